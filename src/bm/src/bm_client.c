@@ -53,11 +53,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /*****************************************************************************/
 #define MODULE_ID LOG_MODULE_ID_CLIENT
 
+// Clients are also hashed by binary MAC for the BSAL event path
+#define BM_CLIENT_HASH_BITS             8
+#define BM_CLIENT_HASH_SIZE             (1 << BM_CLIENT_HASH_BITS)
+
 /*****************************************************************************/
 static ovsdb_update_monitor_t   bm_client_ovsdb_mon;
 static ds_tree_t                bm_clients = DS_TREE_INIT((ds_key_cmp_t *)strcmp,
                                                           bm_client_t,
                                                           dst_node);
+static bm_client_t              *bm_clients_hash[BM_CLIENT_HASH_SIZE];
 
 static c_item_t map_bsal_bands[] = {
     C_ITEM_STR(RADIO_TYPE_NONE,                      "none"),
@@ -124,6 +129,48 @@ static c_item_t map_ovsdb_force_kick[] = {
     C_ITEM_STR(BM_CLIENT_GHOST_DEVICE_KICK,     "ghost_device")
 };
 
+/*****************************************************************************/
+static unsigned int
+bm_client_hash(const os_macaddr_t *mac)
+{
+    uint32_t    hash = 2166136261u;
+    int         i;
+
+    // FNV-1a, the OUI alone spreads poorly across a venue
+    for (i = 0; i < (int)sizeof(mac->addr); i++) {
+        hash = (hash ^ mac->addr[i]) * 16777619u;
+    }
+
+    return (hash ^ (hash >> BM_CLIENT_HASH_BITS)) & (BM_CLIENT_HASH_SIZE - 1);
+}
+
+static void
+bm_client_table_add(bm_client_t *client)
+{
+    unsigned int    bucket = bm_client_hash(&client->macaddr);
+
+    ds_tree_insert(&bm_clients, client, client->mac_addr);
+
+    client->hash_next = bm_clients_hash[bucket];
+    bm_clients_hash[bucket] = client;
+}
+
+static void
+bm_client_table_remove(bm_client_t *client)
+{
+    bm_client_t     **pprev = &bm_clients_hash[bm_client_hash(&client->macaddr)];
+
+    ds_tree_remove(&bm_clients, client);
+
+    for (; *pprev; pprev = &(*pprev)->hash_next) {
+        if (*pprev == client) {
+            *pprev = client->hash_next;
+            break;
+        }
+    }
+    client->hash_next = NULL;
+}
+
 /*****************************************************************************/
 static bool     bm_client_to_bsal_conf_bs(bm_client_t *client,
                                           bm_group_t *group,
@@ -1763,7 +1810,7 @@ bm_client_ovsdb_update_cb(ovsdb_update_monitor_t *self)
             LOGW("Client '%s' failed to add to one or more groups", client->mac_addr);
         }
 
-        ds_tree_insert(&bm_clients, client, client->mac_addr);
+        bm_client_table_add(client);
         LOGN("Added client %s (hwm=%u, lwm=%u, reject=%s, max_rejects=%d/%d sec)",
                                     client->mac_addr,
                                     client->hwm, client->lwm,
@@ -1876,7 +1923,7 @@ bm_client_ovsdb_update_cb(ovsdb_update_monitor_t *self)
         // Remove the client from the Band Steering report list
         bm_stats_remove_client_from_report( client );
 
-        ds_tree_remove(&bm_clients, client);
+        bm_client_table_remove(client);
         bm_client_remove(client);
 
         break;
@@ -2183,6 +2230,7 @@ bm_client_cleanup(void)
 
         client = ds_tree_inext(&iter);
     }
+    memset(bm_clients_hash, 0, sizeof(bm_clients_hash));
 
     return true;
 }
@@ -2700,10 +2748,16 @@ bm_client_find_by_macstr(char *mac_str)
 bm_client_t *
 bm_client_find_by_macaddr(os_macaddr_t mac_addr)
 {
-    char              mac_str[MAC_STR_LEN];
+    bm_client_t       *client;
 
-    sprintf(mac_str, PRI(os_macaddr_lower_t), FMT(os_macaddr_t, mac_addr));
-    return bm_client_find_by_macstr(mac_str);
+    client = bm_clients_hash[bm_client_hash(&mac_addr)];
+    for (; client; client = client->hash_next) {
+        if (!memcmp(client->macaddr.addr, mac_addr.addr, sizeof(mac_addr.addr))) {
+            return client;
+        }
+    }
+
+    return NULL;
 }
 
 bm_client_t *
@@ -2721,7 +2775,7 @@ bm_client_find_or_add_by_macaddr(os_macaddr_t *mac_addr)
         free(client);
         return NULL;
     }
-    ds_tree_insert(&bm_clients, client, client->mac_addr);
+    bm_client_table_add(client);
     LOGN("Added client %s", client->mac_addr);
     return client;
 }
@@ -268,7 +268,7 @@ typedef struct {
     void                        *client;
 } bm_rrm_req_t;
 
-typedef struct {
+typedef struct bm_client {
     char                        mac_addr[MAC_STR_LEN];
     os_macaddr_t                macaddr;
 
@@ -399,6 +399,7 @@ typedef struct {
     unsigned int                active_treshold_bps;
 
     ds_tree_node_t              dst_node;
+    struct bm_client            *hash_next;
 } bm_client_t;
 
 static inline bm_client_ifcfg_t *
@@ -44,6 +44,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <getopt.h>
 #include <stdarg.h>
 #include <linux/types.h>
+#include <stdatomic.h>
 
 #include "bm.h"
 
@@ -55,19 +56,26 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /*****************************************************************************/
 static struct ev_loop *     _evloop = NULL;
 
-static pthread_mutex_t      bm_cb_lock;
+/*
+ * BSAL events are handed from the target threads to the loop through a
+ * multi-producer/single-consumer ring. Producers reserve a slot by moving
+ * the tail and publish it through the slot sequence number, the consumer
+ * only moves the head and events are handled in place.
+ *
+ * A slot whose sequence equals a position is free for that position, it
+ * is ready for the consumer at position + 1.
+ */
 static ev_async             bm_cb_async;
-static ds_dlist_t           bm_cb_queue;
-static int                  bm_cb_queue_len = 0;
+static bsal_event_t         bm_cb_ring[BM_CB_QUEUE_MAX];
+static atomic_uint          bm_cb_seq[BM_CB_QUEUE_MAX];
+static atomic_uint          bm_cb_head;
+static atomic_uint          bm_cb_tail;
+static atomic_uint          bm_cb_drops;
+static unsigned int         bm_cb_drops_seen = 0;
+static bm_events_queue_stats_t bm_cb_stats;
 
 static bool                 _bsal_initialized = false;
 
-typedef struct {
-    bsal_event_t            event;
-
-    ds_dlist_node_t         node;
-} bm_cb_entry_t;
-
 static c_item_t map_bsal_disc_sources[] = {
     C_ITEM_STR(BSAL_DISC_SOURCE_LOCAL,              "Local"),
     C_ITEM_STR(BSAL_DISC_SOURCE_REMOTE,             "Remote")
@@ -121,72 +129,240 @@ static void     bm_events_handle_event(bsal_event_t *event );
 static void
 bm_events_bsal_event_cb(bsal_event_t *event)
 {
-    bm_cb_entry_t       *cb_entry;
-    int                 ret = 0;
+    unsigned int        tail;
+    unsigned int        seq;
+    int                 diff;
+
+    tail = atomic_load_explicit( &bm_cb_tail, memory_order_relaxed );
+    while( true )
+    {
+        seq = atomic_load_explicit( &bm_cb_seq[tail & (BM_CB_QUEUE_MAX - 1)],
+                                    memory_order_acquire );
+        diff = (int)(seq - tail);
+
+        if( diff == 0 ) {
+            // Slot free, reserve it unless another producer was faster
+            if( atomic_compare_exchange_weak_explicit( &bm_cb_tail, &tail, tail + 1,
+                                                       memory_order_relaxed,
+                                                       memory_order_relaxed ) ) {
+                break;
+            }
+        }
+        else if( diff < 0 ) {
+            // Reported from the loop, logging here would only slow the producer
+            atomic_fetch_add_explicit( &bm_cb_drops, 1, memory_order_relaxed );
+            return;
+        }
+        else {
+            tail = atomic_load_explicit( &bm_cb_tail, memory_order_relaxed );
+        }
+    }
 
-    pthread_mutex_lock( &bm_cb_lock );
+    memcpy( &bm_cb_ring[tail & (BM_CB_QUEUE_MAX - 1)], event, sizeof( *event ) );
+    atomic_store_explicit( &bm_cb_seq[tail & (BM_CB_QUEUE_MAX - 1)], tail + 1,
+                           memory_order_release );
 
-    if( bm_cb_queue_len >= BM_CB_QUEUE_MAX ) {
-        LOGW( "BM CB queue full! Ignoring event..." );
-        goto exit;
+    // ev_async_send() is a no-op while the watcher is already pending
+    if( _evloop ) {
+        ev_async_send( _evloop, &bm_cb_async );
     }
 
-    if( !(cb_entry = calloc( 1, sizeof( *cb_entry ))) ) {
-        LOGE( "Failed to allocate memory for BM CB queue object" );
-        goto exit;
+    return;
+}
+
+static void
+bm_events_count_probe(bm_client_stats_t *stats, bsal_event_t *event, time_t now)
+{
+    stats->probe.last = now;
+    if (event->data.probe_req.ssid_null) {
+        stats->probe.last_null = now;
+        stats->probe.null_cnt++;
+        if (event->data.probe_req.blocked) {
+            stats->probe.null_blocked++;
+        }
     }
+    else {
+        stats->probe.last_direct = now;
+        stats->probe.direct_cnt++;
+        if (event->data.probe_req.blocked) {
+            stats->probe.direct_blocked++;
+        }
+    }
+}
 
-    memcpy( &cb_entry->event, event, sizeof( cb_entry->event ) );
+// Account for a probe request superseded by a later one in the same batch
+static void
+bm_events_count_coalesced_probe(bsal_event_t *event)
+{
+    bm_client_stats_t           *stats;
+    bm_client_t                 *client;
 
-    ds_dlist_insert_tail( &bm_cb_queue, cb_entry );
-    bm_cb_queue_len++;
-    if (bm_cb_queue_len > 5)
-        LOGT("bm_cm_queue_len++ (%d)", bm_cb_queue_len);
-    ret = 1;
+    if (!(client = bm_client_find_by_macaddr(*(os_macaddr_t *)&event->data.probe_req.client_addr))) {
+        return;
+    }
 
-exit:
-    pthread_mutex_unlock( &bm_cb_lock );
-    if( ret && _evloop ) {
-            ev_async_send( _evloop, &bm_cb_async );
+    if (!(stats = bm_client_get_stats(client, event->ifname))) {
+        return;
     }
 
-    return;
+    bm_events_count_probe(stats, event, time(NULL));
+}
+
+/*
+ * Mark the probe requests which a later probe request of the same client on
+ * the same interface makes redundant. Blocked probes feed reject detection
+ * and are never coalesced, and any other event of the batch acts as a
+ * barrier so that the relative order with connects and steering is kept.
+ */
+static unsigned int
+bm_events_coalesce_probes(unsigned int head, unsigned int count, bool *skip)
+{
+    bsal_event_t        *seen[BM_CB_BATCH_MAX];
+    bsal_event_t        *event;
+    unsigned int        nseen = 0;
+    unsigned int        coalesced = 0;
+    unsigned int        i;
+    unsigned int        j;
+
+    for (i = count; i-- > 0; ) {
+        event = &bm_cb_ring[(head + i) & (BM_CB_QUEUE_MAX - 1)];
+        skip[i] = false;
+
+        if (event->type != BSAL_EVENT_PROBE_REQ) {
+            nseen = 0;
+            continue;
+        }
+
+        if (event->data.probe_req.blocked) {
+            continue;
+        }
+
+        for (j = 0; j < nseen; j++) {
+            if (!memcmp(seen[j]->data.probe_req.client_addr,
+                        event->data.probe_req.client_addr,
+                        sizeof(event->data.probe_req.client_addr)) &&
+                !strcmp(seen[j]->ifname, event->ifname)) {
+                break;
+            }
+        }
+
+        if (j < nseen) {
+            skip[i] = true;
+            coalesced++;
+        } else {
+            seen[nseen++] = event;
+        }
+    }
+
+    return coalesced;
 }
 
 // Asynchronous callback to process events in CB queue
 static void
 bm_events_async_cb( EV_P_ ev_async *w, int revents )
 {
-    bm_cb_entry_t       *cb_entry;
+    bool                skip[BM_CB_BATCH_MAX];
     bsal_event_t        *event;
+    unsigned int        drops;
+    unsigned int        depth;
+    unsigned int        count;
+    unsigned int        head;
+    unsigned int        tail;
+    unsigned int        i;
+
+    head = atomic_load_explicit( &bm_cb_head, memory_order_relaxed );
 
     while( true )
     {
-        pthread_mutex_lock( &bm_cb_lock );
-        cb_entry = ds_dlist_is_empty( &bm_cb_queue ) ? NULL : ds_dlist_remove_head( &bm_cb_queue );
-        if ( cb_entry )
-        {
-            bm_cb_queue_len--;
-            if (bm_cb_queue_len > 4)
-                LOGT("bm_cm_queue_len-- (%d)", bm_cb_queue_len);
+        // Slots reserved but not published yet are counted, but not taken
+        tail = atomic_load_explicit( &bm_cb_tail, memory_order_relaxed );
+        depth = tail - head;
+
+        if( depth > bm_cb_stats.depth_max ) {
+            bm_cb_stats.depth_max = depth;
+            if (depth > 5)
+                LOGT("bm_cb_queue depth high watermark (%u)", depth);
         }
-        pthread_mutex_unlock( &bm_cb_lock );
 
-        if ( !cb_entry )
+        for( count = 0; count < BM_CB_BATCH_MAX; count++ )
         {
+            i = (head + count) & (BM_CB_QUEUE_MAX - 1);
+            if( atomic_load_explicit( &bm_cb_seq[i], memory_order_acquire ) !=
+                head + count + 1 ) {
+                break;
+            }
+        }
+
+        // The producer still writing the next slot wakes the loop up again
+        if( !count ) {
             break;
         }
 
-        event = &cb_entry->event;
+        bm_cb_stats.coalesced += bm_events_coalesce_probes( head, count, skip );
+        bm_cb_stats.batches++;
 
-        bm_events_handle_event(event);
+        for( i = 0; i < count; i++ )
+        {
+            event = &bm_cb_ring[(head + i) & (BM_CB_QUEUE_MAX - 1)];
+            if( skip[i] ) {
+                bm_events_count_coalesced_probe( event );
+                continue;
+            }
 
-        free( cb_entry );
+            bm_events_handle_event( event );
+        }
+
+        bm_cb_stats.events += count;
+        // Hand the slots back only once the batch was handled in place
+        for( i = 0; i < count; i++ )
+        {
+            atomic_store_explicit( &bm_cb_seq[(head + i) & (BM_CB_QUEUE_MAX - 1)],
+                                   head + i + BM_CB_QUEUE_MAX, memory_order_release );
+        }
+        head += count;
+        atomic_store_explicit( &bm_cb_head, head, memory_order_relaxed );
     }
 
+    drops = atomic_load_explicit( &bm_cb_drops, memory_order_relaxed );
+    if( drops != bm_cb_drops_seen ) {
+        LOGW( "BM CB queue full! Dropped %u events (%u total)",
+              drops - bm_cb_drops_seen, drops );
+        bm_cb_drops_seen = drops;
+    }
+    bm_cb_stats.drops = drops;
+
     return;
 }
 
+static void
+bm_events_queue_init(void)
+{
+    unsigned int        i;
+
+    for( i = 0; i < BM_CB_QUEUE_MAX; i++ ) {
+        atomic_init( &bm_cb_seq[i], i );
+    }
+    atomic_init( &bm_cb_head, 0 );
+    atomic_init( &bm_cb_tail, 0 );
+    atomic_init( &bm_cb_drops, 0 );
+    bm_cb_drops_seen    = 0;
+    memset( &bm_cb_stats, 0, sizeof( bm_cb_stats ) );
+}
+
+void
+bm_events_get_queue_stats(bm_events_queue_stats_t *stats)
+{
+    unsigned int        head;
+    unsigned int        tail;
+
+    head = atomic_load_explicit( &bm_cb_head, memory_order_relaxed );
+    tail = atomic_load_explicit( &bm_cb_tail, memory_order_relaxed );
+
+    *stats = bm_cb_stats;
+    stats->depth = tail - head;
+    stats->drops = atomic_load_explicit( &bm_cb_drops, memory_order_relaxed );
+}
+
 static void
 bm_events_handle_event(bsal_event_t *event)
 {
@@ -237,21 +413,7 @@ bm_events_handle_event(bsal_event_t *event)
                                                     event->data.probe_req.blocked   ?
                                                                             ", BLOCKED" : "");
         last_probe = stats->probe.last;
-        stats->probe.last = now;
-        if (event->data.probe_req.ssid_null) {
-            stats->probe.last_null = now;
-            stats->probe.null_cnt++;
-            if (event->data.probe_req.blocked) {
-                stats->probe.null_blocked++;
-            }
-        }
-        else {
-            stats->probe.last_direct = now;
-            stats->probe.direct_cnt++;
-            if (event->data.probe_req.blocked) {
-                stats->probe.direct_blocked++;
-            }
-        }
+        bm_events_count_probe(stats, event, now);
 
         // If the client is in 'away' mode of client steering,
         // check if it did an RSSI XING
@@ -818,11 +980,7 @@ bm_events_init(struct ev_loop *loop)
     _evloop             = loop;
 
     // Initialize CB queue
-    ds_dlist_init( &bm_cb_queue, bm_cb_entry_t, node );
-    bm_cb_queue_len     = 0;
-
-    // Initialize mutex lock for CB queue
-    pthread_mutex_init( &bm_cb_lock, NULL );
+    bm_events_queue_init();
 
     // Initialize async watcher
     ev_async_init( &bm_cb_async, bm_events_async_cb );
@@ -842,12 +1000,22 @@ bm_events_init(struct ev_loop *loop)
 bool
 bm_events_cleanup(void)
 {
+    bm_events_queue_stats_t stats;
+
     LOGI( "Events cleaning up" );
 
     ev_async_stop( _evloop, &bm_cb_async );
-    pthread_mutex_destroy( &bm_cb_lock );
 
     target_bsal_cleanup();
+
+    bm_events_get_queue_stats( &stats );
+    LOGI( "Events queue: %llu events in %llu batches, %llu probes coalesced, "
+          "max depth %u, %u dropped",
+          (unsigned long long)stats.events,
+          (unsigned long long)stats.batches,
+          (unsigned long long)stats.coalesced,
+          stats.depth_max,
+          stats.drops );
     _bsal_initialized   = false;
     _evloop            = NULL;
 
@@ -31,10 +31,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef BM_EVENTS_H_INCLUDED
 #define BM_EVENTS_H_INCLUDED
 
-#define                 BM_CB_QUEUE_MAX     256
+#define                 BM_CB_QUEUE_MAX     256     // Power of 2
+#define                 BM_CB_BATCH_MAX     32
+
+typedef struct {
+    unsigned int        depth;          // Events waiting in the queue
+    unsigned int        depth_max;      // High watermark seen by the loop
+    unsigned int        drops;          // Events dropped on a full queue
+    uint64_t            events;         // Events taken off the queue
+    uint64_t            batches;        // Batches drained
+    uint64_t            coalesced;      // Probe requests merged in a batch
+} bm_events_queue_stats_t;
 
 extern bool             bm_events_init(struct ev_loop *loop);
 extern bool             bm_events_cleanup(void);
+extern void             bm_events_get_queue_stats(bm_events_queue_stats_t *stats);
 
 void bm_event_action_frame(const char *ifname, const uint8_t *data, unsigned int data_len);
 void bm_events_handle_rssi_xing(bm_client_t *client, bsal_event_t *event);
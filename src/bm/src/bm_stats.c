@@ -969,6 +969,21 @@ bm_stats_steering_parse_event(
     }
 }
 
+static void
+bm_stats_log_events_queue(void)
+{
+    bm_events_queue_stats_t stats;
+
+    bm_events_get_queue_stats(&stats);
+    LOGD("Events queue: depth %u (max %u), %llu events in %llu batches, "
+         "%llu probes coalesced, %u dropped",
+         stats.depth, stats.depth_max,
+         (unsigned long long)stats.events,
+         (unsigned long long)stats.batches,
+         (unsigned long long)stats.coalesced,
+         stats.drops);
+}
+
 static void
 bm_stats_ev_timer_cb(struct ev_loop *loop, ev_timer *watcher, int revents)
 {
@@ -985,6 +1000,8 @@ bm_stats_ev_timer_cb(struct ev_loop *loop, ev_timer *watcher, int revents)
     ds_tree_foreach(bm_groups, group) {
         bm_stats_steering_process_stats(group);
     }
+
+    bm_stats_log_events_queue();
 }
 
 static void
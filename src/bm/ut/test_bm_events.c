@@ -0,0 +1,286 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "target.h"
+#include "unity.h"
+
+/*
+ * The event queue is static to the module, build it in. The BM modules
+ * the handler calls into are stand-ins, see test_bm_mock_fun.c.
+ */
+#include "bm_events.c"
+#include "test_bm.h"
+
+#define TEST_PRODUCERS      4
+#define TEST_PRODUCER_EVENTS 1000
+#define TEST_PRODUCER_ROUNDS 20
+
+const char *test_name = "bm_tests";
+
+static atomic_uint g_test_producers_ready;
+static atomic_uint g_test_producers_done;
+
+void
+setUp(void)
+{
+    memset(&g_test_bm_events, 0, sizeof(g_test_bm_events));
+    bm_events_queue_init();
+}
+
+void
+tearDown(void)
+{
+}
+
+static void
+test_event_init(bsal_event_t *event, bsal_ev_type_t type, const char *ifname)
+{
+    memset(event, 0, sizeof(*event));
+    event->type = type;
+    STRSCPY(event->ifname, ifname);
+}
+
+static void
+test_send_connect(const char *fmt, unsigned int n)
+{
+    bsal_event_t event;
+    char ifname[BSAL_IFNAME_LEN];
+
+    snprintf(ifname, sizeof(ifname), fmt, n);
+    test_event_init(&event, BSAL_EVENT_CLIENT_CONNECT, ifname);
+    bm_events_bsal_event_cb(&event);
+}
+
+static void
+test_drain(void)
+{
+    bm_events_async_cb(NULL, &bm_cb_async, 0);
+}
+
+/**
+ * @brief events are handled in order, in batches, and the slots recycled
+ */
+void
+test_bm_events_enqueue_drain(void)
+{
+    bm_events_queue_stats_t stats;
+    unsigned int round;
+    unsigned int i;
+    char ifname[BSAL_IFNAME_LEN];
+
+    /* Go around the ring a few times */
+    for (round = 0; round < 3; round++)
+    {
+        memset(&g_test_bm_events, 0, sizeof(g_test_bm_events));
+        for (i = 0; i < BM_CB_QUEUE_MAX - 1; i++) test_send_connect("e%u", i);
+
+        bm_events_get_queue_stats(&stats);
+        TEST_ASSERT_EQUAL_UINT(BM_CB_QUEUE_MAX - 1, stats.depth);
+
+        test_drain();
+        TEST_ASSERT_EQUAL_UINT(BM_CB_QUEUE_MAX - 1, g_test_bm_events.handled);
+        for (i = 0; i < BM_CB_QUEUE_MAX - 1; i++)
+        {
+            snprintf(ifname, sizeof(ifname), "e%u", i);
+            TEST_ASSERT_EQUAL_STRING(ifname, g_test_bm_events.ifnames[i]);
+        }
+    }
+
+    bm_events_get_queue_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT(0, stats.depth);
+    TEST_ASSERT_EQUAL_UINT(BM_CB_QUEUE_MAX - 1, stats.depth_max);
+    TEST_ASSERT_EQUAL_UINT64(3 * (BM_CB_QUEUE_MAX - 1), stats.events);
+    TEST_ASSERT_EQUAL_UINT64(3 * ((BM_CB_QUEUE_MAX - 1 + BM_CB_BATCH_MAX - 1) / BM_CB_BATCH_MAX),
+                             stats.batches);
+    TEST_ASSERT_EQUAL_UINT(0, stats.drops);
+
+    /* Nothing queued, nothing handled */
+    test_drain();
+    TEST_ASSERT_EQUAL_UINT(BM_CB_QUEUE_MAX - 1, g_test_bm_events.handled);
+}
+
+/**
+ * @brief events beyond the queue size are dropped and accounted for
+ */
+void
+test_bm_events_overflow(void)
+{
+    bm_events_queue_stats_t stats;
+    unsigned int i;
+
+    for (i = 0; i < BM_CB_QUEUE_MAX + 5; i++) test_send_connect("o%u", i);
+
+    bm_events_get_queue_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT(BM_CB_QUEUE_MAX, stats.depth);
+    TEST_ASSERT_EQUAL_UINT(5, stats.drops);
+
+    /* The oldest events are kept */
+    test_drain();
+    TEST_ASSERT_EQUAL_UINT(BM_CB_QUEUE_MAX, g_test_bm_events.handled);
+    TEST_ASSERT_EQUAL_STRING("o0", g_test_bm_events.ifnames[0]);
+    TEST_ASSERT_EQUAL_UINT(5, bm_cb_drops_seen);
+
+    /* Room again once drained */
+    test_send_connect("o%u", 1000);
+    test_drain();
+    TEST_ASSERT_EQUAL_UINT(BM_CB_QUEUE_MAX + 1, g_test_bm_events.handled);
+    TEST_ASSERT_EQUAL_STRING("o1000", g_test_bm_events.ifnames[BM_CB_QUEUE_MAX]);
+
+    bm_events_get_queue_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT(0, stats.depth);
+    TEST_ASSERT_EQUAL_UINT(5, stats.drops);
+    TEST_ASSERT_EQUAL_UINT64(BM_CB_QUEUE_MAX + 1, stats.events);
+}
+
+/**
+ * @brief redundant probe requests of a batch are counted, not handled
+ */
+void
+test_bm_events_coalesce(void)
+{
+    bm_events_queue_stats_t stats;
+    bsal_event_t event;
+    unsigned int i;
+
+    /* Three probes from one client, a blocked one and a connect barrier */
+    test_event_init(&event, BSAL_EVENT_PROBE_REQ, "p0");
+    event.data.probe_req.client_addr[5] = 1;
+    for (i = 0; i < 3; i++) bm_events_bsal_event_cb(&event);
+
+    event.data.probe_req.blocked = true;
+    bm_events_bsal_event_cb(&event);
+
+    test_send_connect("c%u", 0);
+
+    event.data.probe_req.blocked = false;
+    bm_events_bsal_event_cb(&event);
+
+    test_drain();
+
+    /* Two of the first three probes are redundant, the barrier keeps the last */
+    TEST_ASSERT_EQUAL_UINT(4, g_test_bm_events.handled);
+    TEST_ASSERT_EQUAL_UINT(2, g_test_bm_events.coalesced);
+
+    bm_events_get_queue_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT64(2, stats.coalesced);
+    TEST_ASSERT_EQUAL_UINT64(6, stats.events);
+}
+
+static void *
+test_producer(void *arg)
+{
+    unsigned int id = (unsigned int)(uintptr_t)arg;
+    char fmt[16];
+    unsigned int i;
+
+    snprintf(fmt, sizeof(fmt), "t%u-%%u", id);
+
+    /* Start together to contend for the slots */
+    atomic_fetch_add(&g_test_producers_ready, 1);
+    while (atomic_load(&g_test_producers_ready) < TEST_PRODUCERS);
+
+    for (i = 0; i < TEST_PRODUCER_EVENTS; i++) test_send_connect(fmt, i);
+
+    atomic_fetch_add(&g_test_producers_done, 1);
+    return NULL;
+}
+
+/**
+ * @brief concurrent producers lose nothing silently and keep their order
+ */
+void
+test_bm_events_producers(void)
+{
+    bm_events_queue_stats_t stats;
+    unsigned int next[TEST_PRODUCERS];
+    pthread_t threads[TEST_PRODUCERS];
+    unsigned int round;
+    unsigned int id;
+    unsigned int n;
+    unsigned int i;
+    int rc;
+
+    for (round = 0; round < TEST_PRODUCER_ROUNDS; round++)
+    {
+        memset(&g_test_bm_events, 0, sizeof(g_test_bm_events));
+        bm_events_queue_init();
+
+        atomic_init(&g_test_producers_ready, 0);
+        atomic_init(&g_test_producers_done, 0);
+        for (i = 0; i < TEST_PRODUCERS; i++)
+        {
+            rc = pthread_create(&threads[i], NULL, test_producer, (void *)(uintptr_t)i);
+            TEST_ASSERT_EQUAL_INT(0, rc);
+        }
+
+        /* The loop drains while the producers run */
+        while (atomic_load(&g_test_producers_done) < TEST_PRODUCERS) test_drain();
+        for (i = 0; i < TEST_PRODUCERS; i++) pthread_join(threads[i], NULL);
+        test_drain();
+
+        bm_events_get_queue_stats(&stats);
+        TEST_ASSERT_EQUAL_UINT(0, stats.depth);
+        TEST_ASSERT_EQUAL_UINT(TEST_PRODUCERS * TEST_PRODUCER_EVENTS,
+                               g_test_bm_events.handled + stats.drops);
+        TEST_ASSERT_EQUAL_UINT64(g_test_bm_events.handled, stats.events);
+
+        /* Each producer's events come out whole and in order, maybe with gaps */
+        memset(next, 0, sizeof(next));
+        for (i = 0; i < g_test_bm_events.handled; i++)
+        {
+            rc = sscanf(g_test_bm_events.ifnames[i], "t%u-%u", &id, &n);
+            TEST_ASSERT_EQUAL_INT(2, rc);
+            TEST_ASSERT_TRUE(id < TEST_PRODUCERS);
+            TEST_ASSERT_TRUE(n >= next[id]);
+            next[id] = n + 1;
+        }
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_bm_events_enqueue_drain);
+    RUN_TEST(test_bm_events_overflow);
+    RUN_TEST(test_bm_events_coalesce);
+    RUN_TEST(test_bm_events_producers);
+
+    return UNITY_END();
+}
@@ -0,0 +1,163 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Stand-ins for the BM modules the event queue code depends on. Events
+ * reaching the handler are recorded and stop there: no group claims their
+ * interface.
+ */
+
+#include "bm.h"
+#include "test_bm.h"
+
+struct test_bm_events g_test_bm_events;
+
+radio_type_t
+bm_group_find_radio_type_by_ifname(const char *ifname)
+{
+    if (g_test_bm_events.handled < TEST_BM_EVENTS_MAX)
+    {
+        STRSCPY(g_test_bm_events.ifnames[g_test_bm_events.handled], ifname);
+    }
+    g_test_bm_events.handled++;
+
+    return RADIO_TYPE_NONE;
+}
+
+bm_group_t *
+bm_group_find_by_ifname(const char *ifname)
+{
+    return NULL;
+}
+
+bm_client_t *
+bm_client_find_by_macaddr(os_macaddr_t mac_addr)
+{
+    g_test_bm_events.coalesced++;
+    return NULL;
+}
+
+bm_client_t *
+bm_client_find_or_add_by_macaddr(os_macaddr_t *mac_addr)
+{
+    return NULL;
+}
+
+bool
+bm_client_bs_ifname_allowed(bm_client_t *client, const char *ifname)
+{
+    return true;
+}
+
+void
+bm_client_check_connected(bm_client_t *client, bm_group_t *group, const char *ifname)
+{
+}
+
+void
+bm_client_cs_check_rssi_xing(bm_client_t *client, bsal_event_t *event)
+{
+}
+
+void
+bm_client_disable_client_steering(bm_client_t *client)
+{
+}
+
+void
+bm_client_disconnected(bm_client_t *client)
+{
+}
+
+bm_client_reject_t
+bm_client_get_reject_detection(bm_client_t *client)
+{
+    return BM_CLIENT_REJECT_NONE;
+}
+
+void
+bm_client_handle_ext_activity(bm_client_t *client, const char *ifname, bool active)
+{
+}
+
+void
+bm_client_handle_ext_xing(bm_client_t *client, const char *ifname, bsal_event_t *event)
+{
+}
+
+void
+bm_client_rejected(bm_client_t *client, bsal_event_t *event)
+{
+}
+
+void
+bm_client_reset_last_probe_snr(bm_client_t *client)
+{
+}
+
+void
+bm_client_send_rrm_req(bm_client_t *client, bm_client_rrm_req_type_t rrm_req_type, int delay)
+{
+}
+
+void
+bm_client_set_state(bm_client_t *client, bm_client_state_t state)
+{
+}
+
+bool
+bm_client_update_cs_state(bm_client_t *client)
+{
+    return false;
+}
+
+void
+bm_event_action_frame(const char *ifname, const uint8_t *data, unsigned int data_len)
+{
+}
+
+bool
+bm_kick(bm_client_t *client, bm_kick_type_t type, uint8_t rssi)
+{
+    return true;
+}
+
+void
+bm_kick_measurement(os_macaddr_t macaddr, uint8_t rssi)
+{
+}
+
+void
+bm_kick_cancel_btm_retry_task(bm_client_t *client)
+{
+}
+
+void
+bm_stats_add_event_to_report(bm_client_t *client, bsal_event_t *event,
+                             dpp_bs_client_event_type_t bs_event,
+                             bool backoff_enabled)
+{
+}
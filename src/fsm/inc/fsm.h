@@ -32,6 +32,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sys/sysinfo.h>
 #include <time.h>
 
+#include "ds_dlist.h"
 #include "ds_tree.h"
 #include "fsm_policy.h"
 #include "os_types.h"
@@ -98,6 +99,15 @@ struct fsm_parser_ops
     /* packet parsing handler. Provided by the plugin */
     void (*handler)(struct fsm_session *, struct net_header_parser *);
 
+    /*
+     * batched packets parsing handler. Optional, provided by the plugin.
+     * Hands over the array of packets parsed in one capture wakeup,
+     * in capture order. The packets are only valid for the call duration.
+     * Plugins not providing it get their handler called for each packet.
+     */
+    void (*batch_handler)(struct fsm_session *, struct net_header_parser *,
+                          size_t);
+
     /*
      * service plugin request. Provided to the plugin.
      * Used for backward compatibility:
@@ -125,6 +135,8 @@ struct fsm_web_cat_ops
     char * (*cat2str)(struct fsm_session *, int id);
     void (*get_stats)(struct fsm_session *, struct fsm_url_stats *);
     void (*dns_response)(struct fsm_session *, struct fqdn_pending_req *);
+    /* Asynchronous lookup, completed through fsm_wc_lookup_done() */
+    bool (*categories_lookup)(struct fsm_session *, struct fsm_wc_lookup *);
 };
 
 
@@ -156,6 +168,34 @@ struct fsm_session_conf
 };
 
 
+/**
+ * @brief packet capture backends
+ *
+ * Selected through the pcap_backend other_config key
+ */
+enum fsm_pcap_backend
+{
+    FSM_PCAP_BACKEND_PCAP = 0,    /* libpcap, one capture per session */
+    FSM_PCAP_BACKEND_TPACKET,     /* AF_PACKET TPACKET_V3 ring */
+};
+
+
+struct fsm_tpacket_ring;
+
+/**
+ * @brief batch of parsed packets
+ *
+ * Filled by the capture backends for plugins providing a batch handler
+ */
+struct fsm_pcap_batch
+{
+    struct net_header_parser *parsers;  /* parsed packets */
+    uint8_t *pkts;                      /* packets copies storage */
+    size_t pkt_size;                    /* size of a packet copy */
+    size_t size;                        /* max number of packets */
+    size_t len;                         /* number of batched packets */
+};
+
 /**
  * @brief session pcaps container
  */
@@ -171,6 +211,11 @@ struct fsm_pcaps
     int snaplen;
     int immediate;
     int started;
+    int backend;                     /* enum fsm_pcap_backend */
+    struct fsm_session *session;     /* owning session, tpacket backend */
+    struct fsm_tpacket_ring *ring;   /* shared ring, tpacket backend */
+    ds_dlist_node_t ring_node;       /* ring's sessions list node */
+    struct fsm_pcap_batch batch;     /* packets pending delivery */
 };
 
 
@@ -232,6 +277,32 @@ struct fsm_dpi_dispatcher
 };
 
 
+/**
+ * @brief mac address set entry
+ */
+struct fsm_dpi_mac_slot
+{
+    os_macaddr_t mac;
+    bool used;
+};
+
+
+/**
+ * @brief compiled mac address set
+ *
+ * Binary form of a targeted_devices or excluded_devices value,
+ * with the opensync tags it references resolved.
+ * Open addressed hash table, linear probing.
+ */
+struct fsm_dpi_mac_set
+{
+    struct fsm_dpi_mac_slot *slots;  /* hash table */
+    size_t size;                     /* number of slots, power of 2 */
+    size_t count;                    /* number of mac addresses */
+    bool is_tag;                     /* value is an opensync tag */
+};
+
+
 /**
  * @brief dpi plugin specifics
  */
@@ -240,6 +311,9 @@ struct fsm_dpi_plugin
     struct fsm_session *session;
     char *targets;
     char *excluded_targets;
+    struct fsm_dpi_mac_set targets_set;
+    struct fsm_dpi_mac_set excluded_set;
+    uint32_t targets_gen;            /* bumped on each sets compilation */
     bool bound;
     ds_tree_node_t dpi_node;
 };
@@ -261,6 +335,8 @@ struct fsm_dpi_flow_info
 {
     struct fsm_session *session;
     int decision;
+    uint32_t targets_gen;   /* plugin's targets generation when cached */
+    bool targeted;          /* cached include/exclude decision */
     ds_tree_node_t dpi_node;
 };
 
@@ -394,6 +470,74 @@ fsm_reset_mgr(void);
 void fsm_pcap_close(struct fsm_session *session);
 
 
+/**
+ * @brief processes a captured packet on behalf of a session
+ *
+ * libpcap callback, also fed by the tpacket backend.
+ * @param args the fsm session
+ * @param header the packet capture header
+ * @param bytes the packet
+ */
+void
+fsm_pcap_handler(uint8_t *args, const struct pcap_pkthdr *header,
+                 const uint8_t *bytes);
+
+
+/**
+ * @brief queues a captured packet for a session
+ *
+ * Sessions without a batch handler get the packet processed right away.
+ * @param session the fsm session
+ * @param header the packet capture header
+ * @param bytes the packet
+ * @param copy true if the packet does not outlive the call
+ */
+void
+fsm_pcap_batch_add(struct fsm_session *session,
+                   const struct pcap_pkthdr *header,
+                   const uint8_t *bytes, bool copy);
+
+
+/**
+ * @brief hands the batched packets of a session to its plugin
+ *
+ * @param session the fsm session
+ */
+void
+fsm_pcap_batch_flush(struct fsm_session *session);
+
+
+/**
+ * @brief binds the session to the TPACKET_V3 ring of its tap interface
+ *
+ * The ring is created by the first session capturing on the interface,
+ * and shared with the sessions thereafter.
+ * @param session the fsm session bound to the tap interface
+ * @return true if the session is bound to the ring, false otherwise
+ */
+bool
+fsm_tpacket_open(struct fsm_session *session);
+
+
+/**
+ * @brief unbinds the session from its TPACKET_V3 ring
+ *
+ * The ring is released along its last session.
+ * @param session the fsm session bound to the tap interface
+ */
+void
+fsm_tpacket_close(struct fsm_session *session);
+
+
+/**
+ * @brief logs the capture statistics of a session's TPACKET_V3 ring
+ *
+ * @param session the fsm session bound to the tap interface
+ */
+void
+fsm_tpacket_stats(struct fsm_session *session);
+
+
 /**
  * @brief manager's ovsdb registration routine
  */
@@ -665,6 +809,15 @@ struct fsm_session *
 fsm_dpi_find_dispatcher(struct fsm_session *session);
 
 
+/**
+ * @brief recompiles the mac sets of the dpi plugins using opensync tags
+ *
+ * Called once an opensync tag or tag group got added, updated or removed.
+ */
+void
+fsm_dpi_update_tags(void);
+
+
 void
 fsm_dpi_alloc_flow_context(struct fsm_session *session,
                            struct net_md_stats_accumulator *acc);
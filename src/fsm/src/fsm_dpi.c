@@ -39,6 +39,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <time.h>
 
 #include "os.h"
+#include "os_nif.h"
 #include "util.h"
 #include "ovsdb.h"
 #include "ovsdb_update.h"
@@ -244,6 +245,255 @@ err_send:
 }
 
 
+#define FSM_DPI_MAC_SET_MIN_SIZE 8
+
+/**
+ * @brief hashes a mac address
+ *
+ * @param mac the mac address to hash
+ * @return the hash value
+ */
+static size_t
+fsm_dpi_mac_hash(os_macaddr_t *mac)
+{
+    uint32_t hash;
+    size_t i;
+
+    /* FNV-1a */
+    hash = 2166136261U;
+    for (i = 0; i < sizeof(mac->addr); i++)
+    {
+        hash ^= mac->addr[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+
+/**
+ * @brief looks up the slot of a mac address in a hash table
+ *
+ * @param slots the hash table
+ * @param size the number of slots of the table
+ * @param mac the mac address to look up
+ * @return the slot holding the mac, or the empty slot where to store it
+ */
+static struct fsm_dpi_mac_slot *
+fsm_dpi_mac_set_slot(struct fsm_dpi_mac_slot *slots, size_t size,
+                     os_macaddr_t *mac)
+{
+    struct fsm_dpi_mac_slot *slot;
+    size_t idx;
+    int cmp;
+
+    idx = fsm_dpi_mac_hash(mac) & (size - 1);
+    slot = &slots[idx];
+    while (slot->used)
+    {
+        cmp = memcmp(slot->mac.addr, mac->addr, sizeof(mac->addr));
+        if (cmp == 0) return slot;
+
+        idx = (idx + 1) & (size - 1);
+        slot = &slots[idx];
+    }
+
+    return slot;
+}
+
+
+/**
+ * @brief releases the content of a mac set
+ *
+ * @param set the mac set to reset
+ */
+static void
+fsm_dpi_mac_set_free(struct fsm_dpi_mac_set *set)
+{
+    free(set->slots);
+    memset(set, 0, sizeof(*set));
+}
+
+
+/**
+ * @brief adds a mac address to a mac set
+ *
+ * The set grows to keep its load factor under 1/2.
+ * @param set the mac set to update
+ * @param mac the mac address to add
+ * @return true if the mac is part of the set, false otherwise
+ */
+static bool
+fsm_dpi_mac_set_add(struct fsm_dpi_mac_set *set, os_macaddr_t *mac)
+{
+    struct fsm_dpi_mac_slot *slots;
+    struct fsm_dpi_mac_slot *slot;
+    size_t size;
+    size_t i;
+
+    if ((set->count + 1) * 2 > set->size)
+    {
+        size = (set->size == 0 ? FSM_DPI_MAC_SET_MIN_SIZE : set->size * 2);
+        slots = calloc(size, sizeof(*slots));
+        if (slots == NULL) return false;
+
+        for (i = 0; i < set->size; i++)
+        {
+            if (!set->slots[i].used) continue;
+
+            slot = fsm_dpi_mac_set_slot(slots, size, &set->slots[i].mac);
+            *slot = set->slots[i];
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->size = size;
+    }
+
+    slot = fsm_dpi_mac_set_slot(set->slots, set->size, mac);
+    if (slot->used) return true;
+
+    slot->mac = *mac;
+    slot->used = true;
+    set->count++;
+
+    return true;
+}
+
+
+/**
+ * @brief checks if a mac address belongs to a mac set
+ *
+ * @param set the mac set
+ * @param mac the mac address to check
+ * @return true if the mac is in the set, false otherwise
+ */
+static bool
+fsm_dpi_mac_in_set(struct fsm_dpi_mac_set *set, os_macaddr_t *mac)
+{
+    struct fsm_dpi_mac_slot *slot;
+
+    if (set->count == 0) return false;
+
+    slot = fsm_dpi_mac_set_slot(set->slots, set->size, mac);
+
+    return slot->used;
+}
+
+
+/**
+ * @brief adds the string representation of a mac address to a mac set
+ *
+ * @param set the mac set to update
+ * @param mac_s the string representation of a mac address
+ */
+static void
+fsm_dpi_mac_set_add_str(struct fsm_dpi_mac_set *set, char *mac_s)
+{
+    os_macaddr_t mac;
+    bool rc;
+
+    rc = os_nif_macaddr_from_str(&mac, mac_s);
+    if (!rc)
+    {
+        LOGD("%s: %s is not a mac address", __func__, mac_s);
+        return;
+    }
+
+    rc = fsm_dpi_mac_set_add(set, &mac);
+    if (!rc) LOGE("%s: failed to add %s", __func__, mac_s);
+}
+
+
+/**
+ * @brief compiles an other_config value into a mac set
+ *
+ * @param set the mac set to build
+ * @param val an opensync tag name or the string representation of a mac address
+ */
+static void
+fsm_dpi_compile_mac_set(struct fsm_dpi_mac_set *set, char *val)
+{
+    om_tag_list_entry_t *entry;
+    int match_flags;
+    om_tag_t *tag;
+    int tag_type;
+
+    fsm_dpi_mac_set_free(set);
+    if (val == NULL) return;
+
+    tag_type = om_tag_get_type(val);
+    set->is_tag = (tag_type != NOT_A_OPENSYNC_TAG);
+    if (!set->is_tag)
+    {
+        fsm_dpi_mac_set_add_str(set, val);
+        return;
+    }
+
+    /* The tag might not yet be known. It will be compiled when added */
+    tag = om_tag_find_by_template(val, &match_flags);
+    if (tag == NULL) return;
+
+    ds_tree_foreach(&tag->values, entry)
+    {
+        if (match_flags && !(entry->flags & match_flags)) continue;
+
+        fsm_dpi_mac_set_add_str(set, entry->value);
+    }
+}
+
+
+/**
+ * @brief compiles the targets and excluded targets of a dpi plugin
+ *
+ * Bumping the generation invalidates the decisions cached in the flows.
+ * @param plugin the dpi plugin
+ */
+static void
+fsm_dpi_compile_targets(struct fsm_dpi_plugin *plugin)
+{
+    fsm_dpi_compile_mac_set(&plugin->targets_set, plugin->targets);
+    fsm_dpi_compile_mac_set(&plugin->excluded_set, plugin->excluded_targets);
+
+    plugin->targets_gen++;
+    if (plugin->targets_gen == 0) plugin->targets_gen++;
+
+    LOGD("%s: %s: %zu targeted macs, %zu excluded macs", __func__,
+         plugin->session->name, plugin->targets_set.count,
+         plugin->excluded_set.count);
+}
+
+
+/**
+ * @brief recompiles the mac sets of the dpi plugins using opensync tags
+ *
+ * Called once an opensync tag or tag group got added, updated or removed.
+ */
+void
+fsm_dpi_update_tags(void)
+{
+    struct fsm_dpi_plugin *plugin;
+    struct fsm_session *session;
+    ds_tree_t *sessions;
+
+    sessions = fsm_get_sessions();
+    if (sessions == NULL) return;
+
+    ds_tree_foreach(sessions, session)
+    {
+        if (session->type != FSM_DPI_PLUGIN) continue;
+        if (session->dpi == NULL) continue;
+
+        plugin = &session->dpi->plugin;
+        if (!plugin->targets_set.is_tag && !plugin->excluded_set.is_tag)
+        {
+            continue;
+        }
+
+        fsm_dpi_compile_targets(plugin);
+    }
+}
+
+
 /**
  * @brief check if a fsm session is a dpi session
  *
@@ -284,6 +534,7 @@ fsm_init_dpi_plugin(struct fsm_session *session)
     dpi_plugin->targets = fsm_get_other_config_val(session, "targeted_devices");
     dpi_plugin->excluded_targets = fsm_get_other_config_val(session,
                                                             "excluded_devices");
+    fsm_dpi_compile_targets(dpi_plugin);
 
     ret = fsm_dpi_add_plugin_to_dispatcher(session);
     if (!ret) return ret;
@@ -499,6 +750,14 @@ fsm_free_dpi_plugin(struct fsm_session *session)
     struct net_md_aggregator *aggr;
     struct fsm_session *dispatcher;
 
+    dpi_context = session->dpi;
+    if (dpi_context != NULL)
+    {
+        dpi_plugin = &dpi_context->plugin;
+        fsm_dpi_mac_set_free(&dpi_plugin->targets_set);
+        fsm_dpi_mac_set_free(&dpi_plugin->excluded_set);
+    }
+
     /* Retrieve the dispatcher */
     dispatcher = fsm_dpi_find_dispatcher(session);
     if (dispatcher == NULL) return;
@@ -812,6 +1071,8 @@ fsm_update_dpi_plugin(struct fsm_session *session)
          plugin->targets ? plugin->targets : "None");
     LOGD("%s: %s: excluded_devices: %s", __func__, session->name,
          plugin->excluded_targets ? plugin->excluded_targets : "None") ;
+
+    fsm_dpi_compile_targets(plugin);
 }
 
 
@@ -1028,50 +1289,63 @@ fsm_dpi_mark_for_report(struct fsm_session *session,
 
 
 /**
- * @brief check if a mac address belongs to a given tag or matches a value
+ * @brief check if any mac of a ethernet header belongs to a mac set
  *
- * @param the mac address to check
- * @param val an opensync tag name or the string representation of a mac address
- * @return true if the mac matches the value, false otherwise
+ * @param eth_hdr the ethernet header to check
+ * @param set the compiled mac set
+ * @return true if either mac is in the set, false otherwise
  */
 static bool
-fsm_dpi_find_mac_in_val(os_macaddr_t *mac, char *val)
+fsm_dpi_find_macs_in_set(struct eth_header *eth_hdr,
+                         struct fsm_dpi_mac_set *set)
 {
-    char mac_s[32] = { 0 };
     bool rc;
-    int ret;
-
-    if (val == NULL) return false;
 
-    snprintf(mac_s, sizeof(mac_s), PRI_os_macaddr_lower_t,
-             FMT_os_macaddr_pt(mac));
-
-    rc = om_tag_in(mac_s, val);
+    rc = fsm_dpi_mac_in_set(set, eth_hdr->srcmac);
     if (rc) return true;
 
-    ret = strncmp(mac_s, val, strlen(mac_s));
-    return (ret == 0);
+    return fsm_dpi_mac_in_set(set, eth_hdr->dstmac);
 }
 
 
 /**
- * @brief check if any mac of a ethernet header matches a given tag
+ * @brief check if a flow is targeted by a dpi plugin
  *
- * @param the mac address to check
- * @param val an opensync tag name or the string representation of a mac address
- * @return true if the mac matches the value, false otherwise
+ * The decision is cached in the flow's plugin info and recomputed
+ * only when the plugin's targets got recompiled.
+ * @param plugin the dpi plugin
+ * @param info the flow's plugin info
+ * @param eth_hdr the ethernet header of the flow's current packet
+ * @return true if the plugin should inspect the flow, false otherwise
  */
 static bool
-fsm_dpi_find_macs_in_val(struct eth_header *eth_hdr, char *val)
+fsm_dpi_is_targeted(struct fsm_dpi_plugin *plugin,
+                    struct fsm_dpi_flow_info *info,
+                    struct eth_header *eth_hdr)
 {
-    bool rc;
+    bool excluded;
+    bool included;
 
-    if (val == NULL) return false;
+    if (info->targets_gen == plugin->targets_gen) return info->targeted;
 
-    rc = fsm_dpi_find_mac_in_val(eth_hdr->srcmac, val);
-    rc |= fsm_dpi_find_mac_in_val(eth_hdr->dstmac, val);
+    /* Check if the source or dest device is an excluded target */
+    excluded = fsm_dpi_find_macs_in_set(eth_hdr, &plugin->excluded_set);
 
-    return rc;
+    /* Check if the source or dest device is a target */
+    /* No explicit target means include */
+    if (plugin->targets == NULL)
+    {
+        included = true;
+    }
+    else
+    {
+        included = fsm_dpi_find_macs_in_set(eth_hdr, &plugin->targets_set);
+    }
+
+    info->targeted = (!excluded && included);
+    info->targets_gen = plugin->targets_gen;
+
+    return info->targeted;
 }
 
 
@@ -1095,8 +1369,7 @@ fsm_dispatch_pkt(struct net_header_parser *net_parser)
     struct eth_header *eth_hdr;
     struct fsm_mgr *mgr;
     ds_tree_t *tree;
-    bool excluded;
-    bool included;
+    bool targeted;
     bool drop;
     bool pass;
 
@@ -1125,33 +1398,8 @@ fsm_dispatch_pkt(struct net_header_parser *net_parser)
         plugin_dpi_context = dpi_plugin->dpi;
         plugin = &plugin_dpi_context->plugin;
 
-        /* Check if the source or dest device is an excluded target */
-        if (plugin->excluded_targets == NULL)
-        {
-            excluded = false;
-        }
-        else
-        {
-            excluded = fsm_dpi_find_macs_in_val(eth_hdr,
-                                                plugin->excluded_targets);
-        }
-        if (excluded)
-        {
-            info = ds_tree_next(tree, info);
-            continue;
-        }
-
-        /* Check if the source or dest device is a target */
-        /* No explicit target means include */
-        if (plugin->targets == NULL)
-        {
-            included = true;
-        }
-        else
-        {
-            included = fsm_dpi_find_macs_in_val(eth_hdr, plugin->targets);
-        }
-        if (!included)
+        targeted = fsm_dpi_is_targeted(plugin, info, eth_hdr);
+        if (!targeted)
         {
             info = ds_tree_next(tree, info);
             continue;
@@ -1213,32 +1461,25 @@ fsm_dpi_filter_packet(struct net_header_parser *net_parser)
 
 
 /**
- * @brief the dispatcher plugin's packet handler
+ * @brief updates a flow with a packet and dispatches the packet
  *
- * Retrieves the flow accumulator.
  * If the flow is new, bind it to the dpi plugins
  * Dispatch the packet to the dpi plugins
  * @param session the dispatcher session
  * @param net_parser the parsed packet
+ * @param acc the packet's flow accumulator
  */
 static void
-fsm_dpi_handler(struct fsm_session *session,
-                struct net_header_parser *net_parser)
+fsm_dpi_process_pkt(struct fsm_session *session,
+                    struct net_header_parser *net_parser,
+                    struct net_md_stats_accumulator *acc)
 {
-    struct net_md_stats_accumulator *acc;
     struct fsm_dpi_dispatcher *dispatch;
-    union fsm_dpi_context *dpi_context;
     struct flow_counters counters;
     size_t payload_len;
     bool filter;
 
-    dpi_context = session->dpi;
-    if (dpi_context == NULL) return;
-
-    dispatch = &dpi_context->dispatch;
-
-    acc = fsm_net_parser_to_acc(net_parser, dispatch->aggr);
-    if (acc == NULL) return;
+    dispatch = &session->dpi->dispatch;
 
     counters.packets_count = acc->counters.packets_count + 1;
     counters.bytes_count = acc->counters.bytes_count + net_parser->packet_len;
@@ -1255,6 +1496,74 @@ fsm_dpi_handler(struct fsm_session *session,
     fsm_dispatch_pkt(net_parser);
 }
 
+
+/**
+ * @brief the dispatcher plugin's packet handler
+ *
+ * Retrieves the flow accumulator.
+ * @param session the dispatcher session
+ * @param net_parser the parsed packet
+ */
+static void
+fsm_dpi_handler(struct fsm_session *session,
+                struct net_header_parser *net_parser)
+{
+    struct net_md_stats_accumulator *acc;
+    struct fsm_dpi_dispatcher *dispatch;
+    union fsm_dpi_context *dpi_context;
+
+    dpi_context = session->dpi;
+    if (dpi_context == NULL) return;
+
+    dispatch = &dpi_context->dispatch;
+
+    acc = fsm_net_parser_to_acc(net_parser, dispatch->aggr);
+    if (acc == NULL) return;
+
+    fsm_dpi_process_pkt(session, net_parser, acc);
+}
+
+
+/**
+ * @brief the dispatcher plugin's batched packets handler
+ *
+ * Resolves the flow accumulators of the whole batch first,
+ * then updates the flows and dispatches the packets in capture order.
+ * @param session the dispatcher session
+ * @param net_parsers the parsed packets
+ * @param count the number of packets
+ */
+static void
+fsm_dpi_batch_handler(struct fsm_session *session,
+                      struct net_header_parser *net_parsers,
+                      size_t count)
+{
+    struct net_md_stats_accumulator *acc;
+    struct fsm_dpi_dispatcher *dispatch;
+    union fsm_dpi_context *dpi_context;
+    size_t i;
+
+    dpi_context = session->dpi;
+    if (dpi_context == NULL) return;
+
+    dispatch = &dpi_context->dispatch;
+
+    for (i = 0; i < count; i++)
+    {
+        acc = fsm_net_parser_to_acc(&net_parsers[i], dispatch->aggr);
+        net_parsers[i].acc = acc;
+        if (acc != NULL) __builtin_prefetch(acc, 1);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        acc = net_parsers[i].acc;
+        if (acc == NULL) continue;
+
+        fsm_dpi_process_pkt(session, &net_parsers[i], acc);
+    }
+}
+
 /**
  * @brief releases the dpi context of a flow accumulator
  *
@@ -1412,6 +1721,7 @@ fsm_dispatch_set_ops(struct fsm_session *session)
     /* Set the plugin specific ops */
     dispatch_ops = &session->p_ops->parser_ops;
     dispatch_ops->handler = fsm_dpi_handler;
+    dispatch_ops->batch_handler = fsm_dpi_batch_handler;
 
     session_ops = &session->ops;
     session_ops->periodic = fsm_dpi_periodic;
@@ -59,7 +59,14 @@ fsm_pcap_stats(struct fsm_session *session)
     pcaps = session->pcaps;
     if (pcaps == NULL) return;
 
+    if (pcaps->backend == FSM_PCAP_BACKEND_TPACKET)
+    {
+        fsm_tpacket_stats(session);
+        return;
+    }
+
     pcap = pcaps->pcap;
+    if (pcap == NULL) return;
     memset(&stats, 0, sizeof(stats));
 
     rc = pcap_stats(pcap, &stats);
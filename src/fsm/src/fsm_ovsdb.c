@@ -1179,6 +1179,8 @@ callback_Openflow_Local_Tag(ovsdb_update_monitor_t *mon,
     if (mon->mon_type == OVSDB_UPDATE_MODIFY) {
         om_local_tag_update_from_schema(tag);
     }
+
+    fsm_dpi_update_tags();
 }
 
 
@@ -1202,6 +1204,8 @@ callback_Openflow_Tag(ovsdb_update_monitor_t *mon,
     if (mon->mon_type == OVSDB_UPDATE_MODIFY) {
         om_tag_update_from_schema(tag);
     }
+
+    fsm_dpi_update_tags();
 }
 
 
@@ -1224,6 +1228,8 @@ callback_Openflow_Tag_Group(ovsdb_update_monitor_t *mon,
     if (mon->mon_type == OVSDB_UPDATE_MODIFY) {
         om_tag_group_update_from_schema(tag);
     }
+
+    fsm_dpi_update_tags();
 }
 
 /**
@@ -1397,7 +1403,10 @@ fsm_ovsdb_init(void)
     OVSDB_TABLE_MONITOR(Openflow_Tag, false);
     OVSDB_TABLE_MONITOR(Openflow_Local_Tag, false);
     OVSDB_TABLE_MONITOR(Openflow_Tag_Group, false);
-    OVSDB_TABLE_MONITOR(Node_Config, false);
+    // Only the fsm rows of Node_Config are of interest, let the server filter them
+    OVSDB_TABLE_MONITOR_FW(Node_Config, NULL,
+                           ovsdb_where_simple(SCHEMA_COLUMN(Node_Config, module),
+                                              FSM_NODE_MODULE));
 
     // Initialize the plugin loader routine
     mgr = fsm_get_mgr();
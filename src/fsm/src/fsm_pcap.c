@@ -37,6 +37,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "json_util.h"
 #include "qm_conn.h"
 #include "os_types.h"
+#include "util.h"
 #include "dppline.h"
 
 /* Set of default values for pcaps settings */
@@ -44,14 +45,24 @@ static int g_buf_size = 0;
 static int g_cnt = 1;
 static int g_immediate_mode = 1;
 
+/* Max number of parsed packets handed at once to a batch handler */
+#define FSM_PCAP_BATCH_SIZE 32
+
 #if defined(CONFIG_FSM_PCAP_SNAPLEN) && (CONFIG_FSM_PCAP_SNAPLEN > 0)
 static int g_snaplen = CONFIG_FSM_PCAP_SNAPLEN;
 #else
 static int g_snaplen = 2048;
 #endif
 
-static void
-fsm_pcap_handler(uint8_t * args, const struct pcap_pkthdr *header,
+/**
+ * @brief processes a captured packet on behalf of a session
+ *
+ * @param args the fsm session
+ * @param header the packet capture header
+ * @param bytes the packet
+ */
+void
+fsm_pcap_handler(uint8_t *args, const struct pcap_pkthdr *header,
                  const uint8_t *bytes)
 {
     struct net_header_parser net_parser;
@@ -74,6 +85,156 @@ fsm_pcap_handler(uint8_t * args, const struct pcap_pkthdr *header,
 }
 
 
+/**
+ * @brief allocates a session's batch of parsed packets
+ *
+ * @param session the fsm session
+ * @return true if success, false otherwise
+ */
+static bool
+fsm_pcap_batch_alloc(struct fsm_session *session)
+{
+    struct fsm_pcap_batch *batch;
+    struct fsm_pcaps *pcaps;
+
+    pcaps = session->pcaps;
+    batch = &pcaps->batch;
+
+    batch->parsers = calloc(FSM_PCAP_BATCH_SIZE, sizeof(*batch->parsers));
+    if (batch->parsers == NULL) return false;
+
+    batch->pkt_size = (size_t)(pcaps->snaplen > 0 ? pcaps->snaplen : g_snaplen);
+    batch->pkts = calloc(FSM_PCAP_BATCH_SIZE, batch->pkt_size);
+    if (batch->pkts == NULL)
+    {
+        free(batch->parsers);
+        batch->parsers = NULL;
+        return false;
+    }
+
+    batch->size = FSM_PCAP_BATCH_SIZE;
+    batch->len = 0;
+
+    return true;
+}
+
+
+/**
+ * @brief releases a session's batch of parsed packets
+ *
+ * @param session the fsm session
+ */
+static void
+fsm_pcap_batch_free(struct fsm_session *session)
+{
+    struct fsm_pcap_batch *batch;
+
+    batch = &session->pcaps->batch;
+    free(batch->parsers);
+    free(batch->pkts);
+    memset(batch, 0, sizeof(*batch));
+}
+
+
+/**
+ * @brief hands the batched packets of a session to its plugin
+ *
+ * @param session the fsm session
+ */
+void
+fsm_pcap_batch_flush(struct fsm_session *session)
+{
+    struct fsm_parser_ops *parser_ops;
+    struct fsm_pcap_batch *batch;
+
+    batch = &session->pcaps->batch;
+    if (batch->len == 0) return;
+
+    parser_ops = &session->p_ops->parser_ops;
+    parser_ops->batch_handler(session, batch->parsers, batch->len);
+    batch->len = 0;
+}
+
+
+/**
+ * @brief queues a captured packet for a session
+ *
+ * Sessions without a batch handler get the packet processed right away.
+ * The batch is flushed once full.
+ * @param session the fsm session
+ * @param header the packet capture header
+ * @param bytes the packet
+ * @param copy true if the packet does not outlive the call
+ */
+void
+fsm_pcap_batch_add(struct fsm_session *session,
+                   const struct pcap_pkthdr *header,
+                   const uint8_t *bytes, bool copy)
+{
+    struct net_header_parser *net_parser;
+    struct fsm_parser_ops *parser_ops;
+    struct fsm_pcap_batch *batch;
+    size_t caplen;
+    uint8_t *pkt;
+    size_t len;
+    bool ret;
+
+    parser_ops = &session->p_ops->parser_ops;
+    batch = &session->pcaps->batch;
+    if (parser_ops->batch_handler == NULL)
+    {
+        fsm_pcap_handler((uint8_t *)session, header, bytes);
+        return;
+    }
+
+    if (batch->size == 0)
+    {
+        ret = fsm_pcap_batch_alloc(session);
+        if (!ret)
+        {
+            fsm_pcap_handler((uint8_t *)session, header, bytes);
+            return;
+        }
+    }
+
+    caplen = MIN(header->caplen, batch->pkt_size);
+    pkt = (uint8_t *)bytes;
+    if (copy)
+    {
+        pkt = batch->pkts + (batch->len * batch->pkt_size);
+        memcpy(pkt, bytes, caplen);
+    }
+
+    net_parser = &batch->parsers[batch->len];
+    memset(net_parser, 0, sizeof(*net_parser));
+    net_parser->packet_len = caplen;
+    net_parser->caplen = caplen;
+    net_parser->data = pkt;
+    net_parser->pcap_datalink = session->pcaps->pcap_datalink;
+    len = net_header_parse(net_parser);
+    if (len == 0) return;
+
+    batch->len++;
+    if (batch->len == batch->size) fsm_pcap_batch_flush(session);
+}
+
+
+/**
+ * @brief libpcap callback queuing a packet in the session's batch
+ *
+ * libpcap only guarantees the packet's validity during the callback.
+ */
+static void
+fsm_pcap_batch_handler(uint8_t *args, const struct pcap_pkthdr *header,
+                       const uint8_t *bytes)
+{
+    struct fsm_session *session;
+
+    session = (struct fsm_session *)args;
+    fsm_pcap_batch_add(session, header, bytes, true);
+}
+
+
 /**
  * @brief parse a session's pcap options from ovsdb.
  *
@@ -86,6 +247,7 @@ fsm_get_pcap_options(struct fsm_session *session)
     struct fsm_pcaps *pcaps;
     char *buf_size_str;
     char *snaplen_str;
+    char *backend_str;
     char *mode_str;
     int prev_value;
     char *cnt_str;
@@ -166,6 +328,35 @@ fsm_get_pcap_options(struct fsm_session *session)
              __func__, iface, prev_value, pcaps->immediate);
     }
 
+    /* Check the capture backend option */
+    prev_value = (started ? pcaps->backend : FSM_PCAP_BACKEND_PCAP);
+    if (!started) pcaps->backend = FSM_PCAP_BACKEND_PCAP;
+    backend_str = fsm_get_other_config_val(session, "pcap_backend");
+    if (backend_str != NULL)
+    {
+        if (!strcmp(backend_str, "tpacket_v3"))
+        {
+            pcaps->backend = FSM_PCAP_BACKEND_TPACKET;
+        }
+        else if (!strcmp(backend_str, "pcap"))
+        {
+            pcaps->backend = FSM_PCAP_BACKEND_PCAP;
+        }
+        else
+        {
+            LOGD("%s: %s: invalid capture backend %s", __func__,
+                 iface, backend_str);
+        }
+    }
+    LOGD("%s: %s: capture backend: %d", __func__, iface, pcaps->backend);
+    restart |= (started && (prev_value != pcaps->backend));
+    if (restart)
+    {
+        LOGI("%s: %s: capture backend changed from %d to %d. "
+             "Will restart pcap socket",
+             __func__, iface, prev_value, pcaps->backend);
+    }
+
     pcaps->cnt = g_cnt;
     cnt_str = fsm_get_other_config_val(session, "pcap_cnt");
     if (cnt_str != NULL)
@@ -277,7 +468,8 @@ fsm_pcap_recv_fn(EV_P_ ev_io *ev, int revents)
     pcap_t *pcap = pcaps->pcap;
 
     /* Ready to receive packets */
-    pcap_dispatch(pcap, pcaps->cnt, fsm_pcap_handler, (void *)session);
+    pcap_dispatch(pcap, pcaps->cnt, fsm_pcap_batch_handler, (void *)session);
+    fsm_pcap_batch_flush(session);
 }
 
 
@@ -294,6 +486,11 @@ bool fsm_pcap_open(struct fsm_session *session) {
 
     if (iface == NULL) return true;
 
+    if (pcaps->backend == FSM_PCAP_BACKEND_TPACKET)
+    {
+        return fsm_tpacket_open(session);
+    }
+
     pcaps->pcap = pcap_create(iface, pcap_err);
     if (pcaps->pcap == NULL) {
         LOGN("PCAP initialization failed for interface %s.",
@@ -385,6 +582,12 @@ void fsm_pcap_close(struct fsm_session *session) {
     struct fsm_pcaps *pcaps = session->pcaps;
     pcap_t *pcap = pcaps->pcap;
 
+    if (pcaps->ring != NULL) {
+        fsm_tpacket_close(session);
+    }
+
+    fsm_pcap_batch_free(session);
+
     if (ev_is_active(&pcaps->fsm_evio)) {
         ev_io_stop(mgr->loop, &pcaps->fsm_evio);
     }
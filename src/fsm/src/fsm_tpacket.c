@@ -0,0 +1,641 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <pcap.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ds_dlist.h"
+#include "ds_tree.h"
+#include "fsm.h"
+#include "log.h"
+#include "os.h"
+#include "util.h"
+
+/* Ring geometry. The block size must be a multiple of the page size */
+#define FSM_TPACKET_BLOCK_SIZE (1 << 16)
+#define FSM_TPACKET_FRAME_SIZE (1 << 11)
+#define FSM_TPACKET_DEFAULT_RING_SIZE (1 << 20)
+#define FSM_TPACKET_MIN_BLOCKS 2
+
+/* Block retirement timeouts, in ms */
+#define FSM_TPACKET_IMMEDIATE_TOV 1
+#define FSM_TPACKET_DEFAULT_TOV 10
+
+#define FSM_TPACKET_VLAN_HLEN 4
+
+/**
+ * @brief TPACKET_V3 ring shared by the sessions capturing on an interface
+ */
+struct fsm_tpacket_ring
+{
+    char ifname[IFNAMSIZ];     /* captured interface */
+    int fd;                    /* AF_PACKET socket */
+    uint8_t *map;              /* mmap'ed ring */
+    size_t map_len;            /* ring length */
+    struct tpacket_req3 req;   /* ring geometry */
+    unsigned int cur_block;    /* next block to read */
+    ev_io evio;                /* libev watcher */
+    ds_dlist_t sessions;       /* sessions fed by the ring */
+    size_t num_sessions;       /* number of sessions fed by the ring */
+    bool kernel_filter;        /* single session filter attached in kernel */
+    uint8_t *vlan_buf;         /* scratch buffer to restore vlan tags */
+    size_t vlan_buf_len;       /* scratch buffer length */
+    uint64_t blocks;           /* blocks processed */
+    uint64_t pkts;             /* packets received */
+    uint64_t drops;            /* packets dropped by the kernel */
+    ds_tree_node_t ring_node;
+};
+
+
+/**
+ * @brief compares 2 rings interface names
+ */
+static int
+fsm_tpacket_ring_cmp(void *a, void *b)
+{
+    return strcmp(a, b);
+}
+
+static ds_tree_t g_fsm_tpacket_rings = DS_TREE_INIT(fsm_tpacket_ring_cmp,
+                                                    struct fsm_tpacket_ring,
+                                                    ring_node);
+
+
+/**
+ * @brief restores the vlan tag the kernel stripped from a packet
+ *
+ * @param ring the ring receiving the packet
+ * @param ppd the packet's ring header
+ * @param data the packet
+ * @param caplen the packet captured length, updated on success
+ * @return the packet with its vlan tag, or the original packet
+ */
+static const uint8_t *
+fsm_tpacket_restore_vlan(struct fsm_tpacket_ring *ring,
+                         struct tpacket3_hdr *ppd,
+                         const uint8_t *data, uint32_t *caplen)
+{
+    uint16_t tpid;
+    uint16_t tci;
+    size_t len;
+
+    if (!(ppd->tp_status & TP_STATUS_VLAN_VALID)) return data;
+    if (*caplen < 2 * ETH_ALEN) return data;
+
+    len = *caplen + FSM_TPACKET_VLAN_HLEN;
+    if (len > ring->vlan_buf_len) return data;
+
+    tpid = ETH_P_8021Q;
+    if (ppd->tp_status & TP_STATUS_VLAN_TPID_VALID)
+    {
+        tpid = ppd->hv1.tp_vlan_tpid;
+    }
+    tpid = htons(tpid);
+    tci = htons(ppd->hv1.tp_vlan_tci);
+
+    memcpy(ring->vlan_buf, data, 2 * ETH_ALEN);
+    memcpy(ring->vlan_buf + 2 * ETH_ALEN, &tpid, sizeof(tpid));
+    memcpy(ring->vlan_buf + 2 * ETH_ALEN + sizeof(tpid), &tci, sizeof(tci));
+    memcpy(ring->vlan_buf + 2 * ETH_ALEN + FSM_TPACKET_VLAN_HLEN,
+           data + 2 * ETH_ALEN, *caplen - 2 * ETH_ALEN);
+    *caplen = len;
+
+    return ring->vlan_buf;
+}
+
+
+/**
+ * @brief hands a packet to the sessions of a ring
+ *
+ * When the ring is shared, each session's filter is applied in user space.
+ * @param ring the ring receiving the packet
+ * @param ppd the packet's ring header
+ */
+static void
+fsm_tpacket_dispatch_pkt(struct fsm_tpacket_ring *ring,
+                         struct tpacket3_hdr *ppd)
+{
+    struct pcap_pkthdr header;
+    struct fsm_pcaps *pcaps;
+    const uint8_t *data;
+    uint32_t caplen;
+    int rc;
+
+    data = (uint8_t *)ppd + ppd->tp_mac;
+    caplen = ppd->tp_snaplen;
+    data = fsm_tpacket_restore_vlan(ring, ppd, data, &caplen);
+
+    memset(&header, 0, sizeof(header));
+    header.ts.tv_sec = ppd->tp_sec;
+    header.ts.tv_usec = ppd->tp_nsec / 1000;
+    header.len = ppd->tp_len;
+    if (data == ring->vlan_buf) header.len += FSM_TPACKET_VLAN_HLEN;
+
+    ds_dlist_foreach(&ring->sessions, pcaps)
+    {
+        header.caplen = MIN(caplen, (uint32_t)pcaps->snaplen);
+
+        if (!ring->kernel_filter)
+        {
+            rc = pcap_offline_filter(pcaps->bpf, &header, data);
+            if (rc == 0) continue;
+        }
+
+        /* The restored vlan buffer gets reused by the next packet */
+        fsm_pcap_batch_add(pcaps->session, &header, data,
+                           (data == ring->vlan_buf));
+    }
+}
+
+
+/**
+ * @brief processes the blocks the kernel handed over to user space
+ *
+ * The packets of a block are batched without copy, the sessions' batches
+ * being flushed before the block is given back to the kernel.
+ * @param ring the ring to process
+ */
+static void
+fsm_tpacket_read(struct fsm_tpacket_ring *ring)
+{
+    struct tpacket_block_desc *block;
+    struct tpacket3_hdr *ppd;
+    struct fsm_pcaps *pcaps;
+    uint32_t i;
+
+    for (;;)
+    {
+        block = (struct tpacket_block_desc *)
+            (ring->map + ring->cur_block * ring->req.tp_block_size);
+        if (!(block->hdr.bh1.block_status & TP_STATUS_USER)) return;
+
+        ppd = (struct tpacket3_hdr *)
+            ((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+        for (i = 0; i < block->hdr.bh1.num_pkts; i++)
+        {
+            fsm_tpacket_dispatch_pkt(ring, ppd);
+            ppd = (struct tpacket3_hdr *)((uint8_t *)ppd + ppd->tp_next_offset);
+        }
+
+        /* The batched packets point into the block */
+        ds_dlist_foreach(&ring->sessions, pcaps)
+        {
+            fsm_pcap_batch_flush(pcaps->session);
+        }
+
+        ring->blocks++;
+
+        /* Give the block back to the kernel */
+        __sync_synchronize();
+        block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        ring->cur_block = (ring->cur_block + 1) % ring->req.tp_block_nr;
+    }
+}
+
+
+/**
+ * @brief libev callback of a ring's socket
+ */
+static void
+fsm_tpacket_recv_fn(EV_P_ ev_io *ev, int revents)
+{
+    struct fsm_tpacket_ring *ring;
+
+    (void)loop;
+    (void)revents;
+
+    ring = ev->data;
+    fsm_tpacket_read(ring);
+}
+
+
+/**
+ * @brief updates the ring's kernel filter after a session joined
+ *
+ * A single session gets its filter attached to the socket. Once shared,
+ * the ring keeps capturing unfiltered, the sessions' filters being
+ * applied in user space.
+ * @param ring the ring to update
+ * @param pcaps the pcaps container of the session joining the ring
+ * @return true if success, false otherwise
+ */
+static bool
+fsm_tpacket_update_filter(struct fsm_tpacket_ring *ring,
+                          struct fsm_pcaps *pcaps)
+{
+    struct sock_fprog fprog;
+    int rc;
+
+    if (ring->num_sessions == 1)
+    {
+        memset(&fprog, 0, sizeof(fprog));
+        fprog.len = pcaps->bpf->bf_len;
+        fprog.filter = (struct sock_filter *)pcaps->bpf->bf_insns;
+        rc = setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                        &fprog, sizeof(fprog));
+        if (rc != 0)
+        {
+            LOGE("%s: %s: failed to attach filter: %s", __func__,
+                 ring->ifname, strerror(errno));
+            return false;
+        }
+        ring->kernel_filter = true;
+        return true;
+    }
+
+    if (!ring->kernel_filter) return true;
+
+    rc = setsockopt(ring->fd, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+    if (rc != 0)
+    {
+        LOGE("%s: %s: failed to detach filter: %s", __func__,
+             ring->ifname, strerror(errno));
+        return false;
+    }
+    ring->kernel_filter = false;
+
+    return true;
+}
+
+
+/**
+ * @brief releases a ring
+ *
+ * @param ring the ring to release
+ */
+static void
+fsm_tpacket_free_ring(struct fsm_tpacket_ring *ring)
+{
+    struct fsm_mgr *mgr = fsm_get_mgr();
+
+    if (ev_is_active(&ring->evio)) ev_io_stop(mgr->loop, &ring->evio);
+    if (ring->map != NULL) munmap(ring->map, ring->map_len);
+    if (ring->fd >= 0) close(ring->fd);
+    free(ring->vlan_buf);
+    free(ring);
+}
+
+
+/**
+ * @brief creates the ring capturing on an interface
+ *
+ * The ring is sized after the first session's buffer size.
+ * The socket is not yet bound to the interface.
+ * @param session the first session capturing on the interface
+ * @return the ring if success, NULL otherwise
+ */
+static struct fsm_tpacket_ring *
+fsm_tpacket_alloc_ring(struct fsm_session *session)
+{
+    struct fsm_tpacket_ring *ring;
+    struct fsm_pcaps *pcaps;
+    struct ifreq ifr;
+    size_t ring_size;
+    int version;
+    char *iface;
+    int rc;
+
+    pcaps = session->pcaps;
+    iface = session->conf->if_name;
+
+    ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) return NULL;
+
+    STRSCPY(ring->ifname, iface);
+    ds_dlist_init(&ring->sessions, struct fsm_pcaps, ring_node);
+    ring->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (ring->fd < 0)
+    {
+        LOGE("%s: %s: socket() failed: %s", __func__, iface, strerror(errno));
+        goto err_free_ring;
+    }
+
+    /* The packet parser expects ethernet frames */
+    memset(&ifr, 0, sizeof(ifr));
+    STRSCPY(ifr.ifr_name, iface);
+    rc = ioctl(ring->fd, SIOCGIFHWADDR, &ifr);
+    if (rc < 0)
+    {
+        LOGE("%s: %s: SIOCGIFHWADDR failed: %s", __func__, iface,
+             strerror(errno));
+        goto err_free_ring;
+    }
+    if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER)
+    {
+        LOGE("%s: %s: unsupported link type %d", __func__, iface,
+             ifr.ifr_hwaddr.sa_family);
+        goto err_free_ring;
+    }
+
+    version = TPACKET_V3;
+    rc = setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION,
+                    &version, sizeof(version));
+    if (rc != 0)
+    {
+        LOGE("%s: %s: TPACKET_V3 not supported: %s", __func__, iface,
+             strerror(errno));
+        goto err_free_ring;
+    }
+
+    ring_size = FSM_TPACKET_DEFAULT_RING_SIZE;
+    if (pcaps->buffer_size > 0) ring_size = (size_t)pcaps->buffer_size;
+
+    ring->req.tp_block_size = FSM_TPACKET_BLOCK_SIZE;
+    ring->req.tp_block_nr = ring_size / FSM_TPACKET_BLOCK_SIZE;
+    if (ring->req.tp_block_nr < FSM_TPACKET_MIN_BLOCKS)
+    {
+        ring->req.tp_block_nr = FSM_TPACKET_MIN_BLOCKS;
+    }
+    ring->req.tp_frame_size = FSM_TPACKET_FRAME_SIZE;
+    ring->req.tp_frame_nr = (ring->req.tp_block_size * ring->req.tp_block_nr) /
+                            ring->req.tp_frame_size;
+    ring->req.tp_retire_blk_tov = (pcaps->immediate ?
+                                   FSM_TPACKET_IMMEDIATE_TOV :
+                                   FSM_TPACKET_DEFAULT_TOV);
+    rc = setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING,
+                    &ring->req, sizeof(ring->req));
+    if (rc != 0)
+    {
+        LOGE("%s: %s: failed to set up the ring: %s", __func__, iface,
+             strerror(errno));
+        goto err_free_ring;
+    }
+
+    ring->map_len = (size_t)ring->req.tp_block_size * ring->req.tp_block_nr;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, ring->fd, 0);
+    if (ring->map == MAP_FAILED)
+    {
+        LOGE("%s: %s: failed to map the ring: %s", __func__, iface,
+             strerror(errno));
+        ring->map = NULL;
+        goto err_free_ring;
+    }
+
+    ring->vlan_buf_len = FSM_TPACKET_BLOCK_SIZE + FSM_TPACKET_VLAN_HLEN;
+    ring->vlan_buf = calloc(1, ring->vlan_buf_len);
+    if (ring->vlan_buf == NULL) goto err_free_ring;
+
+    LOGI("%s: %s: ring of %u blocks of %u bytes", __func__, iface,
+         ring->req.tp_block_nr, ring->req.tp_block_size);
+
+    return ring;
+
+err_free_ring:
+    fsm_tpacket_free_ring(ring);
+
+    return NULL;
+}
+
+
+/**
+ * @brief binds a ring's socket to its interface and starts watching it
+ *
+ * @param ring the ring to start
+ * @return true if success, false otherwise
+ */
+static bool
+fsm_tpacket_start_ring(struct fsm_tpacket_ring *ring)
+{
+    struct fsm_mgr *mgr = fsm_get_mgr();
+    struct sockaddr_ll ll;
+    int rc;
+
+    memset(&ll, 0, sizeof(ll));
+    ll.sll_family = AF_PACKET;
+    ll.sll_protocol = htons(ETH_P_ALL);
+    ll.sll_ifindex = if_nametoindex(ring->ifname);
+    if (ll.sll_ifindex == 0)
+    {
+        LOGE("%s: %s: interface index not found", __func__, ring->ifname);
+        return false;
+    }
+
+    rc = bind(ring->fd, (struct sockaddr *)&ll, sizeof(ll));
+    if (rc != 0)
+    {
+        LOGE("%s: %s: bind() failed: %s", __func__, ring->ifname,
+             strerror(errno));
+        return false;
+    }
+
+    ev_io_init(&ring->evio, fsm_tpacket_recv_fn, ring->fd, EV_READ);
+    ring->evio.data = ring;
+    ev_io_start(mgr->loop, &ring->evio);
+
+    return true;
+}
+
+
+/**
+ * @brief compiles a session's capture filter
+ *
+ * @param session the fsm session
+ * @return true if success, false otherwise
+ */
+static bool
+fsm_tpacket_compile_filter(struct fsm_session *session)
+{
+    struct fsm_pcaps *pcaps;
+    char *pkt_filter;
+    pcap_t *pcap;
+    int rc;
+
+    pcaps = session->pcaps;
+    if (pcaps->bpf == NULL) return false;
+
+    pkt_filter = session->conf->pkt_capt_filter;
+
+    pcap = pcap_open_dead(DLT_EN10MB, pcaps->snaplen);
+    if (pcap == NULL) return false;
+
+    rc = pcap_compile(pcap, pcaps->bpf, pkt_filter, 0, PCAP_NETMASK_UNKNOWN);
+    if (rc != 0)
+    {
+        LOGE("Error compiling capture filter: '%s'. PCAP error:\n>>> %s",
+             pkt_filter, pcap_geterr(pcap));
+    }
+    pcap_close(pcap);
+
+    return (rc == 0);
+}
+
+
+/**
+ * @brief binds the session to the TPACKET_V3 ring of its tap interface
+ *
+ * The ring is created by the first session capturing on the interface,
+ * and shared with the sessions thereafter.
+ * @param session the fsm session bound to the tap interface
+ * @return true if the session is bound to the ring, false otherwise
+ */
+bool
+fsm_tpacket_open(struct fsm_session *session)
+{
+    struct fsm_tpacket_ring *ring;
+    struct fsm_pcaps *pcaps;
+    bool created;
+    char *iface;
+    bool ret;
+
+    pcaps = session->pcaps;
+    iface = session->conf->if_name;
+
+    if (pcaps->ring != NULL) return true;
+
+    ret = fsm_tpacket_compile_filter(session);
+    if (!ret) goto error;
+
+    created = false;
+    ring = ds_tree_find(&g_fsm_tpacket_rings, iface);
+    if (ring == NULL)
+    {
+        ring = fsm_tpacket_alloc_ring(session);
+        if (ring == NULL) goto err_free_code;
+        created = true;
+    }
+
+    pcaps->session = session;
+    pcaps->ring = ring;
+    pcaps->pcap_datalink = DLT_EN10MB;
+    ds_dlist_insert_tail(&ring->sessions, pcaps);
+    ring->num_sessions++;
+
+    ret = fsm_tpacket_update_filter(ring, pcaps);
+    if (!ret) goto err_remove_session;
+
+    if (created)
+    {
+        ret = fsm_tpacket_start_ring(ring);
+        if (!ret) goto err_remove_session;
+
+        ds_tree_insert(&g_fsm_tpacket_rings, ring, ring->ifname);
+    }
+
+    pcaps->started = 1;
+    LOGI("%s: %s: %s bound to ring (%zu sessions)", __func__, iface,
+         session->name, ring->num_sessions);
+
+    return true;
+
+err_remove_session:
+    ds_dlist_remove(&ring->sessions, pcaps);
+    ring->num_sessions--;
+    pcaps->ring = NULL;
+    pcaps->session = NULL;
+    if (created) fsm_tpacket_free_ring(ring);
+
+err_free_code:
+    pcap_freecode(pcaps->bpf);
+
+error:
+    LOGE("Interface %s registered for snooping returning error.", iface);
+
+    return false;
+}
+
+
+/**
+ * @brief unbinds the session from its TPACKET_V3 ring
+ *
+ * The ring is released along its last session.
+ * @param session the fsm session bound to the tap interface
+ */
+void
+fsm_tpacket_close(struct fsm_session *session)
+{
+    struct fsm_tpacket_ring *ring;
+    struct fsm_pcaps *pcaps;
+
+    pcaps = session->pcaps;
+    ring = pcaps->ring;
+    if (ring == NULL) return;
+
+    ds_dlist_remove(&ring->sessions, pcaps);
+    ring->num_sessions--;
+    pcaps->ring = NULL;
+    pcaps->session = NULL;
+    pcaps->started = 0;
+
+    if (ring->num_sessions != 0) return;
+
+    LOGI("%s: %s: releasing ring", __func__, ring->ifname);
+    ds_tree_remove(&g_fsm_tpacket_rings, ring);
+    fsm_tpacket_free_ring(ring);
+}
+
+
+/**
+ * @brief logs the capture statistics of a session's TPACKET_V3 ring
+ *
+ * The kernel counters are reset on read, they get accumulated in the ring.
+ * @param session the fsm session bound to the tap interface
+ */
+void
+fsm_tpacket_stats(struct fsm_session *session)
+{
+    struct tpacket_stats_v3 stats;
+    struct fsm_tpacket_ring *ring;
+    socklen_t len;
+    int rc;
+
+    ring = session->pcaps->ring;
+    if (ring == NULL) return;
+
+    memset(&stats, 0, sizeof(stats));
+    len = sizeof(stats);
+    rc = getsockopt(ring->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len);
+    if (rc != 0)
+    {
+        LOGT("%s: %s: PACKET_STATISTICS failed: %s", __func__,
+             ring->ifname, strerror(errno));
+        return;
+    }
+
+    ring->pkts += stats.tp_packets;
+    ring->drops += stats.tp_drops;
+
+    LOGI("%s: %s: packets received: %" PRIu64 ", dropped: %" PRIu64
+         ", blocks: %" PRIu64 ", sessions: %zu",
+         __func__, ring->ifname, ring->pkts, ring->drops, ring->blocks,
+         ring->num_sessions);
+}
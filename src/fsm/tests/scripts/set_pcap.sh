@@ -141,6 +141,29 @@ set_count() {
          \'$(update_other_config_cmd "pcap_count" ${count_val})\'
 }
 
+# get capture backend
+get_backend() {
+    ovsh s Flow_Service_Manager_Config -w handler==${handler} other_config | \
+        awk -F'"' '{for (i=1;i<NF;i++) {if ($(i)=="pcap_backend"){print $(i+2)}}}'
+}
+
+# set capture backend
+set_backend() {
+    backend=$(get_backend)
+    if ! [ -z ${backend} ]; then
+        cmd_save=${cmd}
+        backend_val_save=${backend_val}
+        cmd="delete"
+        backend_val=${backend}
+        eval ovsdb-client transact \
+             \'$(update_other_config_cmd "pcap_backend" ${backend_val})\'
+        backend_val=${backend_val_save}
+        cmd=${cmd_save}
+    fi
+    eval ovsdb-client transact \
+         \'$(update_other_config_cmd "pcap_backend" ${backend_val})\'
+}
+
 # usage
 usage() {
   cat <<EOF
@@ -153,6 +176,7 @@ usage() {
                 --pcap_mode=[  1 | 0 ]
                 --pcap_bsize=<pcap buffer size>
                 --pcap_cnt=<pcap max packets to dispatch>
+                --pcap_backend=[ pcap | tpacket_v3 ]
 EOF
   exit 1
 }
@@ -194,6 +218,11 @@ while getopts "$optspec" optchar; do
                    opt=${OPTARG%=$val}
                    CNT=$val
                    ;;
+               pcap_backend=?* )
+                   val=${LONG_OPTARG}
+                   opt=${OPTARG%=$val}
+                   BACKEND=$val
+                   ;;
                *)
                    if [ "$OPTERR" = 1 ] && [ "${optspec:0:1}" != ":" ]; then
                        echo "Unknown option --${OPTARG}" >&2
@@ -218,6 +247,7 @@ snaplen_val=${SNAPLEN}
 mode_val=${MODE}
 bufsz_val=${BSIZE}
 count_val=${CNT}
+backend_val=${BACKEND}
 
 # Validate the command argument
 if [ -z ${cmd} ]; then
@@ -253,3 +283,8 @@ fi
 if ! [ -z ${count_val} ]; then
     set_count
 fi
+
+# Apply the capture backend update
+if ! [ -z ${backend_val} ]; then
+    set_backend
+fi
@@ -35,6 +35,7 @@ UNIT_TYPE := BIN
 UNIT_SRC := src/fsm_main.c
 UNIT_SRC += src/fsm_ovsdb.c
 UNIT_SRC += src/fsm_pcap.c
+UNIT_SRC += src/fsm_tpacket.c
 UNIT_SRC += src/fsm_event.c
 UNIT_SRC += src/fsm_service.c
 UNIT_SRC += src/fsm_dpi.c
@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <net/if.h>
 
@@ -945,6 +946,11 @@ test_3_dpi_dispatcher_and_plugin(void)
     TEST_ASSERT_NOT_NULL(info);
     TEST_ASSERT_TRUE(info->session == plugin);
 
+    /* Validate that the plugin's targeting decision is cached in the flow */
+    TEST_ASSERT_EQUAL_UINT32(plugin_dpi_context->plugin.targets_gen,
+                             info->targets_gen);
+    TEST_ASSERT_TRUE(info->targeted);
+
     /* Remove the dpi plugin session */
     conf = &g_confs[7];
     fsm_delete_session(conf);
@@ -1240,6 +1246,190 @@ test_6_service_plugin(void)
 }
 
 
+/**
+ * @brief a set of packets replayed by the packets per second benchmark
+ */
+struct test_pkts
+{
+    struct pcap_pkthdr *headers;
+    uint8_t **pkts;
+    size_t count;
+};
+
+
+/**
+ * @brief loads the packets of a recorded pcap file
+ *
+ * @param fname the pcap file
+ * @param pkts the packets container to fill
+ * @param max_pkts the max number of packets to load
+ */
+static void
+test_load_pcap_file(char *fname, struct test_pkts *pkts, size_t max_pkts)
+{
+    char errbuf[PCAP_ERRBUF_SIZE];
+    struct pcap_pkthdr *header;
+    const uint8_t *data;
+    pcap_t *pcap;
+    int rc;
+
+    pcap = pcap_open_offline(fname, errbuf);
+    TEST_ASSERT_NOT_NULL_MESSAGE(pcap, errbuf);
+
+    while (pkts->count < max_pkts)
+    {
+        rc = pcap_next_ex(pcap, &header, &data);
+        if (rc != 1) break;
+
+        pkts->headers[pkts->count] = *header;
+        pkts->pkts[pkts->count] = malloc(header->caplen);
+        TEST_ASSERT_NOT_NULL(pkts->pkts[pkts->count]);
+        memcpy(pkts->pkts[pkts->count], data, header->caplen);
+        pkts->count++;
+    }
+    pcap_close(pcap);
+}
+
+
+/**
+ * @brief adds a built-in packet to the packets container
+ */
+static void
+test_add_pkt(struct test_pkts *pkts, const uint8_t *pkt, size_t len)
+{
+    memset(&pkts->headers[pkts->count], 0, sizeof(struct pcap_pkthdr));
+    pkts->headers[pkts->count].caplen = len;
+    pkts->headers[pkts->count].len = len;
+    pkts->pkts[pkts->count] = malloc(len);
+    TEST_ASSERT_NOT_NULL(pkts->pkts[pkts->count]);
+    memcpy(pkts->pkts[pkts->count], pkt, len);
+    pkts->count++;
+}
+
+
+/**
+ * @brief replays packets through the dpi dispatcher
+ *
+ * @param dispatcher the dpi dispatcher session
+ * @param pkts the packets to replay
+ * @param nloops the number of times the packets are replayed
+ * @param batch use the batched delivery if true, per packet delivery otherwise
+ * @return the number of packets per second
+ */
+static double
+test_replay_pkts(struct fsm_session *dispatcher, struct test_pkts *pkts,
+                 size_t nloops, bool batch)
+{
+    struct timespec start;
+    struct timespec end;
+    double elapsed;
+    size_t i, n;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (n = 0; n < nloops; n++)
+    {
+        for (i = 0; i < pkts->count; i++)
+        {
+            if (batch)
+            {
+                fsm_pcap_batch_add(dispatcher, &pkts->headers[i],
+                                   pkts->pkts[i], true);
+            }
+            else
+            {
+                fsm_pcap_handler((uint8_t *)dispatcher, &pkts->headers[i],
+                                 pkts->pkts[i]);
+            }
+        }
+        if (batch) fsm_pcap_batch_flush(dispatcher);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec);
+    elapsed += (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return (pkts->count * nloops) / elapsed;
+}
+
+
+/**
+ * @brief measures the dpi dispatcher packets per second rate
+ *
+ * Replays the packets of the pcap file pointed by the FSM_UT_PCAP
+ * environment variable, or built-in packets, through the per packet
+ * and the batched delivery paths.
+ */
+void
+test_dpi_dispatcher_pps(void)
+{
+    struct schema_Flow_Service_Manager_Config *conf;
+    struct fsm_parser_ops *dispatch_ops;
+    struct fsm_session *dispatcher;
+    struct fsm_session *plugin;
+    struct test_pkts pkts;
+    size_t max_pkts;
+    ds_tree_t *sessions;
+    double batch_pps;
+    size_t nloops;
+    double pkt_pps;
+    char *fname;
+    size_t i;
+
+    /* Add a dpi plugin session */
+    conf = &g_confs[7];
+    fsm_add_session(conf);
+    sessions = fsm_get_sessions();
+    plugin = ds_tree_find(sessions, conf->handler);
+    TEST_ASSERT_NOT_NULL(plugin);
+
+    /* Add a dpi dispatcher session */
+    conf = &g_confs[6];
+    fsm_add_session(conf);
+    dispatcher = ds_tree_find(sessions, conf->handler);
+    TEST_ASSERT_NOT_NULL(dispatcher);
+    TEST_ASSERT_NOT_NULL(dispatcher->pcaps);
+
+    dispatch_ops = &dispatcher->p_ops->parser_ops;
+    TEST_ASSERT_NOT_NULL(dispatch_ops->batch_handler);
+
+    max_pkts = 10000;
+    memset(&pkts, 0, sizeof(pkts));
+    pkts.headers = calloc(max_pkts, sizeof(*pkts.headers));
+    TEST_ASSERT_NOT_NULL(pkts.headers);
+    pkts.pkts = calloc(max_pkts, sizeof(*pkts.pkts));
+    TEST_ASSERT_NOT_NULL(pkts.pkts);
+
+    fname = getenv("FSM_UT_PCAP");
+    if (fname != NULL)
+    {
+        test_load_pcap_file(fname, &pkts, max_pkts);
+    }
+    else
+    {
+        test_add_pkt(&pkts, pkt372, sizeof(pkt372));
+        test_add_pkt(&pkts, pkt486, sizeof(pkt486));
+    }
+    TEST_ASSERT_TRUE(pkts.count != 0);
+
+    nloops = (100000 / pkts.count) + 1;
+    pkt_pps = test_replay_pkts(dispatcher, &pkts, nloops, false);
+    batch_pps = test_replay_pkts(dispatcher, &pkts, nloops, true);
+    LOGI("%s: %zu packets: per packet: %.0f pps, batched: %.0f pps",
+         __func__, pkts.count, pkt_pps, batch_pps);
+
+    /* Validate that the batch got fully delivered */
+    TEST_ASSERT_EQUAL_UINT(0, dispatcher->pcaps->batch.len);
+
+    for (i = 0; i < pkts.count; i++) free(pkts.pkts[i]);
+    free(pkts.pkts);
+    free(pkts.headers);
+
+    /* Remove the dpi plugin session */
+    conf = &g_confs[7];
+    fsm_delete_session(conf);
+}
+
+
 int
 main(int argc, char *argv[])
 {
@@ -1269,6 +1459,7 @@ main(int argc, char *argv[])
     RUN_TEST(test_4_dpi_dispatcher_and_plugin);
     RUN_TEST(test_5_dpi_dispatcher_and_plugin);
     RUN_TEST(test_6_service_plugin);
+    RUN_TEST(test_dpi_dispatcher_pps);
 
     return UNITY_END();
 }
@@ -31,6 +31,7 @@ UNIT_TYPE := TEST_BIN
 UNIT_SRC := test_fsm_core.c
 UNIT_SRC += ../src/fsm_ovsdb.c
 UNIT_SRC += ../src/fsm_pcap.c
+UNIT_SRC += ../src/fsm_tpacket.c
 UNIT_SRC += ../src/fsm_event.c
 UNIT_SRC += ../src/fsm_service.c
 UNIT_SRC += ../src/fsm_dpi.c
@@ -27,6 +27,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef CT_STATS_H_INCLUDED
 #define CT_STATS_H_INCLUDED
 
+#include <ev.h>
 #include <libmnl/libmnl.h>
 
 #include "fcm.h"
@@ -70,6 +71,47 @@ typedef struct ctflow_info
     ds_dlist_node_t dl_node;
 } ctflow_info_t;
 
+/**
+ * Conntrack tuple in its netlink form. Addresses and ports are kept in
+ * network order, the tuple zone as read from CTA_TUPLE_ZONE.
+ */
+typedef struct ct_tuple
+{
+    uint8_t src_ip[16];
+    uint8_t dst_ip[16];
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t zone;
+    uint8_t proto;
+    uint8_t family;
+} ct_tuple_t;
+
+typedef struct ct_conn_key
+{
+    uint16_t zone; // CTA_ZONE, host order
+    ct_tuple_t orig;
+} ct_conn_key_t;
+
+/**
+ * Conntrack entry of the flow table fed by the conntrack events
+ */
+typedef struct ct_conn
+{
+    ct_conn_key_t key;
+    ct_tuple_t reply;
+    pkts_ct_info_t orig_pkts;
+    pkts_ct_info_t reply_pkts;
+    bool has_protoinfo;
+    bool has_orig_pkts;
+    bool has_reply_pkts;
+    bool start;
+    bool end;
+    bool refresh;   // counters to query at the next collection
+    bool destroyed; // reported at the next collection, then freed
+    uint32_t gen;   // last resync dump the entry was seen in
+    ds_tree_node_t conn_tnode;
+} ct_conn_t;
+
 struct flow_tracker
 {
     ctflow_info_t *flowptr;
@@ -109,6 +151,18 @@ typedef struct flow_stats_mgr_
     int max_sessions;
     flow_stats_t *active;
     bool debug;
+
+    /* conntrack events */
+    bool ct_events;             // flow table maintained from the events
+    bool ct_resync;             // events were lost, dump at next collection
+    struct mnl_socket *ct_ev_mnl;
+    struct ev_io ct_ev_io;
+    struct mnl_socket *ct_req_mnl;
+    uint32_t ct_seq;
+    uint32_t ct_gen;
+    ds_tree_t ct_conns;
+    size_t ct_conns_count;
+    ct_conn_t *ct_sweep;        // next entry of the counters sweep
 } flow_stats_mgr_t;
 
 
@@ -130,6 +184,12 @@ ct_stats_get_ct_flow(int af_family);
 int
 data_cb(const struct nlmsghdr *nlh, void *data);
 
+int
+ct_stats_conn_cb(const struct nlmsghdr *nlh, void *data);
+
+void
+ct_stats_conn_collect(flow_stats_t *ct_stats);
+
 void
 ct_stats_collect_cb(fcm_collect_plugin_t *collector);
 
@@ -33,6 +33,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <arpa/inet.h>
 #include <dlfcn.h>
 #include "os_types.h"
@@ -65,6 +66,19 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <linux/netfilter/nf_conntrack_tcp.h>
 
+/* receive buffer of the conntrack events socket */
+#define CT_STATS_EV_RCVBUF     (4 * 1024 * 1024)
+
+/* max events read per event socket wakeup */
+#define CT_STATS_EV_BURST      (64)
+
+/* conntrack queries sent at once, and their max length */
+#define CT_STATS_QUERY_CHUNK   (32)
+#define CT_STATS_QUERY_MSG_LEN (160)
+
+/* flows not reported by events whose counters are read per collection */
+#define CT_STATS_SWEEP_MAX     (512)
+
 /**
  * IMC server used for fsm -> fcm flow tags communication
  */
@@ -600,20 +614,18 @@ parse_tuple_cb(const struct nlattr *attr, void *data)
 
 
 /**
- * @brief translates conntrack tuple to ct_stats flow
+ * @brief translates a netlink conntrack tuple
  *
  * @param nest the netlink attribute
- * @param flow the ct_stats flow to update
+ * @param tuple the tuple to fill
  * @return MNL_CB_OK when successful, -1 otherwise
  */
 static int
-get_tuple(const struct nlattr *nest, ct_flow_t *flow)
+get_tuple(const struct nlattr *nest, ct_tuple_t *tuple)
 {
     struct nlattr *proto_tb[CTA_PROTO_MAX+1];
     struct nlattr *tb[CTA_TUPLE_MAX+1];
     struct nlattr *ip_tb[CTA_IP_MAX+1];
-    struct in6_addr *in6;
-    struct in_addr *in;
     int rc;
 
     memset(tb, 0, (CTA_TUPLE_MAX+1) * sizeof(tb[0]));
@@ -630,29 +642,30 @@ get_tuple(const struct nlattr *nest, ct_flow_t *flow)
 
         if (ip_tb[CTA_IP_V4_SRC] != NULL)
         {
-            in = mnl_attr_get_payload(ip_tb[CTA_IP_V4_SRC]);
-            ct_stats_populate_sockaddr(AF_INET, &in->s_addr,
-                                       &flow->layer3_info.src_ip);
+            memcpy(tuple->src_ip, mnl_attr_get_payload(ip_tb[CTA_IP_V4_SRC]),
+                   sizeof(struct in_addr));
+            tuple->family = AF_INET;
         }
 
         if (ip_tb[CTA_IP_V4_DST] != NULL)
         {
-            in = mnl_attr_get_payload(ip_tb[CTA_IP_V4_DST]);
-            ct_stats_populate_sockaddr(AF_INET, &in->s_addr,
-                                       &flow->layer3_info.dst_ip);
+            memcpy(tuple->dst_ip, mnl_attr_get_payload(ip_tb[CTA_IP_V4_DST]),
+                   sizeof(struct in_addr));
+            tuple->family = AF_INET;
         }
 
         if (ip_tb[CTA_IP_V6_SRC] != NULL)
         {
-            in6 = mnl_attr_get_payload(ip_tb[CTA_IP_V6_SRC]);
-            ct_stats_populate_sockaddr(AF_INET6, in6->s6_addr,
-                                       &flow->layer3_info.src_ip);
+            memcpy(tuple->src_ip, mnl_attr_get_payload(ip_tb[CTA_IP_V6_SRC]),
+                   sizeof(struct in6_addr));
+            tuple->family = AF_INET6;
         }
+
         if (ip_tb[CTA_IP_V6_DST] != NULL)
         {
-           in6 = mnl_attr_get_payload(ip_tb[CTA_IP_V6_DST]);
-           ct_stats_populate_sockaddr(AF_INET6, in6->s6_addr,
-                                      &flow->layer3_info.dst_ip);
+            memcpy(tuple->dst_ip, mnl_attr_get_payload(ip_tb[CTA_IP_V6_DST]),
+                   sizeof(struct in6_addr));
+            tuple->family = AF_INET6;
         }
     }
 
@@ -670,19 +683,19 @@ get_tuple(const struct nlattr *nest, ct_flow_t *flow)
         if (proto_tb[CTA_PROTO_NUM] != NULL)
         {
             val8 = mnl_attr_get_u8(proto_tb[CTA_PROTO_NUM]);
-            flow->layer3_info.proto_type = val8;
+            tuple->proto = val8;
         }
 
         if (proto_tb[CTA_PROTO_SRC_PORT] != NULL)
         {
             val16 = mnl_attr_get_u16(proto_tb[CTA_PROTO_SRC_PORT]);
-            flow->layer3_info.src_port = val16;
+            tuple->src_port = val16;
         }
 
         if (proto_tb[CTA_PROTO_DST_PORT] != NULL)
         {
             val16 = mnl_attr_get_u16(proto_tb[CTA_PROTO_DST_PORT]);
-            flow->layer3_info.dst_port = val16;
+            tuple->dst_port = val16;
         }
 
 #ifdef CT_ICMP_SUPPORT
@@ -707,8 +720,8 @@ get_tuple(const struct nlattr *nest, ct_flow_t *flow)
     }
     if (tb[CTA_TUPLE_ZONE] != NULL)
     {
-        flow->ct_zone = mnl_attr_get_u16(tb[CTA_TUPLE_ZONE]);
-        LOGD("%s: Tuple ct_zone: %d", __func__, ntohs(flow->ct_zone));
+        tuple->zone = mnl_attr_get_u16(tb[CTA_TUPLE_ZONE]);
+        LOGD("%s: Tuple ct_zone: %d", __func__, ntohs(tuple->zone));
     }
     return MNL_CB_OK;
 }
@@ -783,14 +796,14 @@ parse_tcp_protoinfo(const struct nlattr *attr, void *data)
 
 
 /**
- * @brief translates conntrack protoinfo to ct_stats flow
+ * @brief translates conntrack protoinfo to a conntrack entry
  *
  * @param nest the netlink attribute
- * @param flow the ct_stats flow to update
+ * @param conn the conntrack entry to update
  * @return MNL_CB_OK when successful, -1 otherwise
  */
 static int
-get_protoinfo(const struct nlattr *nest, ct_flow_t *flow)
+get_protoinfo(const struct nlattr *nest, ct_conn_t *conn)
 {
     struct nlattr *tb[CTA_PROTOINFO_MAX + 1];
     int rc;
@@ -818,7 +831,7 @@ get_protoinfo(const struct nlattr *nest, ct_flow_t *flow)
             case TCP_CONNTRACK_SYN_SENT:
             case TCP_CONNTRACK_SYN_RECV:
             case TCP_CONNTRACK_ESTABLISHED:
-                flow->start = true;
+                conn->start = true;
                 LOGD("%s: TCP Flow started", __func__);
                 break;
 
@@ -828,7 +841,7 @@ get_protoinfo(const struct nlattr *nest, ct_flow_t *flow)
             case TCP_CONNTRACK_TIME_WAIT:
             case TCP_CONNTRACK_CLOSE:
             case TCP_CONNTRACK_TIMEOUT_MAX:
-                flow->end = true;
+                conn->end = true;
                 LOGD("%s: TCP Flow ended", __func__);
                 break;
 
@@ -891,14 +904,14 @@ data_attr_cb(const struct nlattr *attr, void *data)
 
 
 /**
- * @brief translates conntrack counters to ct_stats flow
+ * @brief translates conntrack counters
  *
  * @param nest the netlink attribute
- * @param flow the ct_stats flow to update
+ * @param pkts the counters to update
  * @return MNL_CB_OK when successful, -1 otherwise
  */
 static int
-get_counter(const struct nlattr *nest, ct_flow_t *_flow)
+get_counter(const struct nlattr *nest, pkts_ct_info_t *pkts)
 {
     struct nlattr *count_tb[CTA_COUNTERS_MAX+1];
     uint64_t val64;
@@ -912,25 +925,25 @@ get_counter(const struct nlattr *nest, ct_flow_t *_flow)
     if (count_tb[CTA_COUNTERS32_PACKETS] != NULL)
     {
         val32 = ntohl(mnl_attr_get_u32(count_tb[CTA_COUNTERS32_PACKETS]));
-        _flow->pkt_info.pkt_cnt = val32;
+        pkts->pkt_cnt = val32;
     }
 
     if (count_tb[CTA_COUNTERS_PACKETS] != NULL)
     {
         val64 = be64toh(mnl_attr_get_u64(count_tb[CTA_COUNTERS_PACKETS]));
-        _flow->pkt_info.pkt_cnt = val64;
+        pkts->pkt_cnt = val64;
     }
 
     if (count_tb[CTA_COUNTERS32_BYTES] != NULL)
     {
         val32 = ntohl(mnl_attr_get_u32(count_tb[CTA_COUNTERS32_BYTES]));
-        _flow->pkt_info.bytes = val32;
+        pkts->bytes = val32;
     }
 
     if (count_tb[CTA_COUNTERS_BYTES] != NULL)
     {
         val64 = be64toh(mnl_attr_get_u64(count_tb[CTA_COUNTERS_BYTES]));
-        _flow->pkt_info.bytes = val64;
+        pkts->bytes = val64;
     }
 
     return MNL_CB_OK;
@@ -938,77 +951,123 @@ get_counter(const struct nlattr *nest, ct_flow_t *_flow)
 
 
 /**
- * @brief callback parsing the content of a netlink message
+ * @brief translates a conntrack tuple to a ct_stats flow
  *
- * @param nhl the netlink header message
- * @param data the opaque context passed to mnl processing
- * @return MNL_CB_OK when successful, -1 otherwise
+ * @param tuple the conntrack tuple
+ * @param flow the ct_stats flow to fill
  */
-int
-data_cb(const struct nlmsghdr *nlh, void *data)
+static void
+ct_stats_tuple_to_flow(ct_tuple_t *tuple, ct_flow_t *flow)
 {
-    struct nlattr *tb[CTA_MAX+1];
-    ctflow_info_t *flow_info_1;
-    ctflow_info_t *flow_info;
-    flow_stats_t *ct_stats;
-    struct nfgenmsg *nfg;
-    ct_flow_t *flow_1;
-    uint16_t ct_zone;
-    ct_flow_t *flow;
-    int rc;
-    int af;
+    layer3_ct_info_t *l3;
 
-    memset(tb, 0, (CTA_MAX+1) * sizeof(tb[0]));
-    ct_stats = (flow_stats_t *)data;
-    nfg = mnl_nlmsg_get_payload(nlh);
+    l3 = &flow->layer3_info;
+    if (tuple->family != 0)
+    {
+        ct_stats_populate_sockaddr(tuple->family, tuple->src_ip, &l3->src_ip);
+        ct_stats_populate_sockaddr(tuple->family, tuple->dst_ip, &l3->dst_ip);
+    }
+    l3->src_port = tuple->src_port;
+    l3->dst_port = tuple->dst_port;
+    l3->proto_type = tuple->proto;
+    flow->ct_zone = tuple->zone;
+}
 
-    rc = mnl_attr_parse(nlh, sizeof(*nfg), data_attr_cb, tb);
-    if (rc < 0) return MNL_CB_ERROR;
 
+/**
+ * @brief translates the attributes of a conntrack message
+ *
+ * @param tb the table of <attribute, value> of the message
+ * @param conn the conntrack entry to fill
+ * @return true if both tuples were retrieved, false otherwise
+ */
+static bool
+ct_stats_get_conn(struct nlattr **tb, ct_conn_t *conn)
+{
+    int rc;
+
+    memset(conn, 0, sizeof(*conn));
+
+    /* Zone = 0 flows will not have CTA_ZONE */
     if (tb[CTA_ZONE] != NULL)
     {
-        ct_zone = ntohs(mnl_attr_get_u16(tb[CTA_ZONE]));
+        conn->key.zone = ntohs(mnl_attr_get_u16(tb[CTA_ZONE]));
     }
-    else
+
+    if (tb[CTA_TUPLE_ORIG] == NULL) return false;
+
+    rc = get_tuple(tb[CTA_TUPLE_ORIG], &conn->key.orig);
+    if (rc < 0) return false;
+
+    if (tb[CTA_TUPLE_REPLY] == NULL) return false;
+
+    rc = get_tuple(tb[CTA_TUPLE_REPLY], &conn->reply);
+    if (rc < 0) return false;
+
+    if (tb[CTA_PROTOINFO] != NULL)
     {
-        ct_zone = 0; /* Zone = 0 flows will not have CTA_ZONE */
+        rc = get_protoinfo(tb[CTA_PROTOINFO], conn);
+        if (rc < 0) return false;
+        conn->has_protoinfo = true;
     }
 
-    LOGT("%s: Lookup IP flow for ct_zone: %d, retrieved: %d", __func__,
-         ct_stats->ct_zone, ct_zone);
+    if (tb[CTA_COUNTERS_ORIG] != NULL)
+    {
+        rc = get_counter(tb[CTA_COUNTERS_ORIG], &conn->orig_pkts);
+        if (rc < 0) return false;
+        conn->has_orig_pkts = true;
+    }
 
-    if (ct_stats->ct_zone != USHRT_MAX &&
-        ct_stats->ct_zone != ct_zone) return MNL_CB_OK;
+    if (tb[CTA_COUNTERS_REPLY] != NULL)
+    {
+        rc = get_counter(tb[CTA_COUNTERS_REPLY], &conn->reply_pkts);
+        conn->has_reply_pkts = (rc == MNL_CB_OK);
+    }
 
-    LOGT("%s: Included IP flow for ct_zone: %d", __func__,
-          ct_zone);
+    return true;
+}
 
-    flow_info = calloc(1, sizeof(struct ctflow_info));
-    if(flow_info == NULL) return MNL_CB_OK;
-    flow =  &flow_info->flow;
 
-    flow_info_1 = calloc(1, sizeof(struct ctflow_info));
-    if(flow_info_1 == NULL) goto flow_info_free;
-    flow_1 =  &flow_info_1->flow;
+/**
+ * @brief adds the flows of a conntrack entry to the session's flow list
+ *
+ * @param ct_stats the session
+ * @param conn the conntrack entry
+ */
+static void
+ct_stats_add_conn(flow_stats_t *ct_stats, ct_conn_t *conn)
+{
+    ctflow_info_t *flow_info_1;
+    ctflow_info_t *flow_info;
+    ct_flow_t *flow_1;
+    ct_flow_t *flow;
+    int af;
+
+    if (conn->key.orig.proto != 17 && !conn->has_protoinfo)
+    {
+        LOGT("%s: Missing protocol info.Dropping the ct_flow", __func__);
+        return;
+    }
 
-    if (tb[CTA_TUPLE_ORIG] == NULL) goto flow_info_free;
+    if (!conn->has_orig_pkts) return;
 
-    rc = get_tuple(tb[CTA_TUPLE_ORIG], flow);
-    if (rc < 0) goto flow_info_1_free;
+    flow_info = calloc(1, sizeof(struct ctflow_info));
+    if (flow_info == NULL) return;
+    flow = &flow_info->flow;
 
-    if (tb[CTA_TUPLE_REPLY] == NULL) goto flow_info_1_free;
+    flow_info_1 = calloc(1, sizeof(struct ctflow_info));
+    if (flow_info_1 == NULL) goto flow_info_free;
+    flow_1 = &flow_info_1->flow;
 
-    rc = get_tuple(tb[CTA_TUPLE_REPLY], flow_1);
-    if (rc < 0) goto flow_info_1_free;
+    ct_stats_tuple_to_flow(&conn->key.orig, flow);
+    ct_stats_tuple_to_flow(&conn->reply, flow_1);
 
     af = flow->layer3_info.dst_ip.ss_family;
     if (ct_stats_filter_ip(af, &flow->layer3_info.dst_ip)) goto flow_info_1_free;
 
     af = flow_1->layer3_info.src_ip.ss_family;
-    if (ct_stats_filter_ip(af, &flow_1->layer3_info.src_ip)) goto reply_dir_free;
-
+    if (ct_stats_filter_ip(af, &flow_1->layer3_info.src_ip)) goto flow_info_1_free;
 
-    af = flow_1->layer3_info.src_ip.ss_family;
     // Getting the original ip for v4 NAT'ed case.
     if (af == AF_INET)
     {
@@ -1016,49 +1075,74 @@ data_cb(const struct nlmsghdr *nlh, void *data)
         flow_1->layer3_info.dst_ip = flow->layer3_info.src_ip;
     }
 
-    if (flow->layer3_info.proto_type != 17  &&
-        tb[CTA_PROTOINFO] == NULL)
-    {
-        LOGT("%s: Missing protocol info.Dropping the ct_flow", __func__);
-        goto flow_info_1_free;
-    }
-
-    if (flow->layer3_info.proto_type != 17)
-    {
-        rc = get_protoinfo(tb[CTA_PROTOINFO], flow);
-        if (rc < 0) goto flow_info_1_free;
-    }
-
-    if (tb[CTA_COUNTERS_ORIG] == NULL) goto flow_info_1_free;
-
-    rc = get_counter(tb[CTA_COUNTERS_ORIG], flow);
-    if (rc < 0) goto flow_info_1_free;
+    flow->start = conn->start;
+    flow->end = conn->end;
+    flow->pkt_info = conn->orig_pkts;
 
     if (ct_stats->ct_zone == USHRT_MAX) flow_merge_multi_zonestats(flow_info);
 
-
     ds_dlist_insert_tail(&ct_stats->ctflow_list, flow_info);
     ct_stats->node_count++;
 
-    if (tb[CTA_COUNTERS_REPLY] == NULL) goto reply_dir_free;
+    if (!conn->has_reply_pkts) goto reply_dir_free;
 
-    rc = get_counter(tb[CTA_COUNTERS_REPLY], flow_1);
-    if (rc < 0) goto reply_dir_free;
+    flow_1->pkt_info = conn->reply_pkts;
 
     if (ct_stats->ct_zone == USHRT_MAX) flow_merge_multi_zonestats(flow_info_1);
 
     ds_dlist_insert_tail(&ct_stats->ctflow_list, flow_info_1);
     ct_stats->node_count++;
-    return MNL_CB_OK;
+    return;
 
 flow_info_1_free:
     free(flow_info_1);
 flow_info_free:
     free(flow_info);
-    return MNL_CB_OK;
+    return;
 
 reply_dir_free:
     free(flow_info_1);
+}
+
+
+/**
+ * @brief callback parsing the content of a netlink message
+ *
+ * @param nhl the netlink header message
+ * @param data the opaque context passed to mnl processing
+ * @return MNL_CB_OK when successful, -1 otherwise
+ */
+int
+data_cb(const struct nlmsghdr *nlh, void *data)
+{
+    struct nlattr *tb[CTA_MAX+1];
+    flow_stats_t *ct_stats;
+    struct nfgenmsg *nfg;
+    ct_conn_t conn;
+    bool ret;
+    int rc;
+
+    memset(tb, 0, (CTA_MAX+1) * sizeof(tb[0]));
+    ct_stats = (flow_stats_t *)data;
+    nfg = mnl_nlmsg_get_payload(nlh);
+
+    rc = mnl_attr_parse(nlh, sizeof(*nfg), data_attr_cb, tb);
+    if (rc < 0) return MNL_CB_ERROR;
+
+    ret = ct_stats_get_conn(tb, &conn);
+    if (!ret) return MNL_CB_OK;
+
+    LOGT("%s: Lookup IP flow for ct_zone: %d, retrieved: %d", __func__,
+         ct_stats->ct_zone, conn.key.zone);
+
+    if (ct_stats->ct_zone != USHRT_MAX &&
+        ct_stats->ct_zone != conn.key.zone) return MNL_CB_OK;
+
+    LOGT("%s: Included IP flow for ct_zone: %d", __func__,
+          conn.key.zone);
+
+    ct_stats_add_conn(ct_stats, &conn);
+
     return MNL_CB_OK;
 }
 
@@ -1161,144 +1245,888 @@ ct_stats_get_ct_flow(int af_family)
 
 
 /**
- * @brief frees the temporary list of parsed flows
+ * @brief compare conntrack entries
  *
- * @param ct_stats the container of the list
+ * @param a conntrack entry key
+ * @param b conntrack entry key
+ * @return 0 if the keys match
  */
-static void
-free_ct_flow_list(flow_stats_t *ct_stats)
+static int
+ct_conn_cmp(void *a, void *b)
 {
-    ct_flow_t *flow;
-    int del_count;
-
-    del_count = 0;
-    while (!ds_dlist_is_empty(&ct_stats->ctflow_list))
-    {
-        flow = ds_dlist_remove_tail(&ct_stats->ctflow_list);
-        free(flow);
-        ct_stats->node_count--;
-        del_count++;
-    }
-
-    if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
-    {
-        LOGT("%s: del_count %d node_count %d", __func__,
-             del_count, ct_stats->node_count);
-    }
-    ct_stats->node_count = 0;
+    return memcmp(a, b, sizeof(ct_conn_key_t));
 }
 
 
 /**
- * @brief logs a flow content for debug purposes
+ * @brief marks a conntrack entry as gone
  *
- * @param flow the flow to log
+ * @param conn the conntrack entry
  */
-void
-ct_stats_print_contrack(ct_flow_t *flow)
+static void
+ct_stats_conn_destroyed(ct_conn_t *conn)
 {
-    char src[INET6_ADDRSTRLEN];
-    char dst[INET6_ADDRSTRLEN];
-
-    if (flow == NULL) return;
+    conn->destroyed = true;
+    conn->refresh = false;
+    conn->start = false;
+    conn->end = true;
+}
 
-    memset(src, 0, sizeof(src));
-    memset(dst, 0, sizeof(dst));
 
-    getnameinfo((struct sockaddr *)&flow->layer3_info.src_ip,
-                sizeof(struct sockaddr_storage), src, sizeof(src),
-                0, 0, NI_NUMERICHOST);
-    getnameinfo((struct sockaddr *)&flow->layer3_info.dst_ip,
-                sizeof(struct sockaddr_storage), dst, sizeof(dst),
-                0, 0, NI_NUMERICHOST);
-    LOGI("%s: [ proto=%d tx src=%s dst=%s] ", __func__,
-         flow->layer3_info.proto_type, src, dst);
+/**
+ * @brief releases a conntrack entry of the flow table
+ *
+ * @param mgr the plugin's global state tracker
+ * @param conn the conntrack entry
+ */
+static void
+ct_stats_conn_del(flow_stats_mgr_t *mgr, ct_conn_t *conn)
+{
+    if (mgr->ct_sweep == conn)
+    {
+        mgr->ct_sweep = ds_tree_next(&mgr->ct_conns, conn);
+    }
 
-    LOGI("%s: [src port=%d dst port=%d] "
-         "[packets=%" PRIu64 "  bytes=%" PRIu64 "]", __func__,
-        ntohs(flow->layer3_info.src_port),
-        ntohs(flow->layer3_info.dst_port),
-        flow->pkt_info.pkt_cnt, flow->pkt_info.bytes);
+    ds_tree_remove(&mgr->ct_conns, conn);
+    mgr->ct_conns_count--;
+    free(conn);
 }
 
 
 /**
- * @brief apply the named filter to the given flow
+ * @brief mnl callback applying a conntrack message to the flow table
  *
- * @param filter_name the filter name
- * @param mac_filter the mac filter
- * @param flow the flow to filter
+ * Events, dump entries and query replies are all conntrack messages.
+ * New and update events carry no counters: the entry is marked to have its
+ * counters queried at the next collection. Destroy events carry the final
+ * counters: the entry is kept until the next collection reports it.
+ * @param nlh the netlink message
+ * @param data the plugin's global state tracker
+ * @return MNL_CB_OK when successful, -1 otherwise
  */
-static bool
-apply_filter(char *filter_name, fcm_filter_l2_info_t *mac_filter,
-             ct_flow_t *flow)
+int
+ct_stats_conn_cb(const struct nlmsghdr *nlh, void *data)
 {
-    fcm_filter_l3_info_t filter;
-    fcm_filter_stats_t pkt;
-    bool action;
+    struct nlattr *tb[CTA_MAX+1];
+    flow_stats_mgr_t *mgr;
+    struct nfgenmsg *nfg;
+    ct_conn_t parsed;
+    ct_conn_t *conn;
+    bool destroy;
+    bool ret;
     int rc;
 
-    if (filter_name == NULL) return true;
+    if (NFNL_SUBSYS_ID(nlh->nlmsg_type) != NFNL_SUBSYS_CTNETLINK)
+    {
+        return MNL_CB_OK;
+    }
 
-    rc = getnameinfo((struct sockaddr *)&flow->layer3_info.src_ip,
-                     sizeof(struct sockaddr_storage),
-                     filter.src_ip, sizeof(filter.src_ip),
-                     0, 0, NI_NUMERICHOST);
-    if (rc < 0) return false;
+    memset(tb, 0, (CTA_MAX+1) * sizeof(tb[0]));
+    mgr = (flow_stats_mgr_t *)data;
+    nfg = mnl_nlmsg_get_payload(nlh);
 
-    rc = getnameinfo((struct sockaddr *)&flow->layer3_info.dst_ip,
-                     sizeof(struct sockaddr_storage),
-                     filter.dst_ip, sizeof(filter.dst_ip),
-                     0, 0, NI_NUMERICHOST);
-    if (rc < 0) return false;
+    rc = mnl_attr_parse(nlh, sizeof(*nfg), data_attr_cb, tb);
+    if (rc < 0) return MNL_CB_ERROR;
 
-    filter.sport = ntohs(flow->layer3_info.src_port);
-    filter.dport = ntohs(flow->layer3_info.dst_port);
-    filter.l4_proto = flow->layer3_info.proto_type;
-    filter.ip_type = flow->layer3_info.family_type;
+    ret = ct_stats_get_conn(tb, &parsed);
+    if (!ret) return MNL_CB_OK;
 
-    pkt.pkt_cnt = flow->pkt_info.pkt_cnt;
-    pkt.bytes = flow->pkt_info.bytes;
+    /* icmp flows are never reported, and not queried by ports */
+    if (parsed.key.orig.proto == IPPROTO_ICMP ||
+        parsed.key.orig.proto == IPPROTO_ICMPV6) return MNL_CB_OK;
 
-    fcm_filter_7tuple_apply(filter_name, mac_filter, &filter, &pkt, NULL, &action);
+    destroy = (NFNL_MSG_TYPE(nlh->nlmsg_type) == IPCTNL_MSG_CT_DELETE);
 
-    return action;
-}
+    conn = ds_tree_find(&mgr->ct_conns, &parsed.key);
+    if (conn == NULL)
+    {
+        conn = calloc(1, sizeof(*conn));
+        if (conn == NULL)
+        {
+            LOGE("%s: Unable to allocate memory for conntrack entry.",
+                 __func__);
+            return MNL_CB_OK;
+        }
 
-/**
- * @brief adds collected conntrack info to the plugin aggregator
- *
- * @param ct_stats the aggregator container
- */
-void
-ct_flow_add_sample(flow_stats_t *ct_stats)
-{
-    struct net_md_aggregator *aggr;
-    struct flow_counters pkts_ct;
-    struct net_md_flow_key key;
-    ctflow_info_t *flow_info;
-    int sample_count;
-    ct_flow_t *flow;
-    bool ret;
+        conn->key = parsed.key;
+        ds_tree_insert(&mgr->ct_conns, conn, &conn->key);
+        mgr->ct_conns_count++;
+    }
 
-    aggr = ct_stats->aggr;
-    sample_count = 0;
+    conn->reply = parsed.reply;
+    conn->gen = mgr->ct_gen;
 
-    ds_dlist_foreach(&ct_stats->ctflow_list, flow_info)
+    if (parsed.has_protoinfo)
     {
-        bool                     smac_lookup;
-        bool                     dmac_lookup;
-        fcm_filter_l2_info_t     mac_filter;
-        struct sockaddr_storage *ssrc;
-        struct sockaddr_storage *sdst;
-        os_macaddr_t             smac;
-        os_macaddr_t             dmac;
-        int                      af;
+        conn->has_protoinfo = true;
+        conn->start = parsed.start;
+        conn->end = parsed.end;
+    }
 
-        memset(&smac, 0, sizeof(os_macaddr_t));
-        memset(&dmac, 0, sizeof(os_macaddr_t));
+    if (parsed.has_orig_pkts)
+    {
+        conn->orig_pkts = parsed.orig_pkts;
+        conn->has_orig_pkts = true;
+    }
 
-        flow = &flow_info->flow;
+    if (parsed.has_reply_pkts)
+    {
+        conn->reply_pkts = parsed.reply_pkts;
+        conn->has_reply_pkts = true;
+    }
+
+    if (destroy)
+    {
+        ct_stats_conn_destroyed(conn);
+        return MNL_CB_OK;
+    }
+
+    /* The tuple may have been reused since the entry was destroyed */
+    conn->destroyed = false;
+    conn->refresh = !parsed.has_orig_pkts;
+
+    return MNL_CB_OK;
+}
+
+
+/**
+ * @brief ev callback to conntrack events
+ */
+static void
+read_ct_events_cb(struct ev_loop *loop, struct ev_io *watcher, int revents)
+{
+    char rcv_buf[MNL_SOCKET_BUFFER_SIZE];
+    flow_stats_mgr_t *mgr;
+    int i;
+    int ret;
+
+    if (EV_ERROR & revents)
+    {
+        LOGE("%s: Invalid mnl socket event", __func__);
+        return;
+    }
+
+    mgr = ct_stats_get_mgr();
+    for (i = 0; i < CT_STATS_EV_BURST; i++)
+    {
+        ret = mnl_socket_recvfrom(mgr->ct_ev_mnl, rcv_buf, sizeof(rcv_buf));
+        if (ret == -1)
+        {
+            if (errno == EAGAIN || errno == EINTR) return;
+
+            if (errno == ENOBUFS)
+            {
+                LOGI("%s: conntrack events lost, flow table resync scheduled",
+                     __func__);
+                mgr->ct_resync = true;
+                continue;
+            }
+
+            LOGE("%s: mnl_socket_recvfrom failed: %s", __func__,
+                 strerror(errno));
+            return;
+        }
+
+        ret = mnl_cb_run(rcv_buf, ret, 0, 0, ct_stats_conn_cb, mgr);
+        if (ret == -1) LOGE("%s: mnl_cb_run failed", __func__);
+    }
+}
+
+
+/**
+ * @brief drops the replies left on the request socket by a failed request
+ *
+ * @param mgr the plugin's global state tracker
+ */
+static void
+ct_stats_req_flush(flow_stats_mgr_t *mgr)
+{
+    char buf[MNL_SOCKET_BUFFER_SIZE];
+    int fd;
+
+    fd = mnl_socket_get_fd(mgr->ct_req_mnl);
+    while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+}
+
+
+/**
+ * @brief dumps the conntrack entries of an inet family into the flow table
+ *
+ * @param mgr the plugin's global state tracker
+ * @param af_family the inet family to dump
+ * @return 0 when successful, -1 otherwise
+ */
+static int
+ct_stats_conn_dump(flow_stats_mgr_t *mgr, int af_family)
+{
+    char buf[MNL_SOCKET_BUFFER_SIZE];
+    struct nlmsghdr *nlh;
+    struct nfgenmsg *nfh;
+    uint32_t seq, portid;
+    int ret;
+
+    ct_stats_req_flush(mgr);
+
+    nlh = mnl_nlmsg_put_header(buf);
+    nlh->nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_GET;
+    nlh->nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+    nlh->nlmsg_seq = seq = ++mgr->ct_seq;
+
+    nfh = mnl_nlmsg_put_extra_header(nlh, sizeof(struct nfgenmsg));
+    nfh->nfgen_family = af_family;
+    nfh->version = NFNETLINK_V0;
+    nfh->res_id = 0;
+
+    ret = mnl_socket_sendto(mgr->ct_req_mnl, nlh, nlh->nlmsg_len);
+    if (ret == -1)
+    {
+        LOGE("%s: mnl_socket_sendto failed: %s", __func__, strerror(errno));
+        return -1;
+    }
+
+    portid = mnl_socket_get_portid(mgr->ct_req_mnl);
+
+    while (1)
+    {
+        ret = mnl_socket_recvfrom(mgr->ct_req_mnl, buf, sizeof(buf));
+        if (ret == -1)
+        {
+            LOGE("%s: mnl_socket_recvfrom failed: %s", __func__,
+                 strerror(errno));
+            return -1;
+        }
+
+        ret = mnl_cb_run(buf, ret, seq, portid, ct_stats_conn_cb, mgr);
+        if (ret == -1)
+        {
+            LOGE("%s: mnl_cb_run failed: %s", __func__, strerror(errno));
+            return -1;
+        }
+        else if (ret <= MNL_CB_STOP) break;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief rebuilds the flow table from a conntrack dump
+ *
+ * Entries missing from the dump were destroyed while events were lost.
+ * @param mgr the plugin's global state tracker
+ * @return 0 when successful, -1 otherwise
+ */
+static int
+ct_stats_conn_resync(flow_stats_mgr_t *mgr)
+{
+    ct_conn_t *conn;
+    int rc;
+
+    mgr->ct_resync = false;
+    mgr->ct_gen++;
+
+    rc = ct_stats_conn_dump(mgr, AF_INET);
+    if (rc == 0) rc = ct_stats_conn_dump(mgr, AF_INET6);
+    if (rc != 0)
+    {
+        mgr->ct_resync = true;
+        return -1;
+    }
+
+    ds_tree_foreach(&mgr->ct_conns, conn)
+    {
+        if (conn->gen != mgr->ct_gen) ct_stats_conn_destroyed(conn);
+    }
+
+    LOGD("%s: %zu conntrack entries", __func__, mgr->ct_conns_count);
+
+    return 0;
+}
+
+
+/**
+ * Batch of conntrack queries
+ */
+struct ct_stats_query
+{
+    flow_stats_mgr_t *mgr;
+    ct_conn_t *conns[CT_STATS_QUERY_CHUNK];
+    uint32_t seq;   // sequence number of the first query
+    int count;
+    int replies;
+};
+
+
+/**
+ * @brief mnl callback processing a conntrack query reply
+ */
+static int
+ct_stats_query_data_cb(const struct nlmsghdr *nlh, void *data)
+{
+    struct ct_stats_query *query;
+
+    query = (struct ct_stats_query *)data;
+    query->replies++;
+
+    return ct_stats_conn_cb(nlh, query->mgr);
+}
+
+
+/**
+ * @brief mnl callback processing a conntrack query error
+ */
+static int
+ct_stats_query_err_cb(const struct nlmsghdr *nlh, void *data)
+{
+    struct ct_stats_query *query;
+    struct nlmsgerr *err;
+    ct_conn_t *conn;
+    uint32_t idx;
+
+    query = (struct ct_stats_query *)data;
+    query->replies++;
+
+    err = mnl_nlmsg_get_payload(nlh);
+    idx = nlh->nlmsg_seq - query->seq;
+    if (err->error == 0 || idx >= (uint32_t)query->count) return MNL_CB_OK;
+
+    conn = query->conns[idx];
+    conn->refresh = false;
+
+    /* The destroy event was lost */
+    if (err->error == -ENOENT)
+    {
+        ct_stats_conn_destroyed(conn);
+        return MNL_CB_OK;
+    }
+
+    LOGD("%s: conntrack query failed: %s", __func__, strerror(-err->error));
+
+    return MNL_CB_OK;
+}
+
+
+static mnl_cb_t ct_stats_query_ctl_cb[NLMSG_MIN_TYPE] =
+{
+    [NLMSG_ERROR] = ct_stats_query_err_cb,
+};
+
+
+/**
+ * @brief writes the query of a conntrack entry
+ *
+ * @param buf the buffer to write the query in
+ * @param conn the conntrack entry
+ * @param seq the query sequence number
+ * @return the query
+ */
+static struct nlmsghdr *
+ct_stats_put_query(char *buf, ct_conn_t *conn, uint32_t seq)
+{
+    struct nlattr *nest_proto;
+    struct nlattr *nest_tuple;
+    struct nlattr *nest_ip;
+    struct nlmsghdr *nlh;
+    struct nfgenmsg *nfh;
+    ct_tuple_t *tuple;
+
+    tuple = &conn->key.orig;
+
+    nlh = mnl_nlmsg_put_header(buf);
+    nlh->nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_GET;
+    nlh->nlmsg_flags = NLM_F_REQUEST;
+    nlh->nlmsg_seq = seq;
+
+    nfh = mnl_nlmsg_put_extra_header(nlh, sizeof(struct nfgenmsg));
+    nfh->nfgen_family = tuple->family;
+    nfh->version = NFNETLINK_V0;
+    nfh->res_id = 0;
+
+    nest_tuple = mnl_attr_nest_start(nlh, CTA_TUPLE_ORIG);
+
+    nest_ip = mnl_attr_nest_start(nlh, CTA_TUPLE_IP);
+    if (tuple->family == AF_INET)
+    {
+        mnl_attr_put(nlh, CTA_IP_V4_SRC, sizeof(struct in_addr), tuple->src_ip);
+        mnl_attr_put(nlh, CTA_IP_V4_DST, sizeof(struct in_addr), tuple->dst_ip);
+    }
+    else
+    {
+        mnl_attr_put(nlh, CTA_IP_V6_SRC, sizeof(struct in6_addr), tuple->src_ip);
+        mnl_attr_put(nlh, CTA_IP_V6_DST, sizeof(struct in6_addr), tuple->dst_ip);
+    }
+    mnl_attr_nest_end(nlh, nest_ip);
+
+    nest_proto = mnl_attr_nest_start(nlh, CTA_TUPLE_PROTO);
+    mnl_attr_put_u8(nlh, CTA_PROTO_NUM, tuple->proto);
+    mnl_attr_put_u16(nlh, CTA_PROTO_SRC_PORT, tuple->src_port);
+    mnl_attr_put_u16(nlh, CTA_PROTO_DST_PORT, tuple->dst_port);
+    mnl_attr_nest_end(nlh, nest_proto);
+
+    if (tuple->zone != 0) mnl_attr_put_u16(nlh, CTA_TUPLE_ZONE, tuple->zone);
+
+    mnl_attr_nest_end(nlh, nest_tuple);
+
+    if (conn->key.zone != 0)
+    {
+        mnl_attr_put_u16(nlh, CTA_ZONE, htons(conn->key.zone));
+    }
+
+    return nlh;
+}
+
+
+/**
+ * @brief sends a batch of conntrack queries and processes the replies
+ *
+ * Entries whose query is not answered keep their refresh mark.
+ * @param query the batch of queries
+ */
+static void
+ct_stats_conn_query(struct ct_stats_query *query)
+{
+    char req[CT_STATS_QUERY_CHUNK * CT_STATS_QUERY_MSG_LEN];
+    char buf[MNL_SOCKET_BUFFER_SIZE];
+    flow_stats_mgr_t *mgr;
+    struct nlmsghdr *nlh;
+    uint32_t portid;
+    size_t len;
+    int ret;
+    int i;
+
+    mgr = query->mgr;
+    ct_stats_req_flush(mgr);
+
+    query->seq = mgr->ct_seq + 1;
+    query->replies = 0;
+
+    len = 0;
+    for (i = 0; i < query->count; i++)
+    {
+        nlh = ct_stats_put_query(req + len, query->conns[i], ++mgr->ct_seq);
+        len += nlh->nlmsg_len;
+    }
+
+    ret = mnl_socket_sendto(mgr->ct_req_mnl, req, len);
+    if (ret == -1)
+    {
+        LOGE("%s: mnl_socket_sendto failed: %s", __func__, strerror(errno));
+        goto out;
+    }
+
+    portid = mnl_socket_get_portid(mgr->ct_req_mnl);
+
+    while (query->replies < query->count)
+    {
+        ret = mnl_socket_recvfrom(mgr->ct_req_mnl, buf, sizeof(buf));
+        if (ret == -1)
+        {
+            LOGE("%s: mnl_socket_recvfrom failed: %s", __func__,
+                 strerror(errno));
+            break;
+        }
+
+        ret = mnl_cb_run2(buf, ret, 0, portid, ct_stats_query_data_cb, query,
+                          ct_stats_query_ctl_cb,
+                          MNL_ARRAY_SIZE(ct_stats_query_ctl_cb));
+        if (ret == -1)
+        {
+            LOGE("%s: mnl_cb_run2 failed: %s", __func__, strerror(errno));
+            break;
+        }
+    }
+
+out:
+    query->count = 0;
+}
+
+
+/**
+ * @brief adds a conntrack entry to a batch of queries, sends a full batch
+ *
+ * @param query the batch of queries
+ * @param conn the conntrack entry
+ */
+static void
+ct_stats_conn_query_add(struct ct_stats_query *query, ct_conn_t *conn)
+{
+    query->conns[query->count++] = conn;
+    if (query->count == CT_STATS_QUERY_CHUNK) ct_stats_conn_query(query);
+}
+
+
+/**
+ * @brief refreshes the counters of the flow table
+ *
+ * The entries reported by events since the last collection are queried,
+ * along with a slice of the others, so that long lived flows get their
+ * counters refreshed too. The slice also finds the entries created before
+ * the subscription, the kernel sends no destroy event for them.
+ * A dump is cheaper when most entries are due.
+ * @param mgr the plugin's global state tracker
+ * @return 0 when successful, -1 otherwise
+ */
+static int
+ct_stats_conn_refresh(flow_stats_mgr_t *mgr)
+{
+    struct ct_stats_query query;
+    ct_conn_t *conn;
+    size_t pending;
+    size_t sweep;
+
+    pending = 0;
+    ds_tree_foreach(&mgr->ct_conns, conn)
+    {
+        if (conn->refresh) pending++;
+    }
+
+    sweep = CT_STATS_SWEEP_MAX;
+    if (sweep > mgr->ct_conns_count - pending)
+    {
+        sweep = mgr->ct_conns_count - pending;
+    }
+
+    if (pending + sweep > mgr->ct_conns_count / 2)
+    {
+        return ct_stats_conn_resync(mgr);
+    }
+
+    memset(&query, 0, sizeof(query));
+    query.mgr = mgr;
+
+    ds_tree_foreach(&mgr->ct_conns, conn)
+    {
+        if (conn->refresh) ct_stats_conn_query_add(&query, conn);
+    }
+
+    conn = mgr->ct_sweep;
+    if (conn == NULL) conn = ds_tree_head(&mgr->ct_conns);
+
+    while (conn != NULL && sweep != 0)
+    {
+        if (!conn->destroyed && !conn->refresh)
+        {
+            ct_stats_conn_query_add(&query, conn);
+        }
+        sweep--;
+
+        conn = ds_tree_next(&mgr->ct_conns, conn);
+        if (conn == NULL) conn = ds_tree_head(&mgr->ct_conns);
+    }
+    mgr->ct_sweep = conn;
+
+    if (query.count != 0) ct_stats_conn_query(&query);
+
+    return 0;
+}
+
+
+/**
+ * @brief builds the session's flow list from the flow table
+ *
+ * Destroyed entries are reported one last time, then released.
+ * @param ct_stats the session
+ */
+void
+ct_stats_conn_collect(flow_stats_t *ct_stats)
+{
+    flow_stats_mgr_t *mgr;
+    ct_conn_t *next;
+    ct_conn_t *conn;
+
+    mgr = ct_stats_get_mgr();
+
+    conn = ds_tree_head(&mgr->ct_conns);
+    while (conn != NULL)
+    {
+        next = ds_tree_next(&mgr->ct_conns, conn);
+
+        if (ct_stats->ct_zone == USHRT_MAX ||
+            ct_stats->ct_zone == conn->key.zone)
+        {
+            ct_stats_add_conn(ct_stats, conn);
+        }
+
+        if (conn->destroyed) ct_stats_conn_del(mgr, conn);
+        conn = next;
+    }
+
+    if (mgr->debug)
+    {
+        ctflow_info_t *flow_info = NULL;
+        ds_dlist_foreach(&ct_stats->ctflow_list, flow_info)
+        {
+            ct_stats_print_contrack(&flow_info->flow);
+        }
+    }
+
+    flow_free_merged_multi_zonestats(&flow_tracker_list);
+
+    if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
+        LOGT("%s: total ct flow %d", __func__, ct_stats->node_count);
+}
+
+
+/**
+ * @brief stops the conntrack events processing and frees the flow table
+ *
+ * @param mgr the plugin's global state tracker
+ */
+static void
+ct_stats_events_exit(flow_stats_mgr_t *mgr)
+{
+    ct_conn_t *conn;
+
+    if (ev_is_active(&mgr->ct_ev_io)) ev_io_stop(mgr->loop, &mgr->ct_ev_io);
+
+    if (mgr->ct_ev_mnl != NULL) mnl_socket_close(mgr->ct_ev_mnl);
+    mgr->ct_ev_mnl = NULL;
+
+    if (mgr->ct_req_mnl != NULL) mnl_socket_close(mgr->ct_req_mnl);
+    mgr->ct_req_mnl = NULL;
+
+    while ((conn = ds_tree_head(&mgr->ct_conns)) != NULL)
+    {
+        ct_stats_conn_del(mgr, conn);
+    }
+
+    mgr->ct_sweep = NULL;
+    mgr->ct_events = false;
+}
+
+
+/**
+ * @brief subscribes to the conntrack events
+ *
+ * The flow table is filled by a dump at the first collection, then kept
+ * up to date by the events.
+ * @param mgr the plugin's global state tracker
+ * @return 0 when successful, -1 otherwise
+ */
+static int
+ct_stats_events_init(flow_stats_mgr_t *mgr)
+{
+    int groups[] =
+    {
+        NFNLGRP_CONNTRACK_NEW,
+        NFNLGRP_CONNTRACK_UPDATE,
+        NFNLGRP_CONNTRACK_DESTROY,
+    };
+    struct timeval tv;
+    int bufsize;
+    size_t i;
+    int flags;
+    int fd;
+    int rc;
+
+    mgr->ct_ev_mnl = mnl_socket_open(NETLINK_NETFILTER);
+    if (mgr->ct_ev_mnl == NULL)
+    {
+        LOGE("%s: mnl_socket_open failed: %s", __func__, strerror(errno));
+        goto err;
+    }
+
+    rc = mnl_socket_bind(mgr->ct_ev_mnl, 0, MNL_SOCKET_AUTOPID);
+    if (rc < 0)
+    {
+        LOGE("%s: mnl_socket_bind failed: %s", __func__, strerror(errno));
+        goto err;
+    }
+
+    for (i = 0; i < MNL_ARRAY_SIZE(groups); i++)
+    {
+        rc = mnl_socket_setsockopt(mgr->ct_ev_mnl, NETLINK_ADD_MEMBERSHIP,
+                                   &groups[i], sizeof(int));
+        if (rc < 0)
+        {
+            LOGE("%s: mnl_socket_setsockopt failed: %s", __func__,
+                 strerror(errno));
+            goto err;
+        }
+    }
+
+    /* Absorb connection bursts, a lost event costs a full dump */
+    fd = mnl_socket_get_fd(mgr->ct_ev_mnl);
+    bufsize = CT_STATS_EV_RCVBUF;
+    rc = setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bufsize, sizeof(bufsize));
+    if (rc < 0) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+    flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    mgr->ct_req_mnl = mnl_socket_open(NETLINK_NETFILTER);
+    if (mgr->ct_req_mnl == NULL)
+    {
+        LOGE("%s: mnl_socket_open failed: %s", __func__, strerror(errno));
+        goto err;
+    }
+
+    rc = mnl_socket_bind(mgr->ct_req_mnl, 0, MNL_SOCKET_AUTOPID);
+    if (rc < 0)
+    {
+        LOGE("%s: mnl_socket_bind failed: %s", __func__, strerror(errno));
+        goto err;
+    }
+
+    /* Never block the loop on a lost reply */
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(mnl_socket_get_fd(mgr->ct_req_mnl), SOL_SOCKET, SO_RCVTIMEO,
+               &tv, sizeof(tv));
+
+    ev_io_init(&mgr->ct_ev_io, read_ct_events_cb, fd, EV_READ);
+    ev_io_start(mgr->loop, &mgr->ct_ev_io);
+
+    mgr->ct_resync = true;
+    mgr->ct_events = true;
+
+    return 0;
+
+err:
+    ct_stats_events_exit(mgr);
+    return -1;
+}
+
+
+/**
+ * @brief frees the temporary list of parsed flows
+ *
+ * @param ct_stats the container of the list
+ */
+static void
+free_ct_flow_list(flow_stats_t *ct_stats)
+{
+    ct_flow_t *flow;
+    int del_count;
+
+    del_count = 0;
+    while (!ds_dlist_is_empty(&ct_stats->ctflow_list))
+    {
+        flow = ds_dlist_remove_tail(&ct_stats->ctflow_list);
+        free(flow);
+        ct_stats->node_count--;
+        del_count++;
+    }
+
+    if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
+    {
+        LOGT("%s: del_count %d node_count %d", __func__,
+             del_count, ct_stats->node_count);
+    }
+    ct_stats->node_count = 0;
+}
+
+
+/**
+ * @brief logs a flow content for debug purposes
+ *
+ * @param flow the flow to log
+ */
+void
+ct_stats_print_contrack(ct_flow_t *flow)
+{
+    char src[INET6_ADDRSTRLEN];
+    char dst[INET6_ADDRSTRLEN];
+
+    if (flow == NULL) return;
+
+    memset(src, 0, sizeof(src));
+    memset(dst, 0, sizeof(dst));
+
+    getnameinfo((struct sockaddr *)&flow->layer3_info.src_ip,
+                sizeof(struct sockaddr_storage), src, sizeof(src),
+                0, 0, NI_NUMERICHOST);
+    getnameinfo((struct sockaddr *)&flow->layer3_info.dst_ip,
+                sizeof(struct sockaddr_storage), dst, sizeof(dst),
+                0, 0, NI_NUMERICHOST);
+    LOGI("%s: [ proto=%d tx src=%s dst=%s] ", __func__,
+         flow->layer3_info.proto_type, src, dst);
+
+    LOGI("%s: [src port=%d dst port=%d] "
+         "[packets=%" PRIu64 "  bytes=%" PRIu64 "]", __func__,
+        ntohs(flow->layer3_info.src_port),
+        ntohs(flow->layer3_info.dst_port),
+        flow->pkt_info.pkt_cnt, flow->pkt_info.bytes);
+}
+
+
+/**
+ * @brief apply the named filter to the given flow
+ *
+ * @param filter_name the filter name
+ * @param mac_filter the mac filter
+ * @param flow the flow to filter
+ */
+static bool
+apply_filter(char *filter_name, fcm_filter_l2_info_t *mac_filter,
+             ct_flow_t *flow)
+{
+    fcm_filter_l3_info_t filter;
+    fcm_filter_stats_t pkt;
+    bool action;
+    int rc;
+
+    if (filter_name == NULL) return true;
+
+    rc = getnameinfo((struct sockaddr *)&flow->layer3_info.src_ip,
+                     sizeof(struct sockaddr_storage),
+                     filter.src_ip, sizeof(filter.src_ip),
+                     0, 0, NI_NUMERICHOST);
+    if (rc < 0) return false;
+
+    rc = getnameinfo((struct sockaddr *)&flow->layer3_info.dst_ip,
+                     sizeof(struct sockaddr_storage),
+                     filter.dst_ip, sizeof(filter.dst_ip),
+                     0, 0, NI_NUMERICHOST);
+    if (rc < 0) return false;
+
+    filter.sport = ntohs(flow->layer3_info.src_port);
+    filter.dport = ntohs(flow->layer3_info.dst_port);
+    filter.l4_proto = flow->layer3_info.proto_type;
+    filter.ip_type = flow->layer3_info.family_type;
+
+    pkt.pkt_cnt = flow->pkt_info.pkt_cnt;
+    pkt.bytes = flow->pkt_info.bytes;
+
+    fcm_filter_7tuple_apply(filter_name, mac_filter, &filter, &pkt, NULL, &action);
+
+    return action;
+}
+
+/**
+ * @brief adds collected conntrack info to the plugin aggregator
+ *
+ * @param ct_stats the aggregator container
+ */
+void
+ct_flow_add_sample(flow_stats_t *ct_stats)
+{
+    struct net_md_aggregator *aggr;
+    struct flow_counters pkts_ct;
+    struct net_md_flow_key key;
+    ctflow_info_t *flow_info;
+    int sample_count;
+    ct_flow_t *flow;
+    bool ret;
+
+    aggr = ct_stats->aggr;
+    sample_count = 0;
+
+    ds_dlist_foreach(&ct_stats->ctflow_list, flow_info)
+    {
+        bool                     smac_lookup;
+        bool                     dmac_lookup;
+        fcm_filter_l2_info_t     mac_filter;
+        struct sockaddr_storage *ssrc;
+        struct sockaddr_storage *sdst;
+        os_macaddr_t             smac;
+        os_macaddr_t             dmac;
+        int                      af;
+
+        memset(&smac, 0, sizeof(os_macaddr_t));
+        memset(&dmac, 0, sizeof(os_macaddr_t));
+
+        flow = &flow_info->flow;
         af = flow->layer3_info.src_ip.ss_family;
 
         ssrc = &flow->layer3_info.src_ip;
@@ -1643,6 +2471,20 @@ ct_stats_collect_cb(fcm_collect_plugin_t *collector)
     ct_stats = collector->plugin_ctx;
     if (ct_stats != mgr->active) return;
 
+    ct_stats->collect_filter = collector->filters.collect;
+
+    if (mgr->ct_events)
+    {
+        if (mgr->ct_resync) rc = ct_stats_conn_resync(mgr);
+        else rc = ct_stats_conn_refresh(mgr);
+
+        if (rc == -1) LOGE("%s: conntrack flow table update error", __func__);
+
+        ct_stats_conn_collect(ct_stats);
+        ct_flow_add_sample(ct_stats);
+        return;
+    }
+
     rc = ct_stats_get_ct_flow(AF_INET);
     if (rc == -1)
     {
@@ -1657,8 +2499,6 @@ ct_stats_collect_cb(fcm_collect_plugin_t *collector)
         return;
     }
 
-    ct_stats = collector->plugin_ctx;
-    ct_stats->collect_filter = collector->filters.collect;
     ct_flow_add_sample(ct_stats);
 }
 
@@ -2003,6 +2843,7 @@ ct_stats_init_mgr(struct ev_loop *loop)
     mgr->max_sessions = 2;
     ds_tree_init(&mgr->ct_stats_sessions, ct_stats_session_cmp,
                  flow_stats_t, ct_stats_node);
+    ds_tree_init(&mgr->ct_conns, ct_conn_cmp, ct_conn_t, conn_tnode);
 
     rc = ct_stats_imc_init();
     if (rc != 0) goto err;
@@ -2010,6 +2851,9 @@ ct_stats_init_mgr(struct ev_loop *loop)
     rc = nf_ct_init(loop);
     if (rc != 0) goto err;
 
+    rc = ct_stats_events_init(mgr);
+    if (rc != 0) LOGI("%s: no conntrack events, dumping conntrack", __func__);
+
     mgr->debug = false;
     mgr->initialized = true;
 
@@ -2027,6 +2871,7 @@ ct_stats_exit_mgr(void)
     nf_ct_exit();
 
     mgr = ct_stats_get_mgr();
+    ct_stats_events_exit(mgr);
     memset(mgr, 0, sizeof(*mgr));
     mgr->initialized = false;
 }
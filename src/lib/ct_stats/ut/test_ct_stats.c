@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include <libmnl/libmnl.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
 
 #include "ct_stats.h"
 #include "os_types.h"
@@ -293,6 +294,75 @@ test_process_v6(void)
 }
 
 
+static int
+test_run_mnl_bufs(struct mnl_buf *p_mnl, mnl_cb_t cb, void *data)
+{
+    int ret;
+
+    do
+    {
+        ret = mnl_cb_run(p_mnl->data, p_mnl->len, g_seq, g_portid, cb, data);
+        p_mnl++;
+    } while (ret > MNL_CB_STOP);
+
+    return ret;
+}
+
+
+void
+test_conn_table(void)
+{
+    fcm_collect_plugin_t *collector;
+    flow_stats_t *ct_stats;
+    flow_stats_mgr_t *mgr;
+    struct nlmsghdr *nlh;
+    uint8_t msg[4096];
+    size_t num_conns;
+    int num_flows;
+
+    mgr = ct_stats_get_mgr();
+    TEST_ASSERT_NOT_NULL(mgr);
+
+    ct_stats = ct_stats_get_active_instance();
+    TEST_ASSERT_NOT_NULL(ct_stats);
+
+    collector = ct_stats->collector;
+    TEST_ASSERT_NOT_NULL(collector);
+
+    /* Flows of the dump */
+    test_run_mnl_bufs(g_mnl_buf_ipv4, data_cb, ct_stats);
+    test_run_mnl_bufs(g_mnl_buf_ipv6, data_cb, ct_stats);
+    num_flows = ct_stats->node_count;
+    TEST_ASSERT_TRUE(num_flows > 0);
+    ct_flow_add_sample(ct_stats);
+
+    /* The same entries applied to the flow table report the same flows */
+    test_run_mnl_bufs(g_mnl_buf_ipv4, ct_stats_conn_cb, mgr);
+    test_run_mnl_bufs(g_mnl_buf_ipv6, ct_stats_conn_cb, mgr);
+    num_conns = mgr->ct_conns_count;
+    TEST_ASSERT_TRUE(num_conns > 0);
+
+    ct_stats_conn_collect(ct_stats);
+    TEST_ASSERT_EQUAL_INT(num_flows, ct_stats->node_count);
+    ct_flow_add_sample(ct_stats);
+    TEST_ASSERT_EQUAL_UINT(num_conns, mgr->ct_conns_count);
+
+    /* A destroyed entry is reported once more, then released */
+    nlh = (struct nlmsghdr *)g_mnl_buf_ipv4[0].data;
+    memcpy(msg, nlh, nlh->nlmsg_len);
+    nlh = (struct nlmsghdr *)msg;
+    nlh->nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_DELETE;
+    ct_stats_conn_cb(nlh, mgr);
+
+    ct_stats_conn_collect(ct_stats);
+    TEST_ASSERT_EQUAL_INT(num_flows, ct_stats->node_count);
+    ct_flow_add_sample(ct_stats);
+    TEST_ASSERT_EQUAL_UINT(num_conns - 1, mgr->ct_conns_count);
+
+    collector->send_report(collector);
+}
+
+
 void
 test_ct_stat_v4(void)
 {
@@ -366,6 +436,7 @@ main(int argc, char *argv[])
 
     RUN_TEST(test_process_v4);
     RUN_TEST(test_process_v6);
+    RUN_TEST(test_conn_table);
 #if !defined(__x86_64__)
     RUN_TEST(test_ct_stat_v4);
     RUN_TEST(test_ct_stat_v6);
@@ -94,6 +94,9 @@ dns_parse_update(struct fsm_session *session)
     char *mqtt_blocker_topic = session->ops.get_config(session, "blk_mqtt");
     char *hs_report_interval;
     char *hs_report_topic;
+    char *wc_cache_neg_ttl;
+    char *wc_cache_size;
+    char *wc_cache_ttl;
     long interval;
     int val;
 
@@ -109,6 +112,18 @@ dns_parse_update(struct fsm_session *session)
                                               "wc_health_stats_topic");
     dns_session->health_stats_report_topic = hs_report_topic;
 
+    /* Web categorization verdicts cache, shared by all the sessions */
+    wc_cache_size = session->ops.get_config(session, "wc_cache_size");
+    wc_cache_ttl = session->ops.get_config(session, "wc_cache_ttl");
+    wc_cache_neg_ttl = session->ops.get_config(session, "wc_cache_neg_ttl");
+    if (wc_cache_size || wc_cache_ttl || wc_cache_neg_ttl)
+    {
+        fsm_wc_cache_set_config(wc_cache_size ?
+                                strtoul(wc_cache_size, NULL, 10) : 0,
+                                wc_cache_ttl ? atoi(wc_cache_ttl) : 0,
+                                wc_cache_neg_ttl ? atoi(wc_cache_neg_ttl) : 0);
+    }
+
     if (dbg_str != NULL)
     {
         LOGT("%s: session %p: debug key value: %s",
@@ -877,6 +892,40 @@ update_a_rrs(dns_info *dns, uint8_t *packet,
 }
 
 
+/**
+ * @brief keeps a copy of a DNS reply received before the policy check
+ *
+ * Only the first reply is kept, duplicates are dropped.
+ * @param dns_session the session container
+ * @param req the request the reply answers
+ * @param packet the reply
+ * @param len the reply length
+ */
+static void
+dns_stash_reply(struct dns_session *dns_session, struct fqdn_pending_req *req,
+                uint8_t *packet, int len)
+{
+    if (req->response != NULL)
+    {
+        LOGD("%s: dropping duplicate dns reply %u", __func__, req->req_id);
+        return;
+    }
+
+    LOGD("%s: stashing dns reply %u", __func__, req->req_id);
+    req->response = malloc(len);
+    if (req->response == NULL)
+    {
+        LOGE("Could not allocate memory for dns response %d",
+             req->req_id);
+        dns_remove_req(dns_session, &req->dev_id, req->req_id);
+        return;
+    }
+
+    memcpy(req->response, packet, len);
+    req->response_len = len;
+}
+
+
 static void
 dns_handle_reply(struct dns_session *dns_session, dns_info *dns,
                  eth_info *eth, struct pcap_pkthdr *header,
@@ -911,6 +960,16 @@ dns_handle_reply(struct dns_session *dns_session, dns_info *dns,
         goto free_out;
     }
 
+    /*
+     * The policies are not applied yet, the web categorization verdict is
+     * pending. Hold the reply, it is processed once the verdict is set.
+     */
+    if (req->fsm_checked == false)
+    {
+        dns_stash_reply(dns_session, req, packet, header->caplen);
+        goto free_out;
+    }
+
     req->num_replies++;
     dns_session->req = req;
     process_response_ips(dns, packet, req);
@@ -999,27 +1058,11 @@ dns_handle_reply(struct dns_session *dns_session, dns_info *dns,
         mgr->forward(dns_session, dns, packet, header->caplen);
         dns_remove_req(dns_session, &eth->dstmac, req->req_id);
     }
-    else if (req->fsm_checked == true)
+    else
     {
         mgr->forward(dns_session, dns, packet, header->caplen);
         dns_remove_req(dns_session, &eth->dstmac, req->req_id);
     }
-    else
-    {
-        LOGD("%s: stashing dns reply %u", __func__, req->req_id);
-        req->response = calloc(1, header->caplen);
-        if (req->response == NULL)
-        {
-            LOGE("Could not allocate memory for dns response %d",
-                 req->req_id);
-            dns_remove_req(dns_session, &eth->dstmac, req->req_id);
-        }
-        else
-        {
-            memcpy(req->response, packet, header->caplen);
-            req->response_len = header->caplen;
-        }
-    }
 
   free_out:
     free_rrs(&dns_session->ip, &dns_session->udp, dns, header);
@@ -1069,6 +1112,13 @@ set_provider_ops(struct dns_session *dns_session,
     /* Set the backend provider ops */
     req->categories_check = session->provider_ops->categories_check;
     req->risk_level_check = session->provider_ops->risk_level_check;
+
+    /* Asynchronous provider: the rules are checked against its verdict */
+    if (session->provider_ops->categories_lookup != NULL)
+    {
+        req->categories_check = fsm_wc_verdict_cat_check;
+        req->risk_level_check = fsm_wc_verdict_risk_check;
+    }
 }
 
 
@@ -1583,6 +1633,8 @@ dns_free_req(struct fqdn_pending_req *req)
     struct fsm_url_request *req_info;
     int i;
 
+    fsm_wc_verdict_cancel(req);
+
     if (req->response != NULL) free(req->response);
     if (req->rule_name != NULL) free(req->rule_name);
     if (req->policy != NULL) free(req->policy);
@@ -2038,6 +2090,12 @@ dns_periodic(struct fsm_session *session)
     memset(&stats, 0, sizeof(stats));
     session->provider_ops->get_stats(session, &stats);
 
+    /* The verdicts cache serves the asynchronous providers */
+    if (session->provider_ops->categories_lookup != NULL)
+    {
+        fsm_wc_cache_get_stats(&stats);
+    }
+
     /* Log locally if the time has come */
     if (cmp_log >= DNS_LOG_PERIODIC) dns_log_stats(dns_session, &stats, now);
 
@@ -2115,27 +2173,97 @@ fqdn_policy_check(struct dns_device *ds,
     }
 }
 
+
+/**
+ * @brief processes the DNS reply stashed pending the policy check
+ *
+ * The reply goes through the regular reply path: the answers are
+ * rewritten for a blocked or redirected request, tags are updated and the
+ * request is released.
+ * @param req the request
+ */
+static void
+dns_process_stashed_reply(struct fqdn_pending_req *req)
+{
+    struct net_header_parser net_header;
+    uint8_t *packet;
+
+    packet = req->response;
+    if (packet == NULL) return;
+
+    memset(&net_header, 0, sizeof(net_header));
+    net_header.start = packet;
+    net_header.data = packet;
+    net_header.caplen = req->response_len;
+    net_header.packet_len = req->response_len;
+
+    /* The request may be released by the reply processing */
+    req->response = NULL;
+    req->response_len = 0;
+
+    LOGT("%s: req id %u: processing the stashed reply", __func__, req->req_id);
+    dns_handler(req->fsm_context, &net_header);
+    free(packet);
+}
+
+
+/**
+ * @brief resumes a request once its web categorization verdict is set
+ *
+ * Applies the policies, then processes the DNS reply if it was held
+ * waiting for the verdict.
+ * @param req the request
+ */
+static void
+dns_verdict_ready(struct fqdn_pending_req *req)
+{
+    struct dns_cache *mgr;
+
+    mgr = dns_get_mgr();
+
+    mgr->policy_check(req->dev_session, req);
+    LOGT("%s: req id %u: action %d", __func__, req->req_id, req->action);
+
+    /* The DNS reply is not there yet */
+    if (req->response == NULL) return;
+
+    dns_process_stashed_reply(req);
+}
+
+
 void
 dns_policy_check(struct dns_device *ds,
                  struct fqdn_pending_req *req)
 {
     struct dns_cache *mgr;
+    int rc;
 
     mgr = dns_get_mgr();
-    mgr->policy_check(ds, req);
 
-    /* Process the DNS reply if it was pending policy checking */
-    if (req->response != NULL)
+    /*
+     * Look the web categorization verdict up without blocking.
+     * A reply received meanwhile is stashed until the verdict arrives.
+     */
+    rc = FSM_WC_VERDICT_UNAVAILABLE;
+    if (req->categories_check != NULL)
     {
-        struct dns_session *dns_session = req->fsm_context->handler_ctxt;
-        if (req->action != FSM_BLOCK)
-        {
-            mgr->forward(dns_session, NULL, req->response, req->response_len);
-        }
-        free(req->response);
+        rc = fsm_wc_verdict_get(req->fsm_context, req, dns_verdict_ready);
+    }
+
+    if (rc == FSM_WC_VERDICT_PENDING)
+    {
+        LOGT("%s: req id %u: waiting for the categorization verdict",
+             __func__, req->req_id);
+        ds_tree_insert(&ds->fqdn_pending_reqs, req, &req->req_id);
+        return;
     }
 
+    mgr->policy_check(ds, req);
+
     LOGT("%s: redirect = %s", __func__, req->redirect ? "true" : "false");
     ds_tree_insert(&ds->fqdn_pending_reqs, req, &req->req_id);
+
+    /* Process the DNS reply if it was pending policy checking */
+    dns_process_stashed_reply(req);
     return;
 }
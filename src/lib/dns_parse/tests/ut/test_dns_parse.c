@@ -9,6 +9,7 @@
 #include "log.h"
 #include "qm_conn.h"
 #include "target.h"
+#include "util.h"
 #include "unity.h"
 
 #include "pcap.c"
@@ -267,12 +268,46 @@ void create_hex_dump(const char *fname, const uint8_t *buf, size_t len)
 
 
 
+int g_forwards;
+int g_redirected;
+int g_update_tags;
+
+/**
+ * @brief counts the type A answers pointing to the redirect address
+ */
+static int
+test_count_redirected(dns_info *dns, uint8_t *buf)
+{
+    uint8_t redirect[4] = { 1, 2, 3, 4 };
+    dns_rr *answer;
+    int count = 0;
+    int i;
+
+    if (dns == NULL) return 0;
+
+    answer = dns->answers;
+    for (i = 0; i < dns->ancount && answer != NULL; i++)
+    {
+        if (answer->type == 1 &&
+            memcmp(buf + answer->type_pos + 10, redirect, sizeof(redirect)) == 0)
+        {
+            count++;
+        }
+        answer = answer->next;
+    }
+
+    return count;
+}
+
+
 void
 test_dns_forward(struct dns_session *dns_session, dns_info *dns_info,
                  uint8_t *buf, int len)
 {
     LOGI("%s: here", __func__);
     TEST_ASSERT_EQUAL_INT(g_ipv4_cnt, dns_session->req->ipv4_cnt);
+    g_forwards++;
+    g_redirected = test_count_redirected(dns_info, buf);
 }
 
 
@@ -281,6 +316,48 @@ test_dns_update_tag(struct fqdn_pending_req *req)
 {
     LOGI("%s: here", __func__);
     TEST_ASSERT_EQUAL_STRING(req->updatev4_tag, "upd_v4_tag");
+    g_update_tags++;
+}
+
+
+/**
+ * @brief stand-in asynchronous web categorization provider
+ *
+ * The lookup is kept pending until the test completes it.
+ */
+struct fsm_wc_lookup *g_wc_lookup;
+
+static bool
+test_wc_lookup(struct fsm_session *session, struct fsm_wc_lookup *lookup)
+{
+    g_wc_lookup = lookup;
+    return true;
+}
+
+struct fsm_web_cat_ops g_async_ops =
+{
+    .categories_lookup = test_wc_lookup,
+};
+
+
+/**
+ * @brief policy check applying the action set by the test
+ */
+int g_verdict_action;
+bool g_verdict_redirect;
+
+static void
+test_verdict_policy_check(struct dns_device *ds, struct fqdn_pending_req *req)
+{
+    req->action = g_verdict_action;
+    req->redirect = g_verdict_redirect;
+    if (req->redirect)
+    {
+        STRSCPY(req->redirects[0], "A-1.2.3.4");
+        req->rd_ttl = 10;
+    }
+    if (req->action == FSM_UPDATE_TAG) req->updatev4_tag = "upd_v4_tag";
+    req->fsm_checked = true;
 }
 
 
@@ -350,6 +427,9 @@ void setUp(void)
     dns_plugin_init(g_fsm_parser);
 
     g_ipv4_cnt = 0;
+    g_forwards = 0;
+    g_redirected = 0;
+    g_update_tags = 0;
 
     return;
 }
@@ -633,6 +713,116 @@ test_type_A_duplicate_query_duplicate_response(void)
 }
 
 
+/**
+ * @brief runs a query and its reply ahead of the categorization verdict
+ *
+ * @param action the action set once the verdict arrives
+ * @param redirect whether the answers are redirected
+ */
+static void
+test_reply_before_verdict(int action, bool redirect)
+{
+    void (*policy_check)(struct dns_device *, struct fqdn_pending_req *);
+    struct net_header_parser *net_parser;
+    struct dns_session *dns_session;
+    struct dns_device *ds;
+    size_t len;
+
+    dns_session = dns_lookup_session(g_fsm_parser);
+    TEST_ASSERT_NOT_NULL(dns_session);
+
+    fsm_wc_cache_flush();
+    g_wc_lookup = NULL;
+    g_fsm_parser->provider_ops = &g_async_ops;
+    policy_check = g_dns_mgr->policy_check;
+    g_dns_mgr->policy_check = test_verdict_policy_check;
+    g_verdict_action = action;
+    g_verdict_redirect = redirect;
+
+    net_parser = calloc(1, sizeof(*net_parser));
+    TEST_ASSERT_NOT_NULL(net_parser);
+
+    /* Process query, the verdict lookup is pending */
+    PREPARE_UT(pkt46, net_parser);
+    len = net_header_parse(net_parser);
+    TEST_ASSERT_TRUE(len != 0);
+    dns_handler(g_fsm_parser, net_parser);
+    TEST_ASSERT_NOT_NULL(g_wc_lookup);
+
+    g_ipv4_cnt = 8;
+
+    /* Process response, it is held */
+    memset(net_parser, 0, sizeof(*net_parser));
+    PREPARE_UT(pkt47, net_parser);
+    len = net_header_parse(net_parser);
+    TEST_ASSERT_TRUE(len != 0);
+    dns_handler(g_fsm_parser, net_parser);
+    TEST_ASSERT_EQUAL_INT(0, g_forwards);
+    TEST_ASSERT_EQUAL_INT(0, g_update_tags);
+
+    ds = ds_tree_head(&dns_session->session_devices);
+    TEST_ASSERT_NOT_NULL(ds);
+    TEST_ASSERT_NOT_NULL(ds_tree_head(&ds->fqdn_pending_reqs));
+
+    /* The verdict arrives, the held reply goes through the reply path */
+    g_wc_lookup->reply.nelems = 1;
+    g_wc_lookup->reply.categories[0] = 1;
+    fsm_wc_lookup_done(g_wc_lookup);
+
+    /* The request is released */
+    TEST_ASSERT_NULL(ds_tree_head(&ds->fqdn_pending_reqs));
+
+    g_fsm_parser->provider_ops = NULL;
+    g_dns_mgr->policy_check = policy_check;
+    fsm_wc_cache_flush();
+    free(net_parser);
+}
+
+
+/**
+ * @brief a blocked reply held for the verdict is rewritten
+ */
+void
+test_type_A_reply_before_verdict_block(void)
+{
+    /* Blocked and redirected: the answers point to the redirect address */
+    test_reply_before_verdict(FSM_BLOCK, true);
+    TEST_ASSERT_EQUAL_INT(1, g_forwards);
+    TEST_ASSERT_EQUAL_INT(8, g_redirected);
+
+    /* Blocked without a redirect address: the reply is dropped */
+    g_forwards = 0;
+    test_reply_before_verdict(FSM_BLOCK, false);
+    TEST_ASSERT_EQUAL_INT(0, g_forwards);
+}
+
+
+/**
+ * @brief a redirected reply held for the verdict does not leak the resolved IPs
+ */
+void
+test_type_A_reply_before_verdict_redirect(void)
+{
+    test_reply_before_verdict(FSM_REDIRECT, true);
+    TEST_ASSERT_EQUAL_INT(1, g_forwards);
+    TEST_ASSERT_EQUAL_INT(8, g_redirected);
+    TEST_ASSERT_EQUAL_INT(0, g_update_tags);
+}
+
+
+/**
+ * @brief tags are updated from a reply held for the verdict
+ */
+void
+test_type_A_reply_before_verdict_update_tag(void)
+{
+    test_reply_before_verdict(FSM_UPDATE_TAG, false);
+    TEST_ASSERT_EQUAL_INT(1, g_update_tags);
+    TEST_ASSERT_EQUAL_INT(1, g_forwards);
+    TEST_ASSERT_EQUAL_INT(0, g_redirected);
+}
+
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -652,6 +842,9 @@ int main(int argc, char *argv[])
     RUN_TEST(test_type_A_query_response_update_tag);
     RUN_TEST(test_type_A_duplicate_query_response);
     RUN_TEST(test_type_A_duplicate_query_duplicate_response);
+    RUN_TEST(test_type_A_reply_before_verdict_block);
+    RUN_TEST(test_type_A_reply_before_verdict_redirect);
+    RUN_TEST(test_type_A_reply_before_verdict_update_tag);
 
     return UNITY_END();
 }
@@ -65,5 +65,6 @@ extern bool             evsched_task_reschedule_ms(uint32_t ms);
 extern bool             evsched_task_reschedule(void);
 extern bool             evsched_init(struct ev_loop *loop);
 extern bool             evsched_cleanup(void);
+extern void             evsched_set_slack(uint32_t ms);
 
 #endif /* EVSCHED_H_INCLUDED */
@@ -38,6 +38,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <log.h>
 #include <ds_list.h>
+#include <ds_tree.h>
 
 #include "evsched.h"
 
@@ -46,6 +47,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define MODULE_ID LOG_MODULE_ID_SCHED
 
 #define TIME_JUMP_THRESHOLD     86400       // One day in seconds
+#define EVSCHED_HEAP_MIN        64
+#define EVSCHED_NOT_QUEUED      UINT32_MAX
 
 
 /*****************************************************************************/
@@ -55,27 +58,43 @@ typedef struct {
     evsched_task_t          task_id;
 
     bool                    resched;
-    bool                    remove;
     uint32_t                ms;
     ev_tstamp               sched_time;
     ev_tstamp               trigger_time;
+    uint64_t                seq;            // Orders tasks triggering at the same time
+    uint32_t                heap_idx;
 
     evsched_task_func_t     func;
     void                    *func_arg;
 
     ds_list_t               node;
+    ds_tree_node_t          id_node;
 } evsched_taskinfo_t;
 
 
 /*****************************************************************************/
 
+static int                  evsched_task_id_cmp(void *a, void *b);
+
 static evsched_taskinfo_t           *evsched_current;
 static evsched_task_t               evsched_task_id = 1;
 static struct ev_loop               *evsched_loop;
-static ds_list_t                    evsched_tasklist;
 static ds_list_t                    evsched_pending;
 static ev_timer                     evsched_timer;
 static bool                         evsched_initialized = false;
+static uint32_t                     evsched_slack_ms = 0;
+
+/*
+ * Scheduled tasks are kept in a binary min-heap ordered by trigger time,
+ * and indexed by task id for the lookups of cancel, update and remaining.
+ */
+static evsched_taskinfo_t           **evsched_heap;
+static uint32_t                     evsched_heap_len;
+static uint32_t                     evsched_heap_size;
+static uint64_t                     evsched_seq;
+static ds_tree_t                    evsched_tasks = DS_TREE_INIT(evsched_task_id_cmp,
+                                                                 evsched_taskinfo_t,
+                                                                 id_node);
 
 
 /*****************************************************************************/
@@ -91,26 +110,140 @@ static bool                 evsched_task_insert(evsched_taskinfo_t *ntp, bool re
 
 /*****************************************************************************/
 
-static evsched_taskinfo_t *
-evsched_get_taskinfo(evsched_task_t task, bool remove)
+static int
+evsched_task_id_cmp(void *a, void *b)
 {
-    evsched_taskinfo_t  *tp;
-    ds_list_iter_t      iter;
+    evsched_task_t  ta = *(evsched_task_t *)a;
+    evsched_task_t  tb = *(evsched_task_t *)b;
 
-    tp = ds_list_ifirst(&iter, &evsched_tasklist);
-    while(tp) {
-        if (tp->task_id == task) {
-            if (remove) {
-                ds_list_iremove(&iter);
-            }
+    return (ta > tb) - (ta < tb);
+}
+
+static inline bool
+evsched_heap_before(evsched_taskinfo_t *a, evsched_taskinfo_t *b)
+{
+    if (a->trigger_time != b->trigger_time) {
+        return a->trigger_time < b->trigger_time;
+    }
+
+    return a->seq < b->seq;
+}
 
-            return tp;
+static inline void
+evsched_heap_set(uint32_t idx, evsched_taskinfo_t *tp)
+{
+    evsched_heap[idx] = tp;
+    tp->heap_idx = idx;
+}
+
+static void
+evsched_heap_sift_up(uint32_t idx)
+{
+    evsched_taskinfo_t      *tp = evsched_heap[idx];
+    uint32_t                parent;
+
+    while (idx > 0) {
+        parent = (idx - 1) / 2;
+        if (!evsched_heap_before(tp, evsched_heap[parent])) {
+            break;
         }
 
-        tp = ds_list_inext(&iter);
+        evsched_heap_set(idx, evsched_heap[parent]);
+        idx = parent;
+    }
+
+    evsched_heap_set(idx, tp);
+}
+
+static void
+evsched_heap_sift_down(uint32_t idx)
+{
+    evsched_taskinfo_t      *tp = evsched_heap[idx];
+    uint32_t                child;
+
+    while ((child = 2 * idx + 1) < evsched_heap_len) {
+        if (child + 1 < evsched_heap_len &&
+            evsched_heap_before(evsched_heap[child + 1], evsched_heap[child])) {
+            child++;
+        }
+
+        if (!evsched_heap_before(evsched_heap[child], tp)) {
+            break;
+        }
+
+        evsched_heap_set(idx, evsched_heap[child]);
+        idx = child;
+    }
+
+    evsched_heap_set(idx, tp);
+}
+
+static bool
+evsched_heap_push(evsched_taskinfo_t *tp)
+{
+    evsched_taskinfo_t      **heap;
+    uint32_t                size;
+
+    if (evsched_heap_len == evsched_heap_size) {
+        size = evsched_heap_size ? evsched_heap_size * 2 : EVSCHED_HEAP_MIN;
+        heap = realloc(evsched_heap, size * sizeof(*heap));
+        if (!heap) {
+            return false;
+        }
+
+        evsched_heap = heap;
+        evsched_heap_size = size;
+    }
+
+    tp->seq = evsched_seq++;
+    evsched_heap[evsched_heap_len++] = tp;
+    evsched_heap_sift_up(evsched_heap_len - 1);
+
+    ds_tree_insert(&evsched_tasks, tp, &tp->task_id);
+
+    return true;
+}
+
+static void
+evsched_heap_remove(evsched_taskinfo_t *tp)
+{
+    uint32_t                idx = tp->heap_idx;
+    evsched_taskinfo_t      *last;
+
+    ds_tree_remove(&evsched_tasks, tp);
+
+    tp->heap_idx = EVSCHED_NOT_QUEUED;
+    last = evsched_heap[--evsched_heap_len];
+    if (last == tp) {
+        return;
+    }
+
+    evsched_heap_set(idx, last);
+    if (idx > 0 && evsched_heap_before(last, evsched_heap[(idx - 1) / 2])) {
+        evsched_heap_sift_up(idx);
+    }
+    else {
+        evsched_heap_sift_down(idx);
+    }
+}
+
+static inline evsched_taskinfo_t *
+evsched_heap_first(void)
+{
+    return evsched_heap_len ? evsched_heap[0] : NULL;
+}
+
+static evsched_taskinfo_t *
+evsched_get_taskinfo(evsched_task_t task, bool remove)
+{
+    evsched_taskinfo_t  *tp;
+
+    tp = ds_tree_find(&evsched_tasks, &task);
+    if (tp && remove) {
+        evsched_heap_remove(tp);
     }
 
-    return NULL;
+    return tp;
 }
 
 static void
@@ -128,59 +261,34 @@ evsched_timer_callback(struct ev_loop *loop, ev_timer *timer, int revents)
     evsched_taskinfo_t      *tp;
     ds_list_iter_t          iter;
     ev_tstamp               cur_tm = ev_now(evsched_loop);
+    ev_tstamp               due_tm = cur_tm + ((float)evsched_slack_ms / 1000);
 
     // Avoid compiler warnings
     (void)loop;
     (void)timer;
     (void)revents;
 
-    tp = ds_list_ifirst(&iter, &evsched_tasklist);
-    while(tp) {
-        if (tp->trigger_time > cur_tm) {
-            break;
-        }
-
-        // Remove it from our task list
-        ds_list_iremove(&iter);
-
-        if (tp->remove) {
-            // Marked for removal, so free it
-            LOGT("Task %u canceled", tp->task_id);
-            free(tp);
+    // Tasks due within the slack window are run now rather than on a
+    // timer of their own
+    while ((tp = evsched_heap_first()) && tp->trigger_time <= due_tm) {
+        // Remove it from our task list. Tasks canceled by the function
+        // we call leave the heap right away.
+        evsched_heap_remove(tp);
+
+        // Call function
+        evsched_current = tp;
+        tp->func(tp->func_arg);
+        evsched_current = NULL;
+
+        if (tp->resched) {
+            // Queue it to be rescheduled
+            tp->sched_time = cur_tm;
+            ds_list_insert_tail(&evsched_pending, tp);
         }
         else {
-            // Call function
-            evsched_current = tp;
-            tp->func(tp->func_arg);
-            evsched_current = NULL;
-
-            if (tp->resched) {
-                // Queue it to be rescheduled
-                tp->sched_time = cur_tm;
-                ds_list_insert_tail(&evsched_pending, tp);
-            }
-            else {
-                // we're done with it, let's free it
-                free(tp);
-            }
-        }
-
-        tp = ds_list_inext(&iter);
-    }
-
-    // Walk and free tasks marked for removal
-    tp = ds_list_ifirst(&iter, &evsched_tasklist);
-    while(tp) {
-        if (tp->remove) {
-            // Remove it from our task list
-            ds_list_iremove(&iter);
-
-            // Marked for removal, so free it
-            LOGT("Task %u canceled", tp->task_id);
+            // we're done with it, let's free it
             free(tp);
         }
-
-        tp = ds_list_inext(&iter);
     }
 
     // Reinsert pending tasks queued for rescheduling
@@ -198,7 +306,7 @@ evsched_timer_callback(struct ev_loop *loop, ev_timer *timer, int revents)
     }
 
     // See if we need to restart our timer
-    if ((tp = ds_list_ifirst(&iter, &evsched_tasklist))) {
+    if ((tp = evsched_heap_first())) {
         evsched_reset_timer(tp->trigger_time - ev_now(evsched_loop));
     }
 
@@ -209,6 +317,7 @@ static bool
 evsched_task_insert(evsched_taskinfo_t *ntp, bool restart)
 {
     evsched_taskinfo_t      *tp;
+    ds_list_t               jumped;
     ds_list_iter_t          iter;
 
     // Calculate the trigger time for this task
@@ -218,21 +327,34 @@ evsched_task_insert(evsched_taskinfo_t *ntp, bool restart)
     ntp->resched = false;
 
     // Check for time jump
-    tp = ds_list_head(&evsched_tasklist);
+    tp = evsched_heap_first();
     if (tp && ((ntp->sched_time - tp->sched_time) > TIME_JUMP_THRESHOLD)) {
         // Time has jumped.  Best we can do is fix-up existing events to run
         // immediately.  Not ideal, but best we can do for now.
         LOGW("Detected time jump! Events may happen sooner then requested");
-        while(tp) {
+        ds_list_init(&jumped, evsched_taskinfo_t, node);
+        while((tp = evsched_heap_first())) {
             if ((ntp->sched_time - tp->sched_time) > TIME_JUMP_THRESHOLD) {
+                evsched_heap_remove(tp);
                 tp->sched_time = ntp->sched_time;
                 tp->trigger_time = tp->sched_time;
+                ds_list_insert_tail(&jumped, tp);
             }
             else {
                 break;
             }
+        }
+
+        // Put them back in their former order, ahead of the new task
+        tp = ds_list_ifirst(&iter, &jumped);
+        while(tp) {
+            ds_list_iremove(&iter);
+            if (evsched_heap_push(tp) == false) {
+                LOGE("evsched_task_insert() failed to requeue task %u", tp->task_id);
+                free(tp);
+            }
 
-            tp = ds_list_next(&evsched_tasklist, tp);
+            tp = ds_list_inext(&iter);
         }
 
         // Reschedule timer for immediate run
@@ -242,21 +364,12 @@ evsched_task_insert(evsched_taskinfo_t *ntp, bool restart)
     }
 
     // Insert into task list
-    tp = ds_list_ifirst(&iter, &evsched_tasklist);
-    while(tp) {
-        if (ntp->trigger_time < tp->trigger_time) {
-            ds_list_iinsert(&iter, ntp);
-            break;
-        }
-
-        tp = ds_list_inext(&iter);
-    }
-    if (!tp) {
-        ds_list_insert_tail(&evsched_tasklist, ntp);
+    if (evsched_heap_push(ntp) == false) {
+        return false;
     }
 
     // See if we need to restart our timer
-    if (restart && ds_list_head(&evsched_tasklist) == ntp) {
+    if (restart && evsched_heap_first() == ntp) {
         evsched_reset_timer(ntp->trigger_time - ntp->sched_time);
     }
 
@@ -282,8 +395,11 @@ evsched_init(struct ev_loop *loop)
         evsched_loop = EV_DEFAULT;
     }
 
-    // Initialize our link list of tasks
-    ds_list_init(&evsched_tasklist, evsched_taskinfo_t, node);
+    // Initialize our task heap and pending list
+    evsched_heap = NULL;
+    evsched_heap_len = 0;
+    evsched_heap_size = 0;
+    ds_tree_init(&evsched_tasks, evsched_task_id_cmp, evsched_taskinfo_t, id_node);
     ds_list_init(&evsched_pending,  evsched_taskinfo_t, node);
 
     // Initialize our EV timer
@@ -309,8 +425,16 @@ evsched_cleanup(void)
     // Stop our timer
     ev_timer_stop(evsched_loop, &evsched_timer);
 
-    // Free our task list
-    tp = ds_list_ifirst(&iter, &evsched_tasklist);
+    // Free our task heap
+    while ((tp = evsched_heap_first())) {
+        evsched_heap_remove(tp);
+        free(tp);
+    }
+    free(evsched_heap);
+    evsched_heap = NULL;
+    evsched_heap_size = 0;
+
+    tp = ds_list_ifirst(&iter, &evsched_pending);
     while(tp) {
         ds_list_iremove(&iter);
         free(tp);
@@ -322,6 +446,13 @@ evsched_cleanup(void)
     return true;
 }
 
+void
+evsched_set_slack(uint32_t ms)
+{
+    LOGD("Timer slack set to %u ms", ms);
+    evsched_slack_ms = ms;
+}
+
 evsched_task_t
 evsched_task(evsched_task_func_t func, void *arg, uint32_t ms)
 {
@@ -370,7 +501,9 @@ evsched_task(evsched_task_func_t func, void *arg, uint32_t ms)
 evsched_task_t
 evsched_task_find(evsched_task_func_t func, void *arg, uint8_t find_by)
 {
+    evsched_taskinfo_t      *found = NULL;
     evsched_taskinfo_t      *tp;
+    uint32_t                i;
 
     if (!evsched_initialized) {
         LOGE("evsched_task_find() called before initialization!");
@@ -382,7 +515,9 @@ evsched_task_find(evsched_task_func_t func, void *arg, uint8_t find_by)
         return 0;
     }
 
-    ds_list_foreach(&evsched_tasklist, tp) {
+    // Return the match which triggers first, as the sorted list used to
+    for (i = 0; i < evsched_heap_len; i++) {
+        tp = evsched_heap[i];
         if ((find_by & EVSCHED_FIND_BY_FUNC) && tp->func != func) {
             continue;
         }
@@ -391,12 +526,12 @@ evsched_task_find(evsched_task_func_t func, void *arg, uint8_t find_by)
             continue;
         }
 
-        // Found a match
-        return tp->task_id;
+        if (!found || evsched_heap_before(tp, found)) {
+            found = tp;
+        }
     }
 
-    // Not found
-    return 0;
+    return found ? found->task_id : 0;
 }
 
 uint32_t
@@ -442,6 +577,7 @@ evsched_task_update(evsched_task_t task, uint32_t ms)
     tp->sched_time = ev_now(evsched_loop);
     if (evsched_current) {
         // Queue it up
+        tp->ms = ms;
         ds_list_insert_tail(&evsched_pending, tp);
         LOGT("Task %u queued to be updated (%u ms)", tp->task_id, tp->ms);
     }
@@ -469,25 +605,15 @@ evsched_task_cancel(evsched_task_t task)
         return false;
     }
 
-    if (evsched_current) {
-        // Running a task, cannot remove it now
-        if (task == evsched_current->task_id) {
-            // Just clear out resched flag if set
-            evsched_current->resched = false;
-        }
-        else {
-            // Mark it for removal
-            tp = evsched_get_taskinfo(task, false);
-            if (!tp) {
-                return false;
-            }
-            tp->remove = true;
-            LOGT("Task %u marked for cancellation", task);
-        }
+    if (evsched_current && task == evsched_current->task_id) {
+        // Running this task, cannot remove it now.
+        // Just clear out resched flag if set
+        evsched_current->resched = false;
         return true;
     }
 
-    // Remove and free it now
+    // Remove and free it now, the timer callback picks the next task
+    // from the heap after each call so this is safe while it runs
     tp = evsched_get_taskinfo(task, true);
     if (!tp) {
         return false;
@@ -0,0 +1,302 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <ev.h>
+
+#include "const.h"
+#include "log.h"
+#include "os_time.h"
+#include "target.h"
+#include "unity.h"
+#include "evsched.h"
+
+#define TEST_NUM_TASKS 64
+#define TEST_BENCH_TASKS 10000
+
+const char *test_name = "evsched_tests";
+
+/**
+ * @brief task run bookkeeping
+ */
+struct test_task
+{
+    int id;
+    evsched_task_t task;
+    int runs;
+    int reschedules;
+    int cancel;
+    ev_tstamp run_time;
+};
+
+static struct ev_loop *g_loop;
+static struct test_task g_tasks[TEST_NUM_TASKS];
+static int g_order[TEST_NUM_TASKS * 4];
+static int g_nrun;
+static int g_expected;
+
+
+static void
+test_task_cb(void *arg)
+{
+    struct test_task *t = arg;
+
+    t->runs++;
+    t->run_time = ev_now(g_loop);
+    g_order[g_nrun++] = t->id;
+
+    if (t->cancel >= 0)
+    {
+        TEST_ASSERT_TRUE(evsched_task_cancel(g_tasks[t->cancel].task));
+        t->cancel = -1;
+        g_expected--;
+    }
+
+    if (t->reschedules > 0)
+    {
+        t->reschedules--;
+        evsched_task_reschedule_ms(5);
+        g_expected++;
+    }
+
+    if (g_nrun == g_expected) ev_break(g_loop, EVBREAK_ALL);
+}
+
+
+static void
+test_run(int expected)
+{
+    g_expected = expected;
+    ev_run(g_loop, 0);
+    TEST_ASSERT_EQUAL_INT(g_expected, g_nrun);
+}
+
+
+void
+setUp(void)
+{
+    int i;
+
+    g_loop = ev_default_loop(0);
+    evsched_init(g_loop);
+    evsched_set_slack(0);
+
+    memset(g_tasks, 0, sizeof(g_tasks));
+    for (i = 0; i < TEST_NUM_TASKS; i++)
+    {
+        g_tasks[i].id = i;
+        g_tasks[i].cancel = -1;
+    }
+    g_nrun = 0;
+}
+
+
+void
+tearDown(void)
+{
+    evsched_cleanup();
+}
+
+
+/**
+ * @brief tasks run by trigger time, in scheduling order for equal times
+ */
+void
+test_evsched_order(void)
+{
+    static const uint32_t delays[] = { 30, 10, 20, 10, 0, 30, 20, 10 };
+    static const int expected[] = { 4, 1, 3, 7, 2, 6, 0, 5 };
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(delays); i++)
+    {
+        g_tasks[i].task = evsched_task(test_task_cb, &g_tasks[i], delays[i]);
+        TEST_ASSERT_NOT_EQUAL(0, g_tasks[i].task);
+    }
+
+    test_run(ARRAY_SIZE(delays));
+    TEST_ASSERT_EQUAL_INT_ARRAY(expected, g_order, ARRAY_SIZE(expected));
+}
+
+
+/**
+ * @brief lookups, updates and cancellations by task id
+ */
+void
+test_evsched_update_cancel(void)
+{
+    uint32_t remaining;
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        g_tasks[i].task = evsched_task(test_task_cb, &g_tasks[i], 100 + i);
+    }
+
+    remaining = evsched_task_remaining(g_tasks[3].task);
+    TEST_ASSERT_TRUE(remaining > 0 && remaining <= 103);
+
+    TEST_ASSERT_EQUAL(g_tasks[5].task, evsched_task_find(test_task_cb, &g_tasks[5], EVSCHED_FIND_BY_ARG));
+    TEST_ASSERT_EQUAL(g_tasks[0].task, evsched_task_find(test_task_cb, NULL, EVSCHED_FIND_BY_FUNC));
+
+    TEST_ASSERT_TRUE(evsched_task_update(g_tasks[7].task, 1));
+    TEST_ASSERT_TRUE(evsched_task_cancel(g_tasks[0].task));
+    TEST_ASSERT_FALSE(evsched_task_cancel(g_tasks[0].task));
+    TEST_ASSERT_TRUE(evsched_task_cancel_by_find(test_task_cb, &g_tasks[4], EVSCHED_FIND_BY_ARG));
+    TEST_ASSERT_EQUAL(0, evsched_task_remaining(g_tasks[4].task));
+
+    /* A task canceling one due at the same time */
+    g_tasks[7].cancel = 1;
+    test_run(6);
+
+    TEST_ASSERT_EQUAL_INT(7, g_order[0]);
+    TEST_ASSERT_EQUAL_INT(0, g_tasks[0].runs);
+    TEST_ASSERT_EQUAL_INT(0, g_tasks[1].runs);
+    TEST_ASSERT_EQUAL_INT(0, g_tasks[4].runs);
+    TEST_ASSERT_EQUAL_INT(1, g_tasks[6].runs);
+}
+
+
+/**
+ * @brief tasks rescheduling themselves from their function
+ */
+void
+test_evsched_reschedule(void)
+{
+    g_tasks[0].reschedules = 3;
+    g_tasks[0].task = evsched_task(test_task_cb, &g_tasks[0], 1);
+    g_tasks[1].task = evsched_task(test_task_cb, &g_tasks[1], 50);
+
+    test_run(2);
+
+    TEST_ASSERT_EQUAL_INT(4, g_tasks[0].runs);
+    TEST_ASSERT_EQUAL_INT(1, g_tasks[1].runs);
+    TEST_ASSERT_EQUAL_INT(1, g_order[4]);
+}
+
+
+/**
+ * @brief tasks due within the slack window run together
+ */
+void
+test_evsched_slack(void)
+{
+    evsched_set_slack(100);
+
+    g_tasks[0].task = evsched_task(test_task_cb, &g_tasks[0], 10);
+    g_tasks[1].task = evsched_task(test_task_cb, &g_tasks[1], 60);
+    g_tasks[2].task = evsched_task(test_task_cb, &g_tasks[2], 300);
+
+    test_run(3);
+
+    TEST_ASSERT_TRUE(g_tasks[0].run_time == g_tasks[1].run_time);
+    TEST_ASSERT_TRUE(g_tasks[2].run_time > g_tasks[1].run_time);
+}
+
+
+static void
+test_bench_cb(void *arg)
+{
+    (void)arg;
+    g_nrun++;
+    if (g_nrun == g_expected) ev_break(g_loop, EVBREAK_ALL);
+}
+
+
+/**
+ * @brief 10k outstanding tasks: schedule, update, cancel and run
+ */
+void
+test_evsched_bench(void)
+{
+    static evsched_task_t tasks[TEST_BENCH_TASKS];
+    int64_t start;
+    int64_t sched_us;
+    int64_t update_us;
+    int64_t cancel_us;
+    int64_t run_us;
+    int i;
+
+    srand(1);
+
+    start = clock_mono_usec();
+    for (i = 0; i < TEST_BENCH_TASKS; i++)
+    {
+        tasks[i] = evsched_task(test_bench_cb, &tasks[i], 1000 + rand() % 60000);
+        TEST_ASSERT_NOT_EQUAL(0, tasks[i]);
+    }
+    sched_us = clock_mono_usec() - start;
+
+    start = clock_mono_usec();
+    for (i = 0; i < TEST_BENCH_TASKS; i++)
+    {
+        TEST_ASSERT_TRUE(evsched_task_update(tasks[i], rand() % 50));
+    }
+    update_us = clock_mono_usec() - start;
+
+    start = clock_mono_usec();
+    for (i = 0; i < TEST_BENCH_TASKS; i += 2)
+    {
+        TEST_ASSERT_TRUE(evsched_task_cancel(tasks[i]));
+    }
+    cancel_us = clock_mono_usec() - start;
+
+    start = clock_mono_usec();
+    g_expected = TEST_BENCH_TASKS / 2;
+    ev_run(g_loop, 0);
+    run_us = clock_mono_usec() - start;
+    TEST_ASSERT_EQUAL_INT(TEST_BENCH_TASKS / 2, g_nrun);
+
+    LOGI("%s: %d tasks: schedule %"PRId64" us, update %"PRId64" us, "
+         "cancel half %"PRId64" us, run %"PRId64" us",
+         __func__, TEST_BENCH_TASKS, sched_us, update_us, cancel_us, run_us);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_evsched_order);
+    RUN_TEST(test_evsched_update_cancel);
+    RUN_TEST(test_evsched_reschedule);
+    RUN_TEST(test_evsched_slack);
+    RUN_TEST(test_evsched_bench);
+
+    return UNITY_END();
+}
@@ -28,10 +28,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define FSM_POLICY_H_INCLUDED
 
 #include <ev.h>
+#include <stdint.h>
 #include <time.h>
 
 #include "ds_tree.h"
 #include "ds_list.h"
+#include "ds_dlist.h"
 #include "ovsdb_utils.h"
 #include "os_types.h"
 #include "schema.h"
@@ -170,6 +172,7 @@ struct fsm_url_request
 
 struct fsm_policy_req;
 struct fsm_policy;
+struct fsm_wc_lookup;
 
 struct fqdn_pending_req
 {
@@ -213,6 +216,9 @@ struct fqdn_pending_req
     bool (*risk_level_check)(struct fsm_session *session,
                              struct fsm_policy_req *req,
                              struct fsm_policy *policy);
+    struct fsm_wc_lookup *wc_lookup;   // pending verdict lookup
+    void (*wc_done)(struct fqdn_pending_req *);
+    ds_dlist_node_t wc_node;           // verdict lookup waiters node
     ds_tree_node_t req_node;           // DS tree node
 };
 
@@ -313,12 +319,112 @@ struct fsm_url_stats {
     int64_t avg_lookup_latency;      /* average lookup latency */
 };
 
+/**
+ * @brief node of the fqdn labels trie, labels read right to left
+ *
+ * The masks flag the policies, by index, owning an entry ending at the node.
+ */
+struct fsm_fqdn_node
+{
+    char *label;
+    uint64_t exact;           /* exact and wildcard entries */
+    uint64_t sfr;             /* sfr entries, also match the subdomains */
+    uint64_t sfr_sub;         /* sfr entries with a leading dot */
+    ds_tree_t children;       /* literal labels */
+    ds_dlist_t patterns;      /* wildcard labels, matched with fnmatch() */
+    ds_tree_node_t node;
+    ds_dlist_node_t pnode;
+};
+
+/**
+ * @brief node of the fqdn characters trie, read left to right
+ */
+struct fsm_fqdn_cnode
+{
+    char c;
+    uint64_t end;             /* sfl entries ending at the node */
+    struct fsm_fqdn_cnode *child;
+    struct fsm_fqdn_cnode *sibling;
+};
+
+/**
+ * @brief the fqdn sets of a policy table, compiled for lookups
+ */
+struct fsm_fqdn_matcher
+{
+    struct fsm_fqdn_node *labels;
+    struct fsm_fqdn_cnode *prefixes;
+    size_t nentries;
+    bool dirty;               /* the table's policies changed */
+};
+
+/**
+ * @brief web categorization verdict, cached by fqdn
+ *
+ * Negative verdicts (uncategorized fqdn, failed lookup) expire sooner.
+ */
+struct fsm_wc_verdict
+{
+    char *fqdn;
+    struct fsm_url_reply reply;
+    bool negative;
+    int64_t expiry;           /* monotonic time, in ms */
+    ds_tree_node_t node;
+    ds_dlist_node_t lru_node;
+};
+
+/**
+ * @brief asynchronous verdict lookup, shared by the requests of a fqdn
+ *
+ * The provider fills the reply then calls fsm_wc_lookup_done().
+ */
+struct fsm_wc_lookup
+{
+    struct fsm_session *session;
+    char *fqdn;
+    struct fsm_url_reply reply;
+    int ttl;                  /* verdict ttl in seconds, 0 for the default */
+    bool submitting;          /* being handed over to the provider */
+    bool done;
+    int64_t start;            /* monotonic time, in ms */
+    ds_dlist_t waiters;       /* fqdn_pending_req waiting for the verdict */
+    ds_tree_node_t node;
+};
+
+#define FSM_WC_CACHE_DEFAULT_SIZE 4096
+#define FSM_WC_CACHE_DEFAULT_TTL 3600
+#define FSM_WC_CACHE_DEFAULT_NEG_TTL 60
+
+enum {
+    FSM_WC_VERDICT_READY = 0,
+    FSM_WC_VERDICT_PENDING,
+    FSM_WC_VERDICT_UNAVAILABLE,
+};
+
+/**
+ * @brief verdicts cache shared by the web categorization providers
+ */
+struct fsm_wc_cache
+{
+    bool initialized;
+    ds_tree_t verdicts;       /* fsm_wc_verdict by fqdn */
+    ds_dlist_t lru;           /* most recently used first */
+    size_t nentries;
+    size_t max_entries;
+    int ttl;                  /* seconds */
+    int neg_ttl;              /* seconds */
+    ds_tree_t lookups;        /* fsm_wc_lookup in flight, by fqdn */
+    struct fsm_url_stats stats;
+    int64_t latency_sum;      /* ms, of the successful lookups */
+};
+
 #define POLICY_NAME_SIZE 32
 struct policy_table
 {
     char name[POLICY_NAME_SIZE];
     ds_tree_t policies;
     struct fsm_policy *lookup_array[FSM_MAX_POLICIES];
+    struct fsm_fqdn_matcher fqdn_matcher;
     ds_tree_node_t table_node;
 };
 
@@ -361,5 +467,24 @@ void fsm_policy_register_client(struct fsm_policy_client *client);
 void fsm_policy_deregister_client(struct fsm_policy_client *client);
 void fsm_policy_update_clients(struct policy_table *table);
 bool find_mac_in_set(os_macaddr_t *mac, struct str_set *macs_set);
+bool fsm_fqdn_matcher_build(struct policy_table *table);
+void fsm_fqdn_matcher_free(struct fsm_fqdn_matcher *matcher);
+uint64_t fsm_fqdn_matcher_lookup(struct fsm_fqdn_matcher *matcher,
+                                 const char *fqdn);
+struct fsm_wc_cache *fsm_wc_cache_get(void);
+void fsm_wc_cache_set_config(size_t max_entries, int ttl, int neg_ttl);
+void fsm_wc_cache_flush(void);
+void fsm_wc_cache_get_stats(struct fsm_url_stats *stats);
+int fsm_wc_verdict_get(struct fsm_session *session,
+                       struct fqdn_pending_req *req,
+                       void (*done)(struct fqdn_pending_req *));
+void fsm_wc_verdict_cancel(struct fqdn_pending_req *req);
+void fsm_wc_lookup_done(struct fsm_wc_lookup *lookup);
+bool fsm_wc_verdict_cat_check(struct fsm_session *session,
+                              struct fsm_policy_req *req,
+                              struct fsm_policy *policy);
+bool fsm_wc_verdict_risk_check(struct fsm_session *session,
+                               struct fsm_policy_req *req,
+                               struct fsm_policy *policy);
 
 #endif /* FSM_POLICY_H_INCLUDED */
@@ -0,0 +1,505 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fnmatch.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "ds_tree.h"
+#include "ds_dlist.h"
+#include "fsm_policy.h"
+
+/*
+ * The fqdn sets of all the policies of a table are compiled together.
+ * Each trie node carries a bit mask of the policies (by index) whose set
+ * holds an entry ending at the node, so that a single walk of a request
+ * returns every policy the fqdn belongs to.
+ *
+ * - exact (in/out), start from right (sfr_in/sfr_out) and wildcard
+ *   (wild_in/wild_out) entries go in a trie of labels, read right to left.
+ * - start from left (sfl_in/sfl_out) entries go in a trie of characters.
+ */
+
+#if FSM_MAX_POLICIES > 64
+#error "fqdn matcher policy masks are limited to 64 policies"
+#endif
+
+/* A domain name is at most 255 octets long (RFC 1035) */
+#define FSM_FQDN_LABEL_MAX 256
+#define FSM_FQDN_WILDCHARS "*?["
+
+
+/**
+ * @brief returns the start of the rightmost label of a fqdn part
+ *
+ * @param fqdn the fqdn
+ * @param end the length of the fqdn part
+ * @return the start of the label
+ */
+static const char *
+fsm_fqdn_label_start(const char *fqdn, size_t end)
+{
+    const char *label;
+
+    label = fqdn + end;
+    while (label != fqdn && *(label - 1) != '.') label--;
+
+    return label;
+}
+
+
+/**
+ * @brief allocates a label trie node
+ *
+ * @param label the node's label, NULL for the root
+ * @param len the label length
+ * @return the node, NULL if out of memory
+ */
+static struct fsm_fqdn_node *
+fsm_fqdn_node_alloc(const char *label, size_t len)
+{
+    struct fsm_fqdn_node *node;
+
+    node = calloc(1, sizeof(*node));
+    if (node == NULL) return NULL;
+
+    if (label != NULL)
+    {
+        node->label = strndup(label, len);
+        if (node->label == NULL)
+        {
+            free(node);
+            return NULL;
+        }
+    }
+
+    ds_tree_init(&node->children, ds_str_cmp, struct fsm_fqdn_node, node);
+    ds_dlist_init(&node->patterns, struct fsm_fqdn_node, pnode);
+
+    return node;
+}
+
+
+/**
+ * @brief frees a label trie node and its descendants
+ *
+ * @param node the node to free
+ */
+static void
+fsm_fqdn_node_free(struct fsm_fqdn_node *node)
+{
+    struct fsm_fqdn_node *child;
+
+    if (node == NULL) return;
+
+    while ((child = ds_tree_head(&node->children)) != NULL)
+    {
+        ds_tree_remove(&node->children, child);
+        fsm_fqdn_node_free(child);
+    }
+
+    while ((child = ds_dlist_remove_head(&node->patterns)) != NULL)
+    {
+        fsm_fqdn_node_free(child);
+    }
+
+    free(node->label);
+    free(node);
+}
+
+
+/**
+ * @brief returns the child of a node for a label, adding it if missing
+ *
+ * @param node the parent node
+ * @param label the label
+ * @param len the label length
+ * @param pattern whether the label is matched as a pattern
+ * @return the child node, NULL if out of memory or the label is too long
+ */
+static struct fsm_fqdn_node *
+fsm_fqdn_node_get_child(struct fsm_fqdn_node *node, const char *label,
+                        size_t len, bool pattern)
+{
+    char key[FSM_FQDN_LABEL_MAX];
+    struct fsm_fqdn_node *child;
+
+    if (len >= sizeof(key))
+    {
+        LOGE("%s: label %.*s... too long", __func__, 32, label);
+        return NULL;
+    }
+
+    memcpy(key, label, len);
+    key[len] = '\0';
+
+    if (pattern)
+    {
+        ds_dlist_foreach(&node->patterns, child)
+        {
+            if (strcmp(child->label, key) == 0) return child;
+        }
+    }
+    else
+    {
+        child = ds_tree_find(&node->children, key);
+        if (child != NULL) return child;
+    }
+
+    child = fsm_fqdn_node_alloc(label, len);
+    if (child == NULL) return NULL;
+
+    if (pattern) ds_dlist_insert_tail(&node->patterns, child);
+    else ds_tree_insert(&node->children, child, child->label);
+
+    return child;
+}
+
+
+/**
+ * @brief adds an entry to the label trie
+ *
+ * @param root the trie root
+ * @param entry the fqdn set entry
+ * @param op the policy's fqdn lookup
+ * @param bit the policy's mask bit
+ * @return true if success, false otherwise
+ *
+ * On failure, the labels of the entry already added are left in the trie
+ * with empty masks: they don't match anything.
+ */
+static bool
+fsm_fqdn_labels_add(struct fsm_fqdn_node *root, const char *entry, int op,
+                    uint64_t bit)
+{
+    struct fsm_fqdn_node *node;
+    const char *label;
+    bool subdomains;
+    bool pattern;
+    size_t end;
+    size_t len;
+
+    /* A leading dot restricts a sfr entry to the subdomains */
+    subdomains = (op == FSM_FQDN_OP_SFR && *entry == '.');
+    if (subdomains) entry++;
+
+    end = strlen(entry);
+    if (end && entry[end - 1] == '.') end--;
+
+    node = root;
+    while (end != 0)
+    {
+        label = fsm_fqdn_label_start(entry, end);
+        len = entry + end - label;
+
+        pattern = (op == FSM_FQDN_OP_WILD);
+        pattern &= (strcspn(label, FSM_FQDN_WILDCHARS) < len);
+        node = fsm_fqdn_node_get_child(node, label, len, pattern);
+        if (node == NULL) return false;
+
+        end = (label == entry ? 0 : (size_t)(label - entry - 1));
+    }
+
+    if (op == FSM_FQDN_OP_SFR && subdomains) node->sfr_sub |= bit;
+    else if (op == FSM_FQDN_OP_SFR) node->sfr |= bit;
+    else node->exact |= bit;
+
+    return true;
+}
+
+
+/**
+ * @brief adds an entry to the characters trie
+ *
+ * @param root the trie root
+ * @param entry the fqdn set entry
+ * @param bit the policy's mask bit
+ * @return true if success, false otherwise
+ */
+static bool
+fsm_fqdn_prefixes_add(struct fsm_fqdn_cnode *root, const char *entry,
+                      uint64_t bit)
+{
+    struct fsm_fqdn_cnode *node;
+    struct fsm_fqdn_cnode *child;
+
+    node = root;
+    for (; *entry != '\0'; entry++)
+    {
+        for (child = node->child; child != NULL; child = child->sibling)
+        {
+            if (child->c == *entry) break;
+        }
+
+        if (child == NULL)
+        {
+            child = calloc(1, sizeof(*child));
+            if (child == NULL) return false;
+
+            child->c = *entry;
+            child->sibling = node->child;
+            node->child = child;
+        }
+        node = child;
+    }
+    node->end |= bit;
+
+    return true;
+}
+
+
+/**
+ * @brief frees a characters trie
+ *
+ * @param node the trie root
+ */
+static void
+fsm_fqdn_cnode_free(struct fsm_fqdn_cnode *node)
+{
+    struct fsm_fqdn_cnode *next;
+
+    while (node != NULL)
+    {
+        fsm_fqdn_cnode_free(node->child);
+        next = node->sibling;
+        free(node);
+        node = next;
+    }
+}
+
+
+/**
+ * @brief maps a policy fqdn rule to its lookup
+ *
+ * @param fqdn_op the policy's fqdn rule operation
+ * @return the lookup
+ */
+static int
+fsm_fqdn_rule_lookup(int fqdn_op)
+{
+    switch (fqdn_op)
+    {
+        case FQDN_OP_SFR_IN:
+        case FQDN_OP_SFR_OUT:
+            return FSM_FQDN_OP_SFR;
+
+        case FQDN_OP_SFL_IN:
+        case FQDN_OP_SFL_OUT:
+            return FSM_FQDN_OP_SFL;
+
+        case FQDN_OP_WILD_IN:
+        case FQDN_OP_WILD_OUT:
+            return FSM_FQDN_OP_WILD;
+
+        default:
+            return FSM_FQDN_OP_XM;
+    }
+}
+
+
+/**
+ * @brief releases a compiled matcher
+ *
+ * @param matcher the matcher
+ */
+void
+fsm_fqdn_matcher_free(struct fsm_fqdn_matcher *matcher)
+{
+    fsm_fqdn_node_free(matcher->labels);
+    fsm_fqdn_cnode_free(matcher->prefixes);
+    matcher->labels = NULL;
+    matcher->prefixes = NULL;
+    matcher->nentries = 0;
+}
+
+
+/**
+ * @brief compiles the fqdn sets of a table's policies
+ *
+ * An entry that can't be compiled is logged and skipped, the table keeps a
+ * matcher for its other entries.
+ *
+ * @param table the policy table
+ * @return true if the matcher was built, false otherwise
+ */
+bool
+fsm_fqdn_matcher_build(struct policy_table *table)
+{
+    struct fsm_fqdn_matcher *matcher;
+    struct fsm_policy_rules *rules;
+    struct fsm_policy *p;
+    size_t nerrors;
+    uint64_t bit;
+    size_t i;
+    size_t j;
+    bool ret;
+    int op;
+
+    matcher = &table->fqdn_matcher;
+    fsm_fqdn_matcher_free(matcher);
+    matcher->dirty = false;
+
+    matcher->labels = fsm_fqdn_node_alloc(NULL, 0);
+    matcher->prefixes = calloc(1, sizeof(*matcher->prefixes));
+    if (matcher->labels == NULL || matcher->prefixes == NULL) goto err_free;
+
+    nerrors = 0;
+    for (i = 0; i < FSM_MAX_POLICIES; i++)
+    {
+        p = table->lookup_array[i];
+        if (p == NULL) continue;
+
+        rules = &p->rules;
+        if (!rules->fqdn_rule_present || rules->fqdns == NULL) continue;
+
+        bit = 1ULL << i;
+        op = fsm_fqdn_rule_lookup(rules->fqdn_op);
+        for (j = 0; j < rules->fqdns->nelems; j++)
+        {
+            if (op == FSM_FQDN_OP_SFL)
+            {
+                ret = fsm_fqdn_prefixes_add(matcher->prefixes,
+                                            rules->fqdns->array[j], bit);
+            }
+            else
+            {
+                ret = fsm_fqdn_labels_add(matcher->labels,
+                                          rules->fqdns->array[j], op, bit);
+            }
+            if (!ret)
+            {
+                LOGE("%s: %s: failed to compile %s, skipping it", __func__,
+                     p->rule_name, rules->fqdns->array[j]);
+                nerrors++;
+                continue;
+            }
+            matcher->nentries++;
+        }
+    }
+
+    LOGD("%s: table %s: compiled %zu fqdn entries, skipped %zu", __func__,
+         table->name, matcher->nentries, nerrors);
+
+    return true;
+
+err_free:
+    /* Out of memory, retry on the next lookup */
+    fsm_fqdn_matcher_free(matcher);
+    matcher->dirty = true;
+
+    return false;
+}
+
+
+/**
+ * @brief walks the label trie with the labels of a fqdn, right to left
+ *
+ * @param node the node matching the labels right of @p end
+ * @param fqdn the fqdn
+ * @param end the length of the fqdn part left to match
+ * @param mask the matching policies, updated
+ */
+static void
+fsm_fqdn_labels_match(struct fsm_fqdn_node *node, const char *fqdn,
+                      size_t end, uint64_t *mask)
+{
+    char key[FSM_FQDN_LABEL_MAX];
+    struct fsm_fqdn_node *child;
+    const char *label;
+    size_t next;
+    size_t len;
+
+    if (end == 0)
+    {
+        *mask |= (node->exact | node->sfr);
+        return;
+    }
+
+    /* The fqdn is a subdomain of the node's entries */
+    *mask |= (node->sfr | node->sfr_sub);
+
+    label = fsm_fqdn_label_start(fqdn, end);
+    len = fqdn + end - label;
+    if (len >= sizeof(key)) return;
+
+    memcpy(key, label, len);
+    key[len] = '\0';
+    next = (label == fqdn ? 0 : (size_t)(label - fqdn - 1));
+
+    child = ds_tree_find(&node->children, key);
+    if (child != NULL) fsm_fqdn_labels_match(child, fqdn, next, mask);
+
+    ds_dlist_foreach(&node->patterns, child)
+    {
+        if (fnmatch(child->label, key, 0) != 0) continue;
+        fsm_fqdn_labels_match(child, fqdn, next, mask);
+    }
+}
+
+
+/**
+ * @brief returns the policies whose fqdn set holds a fqdn
+ *
+ * Does not allocate memory.
+ * @param matcher the compiled matcher
+ * @param fqdn the fqdn to look up
+ * @return the mask of the matching policies, by policy index
+ */
+uint64_t
+fsm_fqdn_matcher_lookup(struct fsm_fqdn_matcher *matcher, const char *fqdn)
+{
+    struct fsm_fqdn_cnode *node;
+    uint64_t mask;
+    size_t len;
+
+    mask = 0;
+    if (fqdn == NULL) return mask;
+
+    if (matcher->labels != NULL)
+    {
+        len = strlen(fqdn);
+        if (len && fqdn[len - 1] == '.') len--;
+        fsm_fqdn_labels_match(matcher->labels, fqdn, len, &mask);
+    }
+
+    node = matcher->prefixes;
+    while (node != NULL)
+    {
+        mask |= node->end;
+        if (*fqdn == '\0') break;
+
+        for (node = node->child; node != NULL; node = node->sibling)
+        {
+            if (node->c == *fqdn) break;
+        }
+        fqdn++;
+    }
+
+    return mask;
+}
@@ -36,7 +36,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <unistd.h>
 #include <sys/sysinfo.h>
 #include <limits.h>
-#include <fnmatch.h>
 
 #include "os.h"
 #include "util.h"
@@ -225,118 +224,18 @@ static bool fsm_mac_check(struct fsm_policy_req *req,
 }
 
 
-bool wildmatch(char *pattern, char *domain)
-{
-    char *delim = ".";
-    char *saveptr1;
-    char *saveptr2;
-    char *str1;
-    char *str2;
-    char *sub1;
-    char *sub2;
-    int ret;
-    int j;
-
-   for (j = 1, str1 = strdup(pattern), str2 = strdup(domain); ;
-        j++, str1 = NULL, str2 = NULL)
-   {
-        sub1 = strtok_r(str1, delim, &saveptr1);
-        sub2 = strtok_r(str2, delim, &saveptr2);
-        /*
-         * If we have reached the end of both strings without returning false
-         * then these match
-         */
-        if (sub1 == NULL && sub2 == NULL)
-        {
-            free(str1);
-            free(str2);
-
-            return true;
-        }
-
-        /*
-         * If one of the strings has ended, they weren't even and
-         * there was no match
-         */
-        if (sub1 == NULL || sub2 == NULL)
-        {
-            free(str1);
-            free(str2);
-
-            return false;
-        }
-
-
-        ret = fnmatch(sub1, sub2, 0);
-        if (ret)
-        {
-            free(str1);
-            free(str2);
-
-            return false;
-        }
-
-        free(str1);
-        free(str2);
-   }
-
-   return false;
-}
-
-
-/**
- * fsm_fqdn_in_set: looks up a fqdn in a policy's fqdns values set.
- * @req: the policy request
- * @p: policy
- * @op: lookup
- *
- * Checks if the request's fqdn is either an exact match, start from right
- * or start form left superset of an entry in the policy's fqdn set entry.
- */
-static bool fsm_fqdn_in_set(struct fsm_policy_req *req, struct fsm_policy *p,
-                            int op)
-{
-    struct str_set *fqdns_set;
-    size_t nelems, i;
-    int rc;
-
-    fqdns_set = p->rules.fqdns;
-    if (fqdns_set == NULL) return false;
-    nelems = fqdns_set->nelems;
-    for (i = 0; i < nelems; i++)
-    {
-        char *fqdn_req = req->url;
-        char *entry_set = fqdns_set->array[i];
-        int entry_set_len = strlen(entry_set);
-        int fqdn_req_len = strlen(fqdn_req);
-
-        if (entry_set_len > fqdn_req_len) continue;
-
-        if (op == FSM_FQDN_OP_WILD) return wildmatch(entry_set, fqdn_req);
-
-        if (op == FSM_FQDN_OP_SFR) fqdn_req += (fqdn_req_len - entry_set_len);
-
-        rc = strncmp(fqdn_req, entry_set, entry_set_len);
-        if (rc == 0) return true;
-    }
-    return false;
-}
-
 /**
  * fsm_fqdn_check: check if a fqdn matches the policy's fqdn rule
- * @req: the request being processed
  * @policy: the policy being checked against
+ * @fqdn_mask: the policies whose fqdn set holds the request's fqdn
  *
  */
-static bool fsm_fqdn_check(struct fsm_policy_req *req,
-                          struct fsm_policy *policy)
+static bool fsm_fqdn_check(struct fsm_policy *policy,
+                          uint64_t fqdn_mask)
 {
     struct fsm_policy_rules *rules;
     bool rc = false;
-    bool in_policy, sfr, sfl, wild;
-    int op;
-
-    op = FSM_FQDN_OP_XM;
+    bool in_policy;
 
     rules = &policy->rules;
     if (!rules->fqdn_rule_present) return true;
@@ -347,22 +246,8 @@ static bool fsm_fqdn_check(struct fsm_policy_req *req,
     in_policy |= (rules->fqdn_op == FQDN_OP_SFL_IN);
     in_policy |= (rules->fqdn_op == FQDN_OP_WILD_IN);
 
-
-    sfr = (rules->fqdn_op == FQDN_OP_SFR_IN);
-    sfr |= (rules->fqdn_op == FQDN_OP_SFR_OUT);
-    if (sfr) op = FSM_FQDN_OP_SFR;
-
-    sfl = (rules->fqdn_op == FQDN_OP_SFL_IN);
-    sfl |= (rules->fqdn_op == FQDN_OP_SFL_OUT);
-    if (sfl) op = FSM_FQDN_OP_SFL;
-
-
-    wild = (rules->fqdn_op == FQDN_OP_WILD_IN);
-    wild |= (rules->fqdn_op == FQDN_OP_WILD_OUT);
-    if (wild) op = FSM_FQDN_OP_WILD;
-
-
-    rc = fsm_fqdn_in_set(req, policy, op);
+    /* The fqdn sets of all the table's policies were looked up at once */
+    rc = ((fqdn_mask & (1ULL << policy->idx)) != 0);
 
     /* If fqdn in set and policy applies to fqdns out of set, no match */
     if ((rc) && (!in_policy)) return false;
@@ -641,6 +526,7 @@ void fsm_apply_policies(struct fsm_session *session,
     struct fsm_policy *last_match_policy;
     struct policy_table *table;
     struct fsm_policy *p;
+    uint64_t fqdn_mask;
 
     int i;
     bool rc, matched = false;
@@ -655,6 +541,10 @@ void fsm_apply_policies(struct fsm_session *session,
 
     last_match_policy = NULL;
 
+    /* Look the fqdn up in all the policies' fqdn sets in one pass */
+    if (table->fqdn_matcher.dirty) fsm_fqdn_matcher_build(table);
+    fqdn_mask = fsm_fqdn_matcher_lookup(&table->fqdn_matcher, req->url);
+
     for (i = 0; i < FSM_MAX_POLICIES; i++)
     {
         p = table->lookup_array[i];
@@ -665,7 +555,7 @@ void fsm_apply_policies(struct fsm_session *session,
         if (!rc) continue;
 
         /* MAC rule passed. Check FQDN */
-        rc = fsm_fqdn_check(req, p);
+        rc = fsm_fqdn_check(p, fqdn_mask);
         if (!rc) continue;
 
         /* fqdn rule passed. Check categories */
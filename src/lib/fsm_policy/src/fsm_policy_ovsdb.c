@@ -608,6 +608,7 @@ struct fsm_policy *fsm_policy_insert_schema_p(struct policy_table *table,
 
     fpolicy->table = table;
     table->lookup_array[idx] = fpolicy;
+    table->fqdn_matcher.dirty = true;
 
     /* Set lookup indeces */
     fsm_policy_get_prev(table, fpolicy);
@@ -734,6 +735,9 @@ void fsm_add_policy(struct schema_FSM_Policy *spolicy)
     }
 
     fsm_prepare_policy(fpolicy);
+
+    /* Compile the table's fqdn sets */
+    fsm_fqdn_matcher_build(fpolicy->table);
 }
 
 
@@ -758,6 +762,7 @@ void fsm_free_policy(struct fsm_policy *fpolicy)
     ds_tree_remove(&table->policies, fpolicy);
     idx = fpolicy->idx;
     table->lookup_array[idx] = NULL;
+    table->fqdn_matcher.dirty = true;
     free(fpolicy);
 }
 
@@ -812,7 +817,13 @@ void callback_FSM_Policy(ovsdb_update_monitor_t *mon,
     }
 
     if (mon->mon_type == OVSDB_UPDATE_DEL) {
+        struct policy_table *table;
+
         fsm_delete_policy(old_rec);
+
+        /* Compile the table's remaining fqdn sets */
+        table = fsm_policy_find_table(old_rec->policy);
+        if (table != NULL) fsm_fqdn_matcher_build(table);
     }
 
     if (mon->mon_type == OVSDB_UPDATE_MODIFY) {
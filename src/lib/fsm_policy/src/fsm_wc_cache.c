@@ -0,0 +1,607 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "ds_tree.h"
+#include "ds_dlist.h"
+#include "fsm.h"
+#include "fsm_policy.h"
+
+/*
+ * Web categorization verdicts, shared by all the providers.
+ *
+ * A provider offering the categories_lookup() operation is queried once
+ * per fqdn, whatever the number of requests waiting for the verdict. The
+ * verdict is cached until its ttl expires, the least recently used
+ * verdicts being evicted when the cache is full. Uncategorized fqdns and
+ * failed lookups are cached too, for a shorter time. Connection errors
+ * are not cached, the provider being considered offline by the caller.
+ */
+
+static struct fsm_wc_cache wc_cache;
+
+
+/**
+ * @brief returns the monotonic time in ms
+ */
+static int64_t
+fsm_wc_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * @brief returns the verdicts cache, initializing it on first call
+ */
+struct fsm_wc_cache *
+fsm_wc_cache_get(void)
+{
+    struct fsm_wc_cache *cache = &wc_cache;
+
+    if (cache->initialized) return cache;
+
+    ds_tree_init(&cache->verdicts, ds_str_cmp,
+                 struct fsm_wc_verdict, node);
+    ds_dlist_init(&cache->lru, struct fsm_wc_verdict, lru_node);
+    ds_tree_init(&cache->lookups, ds_str_cmp,
+                 struct fsm_wc_lookup, node);
+    cache->max_entries = FSM_WC_CACHE_DEFAULT_SIZE;
+    cache->ttl = FSM_WC_CACHE_DEFAULT_TTL;
+    cache->neg_ttl = FSM_WC_CACHE_DEFAULT_NEG_TTL;
+    cache->initialized = true;
+
+    return cache;
+}
+
+
+/**
+ * @brief removes a verdict from the cache
+ */
+static void
+fsm_wc_verdict_remove(struct fsm_wc_cache *cache,
+                      struct fsm_wc_verdict *verdict)
+{
+    ds_tree_remove(&cache->verdicts, verdict);
+    ds_dlist_remove(&cache->lru, verdict);
+    cache->nentries--;
+    free(verdict->fqdn);
+    free(verdict);
+}
+
+
+/**
+ * @brief evicts the least recently used verdicts down to a number of entries
+ */
+static void
+fsm_wc_cache_trim(struct fsm_wc_cache *cache, size_t nentries)
+{
+    struct fsm_wc_verdict *verdict;
+
+    while (cache->nentries > nentries)
+    {
+        verdict = ds_dlist_tail(&cache->lru);
+        if (verdict == NULL) break;
+
+        LOGT("%s: evicting %s", __func__, verdict->fqdn);
+        fsm_wc_verdict_remove(cache, verdict);
+    }
+}
+
+
+/**
+ * @brief sets the cache size and the verdicts ttls
+ *
+ * @param max_entries the maximum number of cached verdicts, 0 for the default
+ * @param ttl the verdicts ttl in seconds, 0 for the default
+ * @param neg_ttl the negative verdicts ttl in seconds, 0 for the default
+ */
+void
+fsm_wc_cache_set_config(size_t max_entries, int ttl, int neg_ttl)
+{
+    struct fsm_wc_cache *cache;
+
+    cache = fsm_wc_cache_get();
+    cache->max_entries = (max_entries ? max_entries :
+                          FSM_WC_CACHE_DEFAULT_SIZE);
+    cache->ttl = (ttl > 0 ? ttl : FSM_WC_CACHE_DEFAULT_TTL);
+    cache->neg_ttl = (neg_ttl > 0 ? neg_ttl : FSM_WC_CACHE_DEFAULT_NEG_TTL);
+
+    fsm_wc_cache_trim(cache, cache->max_entries);
+}
+
+
+/**
+ * @brief drops all the cached verdicts
+ *
+ * Lookups in flight are kept, their verdicts get cached on completion.
+ */
+void
+fsm_wc_cache_flush(void)
+{
+    struct fsm_wc_cache *cache;
+
+    cache = fsm_wc_cache_get();
+    fsm_wc_cache_trim(cache, 0);
+}
+
+
+/**
+ * @brief reports the cache and lookups statistics
+ *
+ * @param stats the stats container, its cache and cloud counters are set
+ */
+void
+fsm_wc_cache_get_stats(struct fsm_url_stats *stats)
+{
+    struct fsm_wc_cache *cache;
+    struct fsm_url_stats *cstats;
+
+    cache = fsm_wc_cache_get();
+    cstats = &cache->stats;
+
+    stats->cloud_lookups = cstats->cloud_lookups;
+    stats->cloud_hits = cstats->cloud_hits;
+    stats->cache_lookups = cstats->cache_lookups;
+    stats->cache_hits = cstats->cache_hits;
+    stats->cloud_lookup_failures = cstats->cloud_lookup_failures;
+    stats->categorization_failures = cstats->categorization_failures;
+    stats->uncategorized = cstats->uncategorized;
+    stats->cache_entries = cache->nentries;
+    stats->cache_size = cache->max_entries;
+    stats->min_lookup_latency = cstats->min_lookup_latency;
+    stats->max_lookup_latency = cstats->max_lookup_latency;
+    stats->avg_lookup_latency = cstats->avg_lookup_latency;
+}
+
+
+/**
+ * @brief checks if a provider reply carries no usable verdict
+ */
+static bool
+fsm_wc_reply_failed(struct fsm_url_reply *reply)
+{
+    return (reply->connection_error || (reply->error != 0));
+}
+
+
+/**
+ * @brief looks a fresh verdict up, and marks it most recently used
+ */
+static struct fsm_wc_verdict *
+fsm_wc_cache_lookup(struct fsm_wc_cache *cache, char *fqdn)
+{
+    struct fsm_wc_verdict *verdict;
+
+    cache->stats.cache_lookups++;
+
+    verdict = ds_tree_find(&cache->verdicts, fqdn);
+    if (verdict == NULL) return NULL;
+
+    if (verdict->expiry <= fsm_wc_now())
+    {
+        LOGT("%s: %s verdict expired", __func__, fqdn);
+        fsm_wc_verdict_remove(cache, verdict);
+        return NULL;
+    }
+
+    ds_dlist_remove(&cache->lru, verdict);
+    ds_dlist_insert_head(&cache->lru, verdict);
+    cache->stats.cache_hits++;
+
+    return verdict;
+}
+
+
+/**
+ * @brief caches the verdict of a completed lookup
+ */
+static void
+fsm_wc_cache_add(struct fsm_wc_cache *cache, struct fsm_wc_lookup *lookup)
+{
+    struct fsm_wc_verdict *verdict;
+    struct fsm_url_reply *reply;
+    bool negative;
+    int ttl;
+
+    reply = &lookup->reply;
+    if (reply->connection_error) return;
+
+    negative = (fsm_wc_reply_failed(reply) || (reply->nelems == 0));
+    ttl = (lookup->ttl > 0 ? lookup->ttl : cache->ttl);
+    if (negative && ttl > cache->neg_ttl) ttl = cache->neg_ttl;
+
+    verdict = ds_tree_find(&cache->verdicts, lookup->fqdn);
+    if (verdict == NULL)
+    {
+        fsm_wc_cache_trim(cache, cache->max_entries - 1);
+
+        verdict = calloc(1, sizeof(*verdict));
+        if (verdict == NULL) return;
+
+        verdict->fqdn = strdup(lookup->fqdn);
+        if (verdict->fqdn == NULL)
+        {
+            free(verdict);
+            return;
+        }
+        ds_tree_insert(&cache->verdicts, verdict, verdict->fqdn);
+        cache->nentries++;
+    }
+    else
+    {
+        ds_dlist_remove(&cache->lru, verdict);
+    }
+    ds_dlist_insert_head(&cache->lru, verdict);
+
+    verdict->reply = *reply;
+    verdict->negative = negative;
+    verdict->expiry = fsm_wc_now() + (int64_t)ttl * 1000;
+}
+
+
+/**
+ * @brief updates the lookups statistics with a completed lookup
+ */
+static void
+fsm_wc_lookup_stats(struct fsm_wc_cache *cache, struct fsm_wc_lookup *lookup)
+{
+    struct fsm_url_stats *stats;
+    struct fsm_url_reply *reply;
+    int64_t latency;
+
+    stats = &cache->stats;
+    reply = &lookup->reply;
+
+    if (reply->connection_error)
+    {
+        stats->cloud_lookup_failures++;
+        return;
+    }
+
+    if (reply->error != 0)
+    {
+        stats->categorization_failures++;
+        return;
+    }
+
+    if (reply->nelems == 0) stats->uncategorized++;
+
+    latency = fsm_wc_now() - lookup->start;
+    stats->cloud_hits++;
+    if (stats->cloud_hits == 1 || latency < stats->min_lookup_latency)
+    {
+        stats->min_lookup_latency = latency;
+    }
+    if (latency > stats->max_lookup_latency)
+    {
+        stats->max_lookup_latency = latency;
+    }
+    cache->latency_sum += latency;
+    stats->avg_lookup_latency = cache->latency_sum / stats->cloud_hits;
+}
+
+
+/**
+ * @brief hands a verdict over to a request
+ *
+ * The request's categorization checks are then run against the verdict.
+ */
+static void
+fsm_wc_set_verdict(struct fqdn_pending_req *req, struct fsm_url_reply *reply)
+{
+    struct fsm_url_request *req_info;
+
+    req_info = req->req_info;
+    free(req_info->reply);
+    req_info->reply = calloc(1, sizeof(*reply));
+    if (req_info->reply != NULL) *req_info->reply = *reply;
+
+    req->categorized = FSM_FQDN_CAT_NOP;
+    req->categories_check = fsm_wc_verdict_cat_check;
+    req->risk_level_check = fsm_wc_verdict_risk_check;
+}
+
+
+/**
+ * @brief releases a lookup
+ */
+static void
+fsm_wc_lookup_free(struct fsm_wc_lookup *lookup)
+{
+    free(lookup->fqdn);
+    free(lookup);
+}
+
+
+/**
+ * @brief gets the web categorization verdict of a request's fqdn
+ *
+ * Serves the verdict from the cache, or queries the session's provider.
+ * Concurrent requests for the same fqdn share the provider lookup.
+ * @param session the fsm session
+ * @param req the request, its first question being looked up
+ * @param done called once the verdict of a pending request is set
+ * @return FSM_WC_VERDICT_READY if the verdict is set,
+ *         FSM_WC_VERDICT_PENDING if the request waits for the provider,
+ *         FSM_WC_VERDICT_UNAVAILABLE if no asynchronous lookup is possible
+ */
+int
+fsm_wc_verdict_get(struct fsm_session *session,
+                   struct fqdn_pending_req *req,
+                   void (*done)(struct fqdn_pending_req *))
+{
+    struct fsm_web_cat_ops *ops;
+    struct fsm_wc_verdict *verdict;
+    struct fsm_wc_lookup *lookup;
+    struct fsm_wc_cache *cache;
+    char *fqdn;
+    bool rc;
+
+    ops = session->provider_ops;
+    if (ops == NULL || ops->categories_lookup == NULL)
+    {
+        return FSM_WC_VERDICT_UNAVAILABLE;
+    }
+    if (req->numq == 0) return FSM_WC_VERDICT_UNAVAILABLE;
+
+    cache = fsm_wc_cache_get();
+    fqdn = req->req_info->url;
+
+    verdict = fsm_wc_cache_lookup(cache, fqdn);
+    if (verdict != NULL)
+    {
+        LOGT("%s: %s: cached verdict", __func__, fqdn);
+        fsm_wc_set_verdict(req, &verdict->reply);
+        return FSM_WC_VERDICT_READY;
+    }
+
+    lookup = ds_tree_find(&cache->lookups, fqdn);
+    if (lookup != NULL) goto wait;
+
+    lookup = calloc(1, sizeof(*lookup));
+    if (lookup == NULL) goto err_lookup;
+
+    lookup->fqdn = strdup(fqdn);
+    if (lookup->fqdn == NULL) goto err_fqdn;
+
+    lookup->session = session;
+    lookup->start = fsm_wc_now();
+    ds_dlist_init(&lookup->waiters, struct fqdn_pending_req, wc_node);
+    ds_tree_insert(&cache->lookups, lookup, lookup->fqdn);
+    cache->stats.cloud_lookups++;
+
+    /* The provider may complete the lookup before returning */
+    lookup->submitting = true;
+    rc = ops->categories_lookup(session, lookup);
+    lookup->submitting = false;
+    if (!rc)
+    {
+        ds_tree_remove(&cache->lookups, lookup);
+        goto err_submit;
+    }
+
+    if (lookup->done)
+    {
+        ds_tree_remove(&cache->lookups, lookup);
+        fsm_wc_lookup_stats(cache, lookup);
+        fsm_wc_cache_add(cache, lookup);
+        fsm_wc_set_verdict(req, &lookup->reply);
+        fsm_wc_lookup_free(lookup);
+        return FSM_WC_VERDICT_READY;
+    }
+
+wait:
+    LOGT("%s: %s: waiting for the verdict", __func__, fqdn);
+    req->wc_lookup = lookup;
+    req->wc_done = done;
+    req->categorized = FSM_FQDN_CAT_PENDING;
+    ds_dlist_insert_tail(&lookup->waiters, req);
+
+    return FSM_WC_VERDICT_PENDING;
+
+err_submit:
+    cache->stats.cloud_lookup_failures++;
+    free(lookup->fqdn);
+
+err_fqdn:
+    free(lookup);
+
+err_lookup:
+    LOGD("%s: %s: asynchronous lookup failed", __func__, fqdn);
+    return FSM_WC_VERDICT_UNAVAILABLE;
+}
+
+
+/**
+ * @brief stops waiting for a verdict
+ *
+ * The lookup keeps going on, its verdict is cached on completion.
+ * @param req the request about to be released
+ */
+void
+fsm_wc_verdict_cancel(struct fqdn_pending_req *req)
+{
+    struct fsm_wc_lookup *lookup;
+
+    lookup = req->wc_lookup;
+    if (lookup == NULL) return;
+
+    ds_dlist_remove(&lookup->waiters, req);
+    req->wc_lookup = NULL;
+}
+
+
+/**
+ * @brief completes an asynchronous lookup
+ *
+ * Called by the provider once the lookup's reply is set, successful or
+ * not. Caches the verdict and resumes the waiting requests, which may be
+ * released by their completion routine. The lookup is released.
+ * @param lookup the lookup handed over by categories_lookup()
+ */
+void
+fsm_wc_lookup_done(struct fsm_wc_lookup *lookup)
+{
+    struct fqdn_pending_req *req;
+    struct fsm_wc_cache *cache;
+
+    lookup->done = true;
+
+    /* Completed within categories_lookup(), fsm_wc_verdict_get() takes over */
+    if (lookup->submitting) return;
+
+    cache = fsm_wc_cache_get();
+    ds_tree_remove(&cache->lookups, lookup);
+    fsm_wc_lookup_stats(cache, lookup);
+    fsm_wc_cache_add(cache, lookup);
+
+    LOGT("%s: %s: %zu categories, error %d", __func__, lookup->fqdn,
+         lookup->reply.nelems, lookup->reply.error);
+
+    while (!ds_dlist_is_empty(&lookup->waiters))
+    {
+        req = ds_dlist_remove_head(&lookup->waiters);
+        req->wc_lookup = NULL;
+        fsm_wc_set_verdict(req, &lookup->reply);
+        if (req->wc_done != NULL) req->wc_done(req);
+    }
+
+    fsm_wc_lookup_free(lookup);
+}
+
+
+/**
+ * @brief checks a request's verdict against a policy's categories rule
+ *
+ * @param session the fsm session
+ * @param req the policy request
+ * @param policy the policy being checked against
+ * @return true if the rule is passed, false otherwise
+ */
+bool
+fsm_wc_verdict_cat_check(struct fsm_session *session,
+                         struct fsm_policy_req *req,
+                         struct fsm_policy *policy)
+{
+    struct fsm_policy_rules *rules;
+    struct fqdn_pending_req *fqdn_req;
+    struct fsm_url_reply *reply;
+    bool rc;
+
+    rules = &policy->rules;
+    if (!rules->cat_rule_present) return true;
+
+    fqdn_req = req->fqdn_req;
+    reply = fqdn_req->req_info->reply;
+    if (reply == NULL || fsm_wc_reply_failed(reply))
+    {
+        fqdn_req->categorized = FSM_FQDN_CAT_FAILED;
+        return false;
+    }
+    fqdn_req->categorized = FSM_FQDN_CAT_SUCCESS;
+
+    rc = fsm_fqdncats_in_set(req, policy);
+
+    /* Category in the set, the policy applies to categories out of it */
+    if (rc && (rules->cat_op == CAT_OP_OUT)) return false;
+
+    /* Category out of the set, the policy applies to categories in it */
+    if (!rc && (rules->cat_op == CAT_OP_IN)) return false;
+
+    return true;
+}
+
+
+/**
+ * @brief checks a request's verdict against a policy's risk level rule
+ *
+ * @param session the fsm session
+ * @param req the policy request
+ * @param policy the policy being checked against
+ * @return true if the rule is passed, false otherwise
+ */
+bool
+fsm_wc_verdict_risk_check(struct fsm_session *session,
+                          struct fsm_policy_req *req,
+                          struct fsm_policy *policy)
+{
+    struct fsm_policy_rules *rules;
+    struct fqdn_pending_req *fqdn_req;
+    struct fsm_url_reply *reply;
+    int level;
+
+    rules = &policy->rules;
+    if (!rules->risk_rule_present) return true;
+
+    fqdn_req = req->fqdn_req;
+    reply = fqdn_req->req_info->reply;
+    if (reply == NULL || fsm_wc_reply_failed(reply))
+    {
+        fqdn_req->categorized = FSM_FQDN_CAT_FAILED;
+        return false;
+    }
+    fqdn_req->categorized = FSM_FQDN_CAT_SUCCESS;
+
+    /* Only the webpulse service reports a risk level */
+    if (reply->service_id != URL_WP_SVC) return false;
+
+    level = reply->wb.risk_level;
+    fqdn_req->risk_level = level;
+
+    switch (rules->risk_op)
+    {
+        case RISK_OP_EQ:
+            return (level == rules->risk_level);
+
+        case RISK_OP_NEQ:
+            return (level != rules->risk_level);
+
+        case RISK_OP_GT:
+            return (level > rules->risk_level);
+
+        case RISK_OP_LT:
+            return (level < rules->risk_level);
+
+        case RISK_OP_GTE:
+            return (level >= rules->risk_level);
+
+        case RISK_OP_LTE:
+            return (level <= rules->risk_level);
+
+        default:
+            return false;
+    }
+}
@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 
 #include "fsm.h"
 #include "log.h"
@@ -339,6 +340,7 @@ void tearDown(void)
         t_to_remove = table;
         table = ds_tree_next(tables_tree, table);
         ds_tree_remove(tables_tree, t_to_remove);
+        fsm_fqdn_matcher_free(&t_to_remove->fqdn_matcher);
         free(t_to_remove);
     }
 }
@@ -1144,6 +1146,401 @@ void test_apply_no_action_policy(void)
     free(req_info.reply);
 }
 
+/**
+ * @brief sets a policy with a fqdn rule in a table
+ */
+static void test_set_fqdn_policy(struct policy_table *table,
+                                 struct fsm_policy *policy,
+                                 struct str_set *set, size_t idx,
+                                 int fqdn_op, char **fqdns, size_t nelems)
+{
+    memset(policy, 0, sizeof(*policy));
+    set->array = fqdns;
+    set->nelems = nelems;
+    policy->idx = idx;
+    policy->rule_name = "test_fqdn_rule";
+    policy->rules.fqdn_rule_present = true;
+    policy->rules.fqdn_op = fqdn_op;
+    policy->rules.fqdns = set;
+    table->lookup_array[idx] = policy;
+}
+
+
+/**
+ * @brief validates the compiled lookups of all the fqdn rule types
+ */
+void test_fqdn_matcher_lookups(void)
+{
+    char *xm[] = { "www.google.com", "facebook.com" };
+    char *sfr[] = { "google.com", ".example.org" };
+    char *sfl[] = { "www.goo", "ads" };
+    char *wild[] = { "www.bo*.google.com", "*.cdn.net" };
+    struct fsm_policy policies[4];
+    struct policy_table table;
+    struct str_set sets[4];
+    uint64_t mask;
+    size_t i;
+    bool ret;
+
+    struct
+    {
+        char *fqdn;
+        uint64_t mask;
+    } checks[] =
+    {
+        { "www.google.com", (1ULL << 0) | (1ULL << 3) | (1ULL << 10) },
+        { "google.com", 1ULL << 3 },
+        { "mail.google.com", 1ULL << 3 },
+        { "evilgoogle.com", 0 },
+        { "example.org", 0 },
+        { "a.example.org", 1ULL << 3 },
+        { "www.books.google.com", (1ULL << 3) | (1ULL << 59) },
+        { "www.maps.google.com", 1ULL << 3 },
+        { "ads.tracker.com", 1ULL << 10 },
+        { "a.cdn.net", 1ULL << 59 },
+        { "a.b.cdn.net", 0 },
+        { "facebook.com.", 1ULL << 0 },
+        { "facebook", 0 },
+    };
+
+    memset(&table, 0, sizeof(table));
+    test_set_fqdn_policy(&table, &policies[0], &sets[0], 0,
+                         FQDN_OP_IN, xm, 2);
+    test_set_fqdn_policy(&table, &policies[1], &sets[1], 3,
+                         FQDN_OP_SFR_OUT, sfr, 2);
+    test_set_fqdn_policy(&table, &policies[2], &sets[2], 10,
+                         FQDN_OP_SFL_IN, sfl, 2);
+    test_set_fqdn_policy(&table, &policies[3], &sets[3], 59,
+                         FQDN_OP_WILD_IN, wild, 2);
+
+    ret = fsm_fqdn_matcher_build(&table);
+    TEST_ASSERT_TRUE(ret);
+
+    for (i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+    {
+        mask = fsm_fqdn_matcher_lookup(&table.fqdn_matcher, checks[i].fqdn);
+        TEST_ASSERT_EQUAL_UINT64_MESSAGE(checks[i].mask, mask, checks[i].fqdn);
+    }
+
+    fsm_fqdn_matcher_free(&table.fqdn_matcher);
+}
+
+
+/**
+ * @brief compiles and looks up a 50k entries block list
+ */
+void test_fqdn_matcher_large_set(void)
+{
+    struct timespec start, end;
+    struct fsm_policy policy;
+    struct policy_table table;
+    double build_ms, lookup_ms;
+    size_t nelems = 50000;
+    struct str_set set;
+    char fqdn[64];
+    char **fqdns;
+    size_t hits;
+    size_t i;
+    bool ret;
+
+    fqdns = calloc(nelems, sizeof(*fqdns));
+    TEST_ASSERT_NOT_NULL(fqdns);
+    for (i = 0; i < nelems; i++)
+    {
+        fqdns[i] = malloc(32);
+        TEST_ASSERT_NOT_NULL(fqdns[i]);
+        snprintf(fqdns[i], 32, "host%zu.domain%zu.com", i, i % 1000);
+    }
+
+    memset(&table, 0, sizeof(table));
+    test_set_fqdn_policy(&table, &policy, &set, 1, FQDN_OP_SFR_IN,
+                         fqdns, nelems);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = fsm_fqdn_matcher_build(&table);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    TEST_ASSERT_TRUE(ret);
+    build_ms = (end.tv_sec - start.tv_sec) * 1e3;
+    build_ms += (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    /* Half of the lookups hit a subdomain of an entry */
+    hits = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < 2 * nelems; i++)
+    {
+        snprintf(fqdn, sizeof(fqdn), "www.host%zu.domain%zu.com", i, i % 1000);
+        if (fsm_fqdn_matcher_lookup(&table.fqdn_matcher, fqdn)) hits++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    lookup_ms = (end.tv_sec - start.tv_sec) * 1e3;
+    lookup_ms += (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    TEST_ASSERT_EQUAL_UINT(nelems, hits);
+    LOGI("%s: %zu entries: build: %.2f ms, %zu lookups: %.2f ms", __func__,
+         nelems, build_ms, 2 * nelems, lookup_ms);
+
+    fsm_fqdn_matcher_free(&table.fqdn_matcher);
+    for (i = 0; i < nelems; i++) free(fqdns[i]);
+    free(fqdns);
+}
+
+
+/**
+ * @brief compiles entries with long labels
+ *
+ * Labels longer than a DNS label are still compiled, a label too long for
+ * a domain name is skipped without disabling the table's other entries.
+ */
+void test_fqdn_matcher_long_labels(void)
+{
+    char label[300];
+    char too_long[320];
+    char long_fqdn[96];
+    struct fsm_policy policies[2];
+    struct policy_table table;
+    struct str_set sets[2];
+    char *xm[3];
+    char *sfr[1];
+    uint64_t mask;
+    bool ret;
+
+    /* A 70 characters label */
+    memset(label, 'a', 70);
+    label[70] = '\0';
+    snprintf(long_fqdn, sizeof(long_fqdn), "%s.example.com", label);
+
+    /* A 299 characters label */
+    memset(label, 'b', 299);
+    label[299] = '\0';
+    snprintf(too_long, sizeof(too_long), "%s.example.com", label);
+
+    xm[0] = long_fqdn;
+    xm[1] = too_long;
+    xm[2] = "www.google.com";
+    sfr[0] = "example.com";
+
+    memset(&table, 0, sizeof(table));
+    table.fqdn_matcher.dirty = true;
+    test_set_fqdn_policy(&table, &policies[0], &sets[0], 0,
+                         FQDN_OP_IN, xm, 3);
+    test_set_fqdn_policy(&table, &policies[1], &sets[1], 1,
+                         FQDN_OP_SFR_OUT, sfr, 1);
+
+    ret = fsm_fqdn_matcher_build(&table);
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_FALSE(table.fqdn_matcher.dirty);
+    TEST_ASSERT_EQUAL_UINT(3, table.fqdn_matcher.nentries);
+
+    mask = fsm_fqdn_matcher_lookup(&table.fqdn_matcher, long_fqdn);
+    TEST_ASSERT_EQUAL_UINT64((1ULL << 0) | (1ULL << 1), mask);
+
+    mask = fsm_fqdn_matcher_lookup(&table.fqdn_matcher, "www.google.com");
+    TEST_ASSERT_EQUAL_UINT64(1ULL << 0, mask);
+
+    mask = fsm_fqdn_matcher_lookup(&table.fqdn_matcher, "mail.example.com");
+    TEST_ASSERT_EQUAL_UINT64(1ULL << 1, mask);
+
+    /* The skipped entry doesn't match, its parent domain still does */
+    mask = fsm_fqdn_matcher_lookup(&table.fqdn_matcher, too_long);
+    TEST_ASSERT_EQUAL_UINT64(1ULL << 1, mask);
+
+    fsm_fqdn_matcher_free(&table.fqdn_matcher);
+}
+
+/**
+ * @brief stand-in asynchronous web categorization provider
+ *
+ * Each lookup completes after an artificial latency. Fqdns starting with
+ * "uncat" are not categorized, the others fall into category 1 with a
+ * high risk level.
+ */
+#define TEST_WC_LATENCY 0.02
+#define TEST_WC_MAX_LOOKUPS 8
+
+struct test_wc_lookup
+{
+    ev_timer timer;
+    struct fsm_wc_lookup *lookup;
+};
+
+static struct test_wc_lookup test_wc_lookups[TEST_WC_MAX_LOOKUPS];
+static int test_wc_nlookups;
+static int test_wc_nverdicts;
+
+static void test_wc_timer_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+    struct test_wc_lookup *tl;
+    struct fsm_url_reply *reply;
+
+    tl = (struct test_wc_lookup *)w;
+    reply = &tl->lookup->reply;
+    reply->service_id = URL_WP_SVC;
+    if (strncmp(tl->lookup->fqdn, "uncat", strlen("uncat")) != 0)
+    {
+        reply->nelems = 1;
+        reply->categories[0] = 1;
+        reply->wb.risk_level = 7;
+    }
+    fsm_wc_lookup_done(tl->lookup);
+}
+
+
+static bool test_wc_lookup(struct fsm_session *session,
+                           struct fsm_wc_lookup *lookup)
+{
+    struct test_wc_lookup *tl;
+
+    if (test_wc_nlookups == TEST_WC_MAX_LOOKUPS) return false;
+
+    tl = &test_wc_lookups[test_wc_nlookups++];
+    tl->lookup = lookup;
+    ev_timer_init(&tl->timer, test_wc_timer_cb, TEST_WC_LATENCY, 0);
+    ev_timer_start(EV_DEFAULT, &tl->timer);
+
+    return true;
+}
+
+
+static void test_wc_verdict_done(struct fqdn_pending_req *req)
+{
+    test_wc_nverdicts++;
+}
+
+
+/**
+ * @brief validates the asynchronous verdicts and their caching
+ */
+void test_wc_async_verdicts(void)
+{
+    struct fsm_web_cat_ops ops = { .categories_lookup = test_wc_lookup };
+    char *fqdns[] = { "www.playboy.com", "www.playboy.com", "uncat.com" };
+    struct fsm_url_request req_info[4];
+    struct fqdn_pending_req fqdn_req[4];
+    struct schema_FSM_Policy *spolicy;
+    struct fsm_policy_session *mgr;
+    struct fsm_session session;
+    struct fsm_policy_req req;
+    struct policy_table *table;
+    struct fsm_url_stats stats;
+    os_macaddr_t dev_mac;
+    size_t nreqs;
+    size_t i;
+    int rc;
+
+    memset(&session, 0, sizeof(session));
+    memset(&dev_mac, 0, sizeof(dev_mac));
+    memset(fqdn_req, 0, sizeof(fqdn_req));
+    memset(req_info, 0, sizeof(req_info));
+    session.provider_ops = &ops;
+    test_wc_nlookups = 0;
+    test_wc_nverdicts = 0;
+    fsm_wc_cache_flush();
+
+    /* Insert dev_webpulse policy */
+    spolicy = &spolicies[3];
+    fsm_add_policy(spolicy);
+    mgr = fsm_policy_get_mgr();
+    table = ds_tree_find(&mgr->policy_tables, spolicy->policy);
+    TEST_ASSERT_NOT_NULL(table);
+
+    /* The requests wait for the provider, one lookup per fqdn */
+    nreqs = sizeof(fqdns) / sizeof(fqdns[0]);
+    for (i = 0; i < nreqs; i++)
+    {
+        STRSCPY(req_info[i].url, fqdns[i]);
+        fqdn_req[i].req_info = &req_info[i];
+        fqdn_req[i].numq = 1;
+        fqdn_req[i].policy_table = table;
+        rc = fsm_wc_verdict_get(&session, &fqdn_req[i], test_wc_verdict_done);
+        TEST_ASSERT_EQUAL_INT(FSM_WC_VERDICT_PENDING, rc);
+        TEST_ASSERT_EQUAL_INT(FSM_FQDN_CAT_PENDING, fqdn_req[i].categorized);
+    }
+    TEST_ASSERT_EQUAL_INT(2, test_wc_nlookups);
+    TEST_ASSERT_EQUAL_INT(0, test_wc_nverdicts);
+
+    ev_run(EV_DEFAULT, 0);
+    TEST_ASSERT_EQUAL_INT(nreqs, test_wc_nverdicts);
+
+    /* Apply the policies to the verdicts */
+    for (i = 0; i < nreqs; i++)
+    {
+        TEST_ASSERT_NOT_NULL(req_info[i].reply);
+        memset(&req, 0, sizeof(req));
+        req.device_id = &dev_mac;
+        req.url = req_info[i].url;
+        req.fqdn_req = &fqdn_req[i];
+        fsm_apply_policies(&session, &req);
+        TEST_ASSERT_EQUAL_INT(i < 2 ? FSM_BLOCK : FSM_NO_MATCH,
+                              req.reply.action);
+        free(req.reply.rule_name);
+        free(req.reply.policy);
+    }
+    TEST_ASSERT_EQUAL_INT(1, fqdn_req[0].cat_match);
+    TEST_ASSERT_EQUAL_INT(7, fqdn_req[0].risk_level);
+
+    /* Categorized and uncategorized verdicts are served from the cache */
+    STRSCPY(req_info[3].url, "uncat.com");
+    fqdn_req[3].req_info = &req_info[3];
+    fqdn_req[3].numq = 1;
+    rc = fsm_wc_verdict_get(&session, &fqdn_req[3], test_wc_verdict_done);
+    TEST_ASSERT_EQUAL_INT(FSM_WC_VERDICT_READY, rc);
+    TEST_ASSERT_EQUAL_INT(2, test_wc_nlookups);
+
+    memset(&stats, 0, sizeof(stats));
+    fsm_wc_cache_get_stats(&stats);
+    TEST_ASSERT_EQUAL_INT(4, stats.cache_lookups);
+    TEST_ASSERT_EQUAL_INT(1, stats.cache_hits);
+    TEST_ASSERT_EQUAL_INT(2, stats.cloud_lookups);
+    TEST_ASSERT_EQUAL_INT(1, stats.uncategorized);
+    TEST_ASSERT_EQUAL_INT(2, stats.cache_entries);
+    TEST_ASSERT_TRUE(stats.min_lookup_latency >= TEST_WC_LATENCY * 1000 - 1);
+
+    for (i = 0; i < 4; i++) free(req_info[i].reply);
+    fsm_wc_cache_flush();
+}
+
+
+/**
+ * @brief validates that released requests stop waiting for their verdict
+ */
+void test_wc_async_cancel(void)
+{
+    struct fsm_web_cat_ops ops = { .categories_lookup = test_wc_lookup };
+    struct fsm_url_request req_info;
+    struct fqdn_pending_req fqdn_req;
+    struct fsm_session session;
+    int rc;
+
+    memset(&session, 0, sizeof(session));
+    memset(&fqdn_req, 0, sizeof(fqdn_req));
+    memset(&req_info, 0, sizeof(req_info));
+    session.provider_ops = &ops;
+    test_wc_nlookups = 0;
+    test_wc_nverdicts = 0;
+    fsm_wc_cache_flush();
+
+    STRSCPY(req_info.url, "www.cancelled.com");
+    fqdn_req.req_info = &req_info;
+    fqdn_req.numq = 1;
+    rc = fsm_wc_verdict_get(&session, &fqdn_req, test_wc_verdict_done);
+    TEST_ASSERT_EQUAL_INT(FSM_WC_VERDICT_PENDING, rc);
+
+    fsm_wc_verdict_cancel(&fqdn_req);
+    TEST_ASSERT_NULL(fqdn_req.wc_lookup);
+
+    /* The verdict is still cached */
+    ev_run(EV_DEFAULT, 0);
+    TEST_ASSERT_EQUAL_INT(0, test_wc_nverdicts);
+    TEST_ASSERT_NULL(req_info.reply);
+
+    rc = fsm_wc_verdict_get(&session, &fqdn_req, test_wc_verdict_done);
+    TEST_ASSERT_EQUAL_INT(FSM_WC_VERDICT_READY, rc);
+    TEST_ASSERT_EQUAL_INT(1, test_wc_nlookups);
+
+    free(req_info.reply);
+    fsm_wc_cache_flush();
+}
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -1167,6 +1564,11 @@ int main(int argc, char *argv[])
     RUN_TEST(test_apply_mac_policies);
     RUN_TEST(test_apply_wildcard_policy_match_in);
     RUN_TEST(test_apply_wildcard_policy_no_match);
+    RUN_TEST(test_fqdn_matcher_lookups);
+    RUN_TEST(test_fqdn_matcher_large_set);
+    RUN_TEST(test_fqdn_matcher_long_labels);
+    RUN_TEST(test_wc_async_verdicts);
+    RUN_TEST(test_wc_async_cancel);
 
     return UNITY_END();
 }
@@ -30,6 +30,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <ev.h>
 #include <jansson.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
 /*
  * ===========================================================================
@@ -49,6 +50,22 @@ extern char *JSON_SPLIT_ERROR;
 
 extern char        *json_split(char *str);
 
+/*
+ * Resumable version of json_split() for stream readers: the scan state is
+ * kept across calls, so a message received over several reads is only
+ * scanned once and the buffer doesn't need to be NUL terminated.
+ */
+struct json_split_state
+{
+    size_t              scan;       /* Bytes of the current message scanned */
+    int                 depth;      /* Current message nesting level */
+    bool                in_str;     /* Scanning a string */
+    bool                esc;        /* Scanning an escaped character */
+};
+
+extern void         json_split_init(struct json_split_state *st);
+extern ssize_t      json_split_stream(struct json_split_state *st, const char *buf, size_t len);
+
 extern const char  *json_dumps_static(const json_t *json, int flags);
 extern bool         json_gets(const json_t *json, char *output, size_t output_sz, int flags);
 extern bool         json_get_str(const json_t *json, char *output, size_t output_sz);
@@ -167,6 +167,74 @@ char *json_split(char *str)
     return NULL;
 }
 
+void json_split_init(struct json_split_state *st)
+{
+    memset(st, 0, sizeof(*st));
+}
+
+/**
+ * Scan the bytes of buf that were not scanned by the previous calls for the
+ * end of the JSON object at the start of buf. Returns the length of the object,
+ * including leading whitespace, 0 if the object is incomplete or -1 if buf
+ * doesn't start with an object.
+ *
+ * Once an object is returned the state is reset, the next call scans the
+ * data following it. Escape sequences are left to the JSON parser to validate.
+ */
+ssize_t json_split_stream(struct json_split_state *st, const char *buf, size_t len)
+{
+    /* Work on a copy of the state, it stays in registers */
+    struct json_split_state cur = *st;
+    ssize_t msglen = 0;
+    char c;
+
+    for (; cur.scan < len; cur.scan++)
+    {
+        c = buf[cur.scan];
+
+        if (cur.in_str)
+        {
+            if (cur.esc) cur.esc = false;
+            else if (c == '\\') cur.esc = true;
+            else if (c == '"') cur.in_str = false;
+            continue;
+        }
+
+        switch (c)
+        {
+            case '{':
+                cur.depth++;
+                break;
+
+            case '}':
+                if (cur.depth <= 0) return -1;
+                if (--cur.depth > 0) break;
+
+                msglen = cur.scan + 1;
+                json_split_init(st);
+                return msglen;
+
+            case '"':
+                cur.in_str = true;
+                break;
+
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n':
+                break;
+
+            default:
+                if (cur.depth <= 0) return -1;
+                break;
+        }
+    }
+
+    *st = cur;
+
+    return msglen;
+}
+
 /*
  * Dump the JSON object to a static string. If there's not enough room, this function shall return false and an empty string.
  */
@@ -255,6 +255,7 @@ static inline void __unused_MODULE_ID(void)
 #define LOG_OPEN_STDOUT         (1 << 2)        /* Log to stdout */
 #define LOG_OPEN_STDOUT_QUIET   (1 << 3)        /* Log to stdout is quiet, shows only STDOUT severity messages */
 #define LOG_OPEN_REMOTE         (1 << 4)        /* Log to mqtt */
+#define LOG_OPEN_ASYNC          (1 << 5)        /* Format and dispatch messages from a writer thread */
 
 /*
  * ===========================================================================
@@ -284,6 +285,17 @@ struct logger
     };
 };
 
+/**
+ * Counters of the asynchronous logging backend, see LOG_OPEN_ASYNC
+ */
+typedef struct
+{
+    uint64_t            logged;                     /* Messages recorded into the ring */
+    uint64_t            dropped;                    /* Messages dropped on a full ring */
+    uint64_t            formatted;                  /* Messages the caller had to format */
+    unsigned int        depth;                      /* Messages waiting for the writer */
+} log_async_stats_t;
+
 struct logger_msg
 {
     log_severity_t      lm_severity;                /* Message severity */
@@ -306,6 +318,7 @@ void                  mlog(log_severity_t s,
 
 bool                  log_open(char *name, int flags);
 void                  log_close();
+void                  log_async_get_stats(log_async_stats_t *stats);
 const char*           log_get_name();
 
 log_severity_t        log_severity_get();
@@ -34,9 +34,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 #include <jansson.h>
 
 #include "log.h"
+#include "log_priv.h"
 #include "os_time.h"
 #include "util.h"
 #include "assert.h"
@@ -99,6 +101,40 @@ ds_dlist_t log_logger_list = DS_DLIST_INIT(logger_t, logger_node);
 
 static log_dynamic_t log_dynamic;
 
+/*
+ * The sinks keep static state and run on the caller's thread as well as on
+ * the asynchronous writer, they are serialized. The lock is recursive as a
+ * sink may log itself, the depth tells when this thread is inside a sink.
+ */
+static pthread_once_t  log_dispatch_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t log_dispatch_lock;
+static __thread int    log_dispatch_depth = 0;
+
+/* Do not fork while another thread, e.g. the writer, is inside a sink */
+static void log_dispatch_atfork_lock(void)
+{
+    pthread_mutex_lock(&log_dispatch_lock);
+}
+
+static void log_dispatch_atfork_unlock(void)
+{
+    pthread_mutex_unlock(&log_dispatch_lock);
+}
+
+static void log_dispatch_init(void)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&log_dispatch_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    pthread_atfork(log_dispatch_atfork_lock,
+                   log_dispatch_atfork_unlock,
+                   log_dispatch_atfork_unlock);
+}
+
 static const char *log_name = ""; // process name
 
 const char* log_get_name()
@@ -149,6 +185,9 @@ bool log_open(char *name, int flags)
         flags |= LOG_OPEN_SYSLOG;
         if (isatty(0)) flags |= LOG_OPEN_STDOUT;
         flags |= LOG_OPEN_REMOTE;
+#ifdef CONFIG_LOG_ASYNC
+        flags |= LOG_OPEN_ASYNC;
+#endif
     }
 
     if (flags & LOG_OPEN_SYSLOG)
@@ -178,17 +217,31 @@ bool log_open(char *name, int flags)
     traceback_enabled = logger_traceback_new(&logger_traceback);
     log_register_logger(&logger_traceback);
 
+    if (flags & LOG_OPEN_ASYNC)
+    {
+        if (!log_async_start())
+        {
+            LOG(WARNING, "Failed to start the log writer, logging synchronously");
+        }
+    }
+
     return true;
 }
 
 void log_register_logger(logger_t *logger)
 {
+    pthread_once(&log_dispatch_once, log_dispatch_init);
+    pthread_mutex_lock(&log_dispatch_lock);
     ds_dlist_insert_tail(&log_logger_list, logger);
+    pthread_mutex_unlock(&log_dispatch_lock);
 }
 
 void log_unregister_logger(logger_t *logger)
 {
+    pthread_once(&log_dispatch_once, log_dispatch_init);
+    pthread_mutex_lock(&log_dispatch_lock);
     ds_dlist_remove(&log_logger_list, logger);
+    pthread_mutex_unlock(&log_dispatch_lock);
 }
 
 /**
@@ -416,6 +469,7 @@ bool log_severity_parse(char *sevstr)
 void log_close()
 {
     LOG_MODULE_MESSAGE(NOTICE, LOG_MODULE_ID_COMMON, "log functionality closed");
+    log_async_flush();
     log_enabled = false;
 }
 
@@ -492,51 +546,18 @@ void log_meminfo(char *str, int size, int pos, const char *str_prefix, const cha
 }
 #endif
 
-void mlog(log_severity_t sev,
-          log_module_t module,
-          const char  *fmt, ...)
+void log_dispatch(log_severity_t sev, log_module_t module, char *timestr, char *text)
 {
-    char            buff[LOGGER_BUFF_LEN];
-    char            timestr[80];
-    struct tm             *lt;
-    time_t                 t;
-    va_list                args;
     char           *strip;
     log_severity_entry_t *se;
     char           *tag;
 
-    // Save errno, so that log does not overwrite it
-    int save_errno = errno;
-
-    if (false == log_enabled) {
-        return;
-    }
-
-    if (sev == LOG_SEVERITY_DISABLED) {
-        return;
-    }
-
-    if (module > LOG_MODULE_ID_LAST) module = LOG_MODULE_ID_MISC;
-
-    if (!log_any_sink_match(sev, module)) {
-        return;
-    }
-
     se = &log_severity_table[sev];
     tag = log_module_table[module].module_name;
-    t = time_real();
-    lt = localtime(&t);
-
-    strftime(timestr, sizeof(timestr), "%d %b %H:%M:%S %Z", lt);
-
-    // format
-    va_start(args, fmt);
-    vsnprintf(buff, sizeof(buff), fmt, args);
-    va_end(args);
 
     // chop \r\n
-    strip = &buff[strlen(buff) - 1];
-    while ((strip > buff) && ((*strip == LF) || (*strip == CR)))
+    strip = &text[strlen(text) - 1];
+    while ((strip > text) && ((*strip == LF) || (*strip == CR)))
         *strip = NUL;
 
     // pretty print
@@ -564,9 +585,13 @@ void mlog(log_severity_t sev,
     msg.lm_module_name = log_module_table[module].module_name;
     msg.lm_tag = se_tag;
     msg.lm_timestamp = timestr;
-    msg.lm_text = buff;
+    msg.lm_text = text;
 
     /* Feed messages to the registered loggers */
+    pthread_once(&log_dispatch_once, log_dispatch_init);
+    pthread_mutex_lock(&log_dispatch_lock);
+    log_dispatch_depth++;
+
     logger_t *plog;
     ds_dlist_foreach(&log_logger_list, plog)
     {
@@ -578,6 +603,75 @@ void mlog(log_severity_t sev,
         plog->logger_fn(plog, &msg);
     }
 
+    log_dispatch_depth--;
+    pthread_mutex_unlock(&log_dispatch_lock);
+}
+
+void mlog(log_severity_t sev,
+          log_module_t module,
+          const char  *fmt, ...)
+{
+    char            buff[LOGGER_BUFF_LEN];
+    char            timestr[80];
+    struct tm              lt;
+    time_t                 t;
+    va_list                args;
+    bool                   recorded;
+
+    // Save errno, so that log does not overwrite it
+    int save_errno = errno;
+
+    if (false == log_enabled) {
+        return;
+    }
+
+    if (sev == LOG_SEVERITY_DISABLED) {
+        return;
+    }
+
+    if (module > LOG_MODULE_ID_LAST) module = LOG_MODULE_ID_MISC;
+
+    if (!log_any_sink_match(sev, module)) {
+        return;
+    }
+
+    /*
+     * Messages logged by a sink are written out right away, the writer may
+     * be waiting for the sinks this thread holds.
+     */
+    if (log_async_active() && (log_dispatch_depth == 0))
+    {
+        /*
+         * Errors and messages too large for a slot are written out right
+         * away, after what is still queued. Errors are thus not lost if the
+         * process is about to die.
+         */
+        if (sev > LOG_SEVERITY_ERR)
+        {
+            va_start(args, fmt);
+            recorded = log_async_record(sev, module, save_errno, fmt, args);
+            va_end(args);
+
+            errno = save_errno;
+            if (recorded) return;
+        }
+
+        log_async_flush();
+        errno = save_errno;
+    }
+
+    t = time_real();
+    localtime_r(&t, &lt);
+
+    strftime(timestr, sizeof(timestr), "%d %b %H:%M:%S %Z", &lt);
+
+    // format
+    va_start(args, fmt);
+    vsnprintf(buff, sizeof(buff), fmt, args);
+    va_end(args);
+
+    log_dispatch(sev, module, timestr, buff);
+
     // restore saved errno value
     errno = save_errno;
 
@@ -0,0 +1,732 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Asynchronous logging backend
+ *
+ * The calling thread only records a copy of the format string, the raw
+ * arguments and a monotonic timestamp into a slot of a bounded ring. A
+ * writer thread formats the messages and feeds them to the registered
+ * loggers, so the syslog and remote sinks never run on the caller's
+ * path. Messages recorded while the ring is full are dropped and
+ * reported by the writer.
+ *
+ * The format is copied rather than referenced, it may be a stack buffer
+ * or belong to a plugin which is unloaded before the writer gets to it.
+ *
+ * The ring is a multi-producer/single-consumer array of fixed slots, each
+ * carrying a sequence number which tells whether it is free, being
+ * written, or ready for the writer.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "log.h"
+#include "log_priv.h"
+
+#ifndef CONFIG_LOG_ASYNC_SLOTS
+#define CONFIG_LOG_ASYNC_SLOTS      256
+#endif
+
+#define LOG_ASYNC_SLOTS             CONFIG_LOG_ASYNC_SLOTS
+#define LOG_ASYNC_DATA_LEN          480     /* Slots are 512 bytes */
+#define LOG_ASYNC_BUFF_LEN          (1024*8)
+#define LOG_ASYNC_SPEC_MAX          32
+#define LOG_ASYNC_FLUSH_TIMEOUT_MS  1000
+#define LOG_ASYNC_IDLE_TIMEOUT_MS   1000
+
+#if (LOG_ASYNC_SLOTS & (LOG_ASYNC_SLOTS - 1)) != 0
+#error "CONFIG_LOG_ASYNC_SLOTS must be a power of 2"
+#endif
+
+/* Argument classes of a printf conversion, as passed through varargs */
+typedef enum
+{
+    LOG_ARG_NONE = 0,           /* "%%" */
+    LOG_ARG_ERRNO,              /* "%m", uses the errno saved by mlog() */
+    LOG_ARG_INT,
+    LOG_ARG_LONG,
+    LOG_ARG_LLONG,
+    LOG_ARG_INTMAX,
+    LOG_ARG_SIZE,
+    LOG_ARG_PTRDIFF,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_PTR,
+    LOG_ARG_STR,
+    LOG_ARG_UNSUPPORTED         /* "%n", "%ls", "%Lf", ... formatted by the caller */
+} log_arg_t;
+
+typedef struct
+{
+    const char     *start;      /* Points to the '%' */
+    size_t          len;        /* Length of the whole conversion */
+    log_arg_t       arg;        /* Class of the converted argument */
+    int             nstar;      /* Number of '*' width/precision arguments */
+    bool            star_prec;  /* Precision is the last '*' argument */
+    int             prec;       /* Literal precision, -1 if none */
+} log_spec_t;
+
+typedef enum
+{
+    LOG_ASYNC_EMPTY = 0,        /* Released unused, the caller wrote the message */
+    LOG_ASYNC_DEFERRED,         /* data holds the format followed by the arguments */
+    LOG_ASYNC_TEXT              /* data holds the formatted text */
+} log_async_kind_t;
+
+typedef struct
+{
+    atomic_uint     seq;
+    uint8_t         kind;
+    uint8_t         severity;
+    uint16_t        module;
+    int             saved_errno;
+    int64_t         mono_ms;
+    char            data[LOG_ASYNC_DATA_LEN];
+} log_async_slot_t;
+
+static log_async_slot_t    *log_async_ring;
+static bool                 log_async_enabled = false;
+static atomic_uint          log_async_tail;
+static atomic_uint          log_async_head;
+static atomic_bool          log_async_sleeping;
+static int                  log_async_efd = -1;
+static pthread_t            log_async_thread;
+
+static atomic_uint_fast64_t log_async_logged;
+static atomic_uint_fast64_t log_async_dropped;
+static atomic_uint_fast64_t log_async_inline;
+
+
+static int64_t log_async_clock_ms(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Parse the printf conversion starting at '%'. Returns a pointer past it.
+ */
+static const char *log_async_parse_spec(const char *p, log_spec_t *spec)
+{
+    enum { LEN_NONE, LEN_L, LEN_LL, LEN_J, LEN_Z, LEN_T, LEN_LD } len = LEN_NONE;
+
+    memset(spec, 0, sizeof(*spec));
+    spec->start = p++;
+    spec->prec = -1;
+
+    while (*p && strchr("-+ #0'I", *p)) p++;
+
+    if (*p == '*')
+    {
+        spec->nstar++;
+        p++;
+    }
+    else
+    {
+        while (*p >= '0' && *p <= '9') p++;
+    }
+
+    if (*p == '.')
+    {
+        p++;
+        if (*p == '*')
+        {
+            spec->nstar++;
+            spec->star_prec = true;
+            p++;
+        }
+        else
+        {
+            spec->prec = 0;
+            while (*p >= '0' && *p <= '9') spec->prec = spec->prec * 10 + (*p++ - '0');
+        }
+    }
+
+    for (;; p++)
+    {
+        switch (*p)
+        {
+            case 'h': continue;
+            case 'l': len = (len == LEN_L) ? LEN_LL : LEN_L; continue;
+            case 'q': len = LEN_LL; continue;
+            case 'L': len = LEN_LD; continue;
+            case 'j': len = LEN_J; continue;
+            case 'z': case 'Z': len = LEN_Z; continue;
+            case 't': len = LEN_T; continue;
+        }
+        break;
+    }
+
+    switch (*p)
+    {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+            switch (len)
+            {
+                case LEN_NONE: spec->arg = LOG_ARG_INT;     break;
+                case LEN_L:    spec->arg = LOG_ARG_LONG;    break;
+                case LEN_LL:
+                case LEN_LD:   spec->arg = LOG_ARG_LLONG;   break;
+                case LEN_J:    spec->arg = LOG_ARG_INTMAX;  break;
+                case LEN_Z:    spec->arg = LOG_ARG_SIZE;    break;
+                case LEN_T:    spec->arg = LOG_ARG_PTRDIFF; break;
+            }
+            break;
+
+        case 'c':
+            spec->arg = LOG_ARG_INT;
+            break;
+
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            spec->arg = (len == LEN_LD) ? LOG_ARG_UNSUPPORTED : LOG_ARG_DOUBLE;
+            break;
+
+        case 's':
+            spec->arg = (len == LEN_NONE) ? LOG_ARG_STR : LOG_ARG_UNSUPPORTED;
+            break;
+
+        case 'p':
+            spec->arg = LOG_ARG_PTR;
+            break;
+
+        case 'm':
+            spec->arg = LOG_ARG_ERRNO;
+            break;
+
+        case '%':
+            spec->arg = LOG_ARG_NONE;
+            break;
+
+        default:
+            spec->arg = LOG_ARG_UNSUPPORTED;
+            break;
+    }
+
+    if (*p) p++;
+    spec->len = p - spec->start;
+
+    return p;
+}
+
+/**
+ * Copy @p fmt and its arguments into @p data. The format comes first with
+ * its NUL. Integers, doubles and pointers take 8 bytes, '*' arguments 4 and
+ * strings are copied with their NUL, preceded by a byte telling whether the
+ * pointer was NULL.
+ *
+ * Returns false if an argument cannot be recorded or does not fit.
+ */
+static bool log_async_capture(char *data, size_t size, const char *fmt, va_list args)
+{
+    const char     *p = fmt;
+    log_spec_t      spec;
+    size_t          pos;
+    int             star[2];
+    int64_t         ival;
+    double          dval;
+    const char     *sval;
+    size_t          slen;
+    int             i;
+
+    pos = strlen(fmt) + 1;
+    if (pos > size) return false;
+    memcpy(data, fmt, pos);
+
+    while ((p = strchr(p, '%')) != NULL)
+    {
+        p = log_async_parse_spec(p, &spec);
+        if (spec.arg == LOG_ARG_UNSUPPORTED) return false;
+        if (spec.len >= LOG_ASYNC_SPEC_MAX) return false;
+
+        for (i = 0; i < spec.nstar; i++)
+        {
+            star[i] = va_arg(args, int);
+            if (pos + sizeof(int) > size) return false;
+            memcpy(data + pos, &star[i], sizeof(int));
+            pos += sizeof(int);
+        }
+
+        switch (spec.arg)
+        {
+            case LOG_ARG_INT:     ival = va_arg(args, int);         break;
+            case LOG_ARG_LONG:    ival = va_arg(args, long);        break;
+            case LOG_ARG_LLONG:   ival = va_arg(args, long long);   break;
+            case LOG_ARG_INTMAX:  ival = va_arg(args, intmax_t);    break;
+            case LOG_ARG_SIZE:    ival = va_arg(args, size_t);      break;
+            case LOG_ARG_PTRDIFF: ival = va_arg(args, ptrdiff_t);   break;
+
+            case LOG_ARG_DOUBLE:
+                dval = va_arg(args, double);
+                if (pos + sizeof(dval) > size) return false;
+                memcpy(data + pos, &dval, sizeof(dval));
+                pos += sizeof(dval);
+                continue;
+
+            case LOG_ARG_PTR:
+                sval = va_arg(args, void *);
+                if (pos + sizeof(sval) > size) return false;
+                memcpy(data + pos, &sval, sizeof(sval));
+                pos += sizeof(sval);
+                continue;
+
+            case LOG_ARG_STR:
+                sval = va_arg(args, const char *);
+                if (pos + 1 > size) return false;
+                data[pos++] = (sval != NULL);
+                if (sval == NULL) continue;
+
+                /* "%.*s" is commonly used on buffers without a NUL */
+                if (spec.star_prec && star[spec.nstar - 1] >= 0)
+                    slen = strnlen(sval, star[spec.nstar - 1]);
+                else if (spec.prec >= 0)
+                    slen = strnlen(sval, spec.prec);
+                else
+                    slen = strlen(sval);
+
+                if (pos + slen + 1 > size) return false;
+                memcpy(data + pos, sval, slen);
+                pos += slen;
+                data[pos++] = '\0';
+                continue;
+
+            default:
+                continue;
+        }
+
+        if (pos + sizeof(ival) > size) return false;
+        memcpy(data + pos, &ival, sizeof(ival));
+        pos += sizeof(ival);
+    }
+
+    return true;
+}
+
+#define LOG_ASYNC_SNPRINTF(buf, size, fmt, spec, star, val)                        \
+    ((spec).nstar == 0 ? snprintf(buf, size, fmt, val) :                            \
+     (spec).nstar == 1 ? snprintf(buf, size, fmt, (star)[0], val) :                 \
+                         snprintf(buf, size, fmt, (star)[0], (star)[1], val))
+
+/**
+ * Format a recorded message into @p buf
+ */
+static void log_async_render(log_async_slot_t *slot, char *buf, size_t size)
+{
+    char            cspec[LOG_ASYNC_SPEC_MAX];
+    const char     *p = slot->data;
+    const char     *data;
+    const char     *lit;
+    log_spec_t      spec;
+    size_t          pos = 0;
+    int             star[2];
+    int64_t         ival;
+    double          dval;
+    void           *pval;
+    int             n = 0;
+    int             i;
+
+    if (slot->kind == LOG_ASYNC_TEXT)
+    {
+        snprintf(buf, size, "%s", slot->data);
+        return;
+    }
+
+    data = slot->data + strlen(slot->data) + 1;
+    buf[0] = '\0';
+    while (*p && pos < size - 1)
+    {
+        lit = p;
+        p += strcspn(p, "%");
+        n = p - lit;
+        if (n > 0)
+        {
+            if ((size_t)n > size - 1 - pos) n = size - 1 - pos;
+            memcpy(buf + pos, lit, n);
+            pos += n;
+            buf[pos] = '\0';
+            continue;
+        }
+
+        p = log_async_parse_spec(p, &spec);
+        memcpy(cspec, spec.start, spec.len);
+        cspec[spec.len] = '\0';
+
+        for (i = 0; i < spec.nstar; i++)
+        {
+            memcpy(&star[i], data, sizeof(int));
+            data += sizeof(int);
+        }
+
+        switch (spec.arg)
+        {
+            case LOG_ARG_NONE:
+                n = snprintf(buf + pos, size - pos, "%%");
+                break;
+
+            case LOG_ARG_ERRNO:
+                errno = slot->saved_errno;
+                n = snprintf(buf + pos, size - pos, cspec, 0);
+                break;
+
+            case LOG_ARG_DOUBLE:
+                memcpy(&dval, data, sizeof(dval));
+                data += sizeof(dval);
+                n = LOG_ASYNC_SNPRINTF(buf + pos, size - pos, cspec, spec, star, dval);
+                break;
+
+            case LOG_ARG_PTR:
+                memcpy(&pval, data, sizeof(pval));
+                data += sizeof(pval);
+                n = LOG_ASYNC_SNPRINTF(buf + pos, size - pos, cspec, spec, star, pval);
+                break;
+
+            case LOG_ARG_STR:
+                if (*data++)
+                {
+                    n = LOG_ASYNC_SNPRINTF(buf + pos, size - pos, cspec, spec, star, data);
+                    data += strlen(data) + 1;
+                }
+                else
+                {
+                    n = LOG_ASYNC_SNPRINTF(buf + pos, size - pos, cspec, spec, star, (char *)NULL);
+                }
+                break;
+
+            default:
+                memcpy(&ival, data, sizeof(ival));
+                data += sizeof(ival);
+                switch (spec.arg)
+                {
+                    case LOG_ARG_LONG:
+                        n = LOG_ASYNC_SNPRINTF(buf + pos, size - pos, cspec, spec, star, (long)ival);
+                        break;
+                    case LOG_ARG_LLONG:
+                        n = LOG_ASYNC_SNPRINTF(buf + pos, size - pos, cspec, spec, star, (long long)ival);
+                        break;
+                    case LOG_ARG_INTMAX:
+                        n = LOG_ASYNC_SNPRINTF(buf + pos, size - pos, cspec, spec, star, (intmax_t)ival);
+                        break;
+                    case LOG_ARG_SIZE:
+                        n = LOG_ASYNC_SNPRINTF(buf + pos, size - pos, cspec, spec, star, (size_t)ival);
+                        break;
+                    case LOG_ARG_PTRDIFF:
+                        n = LOG_ASYNC_SNPRINTF(buf + pos, size - pos, cspec, spec, star, (ptrdiff_t)ival);
+                        break;
+                    default:
+                        n = LOG_ASYNC_SNPRINTF(buf + pos, size - pos, cspec, spec, star, (int)ival);
+                        break;
+                }
+                break;
+        }
+
+        if (n < 0) break;
+        pos += n;
+        if (pos >= size) pos = size - 1;
+    }
+}
+
+/**
+ * Timestamp of a record, the string is only rebuilt when the second changes
+ */
+static char *log_async_timestamp(int64_t mono_ms)
+{
+    static char     timestr[80];
+    static time_t   timestr_sec = -1;
+    struct tm       lt;
+    time_t          t;
+
+    t = (log_async_clock_ms(CLOCK_REALTIME) - log_async_clock_ms(CLOCK_MONOTONIC) + mono_ms) / 1000;
+    if (t != timestr_sec)
+    {
+        localtime_r(&t, &lt);
+        strftime(timestr, sizeof(timestr), "%d %b %H:%M:%S %Z", &lt);
+        timestr_sec = t;
+    }
+
+    return timestr;
+}
+
+static void log_async_wake(void)
+{
+    uint64_t one = 1;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&log_async_sleeping, memory_order_relaxed) &&
+        atomic_exchange(&log_async_sleeping, false))
+    {
+        if (write(log_async_efd, &one, sizeof(one)) < 0) { /* writer is awake anyway */ }
+    }
+}
+
+static log_async_slot_t *log_async_peek(unsigned int head)
+{
+    log_async_slot_t   *slot = &log_async_ring[head & (LOG_ASYNC_SLOTS - 1)];
+
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != head + 1) return NULL;
+
+    return slot;
+}
+
+/**
+ * Format and dispatch everything the ring holds. Writer thread only.
+ */
+static bool log_async_drain(void)
+{
+    static char             buff[LOG_ASYNC_BUFF_LEN];
+    log_async_slot_t       *slot;
+    unsigned int            head;
+    bool                    drained = false;
+
+    head = atomic_load_explicit(&log_async_head, memory_order_relaxed);
+    while ((slot = log_async_peek(head)) != NULL)
+    {
+        if (slot->kind != LOG_ASYNC_EMPTY)
+        {
+            log_async_render(slot, buff, sizeof(buff));
+            log_dispatch(slot->severity, slot->module, log_async_timestamp(slot->mono_ms), buff);
+        }
+
+        atomic_store_explicit(&slot->seq, head + LOG_ASYNC_SLOTS, memory_order_release);
+        head++;
+        atomic_store_explicit(&log_async_head, head, memory_order_release);
+        drained = true;
+    }
+
+    return drained;
+}
+
+static void *log_async_writer(void *arg)
+{
+    static uint64_t     reported = 0;
+    struct pollfd       pfd = { .fd = log_async_efd, .events = POLLIN };
+    uint64_t            dropped;
+    uint64_t            cnt;
+    char                buff[128];
+
+    (void)arg;
+
+    for (;;)
+    {
+        if (log_async_drain()) continue;
+
+        dropped = atomic_load_explicit(&log_async_dropped, memory_order_relaxed);
+        if (dropped != reported)
+        {
+            snprintf(buff, sizeof(buff), "Log ring full, dropped %llu messages (%llu total)",
+                     (unsigned long long)(dropped - reported), (unsigned long long)dropped);
+            log_dispatch(LOG_SEVERITY_WARNING, LOG_MODULE_ID_COMMON,
+                         log_async_timestamp(log_async_clock_ms(CLOCK_MONOTONIC)), buff);
+            reported = dropped;
+        }
+
+        atomic_store(&log_async_sleeping, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (log_async_peek(atomic_load_explicit(&log_async_head, memory_order_relaxed)))
+        {
+            atomic_store(&log_async_sleeping, false);
+            continue;
+        }
+
+        if (poll(&pfd, 1, LOG_ASYNC_IDLE_TIMEOUT_MS) > 0)
+        {
+            if (read(log_async_efd, &cnt, sizeof(cnt)) < 0) { /* spurious wakeup */ }
+        }
+        atomic_store(&log_async_sleeping, false);
+    }
+
+    return NULL;
+}
+
+/* A forked child does not inherit the writer, log synchronously there */
+static void log_async_atfork_child(void)
+{
+    log_async_enabled = false;
+}
+
+bool log_async_start(void)
+{
+    pthread_attr_t  attr;
+    unsigned int    i;
+    int             rc;
+
+    if (log_async_enabled) return true;
+
+    log_async_ring = calloc(LOG_ASYNC_SLOTS, sizeof(*log_async_ring));
+    if (log_async_ring == NULL) return false;
+
+    for (i = 0; i < LOG_ASYNC_SLOTS; i++)
+    {
+        atomic_init(&log_async_ring[i].seq, i);
+    }
+    atomic_init(&log_async_tail, 0);
+    atomic_init(&log_async_head, 0);
+    atomic_init(&log_async_sleeping, false);
+
+    log_async_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (log_async_efd < 0) goto err_ring;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&log_async_thread, &attr, log_async_writer, NULL);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) goto err_efd;
+
+    pthread_atfork(NULL, NULL, log_async_atfork_child);
+    atexit(log_async_flush);
+
+    log_async_enabled = true;
+
+    return true;
+
+err_efd:
+    close(log_async_efd);
+    log_async_efd = -1;
+
+err_ring:
+    free(log_async_ring);
+    log_async_ring = NULL;
+
+    return false;
+}
+
+bool log_async_active(void)
+{
+    /* The writer's own messages, e.g. from the traceback logger, stay synchronous */
+    return log_async_enabled && !pthread_equal(pthread_self(), log_async_thread);
+}
+
+bool log_async_record(log_severity_t sev, log_module_t module,
+                      int saved_errno, const char *fmt, va_list args)
+{
+    log_async_slot_t       *slot;
+    unsigned int            pos;
+    unsigned int            seq;
+    va_list                 copy;
+    bool                    ret = true;
+    int                     diff;
+    int                     len;
+
+    pos = atomic_load_explicit(&log_async_tail, memory_order_relaxed);
+    for (;;)
+    {
+        slot = &log_async_ring[pos & (LOG_ASYNC_SLOTS - 1)];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        diff = (int)(seq - pos);
+
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&log_async_tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            atomic_fetch_add_explicit(&log_async_dropped, 1, memory_order_relaxed);
+            return true;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&log_async_tail, memory_order_relaxed);
+        }
+    }
+
+    slot->severity = sev;
+    slot->module = module;
+    slot->saved_errno = saved_errno;
+    slot->mono_ms = log_async_clock_ms(CLOCK_MONOTONIC);
+    slot->kind = LOG_ASYNC_DEFERRED;
+
+    va_copy(copy, args);
+    if (!log_async_capture(slot->data, sizeof(slot->data), fmt, copy))
+    {
+        /* Not recordable as is, keep the text if it fits */
+        errno = saved_errno;
+        len = vsnprintf(slot->data, sizeof(slot->data), fmt, args);
+        if (len >= 0 && (size_t)len < sizeof(slot->data))
+        {
+            slot->kind = LOG_ASYNC_TEXT;
+            atomic_fetch_add_explicit(&log_async_inline, 1, memory_order_relaxed);
+        }
+        else
+        {
+            /* The slot is released empty, the caller writes the message */
+            slot->kind = LOG_ASYNC_EMPTY;
+            ret = false;
+        }
+    }
+    va_end(copy);
+
+    if (ret) atomic_fetch_add_explicit(&log_async_logged, 1, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    log_async_wake();
+
+    return ret;
+}
+
+void log_async_flush(void)
+{
+    unsigned int    tail;
+    int64_t         deadline;
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+
+    if (!log_async_active()) return;
+
+    tail = atomic_load(&log_async_tail);
+    deadline = log_async_clock_ms(CLOCK_MONOTONIC) + LOG_ASYNC_FLUSH_TIMEOUT_MS;
+
+    while ((int)(tail - atomic_load(&log_async_head)) > 0)
+    {
+        log_async_wake();
+        if (log_async_clock_ms(CLOCK_MONOTONIC) > deadline) break;
+        nanosleep(&ts, NULL);
+    }
+}
+
+void log_async_get_stats(log_async_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (!log_async_enabled) return;
+
+    stats->logged = atomic_load_explicit(&log_async_logged, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&log_async_dropped, memory_order_relaxed);
+    stats->formatted = atomic_load_explicit(&log_async_inline, memory_order_relaxed);
+    stats->depth = atomic_load(&log_async_tail) - atomic_load(&log_async_head);
+}
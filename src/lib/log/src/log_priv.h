@@ -0,0 +1,55 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LOG_PRIV_H_INCLUDED
+#define LOG_PRIV_H_INCLUDED
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "log.h"
+
+/**
+ * Common methods shared between the log library modules only
+ */
+
+/* Feed a formatted message to the registered loggers */
+extern void log_dispatch(log_severity_t sev, log_module_t module, char *timestr, char *text);
+
+/* Start the writer thread of the asynchronous backend */
+extern bool log_async_start(void);
+
+/* Return true if messages are recorded into the asynchronous ring */
+extern bool log_async_active(void);
+
+/* Record a message into the ring, false if the caller has to write it out */
+extern bool log_async_record(log_severity_t sev, log_module_t module,
+                             int saved_errno, const char *fmt, va_list args);
+
+/* Wait until the writer has dispatched everything recorded so far */
+extern void log_async_flush(void);
+
+#endif /* LOG_PRIV_H_INCLUDED */
@@ -33,6 +33,7 @@ UNIT_NAME := log
 UNIT_TYPE := LIB
 
 UNIT_SRC  := src/log.c
+UNIT_SRC  += src/log_async.c
 UNIT_SRC  += src/log_syslog.c
 UNIT_SRC  += src/log_stdout.c
 UNIT_SRC  += src/log_traceback.c
@@ -42,6 +43,7 @@ UNIT_CFLAGS := -I$(UNIT_PATH)/inc
 UNIT_CFLAGS += -Isrc/lib/osa/inc
 
 UNIT_LDFLAGS += -lev
+UNIT_LDFLAGS += -lpthread
 
 UNIT_EXPORT_CFLAGS := $(UNIT_CFLAGS)
 UNIT_EXPORT_LDFLAGS := $(UNIT_LDFLAGS)
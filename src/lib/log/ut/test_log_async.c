@@ -0,0 +1,431 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "const.h"
+#include "log.h"
+#include "log_priv.h"
+#include "unity.h"
+
+#ifndef CONFIG_LOG_ASYNC_SLOTS
+#define CONFIG_LOG_ASYNC_SLOTS 256
+#endif
+
+#define TEST_MAX_MSGS 1024
+#define TEST_MSG_LEN 1024
+#define TEST_NUM_THREADS 4
+#define TEST_THREAD_MSGS 2000
+
+const char *test_name = "log_async_tests";
+
+/**
+ * @brief a message seen by the test logger
+ */
+struct test_msg
+{
+    log_severity_t severity;
+    pthread_t thread;
+    char text[TEST_MSG_LEN];
+};
+
+/**
+ * @brief state of the test logger
+ *
+ * The logger holds the writer in its callback on the "hold" message until
+ * the test releases it, which lets the ring fill up.
+ */
+struct test_logger
+{
+    logger_t logger;
+    pthread_mutex_t lock;
+    struct test_msg msgs[TEST_MAX_MSGS];
+    size_t count;
+    bool hold;
+    sem_t held;
+    sem_t release;
+    atomic_int inside;
+    atomic_int overlaps;
+    atomic_int thread_msgs;
+};
+
+static struct test_logger g_log;
+
+
+static void
+test_logger_log(logger_t *self, logger_msg_t *msg)
+{
+    struct test_msg *m;
+
+    if (atomic_fetch_add(&g_log.inside, 1) != 0)
+    {
+        atomic_fetch_add(&g_log.overlaps, 1);
+    }
+
+    if (strncmp(msg->lm_text, "thread ", 7) == 0)
+    {
+        atomic_fetch_add(&g_log.thread_msgs, 1);
+        /* Widen the window for a concurrent dispatch */
+        sched_yield();
+        goto out;
+    }
+
+    pthread_mutex_lock(&g_log.lock);
+    if (g_log.count < ARRAY_SIZE(g_log.msgs))
+    {
+        m = &g_log.msgs[g_log.count++];
+        m->severity = msg->lm_severity;
+        m->thread = pthread_self();
+        snprintf(m->text, sizeof(m->text), "%s", msg->lm_text);
+    }
+    pthread_mutex_unlock(&g_log.lock);
+
+    if (g_log.hold && strcmp(msg->lm_text, "hold") == 0)
+    {
+        sem_post(&g_log.held);
+        sem_wait(&g_log.release);
+    }
+
+out:
+    atomic_fetch_sub(&g_log.inside, 1);
+}
+
+static bool
+test_logger_match(log_severity_t sev, log_module_t module)
+{
+    return module != LOG_MODULE_ID_TRACEBACK;
+}
+
+
+void
+setUp(void)
+{
+    log_async_flush();
+
+    pthread_mutex_lock(&g_log.lock);
+    g_log.count = 0;
+    pthread_mutex_unlock(&g_log.lock);
+}
+
+void
+tearDown(void)
+{
+}
+
+
+/**
+ * @brief waits for the writer to report dropped messages
+ */
+static bool
+test_wait_drop_report(char *text, size_t size)
+{
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+    size_t i;
+    int n;
+
+    for (n = 0; n < 2000; n++)
+    {
+        pthread_mutex_lock(&g_log.lock);
+        for (i = 0; i < g_log.count; i++)
+        {
+            if (strncmp(g_log.msgs[i].text, "Log ring full", 13) != 0) continue;
+            snprintf(text, size, "%s", g_log.msgs[i].text);
+            pthread_mutex_unlock(&g_log.lock);
+            return true;
+        }
+        pthread_mutex_unlock(&g_log.lock);
+        nanosleep(&ts, NULL);
+    }
+
+    return false;
+}
+
+/**
+ * @brief holds the writer inside the test logger
+ */
+static void
+test_writer_hold(void)
+{
+    g_log.hold = true;
+    LOGI("hold");
+    sem_wait(&g_log.held);
+}
+
+static void
+test_writer_release(void)
+{
+    g_log.hold = false;
+    sem_post(&g_log.release);
+}
+
+
+/**
+ * @brief deferred messages render like printf
+ */
+void
+test_log_async_formats(void)
+{
+    char expected[TEST_MAX_MSGS][128];
+    log_async_stats_t before;
+    log_async_stats_t after;
+    char raw[4] = { 'a', 'b', 'c', 'd' };
+    void *ptr = &before;
+    size_t n = 0;
+    size_t i;
+
+    log_async_get_stats(&before);
+
+    LOGI("int %d %5i %-3u %x %#o %c", -1, 42, 7u, 0xbeef, 8, 'z');
+    snprintf(expected[n++], 128, "int %d %5i %-3u %x %#o %c", -1, 42, 7u, 0xbeef, 8, 'z');
+
+    LOGI("long %ld %llu %jd %zu %td", -2L, 3ULL, (intmax_t)-4, (size_t)5, (ptrdiff_t)-6);
+    snprintf(expected[n++], 128, "long %ld %llu %jd %zu %td", -2L, 3ULL, (intmax_t)-4,
+             (size_t)5, (ptrdiff_t)-6);
+
+    LOGI("double %.2f %e %*.*g", 3.14159, 1e10, 8, 3, 2.5);
+    snprintf(expected[n++], 128, "double %.2f %e %*.*g", 3.14159, 1e10, 8, 3, 2.5);
+
+    LOGI("str '%s' '%10s' '%.*s' '%.2s' %p 100%%", "x", "right", 3, raw, raw, ptr);
+    snprintf(expected[n++], 128, "str '%s' '%10s' '%.*s' '%.2s' %p 100%%", "x", "right", 3,
+             raw, raw, ptr);
+
+    errno = ENOENT;
+    LOGI("errno %m");
+    snprintf(expected[n++], 128, "errno %s", strerror(ENOENT));
+
+    log_async_flush();
+    log_async_get_stats(&after);
+
+    TEST_ASSERT_EQUAL_UINT64(before.logged + n, after.logged);
+    TEST_ASSERT_EQUAL_UINT64(before.formatted, after.formatted);
+
+    TEST_ASSERT_EQUAL_UINT(n, g_log.count);
+    for (i = 0; i < n; i++)
+    {
+        TEST_ASSERT_EQUAL_STRING(expected[i], g_log.msgs[i].text);
+        TEST_ASSERT_FALSE(pthread_equal(pthread_self(), g_log.msgs[i].thread));
+    }
+}
+
+
+/**
+ * @brief the format is not referenced once the call returns
+ */
+void
+test_log_async_format_copy(void)
+{
+    char fmt[64];
+
+    test_writer_hold();
+
+    snprintf(fmt, sizeof(fmt), "stack format %%d %%s");
+    LOGI(fmt, 1, "one");
+    snprintf(fmt, sizeof(fmt), "clobbered %%s %%d");
+
+    test_writer_release();
+    log_async_flush();
+
+    TEST_ASSERT_EQUAL_UINT(2, g_log.count);
+    TEST_ASSERT_EQUAL_STRING("hold", g_log.msgs[0].text);
+    TEST_ASSERT_EQUAL_STRING("stack format 1 one", g_log.msgs[1].text);
+}
+
+
+/**
+ * @brief messages recorded on a full ring are dropped and reported
+ */
+void
+test_log_async_drop(void)
+{
+    log_async_stats_t before;
+    log_async_stats_t after;
+    char expected[128];
+    char report[128];
+    int i;
+
+    log_async_get_stats(&before);
+
+    /* The held message keeps its slot until the writer is released */
+    test_writer_hold();
+    for (i = 0; i < CONFIG_LOG_ASYNC_SLOTS + 10; i++)
+    {
+        LOGI("message %d", i);
+    }
+
+    log_async_get_stats(&after);
+    TEST_ASSERT_EQUAL_UINT(CONFIG_LOG_ASYNC_SLOTS, after.depth);
+    TEST_ASSERT_EQUAL_UINT64(before.dropped + 11, after.dropped);
+
+    test_writer_release();
+    log_async_flush();
+
+    TEST_ASSERT_TRUE(test_wait_drop_report(report, sizeof(report)));
+    snprintf(expected, sizeof(expected), "Log ring full, dropped 11 messages (%llu total)",
+             (unsigned long long)after.dropped);
+    TEST_ASSERT_EQUAL_STRING(expected, report);
+
+    /* Everything recorded before the ring was full is delivered in order */
+    TEST_ASSERT_EQUAL_UINT(CONFIG_LOG_ASYNC_SLOTS + 1, g_log.count);
+    for (i = 0; i < CONFIG_LOG_ASYNC_SLOTS - 1; i++)
+    {
+        snprintf(expected, sizeof(expected), "message %d", i);
+        TEST_ASSERT_EQUAL_STRING(expected, g_log.msgs[i + 1].text);
+    }
+}
+
+
+/**
+ * @brief errors, oversized and unsupported messages
+ */
+void
+test_log_async_fallbacks(void)
+{
+    log_async_stats_t before;
+    log_async_stats_t after;
+    char expected[128];
+    char big[600];
+
+    log_async_get_stats(&before);
+
+    LOGI("queued %d", 1);
+    LOGI("queued %d", 2);
+
+    /* Errors are written by the caller once the queued messages are out */
+    LOGE("error %d", 3);
+    TEST_ASSERT_EQUAL_UINT(3, g_log.count);
+    TEST_ASSERT_EQUAL_STRING("queued 1", g_log.msgs[0].text);
+    TEST_ASSERT_EQUAL_STRING("queued 2", g_log.msgs[1].text);
+    TEST_ASSERT_EQUAL_STRING("error 3", g_log.msgs[2].text);
+    TEST_ASSERT_FALSE(pthread_equal(pthread_self(), g_log.msgs[0].thread));
+    TEST_ASSERT_TRUE(pthread_equal(pthread_self(), g_log.msgs[2].thread));
+
+    /* Messages which do not fit a slot are written by the caller */
+    memset(big, 'b', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    LOGI("big %s", big);
+    TEST_ASSERT_EQUAL_UINT(4, g_log.count);
+    TEST_ASSERT_EQUAL_UINT(strlen(big) + 4, strlen(g_log.msgs[3].text));
+    TEST_ASSERT_TRUE(pthread_equal(pthread_self(), g_log.msgs[3].thread));
+
+    /* Conversions that cannot be recorded are formatted by the caller */
+    LOGI("long double %.1Lf", (long double)1.5);
+    log_async_flush();
+    snprintf(expected, sizeof(expected), "long double %.1Lf", (long double)1.5);
+    TEST_ASSERT_EQUAL_UINT(5, g_log.count);
+    TEST_ASSERT_EQUAL_STRING(expected, g_log.msgs[4].text);
+    TEST_ASSERT_FALSE(pthread_equal(pthread_self(), g_log.msgs[4].thread));
+
+    log_async_get_stats(&after);
+    TEST_ASSERT_EQUAL_UINT64(before.logged + 3, after.logged);
+    TEST_ASSERT_EQUAL_UINT64(before.formatted + 1, after.formatted);
+}
+
+
+static void *
+test_log_thread(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    int i;
+
+    for (i = 0; i < TEST_THREAD_MSGS; i++)
+    {
+        if (i % 100 == 0)
+            LOGE("thread %d error %d", id, i);
+        else
+            LOGI("thread %d message %d", id, i);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief the sinks are never run concurrently
+ */
+void
+test_log_async_threads(void)
+{
+    pthread_t threads[TEST_NUM_THREADS];
+    log_async_stats_t before;
+    log_async_stats_t after;
+    int i;
+
+    log_async_get_stats(&before);
+    atomic_store(&g_log.thread_msgs, 0);
+    atomic_store(&g_log.overlaps, 0);
+
+    for (i = 0; i < TEST_NUM_THREADS; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, test_log_thread,
+                                                (void *)(intptr_t)i));
+    }
+    for (i = 0; i < TEST_NUM_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    log_async_flush();
+
+    log_async_get_stats(&after);
+    TEST_ASSERT_EQUAL_INT(0, atomic_load(&g_log.overlaps));
+    TEST_ASSERT_EQUAL_UINT64(TEST_NUM_THREADS * TEST_THREAD_MSGS,
+                             atomic_load(&g_log.thread_msgs) + (after.dropped - before.dropped));
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    pthread_mutex_init(&g_log.lock, NULL);
+    sem_init(&g_log.held, 0, 0);
+    sem_init(&g_log.release, 0, 0);
+
+    log_open("TEST", LOG_OPEN_ASYNC);
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    g_log.logger.logger_fn = test_logger_log;
+    g_log.logger.match_fn = test_logger_match;
+    log_register_logger(&g_log.logger);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_log_async_formats);
+    RUN_TEST(test_log_async_format_copy);
+    RUN_TEST(test_log_async_drop);
+    RUN_TEST(test_log_async_fallbacks);
+    RUN_TEST(test_log_async_threads);
+
+    return UNITY_END();
+}
@@ -0,0 +1,190 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef NETWORK_METADATA_HASH_H_INCLUDED
+#define NETWORK_METADATA_HASH_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * @brief minimum (and initial) number of slots of a flow hash table
+ *
+ * Must be a power of 2.
+ */
+#define NET_MD_HTABLE_MIN_SIZE 64
+
+enum
+{
+    NET_MD_HKEY_SMAC = 1 << 0,    /* source mac is set */
+    NET_MD_HKEY_DMAC = 1 << 1,    /* destination mac is set */
+};
+
+struct net_md_flow_key;
+struct net_md_stats_accumulator;
+
+
+/**
+ * @brief packed, fixed size flow lookup key
+ *
+ * Projection of a net_md_flow_key on the fields the aggregator trees
+ * discriminate flows with. Unused fields are zeroed so that keys
+ * can be hashed and compared as plain memory.
+ * The size of the structure is a multiple of 8 bytes.
+ */
+struct net_md_flow_hkey
+{
+    uint8_t smac[6];
+    uint8_t dmac[6];
+    uint16_t vlan_id;
+    uint16_t ethertype;   /* Network byte order, eth only flows */
+    uint8_t ip_version;
+    uint8_t ipprotocol;
+    uint8_t flags;        /* NET_MD_HKEY_SMAC | NET_MD_HKEY_DMAC */
+    uint8_t pad;
+    uint16_t sport;       /* Network byte order */
+    uint16_t dport;       /* Network byte order */
+    uint8_t src_ip[16];   /* Network byte order */
+    uint8_t dst_ip[16];   /* Network byte order */
+};
+
+
+/**
+ * @brief flow hash table slot
+ *
+ * A slot is free when its accumulator pointer is NULL.
+ */
+struct net_md_flow_hentry
+{
+    struct net_md_flow_hkey key;
+    struct net_md_stats_accumulator *acc;
+    uint32_t hash;
+};
+
+
+/**
+ * @brief open addressing (linear probing) flow hash table
+ *
+ * Indexes the flow accumulators of an aggregator. The aggregator trees
+ * remain the owners of the accumulators, the table only references them.
+ * The slots array is allocated on first insertion.
+ */
+struct net_md_flow_htable
+{
+    struct net_md_flow_hentry *entries;
+    size_t size;          /* # of slots, power of 2 */
+    size_t count;         /* # of used slots */
+};
+
+
+/**
+ * @brief initializes an empty flow hash table
+ *
+ * @param table the table to initialize
+ */
+void
+net_md_htable_init(struct net_md_flow_htable *table);
+
+
+/**
+ * @brief releases the slots of a flow hash table
+ *
+ * The referenced accumulators are not freed.
+ *
+ * @param table the table to release
+ */
+void
+net_md_htable_fini(struct net_md_flow_htable *table);
+
+
+/**
+ * @brief packs a flow lookup key in a hash key
+ *
+ * @param key the flow key to pack
+ * @param hkey the hash key to fill
+ */
+void
+net_md_set_hkey(struct net_md_flow_key *key, struct net_md_flow_hkey *hkey);
+
+
+/**
+ * @brief computes the hash value of a packed key
+ *
+ * @param hkey the packed key
+ * @return the hash value
+ */
+uint32_t
+net_md_hkey_hash(struct net_md_flow_hkey *hkey);
+
+
+/**
+ * @brief looks up an accumulator in the table
+ *
+ * @param table the hash table
+ * @param hkey the packed key
+ * @param hash the hash value of the packed key
+ * @return the accumulator if found, NULL otherwise
+ */
+struct net_md_stats_accumulator *
+net_md_htable_find(struct net_md_flow_htable *table,
+                   struct net_md_flow_hkey *hkey, uint32_t hash);
+
+
+/**
+ * @brief adds an accumulator to the table
+ *
+ * The caller must make sure the key is not already present.
+ *
+ * @param table the hash table
+ * @param hkey the packed key
+ * @param hash the hash value of the packed key
+ * @param acc the accumulator to reference
+ * @return true if the accumulator was added, false otherwise
+ */
+bool
+net_md_htable_insert(struct net_md_flow_htable *table,
+                     struct net_md_flow_hkey *hkey, uint32_t hash,
+                     struct net_md_stats_accumulator *acc);
+
+
+/**
+ * @brief removes an accumulator from the table
+ *
+ * The entry is removed only if it references the given accumulator.
+ *
+ * @param table the hash table
+ * @param hkey the packed key
+ * @param hash the hash value of the packed key
+ * @param acc the accumulator to remove
+ * @return true if the accumulator was removed, false otherwise
+ */
+bool
+net_md_htable_remove(struct net_md_flow_htable *table,
+                     struct net_md_flow_hkey *hkey, uint32_t hash,
+                     struct net_md_stats_accumulator *acc);
+
+#endif /* NETWORK_METADATA_HASH_H_INCLUDED */
@@ -38,6 +38,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "os_types.h"
 
 #include "network_metadata.h"
+#include "network_metadata_hash.h"
+#include "network_metadata_slab.h"
 #include "network_metadata_utils.h"
 
 
@@ -104,6 +106,8 @@ struct net_md_aggregator
 {
     ds_tree_t eth_pairs;          /* tracked flows projected at the eth level */
     ds_tree_t five_tuple_flows;   /* 5 tuple only flows */
+    struct net_md_flow_htable flows_htable; /* hash index of the flows */
+    struct net_md_slab_pool flows_pool; /* flow accumulators memory */
     bool report_all_samples;      /* Do not aggregate ethernet samples */
     struct flow_report *report;   /* report to serialize */
     size_t max_windows;           /* maximum number of windows */
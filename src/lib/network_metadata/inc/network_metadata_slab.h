@@ -0,0 +1,119 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef NETWORK_METADATA_SLAB_H_INCLUDED
+#define NETWORK_METADATA_SLAB_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ds_dlist.h"
+
+/**
+ * @brief default number of objects carved out of a slab
+ */
+#define NET_MD_SLAB_NUM_OBJS 32
+
+
+/**
+ * @brief fixed size objects pool
+ *
+ * Objects are carved out of slabs, large chunks holding a fixed number of
+ * objects. Freed objects go back to their slab. Slabs left without any
+ * object in use are released in bulk by net_md_slab_pool_trim().
+ */
+struct net_md_slab_pool
+{
+    ds_dlist_t partial_slabs;     /* slabs with at least one free object */
+    ds_dlist_t full_slabs;        /* slabs without free objects */
+    size_t obj_size;              /* size of an object as seen by the user */
+    size_t stride;                /* size of an object and its header */
+    size_t objs_per_slab;         /* # of objects per slab */
+    size_t num_slabs;             /* # of allocated slabs */
+    size_t num_objs;              /* # of objects in use */
+    size_t max_objs;              /* high water mark of objects in use */
+    size_t released_slabs;        /* # of slabs released by trims */
+};
+
+
+/**
+ * @brief initializes an objects pool
+ *
+ * No memory is allocated until the first object allocation.
+ *
+ * @param pool the pool to initialize
+ * @param obj_size the size of the objects
+ * @param objs_per_slab the number of objects per slab
+ */
+void
+net_md_slab_pool_init(struct net_md_slab_pool *pool, size_t obj_size,
+                      size_t objs_per_slab);
+
+
+/**
+ * @brief releases all the slabs of a pool
+ *
+ * Objects still in use become invalid.
+ *
+ * @param pool the pool to release
+ */
+void
+net_md_slab_pool_fini(struct net_md_slab_pool *pool);
+
+
+/**
+ * @brief allocates a zeroed object from the pool
+ *
+ * @param pool the pool
+ * @return a pointer to the object, NULL if the allocation failed
+ */
+void *
+net_md_slab_alloc(struct net_md_slab_pool *pool);
+
+
+/**
+ * @brief gives an object back to the pool
+ *
+ * @param pool the pool the object was allocated from
+ * @param obj the object to free
+ */
+void
+net_md_slab_free(struct net_md_slab_pool *pool, void *obj);
+
+
+/**
+ * @brief releases the slabs without objects in use
+ *
+ * One empty slab is kept around to absorb the next allocations.
+ *
+ * @param pool the pool to trim
+ * @return the number of released slabs
+ */
+size_t
+net_md_slab_pool_trim(struct net_md_slab_pool *pool);
+
+#endif /* NETWORK_METADATA_SLAB_H_INCLUDED */
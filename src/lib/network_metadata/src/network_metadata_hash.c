@@ -0,0 +1,304 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "const.h"
+#include "log.h"
+#include "network_metadata_hash.h"
+#include "network_metadata_report.h"
+
+C_STATIC_ASSERT((sizeof(struct net_md_flow_hkey) % sizeof(uint64_t)) == 0,
+                "net_md_flow_hkey size must be a multiple of 8");
+
+
+void
+net_md_htable_init(struct net_md_flow_htable *table)
+{
+    memset(table, 0, sizeof(*table));
+}
+
+
+void
+net_md_htable_fini(struct net_md_flow_htable *table)
+{
+    free(table->entries);
+    memset(table, 0, sizeof(*table));
+}
+
+
+/**
+ * @brief packs a flow lookup key in a hash key
+ *
+ * The packed key only carries the fields used by the aggregator trees
+ * to tell flows apart:
+ * - flows with ethernet info are first sorted by source mac, destination mac
+ *   and vlan id (@see net_md_eth_cmp()),
+ * - ethernet only flows are then sorted by ethertype
+ *   (@see net_md_ethertype_cmp()),
+ * - ip flows are sorted by their 5 tuple (@see net_md_5tuple_cmp()).
+ */
+void
+net_md_set_hkey(struct net_md_flow_key *key, struct net_md_flow_hkey *hkey)
+{
+    size_t ipl;
+
+    memset(hkey, 0, sizeof(*hkey));
+
+    if (has_eth_info(key))
+    {
+        if (key->smac != NULL)
+        {
+            hkey->flags |= NET_MD_HKEY_SMAC;
+            memcpy(hkey->smac, key->smac->addr, sizeof(hkey->smac));
+        }
+
+        if (key->dmac != NULL)
+        {
+            hkey->flags |= NET_MD_HKEY_DMAC;
+            memcpy(hkey->dmac, key->dmac->addr, sizeof(hkey->dmac));
+        }
+
+        hkey->vlan_id = (uint16_t)key->vlan_id;
+
+        if (is_eth_only(key))
+        {
+            hkey->ethertype = key->ethertype;
+            return;
+        }
+    }
+
+    hkey->ip_version = key->ip_version;
+    if ((key->ip_version == 4) || (key->ip_version == 6))
+    {
+        ipl = (key->ip_version == 4 ? 4 : 16);
+        if (key->src_ip != NULL) memcpy(hkey->src_ip, key->src_ip, ipl);
+        if (key->dst_ip != NULL) memcpy(hkey->dst_ip, key->dst_ip, ipl);
+    }
+    hkey->ipprotocol = key->ipprotocol;
+    hkey->sport = key->sport;
+    hkey->dport = key->dport;
+}
+
+
+static inline uint64_t
+net_md_hash_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+
+uint32_t
+net_md_hkey_hash(struct net_md_flow_hkey *hkey)
+{
+    uint8_t *p;
+    uint64_t h;
+    uint64_t w;
+    size_t i;
+
+    p = (uint8_t *)hkey;
+    h = 0x9e3779b97f4a7c15ULL;
+    for (i = 0; i < sizeof(*hkey); i += sizeof(w))
+    {
+        memcpy(&w, p + i, sizeof(w));
+        h ^= net_md_hash_mix(w);
+        h = ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+    }
+
+    h = net_md_hash_mix(h);
+
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+
+static struct net_md_flow_hentry *
+net_md_htable_slot(struct net_md_flow_htable *table,
+                   struct net_md_flow_hkey *hkey, uint32_t hash)
+{
+    struct net_md_flow_hentry *entry;
+    size_t mask;
+    size_t i;
+
+    mask = table->size - 1;
+    i = hash & mask;
+    for (;;)
+    {
+        entry = &table->entries[i];
+        if (entry->acc == NULL) return entry;
+
+        if (entry->hash == hash &&
+            memcmp(&entry->key, hkey, sizeof(*hkey)) == 0)
+        {
+            return entry;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+
+static bool
+net_md_htable_resize(struct net_md_flow_htable *table, size_t size)
+{
+    struct net_md_flow_hentry *old_entries;
+    struct net_md_flow_hentry *entries;
+    struct net_md_flow_hentry *entry;
+    struct net_md_flow_hentry *slot;
+    size_t old_size;
+    size_t i;
+
+    entries = calloc(size, sizeof(*entries));
+    if (entries == NULL)
+    {
+        LOGE("%s: failed to allocate %zu flow hash slots", __func__, size);
+        return false;
+    }
+
+    old_entries = table->entries;
+    old_size = table->size;
+
+    table->entries = entries;
+    table->size = size;
+
+    for (i = 0; i < old_size; i++)
+    {
+        entry = &old_entries[i];
+        if (entry->acc == NULL) continue;
+
+        slot = net_md_htable_slot(table, &entry->key, entry->hash);
+        *slot = *entry;
+    }
+
+    free(old_entries);
+
+    return true;
+}
+
+
+struct net_md_stats_accumulator *
+net_md_htable_find(struct net_md_flow_htable *table,
+                   struct net_md_flow_hkey *hkey, uint32_t hash)
+{
+    struct net_md_flow_hentry *entry;
+
+    if (table->count == 0) return NULL;
+
+    entry = net_md_htable_slot(table, hkey, hash);
+
+    return entry->acc;
+}
+
+
+bool
+net_md_htable_insert(struct net_md_flow_htable *table,
+                     struct net_md_flow_hkey *hkey, uint32_t hash,
+                     struct net_md_stats_accumulator *acc)
+{
+    struct net_md_flow_hentry *entry;
+    size_t size;
+    bool ret;
+
+    if (acc == NULL) return false;
+
+    /* Keep the load factor under 70% */
+    if ((table->count + 1) * 10 > table->size * 7)
+    {
+        size = (table->size == 0 ? NET_MD_HTABLE_MIN_SIZE : table->size * 2);
+        ret = net_md_htable_resize(table, size);
+        if (!ret) return false;
+    }
+
+    entry = net_md_htable_slot(table, hkey, hash);
+    if (entry->acc != NULL) return false;
+
+    entry->key = *hkey;
+    entry->hash = hash;
+    entry->acc = acc;
+    table->count++;
+
+    return true;
+}
+
+
+bool
+net_md_htable_remove(struct net_md_flow_htable *table,
+                     struct net_md_flow_hkey *hkey, uint32_t hash,
+                     struct net_md_stats_accumulator *acc)
+{
+    struct net_md_flow_hentry *entry;
+    size_t ideal;
+    size_t mask;
+    size_t i, j;
+    bool move;
+
+    if (table->count == 0) return false;
+
+    entry = net_md_htable_slot(table, hkey, hash);
+    if (entry->acc != acc) return false;
+
+    /*
+     * Backward shift deletion: move up the following entries of the
+     * probe sequence which would not be reachable anymore.
+     */
+    mask = table->size - 1;
+    i = (size_t)(entry - table->entries);
+    j = i;
+    for (;;)
+    {
+        j = (j + 1) & mask;
+        entry = &table->entries[j];
+        if (entry->acc == NULL) break;
+
+        ideal = entry->hash & mask;
+        if (i <= j) move = ((ideal <= i) || (ideal > j));
+        else move = ((ideal <= i) && (ideal > j));
+
+        if (!move) continue;
+
+        table->entries[i] = *entry;
+        i = j;
+    }
+
+    memset(&table->entries[i], 0, sizeof(table->entries[i]));
+    table->count--;
+
+    /* Give back memory after a flow burst */
+    if ((table->size > NET_MD_HTABLE_MIN_SIZE) && (table->count * 8 < table->size))
+    {
+        net_md_htable_resize(table, table->size / 2);
+    }
+
+    return true;
+}
@@ -49,6 +49,9 @@ void net_md_free_aggregator(struct net_md_aggregator *aggr)
 
     net_md_free_flow_report(aggr->report);
 
+    /* The hash index only references accumulators, release it first */
+    net_md_htable_fini(&aggr->flows_htable);
+
     pair = ds_tree_head(&aggr->eth_pairs);
     while (pair != NULL)
     {
@@ -62,6 +65,9 @@ void net_md_free_aggregator(struct net_md_aggregator *aggr)
 
     net_md_free_flow_tree(&aggr->five_tuple_flows);
 
+    /* All accumulators are released, free their slabs */
+    net_md_slab_pool_fini(&aggr->flows_pool);
+
     free(aggr);
 }
 
@@ -115,6 +121,8 @@ net_md_allocate_aggregator(struct net_md_aggregator_set *aggr_set)
                  struct net_md_eth_pair, eth_pair_node);
     ds_tree_init(&aggr->five_tuple_flows, net_md_5tuple_cmp,
                  struct net_md_flow, flow_node);
+    net_md_htable_init(&aggr->flows_htable);
+    net_md_init_flows_pool(aggr);
     aggr->collect_filter = aggr_set->collect_filter;
     aggr->report_filter = aggr_set->report_filter;
     aggr->send_report = aggr_set->send_report;
@@ -0,0 +1,231 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ds_dlist.h"
+#include "log.h"
+#include "network_metadata_slab.h"
+
+/* Objects alignment within a slab */
+#define NET_MD_SLAB_ALIGN 16
+#define NET_MD_SLAB_ROUNDUP(x) (((x) + NET_MD_SLAB_ALIGN - 1) & ~(NET_MD_SLAB_ALIGN - 1))
+
+
+struct net_md_slab;
+
+/**
+ * @brief object header, precedes the memory handed to the user
+ */
+struct net_md_slab_obj
+{
+    struct net_md_slab *slab;       /* slab the object belongs to */
+    struct net_md_slab_obj *next;   /* next free object of the slab */
+};
+
+
+/**
+ * @brief slab header, precedes the objects storage
+ */
+struct net_md_slab
+{
+    ds_dlist_node_t slab_node;
+    struct net_md_slab_obj *free_objs;  /* free objects */
+    size_t num_used;                    /* # of objects in use */
+    bool full;                          /* in the full slabs list */
+};
+
+#define NET_MD_SLAB_HDR_SIZE NET_MD_SLAB_ROUNDUP(sizeof(struct net_md_slab))
+#define NET_MD_SLAB_OBJ_HDR_SIZE NET_MD_SLAB_ROUNDUP(sizeof(struct net_md_slab_obj))
+
+
+void
+net_md_slab_pool_init(struct net_md_slab_pool *pool, size_t obj_size,
+                      size_t objs_per_slab)
+{
+    memset(pool, 0, sizeof(*pool));
+
+    ds_dlist_init(&pool->partial_slabs, struct net_md_slab, slab_node);
+    ds_dlist_init(&pool->full_slabs, struct net_md_slab, slab_node);
+    pool->obj_size = obj_size;
+    pool->stride = NET_MD_SLAB_OBJ_HDR_SIZE + NET_MD_SLAB_ROUNDUP(obj_size);
+    pool->objs_per_slab = (objs_per_slab == 0 ? NET_MD_SLAB_NUM_OBJS : objs_per_slab);
+}
+
+
+static void
+net_md_slab_free_list(ds_dlist_t *list)
+{
+    struct net_md_slab *slab;
+
+    while ((slab = ds_dlist_remove_head(list)) != NULL) free(slab);
+}
+
+
+void
+net_md_slab_pool_fini(struct net_md_slab_pool *pool)
+{
+    if (pool->num_objs != 0)
+    {
+        LOGD("%s: releasing %zu objects still in use", __func__, pool->num_objs);
+    }
+
+    net_md_slab_free_list(&pool->partial_slabs);
+    net_md_slab_free_list(&pool->full_slabs);
+    pool->num_slabs = 0;
+    pool->num_objs = 0;
+}
+
+
+static struct net_md_slab *
+net_md_slab_new(struct net_md_slab_pool *pool)
+{
+    struct net_md_slab_obj *obj;
+    struct net_md_slab *slab;
+    uint8_t *storage;
+    size_t i;
+
+    slab = malloc(NET_MD_SLAB_HDR_SIZE + pool->stride * pool->objs_per_slab);
+    if (slab == NULL) return NULL;
+
+    memset(slab, 0, sizeof(*slab));
+
+    /* Chain the objects, first object at the head of the free list */
+    storage = (uint8_t *)slab + NET_MD_SLAB_HDR_SIZE;
+    for (i = pool->objs_per_slab; i > 0; i--)
+    {
+        obj = (struct net_md_slab_obj *)(storage + (i - 1) * pool->stride);
+        obj->slab = slab;
+        obj->next = slab->free_objs;
+        slab->free_objs = obj;
+    }
+
+    ds_dlist_insert_head(&pool->partial_slabs, slab);
+    pool->num_slabs++;
+
+    return slab;
+}
+
+
+void *
+net_md_slab_alloc(struct net_md_slab_pool *pool)
+{
+    struct net_md_slab_obj *obj;
+    struct net_md_slab *slab;
+    void *data;
+
+    slab = ds_dlist_head(&pool->partial_slabs);
+    if (slab == NULL)
+    {
+        slab = net_md_slab_new(pool);
+        if (slab == NULL) return NULL;
+    }
+
+    obj = slab->free_objs;
+    slab->free_objs = obj->next;
+    obj->next = NULL;
+    slab->num_used++;
+
+    if (slab->free_objs == NULL)
+    {
+        ds_dlist_remove(&pool->partial_slabs, slab);
+        ds_dlist_insert_head(&pool->full_slabs, slab);
+        slab->full = true;
+    }
+
+    pool->num_objs++;
+    if (pool->num_objs > pool->max_objs) pool->max_objs = pool->num_objs;
+
+    data = (uint8_t *)obj + NET_MD_SLAB_OBJ_HDR_SIZE;
+    memset(data, 0, pool->obj_size);
+
+    return data;
+}
+
+
+void
+net_md_slab_free(struct net_md_slab_pool *pool, void *data)
+{
+    struct net_md_slab_obj *obj;
+    struct net_md_slab *slab;
+
+    if (data == NULL) return;
+
+    obj = (struct net_md_slab_obj *)((uint8_t *)data - NET_MD_SLAB_OBJ_HDR_SIZE);
+    slab = obj->slab;
+
+    obj->next = slab->free_objs;
+    slab->free_objs = obj;
+    slab->num_used--;
+    pool->num_objs--;
+
+    if (slab->full)
+    {
+        ds_dlist_remove(&pool->full_slabs, slab);
+        ds_dlist_insert_tail(&pool->partial_slabs, slab);
+        slab->full = false;
+    }
+}
+
+
+size_t
+net_md_slab_pool_trim(struct net_md_slab_pool *pool)
+{
+    struct net_md_slab *slab;
+    struct net_md_slab *next;
+    size_t released;
+    bool keep;
+
+    released = 0;
+    keep = true;
+    slab = ds_dlist_head(&pool->partial_slabs);
+    while (slab != NULL)
+    {
+        next = ds_dlist_next(&pool->partial_slabs, slab);
+        if (slab->num_used == 0)
+        {
+            if (keep)
+            {
+                keep = false;
+            }
+            else
+            {
+                ds_dlist_remove(&pool->partial_slabs, slab);
+                free(slab);
+                pool->num_slabs--;
+                released++;
+            }
+        }
+        slab = next;
+    }
+
+    pool->released_slabs += released;
+
+    return released;
+}
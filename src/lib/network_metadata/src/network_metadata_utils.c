@@ -36,6 +36,28 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define MAX_STRLEN 256
 
+/**
+ * @brief memory backing a flow accumulator
+ *
+ * The flow tree node, the accumulator, its keys and the addresses they
+ * point to are allocated as one object from the aggregator's flows pool.
+ */
+struct net_md_flow_storage
+{
+    struct net_md_flow flow;
+    struct net_md_stats_accumulator acc;
+    struct net_md_flow_key key;
+    struct flow_key fkey;
+    os_macaddr_t smac;
+    os_macaddr_t dmac;
+    uint8_t src_ip[16];
+    uint8_t dst_ip[16];
+    char fkey_smac[OS_MACSTR_SZ];
+    char fkey_dmac[OS_MACSTR_SZ];
+    char fkey_src_ip[INET6_ADDRSTRLEN];
+    char fkey_dst_ip[INET6_ADDRSTRLEN];
+};
+
 /**
  * @brief compares 2 flow keys'ethernet content
  *
@@ -565,17 +587,170 @@ void net_md_acc_destroy_cb(struct net_md_stats_accumulator *acc)
 }
 
 
+/**
+ * @brief removes an accumulator from its aggregator's hash index
+ *
+ * @param acc the accumulator to unindex
+ */
+static void net_md_unindex_acc(struct net_md_stats_accumulator *acc)
+{
+    struct net_md_flow_htable *table;
+    struct net_md_flow_hkey hkey;
+    uint32_t hash;
+
+    if (acc->aggr == NULL) return;
+    if (acc->key == NULL) return;
+
+    table = &acc->aggr->flows_htable;
+    if (table->count == 0) return;
+
+    net_md_set_hkey(acc->key, &hkey);
+    hash = net_md_hkey_hash(&hkey);
+    net_md_htable_remove(table, &hkey, hash, acc);
+}
+
+
 void net_md_free_acc(struct net_md_stats_accumulator *acc)
 {
+    struct net_md_flow_storage *storage;
+
     if (acc == NULL) return;
 
+    net_md_unindex_acc(acc);
     net_md_acc_destroy_cb(acc);
 
-    free_net_md_flow_key(acc->key);
-    free_flow_key(acc->fkey);
+    /* The keys are part of the accumulator storage, only free their data */
+    free_flow_key_tags(acc->fkey);
+    free_flow_key_vdr_data(acc->fkey);
     if (acc->free_plugins != NULL) acc->free_plugins(acc);
 
-    free(acc);
+    storage = CONTAINER_OF(acc, struct net_md_flow_storage, acc);
+    net_md_slab_free(&acc->aggr->flows_pool, storage);
+}
+
+
+/**
+ * @brief initializes the aggregator's flows pool
+ *
+ * @param aggr the aggregator
+ */
+void net_md_init_flows_pool(struct net_md_aggregator *aggr)
+{
+    net_md_slab_pool_init(&aggr->flows_pool, sizeof(struct net_md_flow_storage),
+                          NET_MD_SLAB_NUM_OBJS);
+}
+
+
+/**
+ * @brief sets the lookup key of a flow storage
+ *
+ * The key addresses point to the storage inline buffers.
+ *
+ * @param storage the flow storage
+ * @param lkey the key to copy
+ */
+static void
+net_md_set_inline_key(struct net_md_flow_storage *storage,
+                      struct net_md_flow_key *lkey)
+{
+    struct net_md_flow_key *key;
+    size_t ipl;
+
+    key = &storage->key;
+
+    if (lkey->smac != NULL)
+    {
+        storage->smac = *lkey->smac;
+        key->smac = &storage->smac;
+    }
+
+    if (lkey->dmac != NULL)
+    {
+        storage->dmac = *lkey->dmac;
+        key->dmac = &storage->dmac;
+    }
+
+    if ((lkey->ip_version == 4) || (lkey->ip_version == 6))
+    {
+        ipl = (lkey->ip_version == 4 ? 4 : 16);
+        memcpy(storage->src_ip, lkey->src_ip, ipl);
+        key->src_ip = storage->src_ip;
+        memcpy(storage->dst_ip, lkey->dst_ip, ipl);
+        key->dst_ip = storage->dst_ip;
+    }
+
+    key->ip_version = lkey->ip_version;
+    key->vlan_id = lkey->vlan_id;
+    key->ethertype = lkey->ethertype;
+    key->ipprotocol = lkey->ipprotocol;
+    key->sport = lkey->sport;
+    key->dport = lkey->dport;
+    key->fstart = lkey->fstart;
+    key->fend = lkey->fend;
+}
+
+
+/**
+ * @brief sets the report key of a flow storage
+ *
+ * The key strings point to the storage inline buffers.
+ * @see net_md_set_flow_key() for the heap allocated counterpart.
+ *
+ * @param storage the flow storage
+ * @param key the lookup key to translate
+ * @return true if successful, false otherwise
+ */
+static bool
+net_md_set_inline_fkey(struct net_md_flow_storage *storage,
+                       struct net_md_flow_key *key)
+{
+    struct flow_key *fkey;
+    const char *res;
+    int family;
+
+    fkey = &storage->fkey;
+
+    if (key->smac != NULL)
+    {
+        snprintf(storage->fkey_smac, sizeof(storage->fkey_smac),
+                 PRI_os_macaddr_lower_t, FMT_os_macaddr_pt(key->smac));
+        fkey->smac = storage->fkey_smac;
+    }
+
+    if (key->dmac != NULL)
+    {
+        snprintf(storage->fkey_dmac, sizeof(storage->fkey_dmac),
+                 PRI_os_macaddr_lower_t, FMT_os_macaddr_pt(key->dmac));
+        fkey->dmac = storage->fkey_dmac;
+    }
+
+    fkey->vlan_id = key->vlan_id;
+    fkey->ethertype = key->ethertype;
+
+    if (key->ip_version == 0) return true;
+
+    family = ((key->ip_version == 4) ? AF_INET : AF_INET6);
+
+    fkey->ip_version = key->ip_version;
+
+    res = inet_ntop(family, key->src_ip, storage->fkey_src_ip,
+                    sizeof(storage->fkey_src_ip));
+    if (res == NULL) return false;
+    fkey->src_ip = storage->fkey_src_ip;
+
+    res = inet_ntop(family, key->dst_ip, storage->fkey_dst_ip,
+                    sizeof(storage->fkey_dst_ip));
+    if (res == NULL) return false;
+    fkey->dst_ip = storage->fkey_dst_ip;
+
+    fkey->protocol = key->ipprotocol;
+    fkey->sport = ntohs(key->sport);
+    fkey->dport = ntohs(key->dport);
+
+    /* New flow is observed */
+    fkey->state.first_obs = time(NULL);
+
+    return true;
 }
 
 
@@ -583,19 +758,25 @@ struct net_md_stats_accumulator *
 net_md_set_acc(struct net_md_aggregator *aggr,
                struct net_md_flow_key *key)
 {
+    struct net_md_flow_storage *storage;
     struct net_md_stats_accumulator *acc;
+    bool ret;
 
     if (key == NULL) return NULL;
 
-    acc = calloc(1, sizeof(*acc));
-    if (acc == NULL) return NULL;
+    /* One allocation covers the accumulator and its keys */
+    storage = net_md_slab_alloc(&aggr->flows_pool);
+    if (storage == NULL) return NULL;
+
+    acc = &storage->acc;
 
-    acc->key = set_net_md_flow_key(key);
-    if (acc->key == NULL) goto err_free_acc;
+    net_md_set_inline_key(storage, key);
+    acc->key = &storage->key;
 
-    acc->fkey = net_md_set_flow_key(key);
-    if (acc->fkey == NULL) goto err_free_md_flow_key;
+    ret = net_md_set_inline_fkey(storage, key);
+    if (!ret) goto err_free_storage;
 
+    acc->fkey = &storage->fkey;
     acc->fkey->state.report_attrs = true;
 
     if (aggr->on_acc_create != NULL) aggr->on_acc_create(aggr, acc);
@@ -603,11 +784,8 @@ net_md_set_acc(struct net_md_aggregator *aggr,
 
     return acc;
 
-err_free_md_flow_key:
-    free_net_md_flow_key(acc->key);
-
-err_free_acc:
-    free(acc);
+err_free_storage:
+    net_md_slab_free(&aggr->flows_pool, storage);
 
     return NULL;
 }
@@ -617,8 +795,8 @@ void net_md_free_flow(struct net_md_flow *flow)
 {
     if (flow == NULL) return;
 
+    /* The flow is part of its accumulator storage */
     net_md_free_acc(flow->tuple_stats);
-    free(flow);
 }
 
 
@@ -697,24 +875,16 @@ net_md_tree_lookup_acc(struct net_md_aggregator *aggr,
     flow = ds_tree_find(tree, key);
     if (flow != NULL) return flow->tuple_stats;
 
-    /* Allocate flow */
-    flow = calloc(1, sizeof(*flow));
-    if (flow == NULL) return NULL;
-
-    /* Allocate the flow accumulator */
+    /* Allocate the flow accumulator, the flow is part of its storage */
     acc = net_md_set_acc(aggr, key);
-    if (acc == NULL) goto err_free_flow;
+    if (acc == NULL) return NULL;
 
+    flow = &CONTAINER_OF(acc, struct net_md_flow_storage, acc)->flow;
     flow->tuple_stats = acc;
     ds_tree_insert(tree, flow, acc->key);
     aggr->total_flows++;
 
     return acc;
-
-err_free_flow:
-    free(flow);
-
-    return NULL;
 }
 
 
@@ -785,18 +955,45 @@ net_md_lookup_eth_acc(struct net_md_aggregator *aggr,
 }
 
 
+/**
+ * @brief looks up a flow accumulator, creates it if not found
+ *
+ * The flows hash index is checked first. On a miss, the accumulator is
+ * looked up or created through the aggregator trees, then indexed.
+ *
+ * @param aggr the aggregator
+ * @param key the lookup key
+ * @return the flow accumulator
+ */
 struct net_md_stats_accumulator *
 net_md_lookup_acc(struct net_md_aggregator *aggr,
                   struct net_md_flow_key *key)
 {
     struct net_md_stats_accumulator *acc;
+    struct net_md_flow_hkey hkey;
+    uint32_t hash;
 
     if (aggr == NULL) return NULL;
 
-    if (has_eth_info(key)) return net_md_lookup_eth_acc(aggr, key);
+    net_md_set_hkey(key, &hkey);
+    hash = net_md_hkey_hash(&hkey);
+    acc = net_md_htable_find(&aggr->flows_htable, &hkey, hash);
+    if (acc != NULL) return acc;
 
-    acc = net_md_tree_lookup_acc(aggr, &aggr->five_tuple_flows, key);
-    if (acc != NULL) acc->aggr = aggr;
+    if (has_eth_info(key))
+    {
+        acc = net_md_lookup_eth_acc(aggr, key);
+    }
+    else
+    {
+        acc = net_md_tree_lookup_acc(aggr, &aggr->five_tuple_flows, key);
+    }
+    if (acc == NULL) return NULL;
+
+    acc->aggr = aggr;
+
+    /* The trees remain the reference, a failed insertion is not fatal */
+    net_md_htable_insert(&aggr->flows_htable, &hkey, hash, acc);
 
     return acc;
 }
@@ -1134,6 +1331,7 @@ void net_md_free_flow_report(struct flow_report *report)
 
 void net_md_reset_aggregator(struct net_md_aggregator *aggr)
 {
+    struct net_md_slab_pool *pool;
     struct flow_report *report;
     struct flow_window **windows_array;
     struct flow_window *window;
@@ -1141,6 +1339,13 @@ void net_md_reset_aggregator(struct net_md_aggregator *aggr)
 
     if (aggr == NULL) return;
 
+    /* Give back the memory of the flows retired since the last reset */
+    pool = &aggr->flows_pool;
+    net_md_slab_pool_trim(pool);
+    LOGD("%s: flows pool: %zu slabs, %zu objects in use, peak %zu, %zu slabs released",
+         __func__, pool->num_slabs, pool->num_objs, pool->max_objs,
+         pool->released_slabs);
+
     report = aggr->report;
     n = report->num_windows;
     if (n == 0) return;
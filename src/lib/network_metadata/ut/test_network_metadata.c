@@ -1538,6 +1538,8 @@ int main(int argc, char *argv[])
     RUN_TEST(test_update_flow_tags);
     RUN_TEST(test_update_vendor_data);
     RUN_TEST(test_update_filter_flow_tags);
+    RUN_TEST(test_flow_lookup_scale);
+    RUN_TEST(test_flows_pool_release);
 
     return UNITY_END();
 }
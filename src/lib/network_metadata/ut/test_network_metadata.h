@@ -99,5 +99,7 @@ void test_vendor_data_serialize_deserialize(void);
 void test_update_flow_tags(void);
 void test_update_vendor_data(void);
 void test_update_filter_flow_tags(void);
+void test_flow_lookup_scale(void);
+void test_flows_pool_release(void);
 
 #endif // __TEST_NETWORK_METADATA_H__
@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "log.h"
@@ -2587,3 +2588,175 @@ test_update_filter_flow_tags(void)
     net_md_free_aggregator(alt_aggr);
     net_md_free_aggregator(aggr);
 }
+
+
+/**
+ * @brief times flow lookups for a given number of tracked flows
+ *
+ * @param nflows the number of flows to track
+ * @param nloops the number of times all the flows are looked up
+ */
+static void
+test_flow_lookup_cost(size_t nflows, size_t nloops)
+{
+    struct net_md_stats_accumulator **accs;
+    struct net_md_aggregator_set *aggr_set;
+    struct net_md_stats_accumulator *acc;
+    struct net_md_aggregator *aggr;
+    struct net_md_flow_key key;
+    struct timespec start;
+    struct timespec end;
+    os_macaddr_t smac;
+    os_macaddr_t dmac;
+    uint8_t src_ip[4];
+    uint8_t dst_ip[4];
+    double elapsed;
+    size_t i, n;
+
+    accs = calloc(nflows, sizeof(*accs));
+    TEST_ASSERT_NOT_NULL(accs);
+
+    aggr_set = &g_nd_test.aggr_set;
+    aggr = net_md_allocate_aggregator(aggr_set);
+    TEST_ASSERT_NOT_NULL(aggr);
+
+    memset(&key, 0, sizeof(key));
+    memset(&smac, 0, sizeof(smac));
+    memset(&dmac, 0, sizeof(dmac));
+    key.smac = &smac;
+    key.dmac = &dmac;
+    key.ip_version = 4;
+    key.src_ip = src_ip;
+    key.dst_ip = dst_ip;
+    key.ipprotocol = IPPROTO_TCP;
+    key.dport = htons(443);
+    dst_ip[0] = 192;
+    dst_ip[1] = 168;
+    dst_ip[2] = 40;
+    dst_ip[3] = 1;
+
+    /* Spread the flows over 64 devices */
+    for (i = 0; i < nflows; i++)
+    {
+        smac.addr[5] = i % 64;
+        src_ip[0] = 10;
+        src_ip[1] = 0;
+        src_ip[2] = (i >> 16) & 0xff;
+        src_ip[3] = i % 64;
+        key.sport = htons(1024 + (i >> 6));
+        accs[i] = net_md_lookup_acc(aggr, &key);
+        TEST_ASSERT_NOT_NULL(accs[i]);
+    }
+    TEST_ASSERT_EQUAL_UINT(nflows, aggr->total_flows);
+    TEST_ASSERT_EQUAL_UINT(nflows, aggr->flows_htable.count);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (n = 0; n < nloops; n++)
+    {
+        for (i = 0; i < nflows; i++)
+        {
+            smac.addr[5] = i % 64;
+            src_ip[2] = (i >> 16) & 0xff;
+            src_ip[3] = i % 64;
+            key.sport = htons(1024 + (i >> 6));
+            acc = net_md_lookup_acc(aggr, &key);
+            TEST_ASSERT_EQUAL_PTR(accs[i], acc);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) * 1e9;
+    elapsed += (end.tv_nsec - start.tv_nsec);
+    LOGI("%s: %zu flows: %.1f ns per lookup", __func__,
+         nflows, elapsed / (nflows * nloops));
+
+    /* No flow was created by the lookups */
+    TEST_ASSERT_EQUAL_UINT(nflows, aggr->total_flows);
+
+    /* One pool object per flow, plus one per device pair */
+    TEST_ASSERT_EQUAL_UINT(nflows + (nflows < 64 ? nflows : 64),
+                           aggr->flows_pool.num_objs);
+
+    net_md_free_aggregator(aggr);
+    free(accs);
+}
+
+
+/**
+ * @brief measures the flow lookup cost against the number of flows
+ */
+void
+test_flow_lookup_scale(void)
+{
+    TEST_ASSERT_TRUE(g_nd_test.initialized);
+
+    test_flow_lookup_cost(100, 1000);
+    test_flow_lookup_cost(1000, 100);
+    test_flow_lookup_cost(10000, 10);
+    test_flow_lookup_cost(50000, 2);
+}
+
+
+/**
+ * @brief validates the release of retired flows' memory
+ */
+void
+test_flows_pool_release(void)
+{
+    struct net_md_aggregator_set *aggr_set;
+    struct net_md_eth_pair *eth_pair;
+    struct net_md_aggregator *aggr;
+    struct net_md_flow_key *key;
+    struct flow_counters counters;
+    size_t num_pairs;
+    size_t key_idx;
+    bool ret;
+
+    TEST_ASSERT_TRUE(g_nd_test.initialized);
+
+    counters.packets_count = 100;
+    counters.bytes_count = 10000;
+
+    /* Allocate aggregator, retire inactive flows right away */
+    aggr_set = &g_nd_test.aggr_set;
+    aggr_set->acc_ttl = 0;
+    aggr = net_md_allocate_aggregator(aggr_set);
+    TEST_ASSERT_NOT_NULL(aggr);
+
+    /* No memory is used until the first flow shows up */
+    TEST_ASSERT_EQUAL_UINT(0, aggr->flows_pool.num_slabs);
+
+    ret = net_md_activate_window(aggr);
+    TEST_ASSERT_TRUE(ret);
+
+    for (key_idx = 0; key_idx < g_nd_test.nelems; key_idx++)
+    {
+        key = g_nd_test.net_md_keys[key_idx];
+        ret = net_md_add_sample(aggr, key, &counters);
+        TEST_ASSERT_TRUE(ret);
+    }
+    TEST_ASSERT_NOT_EQUAL(0, aggr->flows_pool.num_objs);
+    TEST_ASSERT_EQUAL_UINT(aggr->flows_pool.num_objs, aggr->flows_pool.max_objs);
+
+    /* Report the active flows */
+    ret = net_md_close_active_window(aggr);
+    TEST_ASSERT_TRUE(ret);
+    net_md_reset_aggregator(aggr);
+
+    /* The now inactive flows get retired */
+    ret = net_md_activate_window(aggr);
+    TEST_ASSERT_TRUE(ret);
+    ret = net_md_close_active_window(aggr);
+    TEST_ASSERT_TRUE(ret);
+    net_md_reset_aggregator(aggr);
+
+    TEST_ASSERT_EQUAL_UINT(0, aggr->total_flows);
+    TEST_ASSERT_EQUAL_UINT(0, aggr->flows_htable.count);
+
+    /* Only the ethernet pairs accumulators remain */
+    num_pairs = 0;
+    ds_tree_foreach(&aggr->eth_pairs, eth_pair) num_pairs++;
+    TEST_ASSERT_EQUAL_UINT(num_pairs, aggr->flows_pool.num_objs);
+
+    net_md_free_aggregator(aggr);
+}
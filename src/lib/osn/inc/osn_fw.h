@@ -48,6 +48,15 @@ enum osfw_table
     OSFW_TABLE_SECURITY
 };
 
+/*
+ * Kernel set type enumeration
+ */
+enum osfw_ipset_type
+{
+    OSFW_IPSET_HASH_NET,
+    OSFW_IPSET_HASH_MAC
+};
+
 /*
  * Initialize global firewall subsystem
  *
@@ -118,6 +127,36 @@ bool osfw_rule_add(int family, enum osfw_table table, const char *chain,
 bool osfw_rule_del(int family, enum osfw_table table, const char *chain,
 		int prio, const char *match, const char *target);
 
+/*
+ * Create a kernel set that rules can match against:
+ *      - family: AF_INET or AF_INET6, ignored for OSFW_IPSET_HASH_MAC sets
+ *      - name: Name of the set, at most 31 characters
+ *      - type: Type of the set members
+ * The set is created empty and right away, so that a rule referring to it
+ * can be added in the same transaction.
+ */
+bool osfw_ipset_add(int family, const char *name, enum osfw_ipset_type type);
+
+/*
+ * Delete a kernel set from the system:
+ *      - name: Name of the set
+ * The set is destroyed by the next osfw_apply(), once the rules referring to
+ * it have been removed.
+ */
+bool osfw_ipset_del(const char *name);
+
+/*
+ * Add or remove a set member:
+ *      - name: Name of the set
+ *      - value: An address, a network or a MAC address, following the type
+ *        of the set
+ * Membership changes are batched and pushed by the next osfw_apply(), before
+ * the rules are applied. Adding an existing member or removing a missing one
+ * is not an error.
+ */
+bool osfw_ipset_member_add(const char *name, const char *value);
+bool osfw_ipset_member_del(const char *name, const char *value);
+
 /*
  * Apply configuration to the system
  * The implementation should apply the configuration in the firewall subsystem
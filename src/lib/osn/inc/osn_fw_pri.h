@@ -39,6 +39,7 @@
 #define OSFW_SIZE_MATCH 512
 #define OSFW_SIZE_TARGET 128
 #define OSFW_SIZE_CMD 512
+#define OSFW_SIZE_IPSET 32
 
 #define OSFW_STR_UNKNOWN "osfw-unknown"
 
@@ -47,6 +48,7 @@
 
 #define OSFW_STR_CMD_IPTABLES_RESTORE "iptables-restore"
 #define OSFW_STR_CMD_IP6TABLES_RESTORE "ip6tables-restore"
+#define OSFW_STR_CMD_IPSET "ipset"
 
 #define OSFW_STR_TABLE_FILTER "filter"
 #define OSFW_STR_TABLE_NAT "nat"
@@ -107,5 +109,16 @@ struct osfw_nfbase {
 	struct osfw_nfinet inet6;
 };
 
+struct osfw_ipsetcmd {
+	struct ds_dlist_node elt;
+	char name[OSFW_SIZE_IPSET];
+	char line[OSFW_SIZE_MATCH];
+};
+
+struct osfw_ipsetbase {
+	struct ds_dlist members;
+	struct ds_dlist destroys;
+};
+
 #endif /* OSN_FW_PRI_H_INCLUDED */
 
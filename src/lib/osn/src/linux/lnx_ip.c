@@ -25,21 +25,24 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <inttypes.h>
 
 #include "log.h"
 #include "util.h"
-#include "execsh.h"
 
 #include "lnx_ip.h"
+#include "lnx_rtnl.h"
 
 #define LNX_IP_REALLOC_GROW    16
 
 struct lnx_ip_addr_node
 {
     osn_ip_addr_t           addr;
+    int                     req;                            /* Index of the last add request */
     ds_tree_node_t          tnode;                          /* Tree node */
 };
 
@@ -47,24 +50,19 @@ struct lnx_ip_route_gw_node
 {
     osn_ip_addr_t           src;                            /* Source subnet */
     osn_ip_addr_t           gw;                             /* Destination gateway */
+    int                     req;                            /* Index of the last add request */
     ds_tree_node_t          tnode;
 };
 
-static bool lnx_ip_addr_flush(lnx_ip_t *self);
-static bool lnx_ip_route_flush(lnx_ip_t *self);
+static bool lnx_ip_addr_flush(lnx_ip_t *self, int ifindex, lnx_rtnl_batch_t *batch);
+static bool lnx_ip_route_flush(lnx_ip_t *self, int ifindex, lnx_rtnl_batch_t *batch);
+static bool lnx_ip_batch_ok(lnx_rtnl_batch_t *batch, int first, int last);
 static void lnx_ip_status_poll(lnx_ip_t *self);
 
-/* execsh commands */
-static char lnx_ip_addr_add_cmd[] = _S(ip address add "$2/$3" broadcast "+" dev "$1");
-static char lnx_ip_addr_flush_cmd[] = _S([ ! -e "/sys/class/net/$1" ] || ip -4 address flush dev "$1");
-
-static char lnx_ip_route_gw_add_cmd[] = _S(ip route add "$2" via "$3" dev "$1");
-
-/* Scope global doesn't flush "local" or "link" routes */
-static char lnx_ip_route_gw_flush_cmd[] = _S([ ! -e "/sys/class/net/$1" ] || ip -4 route flush dev "$1" scope global);
-
 static lnx_netlink_fn_t lnx_ip_nl_fn;
-static execsh_fn_t lnx_ip_addr_parse;
+static lnx_rtnl_addr_fn_t lnx_ip_addr_flush_fn;
+static lnx_rtnl_route_fn_t lnx_ip_route_flush_fn;
+static lnx_rtnl_addr_fn_t lnx_ip_status_addr_fn;
 
 /*
  * Initialize Linux IP object instance
@@ -113,7 +111,9 @@ bool lnx_ip_fini(lnx_ip_t *self)
 {
     struct lnx_ip_addr_node *node;
     struct lnx_ip_route_gw_node *rnode;
+    lnx_rtnl_batch_t batch;
     ds_tree_iter_t iter;
+    int ifindex;
 
     bool retval = true;
 
@@ -124,11 +124,21 @@ bool lnx_ip_fini(lnx_ip_t *self)
         retval = false;
     }
 
-    /* Flush routes */
-    lnx_ip_route_flush(self);
+    /* Flush routes and remove all active addresses, nothing to do if the interface is gone */
+    ifindex = if_nametoindex(self->ip_ifname);
+    if (ifindex != 0)
+    {
+        lnx_rtnl_batch_init(&batch);
+        lnx_ip_route_flush(self, ifindex, &batch);
+        lnx_ip_addr_flush(self, ifindex, &batch);
+
+        if (lnx_rtnl_batch_commit(&batch) != 0)
+        {
+            LOG(WARN, "ip: %s: Unable to flush IPv4 addresses and routes.", self->ip_ifname);
+        }
 
-    /* Remove all active addresses */
-    lnx_ip_addr_flush(self);
+        lnx_rtnl_batch_fini(&batch);
+    }
 
     /* Free list of IPv4 address */
     ds_tree_foreach_iter(&self->ip_addr_list, node, &iter)
@@ -157,35 +167,64 @@ bool lnx_ip_fini(lnx_ip_t *self)
 }
 
 /*
- * Flush all configured IPv4 routes
+ * Queue the removal of all IPv4 routes to batch
+ */
+bool lnx_ip_route_flush(lnx_ip_t *self, int ifindex, lnx_rtnl_batch_t *batch)
+{
+    if (!lnx_rtnl_route_foreach(AF_INET, ifindex, lnx_ip_route_flush_fn, batch))
+    {
+        LOG(WARN, "ip: %s: Unable to acquire IPv4 routes, not flushing.", self->ip_ifname);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Scope global doesn't flush "local" or "link" routes, same as
+ * "ip -4 route flush dev IF scope global"
  */
-bool lnx_ip_route_flush(lnx_ip_t *self)
+bool lnx_ip_route_flush_fn(void *data, const struct lnx_rtnl_route *route)
 {
-    int rc;
+    if (route->rr_table != RT_TABLE_MAIN) return true;
+    if (route->rr_scope != RT_SCOPE_UNIVERSE) return true;
 
-    rc = execsh_log(LOG_SEVERITY_DEBUG, lnx_ip_route_gw_flush_cmd, self->ip_ifname);
-    if (rc != 0)
+    lnx_rtnl_batch_route_del(data, route);
+
+    return true;
+}
+
+/*
+ * Queue the removal of all IPv4 addresses to batch
+ */
+bool lnx_ip_addr_flush(lnx_ip_t *self, int ifindex, lnx_rtnl_batch_t *batch)
+{
+    if (!lnx_rtnl_addr_foreach(AF_INET, ifindex, lnx_ip_addr_flush_fn, batch))
     {
-        LOG(WARN, "ip: %s: Unable to flush IPv4 routes.", self->ip_ifname);
+        LOG(WARN, "ip: %s: Unable to acquire IPv4 addresses, not flushing.", self->ip_ifname);
         return false;
     }
 
     return true;
 }
 
+bool lnx_ip_addr_flush_fn(void *data, const struct lnx_rtnl_addr *addr)
+{
+    lnx_rtnl_batch_addr(data, RTM_DELADDR, addr->ra_ifindex, AF_INET, &addr->ra_addr.in, addr->ra_prefix);
+
+    return true;
+}
 
 /*
- * Flush all configured IPv4 addresses
+ * Check the results of requests [first, last) of a committed batch
  */
-bool lnx_ip_addr_flush(lnx_ip_t *self)
+bool lnx_ip_batch_ok(lnx_rtnl_batch_t *batch, int first, int last)
 {
-    int rc;
+    int idx;
 
-    rc = execsh_log(LOG_SEVERITY_DEBUG, lnx_ip_addr_flush_cmd, self->ip_ifname);
-    if (rc != 0)
+    for (idx = first; idx < last; idx++)
     {
-        LOG(WARN, "ip: %s: Unable to flush IPv4 addresses.", self->ip_ifname);
-        return false;
+        if (lnx_rtnl_batch_error(batch, idx) != 0) return false;
     }
 
     return true;
@@ -193,72 +232,103 @@ bool lnx_ip_addr_flush(lnx_ip_t *self)
 
 /*
  * Apply configuration to system
+ *
+ * The flush and the new configuration are sent as a single batch of requests.
  */
 bool lnx_ip_apply(lnx_ip_t *self)
 {
     struct lnx_ip_addr_node *node;
     struct lnx_ip_route_gw_node *rnode;
+    lnx_rtnl_batch_t batch;
+    int addr_flush_end;
+    int route_flush_end;
+    bool is_default;
+    int ifindex;
+    int err;
+
+    ifindex = if_nametoindex(self->ip_ifname);
+    if (ifindex == 0)
+    {
+        LOG(WARN, "ip: %s: Interface does not exist, unable to apply IPv4 configuration.", self->ip_ifname);
+        return true;
+    }
 
-    char saddr[OSN_IP_ADDR_LEN];
-    char sgw[OSN_IP_ADDR_LEN];
-    char spref[C_INT32_LEN];
-    int rc;
+    lnx_rtnl_batch_init(&batch);
 
     /* Start by issuing a flush */
-    lnx_ip_addr_flush(self);
-    lnx_ip_route_flush(self);
+    lnx_ip_addr_flush(self, ifindex, &batch);
+    addr_flush_end = batch.rb_count;
+    lnx_ip_route_flush(self, ifindex, &batch);
+    route_flush_end = batch.rb_count;
 
     /* First apply IPv4 addresses */
     ds_tree_foreach(&self->ip_addr_list, node)
     {
-        if (inet_ntop(AF_INET, &node->addr.ia_addr, saddr, sizeof(saddr)) == NULL)
-        {
-            LOG(ERR, "ip: %s: Unable to convert IPv4 address, skipping add.", self->ip_ifname);
-            continue;
-        }
-
-        snprintf(spref, sizeof(spref), "%d", node->addr.ia_prefix);
-
-        rc = execsh_log(LOG_SEVERITY_DEBUG, lnx_ip_addr_add_cmd, self->ip_ifname, saddr, spref);
-        if (rc != 0)
-        {
-            LOG(WARN, "ip: %s: Unable to add IPv4 address: "PRI_osn_ip_addr,
-                    self->ip_ifname,
-                    FMT_osn_ip_addr(node->addr));
-            continue;
-        }
+        node->req = lnx_rtnl_batch_addr(
+                &batch,
+                RTM_NEWADDR,
+                ifindex,
+                AF_INET,
+                &node->addr.ia_addr,
+                node->addr.ia_prefix);
     }
 
     /* Apply IPv4 routes */
     ds_tree_foreach(&self->ip_route_gw_list, rnode)
     {
-        if (osn_ip_addr_cmp(&rnode->src, &OSN_IP_ADDR_INIT) == 0)
-        {
-            STRSCPY(saddr, "default");
-        }
-        else if (inet_ntop(AF_INET, &rnode->src.ia_addr, saddr, sizeof(saddr)) == NULL)
-        {
-            LOG(ERR, "ip: %s: Unable to convert IPv4 source address, skipping.", self->ip_ifname);
-            continue;
-        }
+        /* A 0.0.0.0 source is the default route, otherwise it's a host route */
+        is_default = osn_ip_addr_cmp(&rnode->src, &OSN_IP_ADDR_INIT) == 0;
+
+        rnode->req = lnx_rtnl_batch_route(
+                &batch,
+                RTM_NEWROUTE,
+                ifindex,
+                AF_INET,
+                &rnode->src.ia_addr,
+                is_default ? 0 : 32,
+                &rnode->gw.ia_addr);
+    }
 
-        if (inet_ntop(AF_INET, &rnode->gw.ia_addr, sgw, sizeof(sgw)) == NULL)
-        {
-            LOG(ERR, "ip: %s: Unable to convert IPv4 gateway address, skipping.", self->ip_ifname);
-            continue;
-        }
+    if (lnx_rtnl_batch_commit(&batch) < 0)
+    {
+        LOG(ERR, "ip: %s: Unable to send IPv4 configuration requests.", self->ip_ifname);
+    }
 
-        rc = execsh_log(LOG_SEVERITY_DEBUG, lnx_ip_route_gw_add_cmd, self->ip_ifname, saddr, sgw);
-        if (rc != 0)
-        {
-            LOG(WARN, "ip: %s: Unable to add IPv4 gateway route: "PRI_osn_ip_addr" -> "PRI_osn_ip_addr,
-                    self->ip_ifname,
-                    FMT_osn_ip_addr(rnode->src),
-                    FMT_osn_ip_addr(rnode->gw));
-            continue;
-        }
+    if (!lnx_ip_batch_ok(&batch, 0, addr_flush_end))
+    {
+        LOG(WARN, "ip: %s: Unable to flush IPv4 addresses.", self->ip_ifname);
+    }
+
+    if (!lnx_ip_batch_ok(&batch, addr_flush_end, route_flush_end))
+    {
+        LOG(WARN, "ip: %s: Unable to flush IPv4 routes.", self->ip_ifname);
+    }
+
+    ds_tree_foreach(&self->ip_addr_list, node)
+    {
+        err = node->req < 0 ? EINVAL : lnx_rtnl_batch_error(&batch, node->req);
+        if (err == 0) continue;
+
+        LOG(WARN, "ip: %s: Unable to add IPv4 address: "PRI_osn_ip_addr": %s",
+                self->ip_ifname,
+                FMT_osn_ip_addr(node->addr),
+                strerror(err));
+    }
+
+    ds_tree_foreach(&self->ip_route_gw_list, rnode)
+    {
+        err = rnode->req < 0 ? EINVAL : lnx_rtnl_batch_error(&batch, rnode->req);
+        if (err == 0) continue;
+
+        LOG(WARN, "ip: %s: Unable to add IPv4 gateway route: "PRI_osn_ip_addr" -> "PRI_osn_ip_addr": %s",
+                self->ip_ifname,
+                FMT_osn_ip_addr(rnode->src),
+                FMT_osn_ip_addr(rnode->gw),
+                strerror(err));
     }
 
+    lnx_rtnl_batch_fini(&batch);
+
     return true;
 }
 
@@ -392,7 +462,7 @@ void lnx_ip_status_notify(lnx_ip_t *self, lnx_ip_status_fn_t *fn)
  */
 void lnx_ip_status_poll(lnx_ip_t *self)
 {
-    int rc;
+    int ifindex;
 
     if (self->ip_status.is_addr != NULL)
     {
@@ -402,16 +472,15 @@ void lnx_ip_status_poll(lnx_ip_t *self)
     self->ip_status.is_addr = NULL;
     self->ip_status.is_addr_len = 0;
 
-    /*
-     * Execute the "ip -4 -o addr show IFNAME" command.
-     * The -o switch yields a more compact and easier to parse format.
-     */
-    rc = execsh_fn(lnx_ip_addr_parse, self, _S(ip -4 -o addr show dev "$1"), self->ip_ifname);
-    if (rc != 0)
+    /* Addresses are served from the RTNETLINK cache */
+    ifindex = if_nametoindex(self->ip_ifname);
+    if (ifindex == 0)
     {
-        LOG(DEBUG, "ip: %s: Unable to acquire interface IPv4 address list. Exit code: %d",
-                self->ip_ifname,
-                rc);
+        LOG(DEBUG, "ip: %s: Interface does not exist.", self->ip_ifname);
+    }
+    else if (!lnx_rtnl_addr_foreach(AF_INET, ifindex, lnx_ip_status_addr_fn, self))
+    {
+        LOG(DEBUG, "ip: %s: Unable to acquire interface IPv4 address list.", self->ip_ifname);
     }
 
     LOG(INFO, "ip: %s: Found %zu IPv4 address(es).", self->ip_ifname, self->ip_status.is_addr_len);
@@ -423,44 +492,13 @@ void lnx_ip_status_poll(lnx_ip_t *self)
 }
 
 /**
- * Parse a single line of a "ip -o -4 addr show dev IF" output.
+ * Add a single interface address to the status structure
  */
-bool lnx_ip_addr_parse(void *data, int type, const char *line)
+bool lnx_ip_status_addr_fn(void *data, const struct lnx_rtnl_addr *addr)
 {
-    char buf[256];
-    char *pbuf;
-    char *sip4;
-
     lnx_ip_t *self = data;
-
-    LOG(DEBUG, "ip: %s: ip_addr_show%s %s",
-            self->ip_ifname,
-            type == EXECSH_PIPE_STDOUT ? ">" : "|",
-            line);
-
-    if (type != EXECSH_PIPE_STDOUT) return true;
-
-    STRSCPY(buf, line);
-
-    /*
-     * Example output:
-     *
-     * # ip -o -4 addr show
-     * 20: br-wan    inet 10.77.204.196/24 brd 10.77.204.255 scope global br-wan\       valid_lft forever preferred_lft forever
-     * 21: br-home    inet 192.168.40.1/24 brd 192.168.40.255 scope global br-home\       valid_lft forever preferred_lft forever
-     */
-
-    /* Skip interface index */
-    strtok_r(buf, " ", &pbuf);
-
-    /* Skip interface name */
-    strtok_r(NULL, " ", &pbuf);
-
-    /* Skip "inet" */
-    strtok_r(NULL, " ", &pbuf);
-
-    /* IPv4 address, includes the netmask (prefix) */
-    sip4 = strtok_r(NULL, " ", &pbuf);
+    osn_ip_addr_t *ip;
+    void *is_addr;
 
     struct osn_ip_status *is = &self->ip_status;
 
@@ -469,22 +507,22 @@ bool lnx_ip_addr_parse(void *data, int type, const char *line)
      */
     if ((is->is_addr_len % LNX_IP_REALLOC_GROW) == 0)
     {
-        is->is_addr = realloc(
+        is_addr = realloc(
                 is->is_addr,
                 (is->is_addr_len + LNX_IP_REALLOC_GROW) * sizeof(is->is_addr[0]));
-    }
-
-    if (!osn_ip_addr_from_str(&is->is_addr[is->is_addr_len], sip4))
-    {
-        LOG(WARN, "ip: %s: Error parsing IPv4 addresses -- invalid IPv4 address \"%s\" on line: %s",
-                self->ip_ifname,
-                sip4,
-                line);
+        if (is_addr == NULL)
+        {
+            LOG(ERR, "ip: %s: Error allocating IPv4 address list.", self->ip_ifname);
+            return false;
+        }
 
-        return true;
+        is->is_addr = is_addr;
     }
 
-    is->is_addr_len++;
+    ip = &is->is_addr[is->is_addr_len++];
+    *ip = OSN_IP_ADDR_INIT;
+    ip->ia_addr = addr->ra_addr.in;
+    ip->ia_prefix = addr->ra_prefix;
 
     return true;
 }
@@ -25,14 +25,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
 #include <stdlib.h>
 #include <errno.h>
 
 #include "log.h"
 #include "util.h"
-#include "execsh.h"
 
 #include "lnx_ip6.h"
+#include "lnx_rtnl.h"
 
 /*
  * Specify the increment by which dynamic arrays are grown each time they
@@ -45,13 +47,14 @@ struct lnx_ip6_addr_node
     osn_ip6_addr_t          addr;                       /* IPv6 address */
     bool                    enabled;                    /* IP address should be added, otherwise removed */
     bool                    active;                     /* IP address is applied to the system */
+    int                     req;                        /* Index of the last add request */
     ds_tree_node_t          tnode;                      /* Tree node */
 };
 
-static bool lnx_ip6_addr_flush(lnx_ip6_t *self);
-static bool lnx_ip6_ipaddr_parse(void *_self, int type, const char *line);
+static void lnx_ip6_addr_flush(lnx_ip6_t *self, int ifindex, lnx_rtnl_batch_t *batch);
+static lnx_rtnl_addr_fn_t lnx_ip6_ipaddr_fn;
 static void lnx_ip6_status_ipaddr_update(lnx_ip6_t *self);
-static bool lnx_ip6_neigh_parse(void *_self, int type, const char *line);
+static lnx_rtnl_neigh_fn_t lnx_ip6_neigh_fn;
 static void lnx_ip6_status_neigh_update(lnx_ip6_t *self);
 static lnx_netlink_fn_t lnx_ip6_nl_fn;
 
@@ -100,7 +103,9 @@ error:
 bool lnx_ip6_fini(lnx_ip6_t *self)
 {
     struct lnx_ip6_addr_node *node;
+    lnx_rtnl_batch_t batch;
     ds_tree_iter_t iter;
+    int ifindex;
 
     /* Stop the netlink event listener */
     lnx_netlink_stop(&self->ip6_nl);
@@ -122,7 +127,16 @@ bool lnx_ip6_fini(lnx_ip6_t *self)
     }
 
     /* Remove all active addresses */
-    lnx_ip6_addr_flush(self);
+    ifindex = if_nametoindex(self->ip6_ifname);
+    lnx_rtnl_batch_init(&batch);
+    lnx_ip6_addr_flush(self, ifindex, &batch);
+
+    if (ifindex != 0 && lnx_rtnl_batch_commit(&batch) != 0)
+    {
+        LOG(WARN, "ip6: %s: Unable to remove IPv6 addresses.", self->ip6_ifname);
+    }
+
+    lnx_rtnl_batch_fini(&batch);
 
     /* Free list of IPv6 address */
     ds_tree_foreach_iter(&self->ip6_addr_list, node, &iter)
@@ -141,23 +155,18 @@ bool lnx_ip6_fini(lnx_ip6_t *self)
     return true;
 }
 
-static char ip6_del_cmd[] = _S(ip -6 address del "$2/$3" dev "$1");
-static char ip6_add_cmd[] = _S(ip -6 address add "$2/$3" dev "$1");
-
 /*
- * Flush all configured IPv6 interfaces
+ * Queue the removal of all configured IPv6 addresses to batch
  *
  * Note: A simple ip -6 addr flush would in theory work. The problem with that command is
  * that it flushes, amongst others, the link-local address. In order to work around that
  * we have to keep track of IP addresses that are to be removed.
  */
-bool lnx_ip6_addr_flush(lnx_ip6_t *self)
+void lnx_ip6_addr_flush(lnx_ip6_t *self, int ifindex, lnx_rtnl_batch_t *batch)
 {
     struct lnx_ip6_addr_node *node;
-    char saddr[OSN_IP6_ADDR_LEN];
-    char spref[C_INT32_LEN];
     ds_tree_iter_t iter;
-    int rc;
+    int req;
 
     ds_tree_foreach_iter(&self->ip6_addr_list, node, &iter)
     {
@@ -169,28 +178,26 @@ bool lnx_ip6_addr_flush(lnx_ip6_t *self)
          *  false     true       nop
          *  false     false      remove from list
          */
-        if (node->active)
+        if (node->active && ifindex != 0)
         {
             /* Remove IP from the system */
-            //snprintf(saddr, sizeof(saddr),  PRI(in6_addr), FMT(in6_addr, node->addr.ia6_addr));
-            if (inet_ntop(AF_INET6, &node->addr.ia6_addr, saddr, sizeof(saddr)) == NULL)
-            {
-                LOG(ERR, "ip6: %s: Unable to convert IPv6 address, skipping delete.", self->ip6_ifname);
-            }
-
-            snprintf(spref, sizeof(spref), "%d", node->addr.ia6_prefix);
-
-            rc = execsh_log(LOG_SEVERITY_DEBUG, ip6_del_cmd, self->ip6_ifname, saddr, spref);
-            if (rc != 0)
+            req = lnx_rtnl_batch_addr(
+                    batch,
+                    RTM_DELADDR,
+                    ifindex,
+                    AF_INET6,
+                    &node->addr.ia6_addr,
+                    node->addr.ia6_prefix);
+            if (req < 0)
             {
                 LOG(WARN, "ip6: %s: Unable to remove IPv6 address: "PRI_osn_ip6_addr,
                         self->ip6_ifname,
                         FMT_osn_ip6_addr(node->addr));
             }
-
-            node->active = false;
         }
 
+        node->active = false;
+
         /* Remove element from the list */
         if (!node->enabled)
         {
@@ -198,44 +205,77 @@ bool lnx_ip6_addr_flush(lnx_ip6_t *self)
             free(node);
         }
     }
-
-    return true;
 }
 
 /*
  * Apply configuration to system
+ *
+ * The removal of the old addresses and the new addresses are sent as a single
+ * batch of requests.
  */
 bool lnx_ip6_apply(lnx_ip6_t *self)
 {
     struct lnx_ip6_addr_node *node;
-    char saddr[C_IPV6ADDR_LEN];
-    char spref[C_INT32_LEN];
-    int rc;
+    lnx_rtnl_batch_t batch;
+    int flush_end;
+    int ifindex;
+    int err;
+    int idx;
+
+    ifindex = if_nametoindex(self->ip6_ifname);
+    if (ifindex == 0)
+    {
+        LOG(WARN, "ip6: %s: Interface does not exist, unable to apply IPv6 configuration.", self->ip6_ifname);
+    }
+
+    lnx_rtnl_batch_init(&batch);
 
     /* Start by issuing a flush */
-    lnx_ip6_addr_flush(self);
+    lnx_ip6_addr_flush(self, ifindex, &batch);
+    flush_end = batch.rb_count;
+
+    if (ifindex == 0) goto exit;
 
     ds_tree_foreach(&self->ip6_addr_list, node)
     {
-        if (inet_ntop(AF_INET6, &node->addr.ia6_addr, saddr, sizeof(saddr)) == NULL)
-        {
-            LOG(ERR, "ip6: %s: Unable to convert IPv6 address, skipping add.", self->ip6_ifname);
-            continue;
-        }
+        node->req = lnx_rtnl_batch_addr(
+                &batch,
+                RTM_NEWADDR,
+                ifindex,
+                AF_INET6,
+                &node->addr.ia6_addr,
+                node->addr.ia6_prefix);
 
-        snprintf(spref, sizeof(spref), "%d", node->addr.ia6_prefix);
+        node->active = true;
+    }
 
-        rc = execsh_log(LOG_SEVERITY_DEBUG, ip6_add_cmd, self->ip6_ifname, saddr, spref);
-        if (rc != 0)
-        {
-            LOG(WARN, "ip6: %s: Unable to add IPv6 address: "PRI_osn_ip6_addr,
-                    self->ip6_ifname,
-                    FMT_osn_ip6_addr(node->addr));
-        }
+    if (lnx_rtnl_batch_commit(&batch) < 0)
+    {
+        LOG(ERR, "ip6: %s: Unable to send IPv6 configuration requests.", self->ip6_ifname);
+    }
 
-        node->active = true;
+    for (idx = 0; idx < flush_end; idx++)
+    {
+        if (lnx_rtnl_batch_error(&batch, idx) == 0) continue;
+
+        LOG(WARN, "ip6: %s: Unable to remove IPv6 address(es).", self->ip6_ifname);
+        break;
+    }
+
+    ds_tree_foreach(&self->ip6_addr_list, node)
+    {
+        err = node->req < 0 ? EINVAL : lnx_rtnl_batch_error(&batch, node->req);
+        if (err == 0) continue;
+
+        LOG(WARN, "ip6: %s: Unable to add IPv6 address: "PRI_osn_ip6_addr": %s",
+                self->ip6_ifname,
+                FMT_osn_ip6_addr(node->addr),
+                strerror(err));
     }
 
+exit:
+    lnx_rtnl_batch_fini(&batch);
+
     return true;
 }
 
@@ -300,67 +340,28 @@ bool lnx_ip6_dns_del(lnx_ip6_t *ip6, const osn_ip6_addr_t *addr)
     return false;
 }
 
-/**
- * Parse a single line of a "ip -o -6 addr show dev IF" output.
+/*
+ * Convert a RTNETLINK lifetime to the osn_ip6_addr_t representation. Permanent
+ * and expired addresses are reported without a lifetime (INT_MIN), same as
+ * when the status was parsed from "ip -6 address" output, so they keep
+ * comparing equal to the configured addresses.
  */
-bool lnx_ip6_ipaddr_parse(void *_self, int type, const char *line)
+static int lnx_ip6_lft(uint32_t lft)
 {
-    char *svalid_lft;
-    char *spref_lft;
-    char buf[256];
-    char *pbuf;
-    char *sip6;
-    int lft;
-
-    lnx_ip6_t *self = _self;
-
-    LOG(DEBUG, "ip6: %s: ip_addr_show%s %s",
-            self->ip6_ifname,
-            type == EXECSH_PIPE_STDOUT ? ">" : "|",
-            line);
-
-    if (type != EXECSH_PIPE_STDOUT) return true;
-
-    STRSCPY(buf, line);
-
-    /*
-     * Example output:
-     *
-     * # ip -o -6 addr show dev br-wan
-     * 20: br-wan    inet6 2a00:ee2:1704:9901::2000/128 scope global dynamic \       valid_lft 237sec preferred_lft 124sec
-     * 20: br-wan    inet6 fe80::62b4:f7ff:fef0:15c8/64 scope link \       valid_lft forever preferred_lft forever
-     */
-
-    /* Skip interface index */
-    strtok_r(buf, " ", &pbuf);
-
-    /* Skip interface name */
-    strtok_r(NULL, " ", &pbuf);
-
-    /* Skip "inet6" */
-    strtok_r(NULL, " ", &pbuf);
-
-    /* IPv6 address, includes the prefix */
-    sip6 = strtok_r(NULL, " ", &pbuf);
-
-    /*
-     * It seems that there's a variable amount of keywords after the IPv6 address
-     * Skip all keywords until we encounter the "valid_lft" string
-     */
-    while ((svalid_lft = strtok_r(NULL, " ", &pbuf)) != NULL)
-    {
-        if (strcmp(svalid_lft, "valid_lft") == 0) break;
-    }
+    if (lft == 0 || lft > INT_MAX) return INT_MIN;
 
-    /* Parse the vlaid_lft value */
-    svalid_lft = strtok_r(NULL, " ", &pbuf);
-
-    /* Skip "preferred_lft" */
-    strtok_r(NULL, " ", &pbuf);
+    return (int)lft;
+}
 
-    /* Skip "preferred_lft" */
-    spref_lft = strtok_r(NULL, " ", &pbuf);
+/**
+ * Add a single interface address to the status structure
+ */
+bool lnx_ip6_ipaddr_fn(void *_self, const struct lnx_rtnl_addr *addr)
+{
+    osn_ip6_addr_t *ip6;
+    void *is6_addr;
 
+    lnx_ip6_t *self = _self;
     struct osn_ip6_status *is = &self->ip6_status;
 
     /*
@@ -368,45 +369,28 @@ bool lnx_ip6_ipaddr_parse(void *_self, int type, const char *line)
      */
     if ((is->is6_addr_len % LNX_IP6_REALLOC_GROW) == 0)
     {
-        is->is6_addr = realloc(
+        is6_addr = realloc(
                 is->is6_addr,
                 (is->is6_addr_len + LNX_IP6_REALLOC_GROW) * sizeof(is->is6_addr[0]));
-    }
-
-    if (!osn_ip6_addr_from_str(&is->is6_addr[is->is6_addr_len], sip6))
-    {
-        LOG(WARN, "ip6: %s: Error parsing IPv6 addresses -- invalid IPv6 address \"%s\" on line: %s",
-                self->ip6_ifname,
-                sip6,
-                line);
-        return true;
-    }
+        if (is6_addr == NULL)
+        {
+            LOG(ERR, "ip6: %s: Error allocating IPv6 address list.", self->ip6_ifname);
+            return false;
+        }
 
-    if (strcmp(svalid_lft, "infinite") == 0)
-    {
-        is->is6_addr[is->is6_addr_len].ia6_valid_lft = -1;
-    }
-    else
-    {
-        lft = atol(svalid_lft);
-        if (lft == 0) lft = INT_MIN;
-        is->is6_addr[is->is6_addr_len].ia6_valid_lft = lft;
+        is->is6_addr = is6_addr;
     }
 
-    if (strcmp(spref_lft, "infinite") == 0)
-    {
-        is->is6_addr[is->is6_addr_len].ia6_pref_lft = -1;
-    }
-    else
-    {
-        lft = atol(spref_lft);
-        if (lft == 0) lft = INT_MIN;
-        is->is6_addr[is->is6_addr_len].ia6_pref_lft = lft;
-    }
+    ip6 = &is->is6_addr[is->is6_addr_len];
+    *ip6 = OSN_IP6_ADDR_INIT;
+    ip6->ia6_addr = addr->ra_addr.in6;
+    ip6->ia6_prefix = addr->ra_prefix;
+    ip6->ia6_valid_lft = lnx_ip6_lft(addr->ra_valid_lft);
+    ip6->ia6_pref_lft = lnx_ip6_lft(addr->ra_pref_lft);
 
     LOG(DEBUG, "ip6: %s: IPv6 address = "PRI_osn_ip6_addr,
             self->ip6_ifname,
-            FMT_osn_ip6_addr(is->is6_addr[is->is6_addr_len]));
+            FMT_osn_ip6_addr(*ip6));
 
     is->is6_addr_len++;
 
@@ -415,7 +399,7 @@ bool lnx_ip6_ipaddr_parse(void *_self, int type, const char *line)
 
 void lnx_ip6_status_ipaddr_update(lnx_ip6_t *self)
 {
-    int rc;
+    int ifindex;
 
     if (self->ip6_status.is6_addr != NULL)
     {
@@ -424,73 +408,25 @@ void lnx_ip6_status_ipaddr_update(lnx_ip6_t *self)
     self->ip6_status.is6_addr_len = 0;
     self->ip6_status.is6_addr = NULL;
 
-    rc = execsh_fn(lnx_ip6_ipaddr_parse, self, _S(ip -6 -o addr show dev "$1"), self->ip6_ifname);
-    if (rc != 0)
+    /* Addresses are served from the RTNETLINK cache */
+    ifindex = if_nametoindex(self->ip6_ifname);
+    if (ifindex == 0 || !lnx_rtnl_addr_foreach(AF_INET6, ifindex, lnx_ip6_ipaddr_fn, self))
     {
-        LOG(DEBUG, "ip6: %s: Unable to acquire IPv6 address list. Exit code: %d",
-                self->ip6_ifname,
-                rc);
+        LOG(DEBUG, "ip6: %s: Unable to acquire IPv6 address list.", self->ip6_ifname);
     }
 
     LOG(INFO, "ip6: %s: Found %zu IPv6 address(es).", self->ip6_ifname, self->ip6_status.is6_addr_len);
 }
+
 /**
- * Parse a single line of a "ip -6 neigh show" output.
+ * Add a single neighbor table entry to the status structure
  */
-bool lnx_ip6_neigh_parse(void *_self, int type, const char *line)
+bool lnx_ip6_neigh_fn(void *_self, const struct lnx_rtnl_neigh *neigh)
 {
-    char buf[256];
-    char *pbuf;
-    char *saddr;
-    char *smac;
-    char *sll;
+    struct osn_ip6_neigh *n;
+    void *is6_neigh;
 
     lnx_ip6_t *self = _self;
-
-    LOG(DEBUG, "ip6: %s: ip_neigh_show%s %s",
-            self->ip6_ifname,
-            type == EXECSH_PIPE_STDOUT ? ">" : "|",
-            line);
-
-    if (type != EXECSH_PIPE_STDOUT) return true;
-
-    STRSCPY(buf, line);
-
-    /*
-     * Example output:
-     *
-     * fe80::ae1f:6bff:feb0:55ef lladdr ac:1f:6b:b0:55:ef router STALE
-     */
-    saddr = strtok_r(buf, " ", &pbuf);
-
-    /*
-     * The next string may contain "lladdr" or "FAILED" -- skip this whole line
-     * if the next entry is not "lladdr"
-     */
-    sll = strtok_r(NULL, " ", &pbuf);
-    if (strcmp(sll, "lladdr") != 0)
-    {
-        /* Skip this entry */
-        return true;
-    }
-
-    /* Parse the MAC */
-    smac = strtok_r(NULL, " ", &pbuf);
-
-    if (smac == NULL || saddr == NULL)
-    {
-        LOG(WARN, "ip6: %s: Error parsing IPv6 neighbor output: %s",
-                self->ip6_ifname,
-                line);
-        return true;
-    }
-
-    if (strcmp(smac, "FAILED") == 0)
-    {
-        /* ip -6 neigh flush may trigger this condition */
-        return true;
-    }
-
     struct osn_ip6_status *is = &self->ip6_status;
 
     /*
@@ -498,37 +434,29 @@ bool lnx_ip6_neigh_parse(void *_self, int type, const char *line)
      */
     if ((is->is6_neigh_len % LNX_IP6_REALLOC_GROW) == 0)
     {
-        is->is6_neigh = realloc(
+        is6_neigh = realloc(
                 is->is6_neigh,
                 (is->is6_neigh_len + LNX_IP6_REALLOC_GROW) * sizeof(is->is6_neigh[0]));
-    }
-
-    if (!osn_ip6_addr_from_str(&is->is6_neigh[is->is6_neigh_len].i6n_ipaddr, saddr))
-    {
-        LOG(WARN, "ip6: %s: Error parsing IPv6 neighbor report -- invalid IPv6 address \"%s\" on line: %s",
-                self->ip6_ifname,
-                saddr,
-                line);
-        return true;
-    }
+        if (is6_neigh == NULL)
+        {
+            LOG(ERR, "ip6: %s: Error allocating IPv6 neighbor list.", self->ip6_ifname);
+            return false;
+        }
 
-    if (!osn_mac_addr_from_str(&is->is6_neigh[is->is6_neigh_len].i6n_hwaddr, smac))
-    {
-        LOG(WARN, "ip6: %s: Error parsing IPv6 neighbor report -- invalid MAC \"%s\" on line: %s",
-                self->ip6_ifname,
-                smac,
-                line);
-        return true;
+        is->is6_neigh = is6_neigh;
     }
 
-    is->is6_neigh_len++;
+    n = &is->is6_neigh[is->is6_neigh_len++];
+    n->i6n_ipaddr = OSN_IP6_ADDR_INIT;
+    n->i6n_ipaddr.ia6_addr = neigh->rn_addr.in6;
+    memcpy(n->i6n_hwaddr.ma_addr, neigh->rn_lladdr, sizeof(n->i6n_hwaddr.ma_addr));
 
     return true;
 }
 
 void lnx_ip6_status_neigh_update(lnx_ip6_t *self)
 {
-    int rc;
+    int ifindex;
 
     if (self->ip6_status.is6_neigh != NULL)
     {
@@ -537,12 +465,11 @@ void lnx_ip6_status_neigh_update(lnx_ip6_t *self)
     self->ip6_status.is6_neigh_len = 0;
     self->ip6_status.is6_neigh = NULL;
 
-    rc = execsh_fn(lnx_ip6_neigh_parse, self, _S(ip -6 neigh show dev "$1"), self->ip6_ifname);
-    if (rc != 0)
+    ifindex = if_nametoindex(self->ip6_ifname);
+    if (ifindex == 0 || !lnx_rtnl_neigh_foreach(AF_INET6, ifindex, lnx_ip6_neigh_fn, self))
     {
-        LOG(DEBUG, "ip6: %s: \"ip -6 neigh show\" returned error %d. Neighbor report may be incomplete.",
-                self->ip6_ifname,
-                rc);
+        LOG(DEBUG, "ip6: %s: Unable to acquire IPv6 neighbors. Neighbor report may be incomplete.",
+                self->ip6_ifname);
     }
 
     LOG(INFO, "ip6: %s: Found %zu neighbor(s).", self->ip6_ifname, self->ip6_status.is6_neigh_len);
@@ -46,6 +46,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "util.h"
 
 #include "lnx_netlink.h"
+#include "lnx_rtnl.h"
 
 #if !defined(CONFIG_OSN_NETLINK_DEBOUNCE_MS)
 #define CONFIG_OSN_NETLINK_DEBOUNCE_MS 300
@@ -217,6 +218,9 @@ bool lnx_netlink_sock_open(void)
      ev_io_init(&lnx_netlink_sock_ev, lnx_netlink_sock_fn, lnx_netlink_sock, EV_READ);
      ev_io_start(EV_DEFAULT, &lnx_netlink_sock_ev);
 
+     /* Address and route changes are tracked from now on, resync the cache */
+     lnx_rtnl_cache_track(true);
+
      LOG(NOTICE, "netlink: NETLINK socket successfully created.");
 
      return true;
@@ -238,6 +242,9 @@ void lnx_netlink_sock_close(void)
     /* Stop listening to I/O events */
     ev_io_stop(EV_DEFAULT, &lnx_netlink_sock_ev);
 
+    /* Events are lost from now on, stop trusting the address and route cache */
+    lnx_rtnl_cache_track(false);
+
     /* Close the socket */
     if (close(lnx_netlink_sock) != 0)
     {
@@ -286,6 +293,9 @@ void lnx_netlink_sock_fn(struct ev_loop *loop, ev_io *w, int revent)
             NLMSG_OK(nl_msg, nl_len);
             nl_msg = NLMSG_NEXT(nl_msg, nl_len))
     {
+        /* Keep the address and route cache up to date */
+        lnx_rtnl_cache_update(nl_msg);
+
         /* Filter certain type of netlink messages as they cause too much unnecessary updates */
         if (lnx_netlink_weed_out(nl_msg))
         {
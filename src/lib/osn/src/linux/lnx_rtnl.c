@@ -0,0 +1,1292 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * ===========================================================================
+ *  This module implements interface configuration and state queries over
+ *  a RTNETLINK socket.
+ *
+ *  A single NETLINK_ROUTE socket is shared by all users; requests are queued
+ *  to a batch and sent to the kernel in one go, followed by reading back the
+ *  ACKs. Addresses and routes are kept in a cache: the cache is filled by a
+ *  dump on first use and kept up to date by the events received by
+ *  lnx_netlink. If lnx_netlink is not listening to events, each query issues
+ *  a new dump.
+ *
+ *  This is an private module and is not part of the OpenSync Networking API.
+ * ===========================================================================
+ */
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/neighbour.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ds_tree.h"
+#include "log.h"
+#include "os_time.h"
+#include "util.h"
+
+#include "lnx_rtnl.h"
+
+/* Maximum size of a single request */
+#define LNX_RTNL_REQ_SZ         512
+/* Receive buffer size of the RTNETLINK socket, large enough for a chunk of ACKs */
+#define LNX_RTNL_RCVBUF_SZ      (256 * 1024)
+/* Timeout in seconds when waiting for a kernel reply */
+#define LNX_RTNL_TIMEOUT        2
+/* Number of times a dump is repeated when it was interrupted by a change */
+#define LNX_RTNL_DUMP_RETRY     3
+
+/* Index into the per-family cache state arrays */
+#define LNX_RTNL_FAMILY_IDX(f)  ((f) == AF_INET6 ? 1 : 0)
+
+struct lnx_rtnl_addr_node
+{
+    struct lnx_rtnl_addr    an_addr;        /* Address, also the tree key */
+    double                  an_tstamp;      /* Time the lifetimes were received */
+    ds_tree_node_t          an_tnode;
+};
+
+struct lnx_rtnl_route_node
+{
+    struct lnx_rtnl_route   rn_route;       /* Route, also the tree key */
+    ds_tree_node_t          rn_tnode;
+};
+
+typedef void lnx_rtnl_dump_fn_t(void *data, struct nlmsghdr *nh);
+
+static int lnx_rtnl_addr_cmp(void *_a, void *_b);
+static int lnx_rtnl_route_cmp(void *_a, void *_b);
+
+/* RTNETLINK request socket */
+static int lnx_rtnl_sock = -1;
+/* Sequence number of the next request */
+static uint32_t lnx_rtnl_seq;
+/* Receive buffer, grown to the size of the largest message */
+static uint8_t *lnx_rtnl_rbuf;
+static size_t lnx_rtnl_rbuf_sz;
+
+/* True if lnx_netlink feeds events to the cache */
+static bool lnx_rtnl_tracked = false;
+/* Per family (IPv4, IPv6) cache validity */
+static bool lnx_rtnl_addr_valid[2];
+static bool lnx_rtnl_route_valid[2];
+
+static ds_tree_t lnx_rtnl_addr_cache = DS_TREE_INIT(lnx_rtnl_addr_cmp, struct lnx_rtnl_addr_node, an_tnode);
+static ds_tree_t lnx_rtnl_route_cache = DS_TREE_INIT(lnx_rtnl_route_cmp, struct lnx_rtnl_route_node, rn_tnode);
+
+static const union lnx_rtnl_inaddr lnx_rtnl_inaddr_any;
+
+/*
+ * ===========================================================================
+ *  Socket handling
+ * ===========================================================================
+ */
+static bool lnx_rtnl_sock_open(void)
+{
+    struct sockaddr_nl nladdr;
+    struct timeval tv;
+    int sz;
+
+    if (lnx_rtnl_sock >= 0) return true;
+
+    lnx_rtnl_sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (lnx_rtnl_sock < 0)
+    {
+        LOG(ERR, "rtnl: Error creating RTNETLINK socket: %s", strerror(errno));
+        return false;
+    }
+
+    sz = LNX_RTNL_RCVBUF_SZ;
+    if (setsockopt(lnx_rtnl_sock, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz)) != 0)
+    {
+        LOG(WARN, "rtnl: Error setting the RTNETLINK socket receive buffer size: %s", strerror(errno));
+    }
+
+    /* Never block forever waiting for the kernel */
+    tv.tv_sec = LNX_RTNL_TIMEOUT;
+    tv.tv_usec = 0;
+    if (setsockopt(lnx_rtnl_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0)
+    {
+        LOG(WARN, "rtnl: Error setting the RTNETLINK socket timeout: %s", strerror(errno));
+    }
+
+    memset(&nladdr, 0, sizeof(nladdr));
+    nladdr.nl_family = AF_NETLINK;
+    if (bind(lnx_rtnl_sock, (struct sockaddr *)&nladdr, sizeof(nladdr)) != 0)
+    {
+        LOG(ERR, "rtnl: Error binding RTNETLINK socket: %s", strerror(errno));
+        close(lnx_rtnl_sock);
+        lnx_rtnl_sock = -1;
+        return false;
+    }
+
+    if (lnx_rtnl_seq == 0) lnx_rtnl_seq = (uint32_t)time(NULL);
+
+    return true;
+}
+
+/*
+ * The socket is closed after a receive error; this drops any stale replies
+ * so they are not mistaken for replies to the next request.
+ */
+static void lnx_rtnl_sock_close(void)
+{
+    if (lnx_rtnl_sock < 0) return;
+
+    close(lnx_rtnl_sock);
+    lnx_rtnl_sock = -1;
+}
+
+/*
+ * Receive a single datagram into lnx_rtnl_rbuf, growing it if needed
+ */
+static ssize_t lnx_rtnl_recv(void)
+{
+    uint8_t *buf;
+    ssize_t rc;
+
+    do
+    {
+        rc = recv(lnx_rtnl_sock, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    }
+    while (rc < 0 && errno == EINTR);
+
+    if (rc < 0)
+    {
+        LOG(ERR, "rtnl: Error receiving from RTNETLINK socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if ((size_t)rc > lnx_rtnl_rbuf_sz)
+    {
+        buf = realloc(lnx_rtnl_rbuf, rc);
+        if (buf == NULL)
+        {
+            LOG(ERR, "rtnl: Error allocating receive buffer of %zd bytes.", rc);
+            return -1;
+        }
+
+        lnx_rtnl_rbuf = buf;
+        lnx_rtnl_rbuf_sz = rc;
+    }
+
+    do
+    {
+        rc = recv(lnx_rtnl_sock, lnx_rtnl_rbuf, lnx_rtnl_rbuf_sz, 0);
+    }
+    while (rc < 0 && errno == EINTR);
+
+    if (rc < 0)
+    {
+        LOG(ERR, "rtnl: Error receiving from RTNETLINK socket: %s", strerror(errno));
+    }
+
+    return rc;
+}
+
+/*
+ * ===========================================================================
+ *  Message helpers
+ * ===========================================================================
+ */
+static void lnx_rtnl_msg_init(struct nlmsghdr *nh, int type, int flags, size_t hdr_len)
+{
+    memset(nh, 0, LNX_RTNL_REQ_SZ);
+    nh->nlmsg_len = NLMSG_LENGTH(hdr_len);
+    nh->nlmsg_type = type;
+    nh->nlmsg_flags = NLM_F_REQUEST | flags;
+}
+
+static struct rtattr *lnx_rtnl_attr_put(struct nlmsghdr *nh, int type, const void *data, size_t len)
+{
+    struct rtattr *rta;
+
+    if (NLMSG_ALIGN(nh->nlmsg_len) + RTA_SPACE(len) > LNX_RTNL_REQ_SZ)
+    {
+        LOG(ERR, "rtnl: Request too large, cannot add attribute %d.", type);
+        return NULL;
+    }
+
+    rta = (struct rtattr *)((uint8_t *)nh + NLMSG_ALIGN(nh->nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    if (len > 0) memcpy(RTA_DATA(rta), data, len);
+
+    nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_SPACE(len);
+
+    return rta;
+}
+
+static void lnx_rtnl_attr_nest_end(struct nlmsghdr *nh, struct rtattr *nest)
+{
+    nest->rta_len = (uint8_t *)nh + nh->nlmsg_len - (uint8_t *)nest;
+}
+
+static void lnx_rtnl_attr_parse(struct rtattr *tb[], int max, struct rtattr *rta, int len)
+{
+    memset(tb, 0, sizeof(tb[0]) * (max + 1));
+
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        if (rta->rta_type <= max) tb[rta->rta_type] = rta;
+    }
+}
+
+static size_t lnx_rtnl_inaddr_len(int family)
+{
+    switch (family)
+    {
+        case AF_INET:
+            return sizeof(struct in_addr);
+
+        case AF_INET6:
+            return sizeof(struct in6_addr);
+    }
+
+    return 0;
+}
+
+/*
+ * Copy an address attribute, returns false if the attribute is missing or
+ * has the wrong size
+ */
+static bool lnx_rtnl_attr_inaddr(union lnx_rtnl_inaddr *out, int family, struct rtattr *rta)
+{
+    size_t alen = lnx_rtnl_inaddr_len(family);
+
+    if (rta == NULL || alen == 0 || RTA_PAYLOAD(rta) != alen) return false;
+
+    memcpy(out, RTA_DATA(rta), alen);
+
+    return true;
+}
+
+static uint32_t lnx_rtnl_attr_u32(struct rtattr *rta, uint32_t def)
+{
+    if (rta == NULL || RTA_PAYLOAD(rta) < sizeof(uint32_t)) return def;
+
+    return *(uint32_t *)RTA_DATA(rta);
+}
+
+/*
+ * ===========================================================================
+ *  Request batching
+ * ===========================================================================
+ */
+void lnx_rtnl_batch_init(lnx_rtnl_batch_t *self)
+{
+    memset(self, 0, sizeof(*self));
+}
+
+void lnx_rtnl_batch_fini(lnx_rtnl_batch_t *self)
+{
+    free(self->rb_buf);
+    free(self->rb_err);
+    memset(self, 0, sizeof(*self));
+}
+
+/*
+ * Append a request to the batch and return its index
+ */
+static int lnx_rtnl_batch_queue(lnx_rtnl_batch_t *self, struct nlmsghdr *nh)
+{
+    size_t len = NLMSG_ALIGN(nh->nlmsg_len);
+    size_t size;
+    uint8_t *buf;
+
+    /* First request after a commit, forget the previous results */
+    if (self->rb_len == 0) self->rb_count = 0;
+
+    if (self->rb_len + len > self->rb_size)
+    {
+        size = self->rb_size == 0 ? 4 * LNX_RTNL_REQ_SZ : self->rb_size;
+        while (size < self->rb_len + len) size *= 2;
+
+        buf = realloc(self->rb_buf, size);
+        if (buf == NULL)
+        {
+            LOG(ERR, "rtnl: Error allocating request batch buffer.");
+            return -1;
+        }
+
+        self->rb_buf = buf;
+        self->rb_size = size;
+    }
+
+    memcpy(self->rb_buf + self->rb_len, nh, len);
+    self->rb_len += len;
+
+    return self->rb_count++;
+}
+
+int lnx_rtnl_batch_addr(
+        lnx_rtnl_batch_t *self,
+        int cmd,
+        int ifindex,
+        int family,
+        const void *addr,
+        int prefix)
+{
+    union
+    {
+        struct nlmsghdr     nh;
+        uint8_t             buf[LNX_RTNL_REQ_SZ];
+    } req;
+
+    struct ifaddrmsg *ifa;
+    struct in_addr brd;
+    uint32_t mask;
+    size_t alen;
+
+    alen = lnx_rtnl_inaddr_len(family);
+    if (alen == 0 || prefix < 0 || prefix > (int)alen * 8) return -1;
+
+    lnx_rtnl_msg_init(&req.nh, cmd, cmd == RTM_NEWADDR ? NLM_F_CREATE | NLM_F_EXCL : 0, sizeof(*ifa));
+
+    ifa = NLMSG_DATA(&req.nh);
+    ifa->ifa_family = family;
+    ifa->ifa_prefixlen = prefix;
+    ifa->ifa_index = ifindex;
+    ifa->ifa_scope = RT_SCOPE_UNIVERSE;
+
+    if (lnx_rtnl_attr_put(&req.nh, IFA_LOCAL, addr, alen) == NULL) return -1;
+
+    if (cmd == RTM_NEWADDR)
+    {
+        if (lnx_rtnl_attr_put(&req.nh, IFA_ADDRESS, addr, alen) == NULL) return -1;
+
+        if (family == AF_INET)
+        {
+            memcpy(&brd, addr, sizeof(brd));
+
+            /* Same as iproute2 "broadcast +": only set for prefixes shorter than /31 */
+            if (prefix <= 30)
+            {
+                mask = prefix == 0 ? 0 : htonl(~0U << (32 - prefix));
+                brd.s_addr |= ~mask;
+                if (lnx_rtnl_attr_put(&req.nh, IFA_BROADCAST, &brd, sizeof(brd)) == NULL) return -1;
+            }
+
+            /* Loopback addresses have host scope, same as iproute2 */
+            if ((ntohl(brd.s_addr) >> 24) == 127) ifa->ifa_scope = RT_SCOPE_HOST;
+        }
+    }
+
+    return lnx_rtnl_batch_queue(self, &req.nh);
+}
+
+int lnx_rtnl_batch_route(
+        lnx_rtnl_batch_t *self,
+        int cmd,
+        int ifindex,
+        int family,
+        const void *dst,
+        int dst_len,
+        const void *gw)
+{
+    union
+    {
+        struct nlmsghdr     nh;
+        uint8_t             buf[LNX_RTNL_REQ_SZ];
+    } req;
+
+    struct rtmsg *rtm;
+    uint32_t oif;
+    size_t alen;
+
+    alen = lnx_rtnl_inaddr_len(family);
+    if (alen == 0 || dst_len < 0 || dst_len > (int)alen * 8) return -1;
+
+    lnx_rtnl_msg_init(&req.nh, cmd, cmd == RTM_NEWROUTE ? NLM_F_CREATE | NLM_F_EXCL : 0, sizeof(*rtm));
+
+    rtm = NLMSG_DATA(&req.nh);
+    rtm->rtm_family = family;
+    rtm->rtm_dst_len = dst_len;
+    rtm->rtm_table = RT_TABLE_MAIN;
+
+    /* Match "ip route add" and "ip route del" */
+    if (cmd == RTM_NEWROUTE)
+    {
+        rtm->rtm_protocol = RTPROT_BOOT;
+        rtm->rtm_scope = gw != NULL ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+        rtm->rtm_type = RTN_UNICAST;
+    }
+    else
+    {
+        rtm->rtm_scope = RT_SCOPE_NOWHERE;
+    }
+
+    if (dst_len > 0 && lnx_rtnl_attr_put(&req.nh, RTA_DST, dst, alen) == NULL) return -1;
+    if (gw != NULL && lnx_rtnl_attr_put(&req.nh, RTA_GATEWAY, gw, alen) == NULL) return -1;
+
+    oif = ifindex;
+    if (lnx_rtnl_attr_put(&req.nh, RTA_OIF, &oif, sizeof(oif)) == NULL) return -1;
+
+    return lnx_rtnl_batch_queue(self, &req.nh);
+}
+
+int lnx_rtnl_batch_route_del(lnx_rtnl_batch_t *self, const struct lnx_rtnl_route *route)
+{
+    union
+    {
+        struct nlmsghdr     nh;
+        uint8_t             buf[LNX_RTNL_REQ_SZ];
+    } req;
+
+    struct rtmsg *rtm;
+    uint32_t val;
+    size_t alen;
+
+    alen = lnx_rtnl_inaddr_len(route->rr_family);
+    if (alen == 0) return -1;
+
+    lnx_rtnl_msg_init(&req.nh, RTM_DELROUTE, 0, sizeof(*rtm));
+
+    rtm = NLMSG_DATA(&req.nh);
+    rtm->rtm_family = route->rr_family;
+    rtm->rtm_dst_len = route->rr_dst_len;
+    rtm->rtm_tos = route->rr_tos;
+    rtm->rtm_table = route->rr_table < 256 ? route->rr_table : RT_TABLE_UNSPEC;
+    rtm->rtm_scope = RT_SCOPE_NOWHERE;
+
+    val = route->rr_table;
+    if (lnx_rtnl_attr_put(&req.nh, RTA_TABLE, &val, sizeof(val)) == NULL) return -1;
+
+    if (route->rr_dst_len > 0 &&
+            lnx_rtnl_attr_put(&req.nh, RTA_DST, &route->rr_dst, alen) == NULL)
+    {
+        return -1;
+    }
+
+    if (memcmp(&route->rr_gw, &lnx_rtnl_inaddr_any, alen) != 0 &&
+            lnx_rtnl_attr_put(&req.nh, RTA_GATEWAY, &route->rr_gw, alen) == NULL)
+    {
+        return -1;
+    }
+
+    val = route->rr_ifindex;
+    if (val != 0 && lnx_rtnl_attr_put(&req.nh, RTA_OIF, &val, sizeof(val)) == NULL) return -1;
+
+    val = route->rr_priority;
+    if (val != 0 && lnx_rtnl_attr_put(&req.nh, RTA_PRIORITY, &val, sizeof(val)) == NULL) return -1;
+
+    return lnx_rtnl_batch_queue(self, &req.nh);
+}
+
+int lnx_rtnl_batch_vlan_add(lnx_rtnl_batch_t *self, const char *ifname, int parent_ifindex, int vid)
+{
+    union
+    {
+        struct nlmsghdr     nh;
+        uint8_t             buf[LNX_RTNL_REQ_SZ];
+    } req;
+
+    struct rtattr *linkinfo;
+    struct rtattr *data;
+    uint32_t link;
+    uint16_t id;
+
+    if (strlen(ifname) >= IFNAMSIZ) return -1;
+
+    lnx_rtnl_msg_init(&req.nh, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, sizeof(struct ifinfomsg));
+
+    link = parent_ifindex;
+    if (lnx_rtnl_attr_put(&req.nh, IFLA_LINK, &link, sizeof(link)) == NULL) return -1;
+    if (lnx_rtnl_attr_put(&req.nh, IFLA_IFNAME, ifname, strlen(ifname) + 1) == NULL) return -1;
+
+    linkinfo = lnx_rtnl_attr_put(&req.nh, IFLA_LINKINFO, NULL, 0);
+    if (linkinfo == NULL) return -1;
+    if (lnx_rtnl_attr_put(&req.nh, IFLA_INFO_KIND, "vlan", strlen("vlan")) == NULL) return -1;
+
+    data = lnx_rtnl_attr_put(&req.nh, IFLA_INFO_DATA, NULL, 0);
+    if (data == NULL) return -1;
+
+    id = vid;
+    if (lnx_rtnl_attr_put(&req.nh, IFLA_VLAN_ID, &id, sizeof(id)) == NULL) return -1;
+
+    lnx_rtnl_attr_nest_end(&req.nh, data);
+    lnx_rtnl_attr_nest_end(&req.nh, linkinfo);
+
+    return lnx_rtnl_batch_queue(self, &req.nh);
+}
+
+int lnx_rtnl_batch_link_del(lnx_rtnl_batch_t *self, const char *ifname)
+{
+    union
+    {
+        struct nlmsghdr     nh;
+        uint8_t             buf[LNX_RTNL_REQ_SZ];
+    } req;
+
+    if (strlen(ifname) >= IFNAMSIZ) return -1;
+
+    lnx_rtnl_msg_init(&req.nh, RTM_DELLINK, 0, sizeof(struct ifinfomsg));
+
+    if (lnx_rtnl_attr_put(&req.nh, IFLA_IFNAME, ifname, strlen(ifname) + 1) == NULL) return -1;
+
+    return lnx_rtnl_batch_queue(self, &req.nh);
+}
+
+/*
+ * Errors which mean that the requested state is already in place: deleting
+ * an object that is already gone. Secondary IPv4 addresses, for example, are
+ * removed together with the primary address.
+ */
+static bool lnx_rtnl_batch_err_ignore(int type, int err)
+{
+    switch (type)
+    {
+        case RTM_DELLINK:
+            return err == ENODEV;
+
+        case RTM_DELADDR:
+            return err == EADDRNOTAVAIL || err == ENODEV;
+
+        case RTM_DELROUTE:
+            return err == ESRCH || err == ENODEV;
+    }
+
+    return false;
+}
+
+/*
+ * Send requests [first, first + count) starting at offset off and wait for
+ * their ACKs. Returns false on socket errors.
+ */
+static bool lnx_rtnl_batch_send(lnx_rtnl_batch_t *self, uint32_t seq, int first, int count, size_t off, size_t len)
+{
+    struct nlmsgerr *err;
+    struct nlmsghdr *nh;
+    size_t nl_len;
+    int pending;
+    ssize_t rc;
+    int idx;
+
+    do
+    {
+        rc = send(lnx_rtnl_sock, self->rb_buf + off, len, 0);
+    }
+    while (rc < 0 && errno == EINTR);
+
+    if (rc < 0)
+    {
+        LOG(ERR, "rtnl: Error sending %d request(s): %s", count, strerror(errno));
+        return false;
+    }
+
+    pending = count;
+    while (pending > 0)
+    {
+        rc = lnx_rtnl_recv();
+        if (rc < 0) return false;
+
+        for (nh = (void *)lnx_rtnl_rbuf, nl_len = (size_t)rc;
+                NLMSG_OK(nh, nl_len);
+                nh = NLMSG_NEXT(nh, nl_len))
+        {
+            /* Skip replies to earlier requests */
+            idx = (int)(nh->nlmsg_seq - seq);
+            if (idx < first || idx >= first + count) continue;
+            if (nh->nlmsg_type != NLMSG_ERROR) continue;
+            if (self->rb_err[idx] >= 0) continue;
+
+            err = NLMSG_DATA(nh);
+            self->rb_err[idx] = -err->error;
+            pending--;
+        }
+    }
+
+    return true;
+}
+
+int lnx_rtnl_batch_commit(lnx_rtnl_batch_t *self)
+{
+    struct nlmsghdr *nh;
+    size_t chunk_off;
+    int chunk_first;
+    size_t off;
+    uint32_t seq;
+    int *perr;
+    int nerr;
+    int idx;
+
+    if (self->rb_len == 0) return 0;
+
+    perr = realloc(self->rb_err, self->rb_count * sizeof(self->rb_err[0]));
+    if (perr == NULL)
+    {
+        LOG(ERR, "rtnl: Error allocating request results.");
+        self->rb_len = 0;
+        self->rb_count = 0;
+        return -1;
+    }
+    self->rb_err = perr;
+
+    /* -1 marks a request that was not acknowledged yet */
+    for (idx = 0; idx < self->rb_count; idx++) self->rb_err[idx] = -1;
+
+    if (!lnx_rtnl_sock_open()) goto error;
+
+    seq = lnx_rtnl_seq;
+    lnx_rtnl_seq += self->rb_count;
+
+    /*
+     * Send requests in chunks; ACKs that don't fit the socket receive buffer
+     * are dropped by the kernel.
+     */
+    chunk_first = 0;
+    chunk_off = 0;
+    for (idx = 0, off = 0; idx < self->rb_count; idx++)
+    {
+        nh = (struct nlmsghdr *)(self->rb_buf + off);
+        nh->nlmsg_seq = seq + idx;
+        nh->nlmsg_flags |= NLM_F_ACK;
+        off += NLMSG_ALIGN(nh->nlmsg_len);
+
+        if (idx + 1 - chunk_first < LNX_RTNL_BATCH_CHUNK && idx + 1 < self->rb_count) continue;
+
+        if (!lnx_rtnl_batch_send(self, seq, chunk_first, idx + 1 - chunk_first, chunk_off, off - chunk_off))
+        {
+            lnx_rtnl_sock_close();
+            goto error;
+        }
+
+        chunk_first = idx + 1;
+        chunk_off = off;
+    }
+
+    /* Collect results and apply the successful requests to the cache */
+    nerr = 0;
+    for (idx = 0, off = 0; idx < self->rb_count; idx++)
+    {
+        nh = (struct nlmsghdr *)(self->rb_buf + off);
+        off += NLMSG_ALIGN(nh->nlmsg_len);
+
+        if (self->rb_err[idx] != 0 && lnx_rtnl_batch_err_ignore(nh->nlmsg_type, self->rb_err[idx]))
+        {
+            self->rb_err[idx] = 0;
+        }
+
+        if (self->rb_err[idx] != 0)
+        {
+            LOG(DEBUG, "rtnl: Request %d (type %d) failed: %s",
+                    idx, nh->nlmsg_type, strerror(self->rb_err[idx]));
+            nerr++;
+            continue;
+        }
+
+        /*
+         * The kernel will report the same change as an event, applying it
+         * now makes it visible to queries issued before the event is read.
+         */
+        if (nh->nlmsg_type != RTM_NEWLINK && nh->nlmsg_type != RTM_DELLINK)
+        {
+            lnx_rtnl_cache_update(nh);
+        }
+    }
+
+    self->rb_len = 0;
+
+    return nerr;
+
+error:
+    for (idx = 0; idx < self->rb_count; idx++)
+    {
+        if (self->rb_err[idx] < 0) self->rb_err[idx] = EIO;
+    }
+
+    self->rb_len = 0;
+
+    return -1;
+}
+
+int lnx_rtnl_batch_error(lnx_rtnl_batch_t *self, int idx)
+{
+    if (idx < 0 || idx >= self->rb_count || self->rb_err == NULL) return EINVAL;
+
+    return self->rb_err[idx];
+}
+
+/*
+ * ===========================================================================
+ *  Dumps
+ * ===========================================================================
+ */
+static bool lnx_rtnl_dump(int type, int family, lnx_rtnl_dump_fn_t *fn, void *data, bool *intr)
+{
+    union
+    {
+        struct nlmsghdr     nh;
+        uint8_t             buf[LNX_RTNL_REQ_SZ];
+    } req;
+
+    struct nlmsgerr *err;
+    struct nlmsghdr *nh;
+    size_t hdr_len;
+    size_t nl_len;
+    uint32_t seq;
+    ssize_t rc;
+
+    *intr = false;
+
+    switch (type)
+    {
+        case RTM_GETADDR:
+            hdr_len = sizeof(struct ifaddrmsg);
+            break;
+
+        case RTM_GETROUTE:
+            hdr_len = sizeof(struct rtmsg);
+            break;
+
+        case RTM_GETNEIGH:
+            hdr_len = sizeof(struct ndmsg);
+            break;
+
+        default:
+            return false;
+    }
+
+    if (!lnx_rtnl_sock_open()) return false;
+
+    /* The address family is the first field of all the headers above */
+    lnx_rtnl_msg_init(&req.nh, type, NLM_F_DUMP, hdr_len);
+    *(uint8_t *)NLMSG_DATA(&req.nh) = family;
+    seq = req.nh.nlmsg_seq = lnx_rtnl_seq++;
+
+    do
+    {
+        rc = send(lnx_rtnl_sock, &req, req.nh.nlmsg_len, 0);
+    }
+    while (rc < 0 && errno == EINTR);
+
+    if (rc < 0)
+    {
+        LOG(ERR, "rtnl: Error sending dump request %d: %s", type, strerror(errno));
+        return false;
+    }
+
+    while (true)
+    {
+        rc = lnx_rtnl_recv();
+        if (rc < 0) goto error;
+
+        for (nh = (void *)lnx_rtnl_rbuf, nl_len = (size_t)rc;
+                NLMSG_OK(nh, nl_len);
+                nh = NLMSG_NEXT(nh, nl_len))
+        {
+            if (nh->nlmsg_seq != seq) continue;
+
+            /* The dump content changed while it was being sent */
+            if (nh->nlmsg_flags & NLM_F_DUMP_INTR) *intr = true;
+
+            if (nh->nlmsg_type == NLMSG_DONE) return true;
+
+            if (nh->nlmsg_type == NLMSG_ERROR)
+            {
+                err = NLMSG_DATA(nh);
+                LOG(ERR, "rtnl: Dump request %d failed: %s", type, strerror(-err->error));
+                return false;
+            }
+
+            fn(data, nh);
+        }
+    }
+
+error:
+    lnx_rtnl_sock_close();
+    return false;
+}
+
+/*
+ * ===========================================================================
+ *  Address and route cache
+ * ===========================================================================
+ */
+int lnx_rtnl_addr_cmp(void *_a, void *_b)
+{
+    struct lnx_rtnl_addr *a = _a;
+    struct lnx_rtnl_addr *b = _b;
+
+    if (a->ra_family != b->ra_family) return a->ra_family - b->ra_family;
+    if (a->ra_ifindex != b->ra_ifindex) return a->ra_ifindex - b->ra_ifindex;
+    if (a->ra_prefix != b->ra_prefix) return a->ra_prefix - b->ra_prefix;
+
+    return memcmp(&a->ra_addr, &b->ra_addr, sizeof(a->ra_addr));
+}
+
+int lnx_rtnl_route_cmp(void *_a, void *_b)
+{
+    struct lnx_rtnl_route *a = _a;
+    struct lnx_rtnl_route *b = _b;
+    int rc;
+
+    if (a->rr_family != b->rr_family) return a->rr_family - b->rr_family;
+    if (a->rr_table != b->rr_table) return a->rr_table - b->rr_table;
+    if (a->rr_dst_len != b->rr_dst_len) return a->rr_dst_len - b->rr_dst_len;
+
+    rc = memcmp(&a->rr_dst, &b->rr_dst, sizeof(a->rr_dst));
+    if (rc != 0) return rc;
+
+    if (a->rr_tos != b->rr_tos) return a->rr_tos - b->rr_tos;
+    if (a->rr_priority != b->rr_priority) return a->rr_priority < b->rr_priority ? -1 : 1;
+    if (a->rr_ifindex != b->rr_ifindex) return a->rr_ifindex - b->rr_ifindex;
+
+    return memcmp(&a->rr_gw, &b->rr_gw, sizeof(a->rr_gw));
+}
+
+static void lnx_rtnl_addr_cache_msg(struct nlmsghdr *nh)
+{
+    struct rtattr *tb[IFA_MAX + 1];
+    struct lnx_rtnl_addr_node *node;
+    struct ifa_cacheinfo *ci;
+    struct lnx_rtnl_addr addr;
+    struct ifaddrmsg *ifa;
+
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa))) return;
+
+    ifa = NLMSG_DATA(nh);
+    if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6) return;
+
+    lnx_rtnl_attr_parse(tb, IFA_MAX, IFA_RTA(ifa), IFA_PAYLOAD(nh));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.ra_family = ifa->ifa_family;
+    addr.ra_ifindex = ifa->ifa_index;
+    addr.ra_prefix = ifa->ifa_prefixlen;
+    addr.ra_scope = ifa->ifa_scope;
+    addr.ra_valid_lft = LNX_RTNL_LFT_INFINITE;
+    addr.ra_pref_lft = LNX_RTNL_LFT_INFINITE;
+
+    /* IFA_ADDRESS is the peer address on point-to-point links */
+    if (!lnx_rtnl_attr_inaddr(&addr.ra_addr, addr.ra_family, tb[IFA_LOCAL]) &&
+            !lnx_rtnl_attr_inaddr(&addr.ra_addr, addr.ra_family, tb[IFA_ADDRESS]))
+    {
+        return;
+    }
+
+    if (tb[IFA_CACHEINFO] != NULL && RTA_PAYLOAD(tb[IFA_CACHEINFO]) >= sizeof(*ci))
+    {
+        ci = RTA_DATA(tb[IFA_CACHEINFO]);
+        addr.ra_valid_lft = ci->ifa_valid;
+        addr.ra_pref_lft = ci->ifa_prefered;
+    }
+
+    node = ds_tree_find(&lnx_rtnl_addr_cache, &addr);
+
+    if (nh->nlmsg_type == RTM_DELADDR)
+    {
+        if (node == NULL) return;
+
+        ds_tree_remove(&lnx_rtnl_addr_cache, node);
+        free(node);
+        return;
+    }
+
+    if (node == NULL)
+    {
+        node = calloc(1, sizeof(*node));
+        if (node == NULL) return;
+
+        node->an_addr = addr;
+        ds_tree_insert(&lnx_rtnl_addr_cache, node, &node->an_addr);
+    }
+
+    node->an_addr = addr;
+    node->an_tstamp = clock_mono_double();
+}
+
+static void lnx_rtnl_route_cache_msg(struct nlmsghdr *nh)
+{
+    struct rtattr *tb[RTA_MAX + 1];
+    struct lnx_rtnl_route_node *node;
+    struct lnx_rtnl_route route;
+    ds_tree_iter_t iter;
+    struct rtmsg *rtm;
+
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*rtm))) return;
+
+    rtm = NLMSG_DATA(nh);
+    if (rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6) return;
+
+    /* Skip route cache entries */
+    if (rtm->rtm_flags & RTM_F_CLONED) return;
+
+    lnx_rtnl_attr_parse(tb, RTA_MAX, RTM_RTA(rtm), RTM_PAYLOAD(nh));
+
+    memset(&route, 0, sizeof(route));
+    route.rr_family = rtm->rtm_family;
+    route.rr_table = lnx_rtnl_attr_u32(tb[RTA_TABLE], rtm->rtm_table);
+    route.rr_dst_len = rtm->rtm_dst_len;
+    route.rr_tos = rtm->rtm_tos;
+    route.rr_scope = rtm->rtm_scope;
+    route.rr_type = rtm->rtm_type;
+    route.rr_protocol = rtm->rtm_protocol;
+    route.rr_ifindex = lnx_rtnl_attr_u32(tb[RTA_OIF], 0);
+    route.rr_priority = lnx_rtnl_attr_u32(tb[RTA_PRIORITY], 0);
+    lnx_rtnl_attr_inaddr(&route.rr_dst, route.rr_family, tb[RTA_DST]);
+    lnx_rtnl_attr_inaddr(&route.rr_gw, route.rr_family, tb[RTA_GATEWAY]);
+
+    if (nh->nlmsg_type == RTM_DELROUTE)
+    {
+        node = ds_tree_find(&lnx_rtnl_route_cache, &route);
+        if (node == NULL) return;
+
+        ds_tree_remove(&lnx_rtnl_route_cache, node);
+        free(node);
+        return;
+    }
+
+    /*
+     * A replaced route is not reported as deleted; drop all the routes to the
+     * same destination that the new route may have replaced.
+     */
+    if (nh->nlmsg_flags & NLM_F_REPLACE)
+    {
+        ds_tree_foreach_iter(&lnx_rtnl_route_cache, node, &iter)
+        {
+            if (node->rn_route.rr_family != route.rr_family) continue;
+            if (node->rn_route.rr_table != route.rr_table) continue;
+            if (node->rn_route.rr_dst_len != route.rr_dst_len) continue;
+            if (node->rn_route.rr_tos != route.rr_tos) continue;
+            if (node->rn_route.rr_priority != route.rr_priority) continue;
+            if (memcmp(&node->rn_route.rr_dst, &route.rr_dst, sizeof(route.rr_dst)) != 0) continue;
+
+            ds_tree_iremove(&iter);
+            free(node);
+        }
+    }
+
+    node = ds_tree_find(&lnx_rtnl_route_cache, &route);
+    if (node == NULL)
+    {
+        node = calloc(1, sizeof(*node));
+        if (node == NULL) return;
+
+        node->rn_route = route;
+        ds_tree_insert(&lnx_rtnl_route_cache, node, &node->rn_route);
+    }
+
+    node->rn_route = route;
+}
+
+/*
+ * Remove all cached entries of interface ifindex; if routes_only is true
+ * addresses are kept.
+ */
+static void lnx_rtnl_cache_ifindex_flush(int ifindex, bool routes_only)
+{
+    struct lnx_rtnl_route_node *rnode;
+    struct lnx_rtnl_addr_node *anode;
+    ds_tree_iter_t iter;
+
+    ds_tree_foreach_iter(&lnx_rtnl_route_cache, rnode, &iter)
+    {
+        if (rnode->rn_route.rr_ifindex != ifindex) continue;
+
+        ds_tree_iremove(&iter);
+        free(rnode);
+    }
+
+    if (routes_only) return;
+
+    ds_tree_foreach_iter(&lnx_rtnl_addr_cache, anode, &iter)
+    {
+        if (anode->an_addr.ra_ifindex != ifindex) continue;
+
+        ds_tree_iremove(&iter);
+        free(anode);
+    }
+}
+
+static void lnx_rtnl_link_cache_msg(struct nlmsghdr *nh)
+{
+    struct ifinfomsg *ifi;
+
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi))) return;
+
+    ifi = NLMSG_DATA(nh);
+    if (ifi->ifi_index <= 0) return;
+
+    if (nh->nlmsg_type == RTM_DELLINK)
+    {
+        lnx_rtnl_cache_ifindex_flush(ifi->ifi_index, false);
+    }
+    else if (!(ifi->ifi_flags & IFF_UP))
+    {
+        /* Routes are removed when an interface goes down, without any notification */
+        lnx_rtnl_cache_ifindex_flush(ifi->ifi_index, true);
+    }
+}
+
+static void lnx_rtnl_addr_dump_fn(void *data, struct nlmsghdr *nh)
+{
+    (void)data;
+
+    if (nh->nlmsg_type == RTM_NEWADDR) lnx_rtnl_addr_cache_msg(nh);
+}
+
+static void lnx_rtnl_route_dump_fn(void *data, struct nlmsghdr *nh)
+{
+    (void)data;
+
+    if (nh->nlmsg_type == RTM_NEWROUTE) lnx_rtnl_route_cache_msg(nh);
+}
+
+/*
+ * Refill the address cache of the given family, unless it is up to date
+ */
+static bool lnx_rtnl_addr_cache_sync(int family)
+{
+    struct lnx_rtnl_addr_node *node;
+    ds_tree_iter_t iter;
+    bool intr = false;
+    int retry;
+
+    if (lnx_rtnl_addr_valid[LNX_RTNL_FAMILY_IDX(family)]) return true;
+
+    for (retry = 0; retry < LNX_RTNL_DUMP_RETRY; retry++)
+    {
+        ds_tree_foreach_iter(&lnx_rtnl_addr_cache, node, &iter)
+        {
+            if (node->an_addr.ra_family != family) continue;
+
+            ds_tree_iremove(&iter);
+            free(node);
+        }
+
+        if (!lnx_rtnl_dump(RTM_GETADDR, family, lnx_rtnl_addr_dump_fn, NULL, &intr)) return false;
+        if (!intr) break;
+    }
+
+    if (intr)
+    {
+        LOG(WARN, "rtnl: Address dump was interrupted %d times, results may be inconsistent.", retry);
+    }
+
+    /* Without events, the cache is stale as soon as it is filled */
+    lnx_rtnl_addr_valid[LNX_RTNL_FAMILY_IDX(family)] = lnx_rtnl_tracked && !intr;
+
+    return true;
+}
+
+static bool lnx_rtnl_route_cache_sync(int family)
+{
+    struct lnx_rtnl_route_node *node;
+    ds_tree_iter_t iter;
+    bool intr = false;
+    int retry;
+
+    if (lnx_rtnl_route_valid[LNX_RTNL_FAMILY_IDX(family)]) return true;
+
+    for (retry = 0; retry < LNX_RTNL_DUMP_RETRY; retry++)
+    {
+        ds_tree_foreach_iter(&lnx_rtnl_route_cache, node, &iter)
+        {
+            if (node->rn_route.rr_family != family) continue;
+
+            ds_tree_iremove(&iter);
+            free(node);
+        }
+
+        if (!lnx_rtnl_dump(RTM_GETROUTE, family, lnx_rtnl_route_dump_fn, NULL, &intr)) return false;
+        if (!intr) break;
+    }
+
+    if (intr)
+    {
+        LOG(WARN, "rtnl: Route dump was interrupted %d times, results may be inconsistent.", retry);
+    }
+
+    lnx_rtnl_route_valid[LNX_RTNL_FAMILY_IDX(family)] = lnx_rtnl_tracked && !intr;
+
+    return true;
+}
+
+void lnx_rtnl_cache_track(bool track)
+{
+    lnx_rtnl_tracked = track;
+
+    memset(lnx_rtnl_addr_valid, 0, sizeof(lnx_rtnl_addr_valid));
+    memset(lnx_rtnl_route_valid, 0, sizeof(lnx_rtnl_route_valid));
+}
+
+void lnx_rtnl_cache_update(struct nlmsghdr *nh)
+{
+    struct ifaddrmsg *ifa;
+    struct rtmsg *rtm;
+
+    switch (nh->nlmsg_type)
+    {
+        case RTM_NEWADDR:
+        case RTM_DELADDR:
+            if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa))) return;
+            ifa = NLMSG_DATA(nh);
+            if (!lnx_rtnl_addr_valid[LNX_RTNL_FAMILY_IDX(ifa->ifa_family)]) return;
+
+            lnx_rtnl_addr_cache_msg(nh);
+            break;
+
+        case RTM_NEWROUTE:
+        case RTM_DELROUTE:
+            if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*rtm))) return;
+            rtm = NLMSG_DATA(nh);
+            if (!lnx_rtnl_route_valid[LNX_RTNL_FAMILY_IDX(rtm->rtm_family)]) return;
+
+            lnx_rtnl_route_cache_msg(nh);
+            break;
+
+        case RTM_NEWLINK:
+        case RTM_DELLINK:
+            lnx_rtnl_link_cache_msg(nh);
+            break;
+    }
+}
+
+/*
+ * ===========================================================================
+ *  Queries
+ * ===========================================================================
+ */
+bool lnx_rtnl_addr_foreach(int family, int ifindex, lnx_rtnl_addr_fn_t *fn, void *data)
+{
+    struct lnx_rtnl_addr_node *node;
+    struct lnx_rtnl_addr addr;
+    uint32_t elapsed;
+    double now;
+
+    if (family != AF_INET && family != AF_INET6) return false;
+
+    if (!lnx_rtnl_addr_cache_sync(family)) return false;
+
+    now = clock_mono_double();
+
+    ds_tree_foreach(&lnx_rtnl_addr_cache, node)
+    {
+        if (node->an_addr.ra_family != family) continue;
+        if (node->an_addr.ra_ifindex != ifindex) continue;
+
+        /* Lifetimes count down from the time they were reported */
+        addr = node->an_addr;
+        elapsed = (uint32_t)(now - node->an_tstamp);
+
+        if (addr.ra_valid_lft != LNX_RTNL_LFT_INFINITE)
+        {
+            addr.ra_valid_lft = addr.ra_valid_lft > elapsed ? addr.ra_valid_lft - elapsed : 0;
+        }
+
+        if (addr.ra_pref_lft != LNX_RTNL_LFT_INFINITE)
+        {
+            addr.ra_pref_lft = addr.ra_pref_lft > elapsed ? addr.ra_pref_lft - elapsed : 0;
+        }
+
+        if (!fn(data, &addr)) break;
+    }
+
+    return true;
+}
+
+bool lnx_rtnl_route_foreach(int family, int ifindex, lnx_rtnl_route_fn_t *fn, void *data)
+{
+    struct lnx_rtnl_route_node *node;
+
+    if (family != AF_INET && family != AF_INET6) return false;
+
+    if (!lnx_rtnl_route_cache_sync(family)) return false;
+
+    ds_tree_foreach(&lnx_rtnl_route_cache, node)
+    {
+        if (node->rn_route.rr_family != family) continue;
+        if (ifindex != 0 && node->rn_route.rr_ifindex != ifindex) continue;
+
+        if (!fn(data, &node->rn_route)) break;
+    }
+
+    return true;
+}
+
+struct lnx_rtnl_neigh_dump
+{
+    int                     nd_ifindex;
+    lnx_rtnl_neigh_fn_t    *nd_fn;
+    void                   *nd_data;
+    bool                    nd_stop;
+};
+
+static void lnx_rtnl_neigh_dump_fn(void *data, struct nlmsghdr *nh)
+{
+    struct lnx_rtnl_neigh_dump *nd = data;
+    struct rtattr *tb[NDA_MAX + 1];
+    struct lnx_rtnl_neigh neigh;
+    struct ndmsg *ndm;
+
+    if (nd->nd_stop) return;
+    if (nh->nlmsg_type != RTM_NEWNEIGH) return;
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ndm))) return;
+
+    ndm = NLMSG_DATA(nh);
+    if (ndm->ndm_ifindex != nd->nd_ifindex) return;
+
+    lnx_rtnl_attr_parse(tb, NDA_MAX, (struct rtattr *)((uint8_t *)ndm + NLMSG_ALIGN(sizeof(*ndm))),
+            nh->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm)));
+
+    memset(&neigh, 0, sizeof(neigh));
+    neigh.rn_family = ndm->ndm_family;
+    neigh.rn_ifindex = ndm->ndm_ifindex;
+    neigh.rn_state = ndm->ndm_state;
+
+    if (!lnx_rtnl_attr_inaddr(&neigh.rn_addr, neigh.rn_family, tb[NDA_DST])) return;
+
+    /* Incomplete entries have no hardware address */
+    if (tb[NDA_LLADDR] == NULL || RTA_PAYLOAD(tb[NDA_LLADDR]) != sizeof(neigh.rn_lladdr)) return;
+    memcpy(neigh.rn_lladdr, RTA_DATA(tb[NDA_LLADDR]), sizeof(neigh.rn_lladdr));
+
+    if (!nd->nd_fn(nd->nd_data, &neigh)) nd->nd_stop = true;
+}
+
+bool lnx_rtnl_neigh_foreach(int family, int ifindex, lnx_rtnl_neigh_fn_t *fn, void *data)
+{
+    struct lnx_rtnl_neigh_dump nd;
+    bool intr;
+
+    nd.nd_ifindex = ifindex;
+    nd.nd_fn = fn;
+    nd.nd_data = data;
+    nd.nd_stop = false;
+
+    return lnx_rtnl_dump(RTM_GETNEIGH, family, lnx_rtnl_neigh_dump_fn, &nd, &intr);
+}
@@ -0,0 +1,216 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LNX_RTNL_H_INCLUDED
+#define LNX_RTNL_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+
+/*
+ * ===========================================================================
+ *  RTNETLINK configuration and state access.
+ *
+ *  Requests are queued to a batch and sent over a single shared NETLINK_ROUTE
+ *  socket when the batch is committed. Addresses and routes are read from a
+ *  cache which is filled by a dump and then kept up to date by the events
+ *  received by lnx_netlink.
+ *
+ *  This is an private module and is not part of the OpenSync Networking API.
+ * ===========================================================================
+ */
+
+/* Maximum number of requests sent to the kernel before reading the ACKs */
+#define LNX_RTNL_BATCH_CHUNK    64
+
+/* Lifetime value that means "forever" */
+#define LNX_RTNL_LFT_INFINITE   UINT32_MAX
+
+union lnx_rtnl_inaddr
+{
+    struct in_addr      in;
+    struct in6_addr     in6;
+};
+
+/*
+ * Cached interface address
+ */
+struct lnx_rtnl_addr
+{
+    int                     ra_family;      /* AF_INET or AF_INET6 */
+    int                     ra_ifindex;     /* Interface index */
+    int                     ra_prefix;      /* Prefix length */
+    union lnx_rtnl_inaddr   ra_addr;        /* Local address */
+    int                     ra_scope;       /* Address scope (RT_SCOPE_*) */
+    uint32_t                ra_valid_lft;   /* Valid lifetime in seconds */
+    uint32_t                ra_pref_lft;    /* Preferred lifetime in seconds */
+};
+
+/*
+ * Cached route
+ */
+struct lnx_rtnl_route
+{
+    int                     rr_family;      /* AF_INET or AF_INET6 */
+    int                     rr_table;       /* Routing table */
+    int                     rr_ifindex;     /* Output interface index */
+    int                     rr_dst_len;     /* Destination prefix length */
+    union lnx_rtnl_inaddr   rr_dst;         /* Destination */
+    union lnx_rtnl_inaddr   rr_gw;          /* Gateway, all zeroes if none */
+    uint32_t                rr_priority;    /* Route metric */
+    int                     rr_tos;         /* TOS */
+    int                     rr_scope;       /* Route scope (RT_SCOPE_*) */
+    int                     rr_type;        /* Route type (RTN_*) */
+    int                     rr_protocol;    /* Route origin (RTPROT_*) */
+};
+
+/*
+ * Neighbor report entry
+ */
+struct lnx_rtnl_neigh
+{
+    int                     rn_family;      /* AF_INET or AF_INET6 */
+    int                     rn_ifindex;     /* Interface index */
+    union lnx_rtnl_inaddr   rn_addr;        /* Neighbor address */
+    uint8_t                 rn_lladdr[6];   /* Hardware address */
+    int                     rn_state;       /* Neighbor state (NUD_*) */
+};
+
+typedef bool lnx_rtnl_addr_fn_t(void *data, const struct lnx_rtnl_addr *addr);
+typedef bool lnx_rtnl_route_fn_t(void *data, const struct lnx_rtnl_route *route);
+typedef bool lnx_rtnl_neigh_fn_t(void *data, const struct lnx_rtnl_neigh *neigh);
+
+/*
+ * Batch of requests. Each request is identified by the index returned when
+ * it is queued, the result of the request can be retrieved by this index
+ * after the batch is committed.
+ */
+typedef struct lnx_rtnl_batch lnx_rtnl_batch_t;
+
+struct lnx_rtnl_batch
+{
+    uint8_t    *rb_buf;                     /* Queued netlink messages */
+    size_t      rb_len;                     /* Length of queued messages */
+    size_t      rb_size;                    /* Size of rb_buf */
+    int         rb_count;                   /* Number of queued requests */
+    int        *rb_err;                     /* Request results (errno), valid after commit */
+};
+
+void lnx_rtnl_batch_init(lnx_rtnl_batch_t *self);
+void lnx_rtnl_batch_fini(lnx_rtnl_batch_t *self);
+
+/**
+ * Queue an address request. cmd is either RTM_NEWADDR or RTM_DELADDR. For
+ * IPv4 addresses the broadcast address is derived from the prefix, same as
+ * "ip address add ... broadcast +".
+ *
+ * Returns the request index or -1 on error.
+ */
+int lnx_rtnl_batch_addr(
+        lnx_rtnl_batch_t *self,
+        int cmd,
+        int ifindex,
+        int family,
+        const void *addr,
+        int prefix);
+
+/**
+ * Queue a main table route request. cmd is either RTM_NEWROUTE or RTM_DELROUTE.
+ * gw may be NULL for device routes.
+ *
+ * Returns the request index or -1 on error.
+ */
+int lnx_rtnl_batch_route(
+        lnx_rtnl_batch_t *self,
+        int cmd,
+        int ifindex,
+        int family,
+        const void *dst,
+        int dst_len,
+        const void *gw);
+
+/**
+ * Queue the deletion of a cached route
+ */
+int lnx_rtnl_batch_route_del(lnx_rtnl_batch_t *self, const struct lnx_rtnl_route *route);
+
+/**
+ * Queue the creation of a VLAN interface
+ */
+int lnx_rtnl_batch_vlan_add(lnx_rtnl_batch_t *self, const char *ifname, int parent_ifindex, int vid);
+
+/**
+ * Queue the deletion of an interface. A missing interface is not an error.
+ */
+int lnx_rtnl_batch_link_del(lnx_rtnl_batch_t *self, const char *ifname);
+
+/**
+ * Send all queued requests and wait for their acknowledgements. The batch is
+ * emptied, results remain available through lnx_rtnl_batch_error() until the
+ * next request is queued.
+ *
+ * Returns the number of failed requests or -1 if the requests couldn't be sent.
+ */
+int lnx_rtnl_batch_commit(lnx_rtnl_batch_t *self);
+
+/**
+ * Return the result of request idx of the last commit: 0 on success or an
+ * errno value
+ */
+int lnx_rtnl_batch_error(lnx_rtnl_batch_t *self, int idx);
+
+/**
+ * Walk the addresses of interface ifindex of the given family. Lifetimes are
+ * the remaining lifetimes at the time of the call.
+ */
+bool lnx_rtnl_addr_foreach(int family, int ifindex, lnx_rtnl_addr_fn_t *fn, void *data);
+
+/**
+ * Walk the routes of the given family. If ifindex is not 0, only routes using
+ * this output interface are listed.
+ */
+bool lnx_rtnl_route_foreach(int family, int ifindex, lnx_rtnl_route_fn_t *fn, void *data);
+
+/**
+ * Walk the neighbor table entries of interface ifindex. Neighbors are not
+ * cached, each call issues a dump.
+ */
+bool lnx_rtnl_neigh_foreach(int family, int ifindex, lnx_rtnl_neigh_fn_t *fn, void *data);
+
+/**
+ * Cache maintenance, used by lnx_netlink.
+ *
+ * lnx_rtnl_cache_track() tells whether the caller receives address, route
+ * and link events; the cache is invalidated each time this changes. Received
+ * events are passed to lnx_rtnl_cache_update().
+ */
+void lnx_rtnl_cache_track(bool track);
+void lnx_rtnl_cache_update(struct nlmsghdr *nh);
+
+#endif /* LNX_RTNL_H_INCLUDED */
@@ -24,38 +24,16 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <errno.h>
+#include <net/if.h>
+
 #include "ds.h"
-#include "execsh.h"
 #include "log.h"
 #include "util.h"
 
+#include "lnx_rtnl.h"
 #include "lnx_vlan.h"
 
-/*
- * Script for creating a VLAN interface.
- *
- * Input parameters:
- *
- * $1 - Interface name
- * $2 - Parent interface name
- * $3 - VLANID
- */
-const char lnx_vlan_create[] = _S(
-    ip link add link "$2" name "$1" type vlan id "$3");
-
-/*
- * Script for deleting a VLAN interface
- *
- * Input parameters:
- *
- * $1 - Interface name
- */
-const char lnx_vlan_delete[] = _S(
-    if [ -e "/sys/class/net/$1" ];
-    then
-        ip link del "$1";
-    fi;);
-
 bool lnx_vlan_init(lnx_vlan_t *self, const char *ifname)
 {
     memset(self, 0, sizeof(*self));
@@ -71,24 +49,30 @@ bool lnx_vlan_init(lnx_vlan_t *self, const char *ifname)
 
 bool lnx_vlan_fini(lnx_vlan_t *self)
 {
-    int rc;
+    lnx_rtnl_batch_t batch;
 
     if (!self->lv_applied) return true;
 
     /* Silently delete old interfaces, if there are any */
-    rc = execsh_log(LOG_SEVERITY_DEBUG, lnx_vlan_delete, self->lv_ifname);
-    if (rc != 0)
+    lnx_rtnl_batch_init(&batch);
+    lnx_rtnl_batch_link_del(&batch, self->lv_ifname);
+
+    if (lnx_rtnl_batch_commit(&batch) != 0)
     {
         LOG(WARN, "vlan: %s: Error deleting interface.", self->lv_ifname);
     }
 
+    lnx_rtnl_batch_fini(&batch);
+
     return true;
 }
 
 bool lnx_vlan_apply(lnx_vlan_t *self)
 {
-    char svlanid[C_INT32_LEN];
-    int rc;
+    lnx_rtnl_batch_t batch;
+    int pifindex;
+    int req;
+    int err;
 
     if (self->lv_vlanid < 1 || self->lv_vlanid > 4095)
     {
@@ -106,21 +90,28 @@ bool lnx_vlan_apply(lnx_vlan_t *self)
 
     self->lv_applied = true;
 
-    snprintf(svlanid, sizeof(svlanid), "%d", self->lv_vlanid);
+    pifindex = if_nametoindex(self->lv_pifname);
+    if (pifindex == 0)
+    {
+        LOG(ERR, "vlan: %s: Error creating VLAN interface, parent %s does not exist.",
+                self->lv_ifname, self->lv_pifname);
+        return false;
+    }
 
-    /* Silently delete old interfaces, if there are any */
-    execsh_log(LOG_SEVERITY_DEBUG, lnx_vlan_delete, self->lv_ifname);
-
-    rc = execsh_log(
-            LOG_SEVERITY_DEBUG,
-            lnx_vlan_create,
-            self->lv_ifname,
-            self->lv_pifname,
-            svlanid);
-    if (rc != 0)
+    /* Silently delete old interfaces, if there are any, and create the new one in a single batch */
+    lnx_rtnl_batch_init(&batch);
+    lnx_rtnl_batch_link_del(&batch, self->lv_ifname);
+    req = lnx_rtnl_batch_vlan_add(&batch, self->lv_ifname, pifindex, self->lv_vlanid);
+
+    lnx_rtnl_batch_commit(&batch);
+    err = req < 0 ? EINVAL : lnx_rtnl_batch_error(&batch, req);
+
+    lnx_rtnl_batch_fini(&batch);
+
+    if (err != 0)
     {
-        LOG(ERR, "vlan: %s: Error creating VLAN interface (parent %s, vlanid %d).",
-                self->lv_ifname, self->lv_pifname, self->lv_vlanid);
+        LOG(ERR, "vlan: %s: Error creating VLAN interface (parent %s, vlanid %d): %s",
+                self->lv_ifname, self->lv_pifname, self->lv_vlanid, strerror(err));
         return false;
     }
 
@@ -33,6 +33,7 @@
 #include "osn_fw_pri.h"
 #include "os.h"
 #include "util.h"
+#include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
@@ -43,6 +44,7 @@
 #define MODULE_ID LOG_MODULE_ID_TARGET
 
 static struct osfw_nfbase osfw_nfbase;
+static struct osfw_ipsetbase osfw_ipsetbase;
 
 static const char *osfw_convert_family(int family)
 {
@@ -939,10 +941,162 @@ static struct osfw_nfinet *osfw_nfbase_get_inet(struct osfw_nfbase *self, int fa
 	return nfinet;
 }
 
+static bool osfw_is_valid_ipset(const char *name)
+{
+	const char *c = NULL;
+
+	if (!name || !name[0] || strlen(name) >= OSFW_SIZE_IPSET) {
+		return false;
+	}
+
+	for (c = name; *c; c++) {
+		if (!isalnum((unsigned char) *c) && *c != '_' && *c != '-') {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool osfw_ipsetcmd_add(struct ds_dlist *parent, const char *name, const char *line)
+{
+	struct osfw_ipsetcmd *self = NULL;
+
+	self = calloc(1, sizeof(*self));
+	if (!self) {
+		LOGE("Add OSFW ipset command: memory allocation failed");
+		return false;
+	}
+
+	STRSCPY(self->name, name);
+	STRSCPY(self->line, line);
+	ds_dlist_insert_tail(parent, self);
+	return true;
+}
+
+/* Drop the pending commands of a set, or all of them if name is NULL */
+static void osfw_ipsetcmd_flush(struct ds_dlist *parent, const char *name)
+{
+	struct osfw_ipsetcmd *self = NULL;
+	ds_dlist_iter_t iter;
+
+	for (self = ds_dlist_ifirst(&iter, parent); self; self = ds_dlist_inext(&iter)) {
+		if (name && strncmp(self->name, name, sizeof(self->name))) {
+			continue;
+		}
+		ds_dlist_iremove(&iter);
+		free(self);
+	}
+}
+
+static bool osfw_ipsetbase_set(struct osfw_ipsetbase *self)
+{
+	memset(self, 0, sizeof(*self));
+	ds_dlist_init(&self->members, struct osfw_ipsetcmd, elt);
+	ds_dlist_init(&self->destroys, struct osfw_ipsetcmd, elt);
+	return true;
+}
+
+static bool osfw_ipsetbase_unset(struct osfw_ipsetbase *self)
+{
+	osfw_ipsetcmd_flush(&self->members, NULL);
+	osfw_ipsetcmd_flush(&self->destroys, NULL);
+	return true;
+}
+
+/* Run "ipset restore" on the commands, or on the single one if not NULL */
+static int osfw_ipsetbase_restore(const char *path, struct ds_dlist *cmds, struct osfw_ipsetcmd *single)
+{
+	char cmd[OSFW_SIZE_CMD];
+	struct osfw_ipsetcmd *ipsetcmd = NULL;
+	FILE *stream = NULL;
+
+	stream = fopen(path, "w+");
+	if (!stream) {
+		LOGE("Open %s failed: %d - %s", path, errno, strerror(errno));
+		return -1;
+	}
+	if (single) {
+		fprintf(stream, "%s\n", single->line);
+	} else {
+		ds_dlist_foreach(cmds, ipsetcmd) {
+			fprintf(stream, "%s\n", ipsetcmd->line);
+		}
+	}
+	fclose(stream);
+
+	snprintf(cmd, sizeof(cmd) - 1, "cat %s | %s -exist restore", path, OSFW_STR_CMD_IPSET);
+	cmd[sizeof(cmd) - 1] = '\0';
+	return cmd_log(cmd);
+}
+
+/*
+ * Push a batch of set commands through a single "ipset restore" process
+ * instead of forking one "ipset add" per member. The restore stops at the
+ * first command the kernel rejects, e.g. a /0 network in a hash:net set, so
+ * a failed batch is replayed one command at a time and only the rejected
+ * ones are lost.
+ */
+static bool osfw_ipsetbase_run(struct ds_dlist *cmds)
+{
+	bool errcode = true;
+	int err = 0;
+	char path[OSFW_SIZE_CMD];
+	char cmd[OSFW_SIZE_CMD];
+	struct osfw_ipsetcmd *ipsetcmd = NULL;
+
+	if (ds_dlist_is_empty(cmds)) {
+		return true;
+	}
+
+	snprintf(path, sizeof(path) - 1, "/tmp/osfw-ipset.%d", (int) getpid());
+	path[sizeof(path) - 1] = '\0';
+	err = osfw_ipsetbase_restore(path, cmds, NULL);
+	if (err) {
+		LOGW("Apply OSFW ipset configuration failed, retrying one command at a time");
+		snprintf(cmd, sizeof(cmd) - 1, "cp %s %s.error", path, path);
+		cmd[sizeof(cmd) - 1] = '\0';
+		cmd_log(cmd);
+
+		ds_dlist_foreach(cmds, ipsetcmd) {
+			err = osfw_ipsetbase_restore(path, cmds, ipsetcmd);
+			if (err) {
+				LOGE("Apply OSFW ipset command failed: %s", ipsetcmd->line);
+				errcode = false;
+			}
+		}
+	}
+
+	unlink(path);
+	osfw_ipsetcmd_flush(cmds, NULL);
+	return errcode;
+}
+
+static const char *osfw_convert_ipset_type(int family, enum osfw_ipset_type type)
+{
+	const char *str = OSFW_STR_UNKNOWN;
+
+	switch (type) {
+	case OSFW_IPSET_HASH_NET:
+		str = (family == AF_INET6) ? "hash:net family inet6" : "hash:net family inet";
+		break;
+
+	case OSFW_IPSET_HASH_MAC:
+		str = "hash:mac";
+		break;
+
+	default:
+		LOGE("Convert firewall ipset type: Invalid type: %d", type);
+		break;
+	}
+
+	return str;
+}
+
 bool osfw_init(void)
 {
 	bool errcode = true;
 
+	osfw_ipsetbase_set(&osfw_ipsetbase);
 	errcode = osfw_nfbase_set(&osfw_nfbase);
 	if (!errcode) {
 		LOGE("Initialize OSFW: set base failed");
@@ -968,6 +1122,7 @@ bool osfw_fini(void)
 	}
 
 	errcode = osfw_apply();
+	osfw_ipsetbase_unset(&osfw_ipsetbase);
 	if (!errcode) {
 		LOGE("Finalize OSFW: apply failed");
 		return false;
@@ -1085,15 +1240,101 @@ bool osfw_rule_del(int family, enum osfw_table table, const char *chain,
 	return true;
 }
 
+bool osfw_ipset_add(int family, const char *name, enum osfw_ipset_type type)
+{
+	int err = 0;
+	char cmd[OSFW_SIZE_CMD];
+
+	if (!osfw_is_valid_ipset(name)) {
+		LOGE("Add OSFW ipset: %s is not a valid set name", name ? name : "(null)");
+		return false;
+	}
+
+	/* A set added back before being destroyed is reused */
+	osfw_ipsetcmd_flush(&osfw_ipsetbase.destroys, name);
+	osfw_ipsetcmd_flush(&osfw_ipsetbase.members, name);
+
+	snprintf(cmd, sizeof(cmd) - 1, "%s -exist create %s %s && %s flush %s",
+			OSFW_STR_CMD_IPSET, name, osfw_convert_ipset_type(family, type),
+			OSFW_STR_CMD_IPSET, name);
+	cmd[sizeof(cmd) - 1] = '\0';
+	err = cmd_log(cmd);
+	if (err) {
+		LOGE("Add OSFW ipset: create %s failed", name);
+		return false;
+	}
+	return true;
+}
+
+bool osfw_ipset_del(const char *name)
+{
+	char line[OSFW_SIZE_MATCH];
+
+	if (!osfw_is_valid_ipset(name)) {
+		LOGE("Delete OSFW ipset: %s is not a valid set name", name ? name : "(null)");
+		return false;
+	}
+
+	osfw_ipsetcmd_flush(&osfw_ipsetbase.members, name);
+	snprintf(line, sizeof(line), "destroy %s", name);
+	return osfw_ipsetcmd_add(&osfw_ipsetbase.destroys, name, line);
+}
+
+static bool osfw_ipset_member(const char *op, const char *name, const char *value)
+{
+	char line[OSFW_SIZE_MATCH];
+	int len = 0;
+
+	if (!osfw_is_valid_ipset(name) || !value || !value[0] || strpbrk(value, " \t\n")) {
+		LOGE("OSFW ipset %s: invalid parameters", op);
+		return false;
+	}
+
+	len = snprintf(line, sizeof(line), "%s %s %s", op, name, value);
+	if (len < 0 || (size_t) len >= sizeof(line)) {
+		LOGE("OSFW ipset %s: %s member too long", op, name);
+		return false;
+	}
+	return osfw_ipsetcmd_add(&osfw_ipsetbase.members, name, line);
+}
+
+bool osfw_ipset_member_add(const char *name, const char *value)
+{
+	return osfw_ipset_member("add", name, value);
+}
+
+bool osfw_ipset_member_del(const char *name, const char *value)
+{
+	return osfw_ipset_member("del", name, value);
+}
+
 bool osfw_apply(void)
 {
+	bool members = true;
 	bool errcode = true;
 
+	/*
+	 * Members first, so that new rules never match a partially filled set.
+	 * The rules are still applied when some members were rejected, only
+	 * those are missing from the sets.
+	 */
+	members = osfw_ipsetbase_run(&osfw_ipsetbase.members);
+	if (!members) {
+		LOGE("Apply OSFW ipset members failed");
+	}
+
 	errcode = osfw_nfbase_apply(&osfw_nfbase);
 	if (!errcode) {
 		LOGE("Apply OSFW configuration failed");
 		return false;
 	}
-	return true;
+
+	/* Sets can only be destroyed once no rule refers to them anymore */
+	errcode = osfw_ipsetbase_run(&osfw_ipsetbase.destroys);
+	if (!errcode) {
+		LOGE("Apply OSFW ipset destroys failed");
+		return false;
+	}
+	return members;
 }
 
@@ -0,0 +1,703 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * The RTNETLINK socket is replaced by the scripted kernel below
+ */
+#define socket              test_socket
+#define setsockopt          test_setsockopt
+#define bind                test_bind
+#define send                test_send
+#define recv                test_recv
+#define close               test_close
+
+int test_socket(int domain, int type, int protocol);
+int test_setsockopt(int fd, int level, int name, const void *val, socklen_t len);
+int test_bind(int fd, const struct sockaddr *addr, socklen_t len);
+ssize_t test_send(int fd, const void *buf, size_t len, int flags);
+ssize_t test_recv(int fd, void *buf, size_t len, int flags);
+int test_close(int fd);
+
+#include "lnx_rtnl.c"
+
+#include "log.h"
+#include "target.h"
+#include "unity.h"
+
+const char *test_name = "lnx_rtnl_tests";
+
+#define TEST_NL_FD          100
+#define TEST_NL_DGRAM_MAX   8
+#define TEST_NL_DGRAM_SZ    (16 * 1024)
+#define TEST_NL_REQ_MAX     128
+#define TEST_NL_WALK_MAX    8
+
+typedef void test_nl_dump_fn_t(int type);
+
+/**
+ * @brief kernel side of the RTNETLINK socket
+ */
+static struct
+{
+    int nsocket;                                // Sockets opened
+    int nsend;                                  // Datagrams sent by the module
+    int ndump;                                  // Dump requests received
+    int nreq;                                   // Batch requests received
+    int intr;                                   // Number of dumps to mark as interrupted
+    bool drop;                                  // Don't reply
+    int err[TEST_NL_REQ_MAX];                   // errno returned to each batch request
+    test_nl_dump_fn_t *dump_fn;                 // Fills the dump replies
+
+    struct
+    {
+        uint8_t buf[TEST_NL_DGRAM_SZ];
+        size_t len;
+    } dgram[TEST_NL_DGRAM_MAX];                 // Replies not read yet
+    int ndgram;
+} g_nl;
+
+/**
+ * @brief entries returned by a cache walk, as strings
+ */
+static struct
+{
+    int count;
+    char entry[TEST_NL_WALK_MAX][128];
+} g_walk;
+
+
+int
+test_socket(int domain, int type, int protocol)
+{
+    TEST_ASSERT_EQUAL_INT(AF_NETLINK, domain);
+    TEST_ASSERT_EQUAL_INT(NETLINK_ROUTE, protocol);
+    g_nl.nsocket++;
+    return TEST_NL_FD;
+}
+
+int
+test_setsockopt(int fd, int level, int name, const void *val, socklen_t len)
+{
+    return 0;
+}
+
+int
+test_bind(int fd, const struct sockaddr *addr, socklen_t len)
+{
+    return 0;
+}
+
+int
+test_close(int fd)
+{
+    TEST_ASSERT_EQUAL_INT(TEST_NL_FD, fd);
+    return 0;
+}
+
+/**
+ * @brief appends a message to the last reply datagram
+ */
+static void
+test_nl_reply_add(struct nlmsghdr *nh)
+{
+    size_t len = NLMSG_ALIGN(nh->nlmsg_len);
+    size_t *dlen;
+
+    TEST_ASSERT_TRUE(g_nl.ndgram > 0);
+    dlen = &g_nl.dgram[g_nl.ndgram - 1].len;
+    TEST_ASSERT_TRUE(*dlen + len <= TEST_NL_DGRAM_SZ);
+    memcpy(g_nl.dgram[g_nl.ndgram - 1].buf + *dlen, nh, len);
+    *dlen += len;
+}
+
+/**
+ * @brief replies to a dump request: the messages added by the dump callback,
+ * then NLMSG_DONE
+ */
+static void
+test_nl_dump(struct nlmsghdr *req)
+{
+    struct nlmsghdr done;
+    struct nlmsghdr *nh;
+    uint8_t *buf;
+    size_t off;
+    size_t len;
+    int flags;
+
+    g_nl.ndump++;
+    if (g_nl.dump_fn != NULL) g_nl.dump_fn(req->nlmsg_type);
+
+    flags = NLM_F_MULTI;
+    if (g_nl.intr > 0)
+    {
+        flags |= NLM_F_DUMP_INTR;
+        g_nl.intr--;
+    }
+
+    memset(&done, 0, sizeof(done));
+    done.nlmsg_len = NLMSG_LENGTH(0);
+    done.nlmsg_type = NLMSG_DONE;
+    test_nl_reply_add(&done);
+
+    buf = g_nl.dgram[g_nl.ndgram - 1].buf;
+    len = g_nl.dgram[g_nl.ndgram - 1].len;
+    for (off = 0; off < len; off += NLMSG_ALIGN(nh->nlmsg_len))
+    {
+        nh = (struct nlmsghdr *)(buf + off);
+        nh->nlmsg_seq = req->nlmsg_seq;
+        nh->nlmsg_flags |= flags;
+    }
+}
+
+/**
+ * @brief acknowledges a batch request with its scripted errno
+ */
+static void
+test_nl_ack(struct nlmsghdr *req)
+{
+    union
+    {
+        struct nlmsghdr nh;
+        uint8_t buf[NLMSG_SPACE(sizeof(struct nlmsgerr))];
+    } ack;
+    struct nlmsgerr *err;
+
+    TEST_ASSERT_TRUE(g_nl.nreq < TEST_NL_REQ_MAX);
+    TEST_ASSERT_TRUE(req->nlmsg_flags & NLM_F_ACK);
+
+    memset(&ack, 0, sizeof(ack));
+    ack.nh.nlmsg_len = NLMSG_LENGTH(sizeof(*err));
+    ack.nh.nlmsg_type = NLMSG_ERROR;
+    ack.nh.nlmsg_seq = req->nlmsg_seq;
+    err = NLMSG_DATA(&ack.nh);
+    err->error = -g_nl.err[g_nl.nreq++];
+    err->msg = *req;
+
+    test_nl_reply_add(&ack.nh);
+}
+
+ssize_t
+test_send(int fd, const void *buf, size_t len, int flags)
+{
+    struct nlmsghdr *nh;
+    size_t nl_len;
+
+    TEST_ASSERT_EQUAL_INT(TEST_NL_FD, fd);
+    g_nl.nsend++;
+    if (g_nl.drop) return len;
+
+    TEST_ASSERT_TRUE(g_nl.ndgram < TEST_NL_DGRAM_MAX);
+    g_nl.dgram[g_nl.ndgram++].len = 0;
+
+    for (nh = (struct nlmsghdr *)buf, nl_len = len; NLMSG_OK(nh, nl_len); nh = NLMSG_NEXT(nh, nl_len))
+    {
+        /* NLM_F_DUMP bits are shared with NLM_F_EXCL, tell dumps by type */
+        if (nh->nlmsg_type == RTM_GETADDR || nh->nlmsg_type == RTM_GETROUTE)
+        {
+            test_nl_dump(nh);
+        }
+        else
+        {
+            test_nl_ack(nh);
+        }
+    }
+
+    return len;
+}
+
+ssize_t
+test_recv(int fd, void *buf, size_t len, int flags)
+{
+    size_t dlen;
+
+    TEST_ASSERT_EQUAL_INT(TEST_NL_FD, fd);
+
+    /* Nothing queued, the receive times out */
+    if (g_nl.ndgram == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    dlen = g_nl.dgram[0].len;
+    if (flags & MSG_PEEK) return dlen;
+
+    TEST_ASSERT_TRUE(len >= dlen);
+    memcpy(buf, g_nl.dgram[0].buf, dlen);
+    memmove(&g_nl.dgram[0], &g_nl.dgram[1], (g_nl.ndgram - 1) * sizeof(g_nl.dgram[0]));
+    g_nl.ndgram--;
+
+    return dlen;
+}
+
+
+/**
+ * @brief crafts an IPv4 route message
+ *
+ * @param gw gateway or NULL for a device route
+ */
+static struct nlmsghdr *
+test_nl_route(int type, int flags, const char *dst, int dst_len, int oif, const char *gw)
+{
+    static union
+    {
+        struct nlmsghdr nh;
+        uint8_t buf[LNX_RTNL_REQ_SZ];
+    } msg;
+    struct in_addr addr;
+    struct rtmsg *rtm;
+    uint32_t val;
+
+    lnx_rtnl_msg_init(&msg.nh, type, 0, sizeof(*rtm));
+    msg.nh.nlmsg_flags = flags;
+
+    rtm = NLMSG_DATA(&msg.nh);
+    rtm->rtm_family = AF_INET;
+    rtm->rtm_dst_len = dst_len;
+    rtm->rtm_table = RT_TABLE_MAIN;
+    rtm->rtm_protocol = RTPROT_BOOT;
+    rtm->rtm_scope = gw != NULL ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+    rtm->rtm_type = RTN_UNICAST;
+
+    TEST_ASSERT_EQUAL_INT(1, inet_pton(AF_INET, dst, &addr));
+    TEST_ASSERT_NOT_NULL(lnx_rtnl_attr_put(&msg.nh, RTA_DST, &addr, sizeof(addr)));
+    if (gw != NULL)
+    {
+        TEST_ASSERT_EQUAL_INT(1, inet_pton(AF_INET, gw, &addr));
+        TEST_ASSERT_NOT_NULL(lnx_rtnl_attr_put(&msg.nh, RTA_GATEWAY, &addr, sizeof(addr)));
+    }
+    val = RT_TABLE_MAIN;
+    TEST_ASSERT_NOT_NULL(lnx_rtnl_attr_put(&msg.nh, RTA_TABLE, &val, sizeof(val)));
+    val = oif;
+    TEST_ASSERT_NOT_NULL(lnx_rtnl_attr_put(&msg.nh, RTA_OIF, &val, sizeof(val)));
+
+    return &msg.nh;
+}
+
+/**
+ * @brief crafts an IPv4 address message
+ *
+ * @param valid_lft valid lifetime, 0 to leave out the cache info
+ */
+static struct nlmsghdr *
+test_nl_addr(int type, int ifindex, const char *addr, int prefix, uint32_t valid_lft)
+{
+    static union
+    {
+        struct nlmsghdr nh;
+        uint8_t buf[LNX_RTNL_REQ_SZ];
+    } msg;
+    struct ifa_cacheinfo ci;
+    struct ifaddrmsg *ifa;
+    struct in_addr in;
+
+    lnx_rtnl_msg_init(&msg.nh, type, 0, sizeof(*ifa));
+    msg.nh.nlmsg_flags = 0;
+
+    ifa = NLMSG_DATA(&msg.nh);
+    ifa->ifa_family = AF_INET;
+    ifa->ifa_prefixlen = prefix;
+    ifa->ifa_index = ifindex;
+    ifa->ifa_scope = RT_SCOPE_UNIVERSE;
+
+    TEST_ASSERT_EQUAL_INT(1, inet_pton(AF_INET, addr, &in));
+    TEST_ASSERT_NOT_NULL(lnx_rtnl_attr_put(&msg.nh, IFA_LOCAL, &in, sizeof(in)));
+    TEST_ASSERT_NOT_NULL(lnx_rtnl_attr_put(&msg.nh, IFA_ADDRESS, &in, sizeof(in)));
+    if (valid_lft != 0)
+    {
+        memset(&ci, 0, sizeof(ci));
+        ci.ifa_valid = valid_lft;
+        ci.ifa_prefered = valid_lft;
+        TEST_ASSERT_NOT_NULL(lnx_rtnl_attr_put(&msg.nh, IFA_CACHEINFO, &ci, sizeof(ci)));
+    }
+
+    return &msg.nh;
+}
+
+/**
+ * @brief crafts a link message
+ */
+static struct nlmsghdr *
+test_nl_link(int type, int ifindex, bool up)
+{
+    static union
+    {
+        struct nlmsghdr nh;
+        uint8_t buf[LNX_RTNL_REQ_SZ];
+    } msg;
+    struct ifinfomsg *ifi;
+
+    lnx_rtnl_msg_init(&msg.nh, type, 0, sizeof(*ifi));
+    msg.nh.nlmsg_flags = 0;
+
+    ifi = NLMSG_DATA(&msg.nh);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = ifindex;
+    ifi->ifi_flags = up ? IFF_UP | IFF_RUNNING : 0;
+
+    return &msg.nh;
+}
+
+
+static bool
+test_walk_route_fn(void *data, const struct lnx_rtnl_route *route)
+{
+    char dst[INET_ADDRSTRLEN];
+    char gw[INET_ADDRSTRLEN];
+    char *entry;
+
+    TEST_ASSERT_TRUE(g_walk.count < TEST_NL_WALK_MAX);
+    entry = g_walk.entry[g_walk.count++];
+
+    inet_ntop(AF_INET, &route->rr_dst.in, dst, sizeof(dst));
+    inet_ntop(AF_INET, &route->rr_gw.in, gw, sizeof(gw));
+    snprintf(entry, sizeof(g_walk.entry[0]), "%s/%d dev %d", dst, route->rr_dst_len, route->rr_ifindex);
+    if (route->rr_gw.in.s_addr != INADDR_ANY)
+    {
+        snprintf(entry + strlen(entry), sizeof(g_walk.entry[0]) - strlen(entry), " via %s", gw);
+    }
+
+    return true;
+}
+
+static bool
+test_walk_addr_fn(void *data, const struct lnx_rtnl_addr *addr)
+{
+    char str[INET_ADDRSTRLEN];
+
+    TEST_ASSERT_TRUE(g_walk.count < TEST_NL_WALK_MAX);
+
+    inet_ntop(AF_INET, &addr->ra_addr.in, str, sizeof(str));
+    snprintf(g_walk.entry[g_walk.count++], sizeof(g_walk.entry[0]), "%s/%d dev %d lft %u",
+             str, addr->ra_prefix, addr->ra_ifindex, addr->ra_valid_lft);
+
+    return true;
+}
+
+static void
+test_walk_routes(int ifindex)
+{
+    memset(&g_walk, 0, sizeof(g_walk));
+    TEST_ASSERT_TRUE(lnx_rtnl_route_foreach(AF_INET, ifindex, test_walk_route_fn, NULL));
+}
+
+static void
+test_walk_addrs(int ifindex)
+{
+    memset(&g_walk, 0, sizeof(g_walk));
+    TEST_ASSERT_TRUE(lnx_rtnl_addr_foreach(AF_INET, ifindex, test_walk_addr_fn, NULL));
+}
+
+
+/**
+ * @brief kernel tables returned by the dumps
+ */
+static void
+test_dump_tables(int type)
+{
+    if (type == RTM_GETROUTE)
+    {
+        test_nl_reply_add(test_nl_route(RTM_NEWROUTE, 0, "10.0.0.0", 24, 2, NULL));
+        test_nl_reply_add(test_nl_route(RTM_NEWROUTE, 0, "10.0.1.0", 24, 2, NULL));
+        test_nl_reply_add(test_nl_route(RTM_NEWROUTE, 0, "0.0.0.0", 0, 3, "192.168.0.1"));
+    }
+    else if (type == RTM_GETADDR)
+    {
+        test_nl_reply_add(test_nl_addr(RTM_NEWADDR, 2, "10.0.0.1", 24, 0));
+        test_nl_reply_add(test_nl_addr(RTM_NEWADDR, 2, "10.0.1.1", 24, 0));
+        test_nl_reply_add(test_nl_addr(RTM_NEWADDR, 3, "192.168.0.2", 24, 600));
+    }
+}
+
+
+void
+setUp(void)
+{
+    struct lnx_rtnl_route_node *rnode;
+    struct lnx_rtnl_addr_node *anode;
+    ds_tree_iter_t iter;
+
+    ds_tree_foreach_iter(&lnx_rtnl_route_cache, rnode, &iter)
+    {
+        ds_tree_iremove(&iter);
+        free(rnode);
+    }
+    ds_tree_foreach_iter(&lnx_rtnl_addr_cache, anode, &iter)
+    {
+        ds_tree_iremove(&iter);
+        free(anode);
+    }
+
+    lnx_rtnl_sock = -1;
+    lnx_rtnl_cache_track(false);
+    memset(&g_nl, 0, sizeof(g_nl));
+}
+
+void
+tearDown(void)
+{
+    return;
+}
+
+
+/**
+ * @brief a replaced route is not reported as deleted, the routes it replaced
+ * are dropped from the cache
+ */
+void
+test_rtnl_route_replace(void)
+{
+    lnx_rtnl_cache_track(true);
+    g_nl.dump_fn = test_dump_tables;
+
+    test_walk_routes(0);
+    TEST_ASSERT_EQUAL_INT(1, g_nl.ndump);
+    TEST_ASSERT_EQUAL_INT(3, g_walk.count);
+
+    lnx_rtnl_cache_update(test_nl_route(RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE,
+                                        "10.0.0.0", 24, 3, "192.168.0.1"));
+    test_walk_routes(0);
+    TEST_ASSERT_EQUAL_INT(3, g_walk.count);
+    TEST_ASSERT_EQUAL_STRING("0.0.0.0/0 dev 3 via 192.168.0.1", g_walk.entry[0]);
+    TEST_ASSERT_EQUAL_STRING("10.0.0.0/24 dev 3 via 192.168.0.1", g_walk.entry[1]);
+    TEST_ASSERT_EQUAL_STRING("10.0.1.0/24 dev 2", g_walk.entry[2]);
+
+    /* An appended route keeps the existing ones */
+    lnx_rtnl_cache_update(test_nl_route(RTM_NEWROUTE, NLM_F_CREATE | NLM_F_APPEND,
+                                        "10.0.1.0", 24, 3, NULL));
+    test_walk_routes(0);
+    TEST_ASSERT_EQUAL_INT(4, g_walk.count);
+    TEST_ASSERT_EQUAL_STRING("10.0.1.0/24 dev 2", g_walk.entry[2]);
+    TEST_ASSERT_EQUAL_STRING("10.0.1.0/24 dev 3", g_walk.entry[3]);
+
+    lnx_rtnl_cache_update(test_nl_route(RTM_DELROUTE, 0, "10.0.1.0", 24, 2, NULL));
+    test_walk_routes(2);
+    TEST_ASSERT_EQUAL_INT(0, g_walk.count);
+
+    /* Served from the cache */
+    TEST_ASSERT_EQUAL_INT(1, g_nl.ndump);
+}
+
+/**
+ * @brief deleted addresses are removed from the cache
+ */
+void
+test_rtnl_addr_del(void)
+{
+    lnx_rtnl_cache_track(true);
+    g_nl.dump_fn = test_dump_tables;
+
+    test_walk_addrs(2);
+    TEST_ASSERT_EQUAL_INT(2, g_walk.count);
+    TEST_ASSERT_EQUAL_STRING("10.0.0.1/24 dev 2 lft 4294967295", g_walk.entry[0]);
+    TEST_ASSERT_EQUAL_STRING("10.0.1.1/24 dev 2 lft 4294967295", g_walk.entry[1]);
+    test_walk_addrs(3);
+    TEST_ASSERT_EQUAL_INT(1, g_walk.count);
+    TEST_ASSERT_EQUAL_STRING("192.168.0.2/24 dev 3 lft 600", g_walk.entry[0]);
+
+    lnx_rtnl_cache_update(test_nl_addr(RTM_DELADDR, 2, "10.0.0.1", 24, 0));
+    test_walk_addrs(2);
+    TEST_ASSERT_EQUAL_INT(1, g_walk.count);
+    TEST_ASSERT_EQUAL_STRING("10.0.1.1/24 dev 2 lft 4294967295", g_walk.entry[0]);
+
+    /* Unknown address */
+    lnx_rtnl_cache_update(test_nl_addr(RTM_DELADDR, 2, "10.0.1.1", 16, 0));
+    test_walk_addrs(2);
+    TEST_ASSERT_EQUAL_INT(1, g_walk.count);
+
+    TEST_ASSERT_EQUAL_INT(1, g_nl.ndump);
+}
+
+/**
+ * @brief the routes of a link that goes down are dropped, its addresses are
+ * dropped when it is deleted
+ */
+void
+test_rtnl_link_down(void)
+{
+    lnx_rtnl_cache_track(true);
+    g_nl.dump_fn = test_dump_tables;
+
+    test_walk_routes(0);
+    TEST_ASSERT_EQUAL_INT(3, g_walk.count);
+    test_walk_addrs(2);
+    TEST_ASSERT_EQUAL_INT(2, g_walk.count);
+
+    /* Link up, nothing changes */
+    lnx_rtnl_cache_update(test_nl_link(RTM_NEWLINK, 2, true));
+    test_walk_routes(2);
+    TEST_ASSERT_EQUAL_INT(2, g_walk.count);
+
+    lnx_rtnl_cache_update(test_nl_link(RTM_NEWLINK, 2, false));
+    test_walk_routes(0);
+    TEST_ASSERT_EQUAL_INT(1, g_walk.count);
+    TEST_ASSERT_EQUAL_STRING("0.0.0.0/0 dev 3 via 192.168.0.1", g_walk.entry[0]);
+    test_walk_addrs(2);
+    TEST_ASSERT_EQUAL_INT(2, g_walk.count);
+
+    lnx_rtnl_cache_update(test_nl_link(RTM_DELLINK, 2, false));
+    test_walk_addrs(2);
+    TEST_ASSERT_EQUAL_INT(0, g_walk.count);
+    test_walk_addrs(3);
+    TEST_ASSERT_EQUAL_INT(1, g_walk.count);
+
+    TEST_ASSERT_EQUAL_INT(2, g_nl.ndump);
+}
+
+/**
+ * @brief an interrupted dump is repeated, the cache is not trusted when the
+ * dump keeps being interrupted
+ */
+void
+test_rtnl_dump_intr(void)
+{
+    lnx_rtnl_cache_track(true);
+    g_nl.dump_fn = test_dump_tables;
+
+    g_nl.intr = 1;
+    test_walk_routes(0);
+    TEST_ASSERT_EQUAL_INT(2, g_nl.ndump);
+    TEST_ASSERT_EQUAL_INT(3, g_walk.count);
+    test_walk_routes(0);
+    TEST_ASSERT_EQUAL_INT(2, g_nl.ndump);
+
+    /* Still interrupted after all the retries */
+    lnx_rtnl_cache_track(true);
+    g_nl.intr = LNX_RTNL_DUMP_RETRY;
+    test_walk_routes(0);
+    TEST_ASSERT_EQUAL_INT(2 + LNX_RTNL_DUMP_RETRY, g_nl.ndump);
+    TEST_ASSERT_EQUAL_INT(3, g_walk.count);
+
+    test_walk_routes(0);
+    TEST_ASSERT_EQUAL_INT(3 + LNX_RTNL_DUMP_RETRY, g_nl.ndump);
+    TEST_ASSERT_EQUAL_INT(3, g_walk.count);
+    test_walk_routes(0);
+    TEST_ASSERT_EQUAL_INT(3 + LNX_RTNL_DUMP_RETRY, g_nl.ndump);
+
+    /* Without events, every walk dumps */
+    lnx_rtnl_cache_track(false);
+    test_walk_routes(0);
+    test_walk_routes(0);
+    TEST_ASSERT_EQUAL_INT(5 + LNX_RTNL_DUMP_RETRY, g_nl.ndump);
+}
+
+/**
+ * @brief per request results of a batch
+ */
+void
+test_rtnl_batch_errno(void)
+{
+    lnx_rtnl_batch_t batch;
+    struct in_addr addr;
+    int idx;
+    int i;
+
+    inet_pton(AF_INET, "10.0.0.1", &addr);
+    lnx_rtnl_batch_init(&batch);
+
+    /* Objects already gone are not an error */
+    g_nl.err[0] = EADDRNOTAVAIL;
+    g_nl.err[1] = ESRCH;
+    g_nl.err[2] = ENODEV;
+    g_nl.err[3] = EEXIST;
+    g_nl.err[4] = ENETUNREACH;
+    g_nl.err[5] = EPERM;
+    g_nl.err[6] = 0;
+    TEST_ASSERT_EQUAL_INT(0, lnx_rtnl_batch_addr(&batch, RTM_DELADDR, 2, AF_INET, &addr, 24));
+    TEST_ASSERT_EQUAL_INT(1, lnx_rtnl_batch_route(&batch, RTM_DELROUTE, 2, AF_INET, &addr, 32, NULL));
+    TEST_ASSERT_EQUAL_INT(2, lnx_rtnl_batch_link_del(&batch, "br-test.10"));
+    TEST_ASSERT_EQUAL_INT(3, lnx_rtnl_batch_addr(&batch, RTM_NEWADDR, 2, AF_INET, &addr, 24));
+    TEST_ASSERT_EQUAL_INT(4, lnx_rtnl_batch_route(&batch, RTM_NEWROUTE, 2, AF_INET, &addr, 32, &addr));
+    TEST_ASSERT_EQUAL_INT(5, lnx_rtnl_batch_addr(&batch, RTM_DELADDR, 3, AF_INET, &addr, 24));
+    TEST_ASSERT_EQUAL_INT(6, lnx_rtnl_batch_vlan_add(&batch, "br-test.10", 2, 10));
+
+    TEST_ASSERT_EQUAL_INT(3, lnx_rtnl_batch_commit(&batch));
+    TEST_ASSERT_EQUAL_INT(1, g_nl.nsend);
+    TEST_ASSERT_EQUAL_INT(0, lnx_rtnl_batch_error(&batch, 0));
+    TEST_ASSERT_EQUAL_INT(0, lnx_rtnl_batch_error(&batch, 1));
+    TEST_ASSERT_EQUAL_INT(0, lnx_rtnl_batch_error(&batch, 2));
+    TEST_ASSERT_EQUAL_INT(EEXIST, lnx_rtnl_batch_error(&batch, 3));
+    TEST_ASSERT_EQUAL_INT(ENETUNREACH, lnx_rtnl_batch_error(&batch, 4));
+    TEST_ASSERT_EQUAL_INT(EPERM, lnx_rtnl_batch_error(&batch, 5));
+    TEST_ASSERT_EQUAL_INT(0, lnx_rtnl_batch_error(&batch, 6));
+    TEST_ASSERT_EQUAL_INT(EINVAL, lnx_rtnl_batch_error(&batch, 7));
+
+    /* Large batches are sent in chunks */
+    memset(&g_nl, 0, sizeof(g_nl));
+    for (i = 0; i < LNX_RTNL_BATCH_CHUNK + 6; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(i, lnx_rtnl_batch_link_del(&batch, "br-test.10"));
+    }
+    g_nl.err[LNX_RTNL_BATCH_CHUNK] = EBUSY;
+    TEST_ASSERT_EQUAL_INT(1, lnx_rtnl_batch_commit(&batch));
+    TEST_ASSERT_EQUAL_INT(2, g_nl.nsend);
+    TEST_ASSERT_EQUAL_INT(LNX_RTNL_BATCH_CHUNK + 6, g_nl.nreq);
+    TEST_ASSERT_EQUAL_INT(EBUSY, lnx_rtnl_batch_error(&batch, LNX_RTNL_BATCH_CHUNK));
+
+    /* Without ACKs, all the requests fail and the socket is reopened */
+    memset(&g_nl, 0, sizeof(g_nl));
+    g_nl.drop = true;
+    idx = lnx_rtnl_batch_link_del(&batch, "br-test.10");
+    TEST_ASSERT_EQUAL_INT(0, idx);
+    TEST_ASSERT_EQUAL_INT(-1, lnx_rtnl_batch_commit(&batch));
+    TEST_ASSERT_EQUAL_INT(EIO, lnx_rtnl_batch_error(&batch, idx));
+
+    g_nl.drop = false;
+    TEST_ASSERT_EQUAL_INT(0, lnx_rtnl_batch_link_del(&batch, "br-test.10"));
+    TEST_ASSERT_EQUAL_INT(0, lnx_rtnl_batch_commit(&batch));
+    TEST_ASSERT_EQUAL_INT(1, g_nl.nsocket);
+
+    lnx_rtnl_batch_fini(&batch);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_rtnl_route_replace);
+    RUN_TEST(test_rtnl_addr_del);
+    RUN_TEST(test_rtnl_link_down);
+    RUN_TEST(test_rtnl_dump_intr);
+    RUN_TEST(test_rtnl_batch_errno);
+
+    return UNITY_END();
+}
@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define OVSDB_H_INCLUDED
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <ev.h>
 
@@ -140,6 +141,9 @@ typedef enum
     MT_ECHO,
     MT_MONITOR,
     MT_TRANS,
+    MT_MONITOR_COND,
+    MT_MONITOR_COND_CHANGE,
+    MT_GET_SCHEMA,
 }ovsdb_mt_t;
 
 
@@ -204,6 +208,7 @@ bool ovsdb_init(const char *name);
 bool ovsdb_ready(const char *name);
 bool ovsdb_stop_loop(struct ev_loop *loop);
 bool ovsdb_stop(void);
+void ovsdb_set_buffer_max(size_t max);
 
 /*
  * This function allows user to send 'raw' json request
@@ -226,6 +231,30 @@ bool ovsdb_method_send(json_rpc_response_t *callback,
  */
 json_t *ovsdb_method_send_s(ovsdb_mt_t mt, json_t * jparams);
 
+/*
+ * Pipelined sync method send: queue several requests, then wait for the
+ * result of each one by its JSON-RPC id
+ */
+int ovsdb_method_queue_s(ovsdb_mt_t mt, json_t * jparams);
+json_t *ovsdb_method_wait_s(int rpc_id);
+
+/*
+ * Sync calls statistics, latencies in microseconds
+ */
+struct ovsdb_sync_stats
+{
+    uint64_t    calls;          /* Completed calls */
+    uint64_t    errors;         /* Failed calls */
+    uint64_t    connects;       /* Connections opened */
+    uint64_t    lat_total_us;
+    uint64_t    lat_min_us;
+    uint64_t    lat_max_us;
+    uint64_t    lat_last_us;
+};
+
+void ovsdb_sync_stats_get(struct ovsdb_sync_stats *stats);
+void ovsdb_sync_close(void);
+
 /*
  * The following functions generate and send echo json method request
  *
@@ -276,6 +305,31 @@ bool OVSDB_VA_DECL(ovsdb_monit_call,
         char *table,
         int mon_flags);
 
+/*
+ * Conditional monitor request (monitor_cond), updates are received as
+ * "update2" notifications carrying row diffs. Rows are selected on the server
+ * side with the @p where conditions, which are consumed by the call; NULL
+ * selects all rows.
+ */
+bool ovsdb_monit_cond_call_argv(json_rpc_response_t *cb,
+        void *data,
+        int monid,
+        char *table,
+        int mon_flags,
+        int argc,
+        char **argv,
+        json_t *where);
+
+/*
+ * Replace the conditions of a conditional monitor (monitor_cond_change);
+ * @p where is consumed by the call.
+ */
+bool ovsdb_monit_cond_change_call(json_rpc_response_t *cb,
+        void *data,
+        int monid,
+        char *table,
+        json_t *where);
+
 /*
  * The following function creates and sends transaction method json
  *
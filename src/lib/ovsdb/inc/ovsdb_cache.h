@@ -57,9 +57,14 @@ SCHEMA_LISTX(DECL_CACHE_CALLBACK_CAST)
 #define OVSDB_CACHE_MONITOR_F(TABLE, FILTER) \
     ovsdb_cache_monitor_filter(&table_ ## TABLE, callback_ ## TABLE, FILTER)
 
+#define OVSDB_CACHE_MONITOR_FW(TABLE, FILTER, WHERE) \
+    ovsdb_cache_monitor_filter_where(&table_ ## TABLE, callback_ ## TABLE, FILTER, WHERE)
+
 bool ovsdb_cache_monitor(ovsdb_table_t *table, ovsdb_cache_callback_t *callback, bool ignore_version);
 bool ovsdb_cache_monitor_filter(ovsdb_table_t *table,
         ovsdb_cache_callback_t *callback, char **filter);
+bool ovsdb_cache_monitor_filter_where(ovsdb_table_t *table,
+        ovsdb_cache_callback_t *callback, char **filter, json_t *where);
 void ovsdb_cache_dump_table(ovsdb_table_t *table, char *str);
 void ovsdb_cache_update_cb(ovsdb_update_monitor_t *self);
 ovsdb_cache_row_t* ovsdb_cache_find_row_by_uuid(ovsdb_table_t *table, const char *uuid);
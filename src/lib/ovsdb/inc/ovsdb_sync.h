@@ -45,6 +45,7 @@ bool    ovsdb_get_insert_result_uuid(json_t *result, const char *table, const ch
 json_t* ovsdb_sync_select_where(const char *table, json_t *where);
 json_t* ovsdb_sync_select(const char *table, const char *column, const char *value);
 bool    ovsdb_sync_insert(const char *table, json_t *row, ovs_uuid_t *uuid);
+int     ovsdb_sync_insert_rows(const char *table, json_t *rows);
 int     ovsdb_sync_delete_where(const char *table, json_t *where);
 int     ovsdb_sync_update_where(const char *table, json_t *where, json_t *row);
 int     ovsdb_sync_update(const char *table, const char *column, const char *value, json_t *row);
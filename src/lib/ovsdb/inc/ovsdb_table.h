@@ -81,6 +81,7 @@ typedef struct ovsdb_table
     char                    **columns; // all schema columns, null term
     bool                    partial_update;
     ovsdb_update_cbk_t      *monitor_callback;
+    ovsdb_update_row_cbk_t  *monitor_row_callback;
     ovsdb_table_callback_t  *table_callback;
     // cache:
     ovsdb_cache_callback_t  *cache_callback;
@@ -153,6 +154,9 @@ SCHEMA_LISTX(DECL_TABLE_CALLBACK_CAST)
 #define OVSDB_TABLE_MONITOR_F(TABLE, FILTER) \
     ovsdb_table_monitor_filter(&table_ ## TABLE, table_cb_cast_##TABLE(callback_ ## TABLE), FILTER)
 
+#define OVSDB_TABLE_MONITOR_FW(TABLE, FILTER, WHERE) \
+    ovsdb_table_monitor_filter_where(&table_ ## TABLE, table_cb_cast_##TABLE(callback_ ## TABLE), FILTER, WHERE)
+
 json_t* ovsdb_table_filter_row(json_t *row, char *columns[]);
 bool    ovsdb_table_from_json(ovsdb_table_t *table, json_t *jrow, void *record);
 json_t* ovsdb_table_to_json(ovsdb_table_t *table, void *record);
@@ -191,5 +195,8 @@ int     ovsdb_table_delete_where_with_parent(ovsdb_table_t *table, json_t *where
 bool ovsdb_table_monitor(ovsdb_table_t *table, ovsdb_table_callback_t *callback, bool ignore_version);
 bool ovsdb_table_monitor_columns(ovsdb_table_t *table, ovsdb_table_callback_t *callback, char **columns);
 bool ovsdb_table_monitor_filter(ovsdb_table_t *table, ovsdb_table_callback_t *callback, char **filter);
+bool ovsdb_table_monitor_columns_where(ovsdb_table_t *table, ovsdb_table_callback_t *callback, char **columns, json_t *where);
+bool ovsdb_table_monitor_filter_where(ovsdb_table_t *table, ovsdb_table_callback_t *callback, char **filter, json_t *where);
+bool ovsdb_table_monitor_cond_change(ovsdb_table_t *table, json_t *where);
 
 #endif /* OVSDB_TABLE_H_INCLUDED */
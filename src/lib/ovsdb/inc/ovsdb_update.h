@@ -31,6 +31,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <jansson.h>
 
 #include "ovsdb.h"
+#include "ds_tree.h"
+#include "ds_dlist.h"
 #include "os.h"
 
 /*
@@ -101,10 +103,19 @@ typedef struct ovsdb_update_monitor_s ovsdb_update_monitor_t;
 
 typedef void ovsdb_update_cbk_t(ovsdb_update_monitor_t *self);
 
+/*
+ * Return the current row @p uuid of a monitor_cond monitor as a new reference,
+ * or NULL if the row is unknown. Monitors whose owner keeps the rows already,
+ * like the OVSDB cache, set it so that modifications are applied to those
+ * rows instead of a copy kept by the monitor.
+ */
+typedef json_t *ovsdb_update_row_cbk_t(ovsdb_update_monitor_t *self, const char *uuid);
+
 struct ovsdb_update_monitor_s
 {
     ovsdb_update_cbk_t     *mon_cb;            /* Update callback */
     void                   *mon_data;          /* User-supplied data, not touched by ovsdb_update_* */
+    ovsdb_update_row_cbk_t *mon_row_cb;        /* Current row lookup, rows are not kept when set */
 
     /*
      * Except the fields below to be valid only during a callback,
@@ -117,8 +128,33 @@ struct ovsdb_update_monitor_s
     json_t                 *mon_json_new;       /* JSON message containing the update */
     json_t                 *mon_json_old;       /* JSON message containing old data */
     void                   *mon_old_rec;
+
+    /* Private, used by ovsdb_update_* only */
+    int                     mon_id;             /* Monitor id */
+    bool                    mon_cond;           /* monitor_cond in use, updates are diffs */
+    char                   *mon_tname;          /* Monitored table */
+    int                     mon_flags;          /* Monitor flags */
+    int                     mon_colc;           /* Number of monitored columns */
+    char                  **mon_colv;           /* Monitored columns */
+    json_t                 *mon_where;          /* Conditions, until the request is sent */
+    bool                    mon_pending;        /* Request waiting for the schema */
+    ds_dlist_node_t         mon_pnode;
+    ds_tree_t               mon_rows;           /* Rows of a monitor_cond monitor */
 };
 
+/*
+ * A monitor_cond monitor receives "update2" notifications, where a modified
+ * row only carries the changed columns and set or map columns are sent as a
+ * difference. Unless mon_row_cb is set, the current rows are kept to give
+ * callbacks the full record.
+ */
+typedef struct ovsdb_update_row
+{
+    char                   *ur_uuid;            /* Row UUID, tree key */
+    json_t                 *ur_row;             /* Current row data */
+    ds_tree_node_t          ur_node;
+} ovsdb_update_row_t;
+
 /*
  * Start monitoring a table for updates
  */
@@ -130,6 +166,28 @@ extern bool ovsdb_update_monitor_ex(
         int colc,
         char *colv[]);
 
+/*
+ * Start monitoring the rows of a table matching the conditions in @p where,
+ * which uses the transaction "where" syntax and is consumed by the call.
+ * A NULL @p where monitors all rows.
+ */
+extern bool ovsdb_update_monitor_where(
+        ovsdb_update_monitor_t *self,
+        ovsdb_update_cbk_t *callback,
+        char *mon_table,
+        int mon_flags,
+        int colc,
+        char *colv[],
+        json_t *where);
+
+/*
+ * Replace the conditions of a monitor, @p where is consumed by the call.
+ * Rows that no longer match are reported as deleted, new matches as inserted.
+ */
+extern bool ovsdb_update_monitor_cond_change(
+        ovsdb_update_monitor_t *self,
+        json_t *where);
+
 /*
  * Start monitoring a table for updates -- monitors all columns
  */
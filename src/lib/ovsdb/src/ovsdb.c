@@ -47,7 +47,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define MODULE_ID LOG_MODULE_ID_OVSDB
 
-#define MAX_BUFFER_SIZE     (256*1024)
 #define CHUNK_SIZE          (8*1024)
 // typically ovs messages are below 4k, occasionally they are 6k, rarely more than 8k
 
@@ -60,7 +59,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 struct ev_io wovsdb;
 /* Don't use this buffer unless you are cb_ovsdb_read */
 static char *ovs_buffer;
-static int ovs_buffer_size;
+static size_t ovs_buffer_size;
+static size_t ovs_buffer_head;      /* Start of the first unprocessed message */
+static size_t ovs_buffer_len;       /* Bytes in the buffer */
+static struct json_split_state ovs_split;
+/* Read buffer limit, 0 is unlimited */
+static size_t ovs_buffer_max = 0;
 const char *ovsdb_comment = NULL;
 
 int json_rpc_fd = -1;
@@ -86,7 +90,7 @@ static bool ovsdb_process_update(json_t *jsup);
 static bool ovsdb_rpc_callback(int id, bool is_error, json_t *jsmsg);
 
 static void cb_ovsdb_read(struct ev_loop *loop, struct ev_io *watcher, int revents);
-static bool cb_ovsdb_read_json(char *buffer);
+static bool cb_ovsdb_read_json(void);
 
 /******************************************************************************
  *  PROTECTED definitions
@@ -96,9 +100,7 @@ static bool cb_ovsdb_read_json(char *buffer);
 static void cb_ovsdb_read(struct ev_loop *loop, struct ev_io *watcher, int revents)
 {
     ssize_t nr = 0;
-    ssize_t used_size = ovs_buffer ? strlen(ovs_buffer) : 0;
-    ssize_t free_size = ovs_buffer_size - used_size;
-    ssize_t new_size;
+    size_t new_size;
     char *new_buf;
 
     if (EV_ERROR & revents)
@@ -107,31 +109,41 @@ static void cb_ovsdb_read(struct ev_loop *loop, struct ev_io *watcher, int reven
         return;
     }
 
-    // resize buffer if neccesary
-    if (!ovs_buffer || (free_size < CHUNK_SIZE && ovs_buffer_size < MAX_BUFFER_SIZE)) {
-        new_size = ovs_buffer_size + CHUNK_SIZE;
+    // drop the processed messages if the free space is getting low
+    if (ovs_buffer_head > 0 && ovs_buffer_size - ovs_buffer_len < CHUNK_SIZE) {
+        ovs_buffer_len -= ovs_buffer_head;
+        memmove(ovs_buffer, ovs_buffer + ovs_buffer_head, ovs_buffer_len);
+        ovs_buffer_head = 0;
+    }
+
+    // resize buffer if neccesary, doubling it keeps large initial dumps in few reads
+    if (ovs_buffer_size - ovs_buffer_len < CHUNK_SIZE &&
+            (ovs_buffer_max == 0 || ovs_buffer_size < ovs_buffer_max)) {
+        new_size = ovs_buffer_size ? ovs_buffer_size * 2 : CHUNK_SIZE;
+        if (ovs_buffer_max != 0 && new_size > ovs_buffer_max) {
+            new_size = ovs_buffer_max;
+        }
         new_buf = realloc(ovs_buffer, new_size);
         if (!new_buf) {
-            LOG(ERR,"cb_ovsdb_read: realloc(%p, %d -> %d)", ovs_buffer, (int)ovs_buffer_size, (int)new_size);
+            LOG(ERR,"cb_ovsdb_read: realloc(%p, %zu -> %zu)", ovs_buffer, ovs_buffer_size, new_size);
             goto error;
         }
         if (ovs_buffer_size > 0) {
             // only log trace when increasing size, skip initial allocs
-            LOG(TRACE,"cb_ovsdb_read: realloc(%p, %d -> %d) = %p",
-                    ovs_buffer, (int)ovs_buffer_size, (int)new_size, new_buf);
+            LOG(TRACE,"cb_ovsdb_read: realloc(%p, %zu -> %zu) = %p",
+                    ovs_buffer, ovs_buffer_size, new_size, new_buf);
         }
         ovs_buffer = new_buf;
         ovs_buffer_size = new_size;
-        free_size = ovs_buffer_size - used_size;
     }
-    // check if buffer full (need at least 2 bytes free: 1 is for zero termination)
-    if (free_size < 2) {
-        LOG(ERR,"cb_ovsdb_read: buffer full %d/%d", (int)free_size, (int)ovs_buffer_size);
+    // check if buffer full
+    if (ovs_buffer_len >= ovs_buffer_size) {
+        LOG(ERR,"cb_ovsdb_read: buffer full %zu/%zu", ovs_buffer_len, ovs_buffer_size);
         goto error;
     }
 
     // Receive message from client socket
-    nr = recv(watcher->fd, ovs_buffer + used_size, free_size - 1, 0);
+    nr = recv(watcher->fd, ovs_buffer + ovs_buffer_len, ovs_buffer_size - ovs_buffer_len, 0);
     if (nr < 0 && errno == EAGAIN)
     {
         /* Need more data */
@@ -151,22 +163,23 @@ static void cb_ovsdb_read(struct ev_loop *loop, struct ev_io *watcher, int reven
         goto error;
     }
 
-    /* Pad the buffer with \0 */
-    used_size += nr;
-    ovs_buffer[used_size] = '\0';
+    ovs_buffer_len += nr;
 
-    if (!cb_ovsdb_read_json(ovs_buffer))
+    if (!cb_ovsdb_read_json())
     {
         LOG(WARNING, "OVSDB read: Error parsing JSON.");
         goto error;
     }
 
-    // free buffer if the contents were fully consumed
-    used_size = strlen(ovs_buffer);
-    if (used_size == 0) {
-        free(ovs_buffer);
-        ovs_buffer_size = 0;
-        ovs_buffer = NULL;
+    // rewind the buffer if the contents were fully consumed, release it after large messages
+    if (ovs_buffer_head == ovs_buffer_len) {
+        if (ovs_buffer_size > CHUNK_SIZE) {
+            free(ovs_buffer);
+            ovs_buffer_size = 0;
+            ovs_buffer = NULL;
+        }
+        ovs_buffer_head = 0;
+        ovs_buffer_len = 0;
     }
     return;
 
@@ -177,6 +190,9 @@ error:
     free(ovs_buffer);
     ovs_buffer = NULL;
     ovs_buffer_size = 0;
+    ovs_buffer_head = 0;
+    ovs_buffer_len = 0;
+    json_split_init(&ovs_split);
 
     // peer closed, stop watching, close socket
     ev_io_stop(loop, watcher);
@@ -202,61 +218,59 @@ error:
     return;
 }
 
-static bool cb_ovsdb_read_json(char *buf)
+/*
+ * Process the complete messages in the read buffer. The framing state is kept
+ * in ovs_split, so the bytes of an incomplete message are only scanned once,
+ * and messages are parsed in place.
+ */
+static bool cb_ovsdb_read_json(void)
 {
-    char *next;
     json_error_t jerror;
+    ssize_t msglen;
+    char *msg;
 
     json_t *js = NULL;
-    char *str = buf;
 
-    while ((next = json_split(str)) != NULL)
+    while (ovs_buffer_head < ovs_buffer_len)
     {
-        if (next == JSON_SPLIT_ERROR)
+        msg = ovs_buffer + ovs_buffer_head;
+        msglen = json_split_stream(&ovs_split, msg, ovs_buffer_len - ovs_buffer_head);
+        if (msglen == 0) break;
+
+        if (msglen < 0)
         {
-            LOG(ERR, "OVSDB RECV: Error parsing input string.::json=%s", buf);
+            LOG(ERR, "OVSDB RECV: Error parsing input string.::json=%.*s",
+                    (int)(ovs_buffer_len - ovs_buffer_head), msg);
             return false;
         }
 
-        /*
-         * Note that "next" points to the end of the message, which might be the beginning of the next message. Pad it with \0, but
-         * remember the character that we overwrote. We will patch it back once we're json_dumps() has finished.
-         */
-        char save = *next;
-        *next = '\0';
-
-        LOG(DEBUG, "JSON RECV: %s\n", str);
+        LOG(DEBUG, "JSON RECV: %.*s\n", (int)msglen, msg);
         /*
          * Convert string to json_t
          */
-        js = json_loads(str, 0, &jerror);
+        js = json_loadb(msg, msglen, 0, &jerror);
         if (js == NULL)
         {
-            LOG(ERR, "OVSB RECV: Error processing JSON message.::json=%s", str);
+            LOG(ERR, "OVSB RECV: Error processing JSON message (%s).::json=%.*s",
+                    jerror.text, (int)msglen, msg);
             return false;
         }
 
-        /* Patch it back */
-        *next = save;
+        /* Move buffer to the next one */
+        ovs_buffer_head += msglen;
 
         if (!ovsdb_process_recv(js))
         {
-            char *msg;
+            char *str;
 
-            msg = json_dumps(js, JSON_COMPACT);
-            LOG(ERR, "JSON-RPC: Error processing message.::json=%s", msg);
-            json_free(msg);
+            str = json_dumps(js, JSON_COMPACT);
+            LOG(ERR, "JSON-RPC: Error processing message.::json=%s", str);
+            json_free(str);
         }
 
         json_decref(js);
-
-        /* Move buffer to the next one */
-        str = next;
     }
 
-    /* Shift the buffer */
-    memmove(buf, str, strlen(str) + 1);
-
     return true;
 }
 
@@ -281,7 +295,7 @@ bool ovsdb_process_recv(json_t *jsrpc)
     {
         const char * method;
         method = json_string_value(jst);
-        if (!strcmp(method, "update")) {
+        if (!strcmp(method, "update") || !strcmp(method, "update2")) {
             return ovsdb_process_update(jsrpc);
         } else  {
             LOG(ERR, "Received unsupported SYNCHRONOUS method request.::method=%s", json_string_value(jst));
@@ -527,6 +541,15 @@ sleep:
     return false;
 }
 
+/*
+ * Limit the size of the read buffer, a message that doesn't fit closes the
+ * connection. The buffer is not limited by default (0).
+ */
+void ovsdb_set_buffer_max(size_t max)
+{
+    ovs_buffer_max = max;
+}
+
 bool ovsdb_stop(void)
 {
     return ovsdb_stop_loop(NULL);
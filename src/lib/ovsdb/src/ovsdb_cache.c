@@ -48,6 +48,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define MODULE_ID LOG_MODULE_ID_OVSDB
 
 void ovsdb_cache_update_cb(ovsdb_update_monitor_t *self);
+json_t* ovsdb_cache_row_json(ovsdb_update_monitor_t *self, const char *uuid);
 
 // ignore_version can be used if we are not interested in receiving
 // updates for when a referenced table has been modified
@@ -55,6 +56,7 @@ bool ovsdb_cache_monitor_columns(ovsdb_table_t *table,
         ovsdb_cache_callback_t *callback, char **columns)
 {
     table->monitor_callback = ovsdb_cache_update_cb;
+    table->monitor_row_callback = ovsdb_cache_row_json;
     table->cache_callback = callback;
     return ovsdb_table_monitor_columns(table, NULL, columns);
 }
@@ -63,6 +65,7 @@ bool ovsdb_cache_monitor(ovsdb_table_t *table,
         ovsdb_cache_callback_t *callback, bool ignore_version)
 {
     table->monitor_callback = ovsdb_cache_update_cb;
+    table->monitor_row_callback = ovsdb_cache_row_json;
     table->cache_callback = callback;
     return ovsdb_table_monitor(table, NULL, ignore_version);
 }
@@ -71,8 +74,30 @@ bool ovsdb_cache_monitor_filter(ovsdb_table_t *table,
         ovsdb_cache_callback_t *callback, char **filter)
 {
     table->monitor_callback = ovsdb_cache_update_cb;
+    table->monitor_row_callback = ovsdb_cache_row_json;
     table->cache_callback = callback;
-    return ovsdb_table_monitor(table, NULL, filter);
+    return ovsdb_table_monitor_filter(table, NULL, filter);
+}
+
+bool ovsdb_cache_monitor_filter_where(ovsdb_table_t *table,
+        ovsdb_cache_callback_t *callback, char **filter, json_t *where)
+{
+    table->monitor_callback = ovsdb_cache_update_cb;
+    table->monitor_row_callback = ovsdb_cache_row_json;
+    table->cache_callback = callback;
+    return ovsdb_table_monitor_filter_where(table, NULL, filter, where);
+}
+
+// current row of a monitor_cond monitor, update2 diffs are applied
+// to the cached record instead of a copy kept by the monitor
+json_t* ovsdb_cache_row_json(ovsdb_update_monitor_t *self, const char *uuid)
+{
+    ovsdb_table_t *table = self->mon_data;
+    ovsdb_cache_row_t *row;
+
+    row = ds_tree_find(&table->rows, (void*)uuid);
+    if (!row) return NULL;
+    return ovsdb_table_to_json(table, row->record);
 }
 
 // debug dump table
@@ -128,6 +153,40 @@ void _ovsdb_cache_insert_row(ovsdb_table_t *table, ovsdb_cache_row_t *row)
     ovsdb_cache_dump_table(table, msg);
 }
 
+static void _ovsdb_cache_remove_row(ovsdb_table_t *table, ovsdb_cache_row_t *row)
+{
+    ds_tree_remove(&table->rows, row);
+    if (table->key_offset >= 0)
+    {
+        ds_tree_remove(&table->rows_k, row);
+    }
+    if (table->key2_offset >= 0)
+    {
+        ds_tree_remove(&table->rows_k2, row);
+    }
+}
+
+static bool _ovsdb_cache_key_changed(int offset, char *old_rec, char *new_rec)
+{
+    if (offset < 0) return false;
+    return strcmp(old_rec + offset, new_rec + offset) != 0;
+}
+
+// the row trees are keyed by strings stored in the record itself,
+// so a row whose uuid, key or key2 changes is re-indexed
+static void _ovsdb_cache_update_row(ovsdb_table_t *table, ovsdb_cache_row_t *row, void *record)
+{
+    bool reindex;
+
+    reindex = _ovsdb_cache_key_changed(table->uuid_offset, row->record, record)
+        || _ovsdb_cache_key_changed(table->key_offset, row->record, record)
+        || _ovsdb_cache_key_changed(table->key2_offset, row->record, record);
+
+    if (reindex) _ovsdb_cache_remove_row(table, row);
+    memcpy(row->record, record, table->schema_size);
+    if (reindex) _ovsdb_cache_insert_row(table, row);
+}
+
 void ovsdb_cache_update_cb(ovsdb_update_monitor_t *self)
 {
     ovsdb_table_t *table;
@@ -293,7 +352,7 @@ void ovsdb_cache_update_cb(ovsdb_update_monitor_t *self)
                 // mark _changed
                 table->mark_changed(old_record, record);
             }
-            memcpy(row->record, record, sizeof(record));
+            _ovsdb_cache_update_row(table, row, record);
             break;
 
         case OVSDB_UPDATE_DEL:
@@ -303,16 +362,8 @@ void ovsdb_cache_update_cb(ovsdb_update_monitor_t *self)
                     table->table_name, typestr, mon_uuid);
                 return;
             }
-            // remove row from the list
-            ds_tree_remove(&table->rows, row);
-            if (table->key_offset >= 0)
-            {
-                ds_tree_remove(&table->rows_k, row);
-            }
-            if (table->key2_offset >= 0)
-            {
-                ds_tree_remove(&table->rows_k2, row);
-            }
+            // remove row from the indexes
+            _ovsdb_cache_remove_row(table, row);
             // callback
             if (table->cache_callback) table->cache_callback(self, old_record, row->record, row);
             // free row
@@ -335,18 +386,32 @@ void ovsdb_cache_update_cb(ovsdb_update_monitor_t *self)
 ovsdb_cache_row_t* _ovsdb_cache_find_row_by_offset(ovsdb_table_t *table, int offset, const char *kname, const char *key)
 {
     ovsdb_cache_row_t *row;
-    char *row_key;
+    ds_tree_t *index;
     if (offset < 0) return NULL;
 
-    ds_tree_foreach(&table->rows, row)
+    // each lookup key has its own index
+    if (offset == table->uuid_offset) index = &table->rows;
+    else if (offset == table->key_offset) index = &table->rows_k;
+    else if (offset == table->key2_offset) index = &table->rows_k2;
+    else index = NULL;
+
+    if (index)
+    {
+        row = ds_tree_find(index, (void *)key);
+    }
+    else
     {
-        row_key = row->record + offset;
-        if (strcmp(row_key, key) == 0)
+        ds_tree_foreach(&table->rows, row)
         {
-            LOG(TRACE, "found table: %s %s: %s", table->table_name, kname, key);
-            return row;
+            if (strcmp(row->record + offset, key) == 0) break;
         }
     }
+
+    if (row)
+    {
+        LOG(TRACE, "found table: %s %s: %s", table->table_name, kname, key);
+        return row;
+    }
     LOG(TRACE, "NOT found table: %s %s: %s", table->table_name, kname, key);
     return NULL;
 }
@@ -469,7 +534,7 @@ int ovsdb_cache_upsert(ovsdb_table_t *table, void *record)
     if (row)
     {
         // update existing
-        memcpy(row->record, record, table->schema_size);
+        _ovsdb_cache_update_row(table, row, record);
     }
     else
     {
@@ -124,7 +124,7 @@ static bool ovsdb_mon_sel_isprefix(const char * column_ex)
  * va list contains only column names with selector prefixes
  * Return array which is table_name value in monitor request
  */
-static json_t * ovsdb_mon_tbl_val(int mon_flags, int argc, char *argv[])
+static json_t * ovsdb_mon_tbl_val(int mon_flags, int argc, char *argv[], json_t *where)
 {
     json_t * jo;
     json_t * jcarray;
@@ -180,6 +180,12 @@ static json_t * ovsdb_mon_tbl_val(int mon_flags, int argc, char *argv[])
         json_object_set_new(jo, "select", jsel);
     }
 
+    /* Conditions are only valid in monitor_cond requests */
+    if (where != NULL)
+    {
+        json_object_set_new(jo, "where", where);
+    }
+
     return jo;
 }
 
@@ -296,6 +302,18 @@ bool ovsdb_method_send(json_rpc_response_t *callback,
             method = "transact";
             break;
 
+        case MT_MONITOR_COND:
+            method = "monitor_cond";
+            break;
+
+        case MT_MONITOR_COND_CHANGE:
+            method = "monitor_cond_change";
+            break;
+
+        case MT_GET_SCHEMA:
+            method = "get_schema";
+            break;
+
         default:
             LOG(ERR, "unknown method");
             return false;
@@ -413,7 +431,7 @@ bool ovsdb_monit_call_argv(json_rpc_response_t *callback,
 
     jtbl = json_object();
 
-    jtblval = ovsdb_mon_tbl_val(mon_flags, argc, argv);
+    jtblval = ovsdb_mon_tbl_val(mon_flags, argc, argv, NULL);
 
     json_object_set_new(jtbl, table, jtblval);
 
@@ -425,6 +443,68 @@ bool ovsdb_monit_call_argv(json_rpc_response_t *callback,
     return retval;
 }
 
+bool ovsdb_monit_cond_call_argv(json_rpc_response_t *callback,
+        void *data,
+        int monid,
+        char *table,
+        int mon_flags,
+        int argc,
+        char *argv[],
+        json_t *where)
+{
+    json_t * jparams;
+    json_t * jtbl;
+
+    jparams = json_array();
+
+    json_array_append_new(jparams, json_string(OVSDB_DEF_DB));
+    json_array_append_new(jparams, json_integer(monid));
+
+    jtbl = json_object();
+    json_object_set_new(jtbl, table, ovsdb_mon_tbl_val(mon_flags, argc, argv, where));
+    json_array_append_new(jparams, jtbl);
+
+    return ovsdb_method_send(callback, data, MT_MONITOR_COND, jparams);
+}
+
+/**
+ * Change the conditions of a monitor_cond request. The monitor keeps its id,
+ * rows leaving the selection are reported as deleted, rows entering it as
+ * inserted.
+ */
+bool ovsdb_monit_cond_change_call(json_rpc_response_t *callback,
+        void *data,
+        int monid,
+        char *table,
+        json_t *where)
+{
+    json_t * jparams;
+    json_t * jreq;
+    json_t * jtbl;
+
+    jparams = json_array();
+
+    /* The monitor is not renamed, old and new id are the same */
+    json_array_append_new(jparams, json_integer(monid));
+    json_array_append_new(jparams, json_integer(monid));
+
+    /* No conditions selects all rows again */
+    if (where == NULL)
+    {
+        where = json_array();
+        json_array_append_new(where, json_true());
+    }
+
+    jreq = json_object();
+    json_object_set_new(jreq, "where", where);
+
+    jtbl = json_object();
+    json_object_set_new(jtbl, table, jreq);
+    json_array_append_new(jparams, jtbl);
+
+    return ovsdb_method_send(callback, data, MT_MONITOR_COND_CHANGE, jparams);
+}
+
 bool OVSDB_GEN_DECL(ovsdb_monit_call, json_rpc_response_t *callback, void *data, int monid, char *table, int mon_flags)
 {
     OVSDB_GEN_CALL(ovsdb_monit_call, callback, data, monid, table, mon_flags);
@@ -30,13 +30,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * ========================================================================= */
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <jansson.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/socket.h>
 
 #include "os_socket.h"
+#include "os_time.h"
 #include "log.h"
+#include "ds_tree.h"
 #include "json_util.h"
 
 #include "ovsdb.h"
@@ -47,124 +51,454 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "pjs_gen_c.h"
 
 
-/* OVSDB response buffers can be HUGE */
-static char ovsdb_write_buf[256*1024];
+/* OVSDB response buffers can be HUGE, grow on demand up to this limit */
+#define OVSDB_SYNC_BUF_MIN      (16*1024)
+#define OVSDB_SYNC_BUF_MAX      (16*1024*1024)
+
+/*
+ * A synchronous request waiting for its reply
+ */
+struct ovsdb_sync_req
+{
+    int                 id;         /* JSON-RPC id */
+    int64_t             sent;       /* Send time, in microseconds */
+    json_t             *reply;      /* Reply, when received out of order */
+    ds_tree_node_t      node;
+};
+
+/*
+ * A connection to OVSDB carrying synchronous requests
+ *
+ * Several requests can be written before their replies are read; replies
+ * are matched to the requests by their JSON-RPC id.
+ */
+struct ovsdb_sync_chan
+{
+    int                 fd;
+    pid_t               pid;        /* Owner, a forked child reconnects */
+    char               *buf;        /* Read buffer */
+    size_t              size;       /* Read buffer size */
+    size_t              len;        /* Bytes in the read buffer */
+    size_t              scan;       /* Bytes of the current message scanned */
+    int                 depth;      /* Current message nesting level */
+    bool                in_str;     /* Scanning a string */
+    bool                esc;        /* Scanning an escaped character */
+    ds_tree_t           pending;    /* struct ovsdb_sync_req, by id */
+};
+
+/* Long-lived channel shared by the synchronous calls */
+static struct ovsdb_sync_chan ovsdb_sync_chan =
+{
+    .fd = -1,
+    .pending = DS_TREE_INIT(ds_int_cmp, struct ovsdb_sync_req, node),
+};
+static struct ovsdb_sync_stats ovsdb_sync_stats;
+
+static void ovsdb_sync_chan_init(struct ovsdb_sync_chan *chan)
+{
+    memset(chan, 0, sizeof(*chan));
+    chan->fd = -1;
+    ds_tree_init(&chan->pending, ds_int_cmp, struct ovsdb_sync_req, node);
+}
 
 /**
- * Callback for json_dump_callback() -- called from ovsb_write_s()
+ * Close a channel and fail its pending requests
  *
- * Per Jansson documentation, this function shall return -1 on error or 0 on
- * success
+ * Unless @p drop_replies is set, requests whose reply was already read are
+ * kept so that their own ovsdb_sync_chan_wait() call still returns it.
  */
-int ovsdb_sync_write_fn(const char *buf, size_t sz, void *self)
+static void ovsdb_sync_chan_close(struct ovsdb_sync_chan *chan, bool drop_replies)
 {
-    int     ovs_fd = (long)self;
-    ssize_t rc;
+    struct ovsdb_sync_req *req;
+    struct ovsdb_sync_req *next;
 
-    rc = write(ovs_fd, buf, sz);
-    if (rc <= 0)
+    for (req = ds_tree_head(&chan->pending); req != NULL; req = next)
     {
-        LOGE("Synchronous write() to OVSDB failed: %s", strerror(errno));
-        return -1;
+        next = ds_tree_next(&chan->pending, req);
+        if (req->reply != NULL && !drop_replies) continue;
+
+        ds_tree_remove(&chan->pending, req);
+        if (req->reply != NULL) json_decref(req->reply);
+        free(req);
+        ovsdb_sync_stats.errors++;
     }
 
-    return 0;
+    if (chan->fd >= 0) close(chan->fd);
+    free(chan->buf);
+
+    chan->fd = -1;
+    chan->buf = NULL;
+    chan->size = chan->len = chan->scan = 0;
+    chan->depth = 0;
+    chan->in_str = chan->esc = false;
 }
 
 /**
- * Synchronous write to OVSDB -- similar to ovsdb_write() except it doesn't require a callback
- *
- * This function opens a new connection to OVSDB for each request. In the future, if needed, this
- * can be changed to use a timer to close the connection after a period of inactivity.
+ * Connect a channel to OVSDB, unless already connected
  */
-
-json_t *ovsdb_write_s(json_t *jsdata)
+static bool ovsdb_sync_chan_open(struct ovsdb_sync_chan *chan)
 {
-    int     ovs_fd = -1;
-    json_t *retval = NULL;
+    if (chan->pid != getpid())
+    {
+        /* A forked child must not share the parent's connection or replies */
+        ovsdb_sync_chan_close(chan, true);
+    }
+    else if (chan->fd >= 0)
+    {
+        return true;
+    }
 
-    /* Initiate new connection to OVSDB */
-    ovs_fd = ovsdb_conn();
-    if (ovs_fd < 0)
+    chan->fd = ovsdb_conn();
+    if (chan->fd < 0)
     {
         LOGE("SYNC: Error initiating connection to OVSDB.");
-        goto error;
+        return false;
     }
 
-    LOGD("SYNC: Writing sync operation: %s", json_dumps_static(jsdata, 0));
+    chan->pid = getpid();
+    ovsdb_sync_stats.connects++;
 
-    if (json_dump_callback(jsdata, ovsdb_sync_write_fn, (void *)(intptr_t)ovs_fd, JSON_COMPACT) != 0)
+    return true;
+}
+
+/**
+ * Write a whole JSON message to a channel
+ */
+static bool ovsdb_sync_chan_write(struct ovsdb_sync_chan *chan, json_t *jsdata)
+{
+    size_t len;
+    size_t off;
+    ssize_t rc;
+    char *str;
+
+    str = json_dumps(jsdata, JSON_COMPACT);
+    if (str == NULL)
     {
-        LOGE("SYNC: Error during sync write to OVSDB: %s", strerror(errno));
-        goto error;
+        LOGE("SYNC: Error serializing sync operation.");
+        return false;
     }
 
-    /* Read a response and return */
-    size_t buflen = 0;
-    ssize_t nr;
-
-    while (buflen < sizeof(ovsdb_write_buf) - 1)
+    len = strlen(str);
+    for (off = 0; off < len; off += rc)
     {
-        nr = read(ovs_fd, &ovsdb_write_buf[buflen], sizeof(ovsdb_write_buf) - 1 - buflen);
-        if (nr <= 0)
+        rc = send(chan->fd, str + off, len - off, MSG_NOSIGNAL);
+        if (rc <= 0)
         {
-            /* Treat errors and short reads the same -- error while reading response. */
-            LOGE("Sync: Short read or EOF while waiting for JSON response.");
-            goto error;
+            LOGE("Synchronous write() to OVSDB failed: %s", strerror(errno));
+            break;
         }
+    }
+    free(str);
+
+    return off == len;
+}
 
-        buflen += nr;
+/**
+ * Scan newly read bytes for the end of the current JSON message
+ *
+ * The scanner state is kept across reads so that a large reply is scanned
+ * only once.
+ *
+ * @return the length of the message, 0 if incomplete, -1 on error
+ */
+static ssize_t ovsdb_sync_chan_scan(struct ovsdb_sync_chan *chan)
+{
+    char c;
 
-        ovsdb_write_buf[buflen] = '\0';
+    for (; chan->scan < chan->len; chan->scan++)
+    {
+        c = chan->buf[chan->scan];
 
-        char *res = json_split(ovsdb_write_buf);
-        if (res == JSON_SPLIT_ERROR)
+        if (chan->in_str)
         {
-            LOGE("Sync: Error parsing JSON-RPC response: %s\n", ovsdb_write_buf);
-            goto error;
+            if (chan->esc) chan->esc = false;
+            else if (c == '\\') chan->esc = true;
+            else if (c == '"') chan->in_str = false;
+            continue;
         }
 
-        if (res != NULL)
+        switch (c)
         {
-            if (strlen(res))
-                LOGW("Sync: trailing garbage found: '%s'", res);
-            *res = 0;
-            /* Success */
-            break;
+            case '{':
+                chan->depth++;
+                break;
+
+            case '}':
+                if (--chan->depth == 0) return ++chan->scan;
+                break;
+
+            case '"':
+                chan->in_str = true;
+                break;
+
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n':
+                break;
+
+            default:
+                /* Only objects are exchanged over JSON-RPC */
+                if (chan->depth == 0) return -1;
+                break;
         }
     }
 
+    return 0;
+}
+
+/**
+ * Read the next JSON message from a channel
+ */
+static json_t *ovsdb_sync_chan_read(struct ovsdb_sync_chan *chan)
+{
     json_error_t err;
-    retval = json_loads(ovsdb_write_buf, 0, &err);
-    if (retval == NULL)
+    ssize_t msglen;
+    json_t *msg;
+    size_t size;
+    char *buf;
+    ssize_t nr;
+
+    while ((msglen = ovsdb_sync_chan_scan(chan)) == 0)
+    {
+        if (chan->len == chan->size)
+        {
+            size = chan->size ? chan->size * 2 : OVSDB_SYNC_BUF_MIN;
+            if (size > OVSDB_SYNC_BUF_MAX)
+            {
+                LOGE("Sync: JSON-RPC message exceeds %d bytes.", OVSDB_SYNC_BUF_MAX);
+                return NULL;
+            }
+
+            buf = realloc(chan->buf, size);
+            if (buf == NULL)
+            {
+                LOGE("Sync: Error allocating %zu bytes for the JSON response.", size);
+                return NULL;
+            }
+
+            chan->buf = buf;
+            chan->size = size;
+        }
+
+        nr = read(chan->fd, chan->buf + chan->len, chan->size - chan->len);
+        if (nr <= 0)
+        {
+            /* Treat errors and short reads the same -- error while reading response. */
+            LOGE("Sync: Short read or EOF while waiting for JSON response.");
+            return NULL;
+        }
+
+        chan->len += nr;
+    }
+
+    if (msglen < 0)
+    {
+        LOGE("Sync: Error parsing JSON-RPC response: %.*s", (int)chan->len, chan->buf);
+        return NULL;
+    }
+
+    msg = json_loadb(chan->buf, msglen, 0, &err);
+    if (msg == NULL)
+    {
+        LOGE("Sync: Error parsing OVSDB response (%s):\n%.*s", err.text, (int)msglen, chan->buf);
+        return NULL;
+    }
+
+    /* Keep the following, pipelined, messages */
+    chan->len -= msglen;
+    memmove(chan->buf, chan->buf + msglen, chan->len);
+    chan->scan = 0;
+
+    return msg;
+}
+
+/**
+ * Handle a request or a notification sent by OVSDB on a sync channel
+ */
+static void ovsdb_sync_chan_notify(struct ovsdb_sync_chan *chan, json_t *msg)
+{
+    const char *method;
+    json_t *reply;
+
+    method = json_string_value(json_object_get(msg, "method"));
+    if (method == NULL || strcmp(method, "echo") != 0)
     {
-        LOGE("Sync: Error parsing OVSDB response (%s):\n%s", err.text, ovsdb_write_buf);
+        LOGD("Sync: Ignoring OVSDB notification: %s", method ? method : "(null)");
+        return;
+    }
+
+    /* Keep the connection alive */
+    reply = json_pack("{s:O, s:O, s:n}",
+                      "id", json_object_get(msg, "id"),
+                      "result", json_object_get(msg, "params"),
+                      "error");
+    if (reply == NULL) return;
+
+    ovsdb_sync_chan_write(chan, reply);
+    json_decref(reply);
+}
+
+/**
+ * Write a request to a channel, its reply is read by ovsdb_sync_chan_wait()
+ *
+ * @return the JSON-RPC id of the request, -1 on error
+ */
+static int ovsdb_sync_chan_send(struct ovsdb_sync_chan *chan, json_t *jsdata)
+{
+    struct ovsdb_sync_req *req;
+    json_t *jid;
+    bool rc;
+    int id;
+
+    jid = json_object_get(jsdata, "id");
+    if (!json_is_integer(jid))
+    {
+        LOGE("SYNC: Sync operation without an id.");
+        return -1;
+    }
+
+    id = json_integer_value(jid);
+
+    if (!ovsdb_sync_chan_open(chan)) goto error;
+
+    if (ds_tree_find(&chan->pending, &id) != NULL)
+    {
+        LOGE("SYNC: Sync operation id %d already pending.", id);
         goto error;
     }
 
+    req = calloc(1, sizeof(*req));
+    if (req == NULL) goto error;
+
+    req->id = id;
+
+    LOGD("SYNC: Writing sync operation: %s", json_dumps_static(jsdata, 0));
+
+    rc = ovsdb_sync_chan_write(chan, jsdata);
+    if (!rc && ds_tree_is_empty(&chan->pending))
+    {
+        /* The server may have closed an idle connection, retry once */
+        ovsdb_sync_chan_close(chan, false);
+        rc = ovsdb_sync_chan_open(chan) && ovsdb_sync_chan_write(chan, jsdata);
+    }
+
+    if (!rc)
+    {
+        LOGE("SYNC: Error during sync write to OVSDB.");
+        free(req);
+        ovsdb_sync_chan_close(chan, false);
+        goto error;
+    }
+
+    req->sent = clock_mono_usec();
+    ds_tree_insert(&chan->pending, req, &req->id);
+
+    return req->id;
+
 error:
-    /* Terminate connection */
-    if (ovs_fd >= 0)
+    ovsdb_sync_stats.errors++;
+    return -1;
+}
+
+/**
+ * Wait for the reply to a request previously written to a channel
+ *
+ * Replies to other pending requests read meanwhile are kept for their own
+ * ovsdb_sync_chan_wait() call.
+ */
+static json_t *ovsdb_sync_chan_wait(struct ovsdb_sync_chan *chan, int id)
+{
+    struct ovsdb_sync_req *req;
+    struct ovsdb_sync_req *other;
+    json_t *reply;
+    json_t *msg;
+    json_t *jid;
+    int64_t lat;
+    int oid;
+
+    req = ds_tree_find(&chan->pending, &id);
+    if (req == NULL)
     {
-        close(ovs_fd);
+        LOGE("Sync: No pending request with id %d.", id);
+        return NULL;
     }
 
-    return retval;
+    while (req->reply == NULL)
+    {
+        msg = ovsdb_sync_chan_read(chan);
+        if (msg == NULL)
+        {
+            /*
+             * The stream can't be resynchronized, fail the requests still
+             * waiting for a reply; replies already read are delivered.
+             */
+            ovsdb_sync_chan_close(chan, false);
+            return NULL;
+        }
+
+        jid = json_object_get(msg, "id");
+        if (json_object_get(msg, "method") != NULL)
+        {
+            ovsdb_sync_chan_notify(chan, msg);
+            json_decref(msg);
+            continue;
+        }
+
+        oid = json_integer_value(jid);
+        other = json_is_integer(jid) ? ds_tree_find(&chan->pending, &oid) : NULL;
+        if (other == NULL || other->reply != NULL)
+        {
+            LOGW("Sync: Dropping unexpected JSON-RPC response: %s", json_dumps_static(msg, 0));
+            json_decref(msg);
+            continue;
+        }
+
+        other->reply = msg;
+    }
+
+    lat = clock_mono_usec() - req->sent;
+    if (ovsdb_sync_stats.calls == 0 || (uint64_t)lat < ovsdb_sync_stats.lat_min_us)
+    {
+        ovsdb_sync_stats.lat_min_us = lat;
+    }
+    if ((uint64_t)lat > ovsdb_sync_stats.lat_max_us) ovsdb_sync_stats.lat_max_us = lat;
+    ovsdb_sync_stats.lat_total_us += lat;
+    ovsdb_sync_stats.lat_last_us = lat;
+    ovsdb_sync_stats.calls++;
+
+    LOGT("Sync: JSON-RPC id %d replied in %lld us", id, (long long)lat);
+
+    reply = req->reply;
+    ds_tree_remove(&chan->pending, req);
+    free(req);
+
+    return reply;
 }
 
 /**
- * Issue a synchronous request to OVSDB
+ * Synchronous write to OVSDB -- similar to ovsdb_write() except it doesn't require a callback
+ *
+ * Requests share a long-lived connection, opened on first use and re-opened
+ * after an error.
  */
-json_t *ovsdb_method_send_s(
-        ovsdb_mt_t mt,
-        json_t * jparams)
+json_t *ovsdb_write_s(json_t *jsdata)
 {
+    int id;
 
-    int     rpc_id = 0;
+    id = ovsdb_sync_chan_send(&ovsdb_sync_chan, jsdata);
+    if (id < 0) return NULL;
+
+    return ovsdb_sync_chan_wait(&ovsdb_sync_chan, id);
+}
+
+/**
+ * Build a JSON-RPC request
+ */
+static json_t *ovsdb_sync_request(ovsdb_mt_t mt, json_t *jparams, int *rpc_id)
+{
     char    *method = NULL;
     json_t  *js = NULL;
-    json_t  *jres = NULL;
-    json_t  *retval = NULL;
 
     switch (mt)
     {
@@ -180,10 +514,22 @@ json_t *ovsdb_method_send_s(
             method = "transact";
             break;
 
+        case MT_MONITOR_COND:
+            method = "monitor_cond";
+            break;
+
+        case MT_MONITOR_COND_CHANGE:
+            method = "monitor_cond_change";
+            break;
+
+        case MT_GET_SCHEMA:
+            method = "get_schema";
+            break;
+
         default:
             LOG(ERR, "unknown method");
             json_decref(jparams);
-            return false;
+            return NULL;
     }
 
     js = json_object();
@@ -199,17 +545,26 @@ json_t *ovsdb_method_send_s(
         json_decref(jparams);
     }
 
-    rpc_id = ovsdb_jsonrpc_id_new();
-    if (0 < json_object_set_new(js, "id", json_integer(rpc_id)))
+    *rpc_id = ovsdb_jsonrpc_id_new();
+    if (0 < json_object_set_new(js, "id", json_integer(*rpc_id)))
     {
         LOGE("Error adding id key.");
     }
 
-    jres = ovsdb_write_s(js);
+    return js;
+}
+
+/**
+ * Validate a JSON-RPC response and return its result object
+ */
+static json_t *ovsdb_sync_result(json_t *jres, int rpc_id)
+{
+    json_t  *retval = NULL;
+
     if (jres == NULL)
     {
         LOGE("Sync: Error sending OVSDB JSON-RPC request.");
-        goto error;
+        return NULL;
     }
 
     struct rpc_response res;
@@ -241,12 +596,106 @@ json_t *ovsdb_method_send_s(
     json_incref(retval);
 
 error:
-    if (js != NULL) json_decref(js);
-    if (jres != NULL) json_decref(jres);
+    json_decref(jres);
 
     return retval;
 }
 
+/**
+ * Issue a synchronous request to OVSDB
+ */
+json_t *ovsdb_method_send_s(
+        ovsdb_mt_t mt,
+        json_t * jparams)
+{
+    struct ovsdb_sync_chan chan;
+    json_t  *jres = NULL;
+    json_t  *js = NULL;
+    int     rpc_id = 0;
+
+    if (mt != MT_MONITOR && mt != MT_MONITOR_COND)
+    {
+        rpc_id = ovsdb_method_queue_s(mt, jparams);
+        if (rpc_id < 0) return NULL;
+
+        return ovsdb_method_wait_s(rpc_id);
+    }
+
+    js = ovsdb_sync_request(mt, jparams, &rpc_id);
+    if (js == NULL) return NULL;
+
+    /*
+     * A monitor would keep sending updates on the shared channel, use a
+     * connection of its own, closed once the initial reply is read.
+     */
+    ovsdb_sync_chan_init(&chan);
+    if (ovsdb_sync_chan_send(&chan, js) >= 0)
+    {
+        jres = ovsdb_sync_chan_wait(&chan, rpc_id);
+    }
+    ovsdb_sync_chan_close(&chan, true);
+    json_decref(js);
+
+    return ovsdb_sync_result(jres, rpc_id);
+}
+
+/**
+ * Write a synchronous request to OVSDB without waiting for its reply
+ *
+ * Several requests can be queued before waiting for their results with
+ * ovsdb_method_wait_s(), in any order; monitor requests can't be queued.
+ */
+int ovsdb_method_queue_s(
+        ovsdb_mt_t mt,
+        json_t * jparams)
+{
+    json_t  *js = NULL;
+    int     rpc_id = 0;
+
+    if (mt == MT_MONITOR || mt == MT_MONITOR_COND)
+    {
+        LOGE("Sync: Monitor requests can't be queued.");
+        json_decref(jparams);
+        return -1;
+    }
+
+    js = ovsdb_sync_request(mt, jparams, &rpc_id);
+    if (js == NULL) return -1;
+
+    rpc_id = ovsdb_sync_chan_send(&ovsdb_sync_chan, js);
+    json_decref(js);
+
+    return rpc_id;
+}
+
+/**
+ * Wait for the result of a request queued by ovsdb_method_queue_s()
+ */
+json_t *ovsdb_method_wait_s(int rpc_id)
+{
+    json_t *jres;
+
+    jres = ovsdb_sync_chan_wait(&ovsdb_sync_chan, rpc_id);
+
+    return ovsdb_sync_result(jres, rpc_id);
+}
+
+/**
+ * Close the synchronous connection to OVSDB, the next call re-opens it
+ */
+void ovsdb_sync_close(void)
+{
+    ovsdb_sync_chan_close(&ovsdb_sync_chan, true);
+}
+
+/**
+ * Return the synchronous call statistics
+ */
+void ovsdb_sync_stats_get(struct ovsdb_sync_stats *stats)
+{
+    *stats = ovsdb_sync_stats;
+}
+
 /*
  * ovsdb_tran_call_s() -- synchronous replacement for ovsdb_tran_call()
  *
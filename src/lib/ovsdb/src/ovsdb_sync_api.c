@@ -25,6 +25,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <jansson.h>
 
@@ -357,6 +358,43 @@ bool ovsdb_sync_insert(const char *table, json_t *row, ovs_uuid_t *uuid)
     return ovsdb_get_insert_result_uuid(result, table, "insert", uuid);
 }
 
+// insert each row of a json array, the inserts are pipelined
+// return count of inserted rows or -1 on error
+int ovsdb_sync_insert_rows(const char *table, json_t *rows)
+{
+    json_t *row;
+    json_t *result;
+    size_t index;
+    size_t count;
+    int *ids;
+    int rc = 0;
+
+    count = json_array_size(rows);
+    if (count == 0) return 0;
+
+    ids = calloc(count, sizeof(*ids));
+    if (ids == NULL) return -1;
+
+    // write all the inserts, then collect their results
+    json_array_foreach(rows, index, row)
+    {
+        LOG(DEBUG, "Table %s insert: %s", table, json_dumps_static(row, 0));
+        ids[index] = ovsdb_method_queue_s(MT_TRANS,
+                ovsdb_tran_multi(NULL, NULL, table, OTR_INSERT, NULL, json_incref(row)));
+    }
+
+    for (index = 0; index < count; index++)
+    {
+        result = ids[index] < 0 ? NULL : ovsdb_method_wait_s(ids[index]);
+        // errors handled by:
+        if (!ovsdb_get_insert_result_uuid(result, table, "insert", NULL)) rc = -1;
+        else if (rc >= 0) rc++;
+    }
+
+    free(ids);
+    return rc;
+}
+
 
 // DELETE
 
@@ -426,20 +426,25 @@ int ovsdb_table_delete_where_with_parent(ovsdb_table_t *table, json_t *where,
 // MONITOR
 
 
-bool ovsdb_table_monitor_columns(ovsdb_table_t *table,
-        ovsdb_table_callback_t *callback, char **columns)
+// where selects the monitored rows on the server side (monitor_cond),
+// NULL monitors all rows. where is consumed.
+bool ovsdb_table_monitor_columns_where(ovsdb_table_t *table,
+        ovsdb_table_callback_t *callback, char **columns, json_t *where)
 {
     bool ret;
     int count = count_nt_array(columns);
 
     if (!columns || !count)
     {
-        LOG(NOTICE, "Monitor: %s: ALL", table->table_name);
-        ret = ovsdb_update_monitor(
+        LOG(NOTICE, "Monitor: %s: ALL%s", table->table_name, where ? " where" : "");
+        ret = ovsdb_update_monitor_where(
                 &table->monitor,
                 table->monitor_callback,
                 table->table_name,
-                OMT_ALL);
+                OMT_ALL,
+                0,
+                NULL,
+                where);
     }
     else
     {
@@ -455,13 +460,14 @@ bool ovsdb_table_monitor_columns(ovsdb_table_t *table,
                 have_version ? "true" : "false",
                 table->partial_update ? "true" : "false", count,
                 strfmt_nt_array(tmp, sizeof(tmp), columns));
-        ret = ovsdb_update_monitor_ex(
+        ret = ovsdb_update_monitor_where(
                 &table->monitor,
                 table->monitor_callback,
                 table->table_name,
                 OMT_ALL,
                 count,
-                columns);
+                columns,
+                where);
     }
     if (!ret)
     {
@@ -469,10 +475,17 @@ bool ovsdb_table_monitor_columns(ovsdb_table_t *table,
         return false;
     }
     table->monitor.mon_data = table;
+    table->monitor.mon_row_cb = table->monitor_row_callback;
     table->table_callback = callback;
     return true;
 }
 
+bool ovsdb_table_monitor_columns(ovsdb_table_t *table,
+        ovsdb_table_callback_t *callback, char **columns)
+{
+    return ovsdb_table_monitor_columns_where(table, callback, columns, NULL);
+}
+
 // ignore_version can be used if we are not interested in receiving
 // updates for when a referenced table has been modified
 bool ovsdb_table_monitor(ovsdb_table_t *table,
@@ -490,8 +503,8 @@ bool ovsdb_table_monitor(ovsdb_table_t *table,
     return ovsdb_table_monitor_columns(table, callback, columns);
 }
 
-bool ovsdb_table_monitor_filter(ovsdb_table_t *table,
-        ovsdb_table_callback_t *callback, char **filter)
+bool ovsdb_table_monitor_filter_where(ovsdb_table_t *table,
+        ovsdb_table_callback_t *callback, char **filter, json_t *where)
 {
     int schema_count = count_nt_array(table->columns);
     char *cols[schema_count + 2]; // +2: _version, NULL
@@ -518,7 +531,19 @@ bool ovsdb_table_monitor_filter(ovsdb_table_t *table,
     {
         columns = filter;
     }
-    return ovsdb_table_monitor_columns(table, callback, columns);
+    return ovsdb_table_monitor_columns_where(table, callback, columns, where);
+}
+
+bool ovsdb_table_monitor_filter(ovsdb_table_t *table,
+        ovsdb_table_callback_t *callback, char **filter)
+{
+    return ovsdb_table_monitor_filter_where(table, callback, filter, NULL);
+}
+
+// replace the row conditions of a monitor started with a where
+bool ovsdb_table_monitor_cond_change(ovsdb_table_t *table, json_t *where)
+{
+    return ovsdb_update_monitor_cond_change(&table->monitor, where);
 }
 
 void ovsdb_table_update_cb(ovsdb_update_monitor_t *self)
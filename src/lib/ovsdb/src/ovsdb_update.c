@@ -34,7 +34,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "log.h"
 #include "util.h"
 #include "json_util.h"
+#include "ds_tree.h"
 #include "ovsdb.h"
+#include "ovsdb_priv.h"
 #include "ovsdb_update.h"
 
 /*
@@ -151,11 +153,248 @@ parse_next:
 
 static ovsdb_update_process_t   ovsdb_update_monitor_call_cbk;
 static json_rpc_response_t      ovsdb_update_monitor_resp_cbk;
+static json_rpc_response_t      ovsdb_update_monitor_cond_change_cbk;
+static json_rpc_response_t      ovsdb_update_schema_cbk;
+static bool                     ovsdb_update_monitor_send(ovsdb_update_monitor_t *self);
 static void                     ovsdb_update_monitor_process(ovsdb_update_monitor_t *self, json_t *js);
+static void                     ovsdb_update_monitor_process2(ovsdb_update_monitor_t *self, json_t *js);
 static void                     ovsdb_update_monitor_error(ovsdb_update_monitor_t *self);
 
 /*
- * ovsdb_update_monitor(_ex) -- Start monitoring an OVS table. For each update to the table, call the
+ * Database schema, used to tell scalar columns from set and map columns when
+ * applying "update2" diffs. It is requested once, by the first monitor, without
+ * waiting for the answer. Monitors started in the meantime are queued and sent
+ * when the schema arrives.
+ */
+typedef enum
+{
+    OVSDB_UPDATE_SCHEMA_NONE,
+    OVSDB_UPDATE_SCHEMA_LOADING,
+    OVSDB_UPDATE_SCHEMA_LOADED,
+}
+ovsdb_update_schema_state_t;
+
+static json_t                      *ovsdb_update_schema = NULL;
+static ovsdb_update_schema_state_t  ovsdb_update_schema_state = OVSDB_UPDATE_SCHEMA_NONE;
+static ds_dlist_t                   ovsdb_update_pending = DS_DLIST_INIT(ovsdb_update_monitor_t, mon_pnode);
+
+typedef enum
+{
+    OVSDB_UPDATE_COL_SCALAR,
+    OVSDB_UPDATE_COL_SET,
+    OVSDB_UPDATE_COL_MAP,
+}
+ovsdb_update_col_t;
+
+static bool ovsdb_update_schema_request(void)
+{
+    json_t *jparams;
+
+    jparams = json_array();
+    json_array_append_new(jparams, json_string(OVSDB_DEF_DB));
+
+    if (!ovsdb_method_send(ovsdb_update_schema_cbk, NULL, MT_GET_SCHEMA, jparams))
+    {
+        LOG(NOTICE, "UPDATE: Error requesting schema, using unconditional monitors.");
+        ovsdb_update_schema_state = OVSDB_UPDATE_SCHEMA_LOADED;
+        return false;
+    }
+
+    ovsdb_update_schema_state = OVSDB_UPDATE_SCHEMA_LOADING;
+    return true;
+}
+
+void ovsdb_update_schema_cbk(int id, bool is_error, json_t *js, void *data)
+{
+    ovsdb_update_monitor_t *mon;
+
+    (void)data;
+
+    if (is_error || !json_is_object(json_object_get(js, "tables")))
+    {
+        LOG(NOTICE, "UPDATE: Schema not available, using unconditional monitors (rpc_id = %d).", id);
+    }
+    else
+    {
+        ovsdb_update_schema = json_incref(json_object_get(js, "tables"));
+    }
+    ovsdb_update_schema_state = OVSDB_UPDATE_SCHEMA_LOADED;
+
+    while ((mon = ds_dlist_remove_head(&ovsdb_update_pending)) != NULL)
+    {
+        mon->mon_pending = false;
+        if (!ovsdb_update_monitor_send(mon))
+        {
+            ovsdb_update_monitor_error(mon);
+        }
+    }
+}
+
+/*
+ * Columns holding at most one element are sent as the new value, maps
+ * included. Only sets and maps of more than one element are sent as a
+ * difference.
+ */
+static ovsdb_update_col_t ovsdb_update_col_type(const char *table, const char *column)
+{
+    json_t *jtype;
+    json_t *jmax;
+
+    jtype = json_object_get(json_object_get(json_object_get(
+            json_object_get(ovsdb_update_schema, table), "columns"), column), "type");
+
+    /* Atomic types and columns missing from the schema (_version) are scalars */
+    if (!json_is_object(jtype)) return OVSDB_UPDATE_COL_SCALAR;
+
+    jmax = json_object_get(jtype, "max");
+    if (jmax == NULL || (json_is_integer(jmax) && json_integer_value(jmax) == 1))
+    {
+        return OVSDB_UPDATE_COL_SCALAR;
+    }
+
+    if (json_object_get(jtype, "value") != NULL) return OVSDB_UPDATE_COL_MAP;
+
+    return OVSDB_UPDATE_COL_SET;
+}
+
+/*
+ * Return the elements of a set value as a new reference to an array. A set of
+ * one element is sent as the bare atom.
+ */
+static json_t *ovsdb_update_set_elems(json_t *jval)
+{
+    json_t *jelems;
+
+    if (json_is_array(jval) && json_array_size(jval) == 2 &&
+            json_is_string(json_array_get(jval, 0)) &&
+            strcmp(json_string_value(json_array_get(jval, 0)), "set") == 0)
+    {
+        return json_incref(json_array_get(jval, 1));
+    }
+
+    jelems = json_array();
+    if (jval != NULL) json_array_append(jelems, jval);
+
+    return jelems;
+}
+
+static bool ovsdb_update_set_has(json_t *jelems, json_t *jelem)
+{
+    size_t ii;
+
+    for (ii = 0; ii < json_array_size(jelems); ii++)
+    {
+        if (json_equal(json_array_get(jelems, ii), jelem)) return true;
+    }
+
+    return false;
+}
+
+/*
+ * A set diff holds the elements that were either added or removed
+ */
+static json_t *ovsdb_update_apply_set(json_t *jcur, json_t *jdiff)
+{
+    json_t *jcelems;
+    json_t *jdelems;
+    json_t *jelems;
+    json_t *jset;
+    size_t ii;
+
+    jcelems = ovsdb_update_set_elems(jcur);
+    jdelems = ovsdb_update_set_elems(jdiff);
+    jelems = json_array();
+
+    for (ii = 0; ii < json_array_size(jcelems); ii++)
+    {
+        if (ovsdb_update_set_has(jdelems, json_array_get(jcelems, ii))) continue;
+        json_array_append(jelems, json_array_get(jcelems, ii));
+    }
+
+    for (ii = 0; ii < json_array_size(jdelems); ii++)
+    {
+        if (ovsdb_update_set_has(jcelems, json_array_get(jdelems, ii))) continue;
+        json_array_append(jelems, json_array_get(jdelems, ii));
+    }
+
+    json_decref(jcelems);
+    json_decref(jdelems);
+
+    if (json_array_size(jelems) == 1)
+    {
+        jset = json_incref(json_array_get(jelems, 0));
+        json_decref(jelems);
+        return jset;
+    }
+
+    jset = json_array();
+    json_array_append_new(jset, json_string("set"));
+    json_array_append_new(jset, jelems);
+
+    return jset;
+}
+
+/*
+ * A map diff holds added pairs, removed pairs with their current value and
+ * updated keys with their new value
+ */
+static json_t *ovsdb_update_apply_map(json_t *jcur, json_t *jdiff)
+{
+    json_t *jpairs;
+    json_t *jpair;
+    json_t *jdpairs;
+    json_t *jdpair;
+    json_t *jmap;
+    size_t ii;
+    size_t jj;
+
+    jpairs = json_array();
+    if (json_is_array(jcur) && json_is_array(json_array_get(jcur, 1)))
+    {
+        json_array_extend(jpairs, json_array_get(jcur, 1));
+    }
+
+    jdpairs = json_array_get(jdiff, 1);
+    for (ii = 0; ii < json_array_size(jdpairs); ii++)
+    {
+        jdpair = json_array_get(jdpairs, ii);
+
+        for (jj = 0; jj < json_array_size(jpairs); jj++)
+        {
+            jpair = json_array_get(jpairs, jj);
+            if (json_equal(json_array_get(jpair, 0), json_array_get(jdpair, 0))) break;
+        }
+
+        if (jj >= json_array_size(jpairs))
+        {
+            json_array_append(jpairs, jdpair);
+        }
+        else if (json_equal(json_array_get(jpair, 1), json_array_get(jdpair, 1)))
+        {
+            json_array_remove(jpairs, jj);
+        }
+        else
+        {
+            json_array_set(jpairs, jj, jdpair);
+        }
+    }
+
+    jmap = json_array();
+    json_array_append_new(jmap, json_string("map"));
+    json_array_append_new(jmap, jpairs);
+
+    return jmap;
+}
+
+static void ovsdb_update_row_free(ovsdb_update_row_t *row)
+{
+    json_decref(row->ur_row);
+    free(row->ur_uuid);
+    free(row);
+}
+
+/*
+ * ovsdb_update_monitor(_ex/_where) -- Start monitoring an OVS table. For each update to the table, call the
  * callback function.
  *
  * Parameters:
@@ -166,46 +405,137 @@ static void                     ovsdb_update_monitor_error(ovsdb_update_monitor_
  *      mon_flags   -- monitor flags if 0, OTM_ALL is assumed
  *      colc        -- number of columns in colv array, can be 0
  *      colv        -- array of selected columns to be monitored, can be NULL if colc is also 0
+ *      where       -- conditions selecting the monitored rows, can be NULL
  *
  * The problem with OVS updates is that "initial" requests are actual respones
  * to the monitor RPC requests, while insert/modify/delete update notifications
  * are JSON RPC calls from OVS to us! In order to handle all 4 types, we must
  * handle both the monitor RPC response and update RPC call!
+ *
+ * Monitors are conditional (monitor_cond) when the server supports it, rows are
+ * then filtered by the server and modifications only carry what changed. This
+ * is known from the schema, requested by the first monitor. Monitors started
+ * before it arrives are sent from its response, the call does not block.
  */
-bool ovsdb_update_monitor_ex(
+bool ovsdb_update_monitor_where(
         ovsdb_update_monitor_t *self,
         ovsdb_update_cbk_t *callback,
         char *mon_table,
         int mon_flags,
         int colc,
-        char *colv[])
+        char *colv[],
+        json_t *where)
 {
+    int ii;
+
     /* Initialize the ovsdb_update_t structure */
     memset(self, 0, sizeof(*self));
     self->mon_cb = callback;
+    ds_tree_init(&self->mon_rows, ds_str_cmp, ovsdb_update_row_t, ur_node);
+
+    /* Keep the request, to fall back to a plain monitor if monitor_cond is refused */
+    self->mon_tname = strdup(mon_table);
+    self->mon_flags = mon_flags;
+    self->mon_colc = colc;
+    self->mon_colv = calloc(colc + 1, sizeof(*self->mon_colv));
+    if (self->mon_tname == NULL || self->mon_colv == NULL)
+    {
+        LOG(ERR, "UPDATE: Error allocating monitor request.");
+        json_decref(where);
+        return false;
+    }
+    for (ii = 0; ii < colc; ii++)
+    {
+        self->mon_colv[ii] = strdup(colv[ii]);
+    }
 
     /* Regiter update handler */
-    int monid = ovsdb_register_update_cb(
+    self->mon_id = ovsdb_register_update_cb(
             ovsdb_update_monitor_call_cbk,
             self);
 
-    if (!ovsdb_monit_call_argv(
-            ovsdb_update_monitor_resp_cbk,
-            self,
-            monid,
-            mon_table,
-            mon_flags,
-            colc,
-            colv))
+    /* Conditions are sent with the request, once it is known if they are supported */
+    self->mon_where = where;
+
+    if (ovsdb_update_schema_state == OVSDB_UPDATE_SCHEMA_NONE)
+    {
+        ovsdb_update_schema_request();
+    }
+
+    if (ovsdb_update_schema_state == OVSDB_UPDATE_SCHEMA_LOADING)
+    {
+        LOG(INFO, "OVSDB monitor %s, waiting for schema", mon_table);
+        self->mon_pending = true;
+        ds_dlist_insert_tail(&ovsdb_update_pending, self);
+        return true;
+    }
+
+    return ovsdb_update_monitor_send(self);
+}
+
+/*
+ * Send the monitor request, conditional if the schema is available
+ */
+bool ovsdb_update_monitor_send(ovsdb_update_monitor_t *self)
+{
+    json_t *where;
+    bool ret;
+
+    where = self->mon_where;
+    self->mon_where = NULL;
+
+    self->mon_cond = (ovsdb_update_schema != NULL);
+    if (self->mon_cond)
+    {
+        ret = ovsdb_monit_cond_call_argv(
+                ovsdb_update_monitor_resp_cbk,
+                self,
+                self->mon_id,
+                self->mon_tname,
+                self->mon_flags,
+                self->mon_colc,
+                self->mon_colv,
+                where);
+    }
+    else
+    {
+        if (where != NULL)
+        {
+            LOG(WARN, "UPDATE: %s: monitor conditions not supported, monitoring all rows.", self->mon_tname);
+            json_decref(where);
+        }
+
+        ret = ovsdb_monit_call_argv(
+                ovsdb_update_monitor_resp_cbk,
+                self,
+                self->mon_id,
+                self->mon_tname,
+                self->mon_flags,
+                self->mon_colc,
+                self->mon_colv);
+    }
+
+    if (!ret)
     {
         LOG(ERR, "UPDATE: Error sending monitor request.");
         return false;
     }
-    LOG(INFO, "OVSDB monitor %s", mon_table);
+    LOG(INFO, "OVSDB monitor%s %s", self->mon_cond ? "_cond" : "", self->mon_tname);
 
     return true;
 }
 
+bool ovsdb_update_monitor_ex(
+        ovsdb_update_monitor_t *self,
+        ovsdb_update_cbk_t *callback,
+        char *mon_table,
+        int mon_flags,
+        int colc,
+        char *colv[])
+{
+    return ovsdb_update_monitor_where(self, callback, mon_table, mon_flags, colc, colv, NULL);
+}
+
 /*
  * Shorthand wrapper around ovsb_update_monitor_ex() -- see that function for explanation of parameters.
  */
@@ -218,6 +548,40 @@ bool ovsdb_update_monitor(
     return ovsdb_update_monitor_ex(self, callback, table, monit_flags, 0, NULL);
 }
 
+bool ovsdb_update_monitor_cond_change(
+        ovsdb_update_monitor_t *self,
+        json_t *where)
+{
+    /* Not sent yet, the new conditions go with the request */
+    if (self->mon_pending)
+    {
+        json_decref(self->mon_where);
+        self->mon_where = where;
+        return true;
+    }
+
+    if (!self->mon_cond)
+    {
+        LOG(ERR, "UPDATE: %s: monitor is not conditional, can't change conditions.",
+                self->mon_tname != NULL ? self->mon_tname : "(none)");
+        json_decref(where);
+        return false;
+    }
+
+    if (!ovsdb_monit_cond_change_call(
+            ovsdb_update_monitor_cond_change_cbk,
+            self,
+            self->mon_id,
+            self->mon_tname,
+            where))
+    {
+        LOG(ERR, "UPDATE: Error sending monitor condition change request.");
+        return false;
+    }
+
+    return true;
+}
+
 /*
  * This is the callback for ovsdb_register_update_cb()
  */
@@ -228,10 +592,11 @@ void ovsdb_update_monitor_call_cbk(int id, json_t *js, void *data)
     const char  *method;
     json_t      *jparams;
     json_t      *jtable;
+    bool        update2;
 
     ovsdb_update_monitor_t *self = data;
 
-    /* Check if the "method" is really "update" */
+    /* Check if the "method" is really "update" or "update2" */
     method = json_string_value(json_object_get(js, "method"));
     if (method == NULL)
     {
@@ -239,8 +604,8 @@ void ovsdb_update_monitor_call_cbk(int id, json_t *js, void *data)
         goto error;
     }
 
-
-    if (strcmp(method, "update") != 0)
+    update2 = (strcmp(method, "update2") == 0);
+    if (strcmp(method, "update") != 0 && !update2)
     {
         LOG(ERR, "UPDATE: Method is not \"update\": method=%s", method);
         goto error;
@@ -264,7 +629,14 @@ void ovsdb_update_monitor_call_cbk(int id, json_t *js, void *data)
     /* Initialize the object iterator for the 2nd argument in the list */
     jtable = json_array_get(jparams, 1);
 
-    ovsdb_update_monitor_process(self, jtable);
+    if (update2)
+    {
+        ovsdb_update_monitor_process2(self, jtable);
+    }
+    else
+    {
+        ovsdb_update_monitor_process(self, jtable);
+    }
     return;
 
 error:
@@ -280,6 +652,24 @@ void ovsdb_update_monitor_resp_cbk(int id, bool is_error, json_t *js, void *data
 
     ovsdb_update_monitor_t *self = data;
 
+    /* Older servers don't know monitor_cond, retry with a plain monitor */
+    if (is_error && self->mon_cond)
+    {
+        LOG(NOTICE, "UPDATE: %s: monitor_cond refused, monitoring all rows.", self->mon_tname);
+        self->mon_cond = false;
+        if (ovsdb_monit_call_argv(
+                ovsdb_update_monitor_resp_cbk,
+                self,
+                self->mon_id,
+                self->mon_tname,
+                self->mon_flags,
+                self->mon_colc,
+                self->mon_colv))
+        {
+            return;
+        }
+    }
+
     /* Pass down any errors we might have received */
     if (is_error)
     {
@@ -289,7 +679,87 @@ void ovsdb_update_monitor_resp_cbk(int id, bool is_error, json_t *js, void *data
     }
 
     /* Process the message */
-    ovsdb_update_monitor_process(self, js);
+    if (self->mon_cond)
+    {
+        ovsdb_update_monitor_process2(self, js);
+    }
+    else
+    {
+        ovsdb_update_monitor_process(self, js);
+    }
+}
+
+void ovsdb_update_monitor_cond_change_cbk(int id, bool is_error, json_t *js, void *data)
+{
+    ovsdb_update_monitor_t *self = data;
+
+    if (is_error)
+    {
+        LOG(ERR, "UPDATE: %s: monitor condition change failed (rpc_id = %d): %s",
+                self->mon_tname, id, json_dumps_static(js, 0));
+    }
+}
+
+/*
+ * Deliver the current update to the monitor callback
+ */
+static void ovsdb_update_monitor_notify(ovsdb_update_monitor_t *self)
+{
+    /*
+     * Somebody thought it would be a good idea to skip on the _uuid fields,
+     * as we already have it as the key. Our parser was modified to handle this
+     * special case. However, in order to avoid copying the uuid to the structure
+     * each time, we insert it here. This way the parser will take care of it
+     * for us.
+     */
+    json_t *juuid = json_array();
+    if (juuid == NULL)
+    {
+        LOG(ERR, "UPDATE: Error creating array for UUID.");
+        return;
+    }
+
+    do
+    {
+        /*
+         * The UUID is an array, where the first element is the "uuid" string and the second element
+         * is the actual uuid.
+         */
+        if (json_array_append_new(juuid, json_string("uuid")) != 0)
+        {
+            LOG(ERR, "UPDATE: Error appending string \"uuid\"");
+            break;
+        }
+
+        if (json_array_append_new(juuid, json_string(self->mon_uuid)) != 0)
+        {
+            LOG(ERR, "UPDATE: Error appending UUID.");
+            break;
+        }
+
+        if (self->mon_json_new != NULL)
+        {
+            if (json_object_set(self->mon_json_new, "_uuid", juuid) != 0)
+            {
+                LOG(ERR, "UPDATE: Error appending UUID to NEW.");
+                break;
+            }
+        }
+
+        if (self->mon_json_old != NULL)
+        {
+            if (json_object_set(self->mon_json_old, "_uuid", juuid) != 0)
+            {
+                LOG(ERR, "UPDATE: Error appending UUID to OLD.");
+                break;
+            }
+        }
+
+        self->mon_cb(self);
+    }
+    while (false);
+
+    json_decref(juuid);
 }
 
 /*
@@ -330,64 +800,176 @@ void ovsdb_update_monitor_process(ovsdb_update_monitor_t *self, json_t *js)
             self->mon_type = OVSDB_UPDATE_DEL;
         }
 
-        /*
-         * Somebody thought it would be a good idea to skip on the _uuid fields,
-         * as we already have it as the key. Our parser was modified to handle this
-         * special case. However, in order to avoid copying the uuid to the structure
-         * each time, we insert it here. This way the parser will take care of it
-         * for us.
-         */
-        json_t *juuid = json_array();
-        if (juuid == NULL)
+        ovsdb_update_monitor_notify(self);
+    }
+}
+
+/*
+ * Apply an "update2" row modification to the current row, return the old
+ * values of the modified columns
+ */
+static json_t *ovsdb_update_row_modify(const char *table, json_t *jrow, json_t *jdiff)
+{
+    const char *column;
+    json_t *jold;
+    json_t *jcur;
+    json_t *jval;
+    json_t *jnew;
+
+    jold = json_object();
+
+    json_object_foreach(jdiff, column, jval)
+    {
+        jcur = json_object_get(jrow, column);
+        if (jcur != NULL) json_object_set(jold, column, jcur);
+
+        switch (ovsdb_update_col_type(table, column))
         {
-            LOG(ERR, "UPDATE: Error creating array for UUID.");
-            continue;
+            case OVSDB_UPDATE_COL_SET:
+                jnew = ovsdb_update_apply_set(jcur, jval);
+                break;
+
+            case OVSDB_UPDATE_COL_MAP:
+                jnew = ovsdb_update_apply_map(jcur, jval);
+                break;
+
+            default:
+                jnew = json_incref(jval);
+                break;
         }
 
-        do
+        json_object_set_new(jrow, column, jnew);
+    }
+
+    return jold;
+}
+
+/*
+ * Process an update2 request, in the following format:
+ *
+ * "TABLE" :
+ * {
+ *      "UUID":
+ *      {
+ *          "initial" | "insert" : { ...full row... },
+ *          "modify": { ...changed columns, set and map differences... },
+ *          "delete": null
+ *      }
+ * }
+ */
+void ovsdb_update_monitor_process2(ovsdb_update_monitor_t *self, json_t *js)
+{
+    ovsdb_update_row_t *row;
+    const char *table;
+    const char *uuid;
+    const char *op;
+    json_t *jrows;
+    json_t *jdata;
+    json_t *jval;
+    json_t *jrow;
+
+    if (!json_is_object(js))
+    {
+        LOG(ERR, "UPDATE: Update2 notification is not an object.");
+        ovsdb_update_monitor_error(self);
+        return;
+    }
+
+    json_object_foreach(js, table, jrows)
+    {
+        json_object_foreach(jrows, uuid, jdata)
         {
-            /*
-             * The UUID is an array, where the first element is the "uuid" string and the second element
-             * is the actual uuid.
-             */
-            if (json_array_append_new(juuid, json_string("uuid")) != 0)
+            op = json_object_iter_key(json_object_iter(jdata));
+            jval = json_object_iter_value(json_object_iter(jdata));
+            if (op == NULL)
             {
-                LOG(ERR, "UPDATE: Error appending string \"uuid\"");
-                break;
+                LOG(ERR, "UPDATE: %s: Row %s update is empty.", table, uuid);
+                continue;
             }
 
-            if (json_array_append_new(juuid, json_string(self->mon_uuid)) != 0)
+            /* Rows are kept here unless the owner of the monitor keeps them already */
+            row = NULL;
+            jrow = NULL;
+            if (self->mon_row_cb != NULL)
             {
-                LOG(ERR, "UPDATE: Error appending UUID.");
-                break;
+                if (strcmp(op, "modify") == 0 || strcmp(op, "delete") == 0)
+                {
+                    jrow = self->mon_row_cb(self, uuid);
+                }
+            }
+            else
+            {
+                row = ds_tree_find(&self->mon_rows, (void *)uuid);
+                if (row != NULL) jrow = json_incref(row->ur_row);
             }
 
-            if (self->mon_json_new != NULL)
+            self->mon_table = table;
+            self->mon_uuid = uuid;
+            self->mon_json_old = NULL;
+            self->mon_json_new = NULL;
+
+            if (strcmp(op, "initial") == 0 || strcmp(op, "insert") == 0)
             {
-                if (json_object_set(self->mon_json_new, "_uuid", juuid) != 0)
+                if (self->mon_row_cb == NULL)
                 {
-                    LOG(ERR, "UPDATE: Error appending UUID to NEW.");
-                    break;
+                    if (row == NULL)
+                    {
+                        row = calloc(1, sizeof(*row));
+                        row->ur_uuid = strdup(uuid);
+                        ds_tree_insert(&self->mon_rows, row, row->ur_uuid);
+                    }
+                    json_decref(row->ur_row);
+                    row->ur_row = json_incref(jval);
                 }
+
+                self->mon_type = OVSDB_UPDATE_NEW;
+                self->mon_json_new = jval;
+                ovsdb_update_monitor_notify(self);
             }
+            else if (strcmp(op, "modify") == 0)
+            {
+                if (jrow == NULL)
+                {
+                    LOG(ERR, "UPDATE: %s: Modified row %s is unknown.", table, uuid);
+                    continue;
+                }
 
-            if (self->mon_json_old != NULL)
+                self->mon_type = OVSDB_UPDATE_MODIFY;
+                self->mon_json_old = ovsdb_update_row_modify(table, jrow, jval);
+                self->mon_json_new = jrow;
+                ovsdb_update_monitor_notify(self);
+                json_decref(self->mon_json_old);
+            }
+            else if (strcmp(op, "delete") == 0)
             {
-                if (json_object_set(self->mon_json_old, "_uuid", juuid) != 0)
+                if (jrow == NULL)
+                {
+                    LOG(ERR, "UPDATE: %s: Deleted row %s is unknown.", table, uuid);
+                    continue;
+                }
+
+                if (row != NULL)
                 {
-                    LOG(ERR, "UPDATE: Error appending UUID to OLD.");
-                    break;
+                    ds_tree_remove(&self->mon_rows, row);
+                    ovsdb_update_row_free(row);
                 }
+
+                self->mon_type = OVSDB_UPDATE_DEL;
+                self->mon_json_old = jrow;
+                ovsdb_update_monitor_notify(self);
+            }
+            else
+            {
+                LOG(ERR, "UPDATE: %s: Row %s unknown update %s.", table, uuid, op);
             }
 
-            self->mon_cb(self);
+            json_decref(jrow);
         }
-        while (false);
-
-        json_decref(juuid);
     }
-}
 
+    self->mon_json_old = NULL;
+    self->mon_json_new = NULL;
+}
 
 void ovsdb_update_monitor_error(ovsdb_update_monitor_t *self)
 {
@@ -0,0 +1,266 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define sleep                           test_sleep
+#define ovsdb_conn                      test_ovsdb_conn
+
+#include "ovsdb.c"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "unity.h"
+
+#define TEST_READ_BIG (100*1024)
+
+/*
+ * The reader is fed from one end of a socket pair, cb_ovsdb_read() is called
+ * directly, once per received chunk.
+ */
+static int g_rd_mon_id;
+
+static struct
+{
+    int fd[2];
+    size_t msg_hlen;
+    int updates;
+    size_t update_len;
+    int conn_calls;
+} g_rd;
+
+
+unsigned int
+test_sleep(unsigned int seconds)
+{
+    return 0;
+}
+
+int
+test_ovsdb_conn(void)
+{
+    g_rd.conn_calls++;
+    return -1;
+}
+
+static void
+test_read_update_cb(int id, json_t *js, void *data)
+{
+    json_t *jpad;
+
+    TEST_ASSERT_EQUAL_INT(g_rd_mon_id, id);
+    jpad = json_object_get(json_array_get(json_object_get(js, "params"), 1), "pad");
+    g_rd.update_len = json_string_length(jpad);
+    g_rd.updates++;
+}
+
+/**
+ * @brief builds an "update" notification of exactly len bytes
+ */
+static char *
+test_read_msg(size_t len)
+{
+    char head[64];
+    char *msg;
+
+    g_rd.msg_hlen = snprintf(head, sizeof(head),
+                             "{\"id\":null,\"method\":\"update\",\"params\":[%d,{\"pad\":\"",
+                             g_rd_mon_id);
+    TEST_ASSERT_TRUE(len > g_rd.msg_hlen + 4);
+
+    msg = malloc(len + 1);
+    TEST_ASSERT_NOT_NULL(msg);
+    memcpy(msg, head, g_rd.msg_hlen);
+    memset(msg + g_rd.msg_hlen, 'x', len - g_rd.msg_hlen - 4);
+    strcpy(msg + len - 4, "\"}]}");
+
+    return msg;
+}
+
+static void
+test_read_send(const char *data, size_t len)
+{
+    TEST_ASSERT_EQUAL_INT((ssize_t)len, write(g_rd.fd[1], data, len));
+}
+
+static void
+test_read_once(void)
+{
+    cb_ovsdb_read(ev_default_loop(0), &wovsdb, EV_READ);
+}
+
+static void
+test_read_start(void)
+{
+    memset(&g_rd, 0, sizeof(g_rd));
+
+    /* Reader state, possibly left over by a failed test */
+    free(ovs_buffer);
+    ovs_buffer = NULL;
+    ovs_buffer_size = 0;
+    ovs_buffer_head = 0;
+    ovs_buffer_len = 0;
+    json_split_init(&ovs_split);
+    ovsdb_set_buffer_max(0);
+
+    TEST_ASSERT_EQUAL_INT(0, socketpair(AF_UNIX, SOCK_STREAM, 0, g_rd.fd));
+    TEST_ASSERT_EQUAL_INT(0, fcntl(g_rd.fd[0], F_SETFL, O_NONBLOCK));
+
+    ev_io_init(&wovsdb, cb_ovsdb_read, g_rd.fd[0], EV_READ);
+}
+
+static void
+test_read_stop(void)
+{
+    if (g_rd.fd[0] >= 0) close(g_rd.fd[0]);
+    close(g_rd.fd[1]);
+    ovsdb_set_buffer_max(0);
+}
+
+/**
+ * @brief processed messages are dropped when the free space gets low
+ */
+void test_read_compact(void)
+{
+    char *a;
+    char *b;
+
+    test_read_start();
+    a = test_read_msg(6000);
+    b = test_read_msg(4000);
+
+    /* A and the start of B */
+    test_read_send(a, 6000);
+    test_read_send(b, 1500);
+    test_read_once();
+    TEST_ASSERT_EQUAL_INT(1, g_rd.updates);
+    TEST_ASSERT_EQUAL_INT(CHUNK_SIZE, ovs_buffer_size);
+    TEST_ASSERT_EQUAL_INT(6000, ovs_buffer_head);
+    TEST_ASSERT_EQUAL_INT(7500, ovs_buffer_len);
+
+    /* B is still incomplete, A is dropped before reading */
+    test_read_send(b + 1500, 1000);
+    test_read_once();
+    TEST_ASSERT_EQUAL_INT(1, g_rd.updates);
+    TEST_ASSERT_EQUAL_INT(0, ovs_buffer_head);
+    TEST_ASSERT_EQUAL_INT(2500, ovs_buffer_len);
+    TEST_ASSERT_EQUAL_MEMORY(b, ovs_buffer, 2500);
+
+    /* Rest of B, the buffer is released once consumed */
+    test_read_send(b + 2500, 1500);
+    test_read_once();
+    TEST_ASSERT_EQUAL_INT(2, g_rd.updates);
+    TEST_ASSERT_EQUAL_INT(4000 - g_rd.msg_hlen - 4, g_rd.update_len);
+    TEST_ASSERT_NULL(ovs_buffer);
+    TEST_ASSERT_EQUAL_INT(0, ovs_buffer_size);
+    TEST_ASSERT_EQUAL_INT(0, ovs_buffer_head);
+    TEST_ASSERT_EQUAL_INT(0, ovs_buffer_len);
+
+    free(a);
+    free(b);
+    test_read_stop();
+}
+
+/**
+ * @brief the buffer is doubled until a large message fits
+ */
+void test_read_grow(void)
+{
+    size_t size;
+    char *msg;
+
+    test_read_start();
+    msg = test_read_msg(TEST_READ_BIG);
+    test_read_send(msg, TEST_READ_BIG);
+
+    for (size = CHUNK_SIZE; size < TEST_READ_BIG; size *= 2)
+    {
+        test_read_once();
+        TEST_ASSERT_EQUAL_INT(0, g_rd.updates);
+        TEST_ASSERT_EQUAL_INT(size, ovs_buffer_size);
+        TEST_ASSERT_EQUAL_INT(size, ovs_buffer_len);
+    }
+
+    test_read_once();
+    TEST_ASSERT_EQUAL_INT(1, g_rd.updates);
+    TEST_ASSERT_EQUAL_INT(TEST_READ_BIG - g_rd.msg_hlen - 4, g_rd.update_len);
+    TEST_ASSERT_NULL(ovs_buffer);
+    TEST_ASSERT_EQUAL_INT(0, ovs_buffer_size);
+    TEST_ASSERT_EQUAL_INT(0, ovs_buffer_len);
+
+    /* Nothing left to read */
+    test_read_once();
+    TEST_ASSERT_EQUAL_INT(1, g_rd.updates);
+    TEST_ASSERT_EQUAL_INT(0, g_rd.conn_calls);
+
+    free(msg);
+    test_read_stop();
+}
+
+/**
+ * @brief a message larger than the buffer limit closes the connection
+ */
+void test_read_buffer_max(void)
+{
+    char *msg;
+
+    test_read_start();
+    ovsdb_set_buffer_max(3 * CHUNK_SIZE);
+    msg = test_read_msg(5 * CHUNK_SIZE);
+    test_read_send(msg, 5 * CHUNK_SIZE);
+
+    /* Doubled up to the limit */
+    test_read_once();
+    test_read_once();
+    test_read_once();
+    TEST_ASSERT_EQUAL_INT(3 * CHUNK_SIZE, ovs_buffer_size);
+    TEST_ASSERT_EQUAL_INT(3 * CHUNK_SIZE, ovs_buffer_len);
+    TEST_ASSERT_EQUAL_INT(0, g_rd.conn_calls);
+
+    /* Buffer full, the connection is dropped and retried */
+    test_read_once();
+    TEST_ASSERT_EQUAL_INT(0, g_rd.updates);
+    TEST_ASSERT_NULL(ovs_buffer);
+    TEST_ASSERT_EQUAL_INT(0, ovs_buffer_size);
+    TEST_ASSERT_EQUAL_INT(0, ovs_buffer_len);
+    TEST_ASSERT_EQUAL_INT(-1, fcntl(g_rd.fd[0], F_GETFD));
+    TEST_ASSERT_EQUAL_INT(3, g_rd.conn_calls);
+
+    free(msg);
+    g_rd.fd[0] = -1;
+    test_read_stop();
+}
+
+
+void
+run_test_ovsdb_read(void)
+{
+    g_rd_mon_id = ovsdb_register_update_cb(test_read_update_cb, NULL);
+    ovsdb_comment = "TEST";
+
+    RUN_TEST(test_read_compact);
+    RUN_TEST(test_read_grow);
+    RUN_TEST(test_read_buffer_max);
+}
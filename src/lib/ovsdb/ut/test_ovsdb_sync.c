@@ -0,0 +1,583 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <jansson.h>
+
+#include "os_socket.h"
+#include "ovsdb.h"
+#include "ovsdb_sync.h"
+#include "json_util.h"
+#include "log.h"
+#include "unity.h"
+
+/*
+ * The synchronous calls are tested against a fake OVSDB server, running in a
+ * forked child and listening on the socket given by ENV_OVSDB_SOCK_PATH.
+ */
+
+typedef bool sync_srv_fn_t(int lfd);
+
+static char sync_srv_path[64];
+static pid_t sync_srv_pid;
+
+/**
+ * Read one JSON-RPC message, byte by byte, from a client
+ */
+static json_t *sync_srv_recv(int fd)
+{
+    static char buf[256 * 1024];
+    bool in_str = false;
+    bool esc = false;
+    size_t len = 0;
+    int depth = 0;
+    char c;
+
+    while (len < sizeof(buf))
+    {
+        if (read(fd, &c, 1) != 1) return NULL;
+        buf[len++] = c;
+
+        if (in_str)
+        {
+            if (esc) esc = false;
+            else if (c == '\\') esc = true;
+            else if (c == '"') in_str = false;
+        }
+        else if (c == '"') in_str = true;
+        else if (c == '{') depth++;
+        else if (c == '}' && --depth == 0) return json_loadb(buf, len, 0, NULL);
+    }
+
+    return NULL;
+}
+
+static bool sync_srv_send(int fd, const char *str)
+{
+    size_t len = strlen(str);
+
+    return write(fd, str, len) == (ssize_t)len;
+}
+
+/**
+ * Reply to a request with its own params as the result
+ */
+static bool sync_srv_reply(int fd, json_t *req)
+{
+    json_t *reply;
+    bool rc;
+
+    reply = json_pack("{s:O, s:O, s:n}",
+                      "id", json_object_get(req, "id"),
+                      "result", json_object_get(req, "params"),
+                      "error");
+    if (reply == NULL) return false;
+
+    rc = sync_srv_send(fd, json_dumps_static(reply, JSON_COMPACT));
+    json_decref(reply);
+
+    return rc;
+}
+
+/**
+ * Receive a request and reply to it
+ */
+static bool sync_srv_echo(int fd)
+{
+    json_t *req;
+    bool rc;
+
+    req = sync_srv_recv(fd);
+    if (req == NULL) return false;
+
+    rc = sync_srv_reply(fd, req);
+    json_decref(req);
+
+    return rc;
+}
+
+static void sync_srv_start(sync_srv_fn_t *fn)
+{
+    struct sockaddr_un addr;
+    int lfd;
+
+    snprintf(sync_srv_path, sizeof(sync_srv_path), "/tmp/test_ovsdb_sync.%d", (int)getpid());
+    unlink(sync_srv_path);
+
+    lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    TEST_ASSERT_TRUE(lfd >= 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sync_srv_path);
+    TEST_ASSERT_EQUAL_INT(0, bind(lfd, (struct sockaddr *)&addr, sizeof(addr)));
+    TEST_ASSERT_EQUAL_INT(0, listen(lfd, 4));
+
+    setenv(ENV_OVSDB_SOCK_PATH, sync_srv_path, 1);
+
+    sync_srv_pid = fork();
+    TEST_ASSERT_TRUE(sync_srv_pid >= 0);
+    if (sync_srv_pid == 0)
+    {
+        signal(SIGPIPE, SIG_IGN);
+        _exit(fn(lfd) ? 0 : 1);
+    }
+
+    close(lfd);
+}
+
+/**
+ * Close the client connection and check the fake server was happy
+ */
+static void sync_srv_stop(void)
+{
+    int status;
+
+    ovsdb_sync_close();
+
+    TEST_ASSERT_EQUAL_INT(sync_srv_pid, waitpid(sync_srv_pid, &status, 0));
+    unlink(sync_srv_path);
+
+    TEST_ASSERT_TRUE(WIFEXITED(status));
+    TEST_ASSERT_EQUAL_INT(0, WEXITSTATUS(status));
+}
+
+static json_t *sync_call(const char *str)
+{
+    return ovsdb_method_send_s(MT_ECHO, json_pack("[s]", str));
+}
+
+static void sync_check(const char *str)
+{
+    json_t *res;
+
+    res = sync_call(str);
+    TEST_ASSERT_NOT_NULL(res);
+    TEST_ASSERT_EQUAL_STRING(str, json_string_value(json_array_get(res, 0)));
+    json_decref(res);
+}
+
+/*
+ * Several calls share one connection
+ */
+static bool srv_reuse(int lfd)
+{
+    int fd;
+    int i;
+
+    fd = accept(lfd, NULL, NULL);
+    if (fd < 0) return false;
+
+    for (i = 0; i < 3; i++)
+    {
+        if (!sync_srv_echo(fd)) return false;
+    }
+
+    /* The client closes the connection */
+    return sync_srv_recv(fd) == NULL;
+}
+
+void test_sync_reuse(void)
+{
+    struct ovsdb_sync_stats before;
+    struct ovsdb_sync_stats after;
+
+    ovsdb_sync_stats_get(&before);
+
+    sync_srv_start(srv_reuse);
+    sync_check("one");
+    sync_check("two");
+    sync_check("three");
+    sync_srv_stop();
+
+    ovsdb_sync_stats_get(&after);
+    TEST_ASSERT_EQUAL_UINT64(before.connects + 1, after.connects);
+    TEST_ASSERT_EQUAL_UINT64(before.calls + 3, after.calls);
+    TEST_ASSERT_EQUAL_UINT64(before.errors, after.errors);
+    TEST_ASSERT_TRUE(after.lat_min_us <= after.lat_max_us);
+}
+
+/*
+ * The server pings the client before a large reply, written in pieces
+ */
+static bool srv_echo_split(int lfd)
+{
+    json_t *reply;
+    json_t *req;
+    char *str;
+    size_t len;
+    size_t off;
+    int fd;
+
+    fd = accept(lfd, NULL, NULL);
+    if (fd < 0) return false;
+
+    req = sync_srv_recv(fd);
+    if (req == NULL) return false;
+
+    if (!sync_srv_send(fd, "{\"method\":\"echo\",\"id\":\"ping\",\"params\":[\"x\"]}")) return false;
+
+    reply = sync_srv_recv(fd);
+    if (reply == NULL) return false;
+    if (strcmp(json_string_value(json_object_get(reply, "id")), "ping") != 0) return false;
+    if (strcmp(json_string_value(json_array_get(json_object_get(reply, "result"), 0)), "x") != 0) return false;
+    json_decref(reply);
+
+    reply = json_pack("{s:O, s:O, s:n}",
+                      "id", json_object_get(req, "id"),
+                      "result", json_object_get(req, "params"),
+                      "error");
+    str = json_dumps(reply, JSON_COMPACT);
+    len = strlen(str);
+
+    /* Odd sized chunks, splitting strings and escapes */
+    for (off = 0; off < len; off += 7777)
+    {
+        if (write(fd, str + off, len - off < 7777 ? len - off : 7777) < 0) return false;
+        usleep(1000);
+    }
+
+    free(str);
+    json_decref(reply);
+    json_decref(req);
+
+    return sync_srv_recv(fd) == NULL;
+}
+
+void test_sync_echo_split(void)
+{
+    char *big;
+
+    /* Larger than the initial read buffer, with escaped quotes and braces */
+    big = malloc(100000);
+    TEST_ASSERT_NOT_NULL(big);
+    memset(big, 'a', 99999);
+    big[99999] = '\0';
+    memcpy(big + 16380, "\"}{\\", 4);
+
+    sync_srv_start(srv_echo_split);
+    sync_check(big);
+    sync_srv_stop();
+
+    free(big);
+}
+
+/*
+ * Replies with unknown ids are dropped
+ */
+static bool srv_unexpected(int lfd)
+{
+    json_t *req;
+    int fd;
+
+    fd = accept(lfd, NULL, NULL);
+    if (fd < 0) return false;
+
+    req = sync_srv_recv(fd);
+    if (req == NULL) return false;
+
+    if (!sync_srv_send(fd, "{\"id\":-5,\"result\":[\"stale\"],\"error\":null}")) return false;
+    if (!sync_srv_reply(fd, req)) return false;
+    json_decref(req);
+
+    return sync_srv_recv(fd) == NULL;
+}
+
+void test_sync_unexpected(void)
+{
+    sync_srv_start(srv_unexpected);
+    sync_check("fresh");
+    sync_srv_stop();
+}
+
+/*
+ * The server closes an idle connection, then drops a request unanswered
+ */
+static bool srv_reconnect(int lfd)
+{
+    json_t *req;
+    int fd;
+
+    /* Idle close: the next request is written to a new connection */
+    fd = accept(lfd, NULL, NULL);
+    if (fd < 0 || !sync_srv_echo(fd)) return false;
+    close(fd);
+
+    /* EOF while the client waits for the reply */
+    fd = accept(lfd, NULL, NULL);
+    if (fd < 0 || !sync_srv_echo(fd)) return false;
+    req = sync_srv_recv(fd);
+    if (req == NULL) return false;
+    json_decref(req);
+    close(fd);
+
+    /* The next call reconnects */
+    fd = accept(lfd, NULL, NULL);
+    if (fd < 0 || !sync_srv_echo(fd)) return false;
+
+    return sync_srv_recv(fd) == NULL;
+}
+
+void test_sync_reconnect(void)
+{
+    struct ovsdb_sync_stats before;
+    struct ovsdb_sync_stats after;
+
+    ovsdb_sync_stats_get(&before);
+
+    sync_srv_start(srv_reconnect);
+    sync_check("first");
+    /* Let the server close the connection */
+    usleep(50000);
+    sync_check("second");
+    TEST_ASSERT_NULL(sync_call("lost"));
+    sync_check("third");
+    sync_srv_stop();
+
+    ovsdb_sync_stats_get(&after);
+    TEST_ASSERT_EQUAL_UINT64(before.connects + 3, after.connects);
+    TEST_ASSERT_EQUAL_UINT64(before.calls + 3, after.calls);
+    TEST_ASSERT_EQUAL_UINT64(before.errors + 1, after.errors);
+}
+
+/*
+ * Several requests are read before any is answered, replies are written in
+ * reverse order with an echo request in between
+ */
+#define SYNC_PIPELINE_DEPTH 4
+
+static bool srv_pipeline(int lfd)
+{
+    json_t *req[SYNC_PIPELINE_DEPTH];
+    json_t *reply;
+    int fd;
+    int i;
+
+    fd = accept(lfd, NULL, NULL);
+    if (fd < 0) return false;
+
+    for (i = 0; i < SYNC_PIPELINE_DEPTH; i++)
+    {
+        req[i] = sync_srv_recv(fd);
+        if (req[i] == NULL) return false;
+    }
+
+    for (i = SYNC_PIPELINE_DEPTH - 1; i >= 0; i--)
+    {
+        if (!sync_srv_reply(fd, req[i])) return false;
+        json_decref(req[i]);
+
+        if (i == SYNC_PIPELINE_DEPTH / 2)
+        {
+            if (!sync_srv_send(fd, "{\"method\":\"echo\",\"id\":\"ping\",\"params\":[]}")) return false;
+            reply = sync_srv_recv(fd);
+            if (reply == NULL) return false;
+            json_decref(reply);
+        }
+    }
+
+    /* A plain call on the same connection after the pipeline */
+    if (!sync_srv_echo(fd)) return false;
+
+    return sync_srv_recv(fd) == NULL;
+}
+
+void test_sync_pipeline(void)
+{
+    struct ovsdb_sync_stats before;
+    struct ovsdb_sync_stats after;
+    int id[SYNC_PIPELINE_DEPTH];
+    char str[16];
+    json_t *res;
+    int i;
+
+    ovsdb_sync_stats_get(&before);
+
+    sync_srv_start(srv_pipeline);
+
+    for (i = 0; i < SYNC_PIPELINE_DEPTH; i++)
+    {
+        snprintf(str, sizeof(str), "req%d", i);
+        id[i] = ovsdb_method_queue_s(MT_ECHO, json_pack("[s]", str));
+        TEST_ASSERT_TRUE(id[i] >= 0);
+    }
+
+    /* Wait in queue order, while the replies arrive in reverse order */
+    for (i = 0; i < SYNC_PIPELINE_DEPTH; i++)
+    {
+        snprintf(str, sizeof(str), "req%d", i);
+        res = ovsdb_method_wait_s(id[i]);
+        TEST_ASSERT_NOT_NULL(res);
+        TEST_ASSERT_EQUAL_STRING(str, json_string_value(json_array_get(res, 0)));
+        json_decref(res);
+    }
+
+    /* Each reply is delivered once */
+    TEST_ASSERT_NULL(ovsdb_method_wait_s(id[0]));
+
+    sync_check("after");
+    sync_srv_stop();
+
+    ovsdb_sync_stats_get(&after);
+    TEST_ASSERT_EQUAL_UINT64(before.connects + 1, after.connects);
+    TEST_ASSERT_EQUAL_UINT64(before.calls + SYNC_PIPELINE_DEPTH + 1, after.calls);
+
+    /* Monitors can't be queued */
+    TEST_ASSERT_EQUAL_INT(-1, ovsdb_method_queue_s(MT_MONITOR, json_pack("[s]", "monitor")));
+}
+
+/*
+ * Pipelined inserts, answered in reverse order, the second batch with an
+ * error for its middle row
+ */
+static bool srv_insert_rows(int lfd)
+{
+    json_t *req[3];
+    json_t *reply;
+    int batch;
+    int fd;
+    int i;
+
+    fd = accept(lfd, NULL, NULL);
+    if (fd < 0) return false;
+
+    for (batch = 0; batch < 2; batch++)
+    {
+        for (i = 0; i < 3; i++)
+        {
+            req[i] = sync_srv_recv(fd);
+            if (req[i] == NULL) return false;
+        }
+
+        for (i = 2; i >= 0; i--)
+        {
+            if (batch == 1 && i == 1)
+            {
+                reply = json_pack("{s:O, s:[{s:s}], s:n}",
+                                  "id", json_object_get(req[i], "id"),
+                                  "result", "error", "constraint violation",
+                                  "error");
+            }
+            else
+            {
+                reply = json_pack("{s:O, s:[{s:[s,s]}], s:n}",
+                                  "id", json_object_get(req[i], "id"),
+                                  "result", "uuid", "uuid", "0000",
+                                  "error");
+            }
+            if (!sync_srv_send(fd, json_dumps_static(reply, JSON_COMPACT))) return false;
+            json_decref(reply);
+            json_decref(req[i]);
+        }
+    }
+
+    return sync_srv_recv(fd) == NULL;
+}
+
+void test_sync_insert_rows(void)
+{
+    json_t *rows;
+
+    rows = json_pack("[{s:s}, {s:s}, {s:s}]", "a", "1", "a", "2", "a", "3");
+    TEST_ASSERT_NOT_NULL(rows);
+
+    sync_srv_start(srv_insert_rows);
+    TEST_ASSERT_EQUAL_INT(3, ovsdb_sync_insert_rows("T", rows));
+    TEST_ASSERT_EQUAL_INT(-1, ovsdb_sync_insert_rows("T", rows));
+    sync_srv_stop();
+
+    /* The rows are not consumed */
+    TEST_ASSERT_EQUAL_INT(3, json_array_size(rows));
+    TEST_ASSERT_EQUAL_INT(1, rows->refcount);
+    json_decref(rows);
+
+    TEST_ASSERT_EQUAL_INT(0, ovsdb_sync_insert_rows("T", NULL));
+}
+
+/*
+ * A monitor request uses a connection of its own
+ */
+static bool srv_monitor(int lfd)
+{
+    json_t *req;
+    int mfd;
+    int fd;
+
+    fd = accept(lfd, NULL, NULL);
+    if (fd < 0 || !sync_srv_echo(fd)) return false;
+
+    mfd = accept(lfd, NULL, NULL);
+    if (mfd < 0) return false;
+
+    req = sync_srv_recv(mfd);
+    if (req == NULL) return false;
+    if (strcmp(json_string_value(json_object_get(req, "method")), "monitor") != 0) return false;
+    if (!sync_srv_reply(mfd, req)) return false;
+    json_decref(req);
+
+    /* The monitor connection is closed once the reply is read */
+    if (sync_srv_recv(mfd) != NULL) return false;
+
+    if (!sync_srv_echo(fd)) return false;
+
+    return sync_srv_recv(fd) == NULL;
+}
+
+void test_sync_monitor(void)
+{
+    json_t *res;
+
+    sync_srv_start(srv_monitor);
+    sync_check("before");
+
+    res = ovsdb_method_send_s(MT_MONITOR, json_pack("[s]", "monitor"));
+    TEST_ASSERT_NOT_NULL(res);
+    json_decref(res);
+
+    sync_check("after");
+    sync_srv_stop();
+}
+
+void run_test_ovsdb_sync(void)
+{
+    RUN_TEST(test_sync_reuse);
+    RUN_TEST(test_sync_echo_split);
+    RUN_TEST(test_sync_unexpected);
+    RUN_TEST(test_sync_reconnect);
+    RUN_TEST(test_sync_monitor);
+    RUN_TEST(test_sync_pipeline);
+    RUN_TEST(test_sync_insert_rows);
+}
@@ -0,0 +1,652 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * The update monitor is built in, with the RPC calls it makes redirected to
+ * the stand-ins below, so that the server answers can be scripted. This also
+ * gives access to the static set and map helpers.
+ */
+#define ovsdb_method_send               test_ovsdb_method_send
+#define ovsdb_register_update_cb        test_ovsdb_register_update_cb
+#define ovsdb_monit_call_argv           test_ovsdb_monit_call_argv
+#define ovsdb_monit_cond_call_argv      test_ovsdb_monit_cond_call_argv
+#define ovsdb_monit_cond_change_call    test_ovsdb_monit_cond_change_call
+
+#include "ovsdb_update.c"
+
+#include "const.h"
+#include "unity.h"
+
+#define TEST_UPDATE_MON_ID 7
+#define TEST_UPDATE_MAX 8
+
+/*
+ * Table "T" with a column of each kind
+ */
+static const char *test_update_schema =
+    "{\"name\":\"Open_vSwitch\",\"tables\":{\"T\":{\"columns\":{"
+    "\"name\":{\"type\":\"string\"},"
+    "\"n\":{\"type\":{\"key\":\"integer\"}},"
+    "\"opt\":{\"type\":{\"key\":\"string\",\"min\":0,\"max\":1}},"
+    "\"tags\":{\"type\":{\"key\":\"string\",\"min\":0,\"max\":\"unlimited\"}},"
+    "\"kv\":{\"type\":{\"key\":\"string\",\"value\":\"string\","
+    "\"min\":0,\"max\":\"unlimited\"}},"
+    "\"m1\":{\"type\":{\"key\":\"string\",\"value\":\"integer\","
+    "\"min\":0,\"max\":1}}}}}}";
+
+/**
+ * @brief scripted server side of a monitor
+ */
+static struct
+{
+    int schema_calls;
+    json_rpc_response_t *schema_cb;
+    int cond_calls;
+    int plain_calls;
+    char where[256];
+    json_rpc_response_t *resp_cb;
+    void *resp_data;
+    ovsdb_update_process_t *update_cb;
+    void *update_data;
+} g_srv;
+
+/**
+ * @brief updates received by the monitor callback
+ */
+static struct
+{
+    int count;
+    ovsdb_update_type_t type[TEST_UPDATE_MAX];
+    char uuid[TEST_UPDATE_MAX][16];
+    json_t *jold[TEST_UPDATE_MAX];
+    json_t *jnew[TEST_UPDATE_MAX];
+} g_upd;
+
+
+bool
+test_ovsdb_method_send(json_rpc_response_t *cb, void *data, ovsdb_mt_t mt, json_t *jparams)
+{
+    TEST_ASSERT_EQUAL_INT(MT_GET_SCHEMA, mt);
+    json_decref(jparams);
+
+    g_srv.schema_cb = cb;
+    g_srv.schema_calls++;
+    return true;
+}
+
+int
+test_ovsdb_register_update_cb(ovsdb_update_process_t *fn, void *data)
+{
+    g_srv.update_cb = fn;
+    g_srv.update_data = data;
+    return TEST_UPDATE_MON_ID;
+}
+
+bool
+test_ovsdb_monit_call_argv(json_rpc_response_t *cb, void *data, int monid,
+                           char *mon_table, int mon_flags, int argc, char **argv)
+{
+    g_srv.resp_cb = cb;
+    g_srv.resp_data = data;
+    g_srv.plain_calls++;
+    return true;
+}
+
+bool
+test_ovsdb_monit_cond_call_argv(json_rpc_response_t *cb, void *data, int monid,
+                                char *mon_table, int mon_flags, int argc, char **argv,
+                                json_t *where)
+{
+    char *str;
+
+    g_srv.resp_cb = cb;
+    g_srv.resp_data = data;
+    g_srv.cond_calls++;
+
+    str = where != NULL ? json_dumps(where, JSON_COMPACT) : NULL;
+    snprintf(g_srv.where, sizeof(g_srv.where), "%s", str != NULL ? str : "");
+    free(str);
+    json_decref(where);
+    return true;
+}
+
+bool
+test_ovsdb_monit_cond_change_call(json_rpc_response_t *cb, void *data, int monid,
+                                  char *mon_table, json_t *where)
+{
+    json_decref(where);
+    return true;
+}
+
+
+static void
+test_update_cb(ovsdb_update_monitor_t *self)
+{
+    int n = g_upd.count++;
+
+    TEST_ASSERT_TRUE(n < TEST_UPDATE_MAX);
+    g_upd.type[n] = self->mon_type;
+    snprintf(g_upd.uuid[n], sizeof(g_upd.uuid[n]), "%s",
+             self->mon_uuid != NULL ? self->mon_uuid : "");
+    g_upd.jold[n] = self->mon_json_old != NULL ? json_deep_copy(self->mon_json_old) : NULL;
+    g_upd.jnew[n] = self->mon_json_new != NULL ? json_deep_copy(self->mon_json_new) : NULL;
+}
+
+static void
+test_update_reset(void)
+{
+    int n;
+
+    for (n = 0; n < g_upd.count; n++)
+    {
+        json_decref(g_upd.jold[n]);
+        json_decref(g_upd.jnew[n]);
+    }
+    memset(&g_upd, 0, sizeof(g_upd));
+}
+
+/**
+ * @brief answers the schema request, with the schema or an error
+ */
+static void
+test_send_schema(bool has_schema)
+{
+    json_t *js;
+
+    TEST_ASSERT_NOT_NULL(g_srv.schema_cb);
+    js = has_schema ? json_loads(test_update_schema, 0, NULL) : json_string("unknown method");
+    g_srv.schema_cb(1, !has_schema, js, NULL);
+    json_decref(js);
+}
+
+/**
+ * @brief forgets the schema, so that the next monitor requests it again
+ */
+static void
+test_update_schema_free(void)
+{
+    json_decref(ovsdb_update_schema);
+    ovsdb_update_schema = NULL;
+    ovsdb_update_schema_state = OVSDB_UPDATE_SCHEMA_NONE;
+    memset(&g_srv, 0, sizeof(g_srv));
+}
+
+/**
+ * @brief frees a monitor, and the schema so the next one loads it again
+ */
+static void
+test_update_monitor_free(ovsdb_update_monitor_t *self)
+{
+    ovsdb_update_row_t *row;
+    int ii;
+
+    while ((row = ds_tree_head(&self->mon_rows)) != NULL)
+    {
+        ds_tree_remove(&self->mon_rows, row);
+        ovsdb_update_row_free(row);
+    }
+
+    if (self->mon_pending)
+    {
+        ds_dlist_remove(&ovsdb_update_pending, self);
+    }
+    json_decref(self->mon_where);
+
+    for (ii = 0; ii < self->mon_colc; ii++)
+    {
+        free(self->mon_colv[ii]);
+    }
+    free(self->mon_colv);
+    free(self->mon_tname);
+
+    test_update_schema_free();
+    test_update_reset();
+}
+
+/**
+ * @brief checks a JSON value against its text, jsonb-style
+ */
+static void
+test_assert_json(const char *expected, json_t *jval)
+{
+    json_t *jexp;
+    char *str;
+
+    jexp = json_loads(expected, JSON_DECODE_ANY, NULL);
+    TEST_ASSERT_NOT_NULL(jexp);
+
+    if (!json_equal(jexp, jval))
+    {
+        str = jval != NULL ? json_dumps(jval, JSON_SORT_KEYS | JSON_COMPACT | JSON_ENCODE_ANY) : NULL;
+        LOGE("expected %s, got %s", expected, str != NULL ? str : "NULL");
+        free(str);
+        TEST_FAIL();
+    }
+    json_decref(jexp);
+}
+
+static json_t *
+test_apply(json_t *(*apply)(json_t *, json_t *), const char *cur, const char *diff)
+{
+    json_t *jcur;
+    json_t *jdiff;
+    json_t *jres;
+
+    jcur = cur != NULL ? json_loads(cur, JSON_DECODE_ANY, NULL) : NULL;
+    jdiff = json_loads(diff, JSON_DECODE_ANY, NULL);
+    jres = apply(jcur, jdiff);
+    json_decref(jcur);
+    json_decref(jdiff);
+
+    return jres;
+}
+
+static void
+test_assert_apply(json_t *(*apply)(json_t *, json_t *), const char *cur,
+                  const char *diff, const char *expected)
+{
+    json_t *jres;
+
+    jres = test_apply(apply, cur, diff);
+    test_assert_json(expected, jres);
+    json_decref(jres);
+}
+
+static void
+test_send_update2(const char *update)
+{
+    char msg[1024];
+    json_t *js;
+
+    snprintf(msg, sizeof(msg), "{\"method\":\"update2\",\"params\":[%d,%s],\"id\":null}",
+             TEST_UPDATE_MON_ID, update);
+    js = json_loads(msg, 0, NULL);
+    TEST_ASSERT_NOT_NULL(js);
+    g_srv.update_cb(TEST_UPDATE_MON_ID, js, g_srv.update_data);
+    json_decref(js);
+}
+
+static void
+test_send_response(bool is_error, const char *result)
+{
+    json_t *js;
+
+    js = json_loads(result, JSON_DECODE_ANY, NULL);
+    TEST_ASSERT_NOT_NULL(js);
+    g_srv.resp_cb(1, is_error, js, g_srv.resp_data);
+    json_decref(js);
+}
+
+
+/**
+ * @brief set differences add and remove elements
+ */
+void
+test_update_apply_set(void)
+{
+    /* Added and removed elements */
+    test_assert_apply(ovsdb_update_apply_set,
+                      "[\"set\",[\"x\",\"y\"]]", "[\"set\",[\"y\",\"z\"]]",
+                      "[\"set\",[\"x\",\"z\"]]");
+
+    /* Sets of one element are bare atoms, on both sides */
+    test_assert_apply(ovsdb_update_apply_set, "\"x\"", "\"y\"",
+                      "[\"set\",[\"x\",\"y\"]]");
+    test_assert_apply(ovsdb_update_apply_set,
+                      "[\"set\",[\"x\",\"y\"]]", "\"x\"", "\"y\"");
+    test_assert_apply(ovsdb_update_apply_set, NULL, "\"x\"", "\"x\"");
+    test_assert_apply(ovsdb_update_apply_set, "[\"set\",[]]", "[\"set\",[1,2]]",
+                      "[\"set\",[1,2]]");
+
+    /* Removing the last element leaves an empty set */
+    test_assert_apply(ovsdb_update_apply_set, "\"x\"", "\"x\"", "[\"set\",[]]");
+    test_assert_apply(ovsdb_update_apply_set,
+                      "[\"set\",[[\"uuid\",\"a\"],[\"uuid\",\"b\"]]]",
+                      "[\"set\",[[\"uuid\",\"a\"],[\"uuid\",\"b\"]]]",
+                      "[\"set\",[]]");
+}
+
+
+/**
+ * @brief map differences add, update and remove pairs
+ */
+void
+test_update_apply_map(void)
+{
+    const char *cur = "[\"map\",[[\"k1\",\"v1\"],[\"k2\",\"v2\"]]]";
+
+    /* Added pair */
+    test_assert_apply(ovsdb_update_apply_map, cur, "[\"map\",[[\"k3\",\"v3\"]]]",
+                      "[\"map\",[[\"k1\",\"v1\"],[\"k2\",\"v2\"],[\"k3\",\"v3\"]]]");
+
+    /* Updated key, with its new value */
+    test_assert_apply(ovsdb_update_apply_map, cur, "[\"map\",[[\"k2\",\"v9\"]]]",
+                      "[\"map\",[[\"k1\",\"v1\"],[\"k2\",\"v9\"]]]");
+
+    /* Removed pair, with its current value */
+    test_assert_apply(ovsdb_update_apply_map, cur, "[\"map\",[[\"k1\",\"v1\"]]]",
+                      "[\"map\",[[\"k2\",\"v2\"]]]");
+
+    /* All at once, and from an empty or missing map */
+    test_assert_apply(ovsdb_update_apply_map, cur,
+                      "[\"map\",[[\"k1\",\"v1\"],[\"k2\",\"v9\"],[\"k3\",\"v3\"]]]",
+                      "[\"map\",[[\"k2\",\"v9\"],[\"k3\",\"v3\"]]]");
+    test_assert_apply(ovsdb_update_apply_map, "[\"map\",[]]", "[\"map\",[[\"k\",1]]]",
+                      "[\"map\",[[\"k\",1]]]");
+    test_assert_apply(ovsdb_update_apply_map, NULL, "[\"map\",[[\"k\",1]]]",
+                      "[\"map\",[[\"k\",1]]]");
+    test_assert_apply(ovsdb_update_apply_map, "[\"map\",[[\"k\",1]]]",
+                      "[\"map\",[[\"k\",1]]]", "[\"map\",[]]");
+}
+
+
+/**
+ * @brief column kinds are taken from the schema
+ */
+void
+test_update_col_type(void)
+{
+    TEST_ASSERT_TRUE(ovsdb_update_schema_request());
+    test_send_schema(true);
+    TEST_ASSERT_NOT_NULL(ovsdb_update_schema);
+
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_COL_SCALAR, ovsdb_update_col_type("T", "name"));
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_COL_SCALAR, ovsdb_update_col_type("T", "n"));
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_COL_SCALAR, ovsdb_update_col_type("T", "opt"));
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_COL_SET, ovsdb_update_col_type("T", "tags"));
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_COL_MAP, ovsdb_update_col_type("T", "kv"));
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_COL_SCALAR, ovsdb_update_col_type("T", "_version"));
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_COL_SCALAR, ovsdb_update_col_type("X", "tags"));
+
+    /* A map of at most one pair is sent as its new value */
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_COL_SCALAR, ovsdb_update_col_type("T", "m1"));
+
+    test_update_schema_free();
+}
+
+
+/**
+ * @brief update2 notifications are applied to the stored rows
+ */
+void
+test_update_monitor_process2(void)
+{
+    ovsdb_update_monitor_t mon;
+    ovsdb_update_row_t *row;
+    char *cols[] = { "name", "n", "opt", "tags", "kv" };
+
+    TEST_ASSERT_TRUE(ovsdb_update_monitor_where(&mon, test_update_cb, "T", OMT_ALL,
+                                                ARRAY_SIZE(cols), cols,
+                                                json_loads("[[\"name\",\"==\",\"a\"]]", 0, NULL)));
+    test_send_schema(true);
+    TEST_ASSERT_TRUE(mon.mon_cond);
+    TEST_ASSERT_EQUAL_INT(1, g_srv.cond_calls);
+    TEST_ASSERT_EQUAL_INT(0, g_srv.plain_calls);
+
+    /* Initial rows come with the monitor_cond response */
+    test_send_response(false,
+            "{\"T\":{\"u1\":{\"initial\":{\"name\":\"a\",\"n\":1,"
+            "\"opt\":[\"set\",[]],\"tags\":[\"set\",[\"x\",\"y\"]],"
+            "\"kv\":[\"map\",[[\"k1\",\"v1\"],[\"k2\",\"v2\"]]]}}}}");
+    TEST_ASSERT_EQUAL_INT(1, g_upd.count);
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_NEW, g_upd.type[0]);
+    TEST_ASSERT_EQUAL_STRING("u1", g_upd.uuid[0]);
+    TEST_ASSERT_NULL(g_upd.jold[0]);
+    test_assert_json("[\"uuid\",\"u1\"]", json_object_get(g_upd.jnew[0], "_uuid"));
+    test_assert_json("1", json_object_get(g_upd.jnew[0], "n"));
+    test_update_reset();
+
+    /* Scalars and the optional column carry the new value */
+    test_send_update2("{\"T\":{\"u1\":{\"modify\":{\"n\":2,\"opt\":\"o\","
+                      "\"tags\":[\"set\",[\"y\",\"z\"]],"
+                      "\"kv\":[\"map\",[[\"k2\",\"v9\"],[\"k3\",\"v3\"]]]}}}}");
+    TEST_ASSERT_EQUAL_INT(1, g_upd.count);
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_MODIFY, g_upd.type[0]);
+    test_assert_json("{\"_uuid\":[\"uuid\",\"u1\"],\"n\":1,\"opt\":[\"set\",[]],"
+                     "\"tags\":[\"set\",[\"x\",\"y\"]],"
+                     "\"kv\":[\"map\",[[\"k1\",\"v1\"],[\"k2\",\"v2\"]]]}",
+                     g_upd.jold[0]);
+    test_assert_json("{\"_uuid\":[\"uuid\",\"u1\"],\"name\":\"a\",\"n\":2,\"opt\":\"o\","
+                     "\"tags\":[\"set\",[\"x\",\"z\"]],"
+                     "\"kv\":[\"map\",[[\"k1\",\"v1\"],[\"k2\",\"v9\"],[\"k3\",\"v3\"]]]}",
+                     g_upd.jnew[0]);
+    test_update_reset();
+
+    /* A one element set difference is a bare atom, clearing an optional column */
+    test_send_update2("{\"T\":{\"u1\":{\"modify\":{\"tags\":\"x\",\"opt\":[\"set\",[]],"
+                      "\"kv\":[\"map\",[[\"k1\",\"v1\"]]]}}}}");
+    TEST_ASSERT_EQUAL_INT(1, g_upd.count);
+    test_assert_json("{\"_uuid\":[\"uuid\",\"u1\"],\"opt\":\"o\","
+                     "\"tags\":[\"set\",[\"x\",\"z\"]],"
+                     "\"kv\":[\"map\",[[\"k1\",\"v1\"],[\"k2\",\"v9\"],[\"k3\",\"v3\"]]]}",
+                     g_upd.jold[0]);
+    test_assert_json("{\"_uuid\":[\"uuid\",\"u1\"],\"name\":\"a\",\"n\":2,"
+                     "\"opt\":[\"set\",[]],\"tags\":\"z\","
+                     "\"kv\":[\"map\",[[\"k2\",\"v9\"],[\"k3\",\"v3\"]]]}",
+                     g_upd.jnew[0]);
+    test_update_reset();
+
+    /* Unknown rows are not reported */
+    test_send_update2("{\"T\":{\"u9\":{\"modify\":{\"n\":3}},\"u8\":{\"delete\":null}}}");
+    TEST_ASSERT_EQUAL_INT(0, g_upd.count);
+
+    /* A delete reports the stored row */
+    test_send_update2("{\"T\":{\"u2\":{\"insert\":{\"name\":\"b\","
+                      "\"m1\":[\"map\",[[\"a\",1]]]}}}}");
+    test_send_update2("{\"T\":{\"u1\":{\"delete\":null}}}");
+    TEST_ASSERT_EQUAL_INT(2, g_upd.count);
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_NEW, g_upd.type[0]);
+    TEST_ASSERT_EQUAL_STRING("u2", g_upd.uuid[0]);
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_DEL, g_upd.type[1]);
+    TEST_ASSERT_EQUAL_STRING("u1", g_upd.uuid[1]);
+    TEST_ASSERT_NULL(g_upd.jnew[1]);
+    test_assert_json("\"z\"", json_object_get(g_upd.jold[1], "tags"));
+
+    TEST_ASSERT_NULL(ds_tree_find(&mon.mon_rows, "u1"));
+    row = ds_tree_find(&mon.mon_rows, "u2");
+    TEST_ASSERT_NOT_NULL(row);
+    test_assert_json("\"b\"", json_object_get(row->ur_row, "name"));
+    test_update_reset();
+
+    /* A map of at most one pair is replaced, not merged */
+    test_send_update2("{\"T\":{\"u2\":{\"modify\":{\"m1\":[\"map\",[[\"b\",2]]]}}}}");
+    TEST_ASSERT_EQUAL_INT(1, g_upd.count);
+    test_assert_json("[\"map\",[[\"a\",1]]]", json_object_get(g_upd.jold[0], "m1"));
+    test_assert_json("[\"map\",[[\"b\",2]]]", json_object_get(g_upd.jnew[0], "m1"));
+
+    test_update_monitor_free(&mon);
+}
+
+
+/**
+ * @brief monitors wait for the schema, without blocking
+ */
+void
+test_update_monitor_pending(void)
+{
+    ovsdb_update_monitor_t mon1;
+    ovsdb_update_monitor_t mon2;
+    ovsdb_update_monitor_t mon3;
+
+    /* The first monitor requests the schema, the requests are held until it arrives */
+    TEST_ASSERT_TRUE(ovsdb_update_monitor(&mon1, test_update_cb, "T", OMT_ALL));
+    TEST_ASSERT_TRUE(ovsdb_update_monitor_where(&mon2, test_update_cb, "T", OMT_ALL, 0, NULL,
+                                                json_loads("[[\"name\",\"==\",\"a\"]]", 0, NULL)));
+    TEST_ASSERT_EQUAL_INT(1, g_srv.schema_calls);
+    TEST_ASSERT_EQUAL_INT(0, g_srv.cond_calls);
+    TEST_ASSERT_EQUAL_INT(0, g_srv.plain_calls);
+    TEST_ASSERT_TRUE(mon1.mon_pending);
+    TEST_ASSERT_TRUE(mon2.mon_pending);
+
+    /* New conditions replace the held ones */
+    TEST_ASSERT_TRUE(ovsdb_update_monitor_cond_change(&mon2,
+                json_loads("[[\"name\",\"==\",\"b\"]]", 0, NULL)));
+    TEST_ASSERT_EQUAL_INT(0, g_srv.cond_calls);
+
+    /* The held requests go out in order, with the schema known */
+    test_send_schema(true);
+    TEST_ASSERT_EQUAL_INT(2, g_srv.cond_calls);
+    TEST_ASSERT_FALSE(mon1.mon_pending);
+    TEST_ASSERT_FALSE(mon2.mon_pending);
+    TEST_ASSERT_TRUE(mon1.mon_cond);
+    TEST_ASSERT_TRUE(mon2.mon_cond);
+    TEST_ASSERT_EQUAL_STRING("[[\"name\",\"==\",\"b\"]]", g_srv.where);
+    TEST_ASSERT_TRUE(ds_dlist_is_empty(&ovsdb_update_pending));
+
+    /* Later monitors are sent right away */
+    TEST_ASSERT_TRUE(ovsdb_update_monitor(&mon3, test_update_cb, "T", OMT_ALL));
+    TEST_ASSERT_FALSE(mon3.mon_pending);
+    TEST_ASSERT_EQUAL_INT(1, g_srv.schema_calls);
+    TEST_ASSERT_EQUAL_INT(3, g_srv.cond_calls);
+    TEST_ASSERT_EQUAL_STRING("", g_srv.where);
+
+    test_update_monitor_free(&mon1);
+    test_update_monitor_free(&mon2);
+    test_update_monitor_free(&mon3);
+}
+
+
+/**
+ * @brief row kept by the owner of the monitor, see test_update_monitor_row_cb
+ */
+static json_t *g_row;
+
+static json_t *
+test_update_row_cb(ovsdb_update_monitor_t *self, const char *uuid)
+{
+    if (g_row == NULL || strcmp(uuid, "u1") != 0) return NULL;
+    return json_deep_copy(g_row);
+}
+
+/**
+ * @brief diffs are applied to the rows of the owner, the monitor keeps none
+ */
+void
+test_update_monitor_row_cb(void)
+{
+    ovsdb_update_monitor_t mon;
+
+    TEST_ASSERT_TRUE(ovsdb_update_monitor(&mon, test_update_cb, "T", OMT_ALL));
+    mon.mon_row_cb = test_update_row_cb;
+    test_send_schema(true);
+    TEST_ASSERT_TRUE(mon.mon_cond);
+
+    test_send_response(false,
+            "{\"T\":{\"u1\":{\"initial\":{\"name\":\"a\",\"tags\":\"x\"}}}}");
+    TEST_ASSERT_EQUAL_INT(1, g_upd.count);
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_NEW, g_upd.type[0]);
+    test_assert_json("\"a\"", json_object_get(g_upd.jnew[0], "name"));
+    TEST_ASSERT_TRUE(ds_tree_is_empty(&mon.mon_rows));
+    test_update_reset();
+
+    /* The owner stored the row, the modification is applied to it */
+    g_row = json_loads("{\"name\":\"a\",\"tags\":[\"set\",[\"x\"]]}", 0, NULL);
+    test_send_update2("{\"T\":{\"u1\":{\"modify\":{\"tags\":\"y\"}}}}");
+    TEST_ASSERT_EQUAL_INT(1, g_upd.count);
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_MODIFY, g_upd.type[0]);
+    test_assert_json("{\"_uuid\":[\"uuid\",\"u1\"],\"tags\":[\"set\",[\"x\"]]}", g_upd.jold[0]);
+    test_assert_json("{\"_uuid\":[\"uuid\",\"u1\"],\"name\":\"a\","
+                     "\"tags\":[\"set\",[\"x\",\"y\"]]}", g_upd.jnew[0]);
+    TEST_ASSERT_TRUE(ds_tree_is_empty(&mon.mon_rows));
+    test_update_reset();
+
+    /* Rows unknown to the owner are not reported */
+    test_send_update2("{\"T\":{\"u9\":{\"modify\":{\"tags\":\"y\"}}}}");
+    TEST_ASSERT_EQUAL_INT(0, g_upd.count);
+
+    /* A delete reports the row of the owner */
+    test_send_update2("{\"T\":{\"u1\":{\"delete\":null}}}");
+    TEST_ASSERT_EQUAL_INT(1, g_upd.count);
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_DEL, g_upd.type[0]);
+    TEST_ASSERT_NULL(g_upd.jnew[0]);
+    test_assert_json("[\"set\",[\"x\"]]", json_object_get(g_upd.jold[0], "tags"));
+
+    json_decref(g_row);
+    g_row = NULL;
+    test_update_monitor_free(&mon);
+}
+
+
+/**
+ * @brief plain monitors are used when monitor_cond is refused or unknown
+ */
+void
+test_update_monitor_fallback(void)
+{
+    ovsdb_update_monitor_t mon;
+    char *cols[] = { "name" };
+
+    /* The server refuses monitor_cond, the request is sent again */
+    TEST_ASSERT_TRUE(ovsdb_update_monitor_ex(&mon, test_update_cb, "T", OMT_ALL,
+                                             ARRAY_SIZE(cols), cols));
+    test_send_schema(true);
+    TEST_ASSERT_TRUE(mon.mon_cond);
+
+    test_send_response(true, "\"unknown method\"");
+    TEST_ASSERT_FALSE(mon.mon_cond);
+    TEST_ASSERT_EQUAL_INT(1, g_srv.cond_calls);
+    TEST_ASSERT_EQUAL_INT(1, g_srv.plain_calls);
+    TEST_ASSERT_EQUAL_INT(0, g_upd.count);
+
+    /* The plain monitor answers with "update" rows */
+    test_send_response(false, "{\"T\":{\"u3\":{\"new\":{\"name\":\"c\"}}}}");
+    TEST_ASSERT_EQUAL_INT(1, g_upd.count);
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_NEW, g_upd.type[0]);
+    TEST_ASSERT_EQUAL_STRING("u3", g_upd.uuid[0]);
+    test_assert_json("\"c\"", json_object_get(g_upd.jnew[0], "name"));
+
+    /* An error of the plain monitor is reported */
+    test_send_response(true, "\"failed\"");
+    TEST_ASSERT_EQUAL_INT(2, g_upd.count);
+    TEST_ASSERT_EQUAL_INT(OVSDB_UPDATE_ERROR, g_upd.type[1]);
+
+    test_update_monitor_free(&mon);
+
+    /* Without a schema, conditions are dropped and a plain monitor is used */
+    TEST_ASSERT_TRUE(ovsdb_update_monitor_where(&mon, test_update_cb, "T", OMT_ALL,
+                                                ARRAY_SIZE(cols), cols,
+                                                json_loads("[[\"name\",\"==\",\"a\"]]", 0, NULL)));
+    test_send_schema(false);
+    TEST_ASSERT_FALSE(mon.mon_cond);
+    TEST_ASSERT_EQUAL_INT(0, g_srv.cond_calls);
+    TEST_ASSERT_EQUAL_INT(1, g_srv.plain_calls);
+    TEST_ASSERT_FALSE(ovsdb_update_monitor_cond_change(&mon, json_array()));
+
+    test_update_monitor_free(&mon);
+}
+
+
+void
+run_test_ovsdb_update(void)
+{
+    RUN_TEST(test_update_apply_set);
+    RUN_TEST(test_update_apply_map);
+    RUN_TEST(test_update_col_type);
+    RUN_TEST(test_update_monitor_process2);
+    RUN_TEST(test_update_monitor_fallback);
+    RUN_TEST(test_update_monitor_pending);
+    RUN_TEST(test_update_monitor_row_cb);
+}
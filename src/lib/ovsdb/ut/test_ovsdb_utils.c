@@ -24,7 +24,16 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include "ovsdb_utils.h"
+#include "ovsdb_table.h"
+#include "ovsdb_cache.h"
+#include "json_util.h"
 #include "log.h"
 #include "target.h"
 #include "unity.h"
@@ -256,6 +265,354 @@ test_schema2itree(void)
     free_str_itree(converted);
 }
 
+/**
+ * @brief cached record layout, as generated for a schema table
+ */
+struct test_cache_record
+{
+    int _update_type;
+    ovs_uuid_t _uuid;
+    ovs_uuid_t _version;
+    char mac[32];
+    char ifname[32];
+};
+
+#define TEST_CACHE_ROWS 10000
+
+/* Cache internal, rows are added by the monitor and upsert paths */
+void _ovsdb_cache_insert_row(ovsdb_table_t *table, ovsdb_cache_row_t *row);
+
+/**
+ * @brief fills a table cache with rows of unique uuid, key and key2
+ */
+static void test_cache_fill(ovsdb_table_t *table, size_t nrows)
+{
+    struct test_cache_record *rec;
+    ovsdb_cache_row_t *row;
+    size_t i;
+
+    ovsdb_table_init("Test_Cache", table, sizeof(struct test_cache_record),
+                     offsetof(struct test_cache_record, _update_type),
+                     offsetof(struct test_cache_record, _uuid),
+                     offsetof(struct test_cache_record, _version),
+                     NULL, NULL, NULL, NULL);
+    table->key_offset = offsetof(struct test_cache_record, mac);
+    table->key2_offset = offsetof(struct test_cache_record, ifname);
+
+    for (i = 0; i < nrows; i++)
+    {
+        row = calloc(1, table->row_size);
+        TEST_ASSERT_NOT_NULL(row);
+        rec = (struct test_cache_record *)row->record;
+        snprintf(rec->_uuid.uuid, sizeof(rec->_uuid.uuid),
+                 "%08zx-0000-4000-8000-000000000000", i);
+        snprintf(rec->mac, sizeof(rec->mac), "00:00:00:%02zx:%02zx:%02zx",
+                 (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+        snprintf(rec->ifname, sizeof(rec->ifname), "wl%zu", i);
+        _ovsdb_cache_insert_row(table, row);
+    }
+}
+
+static void test_cache_free(ovsdb_table_t *table)
+{
+    ovsdb_cache_row_t *row;
+
+    while ((row = ds_tree_head(&table->rows)) != NULL)
+    {
+        ds_tree_remove(&table->rows, row);
+        free(row);
+    }
+}
+
+/**
+ * @brief looks a row up the way the cache did before it used its indexes
+ */
+static ovsdb_cache_row_t *test_cache_scan(ovsdb_table_t *table, int offset, const char *key)
+{
+    ovsdb_cache_row_t *row;
+
+    ds_tree_foreach(&table->rows, row)
+    {
+        if (strcmp(row->record + offset, key) == 0) return row;
+    }
+    return NULL;
+}
+
+static double test_elapsed_ms(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/**
+ * @brief validates the uuid, key and key2 lookups of a 10k rows cache
+ *
+ * Also reports the indexed lookups against the former full scan.
+ */
+void test_cache_find_10k_rows(void)
+{
+    struct test_cache_record *rec;
+    struct test_cache_record *found;
+    ovsdb_cache_row_t *row;
+    struct timespec start;
+    ovsdb_table_t table;
+    double index_ms;
+    double scan_ms;
+
+    test_cache_fill(&table, TEST_CACHE_ROWS);
+
+    ds_tree_foreach(&table.rows, row)
+    {
+        rec = (struct test_cache_record *)row->record;
+
+        found = ovsdb_cache_find_by_uuid(&table, rec->_uuid.uuid);
+        TEST_ASSERT_EQUAL_PTR(rec, found);
+        found = ovsdb_cache_find_by_key(&table, rec->mac);
+        TEST_ASSERT_EQUAL_PTR(rec, found);
+        found = ovsdb_cache_find_by_key2(&table, rec->ifname);
+        TEST_ASSERT_EQUAL_PTR(rec, found);
+    }
+
+    TEST_ASSERT_NULL(ovsdb_cache_find_by_uuid(&table, "ffffffff-0000-4000-8000-000000000000"));
+    TEST_ASSERT_NULL(ovsdb_cache_find_by_key(&table, "ff:ff:ff:ff:ff:ff"));
+    TEST_ASSERT_NULL(ovsdb_cache_find_by_key2(&table, "eth0"));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ds_tree_foreach(&table.rows, row)
+    {
+        rec = (struct test_cache_record *)row->record;
+        TEST_ASSERT_NOT_NULL(ovsdb_cache_find_row_by_key(&table, rec->mac));
+    }
+    index_ms = test_elapsed_ms(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ds_tree_foreach(&table.rows, row)
+    {
+        rec = (struct test_cache_record *)row->record;
+        TEST_ASSERT_NOT_NULL(test_cache_scan(&table, table.key_offset, rec->mac));
+    }
+    scan_ms = test_elapsed_ms(&start);
+
+    LOGI("%s: %d key lookups: indexed: %.2f ms, full scan: %.2f ms",
+         __func__, TEST_CACHE_ROWS, index_ms, scan_ms);
+
+    test_cache_free(&table);
+}
+
+/**
+ * @brief synthetic ovsdb-server traffic: a monitor reply, update
+ * notifications and an echo request, laid out as ovsdb-server sends them
+ * on the socket, with escaped quotes and braces inside strings.
+ */
+static const char test_ovsdb_traffic[] =
+    "{\"id\":3,\"result\":{\"Wifi_Associated_Clients\":{"
+    "\"2e5e1c6a-3a4b-4f0c-9c2e-7a1d5b8e2f10\":{\"new\":{\"mac\":\"a4:83:e7:11:22:33\","
+    "\"state\":\"active\",\"key_id\":\"onboard-ap\",\"capabilities\":[\"set\",[\"11ac\",\"11n\",\"2x2\"]],"
+    "\"kick\":[\"map\",[]],\"oftag\":[\"set\",[]],\"_version\":[\"uuid\",\"5b0c7a16-7d1e-4c8a-9b1e-0f2d3c4b5a69\"]}},"
+    "\"8c1f2d3e-4b5a-4697-a8b9-c0d1e2f3a4b5\":{\"new\":{\"mac\":\"f0:18:98:44:55:66\","
+    "\"state\":\"active\",\"key_id\":\"key-\\\"home\\\"{}\",\"capabilities\":[\"set\",[\"11ax\",\"11ac\"]],"
+    "\"kick\":[\"map\",[[\"reason\",\"{steering}\"]]],\"oftag\":\"home--1\","
+    "\"_version\":[\"uuid\",\"0e9d8c7b-6a59-4847-b6a5-f4e3d2c1b0a9\"]}}}},\"error\":null}"
+    "{\"id\":null,\"method\":\"update\",\"params\":[1,{\"Wifi_Associated_Clients\":{"
+    "\"2e5e1c6a-3a4b-4f0c-9c2e-7a1d5b8e2f10\":{\"new\":{\"state\":\"idle\"},\"old\":{\"state\":\"active\"}}}}]} "
+    "{\"id\":\"echo\",\"method\":\"echo\",\"params\":[]}"
+    "{\"id\":null,\"method\":\"update\",\"params\":[1,{\"Wifi_Associated_Clients\":{"
+    "\"8c1f2d3e-4b5a-4697-a8b9-c0d1e2f3a4b5\":{\"old\":{\"mac\":\"f0:18:98:44:55:66\",\"state\":\"active\"}}}}]}";
+
+#define TEST_TRAFFIC_MSGS 4
+#define TEST_REPLAY_SIZE (8*1024*1024)
+#define TEST_REPLAY_CHUNK (8*1024)
+
+/**
+ * @brief frames the traffic received in chunks of read_size bytes
+ *
+ * @return the number of messages parsed, -1 on error
+ */
+static int test_split_stream_replay(const char *data, size_t len, size_t read_size)
+{
+    struct json_split_state st;
+    json_error_t err;
+    size_t avail;
+    size_t head;
+    ssize_t n;
+    json_t *js;
+    int count;
+
+    json_split_init(&st);
+    count = 0;
+    head = 0;
+    for (avail = 0; avail < len;)
+    {
+        avail += read_size;
+        if (avail > len) avail = len;
+
+        while ((n = json_split_stream(&st, data + head, avail - head)) > 0)
+        {
+            js = json_loadb(data + head, n, 0, &err);
+            if (js == NULL) return -1;
+            json_decref(js);
+
+            head += n;
+            count++;
+        }
+        if (n < 0) return -1;
+    }
+
+    return (head == len) ? count : -1;
+}
+
+/**
+ * @brief validates the framing of the traffic split at any offset
+ */
+void test_json_split_stream(void)
+{
+    size_t len = sizeof(test_ovsdb_traffic) - 1;
+    struct json_split_state st;
+    size_t read_size;
+
+    for (read_size = 1; read_size <= len; read_size++)
+    {
+        TEST_ASSERT_EQUAL_INT(TEST_TRAFFIC_MSGS,
+                test_split_stream_replay(test_ovsdb_traffic, len, read_size));
+    }
+
+    json_split_init(&st);
+    TEST_ASSERT_EQUAL_INT(-1, json_split_stream(&st, "[1,2]", 5));
+    json_split_init(&st);
+    TEST_ASSERT_EQUAL_INT(-1, json_split_stream(&st, "}", 1));
+    json_split_init(&st);
+    TEST_ASSERT_EQUAL_INT(0, json_split_stream(&st, " {\"a\":\"}", 8));
+    TEST_ASSERT_EQUAL_INT(10, json_split_stream(&st, " {\"a\":\"}\"}", 10));
+    TEST_ASSERT_EQUAL_INT(4, json_split_stream(&st, "\r\n{}\n", 5));
+}
+
+/**
+ * @brief frames the replayed traffic the way the reader did before
+ *
+ * The pending data is NUL terminated and rescanned from the start of the
+ * message on every read, then parsed from a copy and shifted down.
+ */
+static int test_split_legacy_replay(const char *data, size_t len, size_t read_size)
+{
+    json_error_t err;
+    size_t used;
+    size_t off;
+    size_t nr;
+    char *next;
+    char *buf;
+    char *str;
+    json_t *js;
+    char save;
+    int count;
+
+    buf = malloc(len + 1);
+    TEST_ASSERT_NOT_NULL(buf);
+    buf[0] = '\0';
+
+    count = 0;
+    for (off = 0; off < len; off += nr)
+    {
+        nr = (len - off < read_size) ? len - off : read_size;
+        used = strlen(buf);
+        memcpy(buf + used, data + off, nr);
+        buf[used + nr] = '\0';
+
+        str = buf;
+        while ((next = json_split(str)) != NULL && next != JSON_SPLIT_ERROR)
+        {
+            save = *next;
+            *next = '\0';
+            js = json_loads(str, 0, &err);
+            *next = save;
+            if (js == NULL) break;
+            json_decref(js);
+            str = next;
+            count++;
+        }
+        memmove(buf, str, strlen(str) + 1);
+    }
+
+    free(buf);
+    return count;
+}
+
+/**
+ * @brief replays a stream with both readers and reports their throughput
+ */
+static void test_split_report(const char *name, const char *data, size_t len, int nmsgs)
+{
+    struct timespec start;
+    double legacy_ms;
+    double stream_ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_EQUAL_INT(nmsgs, test_split_stream_replay(data, len, TEST_REPLAY_CHUNK));
+    stream_ms = test_elapsed_ms(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_EQUAL_INT(nmsgs, test_split_legacy_replay(data, len, TEST_REPLAY_CHUNK));
+    legacy_ms = test_elapsed_ms(&start);
+
+    LOGI("%s: %zu bytes, %d messages: stream: %.2f ms (%.1f MB/s), legacy: %.2f ms (%.1f MB/s)",
+         name, len, nmsgs,
+         stream_ms, len / (stream_ms * 1e3),
+         legacy_ms, len / (legacy_ms * 1e3));
+}
+
+/**
+ * @brief reports the reader throughput on replayed traffic
+ *
+ * The messages are replayed back to back, then a large initial
+ * monitor reply is built from their rows, both read in
+ * TEST_REPLAY_CHUNK bytes.
+ */
+void test_json_split_stream_throughput(void)
+{
+    size_t len = sizeof(test_ovsdb_traffic) - 1;
+    const char *row;
+    size_t row_len;
+    size_t nmsgs;
+    size_t nrows;
+    size_t off;
+    char *data;
+    size_t i;
+
+    /* Stream of small messages */
+    nmsgs = TEST_REPLAY_SIZE / len;
+    data = malloc(nmsgs * len + 1);
+    TEST_ASSERT_NOT_NULL(data);
+    for (i = 0; i < nmsgs; i++)
+    {
+        memcpy(data + i * len, test_ovsdb_traffic, len);
+    }
+    test_split_report("messages", data, nmsgs * len, nmsgs * TEST_TRAFFIC_MSGS);
+    free(data);
+
+    /* A single large monitor reply, repeating the first row */
+    row = strstr(test_ovsdb_traffic, "\"2e5e1c6a");
+    row_len = strstr(row, "}},") + 2 - row;
+    nrows = TEST_REPLAY_SIZE / 8 / row_len;
+    data = malloc(nrows * (row_len + 1) + 64);
+    TEST_ASSERT_NOT_NULL(data);
+
+    off = sprintf(data, "{\"id\":3,\"result\":{\"Wifi_Associated_Clients\":{");
+    for (i = 0; i < nrows; i++)
+    {
+        /* Unique uuids, jansson keeps only the last of duplicate keys */
+        off += sprintf(data + off, "\"%08zx%.*s,", i, (int)(row_len - 9), row + 9);
+    }
+    off += sprintf(data + off - 1, "}},\"error\":null}") - 1;
+
+    test_split_report("monitor reply", data, off, 1);
+    free(data);
+}
+
+void run_test_ovsdb_sync(void);
+void run_test_ovsdb_update(void);
+void run_test_ovsdb_read(void);
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -270,6 +627,13 @@ int main(int argc, char *argv[])
     RUN_TEST(test_schema2tree);
     RUN_TEST(test_schema2int_set);
     RUN_TEST(test_schema2itree);
+    RUN_TEST(test_cache_find_10k_rows);
+    RUN_TEST(test_json_split_stream);
+    RUN_TEST(test_json_split_stream_throughput);
+
+    run_test_ovsdb_sync();
+    run_test_ovsdb_update();
+    run_test_ovsdb_read();
 
     return UNITY_END();
 }
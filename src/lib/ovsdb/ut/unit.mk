@@ -27,9 +27,16 @@ UNIT_NAME := test_ovsdb_utils
 UNIT_TYPE := TEST_BIN
 
 UNIT_SRC := test_ovsdb_utils.c
+UNIT_SRC += test_ovsdb_sync.c
+UNIT_SRC += test_ovsdb_update.c
+UNIT_SRC += test_ovsdb_read.c
+
+UNIT_CFLAGS := -I$(UNIT_PATH)/../src
+
 UNIT_DEPS := src/lib/common
 UNIT_DEPS += src/lib/log
 UNIT_DEPS += src/lib/osa
 UNIT_DEPS += src/lib/target
 UNIT_DEPS += src/lib/ovsdb
+UNIT_DEPS += src/lib/json_util
 UNIT_DEPS += src/lib/unity
@@ -205,6 +205,19 @@ int
 om_get_type_of_tag(char *name);
 
 
+/**
+ * @brief looks up an opensync tag from its template name
+ *
+ * The tag can be a tag or a group tag
+ * @param tag_name the tag template name (${tag}, ${@tag}, $[group], ...)
+ * @param match_flags set to the flags a tag value must carry to match,
+ *        0 if any value matches
+ * @return the tag if found, NULL otherwise
+ */
+om_tag_t *
+om_tag_find_by_template(char *tag_name, int *match_flags);
+
+
 /**
  * @brief checks if a string is included in an opensync tag
  *
@@ -135,45 +135,42 @@ om_get_type_of_tag(char *name)
 }
 
 /**
- * @brief checks if a string is included in an opensync tag
+ * @brief looks up an opensync tag from its template name
  *
  * The tag can be a tag or a group tag
- * @param value the string checked for inclusion
- * @param tag_name the tag name to check
+ * @param tag_name the tag template name (${tag}, ${@tag}, $[group], ...)
+ * @param match_flags set to the flags a tag value must carry to match,
+ *        0 if any value matches
+ * @return the tag if found, NULL otherwise
  */
-bool
-om_tag_in(char *value, char *tag_name)
+om_tag_t *
+om_tag_find_by_template(char *tag_name, int *match_flags)
 {
-    om_tag_list_entry_t *e;
-    int match_flags;
     char name[256];
-    om_tag_t *tag;
     bool is_gtag;
     int tag_type;
     char *tag_s;
 
-    /* Sanity checks */
-    if (tag_name == NULL) return false;
-    if (value == NULL) return false;
+    *match_flags = 0;
+    if (tag_name == NULL) return NULL;
 
     tag_type = om_tag_get_type(tag_name);
-    if (tag_type == NOT_A_OPENSYNC_TAG) return false;
+    if (tag_type == NOT_A_OPENSYNC_TAG) return NULL;
 
-    match_flags = 0;
     tag_s = tag_name + 2;
     if (*tag_s == TEMPLATE_DEVICE_CHAR)
     {
-        match_flags = OM_TLE_FLAG_DEVICE;
+        *match_flags = OM_TLE_FLAG_DEVICE;
         tag_s += 1;
     }
     else if (*tag_s == TEMPLATE_CLOUD_CHAR)
     {
-        match_flags = OM_TLE_FLAG_CLOUD;
+        *match_flags = OM_TLE_FLAG_CLOUD;
         tag_s += 1;
     }
     else if (*tag_s == TEMPLATE_LOCAL_CHAR)
     {
-        match_flags = OM_TLE_FLAG_LOCAL;
+        *match_flags = OM_TLE_FLAG_LOCAL;
         tag_s += 1;
     }
 
@@ -182,10 +179,31 @@ om_tag_in(char *value, char *tag_name)
 
     is_gtag = (tag_type == OPENSYNC_GROUP_TAG);
 
-    tag = om_tag_find_by_name(name, is_gtag);
-    if (tag == NULL) return false;
+    return om_tag_find_by_name(name, is_gtag);
+}
 
 
+/**
+ * @brief checks if a string is included in an opensync tag
+ *
+ * The tag can be a tag or a group tag
+ * @param value the string checked for inclusion
+ * @param tag_name the tag name to check
+ */
+bool
+om_tag_in(char *value, char *tag_name)
+{
+    om_tag_list_entry_t *e;
+    int match_flags;
+    om_tag_t *tag;
+
+    /* Sanity checks */
+    if (tag_name == NULL) return false;
+    if (value == NULL) return false;
+
+    tag = om_tag_find_by_template(tag_name, &match_flags);
+    if (tag == NULL) return false;
+
     e = om_tag_list_entry_find_by_value(&tag->values, value);
     if (e == NULL) return false;
 
@@ -40,6 +40,7 @@ struct psfs
     ds_tree_t       psfs_root;          /* Key/Value cache */
     ssize_t         psfs_used;          /* Number of bytes used by "good" records
                                            in this store */
+    bool            psfs_journal;       /* A compaction journal is pending removal */
 };
 
 typedef struct psfs psfs_t;
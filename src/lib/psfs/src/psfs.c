@@ -34,6 +34,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "log.h"
 #include "osp_ps.h"
@@ -51,12 +52,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define PSFS_MAGIC                          0x50534653
 /* Padding pattern */
 #define PSFS_PADDING                        0xFF
+/* Records are aligned to 4 bytes */
+#define PSFS_ALIGN(x)                       (((x) + 0x3) & ~0x3)
 
 /* CRC32 polynomial */
 #define PSFS_CRC32_POLY                     0xEDB88320
 /* Running a CRC32 over a "data + CRC32" buffer will always yield this number */
 #define PSFS_CRC32_VERIFY                   0x2144DF1C
 
+/* Use the ARMv8 CRC32 instructions when the CPU supports them */
+#if defined(__aarch64__) && defined(__GNUC__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define PSFS_CRC32_ARM64
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32                         (1 << 7)
+#endif
+#endif
+
 #define PSFS_INIT (psfs_t)      \
 {                               \
     .psfs_fd = -1,              \
@@ -67,6 +79,13 @@ static int psfs_dir_open(bool preserve);
 static bool psfs_dir_close(bool preserve);
 static bool psfs_sync_append(psfs_t *ps);
 static bool psfs_sync_prune(psfs_t *ps);
+static bool psfs_sync_compact(psfs_t *ps, off_t cut);
+static off_t psfs_compact_cut(psfs_t *ps, ssize_t *moved);
+static bool psfs_journal_write(psfs_t *ps);
+static bool psfs_journal_load(psfs_t *ps);
+static bool psfs_journal_replay(psfs_t *ps);
+static bool psfs_journal_clear(psfs_t *ps);
+static void psfs_load_records(psfs_t *ps, int fd);
 static bool psfs_file_lock(int fd, bool exclusive);
 static bool psfs_file_unlock(int fd);
 static void psfs_drop_record(psfs_t *ps, struct psfs_record *pr, ds_tree_iter_t *iter);
@@ -193,6 +212,13 @@ retry:
         goto retry;
     }
 
+    /* Complete an interrupted compaction before anything else is written */
+    if ((flags & OSP_PS_WRITE) && !psfs_journal_replay(ps))
+    {
+        LOG(ERR, "psfs: %s: Error replaying compaction journal.", ps->psfs_name);
+        goto error;
+    }
+
     return true;
 
 error:
@@ -278,9 +304,12 @@ bool psfs_sync(psfs_t *ps, bool force_prune)
 {
     double wasted_ratio;
     ssize_t wasted;
+    ssize_t moved;
     struct stat st;
+    off_t cut;
 
     bool prune = false;
+    bool retval;
 
     if ((ps->psfs_flags & OSP_PS_WRITE) == 0)
     {
@@ -322,17 +351,47 @@ bool psfs_sync(psfs_t *ps, bool force_prune)
         }
     }
 
-    /* Heuristic to decide whether to do an append or prune operation */
-    if (prune || force_prune)
+    /*
+     * Heuristic to decide whether to do an append, compact or prune operation.
+     *
+     * Dead records that are located past the last contiguous run of live
+     * records can be reclaimed by truncating the file and re-appending only
+     * the live records that follow. This is preferred over a full prune when
+     * the amount of data that must be moved is small compared to the store.
+     */
+    if (force_prune)
     {
-        return psfs_sync_prune(ps);
+        retval = psfs_sync_prune(ps);
+    }
+    else if (prune)
+    {
+        cut = psfs_compact_cut(ps, &moved);
+        if ((moved * 100) <= (ps->psfs_used * CONFIG_PSFS_SYNC_COMPACT_RATIO_MAX))
+        {
+            LOG(INFO, "psfs: %s: Compacting from offset %jd, moving %zd of %zd bytes.",
+                    ps->psfs_name,
+                    (intmax_t)cut,
+                    moved,
+                    ps->psfs_used);
+            retval = psfs_sync_compact(ps, cut);
+        }
+        else
+        {
+            retval = psfs_sync_prune(ps);
+        }
     }
     else
     {
-        return psfs_sync_append(ps);
+        retval = psfs_sync_append(ps);
     }
 
-    return true;
+    /* The store is consistent again, the compaction journal is not needed anymore */
+    if (retval && ps->psfs_journal)
+    {
+        retval = psfs_journal_clear(ps);
+    }
+
+    return retval;
 }
 
 /**
@@ -345,19 +404,42 @@ bool psfs_sync(psfs_t *ps, bool force_prune)
  * This function returns true if the operation was successful or false otherwise.
  */
 bool psfs_load(psfs_t *ps)
+{
+    /*
+     * Cache all records in the database to RAM
+     */
+    psfs_load_records(ps, ps->psfs_fd);
+
+    /*
+     * Merge records from an interrupted compaction, if any. Writers replay
+     * the journal in psfs_open() already.
+     */
+    if ((ps->psfs_flags & OSP_PS_WRITE) == 0)
+    {
+        return psfs_journal_load(ps);
+    }
+
+    return true;
+}
+
+/**
+ * Read all records from @p fd and merge them into the store cache; records
+ * read later replace the previous ones.
+ *
+ * @param[in]   ps      Pointer to a valid psfs store object
+ * @param[in]   fd      File descriptor positioned at the first record
+ */
+void psfs_load_records(psfs_t *ps, int fd)
 {
     ssize_t rc;
 
     struct psfs_record *pr = NULL;
 
-    /*
-     * Cache all records in the database to RAM
-     */
     do
     {
         pr = calloc(1, sizeof(*pr));
 
-        rc = psfs_record_read(ps->psfs_fd, pr);
+        rc = psfs_record_read(fd, pr);
         if (rc <= 0)
         {
             free(pr);
@@ -386,8 +468,6 @@ bool psfs_load(psfs_t *ps)
         ps->psfs_used += pr->pr_used;
     }
     while (rc != 0);
-
-    return true;
 }
 
 /**
@@ -413,6 +493,13 @@ bool psfs_erase(psfs_t *ps)
         return false;
     }
 
+    /* A failed compaction must not resurrect records after the erase */
+    if (ps->psfs_journal && !psfs_journal_clear(ps))
+    {
+        LOG(ERR, "psfs: %s: Error removing compaction journal (erase).", ps->psfs_name);
+        return false;
+    }
+
     /* Truncate file to 0 bytes  */
     if (ftruncate(ps->psfs_fd, 0) != 0)
     {
@@ -859,6 +946,9 @@ ssize_t psfs_record_write(int fd, struct psfs_record *pr)
         bpadlen = 4 - ((st.st_size) & 0x3);
     }
 
+    /* Since the file was opened with O_APPEND, this is where the record lands */
+    pr->pr_off = st.st_size + bpadlen;
+
     wmagic = htonl(PSFS_MAGIC);
     ksz = strlen(pr->pr_key) + sizeof(char);
     wsz = htonl(ksz + pr->pr_datasz);
@@ -1105,6 +1195,7 @@ ssize_t psfs_record_read(int fd, struct psfs_record *pr)
     pr->pr_data = (uint8_t *)pr->pr_key + doff;
     pr->pr_datasz = pr_size - doff;
     pr->pr_used = retval;
+    pr->pr_off = coff;
 
     return retval;
 
@@ -1273,7 +1364,509 @@ error:
 }
 
 /**
- * Table-less CRC32 function implementation.
+ * Order records by their offset in the store file
+ */
+static int psfs_record_off_cmp(const void *_a, const void *_b)
+{
+    const struct psfs_record *a = *(struct psfs_record * const *)_a;
+    const struct psfs_record *b = *(struct psfs_record * const *)_b;
+
+    if (a->pr_off < b->pr_off) return -1;
+    if (a->pr_off > b->pr_off) return 1;
+
+    return 0;
+}
+
+/**
+ * Find the compaction offset, which is the end of the contiguous run of live
+ * records at the beginning of the store file. Any dead record (replaced,
+ * deleted or corrupted) is located past this offset.
+ *
+ * @param[in]   ps      Pointer to a valid psfs store object
+ * @param[out]  moved   Number of bytes in live records that would have to be
+ *                      rewritten if the file was truncated at the returned
+ *                      offset (this includes dirty records)
+ *
+ * @return
+ * This function returns the compaction offset.
+ */
+off_t psfs_compact_cut(psfs_t *ps, ssize_t *moved)
+{
+    struct psfs_record **prs;
+    struct psfs_record *pr;
+    size_t nprs;
+    size_t ii;
+    off_t cut;
+
+    *moved = 0;
+
+    nprs = 0;
+    ds_tree_foreach(&ps->psfs_root, pr)
+    {
+        nprs++;
+    }
+
+    prs = calloc(nprs + 1, sizeof(*prs));
+    if (prs == NULL)
+    {
+        /* Pretend everything must be moved, this falls back to prune */
+        *moved = ps->psfs_used;
+        return 0;
+    }
+
+    nprs = 0;
+    ds_tree_foreach(&ps->psfs_root, pr)
+    {
+        /* Deleted keys are dropped during compaction */
+        if (pr->pr_datasz == 0) continue;
+
+        /* Dirty records must be written regardless of the offset */
+        if (pr->pr_dirty)
+        {
+            *moved += pr->pr_used;
+            continue;
+        }
+
+        prs[nprs++] = pr;
+    }
+
+    qsort(prs, nprs, sizeof(*prs), psfs_record_off_cmp);
+
+    cut = 0;
+    for (ii = 0; ii < nprs && prs[ii]->pr_off == cut; ii++)
+    {
+        cut = prs[ii]->pr_off + PSFS_ALIGN(prs[ii]->pr_used);
+    }
+
+    for (; ii < nprs; ii++)
+    {
+        *moved += prs[ii]->pr_used;
+    }
+
+    free(prs);
+
+    return cut;
+}
+
+/**
+ * Transfer all dirty records to physical media (flush). This function performs
+ * an incremental compaction: live records located past @p cut are saved to a
+ * journal, the store file is truncated at @p cut and the records are appended
+ * back. Unlike prune mode, records in front of @p cut are never rewritten.
+ *
+ * If the process is interrupted after the journal was written, the next
+ * psfs_open() in write mode appends the journal to the (possibly truncated)
+ * store. Readers merge it in psfs_load() meanwhile.
+ *
+ * @param[in]   ps      Pointer to a valid psfs store object
+ * @param[in]   cut     Offset as returned by psfs_compact_cut()
+ *
+ * @return
+ * This function returns true on success or false on error.
+ */
+bool psfs_sync_compact(psfs_t *ps, off_t cut)
+{
+    struct psfs_record *pr;
+    ds_tree_iter_t iter;
+
+    int moved = 0;
+
+    if ((ps->psfs_flags & OSP_PS_WRITE) == 0)
+    {
+        LOG(ERR, "psfs: %s: Unable to sync data (compact), read-only mode.", ps->psfs_name);
+        return false;
+    }
+
+    LOG(DEBUG, "psfs: %s: Syncing in compact mode.", ps->psfs_name);
+
+    ds_tree_foreach_iter(&ps->psfs_root, pr, &iter)
+    {
+        /*
+         * Deleted records and the records they replace are all past the
+         * cut offset, truncating the file takes care of them
+         */
+        if (pr->pr_datasz == 0)
+        {
+            LOG(DEBUG, "psfs: %s: Deleting record %s.", ps->psfs_name, pr->pr_key);
+            psfs_drop_record(ps, pr, &iter);
+            continue;
+        }
+
+        if (!pr->pr_dirty && pr->pr_off < cut) continue;
+
+        /* This record must be appended back after truncation */
+        pr->pr_dirty = true;
+        moved++;
+    }
+
+    if (moved > 0 && !psfs_journal_write(ps))
+    {
+        LOG(WARN, "psfs: %s: Error writing compaction journal, falling back to prune mode.",
+                ps->psfs_name);
+        return psfs_sync_prune(ps);
+    }
+
+    /*
+     * If truncation fails, appending the dirty records still results in a
+     * consistent store, just not a compacted one.
+     */
+    if (ftruncate(ps->psfs_fd, cut) != 0)
+    {
+        LOG(ERR, "psfs: %s: Error truncating store (compact). Error: %s",
+                ps->psfs_name,
+                strerror(errno));
+    }
+
+    return psfs_sync_append(ps);
+}
+
+/**
+ * Write all dirty records to the compaction journal. The records are
+ * left flagged as dirty as they still have to be written to the store.
+ *
+ * The journal is first written to a temporary file, which is renamed only
+ * after its content is flushed to disk. The presence of the journal file
+ * thus guarantees that it is complete.
+ *
+ * @param[in]   ps      Pointer to a valid psfs store object
+ *
+ * @return
+ * This function returns true on success or false on error.
+ */
+bool psfs_journal_write(psfs_t *ps)
+{
+    char tname[64 + 16];
+    char jname[64 + 16];
+    struct psfs_record *pr;
+
+    int tfd = -1;
+    bool retval = false;
+
+    snprintf(tname, sizeof(tname), ".%s.tmp", ps->psfs_name);
+    snprintf(jname, sizeof(jname), ".%s.journal", ps->psfs_name);
+
+    (void)unlinkat(ps->psfs_dirfd, tname, 0);
+
+    tfd = openat(ps->psfs_dirfd, tname, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0600);
+    if (tfd < 0)
+    {
+        LOG(ERR, "psfs: %s: Error creating journal file. Error: %s.", ps->psfs_name, strerror(errno));
+        goto error;
+    }
+
+    ds_tree_foreach(&ps->psfs_root, pr)
+    {
+        if (!pr->pr_dirty) continue;
+
+        if (psfs_record_write(tfd, pr) <= 0)
+        {
+            LOG(ERR, "psfs: %s: Error writing record to journal.", ps->psfs_name);
+            goto error;
+        }
+
+        /* psfs_record_write() clears the flag, but the record is not in the store yet */
+        pr->pr_dirty = true;
+    }
+
+    if (fsync(tfd) != 0)
+    {
+        LOG(ERR, "psfs: %s: Error syncing journal data.", ps->psfs_name);
+        goto error;
+    }
+
+    if (renameat(ps->psfs_dirfd, tname, ps->psfs_dirfd, jname) != 0)
+    {
+        LOG(ERR, "psfs: %s: Error renaming journal file.", ps->psfs_name);
+        goto error;
+    }
+
+    /* From now on the journal must be removed once the store is consistent */
+    ps->psfs_journal = true;
+
+    if (fsync(ps->psfs_dirfd) != 0)
+    {
+        LOG(ERR, "psfs: %s: Error syncing store folder.", ps->psfs_name);
+        goto error;
+    }
+
+    retval = true;
+
+error:
+    if (tfd >= 0) close(tfd);
+    if (!ps->psfs_journal) (void)unlinkat(ps->psfs_dirfd, tname, 0);
+
+    return retval;
+}
+
+/**
+ * Merge the records of an interrupted compaction, if a journal is present,
+ * into the store cache. This is used by readers, which cannot modify the
+ * store.
+ *
+ * @param[in]   ps      Pointer to a valid psfs store object
+ *
+ * @return
+ * This function returns true on success or false on error.
+ */
+bool psfs_journal_load(psfs_t *ps)
+{
+    char jname[64 + 16];
+    int jfd;
+
+    snprintf(jname, sizeof(jname), ".%s.journal", ps->psfs_name);
+
+    jfd = openat(ps->psfs_dirfd, jname, O_RDONLY);
+    if (jfd < 0)
+    {
+        if (errno == ENOENT) return true;
+
+        LOG(ERR, "psfs: %s: Error opening journal file. Error: %s", ps->psfs_name, strerror(errno));
+        return false;
+    }
+
+    LOG(NOTICE, "psfs: %s: Loading records from an interrupted compaction.", ps->psfs_name);
+
+    psfs_load_records(ps, jfd);
+
+    close(jfd);
+
+    return true;
+}
+
+/**
+ * Complete an interrupted compaction: append the records saved in the
+ * journal to the store, flush them to disk and remove the journal.
+ *
+ * Records from the journal may already be present in the store if the
+ * compaction was interrupted while appending them; since later records
+ * replace previous ones, writing them twice is harmless.
+ *
+ * @param[in]   ps      Pointer to a valid psfs store object
+ *
+ * @return
+ * This function returns true on success or false on error.
+ */
+bool psfs_journal_replay(psfs_t *ps)
+{
+    char jname[64 + 16];
+    struct psfs_record pr;
+    ssize_t rc;
+    int jfd;
+
+    bool retval = false;
+
+    snprintf(jname, sizeof(jname), ".%s.journal", ps->psfs_name);
+
+    jfd = openat(ps->psfs_dirfd, jname, O_RDONLY);
+    if (jfd < 0)
+    {
+        if (errno == ENOENT) return true;
+
+        LOG(ERR, "psfs: %s: Error opening journal file. Error: %s", ps->psfs_name, strerror(errno));
+        return false;
+    }
+
+    LOG(NOTICE, "psfs: %s: Replaying interrupted compaction.", ps->psfs_name);
+
+    ps->psfs_journal = true;
+
+    do
+    {
+        rc = psfs_record_read(jfd, &pr);
+        if (rc <= 0) continue;
+
+        rc = psfs_record_write(ps->psfs_fd, &pr);
+        psfs_record_fini(&pr);
+        if (rc <= 0)
+        {
+            LOG(ERR, "psfs: %s: Error writing record (replay).", ps->psfs_name);
+            goto error;
+        }
+    }
+    while (rc != 0);
+
+    if (fsync(ps->psfs_fd) != 0)
+    {
+        LOG(ERR, "psfs: %s: Error syncing (replay) storage data.", ps->psfs_name);
+        goto error;
+    }
+
+    /* Writing moved the file position, psfs_load() reads from the beginning */
+    if (lseek(ps->psfs_fd, 0, SEEK_SET) != 0)
+    {
+        LOG(ERR, "psfs: %s: Error seeking to the beginning of file (replay).", ps->psfs_name);
+        goto error;
+    }
+
+    retval = psfs_journal_clear(ps);
+
+error:
+    close(jfd);
+
+    return retval;
+}
+
+/**
+ * Remove the compaction journal and flush the removal to disk.
+ *
+ * @param[in]   ps      Pointer to a valid psfs store object
+ *
+ * @return
+ * This function returns true on success or false on error.
+ */
+bool psfs_journal_clear(psfs_t *ps)
+{
+    char jname[64 + 16];
+
+    snprintf(jname, sizeof(jname), ".%s.journal", ps->psfs_name);
+
+    if (unlinkat(ps->psfs_dirfd, jname, 0) != 0 && errno != ENOENT)
+    {
+        LOG(ERR, "psfs: %s: Error removing journal file. Error: %s", ps->psfs_name, strerror(errno));
+        return false;
+    }
+
+    if (fsync(ps->psfs_dirfd) != 0)
+    {
+        LOG(ERR, "psfs: %s: Error syncing store folder.", ps->psfs_name);
+        return false;
+    }
+
+    ps->psfs_journal = false;
+
+    return true;
+}
+
+/**
+ * Slice-by-8 CRC32 lookup tables, psfs_crc32_table[0] is the classic
+ * byte-at-a-time table. Generated once by psfs_crc32_init().
+ */
+static uint32_t psfs_crc32_table[8][256];
+
+static pthread_once_t psfs_crc32_once = PTHREAD_ONCE_INIT;
+
+/*
+ * CRC32 implementation selected by psfs_crc32_init(). Implementations
+ * operate on the raw (non-inverted) CRC register.
+ */
+static uint32_t (*psfs_crc32_fn)(uint32_t crc, const uint8_t *buf, size_t bufsz);
+
+/* Load a 32-bit little-endian word, independent of the host byte order */
+static inline uint32_t psfs_crc32_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * Portable slice-by-8 CRC32: process 8 bytes per iteration using 8 lookup
+ * tables, fall back to the byte-at-a-time table for the remainder.
+ */
+static uint32_t psfs_crc32_slice8(uint32_t crc, const uint8_t *buf, size_t bufsz)
+{
+    uint32_t lo;
+    uint32_t hi;
+
+    for (; bufsz >= 8; buf += 8, bufsz -= 8)
+    {
+        lo = crc ^ psfs_crc32_le32(buf);
+        hi = psfs_crc32_le32(buf + 4);
+
+        crc = psfs_crc32_table[7][lo & 0xFF] ^
+              psfs_crc32_table[6][(lo >> 8) & 0xFF] ^
+              psfs_crc32_table[5][(lo >> 16) & 0xFF] ^
+              psfs_crc32_table[4][lo >> 24] ^
+              psfs_crc32_table[3][hi & 0xFF] ^
+              psfs_crc32_table[2][(hi >> 8) & 0xFF] ^
+              psfs_crc32_table[1][(hi >> 16) & 0xFF] ^
+              psfs_crc32_table[0][hi >> 24];
+    }
+
+    for (; bufsz > 0; buf++, bufsz--)
+    {
+        crc = (crc >> 8) ^ psfs_crc32_table[0][(crc ^ *buf) & 0xFF];
+    }
+
+    return crc;
+}
+
+#if defined(PSFS_CRC32_ARM64)
+/**
+ * ARMv8 CRC32 extension. Unlike the SSE4.2 instruction, which implements
+ * CRC32C (Castagnoli), the ARMv8 CRC32{B,W,X} instructions use the same
+ * polynomial as PSFS so the on-disk format is preserved.
+ *
+ * The ".arch_extension" directive allows the assembler to accept the CRC
+ * instructions even if the toolchain does not target them by default; the
+ * code path is selected at runtime only if the CPU advertises HWCAP_CRC32.
+ */
+static uint32_t psfs_crc32_arm64(uint32_t crc, const uint8_t *buf, size_t bufsz)
+{
+    uint64_t dw;
+
+    /* Align to 8 bytes */
+    for (; bufsz > 0 && ((uintptr_t)buf & 0x7) != 0; buf++, bufsz--)
+    {
+        __asm__(".arch_extension crc\n\tcrc32b %w0, %w0, %w1" : "+r"(crc) : "r"((uint32_t)*buf));
+    }
+
+    for (; bufsz >= 8; buf += 8, bufsz -= 8)
+    {
+        memcpy(&dw, buf, sizeof(dw));
+        __asm__(".arch_extension crc\n\tcrc32x %w0, %w0, %x1" : "+r"(crc) : "r"(dw));
+    }
+
+    for (; bufsz > 0; buf++, bufsz--)
+    {
+        __asm__(".arch_extension crc\n\tcrc32b %w0, %w0, %w1" : "+r"(crc) : "r"((uint32_t)*buf));
+    }
+
+    return crc;
+}
+#endif
+
+/**
+ * Generate the slice-by-8 tables and select the fastest CRC32 implementation
+ * available on this CPU.
+ */
+static void psfs_crc32_init(void)
+{
+    uint32_t crc;
+    int ii;
+    int jj;
+
+    for (ii = 0; ii < 256; ii++)
+    {
+        crc = ii;
+        for (jj = 0; jj < 8; jj++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ PSFS_CRC32_POLY : crc >> 1;
+        }
+        psfs_crc32_table[0][ii] = crc;
+    }
+
+    for (ii = 0; ii < 256; ii++)
+    {
+        crc = psfs_crc32_table[0][ii];
+        for (jj = 1; jj < 8; jj++)
+        {
+            crc = (crc >> 8) ^ psfs_crc32_table[0][crc & 0xFF];
+            psfs_crc32_table[jj][ii] = crc;
+        }
+    }
+
+    psfs_crc32_fn = psfs_crc32_slice8;
+
+#if defined(PSFS_CRC32_ARM64)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+    {
+        LOG(DEBUG, "psfs: Using ARMv8 CRC32 instructions.");
+        psfs_crc32_fn = psfs_crc32_arm64;
+    }
+#endif
+}
+
+/**
+ * CRC32 function implementation (IEEE 802.3 polynomial, reflected).
  *
  * @param[in]   crc     Previous CRC value
  * @param[in]   buf     Data
@@ -1288,18 +1881,9 @@ error:
  */
 uint32_t psfs_crc32(uint32_t crc, void *buf, ssize_t bufsz)
 {
-    uint8_t *pbuf;
-    int ii;
+    pthread_once(&psfs_crc32_once, psfs_crc32_init);
 
-    crc = ~crc;
-    for (pbuf = buf; bufsz-- > 0; pbuf++)
-    {
-        crc ^= *pbuf;
-        for (ii = 0; ii < 8; ii++)
-        {
-            crc = (crc & 1) ? (crc >> 1) ^ PSFS_CRC32_POLY : crc >> 1;
-        }
-    }
+    if (bufsz <= 0) return crc;
 
-    return ~crc;
+    return ~psfs_crc32_fn(~crc, buf, (size_t)bufsz);
 }
@@ -38,5 +38,8 @@ UNIT_EXPORT_CFLAGS := -I$(UNIT_PATH)/inc
 
 UNIT_SRC += src/psfs.c
 
+UNIT_LDFLAGS += -lpthread
+UNIT_EXPORT_LDFLAGS := $(UNIT_LDFLAGS)
+
 UNIT_DEPS_CFLAGS += src/lib/log
 UNIT_DEPS_CFLAGS += src/lib/osp
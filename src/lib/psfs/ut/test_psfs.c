@@ -0,0 +1,334 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "const.h"
+#include "log.h"
+#include "os_time.h"
+#include "osp_ps.h"
+#include "target.h"
+#include "unity.h"
+#include "psfs.h"
+
+#define TEST_STORE          "test_psfs"
+#define TEST_BENCH_KEYS     10000
+#define TEST_HOT_KEYS       100
+#define TEST_HOT_ROUNDS     50
+
+const char *test_name = "psfs_tests";
+
+/* Not part of the public API, used to craft a compaction journal */
+void psfs_record_init(struct psfs_record *pr, const char *key, const void *data, size_t datasz);
+void psfs_record_fini(struct psfs_record *pr);
+ssize_t psfs_record_write(int fd, struct psfs_record *pr);
+
+
+static void
+test_key(char *key, size_t keysz, int i)
+{
+    snprintf(key, keysz, "key_%05d", i);
+}
+
+
+static void
+test_value(char *value, size_t valuesz, int i, int round)
+{
+    snprintf(value, valuesz, "{\"id\":%d,\"round\":%d,\"payload\":\"%0*d\"}",
+             i, round, 32 + (i % 64), i);
+}
+
+
+static off_t
+test_store_size(void)
+{
+    char path[256];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s/%s", CONFIG_PSFS_DIR, TEST_STORE);
+    if (stat(path, &st) != 0) return -1;
+
+    return st.st_size;
+}
+
+
+/**
+ * @brief verifies that the store holds keys [0, nkeys) at the given rounds
+ */
+static void
+test_verify(int nkeys, int hot_round, int deleted)
+{
+    char value[256];
+    char exp[256];
+    char key[32];
+    psfs_t ps;
+    ssize_t rc;
+    int i;
+
+    TEST_ASSERT_TRUE(psfs_open(&ps, TEST_STORE, OSP_PS_READ));
+    TEST_ASSERT_TRUE(psfs_load(&ps));
+
+    for (i = 0; i < nkeys; i++)
+    {
+        test_key(key, sizeof(key), i);
+        rc = psfs_get(&ps, key, value, sizeof(value));
+
+        if (i < deleted)
+        {
+            TEST_ASSERT_EQUAL_INT(0, rc);
+            continue;
+        }
+
+        test_value(exp, sizeof(exp), i, i >= nkeys - TEST_HOT_KEYS ? hot_round : 0);
+        TEST_ASSERT_EQUAL_INT((ssize_t)strlen(exp) + 1, rc);
+        TEST_ASSERT_EQUAL_STRING(exp, value);
+    }
+
+    TEST_ASSERT_TRUE(psfs_close(&ps));
+}
+
+
+void
+setUp(void)
+{
+    psfs_t ps;
+
+    TEST_ASSERT_TRUE(psfs_open(&ps, TEST_STORE, OSP_PS_RDWR));
+    TEST_ASSERT_TRUE(psfs_erase(&ps));
+    TEST_ASSERT_TRUE(psfs_close(&ps));
+}
+
+
+void
+tearDown(void)
+{
+    setUp();
+}
+
+
+/**
+ * @brief 10k keys: set and sync, then load and get
+ */
+void
+test_psfs_bench(void)
+{
+    char value[256];
+    char key[32];
+    int64_t start;
+    int64_t set_us;
+    int64_t sync_us;
+    int64_t load_us;
+    int64_t get_us;
+    psfs_t ps;
+    int i;
+
+    TEST_ASSERT_TRUE(psfs_open(&ps, TEST_STORE, OSP_PS_RDWR));
+    TEST_ASSERT_TRUE(psfs_load(&ps));
+
+    start = clock_mono_usec();
+    for (i = 0; i < TEST_BENCH_KEYS; i++)
+    {
+        test_key(key, sizeof(key), i);
+        test_value(value, sizeof(value), i, 0);
+        TEST_ASSERT_TRUE(psfs_set(&ps, key, value, strlen(value) + 1) > 0);
+    }
+    set_us = clock_mono_usec() - start;
+
+    start = clock_mono_usec();
+    TEST_ASSERT_TRUE(psfs_sync(&ps, false));
+    sync_us = clock_mono_usec() - start;
+
+    TEST_ASSERT_TRUE(psfs_close(&ps));
+
+    TEST_ASSERT_TRUE(psfs_open(&ps, TEST_STORE, OSP_PS_READ));
+
+    start = clock_mono_usec();
+    TEST_ASSERT_TRUE(psfs_load(&ps));
+    load_us = clock_mono_usec() - start;
+
+    start = clock_mono_usec();
+    for (i = 0; i < TEST_BENCH_KEYS; i++)
+    {
+        test_key(key, sizeof(key), i);
+        TEST_ASSERT_TRUE(psfs_get(&ps, key, value, sizeof(value)) > 0);
+    }
+    get_us = clock_mono_usec() - start;
+
+    TEST_ASSERT_TRUE(psfs_close(&ps));
+
+    LOGI("%s: %d keys, %jd bytes: set %"PRId64" us, sync %"PRId64" us, "
+         "load %"PRId64" us, get %"PRId64" us",
+         __func__, TEST_BENCH_KEYS, (intmax_t)test_store_size(),
+         set_us, sync_us, load_us, get_us);
+
+    test_verify(TEST_BENCH_KEYS, 0, 0);
+}
+
+
+/**
+ * @brief repeatedly updated keys are compacted without rewriting the store
+ */
+void
+test_psfs_compact(void)
+{
+    char value[256];
+    char key[32];
+    int64_t start;
+    int64_t sync_us;
+    off_t base_size;
+    psfs_t ps;
+    int round;
+    int i;
+
+    TEST_ASSERT_TRUE(psfs_open(&ps, TEST_STORE, OSP_PS_RDWR));
+    for (i = 0; i < TEST_BENCH_KEYS; i++)
+    {
+        test_key(key, sizeof(key), i);
+        test_value(value, sizeof(value), i, 0);
+        TEST_ASSERT_TRUE(psfs_set(&ps, key, value, strlen(value) + 1) > 0);
+    }
+    TEST_ASSERT_TRUE(psfs_close(&ps));
+    base_size = test_store_size();
+
+    sync_us = 0;
+    for (round = 1; round <= TEST_HOT_ROUNDS; round++)
+    {
+        TEST_ASSERT_TRUE(psfs_open(&ps, TEST_STORE, OSP_PS_RDWR));
+        TEST_ASSERT_TRUE(psfs_load(&ps));
+
+        for (i = TEST_BENCH_KEYS - TEST_HOT_KEYS; i < TEST_BENCH_KEYS; i++)
+        {
+            test_key(key, sizeof(key), i);
+            test_value(value, sizeof(value), i, round);
+            TEST_ASSERT_TRUE(psfs_set(&ps, key, value, strlen(value) + 1) > 0);
+        }
+
+        start = clock_mono_usec();
+        TEST_ASSERT_TRUE(psfs_sync(&ps, false));
+        sync_us += clock_mono_usec() - start;
+
+        TEST_ASSERT_TRUE(psfs_close(&ps));
+
+        /* Dead records never accumulate past the pruning thresholds */
+        TEST_ASSERT_TRUE(test_store_size() <= base_size + CONFIG_PSFS_SYNC_WASTED_MAX * 1024 + 4096);
+    }
+
+    LOGI("%s: %d rounds of %d updates: sync %"PRId64" us, size %jd -> %jd bytes",
+         __func__, TEST_HOT_ROUNDS, TEST_HOT_KEYS, sync_us,
+         (intmax_t)base_size, (intmax_t)test_store_size());
+
+    test_verify(TEST_BENCH_KEYS, TEST_HOT_ROUNDS, 0);
+
+    /* Deleted keys must stay deleted across compactions */
+    TEST_ASSERT_TRUE(psfs_open(&ps, TEST_STORE, OSP_PS_RDWR));
+    TEST_ASSERT_TRUE(psfs_load(&ps));
+    for (i = 0; i < TEST_BENCH_KEYS / 2; i++)
+    {
+        test_key(key, sizeof(key), i);
+        TEST_ASSERT_EQUAL_INT(0, psfs_set(&ps, key, NULL, 0));
+    }
+    TEST_ASSERT_TRUE(psfs_close(&ps));
+
+    test_verify(TEST_BENCH_KEYS, TEST_HOT_ROUNDS, TEST_BENCH_KEYS / 2);
+    TEST_ASSERT_TRUE(test_store_size() < base_size);
+}
+
+
+/**
+ * @brief records of an interrupted compaction are replayed on load
+ */
+void
+test_psfs_journal(void)
+{
+    struct psfs_record pr;
+    char value[256];
+    char path[256];
+    char key[32];
+    psfs_t ps;
+    int fd;
+    int i;
+
+    TEST_ASSERT_TRUE(psfs_open(&ps, TEST_STORE, OSP_PS_RDWR));
+    for (i = 0; i < TEST_BENCH_KEYS; i++)
+    {
+        test_key(key, sizeof(key), i);
+        test_value(value, sizeof(value), i, 0);
+        TEST_ASSERT_TRUE(psfs_set(&ps, key, value, strlen(value) + 1) > 0);
+    }
+    TEST_ASSERT_TRUE(psfs_close(&ps));
+
+    /* The journal holds the latest value of the hot keys */
+    snprintf(path, sizeof(path), "%s/.%s.journal", CONFIG_PSFS_DIR, TEST_STORE);
+    fd = open(path, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0600);
+    TEST_ASSERT_TRUE(fd >= 0);
+    for (i = TEST_BENCH_KEYS - TEST_HOT_KEYS; i < TEST_BENCH_KEYS; i++)
+    {
+        test_key(key, sizeof(key), i);
+        test_value(value, sizeof(value), i, 1);
+        psfs_record_init(&pr, key, value, strlen(value) + 1);
+        TEST_ASSERT_TRUE(psfs_record_write(fd, &pr) > 0);
+        psfs_record_fini(&pr);
+    }
+    close(fd);
+
+    /* Readers see the journal but leave it in place */
+    test_verify(TEST_BENCH_KEYS, 1, 0);
+    TEST_ASSERT_EQUAL_INT(0, access(path, F_OK));
+
+    /* Writers append it to the store and remove it */
+    TEST_ASSERT_TRUE(psfs_open(&ps, TEST_STORE, OSP_PS_RDWR));
+    TEST_ASSERT_TRUE(access(path, F_OK) != 0);
+    TEST_ASSERT_TRUE(psfs_load(&ps));
+    TEST_ASSERT_TRUE(psfs_close(&ps));
+
+    test_verify(TEST_BENCH_KEYS, 1, 0);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_psfs_bench);
+    RUN_TEST(test_psfs_compact);
+    RUN_TEST(test_psfs_journal);
+
+    return UNITY_END();
+}
@@ -291,3 +291,89 @@ bool nfm_osfw_del_rule(const struct schema_Netfilter *conf)
 	return true;
 }
 
+
+bool nfm_osfw_add_set(int family, const char *name, bool mac)
+{
+	bool errcode = true;
+
+	if (((family != AF_INET) && (family != AF_INET6)) || !name || !name[0]) {
+		LOGE("Add firewall set: invalid parameters");
+		return false;
+	}
+
+	errcode = osfw_ipset_add(family, name, mac ? OSFW_IPSET_HASH_MAC : OSFW_IPSET_HASH_NET);
+	if (!errcode) {
+		LOGE("Add firewall set %s failed", name);
+		return false;
+	}
+	return true;
+}
+
+bool nfm_osfw_del_set(const char *name)
+{
+	bool errcode = true;
+
+	if (!name || !name[0]) {
+		LOGE("Delete firewall set: invalid parameters");
+		return false;
+	}
+
+	errcode = osfw_ipset_del(name);
+	if (!errcode) {
+		LOGE("Delete firewall set %s failed", name);
+		return false;
+	}
+
+	errcode = nfm_osfw_reschedule();
+	if (!errcode) {
+		LOGE("Ask for a reschedule failed");
+		return false;
+	}
+	return true;
+}
+
+bool nfm_osfw_set_add_member(const char *name, const char *value)
+{
+	bool errcode = true;
+
+	if (!name || !name[0] || !value || !value[0]) {
+		LOGE("Add firewall set member: invalid parameters");
+		return false;
+	}
+
+	errcode = osfw_ipset_member_add(name, value);
+	if (!errcode) {
+		LOGE("Add %s to firewall set %s failed", value, name);
+		return false;
+	}
+
+	errcode = nfm_osfw_reschedule();
+	if (!errcode) {
+		LOGE("Ask for a reschedule failed");
+		return false;
+	}
+	return true;
+}
+
+bool nfm_osfw_set_del_member(const char *name, const char *value)
+{
+	bool errcode = true;
+
+	if (!name || !name[0] || !value || !value[0]) {
+		LOGE("Delete firewall set member: invalid parameters");
+		return false;
+	}
+
+	errcode = osfw_ipset_member_del(name, value);
+	if (!errcode) {
+		LOGE("Delete %s from firewall set %s failed", value, name);
+		return false;
+	}
+
+	errcode = nfm_osfw_reschedule();
+	if (!errcode) {
+		LOGE("Ask for a reschedule failed");
+		return false;
+	}
+	return true;
+}
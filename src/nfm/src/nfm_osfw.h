@@ -50,5 +50,9 @@ bool nfm_osfw_add_chain(int family, const char *table, const char *chain);
 bool nfm_osfw_del_chain(int family, const char *table, const char *chain);
 bool nfm_osfw_add_rule(const struct schema_Netfilter *conf);
 bool nfm_osfw_del_rule(const struct schema_Netfilter *conf);
+bool nfm_osfw_add_set(int family, const char *name, bool mac);
+bool nfm_osfw_del_set(const char *name);
+bool nfm_osfw_set_add_member(const char *name, const char *value);
+bool nfm_osfw_set_del_member(const char *name, const char *value);
 
 #endif /* NFM_OSFW_H_INCLUDED */
@@ -174,13 +174,16 @@ static bool nfm_trule_detect_groups(struct nfm_trule *self)
 
 static size_t nfm_trule_calculate_len(const struct nfm_trule *self, const struct nfm_tdata *tdata)
 {
+	const char *p = NULL;
 	size_t len = 0;
 	size_t i = 0;
 
+	/* A tag may be referred more than once, count the value for each reference */
 	len = strlen(self->conf.rule);
 	for (i = 0; i < tdata->tv_cnt; i++) {
-		len -= (strlen(tdata->tv[i].name) + 3 /* ${} */);
-		len += strlen(tdata->tv[i].value);
+		for (p = self->conf.rule; (p = strstr(p, tdata->tv[i].name)); p += strlen(tdata->tv[i].name)) {
+			len += strlen(tdata->tv[i].value);
+		}
 	}
 
 	/* Add room for NULL termination */
@@ -316,6 +319,32 @@ static bool nfm_trule_apply(struct nfm_trule *self, om_action_t type, struct nfm
 	return errcode;
 }
 
+static bool nfm_trule_tag_filter(enum nfm_tag_filter filter, uint8_t filter_flags,
+		const om_tag_list_entry_t *tle)
+{
+	switch (filter) {
+	default:
+	case NFM_TAG_FILTER_NORMAL:
+		if (filter_flags != 0 && (tle->flags & filter_flags) == 0) {
+			return false;
+		}
+		break;
+
+	case NFM_TAG_FILTER_MATCH:
+		if (filter_flags == 0 || (tle->flags & filter_flags) == 0) {
+			return false;
+		}
+		break;
+
+	case NFM_TAG_FILTER_MISMATCH:
+		if (filter_flags == 0 || (tle->flags & filter_flags) != 0) {
+			return false;
+		}
+		break;
+	}
+	return true;
+}
+
 static bool nfm_trule_apply_tag(struct nfm_trule *self, om_action_t type,
 		om_tag_list_entry_t *ttle, ds_tree_iter_t *iter, struct nfm_tdata *tdata, size_t tdn)
 {
@@ -369,25 +398,8 @@ static bool nfm_trule_apply_tag(struct nfm_trule *self, om_action_t type,
 	tdata->tv[tdn].name  = ttle->value;
 	tdata->tv[tdn].group = (ttle->flags & OM_TLE_FLAG_GROUP) ? true : false;
 	ds_tree_foreach(tlist, tle) {
-		switch (filter) {
-		default:
-		case NFM_TAG_FILTER_NORMAL:
-			if (filter_flags != 0 && (tle->flags & filter_flags) == 0) {
-				continue;
-			}
-			break;
-
-		case NFM_TAG_FILTER_MATCH:
-			if (filter_flags == 0 || (tle->flags & filter_flags) == 0) {
-				continue;
-			}
-			break;
-
-		case NFM_TAG_FILTER_MISMATCH:
-			if (filter_flags == 0 || (tle->flags & filter_flags) != 0) {
-				continue;
-			}
-			break;
+		if (!nfm_trule_tag_filter(filter, filter_flags, tle)) {
+			continue;
 		}
 
 		tdata->tv[tdn].value = tle->value;
@@ -422,6 +434,286 @@ static bool nfm_trule_apply_tag(struct nfm_trule *self, om_action_t type,
 	return errcode;
 }
 
+/*
+ * Options whose value can be matched against a kernel set instead of being
+ * expanded once per tag value.
+ */
+static const struct nfm_tset_match {
+	const char *option;
+	bool mac;
+	const char *dir;
+} nfm_tset_matches[] = {
+	{ "-m mac --mac-source ", true, "src" },
+	{ "--source ", false, "src" },
+	{ "--destination ", false, "dst" },
+	{ "-s ", false, "src" },
+	{ "-d ", false, "dst" },
+};
+
+static unsigned int nfm_trule_set_id;
+
+static void nfm_trule_compile_set(struct nfm_trule *self)
+{
+	const struct nfm_tset_match *match = NULL;
+	const char *rule = self->conf.rule;
+	const char *var = NULL;
+	const char *end = NULL;
+	const char *str = NULL;
+	const char *opt = NULL;
+	struct ds_tree_iter iter;
+	size_t optlen = 0;
+	size_t len = 0;
+	size_t i = 0;
+	int nvars = 0;
+
+	/* A single tag, referred to a single time */
+	if (!ds_tree_ifirst(&iter, &self->tags) || ds_tree_inext(&iter)) {
+		return;
+	}
+
+	for (str = rule; (str = strchr(str, TEMPLATE_VAR_CHAR)); str++) {
+		if (str[1] == TEMPLATE_TAG_BEGIN || str[1] == TEMPLATE_GROUP_BEGIN) {
+			var = str;
+			nvars++;
+		}
+	}
+	if (nvars != 1) {
+		return;
+	}
+
+	end = strchr(var, (var[1] == TEMPLATE_TAG_BEGIN) ? TEMPLATE_TAG_END : TEMPLATE_GROUP_END);
+	if (!end || (end[1] != '\0' && end[1] != ' ')) {
+		return;
+	}
+
+	for (i = 0; i < (sizeof(nfm_tset_matches) / sizeof(nfm_tset_matches[0])); i++) {
+		optlen = strlen(nfm_tset_matches[i].option);
+		if ((size_t) (var - rule) < optlen) {
+			continue;
+		}
+		opt = var - optlen;
+		if (strncmp(opt, nfm_tset_matches[i].option, optlen)) {
+			continue;
+		} else if (opt != rule && opt[-1] != ' ') {
+			continue;
+		}
+		match = &nfm_tset_matches[i];
+		break;
+	}
+	if (!match) {
+		return;
+	}
+
+	/* Negated matches keep the per value expansion */
+	for (str = opt; str > rule && str[-1] == ' '; str--);
+	if (str > rule && str[-1] == '!') {
+		return;
+	}
+
+	memset(&self->set, 0, sizeof(self->set));
+	self->set.mac = match->mac;
+	self->set.dir = match->dir;
+	self->set.match_off = opt - rule;
+	self->set.match_len = end + 1 - opt;
+
+	nfm_trule_set_id++;
+	if (self->set.mac) {
+		snprintf(self->set.name4, sizeof(self->set.name4), "nfm%u_m", nfm_trule_set_id);
+		STRSCPY(self->set.name6, self->set.name4);
+	} else {
+		snprintf(self->set.name4, sizeof(self->set.name4), "nfm%u_4", nfm_trule_set_id);
+		snprintf(self->set.name6, sizeof(self->set.name6), "nfm%u_6", nfm_trule_set_id);
+	}
+
+	len = strlen(rule) - self->set.match_len + strlen("-m set --match-set   ") +
+			strlen(self->set.name4) + strlen(self->set.dir);
+	if (len >= sizeof(self->conf.rule)) {
+		LOGD("[%s] Netfilter template rule: set match does not fit, expand it", self->conf.name);
+		memset(&self->set, 0, sizeof(self->set));
+		return;
+	}
+
+	self->flags |= NFM_FLAG_TRULE_SET_COMPILED;
+	LOGD("[%s] Netfilter template rule compiled to %s set %s", self->conf.name,
+			self->set.mac ? "MAC" : "address", self->set.name4);
+}
+
+static const char *nfm_trule_set_name(struct nfm_trule *self, int family)
+{
+	return (family == AF_INET6) ? self->set.name6 : self->set.name4;
+}
+
+static bool nfm_trule_set_apply_rule(struct nfm_trule *self, om_action_t type, int family)
+{
+	struct schema_Netfilter conf;
+	const char *rule = self->conf.rule;
+	bool errcode = true;
+
+	conf = self->conf;
+	snprintf(conf.rule, sizeof(conf.rule), "%.*s-m set --match-set %s %s%s",
+			(int) self->set.match_off, rule, nfm_trule_set_name(self, family),
+			self->set.dir, rule + self->set.match_off + self->set.match_len);
+
+	/* MAC sets serve both families, address sets are per family */
+	if (family) {
+		STRSCPY(conf.protocol, (family == AF_INET6) ? "ipv6" : "ipv4");
+	}
+
+	LOGD("[%s] Apply compiled template rule: %s '%s'", self->conf.name,
+			(type == ADD) ? "add" : "remove", conf.rule);
+	errcode = (type == ADD) ? nfm_osfw_add_rule(&conf) : nfm_osfw_del_rule(&conf);
+	if (!errcode) {
+		LOGE("[%s] Apply compiled template rule failed", self->conf.name);
+		return false;
+	}
+	return true;
+}
+
+static int nfm_trule_set_family(const char *value)
+{
+	unsigned char addr[sizeof(struct in6_addr)];
+	char buf[INET6_ADDRSTRLEN];
+	char *p = NULL;
+
+	STRSCPY(buf, value);
+	p = strchr(buf, '/');
+	if (p) {
+		*p = '\0';
+	}
+
+	if (inet_pton(AF_INET, buf, addr) == 1) {
+		return AF_INET;
+	} else if (inet_pton(AF_INET6, buf, addr) == 1) {
+		return AF_INET6;
+	}
+	return AF_UNSPEC;
+}
+
+static bool nfm_trule_set_is_mac(const char *value)
+{
+	unsigned int mac[6];
+	int len = 0;
+
+	if (sscanf(value, "%2x:%2x:%2x:%2x:%2x:%2x%n",
+			&mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5], &len) != 6) {
+		return false;
+	}
+	return value[len] == '\0';
+}
+
+static bool nfm_trule_set_member(struct nfm_trule *self, om_action_t type, const char *value)
+{
+	const char *name = NULL;
+	int family = AF_UNSPEC;
+
+	if (self->set.mac) {
+		if (!nfm_trule_set_is_mac(value)) {
+			LOGW("[%s] Netfilter template rule: '%s' is not a MAC address - ignore it",
+					self->conf.name, value);
+			return true;
+		}
+		name = self->set.name4;
+	} else {
+		family = nfm_trule_set_family(value);
+		if (family == AF_INET && nfm_osfw_is_inet4(self->conf.protocol)) {
+			name = self->set.name4;
+		} else if (family == AF_INET6 && nfm_osfw_is_inet6(self->conf.protocol)) {
+			name = self->set.name6;
+		} else {
+			if (family == AF_UNSPEC) {
+				LOGW("[%s] Netfilter template rule: '%s' is not an address - ignore it",
+						self->conf.name, value);
+			}
+			return true;
+		}
+	}
+
+	return (type == ADD) ? nfm_osfw_set_add_member(name, value) :
+			nfm_osfw_set_del_member(name, value);
+}
+
+static bool nfm_trule_set_members(struct nfm_trule *self, om_action_t type, struct ds_tree *values,
+		enum nfm_tag_filter filter)
+{
+	om_tag_list_entry_t *ttle = NULL;
+	om_tag_list_entry_t *tle = NULL;
+	bool errcode = true;
+
+	ttle = ds_tree_head(&self->tags);
+	ds_tree_foreach(values, tle) {
+		if (!nfm_trule_tag_filter(filter, OM_TLE_VAR_FLAGS(ttle->flags), tle)) {
+			continue;
+		}
+		if (!nfm_trule_set_member(self, type, tle->value)) {
+			errcode = false;
+		}
+	}
+	return errcode;
+}
+
+static bool nfm_trule_update_set(struct nfm_trule *self, om_action_t type)
+{
+	om_tag_list_entry_t *ttle = NULL;
+	om_tag_t *tag = NULL;
+	bool inet4 = nfm_osfw_is_inet4(self->conf.protocol);
+	bool inet6 = nfm_osfw_is_inet6(self->conf.protocol);
+	bool errcode = true;
+
+	if (type == DELETE) {
+		if (!(self->flags & NFM_FLAG_TRULE_SET_APPLIED)) {
+			return true;
+		}
+		LOGI("[%s] Removing system rule matching set %s", self->conf.name, self->set.name4);
+		if (self->set.mac) {
+			errcode = nfm_trule_set_apply_rule(self, DELETE, 0) && errcode;
+			errcode = nfm_osfw_del_set(self->set.name4) && errcode;
+		}
+		if (!self->set.mac && inet4) {
+			errcode = nfm_trule_set_apply_rule(self, DELETE, AF_INET) && errcode;
+			errcode = nfm_osfw_del_set(self->set.name4) && errcode;
+		}
+		if (!self->set.mac && inet6) {
+			errcode = nfm_trule_set_apply_rule(self, DELETE, AF_INET6) && errcode;
+			errcode = nfm_osfw_del_set(self->set.name6) && errcode;
+		}
+		self->flags &= ~NFM_FLAG_TRULE_SET_APPLIED;
+		return errcode;
+	}
+
+	LOGI("[%s] Adding system rule matching set %s", self->conf.name, self->set.name4);
+	self->flags |= NFM_FLAG_TRULE_SET_APPLIED;
+	if (self->set.mac) {
+		if (!nfm_osfw_add_set(AF_INET, self->set.name4, true) ||
+				!nfm_trule_set_apply_rule(self, ADD, 0)) {
+			return false;
+		}
+	}
+	if (!self->set.mac && inet4) {
+		if (!nfm_osfw_add_set(AF_INET, self->set.name4, false) ||
+				!nfm_trule_set_apply_rule(self, ADD, AF_INET)) {
+			return false;
+		}
+	}
+	if (!self->set.mac && inet6) {
+		if (!nfm_osfw_add_set(AF_INET6, self->set.name6, false) ||
+				!nfm_trule_set_apply_rule(self, ADD, AF_INET6)) {
+			return false;
+		}
+	}
+
+	/* The rule stays in place with an empty set until the tag shows up */
+	ttle = ds_tree_head(&self->tags);
+	tag = om_tag_find_by_name(ttle->value, (ttle->flags & OM_TLE_FLAG_GROUP) ? true : false);
+	if (!tag) {
+		LOGW("[%s] Apply tag for Netfilter template rule: %stag '%s' not found",
+				self->conf.name,
+				(ttle->flags & OM_TLE_FLAG_GROUP) ? "group " : "",
+				ttle->value);
+		return false;
+	}
+	return nfm_trule_set_members(self, ADD, &tag->values, NFM_TAG_FILTER_NORMAL);
+}
+
 bool nfm_trule_update_tags(struct nfm_trule *self, om_action_t type)
 {
 	bool errcode = true;
@@ -429,6 +721,10 @@ bool nfm_trule_update_tags(struct nfm_trule *self, om_action_t type)
 	struct ds_tree_iter iter;
 	struct nfm_tdata tdata;
 
+	if (self->flags & NFM_FLAG_TRULE_SET_COMPILED) {
+		return nfm_trule_update_set(self, type);
+	}
+
 	if (ds_tree_head(&self->tags)) {
 		memset(&tdata, 0, sizeof(tdata));
 		tdata.filter = NFM_TAG_FILTER_NORMAL;
@@ -458,6 +754,8 @@ static bool nfm_trule_set_tags(struct nfm_trule *self)
 		return false;
 	}
 
+	nfm_trule_compile_set(self);
+
 	errcode = nfm_trule_update_tags(self, ADD);
 	if (!errcode) {
 		LOGE("[%s] Set Nefilter template rule: update tags failed", self->conf.name);
@@ -671,6 +969,25 @@ bool nfm_trule_on_tag_update(struct nfm_trule *self, om_tag_t *tag, struct ds_tr
 		return true;
 	}
 
+	if (self->flags & NFM_FLAG_TRULE_SET_COMPILED) {
+		if (!(self->flags & NFM_FLAG_TRULE_SET_APPLIED)) {
+			return true;
+		}
+		if (removed && !nfm_trule_set_members(self, DELETE, removed, NFM_TAG_FILTER_NORMAL)) {
+			errcode = false;
+		}
+		if (added && !nfm_trule_set_members(self, ADD, added, NFM_TAG_FILTER_NORMAL)) {
+			errcode = false;
+		}
+		if (updated && !nfm_trule_set_members(self, DELETE, updated, NFM_TAG_FILTER_MISMATCH)) {
+			errcode = false;
+		}
+		if (updated && !nfm_trule_set_members(self, ADD, updated, NFM_TAG_FILTER_MATCH)) {
+			errcode = false;
+		}
+		return errcode;
+	}
+
 	/* Do removals first */
 	if (removed && ds_tree_head(removed)) {
 		memset(&tdata, 0, sizeof(tdata));
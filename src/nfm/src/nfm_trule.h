@@ -44,11 +44,29 @@
 #define NFM_FLAG_TRULE_CHAIN6_REFERENCED (1 << 3)
 #define NFM_FLAG_TRULE_TARGET4_REFERENCED (1 << 4)
 #define NFM_FLAG_TRULE_TARGET6_REFERENCED (1 << 5)
+#define NFM_FLAG_TRULE_SET_COMPILED (1 << 6)
+#define NFM_FLAG_TRULE_SET_APPLIED (1 << 7)
+
+#define NFM_TRULE_SET_NAME_SIZE 32
+
+/*
+ * A template rule whose only tag stands for the address matched by one option
+ * is compiled to a single rule matching a kernel set holding the tag values.
+ */
+struct nfm_tset {
+	bool mac;
+	const char *dir;
+	size_t match_off;
+	size_t match_len;
+	char name4[NFM_TRULE_SET_NAME_SIZE];
+	char name6[NFM_TRULE_SET_NAME_SIZE];
+};
 
 struct nfm_trule {
 	struct ds_tree_node elt;
 	struct schema_Netfilter conf;
 	struct ds_tree tags;
+	struct nfm_tset set;
 	uint8_t flags;
 };
 
@@ -0,0 +1,59 @@
+/*
+* Copyright (c) 2019, Sagemcom.
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+*    this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice,
+*    this list of conditions and the following disclaimer in the documentation
+*    and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+*    may be used to endorse or promote products derived from this software
+*    without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TEST_NFM_H_INCLUDED
+#define TEST_NFM_H_INCLUDED
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TEST_NFM_CALLS_MAX 64
+#define TEST_NFM_CALL_SIZE 640
+
+/*
+ * Calls seen by the stand-ins, one line each, e.g. "rule+ ipv4 -s 10.0.0.1"
+ * or "member+ nfm1_4 10.0.0.1".
+ */
+struct test_nfm_calls {
+	size_t n;
+	char call[TEST_NFM_CALLS_MAX][TEST_NFM_CALL_SIZE];
+};
+
+extern struct test_nfm_calls g_test_nfm_calls;
+
+void test_nfm_reset(void);
+void test_nfm_record(const char *fmt, ...);
+bool test_nfm_called(const char *fmt, ...);
+size_t test_nfm_count(const char *prefix);
+
+void run_test_nfm_ipset(void);
+
+#endif /* TEST_NFM_H_INCLUDED */
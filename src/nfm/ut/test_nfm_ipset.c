@@ -0,0 +1,185 @@
+/*
+* Copyright (c) 2019, Sagemcom.
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+*    this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice,
+*    this list of conditions and the following disclaimer in the documentation
+*    and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+*    may be used to endorse or promote products derived from this software
+*    without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "unity.h"
+
+/*
+ * Build the firewall API in with the shell commands redirected, so that
+ * the ipset batches can be inspected and the kernel refusal of a member
+ * simulated.
+ */
+#define cmd_log test_cmd_log
+#include "osn_fw.c"
+
+#include "test_nfm.h"
+
+/* A member the simulated kernel refuses */
+#define TEST_IPSET_REJECTED "0.0.0.0/0"
+
+#define TEST_IPSET_RESTORE "ipset -exist restore"
+
+/*
+ * Records "ipset: <cmd>" for a direct command, or one "restore: <line>"
+ * per restored line followed by "restore." for a restore.
+ */
+int test_cmd_log(const char *shell_cmd)
+{
+	char path[OSFW_SIZE_CMD];
+	char line[OSFW_SIZE_MATCH];
+	FILE *stream;
+	int err = 0;
+
+	if (!strstr(shell_cmd, TEST_IPSET_RESTORE)) {
+		test_nfm_record("cmd: %s", shell_cmd);
+		return 0;
+	}
+
+	TEST_ASSERT_EQUAL_INT(1, sscanf(shell_cmd, "cat %511s |", path));
+	stream = fopen(path, "r");
+	TEST_ASSERT_NOT_NULL(stream);
+	while (fgets(line, sizeof(line), stream)) {
+		line[strcspn(line, "\n")] = '\0';
+		test_nfm_record("restore: %s", line);
+		if (strstr(line, TEST_IPSET_REJECTED)) {
+			err = 1;
+		}
+	}
+	fclose(stream);
+	test_nfm_record("restore.");
+	return err;
+}
+
+static void test_ipset_setup(void)
+{
+	test_nfm_reset();
+	TEST_ASSERT_TRUE(osfw_init());
+	TEST_ASSERT_TRUE(osfw_ipset_add(AF_INET, "test4", OSFW_IPSET_HASH_NET));
+	TEST_ASSERT_TRUE(test_nfm_called("cmd: ipset -exist create test4 hash:net family inet && ipset flush test4"));
+	test_nfm_reset();
+}
+
+/**
+ * @brief member changes are queued and pushed in a single restore
+ */
+void test_nfm_ipset_queue(void)
+{
+	test_ipset_setup();
+
+	TEST_ASSERT_TRUE(osfw_ipset_member_add("test4", "10.0.0.1"));
+	TEST_ASSERT_TRUE(osfw_ipset_member_add("test4", "10.0.1.0/24"));
+	TEST_ASSERT_TRUE(osfw_ipset_member_del("test4", "10.0.0.9"));
+	TEST_ASSERT_EQUAL_UINT(0, g_test_nfm_calls.n);
+
+	TEST_ASSERT_TRUE(osfw_apply());
+	TEST_ASSERT_EQUAL_UINT(4, g_test_nfm_calls.n);
+	TEST_ASSERT_EQUAL_STRING("restore: add test4 10.0.0.1", g_test_nfm_calls.call[0]);
+	TEST_ASSERT_EQUAL_STRING("restore: add test4 10.0.1.0/24", g_test_nfm_calls.call[1]);
+	TEST_ASSERT_EQUAL_STRING("restore: del test4 10.0.0.9", g_test_nfm_calls.call[2]);
+	TEST_ASSERT_EQUAL_STRING("restore.", g_test_nfm_calls.call[3]);
+
+	/* Nothing left to push */
+	test_nfm_reset();
+	TEST_ASSERT_TRUE(osfw_apply());
+	TEST_ASSERT_EQUAL_UINT(0, g_test_nfm_calls.n);
+
+	/* Values which would split the restore line are refused */
+	TEST_ASSERT_FALSE(osfw_ipset_member_add("test4", "10.0.0.1 10.0.0.2"));
+	TEST_ASSERT_FALSE(osfw_ipset_member_add("test 4", "10.0.0.1"));
+
+	TEST_ASSERT_TRUE(osfw_fini());
+}
+
+/**
+ * @brief a destroyed set loses its pending members, a set added back is kept
+ */
+void test_nfm_ipset_destroy(void)
+{
+	test_ipset_setup();
+
+	TEST_ASSERT_TRUE(osfw_ipset_member_add("test4", "10.0.0.1"));
+	TEST_ASSERT_TRUE(osfw_ipset_del("test4"));
+	TEST_ASSERT_TRUE(osfw_apply());
+	TEST_ASSERT_EQUAL_UINT(2, g_test_nfm_calls.n);
+	TEST_ASSERT_EQUAL_STRING("restore: destroy test4", g_test_nfm_calls.call[0]);
+
+	test_nfm_reset();
+	TEST_ASSERT_TRUE(osfw_ipset_del("test4"));
+	TEST_ASSERT_TRUE(osfw_ipset_add(AF_INET, "test4", OSFW_IPSET_HASH_NET));
+	TEST_ASSERT_TRUE(osfw_apply());
+	TEST_ASSERT_EQUAL_UINT(0, test_nfm_count("restore"));
+
+	TEST_ASSERT_TRUE(osfw_fini());
+}
+
+/**
+ * @brief a refused batch is replayed one command at a time
+ */
+void test_nfm_ipset_replay(void)
+{
+	test_ipset_setup();
+
+	TEST_ASSERT_TRUE(osfw_ipset_member_add("test4", "10.0.0.1"));
+	TEST_ASSERT_TRUE(osfw_ipset_member_add("test4", TEST_IPSET_REJECTED));
+	TEST_ASSERT_TRUE(osfw_ipset_member_add("test4", "10.0.0.2"));
+
+	/* The rules are applied, the failure is still reported */
+	TEST_ASSERT_FALSE(osfw_apply());
+
+	/* The batch, the copy kept for debugging, then each command alone */
+	TEST_ASSERT_EQUAL_UINT(4, test_nfm_count("restore."));
+	TEST_ASSERT_EQUAL_UINT(1, test_nfm_count("cmd: cp "));
+	TEST_ASSERT_EQUAL_INT(0, strncmp("cmd: cp ", g_test_nfm_calls.call[4], strlen("cmd: cp ")));
+	TEST_ASSERT_EQUAL_STRING("restore: add test4 10.0.0.1", g_test_nfm_calls.call[5]);
+	TEST_ASSERT_EQUAL_STRING("restore.", g_test_nfm_calls.call[6]);
+	TEST_ASSERT_EQUAL_STRING("restore: add test4 " TEST_IPSET_REJECTED, g_test_nfm_calls.call[7]);
+	TEST_ASSERT_EQUAL_STRING("restore.", g_test_nfm_calls.call[8]);
+	TEST_ASSERT_EQUAL_STRING("restore: add test4 10.0.0.2", g_test_nfm_calls.call[9]);
+	TEST_ASSERT_EQUAL_STRING("restore.", g_test_nfm_calls.call[10]);
+
+	/* The queue is flushed either way */
+	test_nfm_reset();
+	TEST_ASSERT_TRUE(osfw_apply());
+	TEST_ASSERT_EQUAL_UINT(0, g_test_nfm_calls.n);
+
+	TEST_ASSERT_TRUE(osfw_fini());
+}
+
+void run_test_nfm_ipset(void)
+{
+	RUN_TEST(test_nfm_ipset_queue);
+	RUN_TEST(test_nfm_ipset_destroy);
+	RUN_TEST(test_nfm_ipset_replay);
+}
@@ -0,0 +1,154 @@
+/*
+* Copyright (c) 2019, Sagemcom.
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+*    this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice,
+*    this list of conditions and the following disclaimer in the documentation
+*    and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+*    may be used to endorse or promote products derived from this software
+*    without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Stand-ins for the NFM modules and the OVSDB calls the template rule code
+ * depends on. The firewall calls are recorded, see test_nfm.h.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ovsdb_table.h"
+#include "nfm_chain.h"
+#include "nfm_osfw.h"
+#include "test_nfm.h"
+
+struct test_nfm_calls g_test_nfm_calls;
+
+struct ovsdb_table table_Netfilter;
+
+void test_nfm_reset(void)
+{
+	memset(&g_test_nfm_calls, 0, sizeof(g_test_nfm_calls));
+}
+
+void test_nfm_record(const char *fmt, ...)
+{
+	va_list args;
+
+	if (g_test_nfm_calls.n >= TEST_NFM_CALLS_MAX) {
+		return;
+	}
+
+	va_start(args, fmt);
+	vsnprintf(g_test_nfm_calls.call[g_test_nfm_calls.n], TEST_NFM_CALL_SIZE, fmt, args);
+	va_end(args);
+	g_test_nfm_calls.n++;
+}
+
+bool test_nfm_called(const char *fmt, ...)
+{
+	char call[TEST_NFM_CALL_SIZE];
+	va_list args;
+	size_t i = 0;
+
+	va_start(args, fmt);
+	vsnprintf(call, sizeof(call), fmt, args);
+	va_end(args);
+
+	for (i = 0; i < g_test_nfm_calls.n; i++) {
+		if (!strcmp(g_test_nfm_calls.call[i], call)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t test_nfm_count(const char *prefix)
+{
+	size_t count = 0;
+	size_t i = 0;
+
+	for (i = 0; i < g_test_nfm_calls.n; i++) {
+		if (!strncmp(g_test_nfm_calls.call[i], prefix, strlen(prefix))) {
+			count++;
+		}
+	}
+	return count;
+}
+
+bool nfm_osfw_is_inet4(const char *protocol)
+{
+	return !strcmp(protocol, "ipv4") || !strcmp(protocol, "both");
+}
+
+bool nfm_osfw_is_inet6(const char *protocol)
+{
+	return !strcmp(protocol, "ipv6") || !strcmp(protocol, "both");
+}
+
+bool nfm_osfw_add_rule(const struct schema_Netfilter *conf)
+{
+	test_nfm_record("rule+ %s %s", conf->protocol, conf->rule);
+	return true;
+}
+
+bool nfm_osfw_del_rule(const struct schema_Netfilter *conf)
+{
+	test_nfm_record("rule- %s %s", conf->protocol, conf->rule);
+	return true;
+}
+
+bool nfm_osfw_add_set(int family, const char *name, bool mac)
+{
+	test_nfm_record("set+ %s %s", name, mac ? "mac" : "net");
+	return true;
+}
+
+bool nfm_osfw_del_set(const char *name)
+{
+	test_nfm_record("set- %s", name);
+	return true;
+}
+
+bool nfm_osfw_set_add_member(const char *name, const char *value)
+{
+	test_nfm_record("member+ %s %s", name, value);
+	return true;
+}
+
+bool nfm_osfw_set_del_member(const char *name, const char *value)
+{
+	test_nfm_record("member- %s %s", name, value);
+	return true;
+}
+
+bool nfm_chain_get_ref(int family, const char *table, const char *chain)
+{
+	return true;
+}
+
+bool nfm_chain_put_ref(int family, const char *table, const char *chain)
+{
+	return true;
+}
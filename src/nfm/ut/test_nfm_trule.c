@@ -0,0 +1,342 @@
+/*
+* Copyright (c) 2019, Sagemcom.
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+*    this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice,
+*    this list of conditions and the following disclaimer in the documentation
+*    and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+*    may be used to endorse or promote products derived from this software
+*    without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "const.h"
+#include "log.h"
+#include "target.h"
+#include "unity.h"
+
+/*
+ * The set compilation is static, build the template rule code in. The
+ * status updates are redirected to a stand-in which finds no row.
+ */
+#define ovsdb_where_simple test_ovsdb_where_simple
+#define ovsdb_table_update_where test_ovsdb_table_update_where
+#include "nfm_trule.c"
+
+#include "test_nfm.h"
+
+const char *test_name = "nfm_tests";
+
+static struct schema_Openflow_Tag g_test_tag;
+
+json_t *test_ovsdb_where_simple(const char *column, const char *value)
+{
+	return NULL;
+}
+
+int test_ovsdb_table_update_where(ovsdb_table_t *table, json_t *where, void *record)
+{
+	return 1;
+}
+
+static void test_tag_set(const char *name, const char **values, int n)
+{
+	int i;
+
+	memset(&g_test_tag, 0, sizeof(g_test_tag));
+	g_test_tag.name_exists = true;
+	STRSCPY(g_test_tag.name, name);
+	for (i = 0; i < n; i++) {
+		STRSCPY(g_test_tag.cloud_value[i], values[i]);
+	}
+	g_test_tag.cloud_value_len = n;
+}
+
+static void test_conf_set(struct schema_Netfilter *conf, const char *protocol, const char *rule)
+{
+	memset(conf, 0, sizeof(*conf));
+	STRSCPY(conf->name, "test_trule");
+	conf->enable = true;
+	STRSCPY(conf->protocol, protocol);
+	STRSCPY(conf->table, "filter");
+	STRSCPY(conf->chain, "FORWARD");
+	conf->priority = 10;
+	STRSCPY(conf->rule, rule);
+	STRSCPY(conf->target, "ACCEPT");
+}
+
+static struct nfm_trule *test_trule_new(struct schema_Netfilter *conf, const char *protocol,
+		const char *rule)
+{
+	struct nfm_trule *self;
+
+	test_conf_set(conf, protocol, rule);
+	test_nfm_reset();
+	TEST_ASSERT_TRUE(nfm_trule_new(conf));
+
+	self = nfm_trule_get(conf->name);
+	TEST_ASSERT_NOT_NULL(self);
+	return self;
+}
+
+void setUp(void)
+{
+	static const char *values[] = { "10.0.0.1", "10.0.1.0/24", "fd00::1", "not-an-address" };
+
+	test_nfm_reset();
+	test_tag_set("hosts", values, 4);
+	TEST_ASSERT_TRUE(om_tag_add_from_schema(&g_test_tag));
+}
+
+void tearDown(void)
+{
+	om_tag_remove_from_schema(&g_test_tag);
+}
+
+/**
+ * @brief the option carrying the tag selects the set type and direction
+ */
+void test_nfm_trule_compile_options(void)
+{
+	static const struct {
+		const char *rule;
+		const char *compiled;
+		bool mac;
+		const char *dir;
+	} cases[] = {
+		{ "-s ${hosts} -p tcp", "-m set --match-set %s src -p tcp", false, "src" },
+		{ "-p udp -d ${hosts}", "-p udp -m set --match-set %s dst", false, "dst" },
+		{ "--source ${hosts}", "-m set --match-set %s src", false, "src" },
+		{ "-i br-home --destination ${hosts}", "-i br-home -m set --match-set %s dst", false, "dst" },
+		{ "-m mac --mac-source ${hosts} -j MARK", "-m set --match-set %s src -j MARK", true, "src" },
+		{ "-s ${#hosts}", "-m set --match-set %s src", false, "src" },
+	};
+	char name[NFM_TRULE_SET_NAME_SIZE];
+	struct schema_Netfilter conf;
+	struct nfm_trule *self;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		self = test_trule_new(&conf, "ipv4", cases[i].rule);
+		STRSCPY(name, self->set.name4);
+
+		TEST_ASSERT_TRUE_MESSAGE(self->flags & NFM_FLAG_TRULE_SET_COMPILED, cases[i].rule);
+		TEST_ASSERT_EQUAL(cases[i].mac, self->set.mac);
+		TEST_ASSERT_EQUAL_STRING(cases[i].dir, self->set.dir);
+		TEST_ASSERT_EQUAL_UINT(1, test_nfm_count("rule+ "));
+		TEST_ASSERT_TRUE(test_nfm_called("set+ %s %s", self->set.name4, cases[i].mac ? "mac" : "net"));
+
+		/* MAC sets serve both families, the rule keeps the configured protocol */
+		if (cases[i].mac) {
+			TEST_ASSERT_TRUE(test_nfm_called("rule+ ipv4 -m set --match-set %s src -j MARK",
+					self->set.name4));
+			TEST_ASSERT_EQUAL_UINT(0, test_nfm_count("member+ "));
+		} else {
+			char rule[TEST_NFM_CALL_SIZE];
+
+			snprintf(rule, sizeof(rule), cases[i].compiled, self->set.name4);
+			TEST_ASSERT_TRUE_MESSAGE(test_nfm_called("rule+ ipv4 %s", rule), rule);
+			TEST_ASSERT_TRUE(test_nfm_called("member+ %s 10.0.0.1", self->set.name4));
+			TEST_ASSERT_TRUE(test_nfm_called("member+ %s 10.0.1.0/24", self->set.name4));
+			/* Other families and non addresses are left out */
+			TEST_ASSERT_EQUAL_UINT(2, test_nfm_count("member+ "));
+		}
+
+		test_nfm_reset();
+		TEST_ASSERT_TRUE(nfm_trule_del(&conf));
+		TEST_ASSERT_EQUAL_UINT(1, test_nfm_count("rule- "));
+		TEST_ASSERT_TRUE(test_nfm_called("set- %s", name));
+		TEST_ASSERT_EQUAL_UINT(0, test_nfm_count("member- "));
+	}
+}
+
+/**
+ * @brief an address set is created per family, MAC members are filtered
+ */
+void test_nfm_trule_compile_families(void)
+{
+	static const char *macs[] = { "aa:bb:cc:dd:ee:01", "10.0.0.1", "aa:bb:cc:dd:ee" };
+	struct schema_Openflow_Tag tag;
+	struct schema_Netfilter conf;
+	struct nfm_trule *self;
+
+	self = test_trule_new(&conf, "both", "-s ${hosts}");
+	TEST_ASSERT_TRUE(self->flags & NFM_FLAG_TRULE_SET_COMPILED);
+	TEST_ASSERT_TRUE(strcmp(self->set.name4, self->set.name6));
+	TEST_ASSERT_TRUE(test_nfm_called("rule+ ipv4 -m set --match-set %s src", self->set.name4));
+	TEST_ASSERT_TRUE(test_nfm_called("rule+ ipv6 -m set --match-set %s src", self->set.name6));
+	TEST_ASSERT_TRUE(test_nfm_called("member+ %s 10.0.0.1", self->set.name4));
+	TEST_ASSERT_TRUE(test_nfm_called("member+ %s 10.0.1.0/24", self->set.name4));
+	TEST_ASSERT_TRUE(test_nfm_called("member+ %s fd00::1", self->set.name6));
+	TEST_ASSERT_EQUAL_UINT(3, test_nfm_count("member+ "));
+
+	test_nfm_reset();
+	TEST_ASSERT_TRUE(nfm_trule_del(&conf));
+	TEST_ASSERT_EQUAL_UINT(2, test_nfm_count("rule- "));
+	TEST_ASSERT_EQUAL_UINT(2, test_nfm_count("set- "));
+
+	tag = g_test_tag;
+	test_tag_set("macs", macs, 3);
+	TEST_ASSERT_TRUE(om_tag_add_from_schema(&g_test_tag));
+
+	self = test_trule_new(&conf, "both", "-m mac --mac-source ${macs}");
+	TEST_ASSERT_TRUE(self->set.mac);
+	TEST_ASSERT_EQUAL_STRING(self->set.name4, self->set.name6);
+	TEST_ASSERT_EQUAL_UINT(1, test_nfm_count("set+ "));
+	TEST_ASSERT_TRUE(test_nfm_called("rule+ both -m set --match-set %s src", self->set.name4));
+	TEST_ASSERT_TRUE(test_nfm_called("member+ %s aa:bb:cc:dd:ee:01", self->set.name4));
+	TEST_ASSERT_EQUAL_UINT(1, test_nfm_count("member+ "));
+	TEST_ASSERT_TRUE(nfm_trule_del(&conf));
+
+	om_tag_remove_from_schema(&g_test_tag);
+	g_test_tag = tag;
+}
+
+/**
+ * @brief anything but a single plain reference keeps the per value expansion
+ */
+void test_nfm_trule_compile_fallback(void)
+{
+	static const char *rules[] = {
+		"! -s ${hosts}",                 /* negated */
+		"-s ! ${hosts}",                 /* negation between option and value */
+		"-s ${hosts}/24",                /* value is part of a word */
+		"-p tcp --dport ${hosts}",       /* not an address option */
+		"-i br-s ${hosts}",              /* option suffix only */
+		"-s ${hosts} -d ${hosts}",       /* referred twice */
+		"-s ${hosts} -d $[lan]",         /* tag and group */
+	};
+	struct schema_Openflow_Tag_Group group;
+	struct schema_Netfilter conf;
+	struct nfm_trule *self;
+	size_t i;
+
+	memset(&group, 0, sizeof(group));
+	STRSCPY(group.name, "lan");
+	STRSCPY(group.tags[0], "hosts");
+	group.tags_len = 1;
+	TEST_ASSERT_TRUE(om_tag_group_add_from_schema(&group));
+
+	for (i = 0; i < ARRAY_SIZE(rules); i++) {
+		self = test_trule_new(&conf, "ipv4", rules[i]);
+		TEST_ASSERT_FALSE_MESSAGE(self->flags & NFM_FLAG_TRULE_SET_COMPILED, rules[i]);
+		TEST_ASSERT_EQUAL_UINT(0, test_nfm_count("set+ "));
+		TEST_ASSERT_TRUE(nfm_trule_del(&conf));
+	}
+	TEST_ASSERT_TRUE(om_tag_group_remove_from_schema(&group));
+
+	/* One rule per value */
+	self = test_trule_new(&conf, "ipv4", "! -s ${hosts} -j DROP");
+	TEST_ASSERT_EQUAL_UINT(4, test_nfm_count("rule+ "));
+	TEST_ASSERT_TRUE(test_nfm_called("rule+ ipv4 ! -s 10.0.0.1 -j DROP"));
+	TEST_ASSERT_TRUE(test_nfm_called("rule+ ipv4 ! -s 10.0.1.0/24 -j DROP"));
+	TEST_ASSERT_TRUE(nfm_trule_del(&conf));
+}
+
+/**
+ * @brief a rule which would not fit once rewritten is expanded instead
+ */
+void test_nfm_trule_compile_too_long(void)
+{
+	struct schema_Netfilter conf;
+	struct nfm_trule *self;
+	char rule[sizeof(conf.rule)];
+	size_t len;
+
+	len = snprintf(rule, sizeof(rule), "-s ${hosts} -m comment --comment ");
+	memset(rule + len, 'x', sizeof(rule) - len - 16);
+	rule[sizeof(rule) - 16] = '\0';
+
+	self = test_trule_new(&conf, "ipv4", rule);
+	TEST_ASSERT_FALSE(self->flags & NFM_FLAG_TRULE_SET_COMPILED);
+	TEST_ASSERT_EQUAL_UINT(0, test_nfm_count("set+ "));
+	TEST_ASSERT_EQUAL_UINT(4, test_nfm_count("rule+ "));
+	TEST_ASSERT_TRUE(nfm_trule_del(&conf));
+}
+
+/**
+ * @brief tag updates only change the set members
+ */
+void test_nfm_trule_update_set(void)
+{
+	static const char *values[] = { "10.0.0.1", "10.0.0.2", "fd00::2" };
+	struct schema_Netfilter conf;
+	struct nfm_trule *self;
+	struct schema_Openflow_Tag tag;
+
+	self = test_trule_new(&conf, "both", "-d ${hosts} -j DROP");
+	TEST_ASSERT_TRUE(self->flags & NFM_FLAG_TRULE_SET_APPLIED);
+
+	tag = g_test_tag;
+	test_tag_set("hosts", values, 3);
+	test_nfm_reset();
+	TEST_ASSERT_TRUE(om_tag_update_from_schema(&g_test_tag));
+
+	TEST_ASSERT_EQUAL_UINT(0, test_nfm_count("rule"));
+	TEST_ASSERT_EQUAL_UINT(0, test_nfm_count("set"));
+	TEST_ASSERT_TRUE(test_nfm_called("member- %s 10.0.1.0/24", self->set.name4));
+	TEST_ASSERT_TRUE(test_nfm_called("member- %s fd00::1", self->set.name6));
+	TEST_ASSERT_TRUE(test_nfm_called("member+ %s 10.0.0.2", self->set.name4));
+	TEST_ASSERT_TRUE(test_nfm_called("member+ %s fd00::2", self->set.name6));
+	TEST_ASSERT_EQUAL_UINT(2, test_nfm_count("member- "));
+	TEST_ASSERT_EQUAL_UINT(2, test_nfm_count("member+ "));
+
+	/* The sets go with the rule, members included */
+	test_nfm_reset();
+	TEST_ASSERT_TRUE(nfm_trule_del(&conf));
+	TEST_ASSERT_EQUAL_UINT(2, test_nfm_count("rule- "));
+	TEST_ASSERT_EQUAL_UINT(2, test_nfm_count("set- "));
+	TEST_ASSERT_EQUAL_UINT(0, test_nfm_count("member"));
+
+	/* Not applied anymore, updates are ignored */
+	test_nfm_reset();
+	TEST_ASSERT_TRUE(om_tag_update_from_schema(&tag));
+	TEST_ASSERT_EQUAL_UINT(0, g_test_nfm_calls.n);
+	g_test_tag = tag;
+}
+
+int main(int argc, char *argv[])
+{
+	(void)argc;
+	(void)argv;
+
+	target_log_open("TEST", LOG_OPEN_STDOUT);
+	log_severity_set(LOG_SEVERITY_INFO);
+
+	nfm_trule_init();
+
+	UnityBegin(test_name);
+
+	RUN_TEST(test_nfm_trule_compile_options);
+	RUN_TEST(test_nfm_trule_compile_families);
+	RUN_TEST(test_nfm_trule_compile_fallback);
+	RUN_TEST(test_nfm_trule_compile_too_long);
+	RUN_TEST(test_nfm_trule_update_set);
+
+	run_test_nfm_ipset();
+
+	return UNITY_END();
+}
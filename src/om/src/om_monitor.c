@@ -618,6 +618,8 @@ om_monitor_update_flows(om_action_t type, json_t *js)
         if (ret) {
             rules = om_range_get_range_rules();
 
+            // The flows of a range are pushed as a single bundle
+            om_flow_batch_begin();
             ds_list_foreach(rules,data) {
                 /* NOTE: Due to the security aspect of the use case when ranges
                  *       are involved, rules are still added partially when errors
@@ -632,6 +634,7 @@ om_monitor_update_flows(om_action_t type, json_t *js)
                  */
                 ret = ret && om_monitor_update_flows_parsed(type, &data->rule);
             }
+            ret = om_flow_batch_commit() && ret;
         } else {
             LOGE("%s: Failed to generate rules for insertion", __func__);
             (void)om_range_clear_range_rules();
@@ -29,34 +29,246 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "schema.h"
 #include "os.h"
 #include "log.h"
 #include "target.h"
+#include "ds_dlist.h"
 #include "om.h"
 
 /*****************************************************************************/
 #define MODULE_ID LOG_MODULE_ID_MAIN
 /*****************************************************************************/
 
-bool om_add_flow(const char *token, const struct schema_Openflow_Config *ofconf)
+// A flow mod waiting for the batch commit
+typedef struct {
+    bool            add;
+    bool            sent;       // Part of a bundle already
+    char            *bridge;
+    char            *rule;
+    char            *flow;      // Flow as used by ovs-ofctl, with actions for an add
+
+    ds_dlist_node_t dl_node;
+} om_flow_mod_t;
+
+/******************************************************************************
+ * Local Variables
+ *****************************************************************************/
+static int          om_flow_batch_depth = 0;
+static ds_dlist_t   om_flow_batch = DS_DLIST_INIT(om_flow_mod_t, dl_node);
+
+
+/******************************************************************************
+ * Local Functions
+ *****************************************************************************/
+
+static char *
+om_flow_format(const struct schema_Openflow_Config *ofconf, bool add)
 {
-    char    flow_entry[512];
+    char    flow[512];
+
+    if (add) {
+        snprintf(flow, sizeof(flow), "table=%d,priority=%d%s%s,actions=%s",
+                 ofconf->table, ofconf->priority,
+                 strlen(ofconf->rule) > 0 ? "," : "",
+                 ofconf->rule, ofconf->action);
+    }
+    else {
+        snprintf(flow, sizeof(flow), "table=%d,priority=%d%s%s",
+                 ofconf->table, ofconf->priority,
+                 strlen(ofconf->rule) > 0 ? "," : "",
+                 ofconf->rule);
+    }
+
+    return strdup(flow);
+}
+
+static void
+om_flow_mod_free(om_flow_mod_t *fmod)
+{
+    free(fmod->bridge);
+    free(fmod->rule);
+    free(fmod->flow);
+    free(fmod);
+}
+
+static bool
+om_flow_mod_queue(const struct schema_Openflow_Config *ofconf, bool add)
+{
+    om_flow_mod_t   *fmod;
+
+    if (!(fmod = calloc(1, sizeof(*fmod)))) {
+        goto alloc_err;
+    }
+    fmod->add = add;
+    fmod->bridge = strdup(ofconf->bridge);
+    fmod->rule = strdup(ofconf->rule);
+    fmod->flow = om_flow_format(ofconf, add);
+    if (!fmod->bridge || !fmod->rule || !fmod->flow) {
+        goto alloc_err;
+    }
+
+    ds_dlist_insert_tail(&om_flow_batch, fmod);
+    return true;
+
+alloc_err:
+    LOGE("[%s] Flow entry %s failed, memory alloc failed", ofconf->token, add ? "add" : "del");
+    if (fmod) {
+        om_flow_mod_free(fmod);
+    }
+    return false;
+}
+
+// Run a single flow mod through ovs-ofctl
+static bool
+om_flow_mod_exec(om_flow_mod_t *fmod)
+{
+    char    flow_entry[640];
     bool    success = false;
 
-    snprintf(flow_entry, sizeof( flow_entry ),
-             "ovs-ofctl add-flow %s \"table=%d,priority=%d%s%s,actions=%s\"",
-             ofconf->bridge, ofconf->table, ofconf->priority,
-             strlen(ofconf->rule) > 0 ? "," : "",
-             ofconf->rule, ofconf->action );
+    if (fmod->add) {
+        snprintf(flow_entry, sizeof( flow_entry ),
+                 "ovs-ofctl add-flow %s \"%s\"", fmod->bridge, fmod->flow);
+    }
+    else {
+        snprintf(flow_entry, sizeof( flow_entry ),
+                 "ovs-ofctl del-flows %s \"%s\" --strict", fmod->bridge, fmod->flow);
+    }
 
-    // Execute ovs-ofctl to add the flow
+    // Execute ovs-ofctl to add/del the flow
     // cmd_log returns 0 on success
     success = (cmd_log(flow_entry) == 0);
     if(!success) {
-        LOGE("Flow entry add failed: %s", flow_entry);
+        LOGE("Flow entry %s failed: %s", fmod->add ? "add" : "del", flow_entry);
+    }
+
+    return success;
+}
+
+// Run all the flow mods of a bridge as one OpenFlow bundle
+static bool
+om_flow_batch_exec_bridge(const char *bridge)
+{
+    om_flow_mod_t   *fmod;
+    char            path[64];
+    char            cmd[128];
+    FILE            *stream;
+    bool            success;
+    int             count = 0;
+    int             fd;
+
+    // Unique name, created exclusively and only readable by us
+    snprintf(path, sizeof(path), "/tmp/om-flows.XXXXXX");
+    if ((fd = mkstemp(path)) < 0) {
+        LOGE("Flow batch: unable to create %s", path);
+        return false;
+    }
+    if (!(stream = fdopen(fd, "w"))) {
+        LOGE("Flow batch: unable to open %s", path);
+        close(fd);
+        unlink(path);
+        return false;
+    }
+
+    ds_dlist_foreach(&om_flow_batch, fmod) {
+        if (strcmp(fmod->bridge, bridge) != 0) {
+            continue;
+        }
+        fmod->sent = true;
+        fprintf(stream, "%s %s\n", fmod->add ? "add" : "delete_strict", fmod->flow);
+        count++;
+    }
+    if (fclose(stream) != 0) {
+        LOGE("Flow batch: unable to write %s", path);
+        unlink(path);
+        return false;
+    }
+
+    snprintf(cmd, sizeof(cmd), "ovs-ofctl --bundle add-flows %s %s", bridge, path);
+    success = (cmd_log(cmd) == 0);
+    unlink(path);
+
+    if (success) {
+        LOGD("Flow batch: %d flow mods applied to %s", count, bridge);
+    }
+    return success;
+}
+
+
+/******************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+// Collect the following flow mods until the matching om_flow_batch_commit()
+void om_flow_batch_begin(void)
+{
+    om_flow_batch_depth++;
+}
+
+// Push the collected flow mods, one bundle per bridge. A bundle is atomic:
+// when it fails, its flow mods are applied one by one so the ones that can
+// be applied still are.
+bool om_flow_batch_commit(void)
+{
+    om_flow_mod_t   *fmod;
+    om_flow_mod_t   *bmod;
+    bool            success = true;
+
+    if (om_flow_batch_depth <= 0) {
+        LOGE("Flow batch: commit without begin");
+        return false;
+    }
+    if (--om_flow_batch_depth > 0) {
+        return true;
+    }
+
+    ds_dlist_foreach(&om_flow_batch, fmod) {
+        if (fmod->sent) {
+            continue;
+        }
+        if (om_flow_batch_exec_bridge(fmod->bridge)) {
+            continue;
+        }
+
+        // The bundle may have failed before its flow mods were marked, mark
+        // them here so the following ones don't retry the bridge
+        LOGW("Flow batch: bundle failed on %s, applying flows one by one", fmod->bridge);
+        for (bmod = fmod; bmod != NULL; bmod = ds_dlist_next(&om_flow_batch, bmod)) {
+            if (!strcmp(bmod->bridge, fmod->bridge)) {
+                bmod->sent = true;
+                success = om_flow_mod_exec(bmod) && success;
+            }
+        }
+    }
+
+    while ((fmod = ds_dlist_remove_head(&om_flow_batch)) != NULL) {
+        target_om_hook(fmod->add ? TARGET_OM_POST_ADD : TARGET_OM_POST_DEL, fmod->rule);
+        om_flow_mod_free(fmod);
+    }
+
+    return success;
+}
+
+bool om_add_flow(const char *token, const struct schema_Openflow_Config *ofconf)
+{
+    om_flow_mod_t   fmod;
+    bool            success = false;
+
+    if (om_flow_batch_depth > 0) {
+        return om_flow_mod_queue(ofconf, true);
+    }
+
+    memset(&fmod, 0, sizeof(fmod));
+    fmod.add = true;
+    fmod.bridge = (char *)ofconf->bridge;
+    if ((fmod.flow = om_flow_format(ofconf, true))) {
+        success = om_flow_mod_exec(&fmod);
+        free(fmod.flow);
     }
 
     target_om_hook(TARGET_OM_POST_ADD, ofconf->rule); 
@@ -66,20 +278,19 @@ bool om_add_flow(const char *token, const struct schema_Openflow_Config *ofconf)
 
 bool om_del_flow(const char *token, const struct schema_Openflow_Config *ofconf)
 {
-    char    flow_entry[512];
-    bool    success = false;
+    om_flow_mod_t   fmod;
+    bool            success = false;
 
-    snprintf( flow_entry, sizeof( flow_entry ),
-              "ovs-ofctl del-flows %s \"table=%d,priority=%d%s%s\" --strict",
-              ofconf->bridge, ofconf->table, ofconf->priority,
-              strlen( ofconf->rule ) > 0 ? "," : "",
-              ofconf->rule );
+    if (om_flow_batch_depth > 0) {
+        return om_flow_mod_queue(ofconf, false);
+    }
 
-    // Execute ovs-ofctl to del the flow
-    // cmd_log returns 0 on success
-    success = (cmd_log(flow_entry) == 0);
-    if(!success) {
-        LOGE("Flow entry del failed: %s", flow_entry);
+    memset(&fmod, 0, sizeof(fmod));
+    fmod.add = false;
+    fmod.bridge = (char *)ofconf->bridge;
+    if ((fmod.flow = om_flow_format(ofconf, false))) {
+        success = om_flow_mod_exec(&fmod);
+        free(fmod.flow);
     }
 
     target_om_hook(TARGET_OM_POST_DEL, ofconf->rule);
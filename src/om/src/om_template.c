@@ -346,18 +346,21 @@ om_template_tflow_update(om_action_t type, om_tflow_t *tflow)
     om_tag_list_entry_t *tle;
     ds_tree_iter_t      iter;
     om_tdata_t          tdata;
+    bool                ret = true;
 
     if (ds_tree_head(&tflow->tags)) {
         memset(&tdata, 0, sizeof(tdata));
         tdata.filter     = TAG_FILTER_NORMAL;
         tdata.ignore_err = false;
         tle = ds_tree_ifirst(&iter, &tflow->tags);
-        if (!om_template_apply_tag(type, tflow, tle, &iter, &tdata, 0)) {
-            return false;
-        }
+
+        // All system flows of the template go in a single bundle
+        om_flow_batch_begin();
+        ret = om_template_apply_tag(type, tflow, tle, &iter, &tdata, 0);
+        ret = om_flow_batch_commit() && ret;
     }
 
-    return true;
+    return ret;
 }
 
 // Update system flows based on tag update
@@ -375,6 +378,10 @@ om_template_tag_update(om_tag_t *tag, ds_tree_t *removed,
     // Fetch flow tree
     tflows = om_tflow_get_tree();
 
+    // Only the flows of the removed, added and updated values are touched,
+    // all of them in a single bundle
+    om_flow_batch_begin();
+
     // Walk template flows and find ones which reference this tag
     ds_tree_foreach(tflows, tflow) {
         if (!om_tag_list_entry_find_by_value(&tflow->tags, tag->name)) {
@@ -433,5 +440,9 @@ om_template_tag_update(om_tag_t *tag, ds_tree_t *removed,
         }
     }
 
+    if (!om_flow_batch_commit()) {
+        ret = false;
+    }
+
     return ret;
 }
@@ -41,6 +41,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 const char *test_name = "om_tests";
 static struct tag_mgr tag_mgr;
 
+void run_test_om_ovs(void);
+
 void setUp(void)
 {
     // pass
@@ -268,5 +270,7 @@ int main(int argc, char *argv[])
     RUN_TEST(test_generate_ipv4_range_rules);
     RUN_TEST(test_generate_ipv6_range_rules);
 
+    run_test_om_ovs();
+
     return UNITY_END();
 }
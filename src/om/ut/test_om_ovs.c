@@ -0,0 +1,305 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * The flow mod code is built in with the commands it runs and the target
+ * hooks redirected to the recorders below.
+ */
+#define cmd_log             test_cmd_log
+#define target_om_hook      test_target_om_hook
+#define mkstemp             test_mkstemp
+
+#include "om_ovs.c"
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "unity.h"
+
+#define TEST_OM_OVS_MAX 16
+
+/**
+ * @brief commands run and hooks called by the flow mod code
+ */
+static struct
+{
+    char *fail_bundle;                          // Bridge whose bundle fails
+    char *fail_flow;                            // Single flow mod that fails
+    bool fail_mkstemp;                          // Bundle file can't be created
+
+    int ncmd;
+    char cmd[TEST_OM_OVS_MAX][256];
+    char bundle[TEST_OM_OVS_MAX][512];          // Contents of the bundle file
+    char path[TEST_OM_OVS_MAX][64];
+
+    int nhook;
+    target_om_hook_t hook[TEST_OM_OVS_MAX];
+    char hook_rule[TEST_OM_OVS_MAX][64];
+} g_ovs;
+
+
+int
+test_cmd_log(const char *shell_cmd)
+{
+    const char *path;
+    struct stat st;
+    FILE *stream;
+    size_t len;
+    int n = g_ovs.ncmd++;
+
+    TEST_ASSERT_TRUE(n < TEST_OM_OVS_MAX);
+    STRSCPY(g_ovs.cmd[n], shell_cmd);
+
+    if (strstr(shell_cmd, "--bundle") == NULL)
+    {
+        if (g_ovs.fail_flow != NULL && strstr(shell_cmd, g_ovs.fail_flow) != NULL) return 1;
+        return 0;
+    }
+
+    /* The bundle file must be private to us */
+    path = strrchr(shell_cmd, ' ') + 1;
+    STRSCPY(g_ovs.path[n], path);
+    TEST_ASSERT_EQUAL_INT(0, stat(path, &st));
+    TEST_ASSERT_EQUAL_INT(0600, st.st_mode & 0777);
+
+    stream = fopen(path, "r");
+    TEST_ASSERT_NOT_NULL(stream);
+    len = fread(g_ovs.bundle[n], 1, sizeof(g_ovs.bundle[n]) - 1, stream);
+    g_ovs.bundle[n][len] = '\0';
+    fclose(stream);
+
+    if (g_ovs.fail_bundle != NULL && strstr(shell_cmd, g_ovs.fail_bundle) != NULL) return 1;
+    return 0;
+}
+
+#undef mkstemp
+int mkstemp(char *template);
+
+int
+test_mkstemp(char *template)
+{
+    if (g_ovs.fail_mkstemp)
+    {
+        errno = EMFILE;
+        return -1;
+    }
+    return mkstemp(template);
+}
+
+bool
+test_target_om_hook(target_om_hook_t hook, const char *openflow_rule)
+{
+    int n = g_ovs.nhook++;
+
+    TEST_ASSERT_TRUE(n < TEST_OM_OVS_MAX);
+    g_ovs.hook[n] = hook;
+    STRSCPY(g_ovs.hook_rule[n], openflow_rule);
+    return true;
+}
+
+
+static struct schema_Openflow_Config *
+test_om_ovs_flow(const char *bridge, const char *rule, int priority)
+{
+    static struct schema_Openflow_Config ofconf;
+
+    memset(&ofconf, 0, sizeof(ofconf));
+    STRSCPY(ofconf.token, "test");
+    STRSCPY(ofconf.bridge, bridge);
+    STRSCPY(ofconf.rule, rule);
+    STRSCPY(ofconf.action, "drop");
+    ofconf.table = 0;
+    ofconf.priority = priority;
+
+    return &ofconf;
+}
+
+static void
+test_om_ovs_reset(void)
+{
+    memset(&g_ovs, 0, sizeof(g_ovs));
+}
+
+
+/**
+ * @brief outside of a batch, each flow mod runs on its own
+ */
+void
+test_om_ovs_flow_single(void)
+{
+    test_om_ovs_reset();
+
+    TEST_ASSERT_TRUE(om_add_flow("test", test_om_ovs_flow("br-home", "dl_src=aa", 200)));
+    TEST_ASSERT_TRUE(om_del_flow("test", test_om_ovs_flow("br-home", "", 100)));
+
+    TEST_ASSERT_EQUAL_INT(2, g_ovs.ncmd);
+    TEST_ASSERT_EQUAL_STRING("ovs-ofctl add-flow br-home \"table=0,priority=200,dl_src=aa,actions=drop\"",
+                             g_ovs.cmd[0]);
+    TEST_ASSERT_EQUAL_STRING("ovs-ofctl del-flows br-home \"table=0,priority=100\" --strict",
+                             g_ovs.cmd[1]);
+
+    TEST_ASSERT_EQUAL_INT(2, g_ovs.nhook);
+    TEST_ASSERT_EQUAL_INT(TARGET_OM_POST_ADD, g_ovs.hook[0]);
+    TEST_ASSERT_EQUAL_STRING("dl_src=aa", g_ovs.hook_rule[0]);
+    TEST_ASSERT_EQUAL_INT(TARGET_OM_POST_DEL, g_ovs.hook[1]);
+}
+
+
+/**
+ * @brief nested batches are pushed once, as one bundle per bridge
+ */
+void
+test_om_ovs_batch_bundle(void)
+{
+    test_om_ovs_reset();
+
+    om_flow_batch_begin();
+    om_flow_batch_begin();
+    TEST_ASSERT_TRUE(om_add_flow("test", test_om_ovs_flow("br-home", "dl_src=aa", 200)));
+    TEST_ASSERT_TRUE(om_del_flow("test", test_om_ovs_flow("br-home", "dl_src=bb", 200)));
+    TEST_ASSERT_TRUE(om_add_flow("test", test_om_ovs_flow("br-wan", "", 100)));
+
+    /* The inner commit only closes the inner batch */
+    TEST_ASSERT_TRUE(om_flow_batch_commit());
+    TEST_ASSERT_EQUAL_INT(0, g_ovs.ncmd);
+    TEST_ASSERT_EQUAL_INT(0, g_ovs.nhook);
+
+    TEST_ASSERT_TRUE(om_flow_batch_commit());
+    TEST_ASSERT_EQUAL_INT(2, g_ovs.ncmd);
+    TEST_ASSERT_EQUAL_STRING_LEN("ovs-ofctl --bundle add-flows br-home /tmp/om-flows.",
+                                 g_ovs.cmd[0], strlen("ovs-ofctl --bundle add-flows br-home /tmp/om-flows."));
+    TEST_ASSERT_EQUAL_STRING("add table=0,priority=200,dl_src=aa,actions=drop\n"
+                             "delete_strict table=0,priority=200,dl_src=bb\n",
+                             g_ovs.bundle[0]);
+    TEST_ASSERT_EQUAL_STRING_LEN("ovs-ofctl --bundle add-flows br-wan /tmp/om-flows.",
+                                 g_ovs.cmd[1], strlen("ovs-ofctl --bundle add-flows br-wan /tmp/om-flows."));
+    TEST_ASSERT_EQUAL_STRING("add table=0,priority=100,actions=drop\n", g_ovs.bundle[1]);
+
+    /* The bundle files are gone */
+    TEST_ASSERT_NOT_EQUAL(0, access(g_ovs.path[0], F_OK));
+    TEST_ASSERT_NOT_EQUAL(0, access(g_ovs.path[1], F_OK));
+
+    /* Hooks run for every flow mod, in order */
+    TEST_ASSERT_EQUAL_INT(3, g_ovs.nhook);
+    TEST_ASSERT_EQUAL_INT(TARGET_OM_POST_ADD, g_ovs.hook[0]);
+    TEST_ASSERT_EQUAL_STRING("dl_src=aa", g_ovs.hook_rule[0]);
+    TEST_ASSERT_EQUAL_INT(TARGET_OM_POST_DEL, g_ovs.hook[1]);
+    TEST_ASSERT_EQUAL_STRING("dl_src=bb", g_ovs.hook_rule[1]);
+    TEST_ASSERT_EQUAL_INT(TARGET_OM_POST_ADD, g_ovs.hook[2]);
+    TEST_ASSERT_EQUAL_STRING("", g_ovs.hook_rule[2]);
+
+    /* Nothing left to commit */
+    TEST_ASSERT_FALSE(om_flow_batch_commit());
+    TEST_ASSERT_EQUAL_INT(2, g_ovs.ncmd);
+}
+
+
+/**
+ * @brief a failed bundle is applied again one flow mod at a time
+ */
+void
+test_om_ovs_batch_fallback(void)
+{
+    test_om_ovs_reset();
+    g_ovs.fail_bundle = "br-home";
+
+    om_flow_batch_begin();
+    TEST_ASSERT_TRUE(om_add_flow("test", test_om_ovs_flow("br-home", "dl_src=aa", 200)));
+    TEST_ASSERT_TRUE(om_add_flow("test", test_om_ovs_flow("br-wan", "dl_src=cc", 200)));
+    TEST_ASSERT_TRUE(om_del_flow("test", test_om_ovs_flow("br-home", "dl_src=bb", 200)));
+    TEST_ASSERT_TRUE(om_flow_batch_commit());
+
+    TEST_ASSERT_EQUAL_INT(4, g_ovs.ncmd);
+    TEST_ASSERT_NOT_NULL(strstr(g_ovs.cmd[0], "--bundle add-flows br-home"));
+    TEST_ASSERT_EQUAL_STRING("ovs-ofctl add-flow br-home \"table=0,priority=200,dl_src=aa,actions=drop\"",
+                             g_ovs.cmd[1]);
+    TEST_ASSERT_EQUAL_STRING("ovs-ofctl del-flows br-home \"table=0,priority=200,dl_src=bb\" --strict",
+                             g_ovs.cmd[2]);
+    TEST_ASSERT_NOT_NULL(strstr(g_ovs.cmd[3], "--bundle add-flows br-wan"));
+    TEST_ASSERT_EQUAL_STRING("add table=0,priority=200,dl_src=cc,actions=drop\n", g_ovs.bundle[3]);
+
+    TEST_ASSERT_EQUAL_INT(3, g_ovs.nhook);
+    TEST_ASSERT_EQUAL_INT(TARGET_OM_POST_ADD, g_ovs.hook[0]);
+    TEST_ASSERT_EQUAL_STRING("dl_src=aa", g_ovs.hook_rule[0]);
+    TEST_ASSERT_EQUAL_INT(TARGET_OM_POST_ADD, g_ovs.hook[1]);
+    TEST_ASSERT_EQUAL_STRING("dl_src=cc", g_ovs.hook_rule[1]);
+    TEST_ASSERT_EQUAL_INT(TARGET_OM_POST_DEL, g_ovs.hook[2]);
+    TEST_ASSERT_EQUAL_STRING("dl_src=bb", g_ovs.hook_rule[2]);
+
+    /* A flow mod failing on its own fails the commit, hooks still run */
+    test_om_ovs_reset();
+    g_ovs.fail_bundle = "br-home";
+    g_ovs.fail_flow = "dl_src=bb";
+
+    om_flow_batch_begin();
+    TEST_ASSERT_TRUE(om_del_flow("test", test_om_ovs_flow("br-home", "dl_src=bb", 200)));
+    TEST_ASSERT_TRUE(om_add_flow("test", test_om_ovs_flow("br-home", "dl_src=aa", 200)));
+    TEST_ASSERT_FALSE(om_flow_batch_commit());
+
+    TEST_ASSERT_EQUAL_INT(3, g_ovs.ncmd);
+    TEST_ASSERT_NOT_NULL(strstr(g_ovs.cmd[1], "del-flows br-home"));
+    TEST_ASSERT_NOT_NULL(strstr(g_ovs.cmd[2], "add-flow br-home"));
+    TEST_ASSERT_EQUAL_INT(2, g_ovs.nhook);
+    TEST_ASSERT_EQUAL_INT(TARGET_OM_POST_DEL, g_ovs.hook[0]);
+    TEST_ASSERT_EQUAL_INT(TARGET_OM_POST_ADD, g_ovs.hook[1]);
+}
+
+
+/**
+ * @brief without a bundle file, each flow mod of the bridge runs once
+ */
+void
+test_om_ovs_batch_no_file(void)
+{
+    test_om_ovs_reset();
+    g_ovs.fail_mkstemp = true;
+
+    om_flow_batch_begin();
+    TEST_ASSERT_TRUE(om_add_flow("test", test_om_ovs_flow("br-home", "dl_src=aa", 200)));
+    TEST_ASSERT_TRUE(om_add_flow("test", test_om_ovs_flow("br-wan", "dl_src=cc", 200)));
+    TEST_ASSERT_TRUE(om_del_flow("test", test_om_ovs_flow("br-home", "dl_src=bb", 200)));
+    TEST_ASSERT_TRUE(om_flow_batch_commit());
+
+    TEST_ASSERT_EQUAL_INT(3, g_ovs.ncmd);
+    TEST_ASSERT_EQUAL_STRING("ovs-ofctl add-flow br-home \"table=0,priority=200,dl_src=aa,actions=drop\"",
+                             g_ovs.cmd[0]);
+    TEST_ASSERT_EQUAL_STRING("ovs-ofctl del-flows br-home \"table=0,priority=200,dl_src=bb\" --strict",
+                             g_ovs.cmd[1]);
+    TEST_ASSERT_EQUAL_STRING("ovs-ofctl add-flow br-wan \"table=0,priority=200,dl_src=cc,actions=drop\"",
+                             g_ovs.cmd[2]);
+    TEST_ASSERT_EQUAL_INT(3, g_ovs.nhook);
+}
+
+
+void
+run_test_om_ovs(void)
+{
+    RUN_TEST(test_om_ovs_flow_single);
+    RUN_TEST(test_om_ovs_batch_bundle);
+    RUN_TEST(test_om_ovs_batch_fallback);
+    RUN_TEST(test_om_ovs_batch_no_file);
+}
@@ -873,23 +873,17 @@ static bool gw_offline_cfg_ovsdb_apply(const struct gw_offline_cfg *cfg)
     }
 
     /* Add home-aps entries to Wifi_Inet_Config... */
-    json_array_foreach(cfg->inet_config_home_aps, index, row)
+    if (ovsdb_sync_insert_rows("Wifi_Inet_Config", cfg->inet_config_home_aps) < 0)
     {
-        if (!ovsdb_sync_insert("Wifi_Inet_Config", row, NULL))
-        {
-            LOG(ERR, "offline_cfg: Error inserting into Wifi_Inet_Config: row=%s", json_dumps_static(row, 0));
-            return false;
-        }
+        LOG(ERR, "offline_cfg: Error inserting into Wifi_Inet_Config");
+        return false;
     }
 
     /* Configure DHCP reservations: */
-    json_array_foreach(cfg->dhcp_reserved_ip, index, row)
+    if (ovsdb_sync_insert_rows("DHCP_reserved_IP", cfg->dhcp_reserved_ip) < 0)
     {
-        if (!ovsdb_sync_insert("DHCP_reserved_IP", row, NULL))
-        {
-            LOG(ERR, "offline_cfg: Error inserting into DHCP_reserved_IP: row=%s", json_dumps_static(row, 0));
-            return false;
-        }
+        LOG(ERR, "offline_cfg: Error inserting into DHCP_reserved_IP");
+        return false;
     }
 
     return true;
@@ -0,0 +1,440 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "log.h"
+#include "os.h"
+#include "os_time.h"
+#include "qm_conn_async.h"
+
+
+/**
+ * @brief changes the events the socket is watched for
+ */
+static void
+qm_conn_async_set_events(qm_conn_async_t *qa, int events)
+{
+    if (qa->events == events) return;
+
+    ev_io_stop(qa->loop, &qa->io);
+    ev_io_set(&qa->io, qa->fd, events);
+    ev_io_start(qa->loop, &qa->io);
+    qa->events = events;
+}
+
+
+/**
+ * @brief removes the oldest pending request
+ *
+ * @param qa the client
+ * @param pending the removed request
+ */
+static void
+qm_conn_async_pop(qm_conn_async_t *qa, struct qm_conn_async_pending *pending)
+{
+    *pending = qa->pending[qa->pending_head];
+    qa->pending_head = (qa->pending_head + 1) % QM_CONN_ASYNC_MAX_INFLIGHT;
+    qa->pending_count--;
+}
+
+
+/**
+ * @brief completes the oldest pending requests with an error
+ *
+ * @param qa the client
+ * @param n the number of requests to complete
+ * @param error the error reported to the response callback
+ */
+static void
+qm_conn_async_fail(qm_conn_async_t *qa, size_t n, enum qm_res_error error)
+{
+    struct qm_conn_async_pending pending;
+    qm_response_t res;
+
+    while (n-- && qa->pending_count)
+    {
+        qm_conn_async_pop(qa, &pending);
+        qa->stats.failed++;
+
+        MEMZERO(res);
+        memcpy(res.tag, QM_RESPONSE_TAG, sizeof(res.tag));
+        res.ver = QM_RESPONSE_VER;
+        res.seq = pending.seq;
+        res.response = QM_RESPONSE_ERROR;
+        res.error = error;
+        if (qa->res_cb) qa->res_cb(qa, &res, pending.data);
+    }
+}
+
+
+void
+qm_conn_async_init(qm_conn_async_t *qa, struct ev_loop *loop)
+{
+    MEMZERO(*qa);
+    qa->loop = loop;
+    qa->fd = -1;
+}
+
+
+void
+qm_conn_async_close(qm_conn_async_t *qa)
+{
+    if (qa->fd >= 0)
+    {
+        ev_io_stop(qa->loop, &qa->io);
+        close(qa->fd);
+        qa->fd = -1;
+        qa->events = 0;
+    }
+
+    free(qa->tx_buf);
+    qa->tx_buf = NULL;
+    qa->tx_size = 0;
+    qa->tx_off = 0;
+    qa->tx_len = 0;
+    qa->rx_len = 0;
+
+    /* Requests queued from the callbacks go to a new connection */
+    qm_conn_async_fail(qa, qa->pending_count, QM_ERROR_CONNECT);
+}
+
+
+/**
+ * @brief writes the transmit buffer until the socket is full
+ *
+ * @param qa the client
+ * @return false if the connection was closed on error, true otherwise
+ */
+static bool
+qm_conn_async_flush(qm_conn_async_t *qa)
+{
+    ssize_t ret;
+
+    while (qa->tx_off < qa->tx_len)
+    {
+        ret = send(qa->fd, qa->tx_buf + qa->tx_off, qa->tx_len - qa->tx_off,
+                   MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                qm_conn_async_set_events(qa, EV_READ | EV_WRITE);
+                return true;
+            }
+
+            LOGE("%s: send error %d %s", __func__, errno, strerror(errno));
+            qm_conn_async_close(qa);
+            return false;
+        }
+        qa->tx_off += ret;
+    }
+
+    qa->tx_off = 0;
+    qa->tx_len = 0;
+    qm_conn_async_set_events(qa, EV_READ);
+
+    return true;
+}
+
+
+/**
+ * @brief matches a response to its pending request
+ *
+ * @param qa the client
+ * @param res the response
+ */
+static void
+qm_conn_async_handle_res(qm_conn_async_t *qa, qm_response_t *res)
+{
+    struct qm_conn_async_pending pending;
+    int64_t latency;
+    size_t i;
+
+    if (!qm_res_valid(res))
+    {
+        LOGE("%s: invalid response %.4s %d", __func__, res->tag, res->ver);
+        qm_conn_async_close(qa);
+        return;
+    }
+
+    for (i = 0; i < qa->pending_count; i++)
+    {
+        if (qa->pending[(qa->pending_head + i) % QM_CONN_ASYNC_MAX_INFLIGHT].seq == res->seq) break;
+    }
+    if (i == qa->pending_count)
+    {
+        LOGW("%s: no request for response seq %u", __func__, res->seq);
+        return;
+    }
+
+    /* QM answers in order, older requests will not get a response */
+    qm_conn_async_fail(qa, i, QM_ERROR_INVALID);
+    if (qa->pending_count == 0) return;
+
+    qm_conn_async_pop(qa, &pending);
+    latency = clock_mono_usec() - pending.queued_usec;
+    qa->stats.received++;
+    qa->stats.latency_usec_sum += latency;
+    if (latency > qa->stats.latency_usec_max) qa->stats.latency_usec_max = latency;
+    qa->stats.qdrop += res->qdrop;
+
+    if (qa->res_cb) qa->res_cb(qa, res, pending.data);
+
+    if (qa->backpressure_cb == NULL) return;
+    if (res->qdrop || (qa->qlen_high && res->qlen >= qa->qlen_high))
+    {
+        qa->backpressure_cb(qa, res);
+    }
+}
+
+
+/**
+ * @brief reads the available responses
+ *
+ * @param qa the client
+ */
+static void
+qm_conn_async_read(qm_conn_async_t *qa)
+{
+    ssize_t ret;
+
+    while (qa->fd >= 0)
+    {
+        ret = read(qa->fd, (uint8_t *)&qa->rx + qa->rx_len, sizeof(qa->rx) - qa->rx_len);
+        if (ret < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+
+            LOGE("%s: read error %d %s", __func__, errno, strerror(errno));
+            qm_conn_async_close(qa);
+            return;
+        }
+        if (ret == 0)
+        {
+            LOGI("%s: connection closed by QM", __func__);
+            qm_conn_async_close(qa);
+            return;
+        }
+
+        qa->rx_len += ret;
+        if (qa->rx_len < sizeof(qa->rx)) continue;
+
+        qa->rx_len = 0;
+        qm_conn_async_handle_res(qa, &qa->rx);
+    }
+}
+
+
+static void
+qm_conn_async_io_cb(struct ev_loop *loop, ev_io *io, int revents)
+{
+    qm_conn_async_t *qa = io->data;
+
+    (void)loop;
+
+    if (revents & EV_WRITE)
+    {
+        if (!qm_conn_async_flush(qa)) return;
+    }
+
+    if (revents & EV_READ) qm_conn_async_read(qa);
+}
+
+
+bool
+qm_conn_async_attach(qm_conn_async_t *qa, int fd)
+{
+    int flags;
+
+    if (qa->fd >= 0) qm_conn_async_close(qa);
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        LOGE("%s: fcntl(%d) error %d %s", __func__, fd, errno, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    qa->fd = fd;
+    qa->events = EV_READ;
+    ev_io_init(&qa->io, qm_conn_async_io_cb, fd, EV_READ);
+    qa->io.data = qa;
+    ev_io_start(qa->loop, &qa->io);
+
+    return true;
+}
+
+
+bool
+qm_conn_async_connect(qm_conn_async_t *qa)
+{
+    int fd;
+
+    if (qa->fd >= 0) return true;
+    if (!qm_conn_client(&fd)) return false;
+
+    return qm_conn_async_attach(qa, fd);
+}
+
+
+/**
+ * @brief makes room for a request in the transmit buffer
+ *
+ * @param qa the client
+ * @param len the encoded request size
+ * @return true if success, false if the buffer is full
+ */
+static bool
+qm_conn_async_reserve(qm_conn_async_t *qa, size_t len)
+{
+    uint8_t *buf;
+    size_t size;
+
+    if (qa->tx_len + len <= qa->tx_size) return true;
+
+    if (qa->tx_off)
+    {
+        memmove(qa->tx_buf, qa->tx_buf + qa->tx_off, qa->tx_len - qa->tx_off);
+        qa->tx_len -= qa->tx_off;
+        qa->tx_off = 0;
+        if (qa->tx_len + len <= qa->tx_size) return true;
+    }
+
+    if (qa->tx_len + len > QM_CONN_ASYNC_MAX_TX) return false;
+
+    size = (qa->tx_size ? qa->tx_size : 4096);
+    while (size < qa->tx_len + len) size *= 2;
+    if (size > QM_CONN_ASYNC_MAX_TX) size = QM_CONN_ASYNC_MAX_TX;
+
+    buf = realloc(qa->tx_buf, size);
+    if (buf == NULL) return false;
+
+    qa->tx_buf = buf;
+    qa->tx_size = size;
+
+    return true;
+}
+
+
+bool
+qm_conn_async_send(qm_conn_async_t *qa, qm_request_t *req, char *topic,
+                   void *data, int data_size, void *cb_data)
+{
+    struct qm_conn_async_pending *pending;
+    bool need_res;
+    uint8_t *p;
+    size_t idx;
+    size_t len;
+
+    if (!qm_req_valid(req))
+    {
+        LOGE("%s: invalid req", __func__);
+        return false;
+    }
+
+    if (!qm_conn_async_connect(qa)) return false;
+
+    need_res = !(req->flags & QM_REQ_FLAG_NO_RESPONSE);
+    if (need_res && qa->pending_count == QM_CONN_ASYNC_MAX_INFLIGHT) goto err_full;
+
+    req->topic_len = (topic && *topic) ? strlen(topic) + 1 : 0;
+    req->data_size = data_size;
+
+    len = sizeof(*req) + req->topic_len + req->data_size;
+    if (!qm_conn_async_reserve(qa, len)) goto err_full;
+
+    p = qa->tx_buf + qa->tx_len;
+    memcpy(p, req, sizeof(*req));
+    p += sizeof(*req);
+    if (req->topic_len)
+    {
+        memcpy(p, topic, req->topic_len);
+        p += req->topic_len;
+    }
+    if (data_size) memcpy(p, data, data_size);
+    qa->tx_len += len;
+
+    if (need_res)
+    {
+        idx = (qa->pending_head + qa->pending_count) % QM_CONN_ASYNC_MAX_INFLIGHT;
+        pending = &qa->pending[idx];
+        pending->seq = req->seq;
+        pending->queued_usec = clock_mono_usec();
+        pending->data = cb_data;
+        qa->pending_count++;
+        if (qa->pending_count > qa->stats.max_inflight)
+        {
+            qa->stats.max_inflight = qa->pending_count;
+        }
+    }
+    qa->stats.sent++;
+
+    LOGT("%s: c:%d dt:%d ds:%d to:%s inflight:%zu", __func__, req->cmd,
+         req->data_type, data_size, topic ? topic : "null", qa->pending_count);
+
+    /* A write error completes the pending requests through the callback */
+    qm_conn_async_flush(qa);
+
+    return true;
+
+err_full:
+    qa->stats.rejected++;
+    LOGD("%s: client full, %zu requests in flight, %zu bytes unsent", __func__,
+         qa->pending_count, qa->tx_len - qa->tx_off);
+    if (qa->backpressure_cb) qa->backpressure_cb(qa, NULL);
+
+    return false;
+}
+
+
+bool
+qm_conn_async_send_stats(qm_conn_async_t *qa, void *data, int data_size)
+{
+    qm_request_t req;
+
+    qm_req_init(&req);
+    req.cmd = QM_CMD_SEND;
+    req.data_type = QM_DATA_STATS;
+    req.compress = QM_REQ_COMPRESS_IF_CFG;
+
+    return qm_conn_async_send(qa, &req, NULL, data, data_size, NULL);
+}
+
+
+size_t
+qm_conn_async_inflight(qm_conn_async_t *qa)
+{
+    return qa->pending_count;
+}
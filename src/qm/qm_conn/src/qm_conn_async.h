@@ -0,0 +1,185 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QM_CONN_ASYNC_H_INCLUDED
+#define QM_CONN_ASYNC_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <ev.h>
+
+#include "qm_conn.h"
+
+/*
+ * Non-blocking QM client
+ *
+ * Requests are encoded into a transmit buffer and written from the event
+ * loop, several of them can be in flight on the same connection. QM
+ * answers the requests of a connection in order, the responses are
+ * matched to the pending requests by sequence number.
+ */
+
+#define QM_CONN_ASYNC_MAX_INFLIGHT 64
+#define QM_CONN_ASYNC_MAX_TX (1024*1024)
+
+typedef struct qm_conn_async qm_conn_async_t;
+
+/**
+ * @brief called when the response of a request is received
+ *
+ * On a connection error the pending requests complete with a response
+ * of type QM_RESPONSE_ERROR and error QM_ERROR_CONNECT.
+ * @param qa the client
+ * @param res the response
+ * @param data the opaque pointer given when sending the request
+ */
+typedef void (*qm_conn_async_res_cb_t)(qm_conn_async_t *qa, qm_response_t *res, void *data);
+
+/**
+ * @brief called when QM or the client can not keep up
+ *
+ * @param qa the client
+ * @param res the response reporting dropped messages or a long queue,
+ *        NULL when the client itself refused a request
+ */
+typedef void (*qm_conn_async_backpressure_cb_t)(qm_conn_async_t *qa, qm_response_t *res);
+
+struct qm_conn_async_pending
+{
+    uint32_t seq;
+    int64_t queued_usec;
+    void *data;
+};
+
+struct qm_conn_async_stats
+{
+    uint64_t sent;             // requests queued for sending
+    uint64_t received;         // responses matched to a request
+    uint64_t failed;           // requests failed by a connection error
+    uint64_t rejected;         // requests refused, client full
+    uint64_t qdrop;            // messages dropped by QM
+    uint32_t max_inflight;     // highest number of pending requests
+    int64_t latency_usec_sum;  // queued to response, all responses
+    int64_t latency_usec_max;
+};
+
+struct qm_conn_async
+{
+    struct ev_loop *loop;
+    ev_io io;
+    int fd;
+    int events;
+
+    /* encoded requests, written from tx_off to tx_len */
+    uint8_t *tx_buf;
+    size_t tx_off;
+    size_t tx_len;
+    size_t tx_size;
+
+    /* ring of the requests waiting for a response */
+    struct qm_conn_async_pending pending[QM_CONN_ASYNC_MAX_INFLIGHT];
+    size_t pending_head;
+    size_t pending_count;
+
+    /* partially read response */
+    qm_response_t rx;
+    size_t rx_len;
+
+    uint32_t qlen_high;        // backpressure when QM queue reaches it, 0 to disable
+    qm_conn_async_res_cb_t res_cb;
+    qm_conn_async_backpressure_cb_t backpressure_cb;
+    void *ctx;
+
+    struct qm_conn_async_stats stats;
+};
+
+/**
+ * @brief initializes a client, without connecting
+ *
+ * @param qa the client
+ * @param loop the event loop the socket is watched from
+ */
+void qm_conn_async_init(qm_conn_async_t *qa, struct ev_loop *loop);
+
+/**
+ * @brief connects the client to QM if not connected
+ *
+ * @param qa the client
+ * @return true if connected, false otherwise
+ */
+bool qm_conn_async_connect(qm_conn_async_t *qa);
+
+/**
+ * @brief uses an already connected socket for the client
+ *
+ * The client owns the socket and closes it.
+ * @param qa the client
+ * @param fd the connected socket
+ * @return true if success, false otherwise
+ */
+bool qm_conn_async_attach(qm_conn_async_t *qa, int fd);
+
+/**
+ * @brief queues a request
+ *
+ * The topic and data are copied, the call does not wait for QM.
+ * @param qa the client
+ * @param req the request, initialized with qm_req_init()
+ * @param topic the topic, can be NULL
+ * @param data the data
+ * @param data_size the data size
+ * @param cb_data the opaque pointer given to the response callback
+ * @return true if queued, false on a connection error or a full client
+ */
+bool qm_conn_async_send(qm_conn_async_t *qa, qm_request_t *req, char *topic,
+                        void *data, int data_size, void *cb_data);
+
+/**
+ * @brief queues a stats report
+ *
+ * @param qa the client
+ * @param data the encoded report
+ * @param data_size the report size
+ * @return true if queued, false otherwise
+ */
+bool qm_conn_async_send_stats(qm_conn_async_t *qa, void *data, int data_size);
+
+/**
+ * @brief returns the number of requests waiting for a response
+ */
+size_t qm_conn_async_inflight(qm_conn_async_t *qa);
+
+/**
+ * @brief closes the connection
+ *
+ * The pending requests complete with a connection error. The client can
+ * connect again.
+ * @param qa the client
+ */
+void qm_conn_async_close(qm_conn_async_t *qa);
+
+#endif /* QM_CONN_ASYNC_H_INCLUDED */
@@ -35,9 +35,12 @@ UNIT_NAME := qm_conn
 UNIT_TYPE := LIB
 
 UNIT_SRC += src/qm_conn.c
+UNIT_SRC += src/qm_conn_async.c
 
 UNIT_CFLAGS := -I$(UNIT_PATH)/src
 
+UNIT_LDFLAGS := -lev
+
 UNIT_EXPORT_CFLAGS := $(UNIT_CFLAGS)
 UNIT_EXPORT_LDFLAGS := $(UNIT_LDFLAGS)
 
@@ -39,6 +39,18 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define QM_LOG_QUEUE_SIZE (100*1024) // 100k
 
+#define QM_SPILL_DEFAULT_SIZE (4*1024*1024)
+#define QM_SPILL_DEFAULT_RATE (10) // replayed messages per second
+
+// refcounted receive block, requests are parsed in place
+
+typedef struct qm_rx_block
+{
+    int refcount;
+    size_t size;
+    uint8_t data[];
+} qm_rx_block_t;
+
 // queue item
 
 typedef struct qm_item
@@ -48,9 +60,21 @@ typedef struct qm_item
     size_t size;
     void *buf;
     time_t timestamp;
+    bool compressed;    // buf already compressed
+    qm_rx_block_t *block; // receive block topic and buf may point into
     ds_dlist_node_t qnode;
 } qm_item_t;
 
+// stats reports merged on the protobuf wire format
+
+typedef struct qm_report_merge
+{
+    uint8_t *buf;       // merged encoded report
+    size_t len;         // merged report length
+    size_t size;        // allocated length
+    bool has_nodeid;    // nodeID already emitted
+} qm_report_merge_t;
+
 typedef struct qm_queue
 {
     ds_dlist_t queue;
@@ -70,12 +94,20 @@ bool qm_mqtt_init(void);
 void qm_mqtt_stop(void);
 void qm_mqtt_set(const char *broker, const char *port, const char *topic, const char *qos, int compress);
 void qm_mqtt_set_log_interval(int log_interval);
+void qm_mqtt_set_compress_on_enqueue(bool enable);
+void qm_mqtt_set_spill_replay_rate(int rate);
+bool qm_mqtt_compress_item(qm_item_t *qi);
 bool qm_mqtt_is_connected();
 bool qm_mqtt_config_valid();
 bool qm_mqtt_send_message(qm_item_t *qi, qm_response_t *res);
 void qm_mqtt_send_queue();
 void qm_mqtt_reconnect();
 
+qm_rx_block_t *qm_rx_block_new(size_t size);
+void qm_rx_block_unref(qm_rx_block_t *block);
+bool qm_rx_block_holds(qm_rx_block_t *block, const void *ptr);
+
+bool qm_queue_item_detach(qm_item_t *qi);
 void qm_queue_item_free_buf(qm_item_t *qi);
 void qm_queue_item_free(qm_item_t *qi);
 void qm_queue_init();
@@ -85,10 +117,30 @@ bool qm_queue_head(qm_item_t **qitem);
 bool qm_queue_tail(qm_item_t **qitem);
 bool qm_queue_remove(qm_item_t *qitem);
 bool qm_queue_drop_head();
+bool qm_queue_spill_head();
 bool qm_queue_make_room(qm_item_t *qi, qm_response_t *res);
 bool qm_queue_put(qm_item_t **qitem, qm_response_t *res);
 bool qm_queue_get(qm_item_t **qitem);
 
 bool qm_event_init();
 
+bool qm_report_merge_init(qm_report_merge_t *merge, size_t size);
+bool qm_report_merge_append(qm_report_merge_t *merge, const void *buf, size_t len);
+void qm_report_merge_free(qm_report_merge_t *merge);
+
+bool qm_spill_set_config(const char *dir, size_t max_size);
+bool qm_spill_enabled(void);
+size_t qm_spill_count(void);
+bool qm_spill_put(qm_item_t *qi);
+void qm_spill_sync(void);
+bool qm_spill_peek(qm_item_t *qi);
+void qm_spill_pop(void);
+void qm_spill_fini(void);
+
+void qm_compress_clear_config(void);
+bool qm_compress_set_level(const char *topic, const char *val);
+bool qm_compress_set_strategy(const char *topic, const char *val);
+bool qm_compress(const char *topic, const void *buf, size_t len, void **out, size_t *out_len);
+void qm_compress_fini(void);
+
 #endif /* QM_H_INCLUDED */
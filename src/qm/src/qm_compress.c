@@ -0,0 +1,355 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "const.h"
+#include "log.h"
+#include "ds_tree.h"
+#include "qm.h"
+
+/*
+ * Messages are deflated through a single z_stream kept across publishes,
+ * reset between messages, into an output buffer grown on demand. This
+ * replaces the per message compress() call, which allocates the deflate
+ * state and window, and the per message output buffer.
+ *
+ * The compression level and strategy default to zlib's and can be
+ * overridden for all topics or for a given topic.
+ */
+
+#define QM_COMPRESS_UNSET (-100)
+
+typedef struct qm_compress_cfg
+{
+    char *topic;
+    int level;
+    int strategy;
+    ds_tree_node_t node;
+} qm_compress_cfg_t;
+
+static struct
+{
+    z_stream strm;
+    bool initialized;
+    int level;
+    int strategy;
+    uint8_t *buf;
+    size_t size;
+} qm_deflate;
+
+static qm_compress_cfg_t qm_compress_default =
+{
+    .level = QM_COMPRESS_UNSET,
+    .strategy = QM_COMPRESS_UNSET,
+};
+
+static ds_tree_t qm_compress_topics = DS_TREE_INIT(ds_str_cmp, qm_compress_cfg_t, node);
+
+static const struct
+{
+    const char *name;
+    int strategy;
+} qm_compress_strategies[] =
+{
+    { "default",  Z_DEFAULT_STRATEGY },
+    { "filtered", Z_FILTERED },
+    { "huffman",  Z_HUFFMAN_ONLY },
+    { "rle",      Z_RLE },
+    { "fixed",    Z_FIXED },
+};
+
+
+/**
+ * @brief returns the compression settings of a topic
+ *
+ * @param topic the topic, NULL for the default settings
+ * @param create create the topic settings if missing
+ * @return the settings, NULL if missing or out of memory
+ */
+static qm_compress_cfg_t *
+qm_compress_get_cfg(const char *topic, bool create)
+{
+    qm_compress_cfg_t *cfg;
+
+    if (topic == NULL) return &qm_compress_default;
+
+    cfg = ds_tree_find(&qm_compress_topics, (void *)topic);
+    if (cfg != NULL || !create) return cfg;
+
+    cfg = calloc(1, sizeof(*cfg));
+    if (cfg == NULL) return NULL;
+
+    cfg->topic = strdup(topic);
+    if (cfg->topic == NULL)
+    {
+        free(cfg);
+        return NULL;
+    }
+    cfg->level = QM_COMPRESS_UNSET;
+    cfg->strategy = QM_COMPRESS_UNSET;
+    ds_tree_insert(&qm_compress_topics, cfg, cfg->topic);
+
+    return cfg;
+}
+
+
+/**
+ * @brief resets the compression settings to zlib's defaults
+ */
+void
+qm_compress_clear_config(void)
+{
+    qm_compress_cfg_t *cfg;
+
+    while ((cfg = ds_tree_head(&qm_compress_topics)) != NULL)
+    {
+        ds_tree_remove(&qm_compress_topics, cfg);
+        free(cfg->topic);
+        free(cfg);
+    }
+
+    qm_compress_default.level = QM_COMPRESS_UNSET;
+    qm_compress_default.strategy = QM_COMPRESS_UNSET;
+}
+
+
+/**
+ * @brief sets the compression level
+ *
+ * @param topic the topic, NULL to set the default level
+ * @param val the level, 0 to 9
+ * @return true if success, false otherwise
+ */
+bool
+qm_compress_set_level(const char *topic, const char *val)
+{
+    qm_compress_cfg_t *cfg;
+    char *end;
+    long level;
+
+    level = strtol(val, &end, 10);
+    if (*val == '\0' || *end != '\0' || level < Z_NO_COMPRESSION || level > Z_BEST_COMPRESSION)
+    {
+        LOGE("%s: invalid compression level '%s'", __func__, val);
+        return false;
+    }
+
+    cfg = qm_compress_get_cfg(topic, true);
+    if (cfg == NULL) return false;
+
+    cfg->level = (int)level;
+
+    return true;
+}
+
+
+/**
+ * @brief sets the compression strategy
+ *
+ * @param topic the topic, NULL to set the default strategy
+ * @param val the strategy: default, filtered, huffman, rle or fixed
+ * @return true if success, false otherwise
+ */
+bool
+qm_compress_set_strategy(const char *topic, const char *val)
+{
+    qm_compress_cfg_t *cfg;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(qm_compress_strategies); i++)
+    {
+        if (strcmp(val, qm_compress_strategies[i].name) == 0) break;
+    }
+
+    if (i == ARRAY_SIZE(qm_compress_strategies))
+    {
+        LOGE("%s: invalid compression strategy '%s'", __func__, val);
+        return false;
+    }
+
+    cfg = qm_compress_get_cfg(topic, true);
+    if (cfg == NULL) return false;
+
+    cfg->strategy = qm_compress_strategies[i].strategy;
+
+    return true;
+}
+
+
+/**
+ * @brief resolves the compression level and strategy of a topic
+ *
+ * @param topic the topic
+ * @param level the resolved level
+ * @param strategy the resolved strategy
+ */
+static void
+qm_compress_resolve(const char *topic, int *level, int *strategy)
+{
+    qm_compress_cfg_t *cfg;
+
+    *level = Z_DEFAULT_COMPRESSION;
+    *strategy = Z_DEFAULT_STRATEGY;
+
+    if (qm_compress_default.level != QM_COMPRESS_UNSET) *level = qm_compress_default.level;
+    if (qm_compress_default.strategy != QM_COMPRESS_UNSET) *strategy = qm_compress_default.strategy;
+
+    cfg = (topic != NULL ? qm_compress_get_cfg(topic, false) : NULL);
+    if (cfg == NULL) return;
+
+    if (cfg->level != QM_COMPRESS_UNSET) *level = cfg->level;
+    if (cfg->strategy != QM_COMPRESS_UNSET) *strategy = cfg->strategy;
+}
+
+
+/**
+ * @brief readies the deflate stream for a new message
+ *
+ * @param level the compression level
+ * @param strategy the compression strategy
+ * @return true if success, false otherwise
+ */
+static bool
+qm_compress_prepare(int level, int strategy)
+{
+    z_stream *strm = &qm_deflate.strm;
+    int ret;
+
+    if (!qm_deflate.initialized)
+    {
+        memset(strm, 0, sizeof(*strm));
+        ret = deflateInit2(strm, level, Z_DEFLATED, MAX_WBITS, 8, strategy);
+        if (ret != Z_OK)
+        {
+            LOGE("%s: deflate init error %d", __func__, ret);
+            return false;
+        }
+        qm_deflate.initialized = true;
+        qm_deflate.level = level;
+        qm_deflate.strategy = strategy;
+        return true;
+    }
+
+    ret = deflateReset(strm);
+    if (ret != Z_OK) goto err_reset;
+
+    if (level == qm_deflate.level && strategy == qm_deflate.strategy) return true;
+
+    /* No input since the reset: the parameters change without flushing */
+    ret = deflateParams(strm, level, strategy);
+    if (ret != Z_OK) goto err_reset;
+
+    qm_deflate.level = level;
+    qm_deflate.strategy = strategy;
+
+    return true;
+
+err_reset:
+    LOGE("%s: deflate reset error %d", __func__, ret);
+    deflateEnd(strm);
+    qm_deflate.initialized = false;
+
+    return false;
+}
+
+
+/**
+ * @brief compresses a message in zlib format
+ *
+ * The output points to a buffer reused by the next call.
+ * @param topic the message topic, selects the compression settings
+ * @param buf the message
+ * @param len the message length
+ * @param out the compressed message
+ * @param out_len the compressed message length
+ * @return true if success, false otherwise
+ */
+bool
+qm_compress(const char *topic, const void *buf, size_t len, void **out, size_t *out_len)
+{
+    z_stream *strm = &qm_deflate.strm;
+    int strategy;
+    uint8_t *obuf;
+    size_t bound;
+    int level;
+    int ret;
+
+    qm_compress_resolve(topic, &level, &strategy);
+    if (!qm_compress_prepare(level, strategy)) return false;
+
+    /* A bound tied to the stream settings, the whole message fits at once */
+    bound = deflateBound(strm, len);
+    if (bound > qm_deflate.size)
+    {
+        obuf = realloc(qm_deflate.buf, bound);
+        if (obuf == NULL)
+        {
+            LOGE("%s: allocate compress buf (%zu): out of mem.", __func__, bound);
+            return false;
+        }
+        qm_deflate.buf = obuf;
+        qm_deflate.size = bound;
+    }
+
+    strm->next_in = (Bytef *)buf;
+    strm->avail_in = len;
+    strm->next_out = qm_deflate.buf;
+    strm->avail_out = qm_deflate.size;
+
+    ret = deflate(strm, Z_FINISH);
+    if (ret != Z_STREAM_END)
+    {
+        LOGE("%s: compression error %d", __func__, ret);
+        return false;
+    }
+
+    *out = qm_deflate.buf;
+    *out_len = strm->total_out;
+
+    LOGD("%s: uncompressed: %zu compressed: %zu level: %d strategy: %d",
+         __func__, len, *out_len, level, strategy);
+
+    return true;
+}
+
+
+/**
+ * @brief releases the deflate stream, its buffer and the settings
+ */
+void
+qm_compress_fini(void)
+{
+    if (qm_deflate.initialized) deflateEnd(&qm_deflate.strm);
+    free(qm_deflate.buf);
+    memset(&qm_deflate, 0, sizeof(qm_deflate));
+
+    qm_compress_clear_config();
+}
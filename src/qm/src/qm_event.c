@@ -27,6 +27,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -42,18 +43,27 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 static int g_qm_sock = -1;
 static ev_io g_qm_sock_ev;
 
+/*
+ * Requests are parsed in place in a refcounted receive block, queue items
+ * reference their topic and data in the block instead of copying them.
+ * Reads scatter into the free end of the block and a spare block, the
+ * spare becomes the receive block once the current one is full.
+ */
 typedef struct qm_async_ctx
 {
     int fd;
     ev_io io;
-    void *buf;
-    int allocated;
-    int size;
+    qm_rx_block_t *block;   // receive block
+    size_t start;           // first byte not parsed yet
+    size_t end;             // end of the received bytes
+    qm_rx_block_t *spare;   // receives the bytes not fitting in block
     bool used;
 } qm_async_ctx_t;
 
 #define QM_MAX_CTX 20
 #define QM_BUF_CHUNK (64*1024)
+#define QM_BUF_MIN_READ (16*1024)
+#define QM_REQ_MAX_SIZE (16*1024*1024)
 
 qm_async_ctx_t g_qm_async[QM_MAX_CTX];
 
@@ -122,21 +132,118 @@ int qm_ctx_idx(qm_async_ctx_t *ctx)
 
 void qm_ctx_freebuf(qm_async_ctx_t *ctx)
 {
-    if (ctx->buf) free(ctx->buf);
-    ctx->buf = NULL;
-    ctx->allocated = 0;
-    ctx->size = 0;
+    qm_rx_block_unref(ctx->block);
+    qm_rx_block_unref(ctx->spare);
+    ctx->block = NULL;
+    ctx->spare = NULL;
+    ctx->start = 0;
+    ctx->end = 0;
 }
 
-void qm_ctx_shift_buf(qm_async_ctx_t *ctx, int size)
+// size of the request starting at ctx->start, as far as known
+// 0 if the request header is malformed
+size_t qm_ctx_req_size(qm_async_ctx_t *ctx)
 {
-    assert(size <= ctx->size);
-    ctx->size -= size;
-    if (ctx->size == 0) {
-        qm_ctx_freebuf(ctx);
-    } else {
-        memmove(ctx->buf, ctx->buf + size, ctx->size);
+    qm_request_t req;
+    size_t size;
+    if (ctx->end - ctx->start < sizeof(req)) return sizeof(req);
+    memcpy(&req, ctx->block->data + ctx->start, sizeof(req));
+    if (memcmp(req.tag, QM_REQUEST_TAG, sizeof(req.tag)) != 0) {
+        LOG(ERR, "%s: invalid request tag", __FUNCTION__);
+        return 0;
+    }
+    size = sizeof(req) + (size_t)req.topic_len + req.data_size;
+    if (size > QM_REQ_MAX_SIZE) {
+        LOG(ERR, "%s: request too large t:%u d:%u", __FUNCTION__, req.topic_len, req.data_size);
+        return 0;
+    }
+    return size;
+}
+
+// move the unparsed bytes, followed by extra bytes, to a new block
+bool qm_ctx_rebase(qm_async_ctx_t *ctx, size_t size, void *extra, size_t extra_len)
+{
+    size_t len = ctx->end - ctx->start;
+    qm_rx_block_t *block;
+
+    block = qm_rx_block_new(size);
+    if (!block) return false;
+    if (len) memcpy(block->data, ctx->block->data + ctx->start, len);
+    if (extra_len) memcpy(block->data + len, extra, extra_len);
+    qm_rx_block_unref(ctx->block);
+    ctx->block = block;
+    ctx->start = 0;
+    ctx->end = len + extra_len;
+    return true;
+}
+
+// make room in the receive block for the rest of the pending request
+bool qm_ctx_reserve(qm_async_ctx_t *ctx)
+{
+    size_t len = ctx->end - ctx->start;
+    size_t room;
+
+    room = qm_ctx_req_size(ctx);
+    if (room == 0) return false;
+    if (room < len + QM_BUF_MIN_READ) room = len + QM_BUF_MIN_READ;
+
+    if (!ctx->spare) {
+        ctx->spare = qm_rx_block_new(QM_BUF_CHUNK);
+        if (!ctx->spare) return false;
+    }
+    if (ctx->block) {
+        if (ctx->block->size - ctx->start >= room) return true;
+        if (len == 0 && ctx->block->refcount == 1 && ctx->block->size >= room) {
+            // no queued item references the block, reuse it
+            ctx->start = ctx->end = 0;
+            return true;
+        }
+    }
+    // the pending request can not complete in the block
+    return qm_ctx_rebase(ctx, room > QM_BUF_CHUNK ? room : QM_BUF_CHUNK, NULL, 0);
+}
+
+// parse one request in place
+bool qm_ctx_parse_req(qm_async_ctx_t *ctx, qm_item_t *qi, bool *complete)
+{
+    uint8_t *p = ctx->block->data + ctx->start;
+    qm_request_t *req = &qi->req;
+    size_t size;
+
+    *complete = false;
+    size = qm_ctx_req_size(ctx);
+    if (size == 0) return false;
+    if (ctx->end - ctx->start < size) {
+        LOG(TRACE, "%s: incomplete %zu/%zu", __FUNCTION__, ctx->end - ctx->start, size);
+        return true;
     }
+    memcpy(req, p, sizeof(*req));
+    p += sizeof(*req);
+
+    qi->block = ctx->block;
+    ctx->block->refcount++;
+    if (req->topic_len) {
+        if (p[req->topic_len - 1] == 0) {
+            qi->topic = (char *)p;
+        } else {
+            // not nul terminated, copy
+            qi->topic = calloc(req->topic_len + 1, 1);
+            if (!qi->topic) {
+                LOG(ERR, "%s: alloc %u", __FUNCTION__, req->topic_len);
+                return false;
+            }
+            memcpy(qi->topic, p, req->topic_len);
+        }
+        p += req->topic_len;
+    }
+    if (req->data_size) qi->buf = p;
+    ctx->start += size;
+
+    LOG(TRACE, "%s: complete from:%s c:%d to:%s dt:%d ds:%d b:%zu", __FUNCTION__,
+            req->sender, req->cmd, qi->topic ? qi->topic : "null",
+            req->data_type, req->data_size, size);
+    *complete = true;
+    return true;
 }
 
 void qm_ctx_release(qm_async_ctx_t *ctx)
@@ -154,7 +261,6 @@ bool qm_async_handle_req(qm_async_ctx_t *ctx)
     qm_item_t *qi = NULL;
     bool ret = false;
     bool complete;
-    int size;
 
     LOG(TRACE, "%s", __FUNCTION__);
 
@@ -163,11 +269,8 @@ bool qm_async_handle_req(qm_async_ctx_t *ctx)
         qi = calloc(sizeof(*qi), 1);
         if (!qi) return false;
 
-        ret = qm_conn_parse_req(ctx->buf, ctx->size, &qi->req, &qi->topic, &qi->buf, &complete);
+        ret = qm_ctx_parse_req(ctx, qi, &complete);
         if (ret && complete) {
-            // shift consumed data in ctx buf
-            size = sizeof(qi->req) + qi->req.topic_len + qi->req.data_size;
-            qm_ctx_shift_buf(ctx, size);
             // enqueue
             qi->size = qi->req.data_size;
             qm_enqueue_and_reply(ctx->fd, qi);
@@ -183,38 +286,60 @@ void qm_async_callback(struct ev_loop *ev, struct ev_io *io, int event)
 {
     qm_async_ctx_t *ctx = io->data;
     int i = qm_ctx_idx(ctx);
-    int free = ctx->allocated - ctx->size;
-    int ret;
-    int new_size;
-    void *new_buf;
+    struct iovec iov[2];
+    size_t spilled;
+    size_t size;
+    ssize_t ret;
     bool result;
 
     if (!(event & EV_READ)) return;
 
-    if (free < QM_BUF_CHUNK) {
-        new_size = ctx->allocated + QM_BUF_CHUNK;
-        new_buf = realloc(ctx->buf, new_size);
-        if (!new_buf) {
-            LOG(ERR, "%s alloc %d", __FUNCTION__, new_size);
-            goto release;
-        }
-        ctx->buf = new_buf;
-        ctx->allocated = new_size;
-    }
-    free = ctx->allocated - ctx->size;
+    if (!qm_ctx_reserve(ctx)) goto release;
+
+    iov[0].iov_base = ctx->block->data + ctx->end;
+    iov[0].iov_len = ctx->block->size - ctx->end;
+    iov[1].iov_base = ctx->spare->data;
+    iov[1].iov_len = ctx->spare->size;
 
-    ret = read(ctx->fd, ctx->buf + ctx->size, free);
+    ret = readv(ctx->fd, iov, 2);
     if (ret < 0) {
-        LOG(ERR, "%s read %d %d %d", __FUNCTION__, ctx->size, ret, errno);
+        LOG(ERR, "%s read %zu %zd %d", __FUNCTION__, ctx->end - ctx->start, ret, errno);
         goto release;
     }
-    ctx->size += ret;
-    LOG(TRACE, "%s ctx:%d fd:%d t:%d r:%d", __FUNCTION__, i, ctx->fd, ctx->size, ret);
+    LOG(TRACE, "%s ctx:%d fd:%d t:%zu r:%zd", __FUNCTION__, i, ctx->fd,
+            ctx->end - ctx->start + ret, ret);
     if (ret == 0) {
         // EOF
         goto release;
     }
 
+    spilled = 0;
+    if ((size_t)ret > iov[0].iov_len) {
+        spilled = ret - iov[0].iov_len;
+        ret = iov[0].iov_len;
+    }
+    ctx->end += ret;
+
+    result = qm_async_handle_req(ctx);
+    if (!result) goto release;
+    if (spilled == 0) return;
+
+    if (ctx->start == ctx->end) {
+        // the spare block starts with a new request
+        qm_rx_block_unref(ctx->block);
+        ctx->block = ctx->spare;
+        ctx->spare = NULL;
+        ctx->start = 0;
+        ctx->end = spilled;
+    } else {
+        // a request spans both blocks, join its bytes
+        size = qm_ctx_req_size(ctx);
+        if (size == 0) goto release;
+        if (size < ctx->end - ctx->start + spilled) size = ctx->end - ctx->start + spilled;
+        if (size < QM_BUF_CHUNK) size = QM_BUF_CHUNK;
+        if (!qm_ctx_rebase(ctx, size, ctx->spare->data, spilled)) goto release;
+    }
+
     result = qm_async_handle_req(ctx);
     if (result) {
         // no error
@@ -108,6 +108,8 @@ int main(int argc, char ** argv)
     // exit:
 
     qm_mqtt_stop();
+    qm_compress_fini();
+    qm_spill_fini();
 
     target_close(TARGET_INIT_MGR_QM, loop);
 
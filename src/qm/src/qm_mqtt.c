@@ -26,7 +26,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <limits.h>
 #include <stdio.h>
-#include <zlib.h>
 
 #include "os_time.h"
 #include "os_nif.h"
@@ -36,7 +35,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "osp_unit.h"
 #include "log.h"
 #include "ds_dlist.h"
-#include "opensync_stats.pb-c.h"
 
 #include "qm.h"
 
@@ -49,12 +47,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define STATS_MQTT_INTERVAL     60  /* Report interval in seconds */
 #define STATS_MQTT_RECONNECT    60  /* Reconnect interval -- seconds */
 #define QM_LOG_TOPIC_PREFIX     "log"
+#define QM_SPILL_INTERVAL       1   /* Spill replay and sync interval -- seconds */
 
 /* Global MQTT instance */
 static mosqev_t         qm_mqtt;
 static bool             qm_mosquitto_init = false;
 static bool             qm_mosqev_init = false;
 static struct ev_timer  qm_mqtt_timer;
+static struct ev_timer  qm_mqtt_timer_spill;
 #ifdef CONFIG_LOG_REMOTE
 static struct ev_timer  qm_mqtt_timer_log;
 #endif
@@ -64,6 +64,8 @@ static char             qm_mqtt_topic[HOST_NAME_MAX];
 static int              qm_mqtt_port = STATS_MQTT_PORT;
 static int              qm_mqtt_qos = STATS_MQTT_QOS;
 static uint8_t          qm_mqtt_compress = 0;
+static bool             qm_mqtt_compress_enqueue = false;
+static int              qm_mqtt_spill_rate = QM_SPILL_DEFAULT_RATE;
 static char             qm_log_topic[128];
 static int              qm_log_interval = 0; // 0 = disabled
 bool                    qm_log_enabled = false;
@@ -163,6 +165,7 @@ bool qm_mqtt_config_valid(void)
 void qm_mqtt_stop(void)
 {
     ev_timer_stop(EV_DEFAULT, &qm_mqtt_timer);
+    ev_timer_stop(EV_DEFAULT, &qm_mqtt_timer_spill);
 
     if (qm_mosqev_init) mosqev_del(&qm_mqtt);
     if (qm_mosquitto_init) mosquitto_lib_cleanup();
@@ -172,61 +175,86 @@ void qm_mqtt_stop(void)
     LOG(NOTICE, "Closing MQTT connection.");
 }
 
+// resolve the topic of a message
+static char *qm_mqtt_item_topic(qm_item_t *qi)
+{
+    // override default topic
+    if (qi->topic && *qi->topic) return qi->topic;
+    return qm_mqtt_topic;
+}
+
+// resolve whether a message is compressed
+static bool qm_mqtt_item_do_compress(qm_item_t *qi)
+{
+    // override default compression
+    switch (qi->req.compress) {
+        default:
+        case QM_REQ_COMPRESS_IF_CFG:  return qm_mqtt_compress;
+        case QM_REQ_COMPRESS_DISABLE: return false;
+        case QM_REQ_COMPRESS_FORCE:   return true;
+    }
+}
+
+void qm_mqtt_set_compress_on_enqueue(bool enable)
+{
+    qm_mqtt_compress_enqueue = enable;
+}
+
+// compress a message once when queued rather than on every publish attempt
+bool qm_mqtt_compress_item(qm_item_t *qi)
+{
+    void *zbuf;
+    size_t zlen;
+    void *buf;
+
+    if (!qm_mqtt_compress_enqueue || qi->compressed) return true;
+    // stats reports are merged before being published
+    if (qi->req.data_type == QM_DATA_STATS) return true;
+    if (!qm_mqtt_item_do_compress(qi)) return true;
+
+    if (!qm_compress(qm_mqtt_item_topic(qi), qi->buf, qi->size, &zbuf, &zlen)) {
+        return false;
+    }
+    buf = malloc(zlen);
+    if (!buf) {
+        LOGE("DPP: allocate compressed message (%zu): out of mem.", zlen);
+        return false;
+    }
+    memcpy(buf, zbuf, zlen);
+    if (!qm_rx_block_holds(qi->block, qi->buf)) free(qi->buf);
+    qi->buf = buf;
+    qi->size = zlen;
+    qi->compressed = true;
+    return true;
+}
+
 bool qm_mqtt_publish(mosqev_t *mqtt, qm_item_t *qi)
 {
-    long mlen = qi->size;
+    size_t mlen = qi->size;
     void *mbuf = qi->buf;
-    char *topic = qm_mqtt_topic;
+    char *topic = qm_mqtt_item_topic(qi);
     int qos = qm_mqtt_qos;
-    bool do_compress = qm_mqtt_compress;
     if (!mqtt) mqtt = &qm_mqtt;
 
-    // override default topic
-    if (qi->topic && *qi->topic) topic = qi->topic;
-
     // override default qos
     if (qi->req.set_qos) qos = qi->req.qos_val;
 
-    // override default compression
-    switch (qi->req.compress) {
-        default:
-        case QM_REQ_COMPRESS_IF_CFG:  do_compress = qm_mqtt_compress; break;
-        case QM_REQ_COMPRESS_DISABLE: do_compress = false; break;
-        case QM_REQ_COMPRESS_FORCE:   do_compress = true; break;
-    }
-    unsigned char *buf = NULL;
-    int ret;
-    if (do_compress)
+    if (!qi->compressed && qm_mqtt_item_do_compress(qi))
     {
         /*
-         * cppcheck detects the code below as a memory leak.
-         * mosqev_publish() will ultimately copy the data to its own buffers.
+         * The compressed message lives in the deflate buffer until the
+         * next compression, mosqev_publish() copies it to its own buffers.
          */
-        long len;
-        len = compressBound(mlen);
-        // allocate 1/4 more than needed
-        len += len / 4;
-        buf = malloc(len);
-        if (!buf) {
-            LOGE("DPP: allocate compress buf (%lu): out of mem.", len);
+        size_t len;
+        if (!qm_compress(topic, qi->buf, qi->size, &mbuf, &len)) {
             return false;
         }
-        ret = compress(buf, (unsigned long*)&len, mbuf, mlen);
-        if (ret != Z_OK)
-        {
-            LOGE("DPP: compression error %d", ret);
-            goto exit;
-        }
-        LOGD("DPP: Publishing uncompressed: %ld compressed: %ld reduction: %d%%",
-                    mlen, len, (int)(100 - 100 * len / mlen));
+        LOGD("DPP: Publishing uncompressed: %zu compressed: %zu reduction: %d%%",
+                    mlen, len, mlen ? (int)(100 - 100 * len / mlen) : 0);
         mlen = len;
-        mbuf = buf;
     }
-    LOGI("MQTT: Publishing %ld bytes", mlen);
-    ret = mosqev_publish(mqtt, NULL, topic, mlen, mbuf, qos, false);
-exit:
-    if (buf) free(buf);
-    return ret;
+    LOGI("MQTT: Publishing %zu bytes", mlen);
+    return mosqev_publish(mqtt, NULL, topic, mlen, mbuf, qos, false);
 }
 
 bool qm_mqtt_send_message(qm_item_t *qi, qm_response_t *res)
@@ -244,96 +272,26 @@ bool qm_mqtt_send_message(qm_item_t *qi, qm_response_t *res)
     return result;
 }
 
-void qm_append_report(qm_item_t *qi, qm_item_t *rep)
-{
-    Sts__Report *rqi = NULL;
-    Sts__Report *rpt = NULL;
-    int          num;
-
-    // have stats, unpack
-    rqi = sts__report__unpack(NULL, qi->size, qi->buf);
-    if (!rqi) {
-        // decode failed
-        goto out;
-    }
-
-    // first reprot
-    if (rep->size == 0) {
-        rpt = rqi;
-        rqi = NULL;
-
-        goto first;
-    }
-
-    rpt = sts__report__unpack(NULL, rep->size, rep->buf);
-    if (!rpt) {
-        goto out;
-    }
-
-#define APPEND(_name, _type) do {\
-        num = rpt->n_##_name;  \
-        rpt->n_##_name += rqi->n_##_name; \
-        rpt->_name = \
-            realloc(rpt->_name, \
-                    rpt->n_##_name * sizeof(Sts__##_type*)); \
-        memcpy (&rpt->_name[num], \
-                rqi->_name, \
-                rqi->n_##_name * sizeof(Sts__##_type*)); \
-        memset(rqi->_name, \
-               0, \
-               rqi->n_##_name * sizeof(Sts__##_type*)); \
-    } while (0)
-
-    // append messages
-    if (rqi->survey) {
-        APPEND(survey, Survey);
-    }
-    if (rqi->neighbors) {
-        APPEND(neighbors, Neighbor);
-    }
-    if (rqi->capacity) {
-        APPEND(capacity, Capacity);
-    }
-    if (rqi->clients) {
-        APPEND(clients, ClientReport);
-    }
-    if (rqi->device) {
-        APPEND(device, Device);
-    }
-    if (rqi->rssi_report) {
-        APPEND(rssi_report, RssiReport);
-    }
-    if (rqi->bs_report) {
-        APPEND(bs_report, BSReport);
-    }
-#undef APPEND
-
-first:
-    {
-        // pack new message
-        int size = sts__report__get_packed_size(rpt);
-        void *buf = malloc(size);
-        if (!buf) goto out;
-        size = sts__report__pack(rpt, buf);
-        LOGI("merged reports stats %zd + %zd = %d", rep->size, qi->size, size);
-
-        // replace message
-        if(rep->buf) free(rep->buf);
-        rep->buf = buf;
-        rep->size = size;
-    }
-
-out:
-    // cleanup
-    if (rpt) sts__report__free_unpacked(rpt, NULL);
-    if (rqi) sts__report__free_unpacked(rqi, NULL);
-}
-
 // merge STATS to a single report
 void qm_queue_merge_stats(qm_item_t *rep)
 {
+    qm_report_merge_t merge;
     qm_item_t *qi = NULL;
     qm_item_t *next = NULL;
+    size_t size = 0;
+    int count = 0;
+
+    // size the merged report once, the nodeIDs but one get dropped
+    ds_dlist_foreach(&g_qm_queue.queue, qi)
+    {
+        if (qi->req.data_type == QM_DATA_STATS) size += qi->size;
+    }
+    if (size == 0) return;
+
+    if (!qm_report_merge_init(&merge, size)) {
+        LOGE("merge reports: allocate %zu bytes: out of mem.", size);
+        return;
+    }
 
     for (qi = ds_dlist_head(&g_qm_queue.queue); qi != NULL; qi = next)
     {
@@ -341,10 +299,19 @@ void qm_queue_merge_stats(qm_item_t *rep)
         //LOGT("t:%d s:%d\n", qi->req.data_type, (int)qi->size);
         if (qi->req.data_type == QM_DATA_STATS)
         {
-            qm_append_report(qi, rep);
+            if (qm_report_merge_append(&merge, qi->buf, qi->size)) count++;
             qm_queue_remove(qi);
         }
     }
+
+    if (merge.len == 0) {
+        qm_report_merge_free(&merge);
+        return;
+    }
+
+    LOGI("merged %d reports stats: %zu bytes", count, merge.len);
+    rep->buf = merge.buf;
+    rep->size = merge.len;
 }
 
 void qm_mqtt_publish_queue()
@@ -446,6 +413,38 @@ void qm_mqtt_timer_handler(struct ev_loop *loop, ev_timer *timer, int revents)
     qm_mqtt_send_queue();
 }
 
+void qm_mqtt_set_spill_replay_rate(int rate)
+{
+    qm_mqtt_spill_rate = rate;
+}
+
+// replay spilled messages at a bounded rate once connected
+void qm_mqtt_timer_handler_spill(struct ev_loop *loop, ev_timer *timer, int revents)
+{
+    (void)loop;
+    (void)timer;
+    (void)revents;
+    qm_item_t qi;
+    bool result;
+    int count;
+
+    qm_spill_sync();
+    if (!qm_spill_count() || !qm_mqtt_is_connected()) return;
+
+    for (count = 0; count < qm_mqtt_spill_rate; count++)
+    {
+        if (!qm_spill_peek(&qi)) break;
+        result = qm_mqtt_publish(&qm_mqtt, &qi);
+        qm_queue_item_free_buf(&qi);
+        if (!result) {
+            LOGE("Publish spilled message failed.\n");
+            break;
+        }
+        qm_spill_pop();
+    }
+    LOGD("replayed %d spilled messages, %zu left", count, qm_spill_count());
+}
+
 void qm_mqtt_timer_handler_log(struct ev_loop *loop, ev_timer *timer, int revents)
 {
     (void)loop;
@@ -546,6 +545,11 @@ bool qm_mqtt_init(void)
     qm_mqtt_timer.data = &qm_mqtt;
     ev_timer_start(EV_DEFAULT, &qm_mqtt_timer);
 
+    // spill replay timer
+    ev_timer_init(&qm_mqtt_timer_spill, qm_mqtt_timer_handler_spill,
+            QM_SPILL_INTERVAL, QM_SPILL_INTERVAL);
+    ev_timer_start(EV_DEFAULT, &qm_mqtt_timer_spill);
+
     // log publish timer
     qm_mqtt_set_log_interval(qm_log_interval);
 
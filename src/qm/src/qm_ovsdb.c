@@ -63,11 +63,18 @@ void callback_AWLAN_Node(ovsdb_update_monitor_t *mon,
     const char  *mqtt_qos = NULL;
     const char  *mqtt_port = NULL;
     int         mqtt_compress = 0;
+    bool        compress_enqueue = false;
     int         log_interval = 0;
+    const char *spill_dir = NULL;
+    size_t      spill_size = 0;
+    int         spill_rate = QM_SPILL_DEFAULT_RATE;
 
     LOG(DEBUG, "%s %d %d", __FUNCTION__, mon->mon_type,
             awlan ? awlan->mqtt_settings_len : 0);
 
+    // Compression settings are parsed from scratch
+    qm_compress_clear_config();
+
     // Apply MQTT settings
     if (mon->mon_type != OVSDB_UPDATE_DEL) {
         // parse map of mqtt settings
@@ -97,6 +104,41 @@ void callback_AWLAN_Node(ovsdb_update_monitor_t *mon,
             {
                 if (strcmp(val, "zlib") == 0) mqtt_compress = 1;
             }
+            else if (strcmp(key, "compress_level") == 0)
+            {
+                qm_compress_set_level(NULL, val);
+            }
+            else if (strncmp(key, "compress_level:", strlen("compress_level:")) == 0)
+            {
+                // per topic override, ie. compress_level:<topic>
+                qm_compress_set_level(key + strlen("compress_level:"), val);
+            }
+            else if (strcmp(key, "compress_strategy") == 0)
+            {
+                qm_compress_set_strategy(NULL, val);
+            }
+            else if (strncmp(key, "compress_strategy:", strlen("compress_strategy:")) == 0)
+            {
+                // per topic override, ie. compress_strategy:<topic>
+                qm_compress_set_strategy(key + strlen("compress_strategy:"), val);
+            }
+            else if (strcmp(key, "compress_on_enqueue") == 0)
+            {
+                compress_enqueue = (strcmp(val, "true") == 0);
+            }
+            else if (strcmp(key, "spill_dir") == 0)
+            {
+                spill_dir = val;
+            }
+            else if (strcmp(key, "spill_size") == 0)
+            {
+                spill_size = strtoul(val, NULL, 10);
+            }
+            else if (strcmp(key, "spill_replay_rate") == 0)
+            {
+                spill_rate = atoi(val);
+                if (spill_rate <= 0) spill_rate = QM_SPILL_DEFAULT_RATE;
+            }
             else if (strcmp(key, "remote_log") == 0)
             {
                 log_interval = atoi(val);
@@ -111,6 +153,9 @@ void callback_AWLAN_Node(ovsdb_update_monitor_t *mon,
 
     qm_mqtt_set(mqtt_broker, mqtt_port, mqtt_topic, mqtt_qos, mqtt_compress);
     qm_mqtt_set_log_interval(log_interval);
+    qm_mqtt_set_compress_on_enqueue(compress_enqueue);
+    qm_spill_set_config(spill_dir, spill_size);
+    qm_mqtt_set_spill_replay_rate(spill_rate);
 }
 
 
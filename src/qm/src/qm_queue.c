@@ -38,18 +38,73 @@ char *g_qm_log_buf = NULL;
 int g_qm_log_buf_size = 0;
 int g_qm_log_drop_count = 0; // number of dropped lines
 
+qm_rx_block_t *qm_rx_block_new(size_t size)
+{
+    qm_rx_block_t *block = malloc(sizeof(*block) + size);
+    if (!block) {
+        LOG(ERR, "%s: alloc %zu", __FUNCTION__, size);
+        return NULL;
+    }
+    block->refcount = 1;
+    block->size = size;
+    return block;
+}
+
+void qm_rx_block_unref(qm_rx_block_t *block)
+{
+    if (block && --block->refcount == 0) free(block);
+}
+
+bool qm_rx_block_holds(qm_rx_block_t *block, const void *ptr)
+{
+    const uint8_t *p = ptr;
+    return block && p >= block->data && p < block->data + block->size;
+}
+
+// copy topic and buf out of the receive block, so that a small
+// message queued for long does not hold a whole block
+bool qm_queue_item_detach(qm_item_t *qi)
+{
+    char *topic = qi->topic;
+    void *buf = qi->buf;
+
+    if (!qi->block) return true;
+
+    if (qm_rx_block_holds(qi->block, qi->topic)) {
+        topic = strdup(qi->topic);
+        if (!topic) goto alloc_err;
+    }
+    if (qm_rx_block_holds(qi->block, qi->buf)) {
+        buf = malloc(qi->size);
+        if (!buf) goto alloc_err;
+        memcpy(buf, qi->buf, qi->size);
+    }
+    qi->topic = topic;
+    qi->buf = buf;
+    qm_rx_block_unref(qi->block);
+    qi->block = NULL;
+    return true;
+
+alloc_err:
+    LOG(ERR, "%s: alloc %zu", __FUNCTION__, qi->size);
+    if (topic != qi->topic) free(topic);
+    return false;
+}
+
 void qm_queue_item_free_buf(qm_item_t *qi)
 {
     if (qi) {
         // cleanup
         if (qi->topic) {
-            free(qi->topic);
+            if (!qm_rx_block_holds(qi->block, qi->topic)) free(qi->topic);
             qi->topic = NULL;
         }
         if (qi->buf) {
-            free(qi->buf);
+            if (!qm_rx_block_holds(qi->block, qi->buf)) free(qi->buf);
             qi->buf = NULL;
         }
+        qm_rx_block_unref(qi->block);
+        qi->block = NULL;
     }
 }
 
@@ -107,6 +162,16 @@ bool qm_queue_drop_head()
     return qm_queue_remove(qitem);
 }
 
+// move the oldest message to the spill log, if configured
+bool qm_queue_spill_head()
+{
+    qm_item_t *qitem;
+    if (!qm_spill_enabled()) return false;
+    if (!qm_queue_head(&qitem)) return false;
+    if (!qm_spill_put(qitem)) return false;
+    return qm_queue_remove(qitem);
+}
+
 bool qm_queue_make_room(qm_item_t *qi, qm_response_t *res)
 {
     if (qi->size > QM_MAX_QUEUE_SIZE_BYTES) {
@@ -116,6 +181,7 @@ bool qm_queue_make_room(qm_item_t *qi, qm_response_t *res)
     while (g_qm_queue.length >= QM_MAX_QUEUE_DEPTH
             || g_qm_queue.size + qi->size > QM_MAX_QUEUE_SIZE_BYTES)
     {
+        if (qm_queue_spill_head()) continue;
         qm_queue_drop_head();
         res->qdrop++;
     }
@@ -127,6 +193,14 @@ bool qm_queue_append_item(qm_item_t **qitem, qm_response_t *res)
     qm_item_t *qi = *qitem;
     qi->size = qi->req.data_size;
     qi->timestamp = time_monotonic();
+    if (!qm_mqtt_compress_item(qi)) {
+        LOGW("Queueing message uncompressed.");
+    }
+    // large messages keep referencing the receive block
+    if (qi->block && (!qm_rx_block_holds(qi->block, qi->buf)
+                || qi->size * 4 < qi->block->size)) {
+        if (!qm_queue_item_detach(qi)) return false;
+    }
     if (!qm_queue_make_room(qi, res)) {
         return false;
     }
@@ -0,0 +1,239 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "qm.h"
+
+/*
+ * Stats reports are merged on the protobuf wire format.
+ *
+ * A Sts__Report carries the nodeID (field 1) and repeated sub-messages.
+ * Decoders append the occurrences of a repeated field in the order they
+ * are met, whatever other fields sit in between. Concatenating the
+ * encoded fields of several reports, keeping a single nodeID, decodes as
+ * the report whose repeated fields are the concatenation of the reports'.
+ */
+
+#define QM_PB_WIRE_VARINT  0
+#define QM_PB_WIRE_FIXED64 1
+#define QM_PB_WIRE_LEN     2
+#define QM_PB_WIRE_FIXED32 5
+
+#define QM_REPORT_NODEID_FIELD 1
+
+
+/**
+ * @brief reads a protobuf varint
+ *
+ * @param pos the read position, moved past the varint
+ * @param end the end of the buffer
+ * @param val the decoded value
+ * @return true if a varint was read, false otherwise
+ */
+static bool
+qm_pb_read_varint(const uint8_t **pos, const uint8_t *end, uint64_t *val)
+{
+    unsigned int shift;
+    uint8_t byte;
+
+    *val = 0;
+    for (shift = 0; shift < 64 && *pos < end; shift += 7)
+    {
+        byte = *(*pos)++;
+        *val |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief moves past the value of a protobuf field
+ *
+ * @param pos the read position, pointing to the field value
+ * @param end the end of the buffer
+ * @param wire_type the field's wire type
+ * @return true if the value was skipped, false if malformed
+ */
+static bool
+qm_pb_skip_value(const uint8_t **pos, const uint8_t *end, int wire_type)
+{
+    uint64_t len;
+    bool ret;
+
+    switch (wire_type)
+    {
+        case QM_PB_WIRE_VARINT:
+            return qm_pb_read_varint(pos, end, &len);
+
+        case QM_PB_WIRE_FIXED64:
+            len = 8;
+            break;
+
+        case QM_PB_WIRE_LEN:
+            ret = qm_pb_read_varint(pos, end, &len);
+            if (!ret) return false;
+            break;
+
+        case QM_PB_WIRE_FIXED32:
+            len = 4;
+            break;
+
+        default:
+            /* Groups are deprecated, never emitted for a report */
+            return false;
+    }
+
+    if (len > (uint64_t)(end - *pos)) return false;
+    *pos += len;
+
+    return true;
+}
+
+
+/**
+ * @brief makes room for more bytes in a merged report
+ *
+ * @param merge the merged report
+ * @param len the number of bytes to append
+ * @return true if success, false otherwise
+ */
+static bool
+qm_report_merge_reserve(qm_report_merge_t *merge, size_t len)
+{
+    uint8_t *buf;
+    size_t size;
+
+    if (merge->len + len <= merge->size) return true;
+
+    size = (merge->size ? merge->size : len);
+    while (size < merge->len + len) size *= 2;
+
+    buf = realloc(merge->buf, size);
+    if (buf == NULL) return false;
+
+    merge->buf = buf;
+    merge->size = size;
+
+    return true;
+}
+
+
+/**
+ * @brief prepares a merged report
+ *
+ * @param merge the merged report
+ * @param size the expected merged size, 0 to allocate on first append
+ * @return true if success, false otherwise
+ */
+bool
+qm_report_merge_init(qm_report_merge_t *merge, size_t size)
+{
+    memset(merge, 0, sizeof(*merge));
+    if (size == 0) return true;
+
+    return qm_report_merge_reserve(merge, size);
+}
+
+
+/**
+ * @brief appends an encoded report to a merged report
+ *
+ * The nodeID of the first report is kept, the following are skipped.
+ * A malformed report leaves the merged report untouched.
+ * @param merge the merged report
+ * @param buf the encoded report
+ * @param len the encoded report length
+ * @return true if the report was appended, false otherwise
+ */
+bool
+qm_report_merge_append(qm_report_merge_t *merge, const void *buf, size_t len)
+{
+    const uint8_t *field;
+    const uint8_t *end;
+    const uint8_t *pos;
+    bool has_nodeid;
+    size_t flen;
+    uint64_t key;
+    size_t saved;
+    bool ret;
+
+    ret = qm_report_merge_reserve(merge, len);
+    if (!ret) return false;
+
+    saved = merge->len;
+    has_nodeid = merge->has_nodeid;
+
+    pos = buf;
+    end = pos + len;
+    while (pos < end)
+    {
+        field = pos;
+        ret = qm_pb_read_varint(&pos, end, &key);
+        if (!ret) goto err_rollback;
+
+        ret = qm_pb_skip_value(&pos, end, (int)(key & 0x7));
+        if (!ret) goto err_rollback;
+
+        if ((key >> 3) == QM_REPORT_NODEID_FIELD)
+        {
+            if (merge->has_nodeid) continue;
+            merge->has_nodeid = true;
+        }
+
+        flen = pos - field;
+        memcpy(merge->buf + merge->len, field, flen);
+        merge->len += flen;
+    }
+
+    return true;
+
+err_rollback:
+    LOGE("%s: malformed report of %zu bytes", __func__, len);
+    merge->len = saved;
+    merge->has_nodeid = has_nodeid;
+
+    return false;
+}
+
+
+/**
+ * @brief releases a merged report
+ *
+ * @param merge the merged report
+ */
+void
+qm_report_merge_free(qm_report_merge_t *merge)
+{
+    free(merge->buf);
+    memset(merge, 0, sizeof(*merge));
+}
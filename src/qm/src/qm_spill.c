@@ -0,0 +1,681 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+#include "log.h"
+#include "ds_dlist.h"
+#include "os_time.h"
+#include "qm.h"
+
+/*
+ * Spill log: the messages pushed out of the full queue are appended to
+ * segment files in a configured directory instead of being dropped, and
+ * are replayed, oldest first, once the broker is reachable again.
+ *
+ * Segments are named QM_SPILL_PREFIX<seq> and hold records made of a
+ * header, the topic and the message. The total size is bounded, the
+ * oldest segment is deleted to make room. Writes are synced every
+ * QM_SPILL_SYNC_BYTES and on qm_spill_sync(). A segment is deleted once
+ * fully replayed; records replayed from a segment still on flash are
+ * replayed again after a restart.
+ *
+ * Monotonic timestamps don't survive a reboot: a record stores the wall
+ * clock time its message was queued at, and the message age is recomputed
+ * from it on replay. The age is approximate if the wall clock was stepped
+ * meanwhile; replay relies only on the order of the records.
+ */
+
+#define QM_SPILL_MAGIC          0x51535031  // "QSP1"
+#define QM_SPILL_PREFIX         "qm_spill."
+#define QM_SPILL_SEGMENTS       8
+#define QM_SPILL_MIN_SEGMENT    (64*1024)
+#define QM_SPILL_SYNC_BYTES     (64*1024)
+
+typedef struct qm_spill_hdr
+{
+    uint32_t magic;
+    uint32_t crc;           // crc32 of the rest of the record
+    qm_request_t req;
+    uint32_t topic_len;     // including the nul, 0 if no topic
+    uint32_t size;          // message size
+    int64_t wall_time;      // time_real() when queued
+    uint8_t compressed;
+    uint8_t reserved[7];
+} qm_spill_hdr_t;
+
+typedef struct qm_spill_seg
+{
+    uint32_t seq;
+    size_t size;            // bytes written
+    size_t count;           // records not replayed yet
+    ds_dlist_node_t node;
+} qm_spill_seg_t;
+
+static struct
+{
+    char *dir;
+    size_t max_size;
+    size_t seg_size;
+    ds_dlist_t segs;        // oldest first, the last one is appended to
+    size_t total;           // bytes in all the segments
+    size_t count;           // records not replayed yet
+    int wfd;                // last segment, opened for append
+    size_t unsynced;
+    int rfd;                // first segment, opened for replay
+    size_t roff;            // first record not replayed
+    size_t rlen;            // length of the record returned by peek
+    uint64_t dropped;       // records lost with deleted segments
+} qm_spill =
+{
+    .wfd = -1,
+    .rfd = -1,
+};
+
+
+/**
+ * @brief builds the path of a segment
+ */
+static void
+qm_spill_seg_path(qm_spill_seg_t *seg, char *path, size_t len)
+{
+    snprintf(path, len, "%s/" QM_SPILL_PREFIX "%u", qm_spill.dir, seg->seq);
+}
+
+
+/**
+ * @brief computes the checksum of a record
+ */
+static uint32_t
+qm_spill_crc(qm_spill_hdr_t *hdr, const void *topic, const void *buf)
+{
+    size_t off = offsetof(qm_spill_hdr_t, req);
+    uLong crc;
+
+    crc = crc32(0L, (const Bytef *)hdr + off, sizeof(*hdr) - off);
+    if (hdr->topic_len) crc = crc32(crc, topic, hdr->topic_len);
+    if (hdr->size) crc = crc32(crc, buf, hdr->size);
+
+    return (uint32_t)crc;
+}
+
+
+/**
+ * @brief reads a record
+ *
+ * @param fd the segment
+ * @param off the record offset
+ * @param hdr the record header
+ * @param topic the allocated topic, NULL if no topic
+ * @param buf the allocated message, NULL if empty
+ * @return true if a valid record was read, false otherwise
+ */
+static bool
+qm_spill_read_record(int fd, size_t off, qm_spill_hdr_t *hdr, char **topic, void **buf)
+{
+    ssize_t ret;
+
+    *topic = NULL;
+    *buf = NULL;
+
+    ret = pread(fd, hdr, sizeof(*hdr), off);
+    if (ret != (ssize_t)sizeof(*hdr)) return false;
+    if (hdr->magic != QM_SPILL_MAGIC) return false;
+    if (hdr->topic_len + (size_t)hdr->size > QM_MAX_QUEUE_SIZE_BYTES) return false;
+    off += sizeof(*hdr);
+
+    if (hdr->topic_len)
+    {
+        *topic = malloc(hdr->topic_len);
+        if (*topic == NULL) goto err_read;
+        ret = pread(fd, *topic, hdr->topic_len, off);
+        if (ret != (ssize_t)hdr->topic_len) goto err_read;
+        if ((*topic)[hdr->topic_len - 1] != '\0') goto err_read;
+        off += hdr->topic_len;
+    }
+
+    if (hdr->size)
+    {
+        *buf = malloc(hdr->size);
+        if (*buf == NULL) goto err_read;
+        ret = pread(fd, *buf, hdr->size, off);
+        if (ret != (ssize_t)hdr->size) goto err_read;
+    }
+
+    if (qm_spill_crc(hdr, *topic, *buf) != hdr->crc) goto err_read;
+
+    return true;
+
+err_read:
+    free(*topic);
+    free(*buf);
+    *topic = NULL;
+    *buf = NULL;
+
+    return false;
+}
+
+
+/**
+ * @brief counts the valid records of a segment found at startup
+ *
+ * The segment is truncated after its last valid record.
+ * @param seg the segment
+ * @return true if the segment holds records, false otherwise
+ */
+static bool
+qm_spill_seg_load(qm_spill_seg_t *seg)
+{
+    qm_spill_hdr_t hdr;
+    char path[PATH_MAX];
+    struct stat st;
+    size_t off;
+    char *topic;
+    void *buf;
+    int fd;
+
+    qm_spill_seg_path(seg, path, sizeof(path));
+    fd = open(path, O_RDWR);
+    if (fd < 0) return false;
+
+    off = 0;
+    while (qm_spill_read_record(fd, off, &hdr, &topic, &buf))
+    {
+        free(topic);
+        free(buf);
+        off += sizeof(hdr) + hdr.topic_len + hdr.size;
+        seg->count++;
+    }
+
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size != off)
+    {
+        LOGW("%s: %s: dropping %zu bytes after the last valid record", __func__,
+             path, (size_t)st.st_size - off);
+        if (ftruncate(fd, off) != 0) LOGE("%s: truncate %s: %s", __func__, path, strerror(errno));
+    }
+    close(fd);
+
+    seg->size = off;
+    if (seg->count) return true;
+
+    unlink(path);
+    return false;
+}
+
+
+static int
+qm_spill_seq_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief loads the segments left in the spill directory
+ */
+static void
+qm_spill_load(void)
+{
+    qm_spill_seg_t *seg;
+    struct dirent *de;
+    uint32_t *seqs;
+    size_t nseqs;
+    size_t size;
+    uint32_t *p;
+    char *end;
+    DIR *dir;
+    size_t i;
+
+    dir = opendir(qm_spill.dir);
+    if (dir == NULL)
+    {
+        LOGE("%s: open %s: %s", __func__, qm_spill.dir, strerror(errno));
+        return;
+    }
+
+    seqs = NULL;
+    nseqs = 0;
+    size = 0;
+    while ((de = readdir(dir)) != NULL)
+    {
+        if (strncmp(de->d_name, QM_SPILL_PREFIX, strlen(QM_SPILL_PREFIX)) != 0) continue;
+        if (nseqs == size)
+        {
+            size = size ? 2 * size : 16;
+            p = realloc(seqs, size * sizeof(*seqs));
+            if (p == NULL) break;
+            seqs = p;
+        }
+        seqs[nseqs] = strtoul(de->d_name + strlen(QM_SPILL_PREFIX), &end, 10);
+        if (*end == '\0') nseqs++;
+    }
+    closedir(dir);
+
+    if (nseqs) qsort(seqs, nseqs, sizeof(*seqs), qm_spill_seq_cmp);
+    for (i = 0; i < nseqs; i++)
+    {
+        seg = calloc(1, sizeof(*seg));
+        if (seg == NULL) break;
+        seg->seq = seqs[i];
+        if (!qm_spill_seg_load(seg))
+        {
+            free(seg);
+            continue;
+        }
+        ds_dlist_insert_tail(&qm_spill.segs, seg);
+        qm_spill.total += seg->size;
+        qm_spill.count += seg->count;
+    }
+    free(seqs);
+
+    if (qm_spill.count)
+    {
+        LOGI("%s: %zu spilled messages (%zu bytes) to replay from %s", __func__,
+             qm_spill.count, qm_spill.total, qm_spill.dir);
+    }
+}
+
+
+/**
+ * @brief deletes the oldest segment
+ */
+static void
+qm_spill_drop_head(void)
+{
+    qm_spill_seg_t *seg;
+    char path[PATH_MAX];
+
+    seg = ds_dlist_remove_head(&qm_spill.segs);
+    if (seg == NULL) return;
+
+    if (qm_spill.rfd >= 0)
+    {
+        close(qm_spill.rfd);
+        qm_spill.rfd = -1;
+        qm_spill.roff = 0;
+        qm_spill.rlen = 0;
+    }
+    if (ds_dlist_is_empty(&qm_spill.segs) && qm_spill.wfd >= 0)
+    {
+        close(qm_spill.wfd);
+        qm_spill.wfd = -1;
+        qm_spill.unsynced = 0;
+    }
+
+    qm_spill_seg_path(seg, path, sizeof(path));
+    unlink(path);
+
+    qm_spill.total -= seg->size;
+    qm_spill.count -= seg->count;
+    qm_spill.dropped += seg->count;
+    if (seg->count) LOGW("%s: dropped %zu spilled messages", __func__, seg->count);
+    free(seg);
+}
+
+
+/**
+ * @brief closes the spill log, leaving the segments on disk
+ */
+static void
+qm_spill_close(void)
+{
+    qm_spill_seg_t *seg;
+
+    qm_spill_sync();
+    if (qm_spill.wfd >= 0) close(qm_spill.wfd);
+    if (qm_spill.rfd >= 0) close(qm_spill.rfd);
+    qm_spill.wfd = -1;
+    qm_spill.rfd = -1;
+    qm_spill.roff = 0;
+    qm_spill.rlen = 0;
+
+    while ((seg = ds_dlist_remove_head(&qm_spill.segs)) != NULL) free(seg);
+    qm_spill.total = 0;
+    qm_spill.count = 0;
+
+    free(qm_spill.dir);
+    qm_spill.dir = NULL;
+}
+
+
+/**
+ * @brief configures the spill log
+ *
+ * The segments found in a new directory are loaded for replay.
+ * @param dir the spill directory, NULL or empty to disable
+ * @param max_size the total size of the segments, 0 for the default
+ * @return true if success, false otherwise
+ */
+bool
+qm_spill_set_config(const char *dir, size_t max_size)
+{
+    if (max_size == 0) max_size = QM_SPILL_DEFAULT_SIZE;
+    qm_spill.max_size = max_size;
+    qm_spill.seg_size = max_size / QM_SPILL_SEGMENTS;
+    if (qm_spill.seg_size < QM_SPILL_MIN_SEGMENT) qm_spill.seg_size = QM_SPILL_MIN_SEGMENT;
+
+    if (dir != NULL && *dir == '\0') dir = NULL;
+    if (dir == NULL && qm_spill.dir == NULL) return true;
+    if (dir != NULL && qm_spill.dir != NULL && strcmp(dir, qm_spill.dir) == 0) return true;
+
+    qm_spill_close();
+    ds_dlist_init(&qm_spill.segs, qm_spill_seg_t, node);
+    if (dir == NULL) return true;
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        LOGE("%s: create %s: %s", __func__, dir, strerror(errno));
+        return false;
+    }
+    qm_spill.dir = strdup(dir);
+    if (qm_spill.dir == NULL) return false;
+
+    LOGI("%s: spilling to %s, up to %zu bytes", __func__, dir, max_size);
+    qm_spill_load();
+
+    return true;
+}
+
+
+/**
+ * @brief tells if the spill log is configured
+ */
+bool
+qm_spill_enabled(void)
+{
+    return qm_spill.dir != NULL;
+}
+
+
+/**
+ * @brief returns the number of spilled messages not replayed yet
+ */
+size_t
+qm_spill_count(void)
+{
+    return qm_spill.count;
+}
+
+
+/**
+ * @brief opens a new segment for append
+ *
+ * @return true if success, false otherwise
+ */
+static bool
+qm_spill_rotate(void)
+{
+    qm_spill_seg_t *tail;
+    qm_spill_seg_t *seg;
+    char path[PATH_MAX];
+
+    qm_spill_sync();
+    if (qm_spill.wfd >= 0) close(qm_spill.wfd);
+    qm_spill.wfd = -1;
+
+    seg = calloc(1, sizeof(*seg));
+    if (seg == NULL) return false;
+
+    tail = ds_dlist_tail(&qm_spill.segs);
+    seg->seq = tail ? tail->seq + 1 : 1;
+    qm_spill_seg_path(seg, path, sizeof(path));
+
+    qm_spill.wfd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (qm_spill.wfd < 0)
+    {
+        LOGE("%s: create %s: %s", __func__, path, strerror(errno));
+        free(seg);
+        return false;
+    }
+    ds_dlist_insert_tail(&qm_spill.segs, seg);
+
+    return true;
+}
+
+
+/**
+ * @brief appends a message to the spill log
+ *
+ * @param qi the message, left untouched
+ * @return true if spilled, false otherwise
+ */
+bool
+qm_spill_put(qm_item_t *qi)
+{
+    qm_spill_hdr_t hdr;
+    char path[PATH_MAX];
+    qm_spill_seg_t *tail;
+    struct iovec iov[3];
+    ssize_t ret;
+    size_t len;
+    int n;
+
+    if (!qm_spill_enabled()) return false;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = QM_SPILL_MAGIC;
+    hdr.req = qi->req;
+    hdr.topic_len = qi->topic ? strlen(qi->topic) + 1 : 0;
+    hdr.size = qi->size;
+    hdr.wall_time = time_real() - (time_monotonic() - qi->timestamp);
+    hdr.compressed = qi->compressed;
+    hdr.crc = qm_spill_crc(&hdr, qi->topic, qi->buf);
+
+    len = sizeof(hdr) + hdr.topic_len + hdr.size;
+    if (len > qm_spill.seg_size) return false;
+
+    tail = ds_dlist_tail(&qm_spill.segs);
+    if (tail == NULL || tail->size + len > qm_spill.seg_size)
+    {
+        if (!qm_spill_rotate()) return false;
+        tail = ds_dlist_tail(&qm_spill.segs);
+    }
+    else if (qm_spill.wfd < 0)
+    {
+        qm_spill_seg_path(tail, path, sizeof(path));
+        qm_spill.wfd = open(path, O_WRONLY | O_APPEND);
+        if (qm_spill.wfd < 0)
+        {
+            LOGE("%s: open %s: %s", __func__, path, strerror(errno));
+            return false;
+        }
+    }
+
+    // make room, the segment being appended to is kept
+    while (qm_spill.total + len > qm_spill.max_size
+            && ds_dlist_head(&qm_spill.segs) != tail)
+    {
+        qm_spill_drop_head();
+    }
+    if (qm_spill.total + len > qm_spill.max_size) return false;
+
+    n = 0;
+    iov[n].iov_base = &hdr;
+    iov[n++].iov_len = sizeof(hdr);
+    if (hdr.topic_len)
+    {
+        iov[n].iov_base = qi->topic;
+        iov[n++].iov_len = hdr.topic_len;
+    }
+    if (hdr.size)
+    {
+        iov[n].iov_base = qi->buf;
+        iov[n++].iov_len = hdr.size;
+    }
+
+    ret = writev(qm_spill.wfd, iov, n);
+    if (ret != (ssize_t)len)
+    {
+        LOGE("%s: write %zd/%zu: %s", __func__, ret, len, strerror(errno));
+        // drop the partial record
+        if (ret > 0 && ftruncate(qm_spill.wfd, tail->size) != 0)
+        {
+            LOGE("%s: truncate: %s", __func__, strerror(errno));
+        }
+        return false;
+    }
+
+    tail->size += len;
+    tail->count++;
+    qm_spill.total += len;
+    qm_spill.count++;
+
+    qm_spill.unsynced += len;
+    if (qm_spill.unsynced >= QM_SPILL_SYNC_BYTES) qm_spill_sync();
+
+    return true;
+}
+
+
+/**
+ * @brief flushes the spilled messages to disk
+ */
+void
+qm_spill_sync(void)
+{
+    if (qm_spill.wfd < 0 || qm_spill.unsynced == 0) return;
+
+    if (fdatasync(qm_spill.wfd) != 0) LOGE("%s: %s", __func__, strerror(errno));
+    qm_spill.unsynced = 0;
+}
+
+
+/**
+ * @brief reads the oldest spilled message
+ *
+ * The message stays in the log until qm_spill_pop().
+ * @param qi the message, its topic and buf are allocated
+ * @return true if a message was read, false if none
+ */
+bool
+qm_spill_peek(qm_item_t *qi)
+{
+    qm_spill_hdr_t hdr;
+    char path[PATH_MAX];
+    qm_spill_seg_t *seg;
+    int64_t age;
+    char *topic;
+    void *buf;
+
+    while ((seg = ds_dlist_head(&qm_spill.segs)) != NULL)
+    {
+        if (qm_spill.roff >= seg->size)
+        {
+            // the last segment is fully replayed
+            if (seg == ds_dlist_tail(&qm_spill.segs) && seg->count == 0)
+            {
+                qm_spill_drop_head();
+            }
+            return false;
+        }
+
+        if (qm_spill.rfd < 0)
+        {
+            qm_spill_seg_path(seg, path, sizeof(path));
+            qm_spill.rfd = open(path, O_RDONLY);
+            if (qm_spill.rfd < 0)
+            {
+                LOGE("%s: open %s: %s", __func__, path, strerror(errno));
+                qm_spill_drop_head();
+                continue;
+            }
+        }
+
+        if (qm_spill_read_record(qm_spill.rfd, qm_spill.roff, &hdr, &topic, &buf)) break;
+
+        LOGE("%s: segment %u: invalid record at %zu", __func__, seg->seq, qm_spill.roff);
+        qm_spill_drop_head();
+    }
+    if (seg == NULL) return false;
+
+    memset(qi, 0, sizeof(*qi));
+    qi->req = hdr.req;
+    qi->topic = topic;
+    qi->buf = buf;
+    qi->size = hdr.size;
+    // the age survives a reboot, the monotonic clock does not
+    age = time_real() - hdr.wall_time;
+    if (age < 0) age = 0;
+    qi->timestamp = time_monotonic() - age;
+    qi->compressed = hdr.compressed;
+    qm_spill.rlen = sizeof(hdr) + hdr.topic_len + hdr.size;
+
+    return true;
+}
+
+
+/**
+ * @brief removes the message returned by qm_spill_peek()
+ */
+void
+qm_spill_pop(void)
+{
+    qm_spill_seg_t *seg;
+
+    seg = ds_dlist_head(&qm_spill.segs);
+    if (seg == NULL || qm_spill.rlen == 0) return;
+
+    qm_spill.roff += qm_spill.rlen;
+    qm_spill.rlen = 0;
+    seg->count--;
+    qm_spill.count--;
+
+    // a fully replayed segment is deleted, unless still appended to
+    if (qm_spill.roff >= seg->size && seg != ds_dlist_tail(&qm_spill.segs))
+    {
+        qm_spill_drop_head();
+    }
+    else if (qm_spill.count == 0 && seg->count == 0)
+    {
+        qm_spill_drop_head();
+    }
+}
+
+
+/**
+ * @brief releases the spill log, the segments are kept on disk
+ */
+void
+qm_spill_fini(void)
+{
+    qm_spill_close();
+}
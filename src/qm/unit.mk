@@ -39,7 +39,10 @@ UNIT_TYPE := BIN
 UNIT_SRC := src/qm_main.c
 UNIT_SRC += src/qm_ovsdb.c
 UNIT_SRC += src/qm_mqtt.c
+UNIT_SRC += src/qm_report.c
+UNIT_SRC += src/qm_compress.c
 UNIT_SRC += src/qm_queue.c
+UNIT_SRC += src/qm_spill.c
 UNIT_SRC += src/qm_event.c
 
 UNIT_CFLAGS += -I$(TOP_DIR)/src/lib/common/inc/
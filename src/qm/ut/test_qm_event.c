@@ -0,0 +1,343 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <ev.h>
+
+#include "log.h"
+#include "unity.h"
+#include "qm.h"
+
+/*
+ * The receive path is fed through a socket pair, the requests it parses
+ * are checked in the queue.
+ */
+
+bool qm_async_new(int fd);
+
+/* QM's MQTT side is not linked in the tests */
+bool qm_log_enabled = false;
+bool qm_mqtt_config_valid() { return true; }
+bool qm_mqtt_is_connected() { return false; }
+bool qm_mqtt_compress_item(qm_item_t *qi) { (void)qi; return true; }
+
+bool
+qm_mqtt_send_message(qm_item_t *qi, qm_response_t *res)
+{
+    (void)qi;
+    (void)res;
+    return false;
+}
+
+
+/**
+ * @brief encodes a request in buf
+ *
+ * The request data is data_size times the fill byte.
+ *
+ * @return the encoded size
+ */
+static size_t
+test_rx_req(uint8_t *buf, const char *topic, size_t data_size, uint8_t fill)
+{
+    qm_request_t req;
+
+    qm_req_init(&req);
+    req.cmd = QM_CMD_SEND;
+    req.flags = QM_REQ_FLAG_NO_RESPONSE;
+    req.data_type = QM_DATA_STATS;
+    req.topic_len = strlen(topic) + 1;
+    req.data_size = data_size;
+
+    memcpy(buf, &req, sizeof(req));
+    memcpy(buf + sizeof(req), topic, req.topic_len);
+    memset(buf + sizeof(req) + req.topic_len, fill, data_size);
+
+    return sizeof(req) + req.topic_len + data_size;
+}
+
+
+/**
+ * @brief opens a QM connection, returns the client end
+ */
+static int
+test_rx_open(void)
+{
+    int sv[2];
+
+    TEST_ASSERT_EQUAL_INT(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    TEST_ASSERT_TRUE(qm_async_new(sv[1]));
+
+    return sv[0];
+}
+
+
+/**
+ * @brief writes bytes to QM and lets it read them
+ */
+static void
+test_rx_write(int fd, const void *buf, size_t len)
+{
+    TEST_ASSERT_EQUAL_INT((int)len, (int)write(fd, buf, len));
+    ev_run(EV_DEFAULT, EVRUN_NOWAIT);
+}
+
+
+/**
+ * @brief checks a queued message
+ */
+static void
+test_rx_check(qm_item_t *qi, const char *topic, size_t data_size, uint8_t fill)
+{
+    const uint8_t *p;
+    size_t i;
+
+    TEST_ASSERT_NOT_NULL(qi);
+    TEST_ASSERT_EQUAL_STRING(topic, qi->topic);
+    TEST_ASSERT_EQUAL_UINT(data_size, qi->size);
+
+    p = qi->buf;
+    for (i = 0; i < data_size; i++)
+    {
+        if (p[i] != fill) TEST_FAIL_MESSAGE("corrupted message data");
+    }
+}
+
+
+/**
+ * @brief checks whether QM closed the connection
+ */
+static bool
+test_rx_closed(int fd)
+{
+    char c;
+
+    ev_run(EV_DEFAULT, EVRUN_NOWAIT);
+
+    return recv(fd, &c, 1, MSG_DONTWAIT) == 0;
+}
+
+
+static void
+test_rx_flush(void)
+{
+    while (qm_queue_drop_head());
+}
+
+
+/**
+ * @brief a request is received in several reads
+ */
+void
+test_rx_split_request(void)
+{
+    static uint8_t buf[4096];
+    qm_item_t *qi;
+    size_t len;
+    int fd;
+
+    qm_queue_init();
+    fd = test_rx_open();
+
+    len = test_rx_req(buf, "split", 3000, 0xa5);
+
+    /* Header, topic and data in pieces */
+    test_rx_write(fd, buf, 10);
+    test_rx_write(fd, buf + 10, sizeof(qm_request_t));
+    test_rx_write(fd, buf + 10 + sizeof(qm_request_t), 1000);
+    TEST_ASSERT_EQUAL_INT(0, qm_queue_length());
+
+    test_rx_write(fd, buf + 1010 + sizeof(qm_request_t),
+                  len - 1010 - sizeof(qm_request_t));
+    TEST_ASSERT_EQUAL_INT(1, qm_queue_length());
+
+    TEST_ASSERT_TRUE(qm_queue_head(&qi));
+    test_rx_check(qi, "split", 3000, 0xa5);
+
+    /* Small messages don't pin the receive block */
+    TEST_ASSERT_NULL(qi->block);
+
+    close(fd);
+    ev_run(EV_DEFAULT, EVRUN_NOWAIT);
+    test_rx_flush();
+}
+
+
+/**
+ * @brief several requests are received in one read
+ */
+void
+test_rx_batched_requests(void)
+{
+    static uint8_t buf[16 * 1024];
+    char topic[32];
+    qm_item_t *qi;
+    size_t len;
+    int fd;
+    int i;
+
+    qm_queue_init();
+    fd = test_rx_open();
+
+    len = 0;
+    for (i = 0; i < 10; i++)
+    {
+        snprintf(topic, sizeof(topic), "batch/%d", i);
+        len += test_rx_req(buf + len, topic, 100 + i, i);
+    }
+    test_rx_write(fd, buf, len);
+    TEST_ASSERT_EQUAL_INT(10, qm_queue_length());
+
+    for (i = 0; i < 10; i++)
+    {
+        snprintf(topic, sizeof(topic), "batch/%d", i);
+        TEST_ASSERT_TRUE(qm_queue_head(&qi));
+        test_rx_check(qi, topic, 100 + i, i);
+        qm_queue_drop_head();
+    }
+
+    close(fd);
+    ev_run(EV_DEFAULT, EVRUN_NOWAIT);
+}
+
+
+/**
+ * @brief large requests spanning the receive and spare blocks
+ *
+ * The messages keep referencing their receive blocks after the connection
+ * released them.
+ */
+void
+test_rx_block_references(void)
+{
+    static uint8_t buf[128 * 1024];
+    qm_rx_block_t *block;
+    qm_item_t *qi;
+    size_t len;
+    int fd;
+
+    qm_queue_init();
+    fd = test_rx_open();
+
+    len = test_rx_req(buf, "large/0", 40000, 0x11);
+    len += test_rx_req(buf + len, "large/1", 40000, 0x22);
+    len += test_rx_req(buf + len, "large/2", 40000, 0x33);
+    test_rx_write(fd, buf, len);
+    ev_run(EV_DEFAULT, EVRUN_NOWAIT);
+    TEST_ASSERT_EQUAL_INT(3, qm_queue_length());
+
+    /* The connection goes away, the queued messages stay valid */
+    close(fd);
+    ev_run(EV_DEFAULT, EVRUN_NOWAIT);
+
+    /* The first message was parsed in the first receive block */
+    TEST_ASSERT_TRUE(qm_queue_head(&qi));
+    block = qi->block;
+    TEST_ASSERT_NOT_NULL(block);
+    TEST_ASSERT_TRUE(qm_rx_block_holds(block, qi->buf));
+    TEST_ASSERT_EQUAL_INT(1, block->refcount);
+    test_rx_check(qi, "large/0", 40000, 0x11);
+    qm_queue_drop_head();
+
+    /* The others were joined from both blocks into a new one */
+    TEST_ASSERT_TRUE(qm_queue_head(&qi));
+    block = qi->block;
+    TEST_ASSERT_NOT_NULL(block);
+    TEST_ASSERT_TRUE(qm_rx_block_holds(block, qi->buf));
+    TEST_ASSERT_EQUAL_INT(2, block->refcount);
+    test_rx_check(qi, "large/1", 40000, 0x22);
+    qm_queue_drop_head();
+
+    TEST_ASSERT_TRUE(qm_queue_head(&qi));
+    TEST_ASSERT_TRUE(qi->block == block);
+    TEST_ASSERT_EQUAL_INT(1, block->refcount);
+    test_rx_check(qi, "large/2", 40000, 0x33);
+    qm_queue_drop_head();
+
+    TEST_ASSERT_EQUAL_INT(0, qm_queue_length());
+}
+
+
+/**
+ * @brief malformed or oversized request headers close the connection
+ */
+void
+test_rx_bad_headers(void)
+{
+    static uint8_t buf[4096];
+    qm_request_t *req;
+    size_t len;
+    int fd;
+
+    qm_queue_init();
+
+    /* Bad tag */
+    fd = test_rx_open();
+    len = test_rx_req(buf, "bad", 100, 0);
+    req = (qm_request_t *)buf;
+    memcpy(req->tag, "XXXX", sizeof(req->tag));
+    test_rx_write(fd, buf, len);
+    TEST_ASSERT_TRUE(test_rx_closed(fd));
+    close(fd);
+
+    /* Oversized data, after a valid request */
+    fd = test_rx_open();
+    len = test_rx_req(buf, "good", 100, 1);
+    req = (qm_request_t *)(buf + len);
+    len += test_rx_req(buf + len, "huge", 100, 0);
+    req->data_size = 0xfffffff0;
+    test_rx_write(fd, buf, len);
+    TEST_ASSERT_TRUE(test_rx_closed(fd));
+    close(fd);
+
+    /* Oversized topic, in the header alone */
+    fd = test_rx_open();
+    test_rx_req(buf, "huge", 0, 0);
+    req = (qm_request_t *)buf;
+    req->topic_len = 0xffffffff;
+    test_rx_write(fd, buf, sizeof(*req));
+    TEST_ASSERT_TRUE(test_rx_closed(fd));
+    close(fd);
+
+    /* Only the valid request was queued */
+    TEST_ASSERT_EQUAL_INT(1, qm_queue_length());
+    test_rx_flush();
+}
+
+
+void
+run_test_qm_event(void)
+{
+    RUN_TEST(test_rx_split_request);
+    RUN_TEST(test_rx_batched_requests);
+    RUN_TEST(test_rx_block_references);
+    RUN_TEST(test_rx_bad_headers);
+}
@@ -0,0 +1,1029 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#include <ev.h>
+
+#include "log.h"
+#include "os_time.h"
+#include "target.h"
+#include "unity.h"
+#include "opensync_stats.pb-c.h"
+#include "qm.h"
+#include "qm_conn_async.h"
+
+#define TEST_NUM_REPORTS 200
+#define TEST_NUM_SURVEYS 8
+#define TEST_NUM_SAMPLES 16
+#define TEST_NUM_MESSAGES 1000
+#define TEST_QDROP_SEQ 500
+#define TEST_SPILL_SIZE (256*1024)
+
+const char *test_name = "qm_report_tests";
+
+/**
+ * @brief encoded reports as queued by the stats manager
+ */
+struct test_reports
+{
+    void *bufs[TEST_NUM_REPORTS];
+    size_t sizes[TEST_NUM_REPORTS];
+    size_t count;
+};
+
+static struct test_reports g_reports;
+
+
+/**
+ * @brief encodes a stats report
+ *
+ * @param idx the report index, used as the surveys timestamp
+ * @param nsurveys the number of surveys of the report
+ * @param size the encoded size
+ * @return the encoded report
+ */
+static void *
+test_pack_report(size_t idx, size_t nsurveys, size_t *size)
+{
+    Sts__Survey__SurveySample samples[TEST_NUM_SAMPLES];
+    Sts__Survey__SurveySample *psamples[TEST_NUM_SAMPLES];
+    Sts__Survey surveys[TEST_NUM_SURVEYS];
+    Sts__Survey *psurveys[TEST_NUM_SURVEYS];
+    Sts__Device device = STS__DEVICE__INIT;
+    Sts__Device *pdevice = &device;
+    Sts__Report report = STS__REPORT__INIT;
+    void *buf;
+    size_t i;
+
+    for (i = 0; i < TEST_NUM_SAMPLES; i++)
+    {
+        sts__survey__survey_sample__init(&samples[i]);
+        samples[i].channel = 36 + 4 * i;
+        samples[i].has_busy = true;
+        samples[i].busy = i;
+        psamples[i] = &samples[i];
+    }
+
+    for (i = 0; i < nsurveys; i++)
+    {
+        sts__survey__init(&surveys[i]);
+        surveys[i].band = STS__RADIO_BAND_TYPE__BAND5G;
+        surveys[i].survey_type = STS__SURVEY_TYPE__ON_CHANNEL;
+        surveys[i].has_timestamp_ms = true;
+        surveys[i].timestamp_ms = idx;
+        surveys[i].n_survey_list = TEST_NUM_SAMPLES;
+        surveys[i].survey_list = psamples;
+        psurveys[i] = &surveys[i];
+    }
+
+    device.has_timestamp_ms = true;
+    device.timestamp_ms = idx;
+
+    report.nodeid = "4C718002B3";
+    report.n_survey = nsurveys;
+    report.survey = psurveys;
+    report.n_device = 1;
+    report.device = &pdevice;
+
+    *size = sts__report__get_packed_size(&report);
+    buf = malloc(*size);
+    TEST_ASSERT_NOT_NULL(buf);
+    sts__report__pack(&report, buf);
+
+    return buf;
+}
+
+
+/**
+ * @brief merges reports the legacy way, unpacking and repacking
+ *
+ * Mirrors the merge QM used to perform for each queued report.
+ * @param buf the accumulated report, replaced by the merged report
+ * @param size the accumulated report size, updated
+ * @param qbuf the report to merge
+ * @param qsize the size of the report to merge
+ */
+static void
+test_legacy_append_report(void **buf, size_t *size, void *qbuf, size_t qsize)
+{
+    Sts__Report *rqi;
+    Sts__Report *rpt;
+    size_t num;
+    void *nbuf;
+
+    rqi = sts__report__unpack(NULL, qsize, qbuf);
+    TEST_ASSERT_NOT_NULL(rqi);
+
+    if (*size == 0)
+    {
+        rpt = rqi;
+        rqi = NULL;
+    }
+    else
+    {
+        rpt = sts__report__unpack(NULL, *size, *buf);
+        TEST_ASSERT_NOT_NULL(rpt);
+
+        num = rpt->n_survey;
+        rpt->n_survey += rqi->n_survey;
+        rpt->survey = realloc(rpt->survey,
+                              rpt->n_survey * sizeof(Sts__Survey *));
+        memcpy(&rpt->survey[num], rqi->survey,
+               rqi->n_survey * sizeof(Sts__Survey *));
+        memset(rqi->survey, 0, rqi->n_survey * sizeof(Sts__Survey *));
+
+        num = rpt->n_device;
+        rpt->n_device += rqi->n_device;
+        rpt->device = realloc(rpt->device,
+                              rpt->n_device * sizeof(Sts__Device *));
+        memcpy(&rpt->device[num], rqi->device,
+               rqi->n_device * sizeof(Sts__Device *));
+        memset(rqi->device, 0, rqi->n_device * sizeof(Sts__Device *));
+    }
+
+    nbuf = malloc(sts__report__get_packed_size(rpt));
+    TEST_ASSERT_NOT_NULL(nbuf);
+    free(*buf);
+    *buf = nbuf;
+    *size = sts__report__pack(rpt, nbuf);
+
+    sts__report__free_unpacked(rpt, NULL);
+    if (rqi) sts__report__free_unpacked(rqi, NULL);
+}
+
+
+void
+setUp(void)
+{
+    size_t i;
+
+    memset(&g_reports, 0, sizeof(g_reports));
+    for (i = 0; i < TEST_NUM_REPORTS; i++)
+    {
+        g_reports.bufs[i] = test_pack_report(i, TEST_NUM_SURVEYS,
+                                             &g_reports.sizes[i]);
+    }
+    g_reports.count = TEST_NUM_REPORTS;
+}
+
+
+void
+tearDown(void)
+{
+    size_t i;
+
+    for (i = 0; i < g_reports.count; i++) free(g_reports.bufs[i]);
+    memset(&g_reports, 0, sizeof(g_reports));
+}
+
+
+/**
+ * @brief validates the content of a wire merged report
+ */
+void
+test_merge_reports(void)
+{
+    qm_report_merge_t merge;
+    Sts__Report *report;
+    size_t nreports;
+    size_t i;
+    bool ret;
+
+    nreports = 3;
+    ret = qm_report_merge_init(&merge, 0);
+    TEST_ASSERT_TRUE(ret);
+
+    for (i = 0; i < nreports; i++)
+    {
+        ret = qm_report_merge_append(&merge, g_reports.bufs[i],
+                                     g_reports.sizes[i]);
+        TEST_ASSERT_TRUE(ret);
+    }
+
+    report = sts__report__unpack(NULL, merge.len, merge.buf);
+    TEST_ASSERT_NOT_NULL(report);
+    TEST_ASSERT_EQUAL_STRING("4C718002B3", report->nodeid);
+    TEST_ASSERT_EQUAL_UINT(nreports * TEST_NUM_SURVEYS, report->n_survey);
+    TEST_ASSERT_EQUAL_UINT(nreports, report->n_device);
+
+    /* The reports' order is preserved */
+    for (i = 0; i < nreports; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT(i, report->device[i]->timestamp_ms);
+        TEST_ASSERT_EQUAL_UINT(i, report->survey[i * TEST_NUM_SURVEYS]->timestamp_ms);
+        TEST_ASSERT_EQUAL_UINT(TEST_NUM_SAMPLES,
+                               report->survey[i * TEST_NUM_SURVEYS]->n_survey_list);
+    }
+
+    sts__report__free_unpacked(report, NULL);
+    qm_report_merge_free(&merge);
+}
+
+
+/**
+ * @brief validates that a malformed report is not merged
+ */
+void
+test_merge_malformed_report(void)
+{
+    qm_report_merge_t merge;
+    size_t len;
+    bool ret;
+
+    ret = qm_report_merge_init(&merge, 0);
+    TEST_ASSERT_TRUE(ret);
+
+    ret = qm_report_merge_append(&merge, g_reports.bufs[0],
+                                 g_reports.sizes[0]);
+    TEST_ASSERT_TRUE(ret);
+    len = merge.len;
+
+    /* Truncated report */
+    ret = qm_report_merge_append(&merge, g_reports.bufs[1],
+                                 g_reports.sizes[1] - 1);
+    TEST_ASSERT_FALSE(ret);
+    TEST_ASSERT_EQUAL_UINT(len, merge.len);
+
+    qm_report_merge_free(&merge);
+}
+
+
+/**
+ * @brief runs a merge in a child process
+ *
+ * Reports the merge duration and the child's peak RSS.
+ * @param legacy use the legacy merge if true, the wire merge otherwise
+ * @param elapsed the merge duration in ms
+ * @param maxrss the peak RSS in kB
+ */
+static void
+test_run_merge(bool legacy, double *elapsed, long *maxrss)
+{
+    qm_report_merge_t merge;
+    struct timespec start;
+    struct timespec end;
+    struct rusage usage;
+    double result[2];
+    void *buf = NULL;
+    size_t size = 0;
+    int pipefd[2];
+    ssize_t len;
+    size_t i;
+    pid_t pid;
+    int rc;
+
+    rc = pipe(pipefd);
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    pid = fork();
+    TEST_ASSERT_TRUE(pid >= 0);
+    if (pid == 0)
+    {
+        close(pipefd[0]);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (legacy)
+        {
+            for (i = 0; i < g_reports.count; i++)
+            {
+                test_legacy_append_report(&buf, &size, g_reports.bufs[i],
+                                          g_reports.sizes[i]);
+            }
+        }
+        else
+        {
+            for (i = 0; i < g_reports.count; i++) size += g_reports.sizes[i];
+            qm_report_merge_init(&merge, size);
+            for (i = 0; i < g_reports.count; i++)
+            {
+                qm_report_merge_append(&merge, g_reports.bufs[i],
+                                       g_reports.sizes[i]);
+            }
+            buf = merge.buf;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        getrusage(RUSAGE_SELF, &usage);
+
+        result[0] = (end.tv_sec - start.tv_sec) * 1e3;
+        result[0] += (end.tv_nsec - start.tv_nsec) / 1e6;
+        result[1] = usage.ru_maxrss;
+        len = write(pipefd[1], result, sizeof(result));
+        free(buf);
+        _exit(len == sizeof(result) ? 0 : 1);
+    }
+
+    close(pipefd[1]);
+    len = read(pipefd[0], result, sizeof(result));
+    close(pipefd[0]);
+    waitpid(pid, &rc, 0);
+    TEST_ASSERT_EQUAL_INT(sizeof(result), len);
+
+    *elapsed = result[0];
+    *maxrss = (long)result[1];
+}
+
+
+/**
+ * @brief compares the legacy and wire merges of a full queue of reports
+ */
+void
+test_merge_reports_benchmark(void)
+{
+    double legacy_ms;
+    long legacy_rss;
+    double wire_ms;
+    long wire_rss;
+
+    test_run_merge(true, &legacy_ms, &legacy_rss);
+    test_run_merge(false, &wire_ms, &wire_rss);
+
+    LOGI("%s: %zu reports: unpack/repack: %.2f ms, peak rss %ld kB",
+         __func__, g_reports.count, legacy_ms, legacy_rss);
+    LOGI("%s: %zu reports: wire merge: %.2f ms, peak rss %ld kB",
+         __func__, g_reports.count, wire_ms, wire_rss);
+}
+
+
+/**
+ * @brief validates compressed reports and the per topic settings
+ */
+void
+test_compress_reports(void)
+{
+    uint8_t dec[8192];
+    size_t def_len;
+    uLongf dec_len;
+    size_t len;
+    void *out;
+    bool ret;
+    int rc;
+
+    TEST_ASSERT_TRUE(g_reports.sizes[0] <= sizeof(dec));
+
+    ret = qm_compress_set_level(NULL, "10");
+    TEST_ASSERT_FALSE(ret);
+    ret = qm_compress_set_strategy(NULL, "best");
+    TEST_ASSERT_FALSE(ret);
+
+    ret = qm_compress("test/default", g_reports.bufs[0], g_reports.sizes[0],
+                      &out, &def_len);
+    TEST_ASSERT_TRUE(ret);
+
+    dec_len = sizeof(dec);
+    rc = uncompress(dec, &dec_len, out, def_len);
+    TEST_ASSERT_EQUAL_INT(Z_OK, rc);
+    TEST_ASSERT_EQUAL_UINT(g_reports.sizes[0], dec_len);
+    TEST_ASSERT_EQUAL_MEMORY(g_reports.bufs[0], dec, dec_len);
+
+    /* A stored topic is not compressed, the other topics are untouched */
+    ret = qm_compress_set_level("test/stored", "0");
+    TEST_ASSERT_TRUE(ret);
+    ret = qm_compress_set_strategy("test/stored", "huffman");
+    TEST_ASSERT_TRUE(ret);
+
+    ret = qm_compress("test/stored", g_reports.bufs[1], g_reports.sizes[1],
+                      &out, &len);
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_TRUE(len > g_reports.sizes[1]);
+
+    dec_len = sizeof(dec);
+    rc = uncompress(dec, &dec_len, out, len);
+    TEST_ASSERT_EQUAL_INT(Z_OK, rc);
+    TEST_ASSERT_EQUAL_MEMORY(g_reports.bufs[1], dec, dec_len);
+
+    ret = qm_compress("test/default", g_reports.bufs[0], g_reports.sizes[0],
+                      &out, &len);
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_EQUAL_UINT(def_len, len);
+
+    qm_compress_fini();
+}
+
+
+/**
+ * @brief runs the compression of a full queue of reports
+ *
+ * @param legacy use a one-shot compress() per report if true,
+ *        the persistent deflate stream otherwise
+ * @return the compression duration in ms
+ */
+static double
+test_run_compress(bool legacy)
+{
+    struct timespec start;
+    struct timespec end;
+    unsigned long len;
+    uint8_t *buf;
+    size_t zlen;
+    void *out;
+    size_t i;
+    int rc;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < g_reports.count; i++)
+    {
+        if (legacy)
+        {
+            len = compressBound(g_reports.sizes[i]);
+            len += len / 4;
+            buf = malloc(len);
+            TEST_ASSERT_NOT_NULL(buf);
+            rc = compress(buf, &len, g_reports.bufs[i], g_reports.sizes[i]);
+            TEST_ASSERT_EQUAL_INT(Z_OK, rc);
+            free(buf);
+        }
+        else
+        {
+            TEST_ASSERT_TRUE(qm_compress(NULL, g_reports.bufs[i],
+                                         g_reports.sizes[i], &out, &zlen));
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+
+/**
+ * @brief compares the one-shot and the persistent stream compressions
+ */
+void
+test_compress_reports_benchmark(void)
+{
+    double legacy_ms;
+    double stream_ms;
+
+    legacy_ms = test_run_compress(true);
+    stream_ms = test_run_compress(false);
+    qm_compress_fini();
+
+    LOGI("%s: %zu reports: compress(): %.2f ms", __func__,
+         g_reports.count, legacy_ms);
+    LOGI("%s: %zu reports: deflate stream: %.2f ms", __func__,
+         g_reports.count, stream_ms);
+}
+
+
+/**
+ * @brief reads exactly len bytes
+ */
+static bool
+test_read_full(int fd, void *buf, size_t len)
+{
+    ssize_t ret;
+    size_t off;
+
+    for (off = 0; off < len; off += ret)
+    {
+        ret = read(fd, (uint8_t *)buf + off, len - off);
+        if (ret <= 0) return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief answers requests like QM until the client disconnects
+ *
+ * The response to the TEST_QDROP_SEQ-th request reports a dropped message.
+ */
+static void
+test_qm_server(int fd)
+{
+    static uint8_t buf[256 * 1024];
+    qm_response_t res;
+    qm_request_t req;
+    size_t count;
+    size_t len;
+
+    for (count = 1; test_read_full(fd, &req, sizeof(req)); count++)
+    {
+        len = req.topic_len + req.data_size;
+        if (len > sizeof(buf) || !test_read_full(fd, buf, len)) break;
+
+        qm_res_init(&res, &req);
+        res.qlen = count;
+        if (count == TEST_QDROP_SEQ) res.qdrop = 1;
+        if (req.flags & QM_REQ_FLAG_NO_RESPONSE) continue;
+        if (!qm_conn_write_res(fd, &res)) break;
+    }
+    _exit(0);
+}
+
+
+/**
+ * @brief starts a fake QM answering on a socket pair
+ *
+ * @param pid the fake QM process
+ * @return the client socket
+ */
+static int
+test_qm_server_start(pid_t *pid)
+{
+    int sv[2];
+    int rc;
+
+    rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    *pid = fork();
+    TEST_ASSERT_TRUE(*pid >= 0);
+    if (*pid == 0)
+    {
+        close(sv[0]);
+        test_qm_server(sv[1]);
+    }
+    close(sv[1]);
+
+    return sv[0];
+}
+
+
+struct test_async_ctx
+{
+    qm_conn_async_t qa;
+    ev_timer timer;
+    size_t sent;
+    size_t received;
+    size_t failed;
+    size_t backpressure;
+};
+
+
+static void
+test_async_res_cb(qm_conn_async_t *qa, qm_response_t *res, void *data)
+{
+    struct test_async_ctx *ctx = qa->ctx;
+
+    (void)data;
+
+    if (res->response == QM_RESPONSE_ERROR) ctx->failed++;
+    else ctx->received++;
+
+    if (ctx->received + ctx->failed == TEST_NUM_MESSAGES) ev_break(qa->loop, EVBREAK_ALL);
+}
+
+
+static void
+test_async_backpressure_cb(qm_conn_async_t *qa, qm_response_t *res)
+{
+    struct test_async_ctx *ctx = qa->ctx;
+
+    if (res) ctx->backpressure++;
+}
+
+
+static void
+test_async_timer_cb(struct ev_loop *loop, ev_timer *timer, int revents)
+{
+    struct test_async_ctx *ctx = timer->data;
+    size_t i;
+
+    (void)revents;
+
+    i = ctx->sent % g_reports.count;
+    if (qm_conn_async_send_stats(&ctx->qa, g_reports.bufs[i], g_reports.sizes[i])) ctx->sent++;
+    if (ctx->sent == TEST_NUM_MESSAGES) ev_timer_stop(loop, timer);
+}
+
+
+/**
+ * @brief runs TEST_NUM_MESSAGES reports through the async client
+ *
+ * @param ctx the test context, holding the client statistics
+ * @param interval the delay between two reports, 0 to send a burst
+ * @return the duration in ms
+ */
+static double
+test_run_async(struct test_async_ctx *ctx, double interval)
+{
+    struct ev_loop *loop = EV_DEFAULT;
+    struct timespec start;
+    struct timespec end;
+    pid_t pid;
+    bool ret;
+    size_t i;
+    int fd;
+
+    memset(ctx, 0, sizeof(*ctx));
+    qm_conn_async_init(&ctx->qa, loop);
+    ctx->qa.res_cb = test_async_res_cb;
+    ctx->qa.backpressure_cb = test_async_backpressure_cb;
+    ctx->qa.ctx = ctx;
+
+    fd = test_qm_server_start(&pid);
+    ret = qm_conn_async_attach(&ctx->qa, fd);
+    TEST_ASSERT_TRUE(ret);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (interval > 0)
+    {
+        ev_timer_init(&ctx->timer, test_async_timer_cb, interval, interval);
+        ctx->timer.data = ctx;
+        ev_timer_start(loop, &ctx->timer);
+        ev_run(loop, 0);
+    }
+    else
+    {
+        while (ctx->sent < TEST_NUM_MESSAGES)
+        {
+            i = ctx->sent % g_reports.count;
+            ret = qm_conn_async_send_stats(&ctx->qa, g_reports.bufs[i], g_reports.sizes[i]);
+            if (ret) ctx->sent++;
+            else ev_run(loop, EVRUN_ONCE);
+        }
+        while (qm_conn_async_inflight(&ctx->qa)) ev_run(loop, EVRUN_ONCE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    qm_conn_async_close(&ctx->qa);
+    waitpid(pid, NULL, 0);
+
+    return (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+
+/**
+ * @brief measures the async client paced at 1k reports/s and in a burst
+ */
+void
+test_async_conn_benchmark(void)
+{
+    struct test_async_ctx ctx;
+    struct timespec start;
+    struct timespec end;
+    qm_response_t res;
+    qm_request_t req;
+    double legacy_ms;
+    double ms;
+    pid_t pid;
+    size_t i;
+    bool ret;
+    int fd;
+
+    ms = test_run_async(&ctx, 0.001);
+    TEST_ASSERT_EQUAL_UINT(TEST_NUM_MESSAGES, ctx.received);
+    TEST_ASSERT_EQUAL_UINT(0, ctx.failed);
+    TEST_ASSERT_EQUAL_UINT(1, ctx.backpressure);
+    LOGI("%s: paced: %d reports in %.2f ms, latency avg %.1f us max %lld us, max in flight %u",
+         __func__, TEST_NUM_MESSAGES, ms,
+         (double)ctx.qa.stats.latency_usec_sum / ctx.qa.stats.received,
+         (long long)ctx.qa.stats.latency_usec_max, ctx.qa.stats.max_inflight);
+
+    ms = test_run_async(&ctx, 0);
+    TEST_ASSERT_EQUAL_UINT(TEST_NUM_MESSAGES, ctx.received);
+    TEST_ASSERT_EQUAL_UINT(0, ctx.failed);
+    LOGI("%s: burst: %d reports in %.2f ms, latency avg %.1f us max %lld us, max in flight %u",
+         __func__, TEST_NUM_MESSAGES, ms,
+         (double)ctx.qa.stats.latency_usec_sum / ctx.qa.stats.received,
+         (long long)ctx.qa.stats.latency_usec_max, ctx.qa.stats.max_inflight);
+
+    /* Blocking round trip per report, as qm_conn_send_stats() minus connect */
+    fd = test_qm_server_start(&pid);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < TEST_NUM_MESSAGES; i++)
+    {
+        qm_req_init(&req);
+        req.cmd = QM_CMD_SEND;
+        req.data_type = QM_DATA_STATS;
+        ret = qm_conn_send_fd(fd, &req, NULL, g_reports.bufs[i % g_reports.count],
+                              g_reports.sizes[i % g_reports.count], &res);
+        TEST_ASSERT_TRUE(ret);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close(fd);
+    waitpid(pid, NULL, 0);
+
+    legacy_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    LOGI("%s: blocking: %d reports in %.2f ms", __func__, TEST_NUM_MESSAGES, legacy_ms);
+}
+
+
+/**
+ * @brief fills a message to spill
+ *
+ * @param qi the message, its buffers are allocated
+ * @param idx the message index, written in the message and used as its age
+ * @param size the message size, at least sizeof(idx)
+ */
+static void
+test_spill_item(qm_item_t *qi, uint32_t idx, size_t size)
+{
+    uint8_t *buf;
+    char topic[32];
+    size_t i;
+
+    memset(qi, 0, sizeof(*qi));
+    qm_req_init(&qi->req);
+    qi->req.cmd = QM_CMD_SEND;
+    qi->req.data_type = (idx % 2) ? QM_DATA_STATS : QM_DATA_RAW;
+    if (!(idx % 2))
+    {
+        snprintf(topic, sizeof(topic), "test/spill/%u", idx);
+        qi->topic = strdup(topic);
+        TEST_ASSERT_NOT_NULL(qi->topic);
+    }
+
+    buf = malloc(size);
+    TEST_ASSERT_NOT_NULL(buf);
+    memcpy(buf, &idx, sizeof(idx));
+    for (i = sizeof(idx); i < size; i++) buf[i] = (uint8_t)(idx + i);
+    qi->buf = buf;
+    qi->size = size;
+    qi->timestamp = time_monotonic() - idx;
+}
+
+
+/**
+ * @brief releases the buffers of a spilled or replayed message
+ */
+static void
+test_spill_free(qm_item_t *qi)
+{
+    free(qi->topic);
+    free(qi->buf);
+    qi->topic = NULL;
+    qi->buf = NULL;
+}
+
+
+/**
+ * @brief checks a replayed message
+ *
+ * @return the message index
+ */
+static uint32_t
+test_spill_check(qm_item_t *qi)
+{
+    uint8_t *buf = qi->buf;
+    char topic[32];
+    uint32_t idx;
+    size_t i;
+
+    TEST_ASSERT_TRUE(qi->size >= sizeof(idx));
+    memcpy(&idx, buf, sizeof(idx));
+    for (i = sizeof(idx); i < qi->size; i++) TEST_ASSERT_EQUAL_UINT8((uint8_t)(idx + i), buf[i]);
+
+    /* The age is kept, at the clocks' resolution */
+    TEST_ASSERT_INT_WITHIN(2, idx, time_monotonic() - qi->timestamp);
+
+    if (idx % 2)
+    {
+        TEST_ASSERT_NULL(qi->topic);
+        TEST_ASSERT_EQUAL_INT(QM_DATA_STATS, qi->req.data_type);
+    }
+    else
+    {
+        snprintf(topic, sizeof(topic), "test/spill/%u", idx);
+        TEST_ASSERT_EQUAL_STRING(topic, qi->topic);
+    }
+
+    return idx;
+}
+
+
+/**
+ * @brief counts the files left in a directory
+ */
+static size_t
+test_count_files(const char *path)
+{
+    struct dirent *de;
+    size_t count = 0;
+    DIR *dir;
+
+    dir = opendir(path);
+    TEST_ASSERT_NOT_NULL(dir);
+    while ((de = readdir(dir)) != NULL)
+    {
+        if (de->d_name[0] != '.') count++;
+    }
+    closedir(dir);
+
+    return count;
+}
+
+
+/**
+ * @brief spills messages, reloads the spill log and replays it
+ */
+void
+test_spill_replay(void)
+{
+    char dir[] = "/tmp/qm_spill_XXXXXX";
+    qm_item_t qi;
+    uint32_t idx;
+    uint32_t i;
+    bool ret;
+
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+    ret = qm_spill_set_config(dir, TEST_SPILL_SIZE);
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_TRUE(qm_spill_enabled());
+
+    for (i = 0; i < 300; i++)
+    {
+        test_spill_item(&qi, i, 100 + 3 * i);
+        ret = qm_spill_put(&qi);
+        test_spill_free(&qi);
+        TEST_ASSERT_TRUE(ret);
+    }
+    TEST_ASSERT_EQUAL_UINT(300, qm_spill_count());
+
+    /* The spilled messages survive a restart */
+    qm_spill_set_config(NULL, 0);
+    TEST_ASSERT_FALSE(qm_spill_enabled());
+    ret = qm_spill_set_config(dir, TEST_SPILL_SIZE);
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_EQUAL_UINT(300, qm_spill_count());
+
+    for (i = 0; i < 300; i++)
+    {
+        TEST_ASSERT_TRUE(qm_spill_peek(&qi));
+        idx = test_spill_check(&qi);
+        test_spill_free(&qi);
+        TEST_ASSERT_EQUAL_UINT(i, idx);
+        qm_spill_pop();
+    }
+    TEST_ASSERT_FALSE(qm_spill_peek(&qi));
+    TEST_ASSERT_EQUAL_UINT(0, qm_spill_count());
+    TEST_ASSERT_EQUAL_UINT(0, test_count_files(dir));
+
+    /* The oldest messages are dropped past the size limit */
+    for (i = 0; i < 2000; i++)
+    {
+        test_spill_item(&qi, i, 1000);
+        ret = qm_spill_put(&qi);
+        test_spill_free(&qi);
+        TEST_ASSERT_TRUE(ret);
+    }
+    TEST_ASSERT_TRUE(qm_spill_count() < 2000);
+    TEST_ASSERT_TRUE(qm_spill_count() * 1000 <= TEST_SPILL_SIZE);
+
+    idx = 0;
+    for (i = 0; qm_spill_peek(&qi); i++)
+    {
+        idx = test_spill_check(&qi);
+        test_spill_free(&qi);
+        qm_spill_pop();
+    }
+    TEST_ASSERT_EQUAL_UINT(1999, idx);
+    TEST_ASSERT_TRUE(i > 0);
+    TEST_ASSERT_EQUAL_UINT(0, test_count_files(dir));
+
+    qm_spill_fini();
+    TEST_ASSERT_EQUAL_INT(0, rmdir(dir));
+}
+
+
+/**
+ * @brief spills a full queue of reports
+ *
+ * @param dir the spill directory
+ * @param sync_each sync every message if true, batch the syncs otherwise
+ * @return the duration in ms
+ */
+static double
+test_run_spill(const char *dir, bool sync_each)
+{
+    struct timespec start;
+    struct timespec end;
+    qm_item_t qi;
+    size_t i;
+
+    qm_spill_set_config(dir, 4 * QM_SPILL_DEFAULT_SIZE);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < g_reports.count; i++)
+    {
+        memset(&qi, 0, sizeof(qi));
+        qi.req.data_type = QM_DATA_STATS;
+        qi.buf = g_reports.bufs[i];
+        qi.size = g_reports.sizes[i];
+        TEST_ASSERT_TRUE(qm_spill_put(&qi));
+        if (sync_each) qm_spill_sync();
+    }
+    qm_spill_sync();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+
+/**
+ * @brief measures the spill throughput and the replay latency
+ */
+void
+test_spill_benchmark(void)
+{
+    char dir[] = "/tmp/qm_spill_XXXXXX";
+    struct timespec start;
+    struct timespec end;
+    double batched_ms;
+    double sync_ms;
+    double max_us;
+    double total;
+    double us;
+    qm_item_t qi;
+    size_t bytes;
+    size_t i;
+
+    TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+
+    bytes = 0;
+    for (i = 0; i < g_reports.count; i++) bytes += g_reports.sizes[i];
+
+    sync_ms = test_run_spill(dir, true);
+    while (qm_spill_peek(&qi))
+    {
+        test_spill_free(&qi);
+        qm_spill_pop();
+    }
+    batched_ms = test_run_spill(dir, false);
+
+    total = 0;
+    max_us = 0;
+    for (i = 0; i < g_reports.count; i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        TEST_ASSERT_TRUE(qm_spill_peek(&qi));
+        qm_spill_pop();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        TEST_ASSERT_EQUAL_UINT(g_reports.sizes[i], qi.size);
+        test_spill_free(&qi);
+
+        us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+        total += us;
+        if (us > max_us) max_us = us;
+    }
+    TEST_ASSERT_EQUAL_UINT(0, qm_spill_count());
+
+    qm_spill_fini();
+    TEST_ASSERT_EQUAL_INT(0, rmdir(dir));
+
+    LOGI("%s: %zu reports, %zu bytes: sync each: %.2f ms, batched sync: %.2f ms",
+         __func__, g_reports.count, bytes, sync_ms, batched_ms);
+    LOGI("%s: replay latency avg %.1f us max %.1f us", __func__,
+         total / g_reports.count, max_us);
+}
+
+
+void run_test_qm_event(void);
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_merge_reports);
+    RUN_TEST(test_merge_malformed_report);
+    RUN_TEST(test_merge_reports_benchmark);
+    RUN_TEST(test_compress_reports);
+    RUN_TEST(test_compress_reports_benchmark);
+    RUN_TEST(test_async_conn_benchmark);
+    RUN_TEST(test_spill_replay);
+    RUN_TEST(test_spill_benchmark);
+
+    run_test_qm_event();
+
+    return UNITY_END();
+}
@@ -46,14 +46,34 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define sm_client_report_stat_delta(n, o) ((n) - (o))
 
+/* Client records are indexed by MAC and radio type */
+typedef struct
+{
+    mac_address_t                   mac;
+    radio_type_t                    type;
+} sm_client_record_key_t;
+
 typedef struct
 {
     dpp_client_record_t             entry;
     ds_dlist_t                      result_list;
     target_client_record_t          cache;
+
+    /* Sampling marks used to detect disconnected clients */
+    uint32_t                        seen_count;
+    bool                            seen_found;
+    bool                            seen_done;
+
+    sm_client_record_key_t          key;
+    ds_tree_node_t                  tnode;
     ds_dlist_node_t                 node;
 } sm_client_record_t;
 
+static int sm_client_record_key_cmp(void *a, void *b)
+{
+    return memcmp(a, b, sizeof(sm_client_record_key_t));
+}
+
 static inline sm_client_record_t * sm_client_record_alloc()
 {
     sm_client_record_t *record = NULL;
@@ -97,6 +117,8 @@ typedef struct
        (sm_client_record_t) */
     ds_dlist_t                      record_list;
     uint32_t                        record_qty;
+    /* Cached client sampling records indexed by key */
+    ds_tree_t                       record_tree;
 
     /* target client temporary list for deriving records */
     ds_dlist_t                      client_list;
@@ -332,6 +354,7 @@ bool sm_client_sm_records_clear(
                 &record->result_list);
 
         ds_dlist_iremove(&record_iter);
+        ds_tree_remove(&client_ctx->record_tree, record);
         sm_client_record_free(record);
         record = NULL;
     }
@@ -364,30 +387,14 @@ sm_client_record_t *sm_client_records_mac_find(
         sm_client_ctx_t            *client_ctx,
         target_client_record_t     *client_entry)
 {
-    ds_dlist_t                     *record_list =
-        &client_ctx->record_list;
-    sm_client_record_t             *record = NULL;
-    dpp_client_record_t            *record_entry = NULL;
-    ds_dlist_iter_t                 record_iter;
-
-    /* Find current client in existing list */
-    for (   record = ds_dlist_ifirst(&record_iter, record_list);
-            record != NULL;
-            record = ds_dlist_inext(&record_iter))
-    {
-        record_entry = &record->entry;
+    sm_client_record_key_t          key;
 
-        if (!memcmp(
-                    record_entry->info.mac,
-                    client_entry->info.mac,
-                    sizeof(record_entry->info.mac))
-             && (record_entry->info.type == client_entry->info.type)
-           ) {
-            return record;
-        }
-    }
+    /* Find current client in existing records */
+    memset(&key, 0, sizeof(key));
+    memcpy(key.mac, client_entry->info.mac, sizeof(key.mac));
+    key.type = client_entry->info.type;
 
-    return NULL;
+    return ds_tree_find(&client_ctx->record_tree, &key);
 }
 
 static
@@ -840,50 +847,59 @@ void sm_client_records_mark_disconnected (
     target_client_record_t         *client_entry = NULL;
     ds_dlist_iter_t                 client_iter;
 
-    uint32_t                        found;
-    uint32_t                        count;
-
+    /* Reset the marks of the cached records */
     for (   record = ds_dlist_ifirst(&record_iter, record_list);
             record != NULL;
             record = ds_dlist_inext(&record_iter))
     {
+        record->seen_count = 0;
+        record->seen_found = false;
+        record->seen_done = false;
+    }
+
+    /* Mark the cached records of the reported clients */
+    for (   client_entry = ds_dlist_ifirst(&client_iter, client_list);
+            client_entry != NULL;
+            client_entry = ds_dlist_inext(&client_iter))
+    {
+        record =
+            sm_client_records_mac_find(
+                    client_ctx,
+                    client_entry);
+        if ((NULL == record) || record->seen_done) {
+            continue;
+        }
         record_entry = &record->entry;
 
-        found = false;
-        count = 0;
+        /* Notify disconnection through stats cookie */
+        if (client_entry->stats_cookie !=
+                record->cache.stats_cookie ) {
+            record->seen_done = true;
+            continue;
+        }
 
-        for (   client_entry = ds_dlist_ifirst(&client_iter, client_list);
-                client_entry != NULL;
-                client_entry = ds_dlist_inext(&client_iter))
-        {
-            /* Check if client is already connected and if it is
-               on the same interface
-             */
-            if (MAC_ADDR_EQ(
-                        client_entry->info.mac,
-                        record_entry->info.mac)) {
-                /* Notify disconnection through stats cookie */
-                if (client_entry->stats_cookie !=
-                        record->cache.stats_cookie ) {
-                    break;
-                }
+        /* Client changed interface */
+        if(0 == strcmp(
+                    client_entry->info.ifname,
+                    record_entry->info.ifname )) {
+            record->seen_found = true;
+        }
 
-                /* Client changed interface */
-                if(0 == strcmp(
-                            client_entry->info.ifname,
-                            record_entry->info.ifname )) {
-                    found = true;
-                }
+        /* Driver did not yet kickout client so we have
+           it on both radios
+         */
+        record->seen_count++;
+    }
 
-                /* Driver did not yet kickout client so we have
-                   it on both radios
-                 */
-                count++;
-            }
-        }
+    /* Sweep the records of the clients gone */
+    for (   record = ds_dlist_ifirst(&record_iter, record_list);
+            record != NULL;
+            record = ds_dlist_inext(&record_iter))
+    {
+        record_entry = &record->entry;
 
         /* Client was either disconnected or changed interface */
-        if (!found && (1 >= count)) {
+        if (!record->seen_found && (1 >= record->seen_count)) {
             /* Check if already notified */
             if (record_entry->is_connected) {
                 /* Mark client entry disconnected */
@@ -971,6 +987,7 @@ bool sm_client_records_reset (
                 MAC_ADDRESS_PRINT(record_entry->info.mac));
 
             ds_dlist_iremove(&record_iter);
+            ds_tree_remove(&client_ctx->record_tree, record);
             sm_client_record_free(record);
             record = NULL;
         }
@@ -1163,7 +1180,12 @@ bool sm_client_records_update(
                 record_entry->duration_ms);
 
             /* Insert new entry */
+            memcpy(record->key.mac,
+                   record_entry->info.mac,
+                   sizeof(record->key.mac));
+            record->key.type = record_entry->info.type;
             ds_dlist_insert_tail(record_list, record);
+            ds_tree_insert(&client_ctx->record_tree, record, &record->key);
         }
 
 update_cache:
@@ -1616,6 +1638,11 @@ bool sm_client_report_request(
                 &client_ctx->record_list,
                 sm_client_record_t,
                 node);
+        ds_tree_init(
+                &client_ctx->record_tree,
+                sm_client_record_key_cmp,
+                sm_client_record_t,
+                tnode);
 
         /* Reschedule initialization in case of error */
         ev_init (init_timer, sm_client_init_timer_cb);
@@ -219,6 +219,122 @@ bool sm_neighbor_report_timer_restart(
     return true;
 }
 
+/* Temporary index of neighbor records by BSSID */
+typedef struct
+{
+    dpp_neighbor_record_list_t     *record;
+    ds_tree_node_t                  node;
+} sm_neighbor_index_node_t;
+
+typedef struct
+{
+    ds_tree_t                       tree;
+    sm_neighbor_index_node_t       *nodes;
+    uint32_t                        size;
+    uint32_t                        qty;
+} sm_neighbor_index_t;
+
+static
+uint32_t sm_neighbor_list_qty(
+        dpp_neighbor_list_t        *neighbor_list)
+{
+    dpp_neighbor_record_list_t     *neighbor = NULL;
+    ds_dlist_iter_t                 neighbor_iter;
+    uint32_t                        qty = 0;
+
+    for (   neighbor = ds_dlist_ifirst(&neighbor_iter, neighbor_list);
+            neighbor != NULL;
+            neighbor = ds_dlist_inext(&neighbor_iter))
+    {
+        qty++;
+    }
+
+    return qty;
+}
+
+static
+dpp_neighbor_record_list_t *sm_neighbor_index_find(
+        sm_neighbor_index_t        *index,
+        char                       *bssid)
+{
+    sm_neighbor_index_node_t       *index_node;
+
+    index_node = ds_tree_find(&index->tree, bssid);
+    if (NULL == index_node) {
+        return NULL;
+    }
+
+    return index_node->record;
+}
+
+static
+bool sm_neighbor_index_add(
+        sm_neighbor_index_t        *index,
+        dpp_neighbor_record_list_t *neighbor)
+{
+    sm_neighbor_index_node_t       *index_node;
+
+    if (index->qty >= index->size) {
+        return false;
+    }
+
+    /* Keep the first record of a BSSID, as list lookups did */
+    if (NULL != sm_neighbor_index_find(index, neighbor->entry.bssid)) {
+        return true;
+    }
+
+    index_node = &index->nodes[index->qty++];
+    index_node->record = neighbor;
+    ds_tree_insert(&index->tree, index_node, neighbor->entry.bssid);
+
+    return true;
+}
+
+/* Index the records of a list, leaving room for extra ones */
+static
+bool sm_neighbor_index_init(
+        sm_neighbor_index_t        *index,
+        dpp_neighbor_list_t        *neighbor_list,
+        uint32_t                    extra)
+{
+    dpp_neighbor_record_list_t     *neighbor = NULL;
+    ds_dlist_iter_t                 neighbor_iter;
+
+    memset(index, 0, sizeof(*index));
+    ds_tree_init(
+            &index->tree,
+            ds_str_cmp,
+            sm_neighbor_index_node_t,
+            node);
+
+    index->size = sm_neighbor_list_qty(neighbor_list) + extra;
+    if (0 == index->size) {
+        return true;
+    }
+
+    index->nodes = calloc(index->size, sizeof(*index->nodes));
+    if (NULL == index->nodes) {
+        return false;
+    }
+
+    for (   neighbor = ds_dlist_ifirst(&neighbor_iter, neighbor_list);
+            neighbor != NULL;
+            neighbor = ds_dlist_inext(&neighbor_iter))
+    {
+        sm_neighbor_index_add(index, neighbor);
+    }
+
+    return true;
+}
+
+static
+void sm_neighbor_index_free(
+        sm_neighbor_index_t        *index)
+{
+    free(index->nodes);
+    memset(index, 0, sizeof(*index));
+}
+
 static
 bool sm_neighbor_results_clear(
         sm_neighbor_ctx_t          *neighbor_ctx,
@@ -287,25 +403,47 @@ bool sm_neighbor_report_send_diff(
     dpp_neighbor_record_list_t     *diff = NULL;
     dpp_neighbor_record_t          *diff_entry = NULL;
 
+    sm_neighbor_index_t             neighbor_index;
+    sm_neighbor_index_t             cache_index;
+
+    memset(&cache_index, 0, sizeof(cache_index));
+    status =
+        sm_neighbor_index_init(
+                &neighbor_index,
+                neighbor_list,
+                0);
+    if (true != status) {
+        LOGE("Processing %s %s neighbor diff report "
+             "(Failed to allocate memmory)",
+             radio_get_name_from_cfg(radio_cfg_ctx),
+             radio_get_scan_name_from_type(scan_type));
+        goto clear;
+    }
+    status =
+        sm_neighbor_index_init(
+                &cache_index,
+                &neighbor_ctx->diff_cache,
+                0);
+    if (true != status) {
+        LOGE("Processing %s %s neighbor diff report "
+             "(Failed to allocate memmory)",
+             radio_get_name_from_cfg(radio_cfg_ctx),
+             radio_get_scan_name_from_type(scan_type));
+        goto clear;
+    }
+
     /* Check for removed entries */
     for (   cache = ds_dlist_ifirst(&cache_iter, &neighbor_ctx->diff_cache);
             cache != NULL;
             cache = ds_dlist_inext(&cache_iter))
     {
         cache_entry = &cache->entry;
-        found = false;
 
         /* Search for existing entry in cache */
-        for (   neighbor = ds_dlist_ifirst(&neighbor_iter, neighbor_list);
-                neighbor != NULL;
-                neighbor = ds_dlist_inext(&neighbor_iter))
-        {
-            neighbor_entry = &neighbor->entry;
-            if (!strcmp (cache_entry->bssid, neighbor_entry->bssid)) {
-                found = true;
-                break;
-            }
-        }
+        found =
+            (NULL != sm_neighbor_index_find(
+                         &neighbor_index,
+                         cache_entry->bssid));
 
         /* Mark entry removed */
         if (!found) {
@@ -345,19 +483,12 @@ bool sm_neighbor_report_send_diff(
             neighbor = ds_dlist_inext(&neighbor_iter))
     {
         neighbor_entry = &neighbor->entry;
-        found = false;
 
         /* Search for existing entry in cache */
-        for (   cache = ds_dlist_ifirst(&cache_iter, &neighbor_ctx->diff_cache);
-                cache != NULL;
-                cache = ds_dlist_inext(&cache_iter))
-        {
-            cache_entry = &cache->entry;
-            if (!strcmp (cache_entry->bssid, neighbor_entry->bssid)) {
-                found = true;
-                break;
-            }
-        }
+        found =
+            (NULL != sm_neighbor_index_find(
+                         &cache_index,
+                         neighbor_entry->bssid));
 
         /* Mark entry added */
         if (!found) {
@@ -435,6 +566,9 @@ bool sm_neighbor_report_send_diff(
     }
 
 clear:
+    sm_neighbor_index_free(&neighbor_index);
+    sm_neighbor_index_free(&cache_index);
+
     status =
         sm_neighbor_results_clear(
                 neighbor_ctx,
@@ -578,7 +712,8 @@ void sm_neighbor_stats_results(
     dpp_neighbor_list_t            *neighbor_list = NULL;
     dpp_neighbor_record_list_t     *neighbor = NULL;
     dpp_neighbor_record_t          *neighbor_entry = NULL;
-    ds_dlist_iter_t                 neighbor_iter;
+
+    sm_neighbor_index_t             neighbor_index;
 
     mac_address_t                   mac;
     uint32_t                        found = 0;
@@ -587,6 +722,8 @@ void sm_neighbor_stats_results(
         return;
     }
 
+    memset(&neighbor_index, 0, sizeof(neighbor_index));
+
     neighbor_ctx    = (sm_neighbor_ctx_t *) scan_ctx;
     report_ctx      = &neighbor_ctx->report;
     radio_cfg_ctx   = neighbor_ctx->radio_cfg;
@@ -639,6 +776,21 @@ void sm_neighbor_stats_results(
         goto clear;
     }
 
+    /* Index the report records, new ones are added while merging */
+    rc =
+        sm_neighbor_index_init(
+                &neighbor_index,
+                neighbor_list,
+                sm_neighbor_list_qty(scan_list));
+    if (true != rc) {
+        LOG(ERR,
+            "Processing %s %s neighbor report "
+            "(Failed to allocate memmory)",
+            radio_get_name_from_cfg(radio_cfg_ctx),
+            radio_get_scan_name_from_type(scan_type));
+        goto clear;
+    }
+
     /* Loop through scan results store them in report */
     for (   scan = ds_dlist_ifirst(&scan_iter, scan_list);
             scan != NULL;
@@ -693,19 +845,16 @@ void sm_neighbor_stats_results(
         }
 
         /* Search for existing entry it */
-        for (   neighbor = ds_dlist_ifirst(&neighbor_iter, neighbor_list);
-                neighbor != NULL;
-                neighbor = ds_dlist_inext(&neighbor_iter))
-        {
-            neighbor_entry = &neighbor->entry;
-            if (!strcmp (scan_entry->bssid, neighbor_entry->bssid)) {
-                /* Update with latest value */
-                memcpy (neighbor_entry,
-                        scan_entry,
-                        sizeof (dpp_neighbor_record_t));
-                found = true;
-                break;
-            }
+        neighbor =
+            sm_neighbor_index_find(
+                    &neighbor_index,
+                    scan_entry->bssid);
+        if (NULL != neighbor) {
+            /* Update with latest value */
+            memcpy (&neighbor->entry,
+                    scan_entry,
+                    sizeof (dpp_neighbor_record_t));
+            found = true;
         }
 
         /* Add new entry to the end */
@@ -736,6 +885,7 @@ void sm_neighbor_stats_results(
                 neighbor_entry->chan);
 
             ds_dlist_insert_tail(neighbor_list, neighbor);
+            sm_neighbor_index_add(&neighbor_index, neighbor);
 
             scan_qty++;
             neighbor_ctx->neighbor_qty++;
@@ -768,6 +918,7 @@ void sm_neighbor_stats_results(
     }
 
 clear:
+    sm_neighbor_index_free(&neighbor_index);
     sm_neighbor_results_clear(
             neighbor_ctx,
             scan_list);
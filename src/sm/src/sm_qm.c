@@ -34,6 +34,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "log.h"
 
 #include "qm_conn.h"
+#include "qm_conn_async.h"
 #include "sm.h"
 
 #define MODULE_ID LOG_MODULE_ID_MAIN
@@ -41,13 +42,32 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /* Global MQTT instance */
 static struct ev_timer  sm_mqtt_timer;
 static uint8_t          sm_mqtt_buf[STATS_MQTT_BUF_SZ];
+static qm_conn_async_t  sm_qm_conn;
+
+static void sm_qm_res_cb(qm_conn_async_t *qa, qm_response_t *res, void *data)
+{
+    (void)qa;
+    (void)data;
+
+    if (res->response == QM_RESPONSE_ERROR) {
+        LOG(ERR, "Publish report failed: %s", qm_error_str(res->error));
+    }
+}
+
+static void sm_qm_backpressure_cb(qm_conn_async_t *qa, qm_response_t *res)
+{
+    if (!res) {
+        LOG(WARN, "QM not keeping up, %zu reports in flight",
+                qm_conn_async_inflight(qa));
+        return;
+    }
+    LOG(WARN, "QM dropped %u messages (queue length: %u size: %u)",
+            res->qdrop, res->qlen, res->qsize);
+}
 
 bool sm_mqtt_publish(long mlen, void *mbuf)
 {
-    qm_response_t res;
-    bool ret;
-    ret = qm_conn_send_stats(mbuf, mlen, &res);
-    return ret;
+    return qm_conn_async_send_stats(&sm_qm_conn, mbuf, mlen);
 }
 
 void sm_mqtt_timer_handler(struct ev_loop *loop, ev_timer *timer, int revents)
@@ -68,7 +88,7 @@ void sm_mqtt_timer_handler(struct ev_loop *loop, ev_timer *timer, int revents)
     LOG(DEBUG, "Total %d elements queued for transmission.\n", dpp_get_queue_elements());
 
     // Do not report any stats if QM is not running
-    if (!qm_conn_get_status(NULL)) {
+    if (!qm_conn_async_connect(&sm_qm_conn)) {
         if (!qm_err) {
             // don't repeat same error
             LOG(INFO, "Cannot connect to QM (QM not running?)");
@@ -98,6 +118,11 @@ void sm_mqtt_timer_handler(struct ev_loop *loop, ev_timer *timer, int revents)
 
 bool sm_mqtt_init(void)
 {
+    // Reports are pipelined to QM without waiting for the responses
+    qm_conn_async_init(&sm_qm_conn, EV_DEFAULT);
+    sm_qm_conn.res_cb = sm_qm_res_cb;
+    sm_qm_conn.backpressure_cb = sm_qm_backpressure_cb;
+
     // Start the MQTT report timer
     ev_timer_init(&sm_mqtt_timer, sm_mqtt_timer_handler,
             STATS_MQTT_INTERVAL, STATS_MQTT_INTERVAL);
@@ -108,5 +133,6 @@ bool sm_mqtt_init(void)
 void sm_mqtt_stop(void)
 {
     ev_timer_stop(EV_DEFAULT, &sm_mqtt_timer);
+    qm_conn_async_close(&sm_qm_conn);
     LOG(NOTICE, "Closing MQTT connection.");
 }
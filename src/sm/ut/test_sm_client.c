@@ -0,0 +1,442 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "unity.h"
+
+/*
+ * The record cache helpers are static, build them in. The conversion of
+ * the target samples is redirected to a stand-in so the test does not
+ * depend on the target layout beyond the common client fields.
+ */
+#define target_stats_clients_convert test_target_stats_clients_convert
+#include "sm_client_report.c"
+
+#define TEST_NUM_RADIOS 3
+#define TEST_NUM_CLIENTS 512
+#define TEST_NUM_SAMPLES 200
+
+const char *test_name = "sm_tests";
+
+/**
+ * @brief client sampling state of a radio
+ */
+struct test_radio
+{
+    radio_entry_t radio_cfg;
+    sm_client_ctx_t ctx;
+    ds_dlist_t first;
+    ds_dlist_t second;
+};
+
+static struct test_radio g_radios[TEST_NUM_RADIOS];
+
+static const radio_type_t g_radio_types[TEST_NUM_RADIOS] =
+{
+    RADIO_TYPE_2G,
+    RADIO_TYPE_5GL,
+    RADIO_TYPE_5GU,
+};
+
+
+void
+setUp(void)
+{
+}
+
+void
+tearDown(void)
+{
+}
+
+
+bool
+test_target_stats_clients_convert(radio_entry_t *radio_cfg,
+                                  target_client_record_t *client_list_new,
+                                  target_client_record_t *client_list_old,
+                                  dpp_client_record_t *client_record)
+{
+    memcpy(&client_record->info, &client_list_new->info,
+           sizeof(client_record->info));
+    return true;
+}
+
+
+/**
+ * @brief how a client shows up in the second sample
+ */
+enum test_client_state
+{
+    TEST_CLIENT_STAY,
+    TEST_CLIENT_GONE,       /* not reported anymore */
+    TEST_CLIENT_MOVED,      /* reported on another interface only */
+    TEST_CLIENT_COOKIE,     /* reported with a new stats cookie */
+    TEST_CLIENT_ROAMING,    /* reported on two other interfaces */
+    TEST_CLIENT_BOTH,       /* reported on the old and a new interface */
+};
+
+static enum test_client_state
+test_client_state(int idx)
+{
+    if (idx % 7 == 0) return TEST_CLIENT_GONE;
+    if (idx % 11 == 0) return TEST_CLIENT_MOVED;
+    if (idx % 13 == 0) return TEST_CLIENT_COOKIE;
+    if (idx % 17 == 0) return TEST_CLIENT_ROAMING;
+    if (idx % 19 == 0) return TEST_CLIENT_BOTH;
+    return TEST_CLIENT_STAY;
+}
+
+static bool
+test_client_disconnected(int idx)
+{
+    switch (test_client_state(idx))
+    {
+        case TEST_CLIENT_GONE:
+        case TEST_CLIENT_MOVED:
+        case TEST_CLIENT_COOKIE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+/**
+ * @brief appends a target client sample to a list
+ */
+static void
+test_client_add(ds_dlist_t *list, radio_type_t type, int idx, int vif,
+                uint64_t cookie)
+{
+    target_client_record_t *client;
+
+    client = calloc(1, sizeof(*client));
+    TEST_ASSERT_NOT_NULL(client);
+
+    client->info.type = type;
+    client->info.mac[0] = 0x02;
+    client->info.mac[1] = type;
+    client->info.mac[4] = idx >> 8;
+    client->info.mac[5] = idx & 0xff;
+    snprintf(client->info.ifname, sizeof(client->info.ifname), "wl%d.%d",
+             type, vif);
+    client->stats_cookie = cookie;
+
+    ds_dlist_insert_tail(list, client);
+}
+
+static void
+test_client_list_free(ds_dlist_t *list)
+{
+    target_client_record_t *client;
+    ds_dlist_iter_t iter;
+
+    for (client = ds_dlist_ifirst(&iter, list);
+         client != NULL;
+         client = ds_dlist_inext(&iter))
+    {
+        ds_dlist_iremove(&iter);
+        free(client);
+    }
+}
+
+
+/**
+ * @brief builds the radio contexts and the two client samples
+ *
+ * The first sample has every client on its home interface, the second
+ * one is derived from test_client_state().
+ */
+static void
+test_radios_init(void)
+{
+    struct test_radio *radio;
+    radio_type_t type;
+    int r;
+    int i;
+
+    memset(g_radios, 0, sizeof(g_radios));
+
+    for (r = 0; r < TEST_NUM_RADIOS; r++)
+    {
+        radio = &g_radios[r];
+        type = g_radio_types[r];
+
+        radio->radio_cfg.type = type;
+        snprintf(radio->radio_cfg.phy_name, sizeof(radio->radio_cfg.phy_name),
+                 "wifi%d", r);
+        snprintf(radio->radio_cfg.if_name, sizeof(radio->radio_cfg.if_name),
+                 "wl%d", type);
+
+        radio->ctx.radio_cfg = &radio->radio_cfg;
+        ds_dlist_init(&radio->ctx.record_list, sm_client_record_t, node);
+        ds_tree_init(&radio->ctx.record_tree, sm_client_record_key_cmp,
+                     sm_client_record_t, tnode);
+
+        ds_dlist_init(&radio->first, target_client_record_t, node);
+        ds_dlist_init(&radio->second, target_client_record_t, node);
+
+        for (i = 0; i < TEST_NUM_CLIENTS; i++)
+        {
+            test_client_add(&radio->first, type, i, 0, 1);
+
+            switch (test_client_state(i))
+            {
+                case TEST_CLIENT_STAY:
+                    test_client_add(&radio->second, type, i, 0, 1);
+                    break;
+                case TEST_CLIENT_GONE:
+                    break;
+                case TEST_CLIENT_MOVED:
+                    test_client_add(&radio->second, type, i, 1, 1);
+                    break;
+                case TEST_CLIENT_COOKIE:
+                    test_client_add(&radio->second, type, i, 0, 2);
+                    break;
+                case TEST_CLIENT_ROAMING:
+                    test_client_add(&radio->second, type, i, 1, 1);
+                    test_client_add(&radio->second, type, i, 2, 1);
+                    break;
+                case TEST_CLIENT_BOTH:
+                    test_client_add(&radio->second, type, i, 1, 1);
+                    test_client_add(&radio->second, type, i, 0, 1);
+                    break;
+            }
+        }
+
+        TEST_ASSERT_TRUE(sm_client_records_update(&radio->ctx, &radio->first,
+                                                  true));
+    }
+}
+
+static void
+test_radios_fini(void)
+{
+    struct test_radio *radio;
+    int r;
+
+    for (r = 0; r < TEST_NUM_RADIOS; r++)
+    {
+        radio = &g_radios[r];
+        sm_client_sm_records_clear(&radio->ctx, &radio->ctx.record_list);
+        TEST_ASSERT_TRUE(ds_tree_is_empty(&radio->ctx.record_tree));
+        test_client_list_free(&radio->first);
+        test_client_list_free(&radio->second);
+    }
+}
+
+
+/**
+ * @brief the records are indexed by MAC and radio type
+ */
+void
+test_client_records_index(void)
+{
+    target_client_record_t *client;
+    struct test_radio *radio;
+    sm_client_record_t *record;
+    ds_dlist_iter_t iter;
+    radio_type_t type;
+    int count;
+    int r;
+
+    test_radios_init();
+
+    for (r = 0; r < TEST_NUM_RADIOS; r++)
+    {
+        radio = &g_radios[r];
+
+        count = 0;
+        ds_dlist_foreach(&radio->ctx.record_list, record) count++;
+        TEST_ASSERT_EQUAL_INT(TEST_NUM_CLIENTS, count);
+
+        for (client = ds_dlist_ifirst(&iter, &radio->first);
+             client != NULL;
+             client = ds_dlist_inext(&iter))
+        {
+            record = sm_client_records_mac_find(&radio->ctx, client);
+            TEST_ASSERT_NOT_NULL(record);
+            TEST_ASSERT_EQUAL_MEMORY(client->info.mac, record->entry.info.mac,
+                                     sizeof(mac_address_t));
+            TEST_ASSERT_TRUE(record->entry.is_connected);
+            TEST_ASSERT_EQUAL_INT(1, record->entry.connected);
+
+            /* Same MAC on another band is another client */
+            type = client->info.type;
+            client->info.type = g_radio_types[(r + 1) % TEST_NUM_RADIOS];
+            TEST_ASSERT_NULL(sm_client_records_mac_find(&radio->ctx, client));
+            client->info.type = type;
+        }
+
+        /* A second sample of the same clients adds no record */
+        TEST_ASSERT_TRUE(sm_client_records_update(&radio->ctx, &radio->first,
+                                                  false));
+        count = 0;
+        ds_dlist_foreach(&radio->ctx.record_list, record) count++;
+        TEST_ASSERT_EQUAL_INT(TEST_NUM_CLIENTS, count);
+    }
+
+    test_radios_fini();
+}
+
+
+/**
+ * @brief the clients missing from a sample are marked disconnected
+ */
+void
+test_client_records_mark_disconnected(void)
+{
+    target_client_record_t client;
+    struct test_radio *radio;
+    sm_client_record_t *record;
+    bool disconnected;
+    int r;
+    int i;
+
+    test_radios_init();
+
+    for (r = 0; r < TEST_NUM_RADIOS; r++)
+    {
+        radio = &g_radios[r];
+
+        sm_client_records_mark_disconnected(&radio->ctx, &radio->second);
+
+        for (i = 0; i < TEST_NUM_CLIENTS; i++)
+        {
+            memset(&client, 0, sizeof(client));
+            client.info.type = g_radio_types[r];
+            client.info.mac[0] = 0x02;
+            client.info.mac[1] = g_radio_types[r];
+            client.info.mac[4] = i >> 8;
+            client.info.mac[5] = i & 0xff;
+
+            record = sm_client_records_mac_find(&radio->ctx, &client);
+            TEST_ASSERT_NOT_NULL(record);
+
+            disconnected = test_client_disconnected(i);
+            TEST_ASSERT_EQUAL_MESSAGE(!disconnected,
+                                      record->entry.is_connected,
+                                      "is_connected");
+            TEST_ASSERT_EQUAL_INT(disconnected ? 1 : 0,
+                                  record->entry.disconnected);
+        }
+
+        /* Marking again does not count the disconnections twice */
+        sm_client_records_mark_disconnected(&radio->ctx, &radio->second);
+        ds_dlist_foreach(&radio->ctx.record_list, record)
+        {
+            TEST_ASSERT_TRUE(record->entry.disconnected <= 1);
+        }
+
+        /* The reported clients reconnect, the gone ones stay away */
+        TEST_ASSERT_TRUE(sm_client_records_update(&radio->ctx, &radio->second,
+                                                  false));
+        for (i = 0; i < TEST_NUM_CLIENTS; i++)
+        {
+            client.info.mac[4] = i >> 8;
+            client.info.mac[5] = i & 0xff;
+
+            record = sm_client_records_mac_find(&radio->ctx, &client);
+            TEST_ASSERT_NOT_NULL(record);
+            TEST_ASSERT_EQUAL(test_client_state(i) != TEST_CLIENT_GONE,
+                              record->entry.is_connected);
+        }
+    }
+
+    test_radios_fini();
+}
+
+
+/**
+ * @brief times the per sample record matching of all radios
+ */
+void
+test_client_records_benchmark(void)
+{
+    target_client_record_t *client;
+    struct test_radio *radio;
+    struct timespec start;
+    struct timespec end;
+    ds_dlist_iter_t iter;
+    double ms;
+    int n;
+    int r;
+
+    test_radios_init();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (n = 0; n < TEST_NUM_SAMPLES; n++)
+    {
+        for (r = 0; r < TEST_NUM_RADIOS; r++)
+        {
+            radio = &g_radios[r];
+            sm_client_records_mark_disconnected(&radio->ctx, &radio->second);
+
+            for (client = ds_dlist_ifirst(&iter, &radio->second);
+                 client != NULL;
+                 client = ds_dlist_inext(&iter))
+            {
+                TEST_ASSERT_NOT_NULL(
+                        sm_client_records_mac_find(&radio->ctx, client));
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    LOGI("%s: %d clients x %d radios: %.3f ms per sample", __func__,
+         TEST_NUM_CLIENTS, TEST_NUM_RADIOS, ms / TEST_NUM_SAMPLES);
+
+    test_radios_fini();
+}
+
+
+void run_test_sm_neighbor(void);
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+
+    target_log_open("TEST", LOG_OPEN_STDOUT);
+    log_severity_set(LOG_SEVERITY_INFO);
+
+    UnityBegin(test_name);
+
+    RUN_TEST(test_client_records_index);
+    RUN_TEST(test_client_records_mark_disconnected);
+    RUN_TEST(test_client_records_benchmark);
+
+    run_test_sm_neighbor();
+
+    return UNITY_END();
+}
@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Stand-ins for the SM modules and target calls the report code under
+ * test depends on.
+ */
+
+#include "log.h"
+#include "sm.h"
+
+bool
+sm_rssi_is_reporting_enabled(radio_entry_t *radio_cfg)
+{
+    return false;
+}
+
+bool
+sm_rssi_stats_results_update(radio_entry_t *radio_cfg, mac_address_t mac,
+                             uint32_t rssi, uint64_t rx_ppdus,
+                             uint64_t tx_ppdus, rssi_source_t source)
+{
+    return true;
+}
+
+void
+sm_sanity_check_report_timestamp(const char *log_prefix,
+                                 uint64_t timestamp_ms,
+                                 uint64_t *reporting_timestamp,
+                                 uint64_t *report_ts)
+{
+}
+
+bool
+sm_scan_schedule(sm_scan_request_t *scan_request)
+{
+    return true;
+}
+
+bool
+sm_scan_schedule_stop(radio_entry_t *radio_cfg, radio_scan_type_t scan_type)
+{
+    return true;
+}
@@ -0,0 +1,251 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "const.h"
+#include "log.h"
+#include "util.h"
+#include "unity.h"
+
+/*
+ * The BSSID index is static, build the neighbor report in and feed it
+ * scan results through a stand-in of the target scan call.
+ */
+#define target_stats_scan_get test_target_stats_scan_get
+#include "sm_neighbor_report.c"
+
+#define TEST_SCAN_CHAN 6
+#define TEST_NUM_NEIGHBORS 300
+
+/**
+ * @brief neighbors returned by the next scan
+ */
+static dpp_neighbor_record_t g_scan[TEST_NUM_NEIGHBORS + 8];
+static size_t g_scan_qty;
+
+
+bool
+test_target_stats_scan_get(radio_entry_t *radio_cfg, uint32_t *chan_list,
+                           uint32_t chan_num, radio_scan_type_t scan_type,
+                           dpp_neighbor_report_data_t *scan_results)
+{
+    dpp_neighbor_record_list_t *neighbor;
+    size_t i;
+
+    for (i = 0; i < g_scan_qty; i++)
+    {
+        neighbor = dpp_neighbor_record_alloc();
+        TEST_ASSERT_NOT_NULL(neighbor);
+        memcpy(&neighbor->entry, &g_scan[i], sizeof(neighbor->entry));
+        ds_dlist_insert_tail(&scan_results->list, neighbor);
+    }
+
+    return true;
+}
+
+
+static void
+test_scan_add(int idx, uint32_t chan, int32_t sig)
+{
+    dpp_neighbor_record_t *entry;
+
+    TEST_ASSERT_TRUE(g_scan_qty < ARRAY_SIZE(g_scan));
+    entry = &g_scan[g_scan_qty++];
+
+    memset(entry, 0, sizeof(*entry));
+    entry->type = RADIO_TYPE_2G;
+    snprintf(entry->bssid, sizeof(entry->bssid), "02:00:00:00:%02x:%02x",
+             idx >> 8, idx & 0xff);
+    snprintf(entry->ssid, sizeof(entry->ssid), "ssid-%d", idx);
+    entry->chan = chan;
+    entry->sig = sig;
+}
+
+static dpp_neighbor_record_list_t *
+test_neighbor_find(dpp_neighbor_list_t *list, int idx, int *count)
+{
+    dpp_neighbor_record_list_t *found = NULL;
+    dpp_neighbor_record_list_t *neighbor;
+    char bssid[sizeof(neighbor->entry.bssid)];
+
+    snprintf(bssid, sizeof(bssid), "02:00:00:00:%02x:%02x",
+             idx >> 8, idx & 0xff);
+
+    *count = 0;
+    ds_dlist_foreach(list, neighbor)
+    {
+        if (strcmp(neighbor->entry.bssid, bssid) != 0) continue;
+        if (found == NULL) found = neighbor;
+        (*count)++;
+    }
+
+    return found;
+}
+
+
+/**
+ * @brief the index keeps the first record of a BSSID and its capacity
+ */
+void
+test_neighbor_index(void)
+{
+    dpp_neighbor_record_list_t records[4];
+    dpp_neighbor_record_list_t extra;
+    sm_neighbor_index_t index;
+    dpp_neighbor_list_t list;
+    size_t i;
+
+    ds_dlist_init(&list, dpp_neighbor_record_list_t, node);
+    memset(records, 0, sizeof(records));
+    for (i = 0; i < ARRAY_SIZE(records); i++)
+    {
+        snprintf(records[i].entry.bssid, sizeof(records[i].entry.bssid),
+                 "02:00:00:00:00:%02zx", i % 3);
+        ds_dlist_insert_tail(&list, &records[i]);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(4, sm_neighbor_list_qty(&list));
+    TEST_ASSERT_TRUE(sm_neighbor_index_init(&index, &list, 1));
+    TEST_ASSERT_EQUAL_UINT32(5, index.size);
+    TEST_ASSERT_EQUAL_UINT32(3, index.qty);
+
+    TEST_ASSERT_EQUAL_PTR(&records[0],
+                          sm_neighbor_index_find(&index, "02:00:00:00:00:00"));
+    TEST_ASSERT_EQUAL_PTR(&records[2],
+                          sm_neighbor_index_find(&index, "02:00:00:00:00:02"));
+    TEST_ASSERT_NULL(sm_neighbor_index_find(&index, "02:00:00:00:00:03"));
+
+    /* Adding a known BSSID does not use a slot */
+    TEST_ASSERT_TRUE(sm_neighbor_index_add(&index, &records[3]));
+    TEST_ASSERT_EQUAL_UINT32(3, index.qty);
+
+    memset(&extra, 0, sizeof(extra));
+    STRSCPY(extra.entry.bssid, "02:00:00:00:00:03");
+    TEST_ASSERT_TRUE(sm_neighbor_index_add(&index, &extra));
+    TEST_ASSERT_EQUAL_PTR(&extra,
+                          sm_neighbor_index_find(&index, "02:00:00:00:00:03"));
+
+    /* The index is full once the extra slots are used */
+    index.size = index.qty;
+    STRSCPY(records[3].entry.bssid, "02:00:00:00:00:04");
+    TEST_ASSERT_FALSE(sm_neighbor_index_add(&index, &records[3]));
+    TEST_ASSERT_NULL(sm_neighbor_index_find(&index, "02:00:00:00:00:04"));
+
+    sm_neighbor_index_free(&index);
+    TEST_ASSERT_NULL(index.nodes);
+
+    /* An empty list needs no node storage */
+    ds_dlist_init(&list, dpp_neighbor_record_list_t, node);
+    TEST_ASSERT_TRUE(sm_neighbor_index_init(&index, &list, 0));
+    TEST_ASSERT_NULL(sm_neighbor_index_find(&index, "02:00:00:00:00:00"));
+    sm_neighbor_index_free(&index);
+}
+
+
+/**
+ * @brief scan results are merged into the report by BSSID
+ */
+void
+test_neighbor_stats_results(void)
+{
+    dpp_neighbor_record_list_t *neighbor;
+    sm_neighbor_ctx_t ctx;
+    radio_entry_t radio_cfg;
+    int count;
+    int i;
+
+    memset(&radio_cfg, 0, sizeof(radio_cfg));
+    radio_cfg.type = RADIO_TYPE_2G;
+    STRSCPY(radio_cfg.phy_name, "wifi0");
+    STRSCPY(radio_cfg.if_name, "wl0");
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.radio_cfg = &radio_cfg;
+    ctx.scan_type = RADIO_SCAN_TYPE_ONCHAN;
+    ctx.chan_list.chan_list[0] = TEST_SCAN_CHAN;
+    ctx.chan_list.chan_num = 1;
+    ds_dlist_init(&ctx.report.list, dpp_neighbor_record_list_t, node);
+    ds_dlist_init(&ctx.results.list, dpp_neighbor_record_list_t, node);
+
+    /* First scan: a duplicate, a silent and an off channel neighbor */
+    g_scan_qty = 0;
+    for (i = 0; i < TEST_NUM_NEIGHBORS / 2; i++)
+    {
+        test_scan_add(i, TEST_SCAN_CHAN, 10);
+    }
+    test_scan_add(0, TEST_SCAN_CHAN, 20);
+    test_scan_add(TEST_NUM_NEIGHBORS, TEST_SCAN_CHAN, 0);
+    test_scan_add(TEST_NUM_NEIGHBORS + 1, TEST_SCAN_CHAN + 5, 10);
+
+    sm_neighbor_stats_results(&ctx, true);
+
+    TEST_ASSERT_EQUAL_UINT32(TEST_NUM_NEIGHBORS / 2, ctx.neighbor_qty);
+    TEST_ASSERT_EQUAL_UINT32(TEST_NUM_NEIGHBORS / 2,
+                             sm_neighbor_list_qty(&ctx.report.list));
+    TEST_ASSERT_TRUE(ds_dlist_is_empty(&ctx.results.list));
+
+    neighbor = test_neighbor_find(&ctx.report.list, 0, &count);
+    TEST_ASSERT_NOT_NULL(neighbor);
+    TEST_ASSERT_EQUAL_INT(1, count);
+    TEST_ASSERT_EQUAL_INT32(20, neighbor->entry.sig);
+    TEST_ASSERT_NULL(test_neighbor_find(&ctx.report.list,
+                                        TEST_NUM_NEIGHBORS, &count));
+    TEST_ASSERT_NULL(test_neighbor_find(&ctx.report.list,
+                                        TEST_NUM_NEIGHBORS + 1, &count));
+
+    /* Second scan: the known neighbors are updated, the new ones added */
+    g_scan_qty = 0;
+    for (i = 0; i < TEST_NUM_NEIGHBORS; i++)
+    {
+        test_scan_add(i, TEST_SCAN_CHAN, 30);
+    }
+
+    sm_neighbor_stats_results(&ctx, true);
+
+    TEST_ASSERT_EQUAL_UINT32(TEST_NUM_NEIGHBORS, ctx.neighbor_qty);
+    TEST_ASSERT_EQUAL_UINT32(TEST_NUM_NEIGHBORS,
+                             sm_neighbor_list_qty(&ctx.report.list));
+    for (i = 0; i < TEST_NUM_NEIGHBORS; i++)
+    {
+        neighbor = test_neighbor_find(&ctx.report.list, i, &count);
+        TEST_ASSERT_NOT_NULL(neighbor);
+        TEST_ASSERT_EQUAL_INT(1, count);
+        TEST_ASSERT_EQUAL_INT32(30, neighbor->entry.sig);
+    }
+
+    sm_neighbor_results_clear(&ctx, &ctx.report.list);
+}
+
+
+void
+run_test_sm_neighbor(void)
+{
+    RUN_TEST(test_neighbor_index);
+    RUN_TEST(test_neighbor_stats_results);
+}